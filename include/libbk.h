@@ -38,11 +38,20 @@ struct bk_addrgroup;
 struct bk_server_info;
 struct bk_netinfo;
 struct bk_polling_io;
+struct bk_queue;
 struct bk_ring;
 struct bk_stat_list;
 struct bk_stat_node;
 struct bk_threadlist;
 struct bk_threadnode;
+struct bk_shmalloc;
+struct bk_arena;
+struct bk_pool;
+struct bk_funsite;
+struct bk_funstat;
+struct bk_shmsnap;
+struct bk_binlog;
+struct bk_binlog_reader;
 
 #ifdef NEED_GLOBAL
 // Seth does not think we need a forward reference to global, but
@@ -310,6 +319,10 @@ struct bk_version
 #define bk_error_mark(B,m,F) bk_error_idump(B,BK_GENERAL_ERROR(B),m,F) ///< Mark a particular location in the error queue for future reference
 #define bk_error_clear(B,m,F) bk_error_iclear(B,BK_GENERAL_ERROR(B),m,F) ///< Delete a previously inserted mark
 #define bk_error_flush(B,m,F) bk_error_iflush(B,BK_GENERAL_ERROR(B),m,F) ///< Flush the error queue, from a mark if desired.
+#define bk_error_async(B,r,m,F) bk_error_iasync(B,BK_GENERAL_ERROR(B),r,m,F) ///< Hand messages to a background flusher through per-thread rings
+#define bk_error_sync(B) bk_error_isync(B,BK_GENERAL_ERROR(B)) ///< Handle messages in the raising thread again
+#define bk_error_dropped(B) bk_error_idropped(B,BK_GENERAL_ERROR(B)) ///< Messages dropped from full rings
+#define bk_error_binlog(B,b,l) bk_error_ibinlog(B,BK_GENERAL_ERROR(B),b,l) ///< Capture messages at or below a level in a binary log instead
 // @}
 
 
@@ -460,17 +473,14 @@ typedef union
  */
 typedef struct __bk_thread
 {
-  dict_h		bt_funstack;		///< Function stack
   struct bk_funinfo    *bt_curfun;		///< Current function
   const char	       *bt_threadname;		///< Thread name
   struct bk_general    *bt_general;		///< Common program state
-  struct bk_stat_list  *bt_funstats;		///< Function performance stats
   clockid_t		bt_cpu_clock;		///< CPU clock id
   bk_flags		bt_flags;		///< Flags for the future
 } *bk_s;
-#define BK_BT_FUNSTATS(B) (*((B) ? &((B)->bt_funstats):(struct bk_stat_list **)&bk_nullptr)) ///< Access the bk_general function statistics state
-#define BK_BT_ISFUNSTATSON(B) (BK_GENERAL_FUNSTATFILE(B) && BK_BT_FUNSTATS(B)) ///< Is fun stats on?
-#define BK_BT_FUNSTACK(B)	((B)->bt_funstack)   ///< Access the function stack
+#define BK_BT_ISFUNSTATSON(B) (BK_GENERAL_FUNSTATFILE(B) != NULL) ///< Is fun stats on?
+#define BK_BT_FUNSTACK(B)	(bk_fun_stack())     ///< Access the (calling thread's) function stack
 #define BK_BT_CURFUN(B)		((B)->bt_curfun)     ///< Access the current function
 #define BK_BT_THREADNAME(B)	((B)->bt_threadname) ///< Access the thread name
 #define BK_BT_GENERAL(B)	((B)->bt_general)    ///< Access the global shared info
@@ -860,8 +870,8 @@ struct bk_addrgroup
  * @brief Normal method to let function tracing know you have entered
  * function--if function tracing is enabled
  */
-#define BK_ENTRY(B, fun, pkg, grp) struct bk_funinfo *__bk_funinfo = (!B || !BK_GENERAL_FLAG_ISFUNON(B)?NULL:bk_fun_entry(B, fun, pkg, grp))
-#define BK_ENTRY_MAIN(B, fun, pkg, grp) struct bk_funinfo *__bk_funinfo = bk_fun_entry(B, fun, pkg, grp)
+#define BK_ENTRY(B, fun, pkg, grp) static struct bk_funsite *__bk_funsite; struct bk_funinfo *__bk_funinfo = (!B || !BK_GENERAL_FLAG_ISFUNON(B)?NULL:bk_fun_entry_i(B, fun, pkg, grp, &__bk_funsite))
+#define BK_ENTRY_MAIN(B, fun, pkg, grp) static struct bk_funsite *__bk_funsite; struct bk_funinfo *__bk_funinfo = bk_fun_entry_i(B, fun, pkg, grp, &__bk_funsite)
 
 
 
@@ -877,7 +887,7 @@ struct bk_addrgroup
  * stack, but the gcc-4 optimizer is too smart and optimizes the hack away, so
  * we must use the volatile declaration correctly.</TRICKY>
  */
-#define BK_ENTRY_VOLATILE(B, fun, pkg, grp) struct bk_funinfo *volatile __bk_funinfo = (!B || !BK_GENERAL_FLAG_ISFUNON(B)?NULL:bk_fun_entry(B, fun, pkg, grp))
+#define BK_ENTRY_VOLATILE(B, fun, pkg, grp) static struct bk_funsite *__bk_funsite; struct bk_funinfo *volatile __bk_funinfo = (!B || !BK_GENERAL_FLAG_ISFUNON(B)?NULL:bk_fun_entry_i(B, fun, pkg, grp, &__bk_funsite))
 
 
 
@@ -1260,7 +1270,25 @@ struct bk_funinfo
   const char *bf_pkgname;			///< Package name
   const char *bf_grpname;			///< Group name
   u_int32_t bf_debuglevel;			///< Per-function debug level
-  struct timeval bf_starttime;			///< If function stats on...
+  struct bk_funsite *bf_site;			///< Call site, if function stats or debugging on
+  u_int64_t bf_startns;				///< Monotonic entry time, if function stats on
+};
+
+
+
+/**
+ * The calling thread's function trace: a fixed array of frames, pushed
+ * and popped by index.  Frames past the capacity are only counted.
+ */
+struct bk_funstack
+{
+  volatile u_int	bfs_depth;		///< Frames in use
+  u_int			bfs_overflow;		///< Entries past capacity, not recorded
+#define BK_FUN_MAXDEPTH	256			///< Most frames recorded
+  struct bk_funinfo	bfs_frames[BK_FUN_MAXDEPTH]; ///< Frames, outermost first
+  struct bk_funstat    *bfs_stats;		///< Function statistics, indexed by call site
+  u_int			bfs_nstats;		///< Call sites in bfs_stats
+  struct bk_funstack   *bfs_next;		///< Next thread with function statistics
 };
 
 
@@ -1443,6 +1471,7 @@ struct bk_url
 #define BK_URL_FLAG_FRAGMENT		0x10	///< Fragment section set.
 #define BK_URL_FLAG_HOST		0x20	///< Host authority section set.
 #define BK_URL_FLAG_SERV		0x40	///< Service authority section set.
+#define BK_URL_FLAG_ARENA		0x80	///< Storage belongs to an arena (destroy does nothing).
 #define BK_URL_FLAG_ALL (BK_URL_FLAG_SCHEME | BK_URL_FLAG_AUTHORITY | BK_URL_FLAG_PATH | BK_URL_FLAG_QUERY | BK_URL_FLAG_FRAGMENT) ///< Convenience "sections" flag for bk_url_reconstruct
   bk_url_parse_mode_e		bu_mode;	///< Mode of URL
   char *			bu_url;		///< Entire URL
@@ -1730,6 +1759,7 @@ extern void bk_debug_iprintf(bk_s B, struct bk_debug *bdinfo, const char *format
 extern void bk_debug_iprintbuf(bk_s B, struct bk_debug *bdinfo, const char *intro, const char *prefix, const bk_vptr *buf);
 extern void bk_debug_ivprintf(bk_s B, struct bk_debug *bdinfo, const char *format, va_list ap) __attribute__ ((format (printf, 3, 0)));
 extern FILE *bk_debug_istream(struct bk_debug *bdfinfo);
+extern void bk_debug_binlog(bk_s B, struct bk_debug *bdinfo, struct bk_binlog *bbl);
 
 
 
@@ -1757,13 +1787,49 @@ extern void bk_error_ivprintf(bk_s B, int sysloglevel, struct bk_error *beinfo,
 extern void bk_error_idump(bk_s B, struct bk_error *beinfo, FILE *fh, const char *mark, int minimumlevel, int sysloglevel, bk_flags flags);
 extern char *bk_error_istrdump(bk_s B, struct bk_error *beinfo, const char *mark, int minimumlevel, bk_flags flags);
 extern void bk_error_irepeater_flush(bk_s B, struct bk_error *beinfo, bk_flags flags);
+#ifdef BK_USING_PTHREADS
+extern int bk_error_iasync(bk_s B, struct bk_error *beinfo, u_int32_t ringsize, time_t msecs, bk_flags flags);
+#define BK_ERROR_ASYNC_BLOCK			0x1 ///< Wait for room in a full ring rather than drop the message
+#define BK_ERROR_ASYNC_BLOCK_HI			0x2 ///< Wait for room only for messages at or above the hi-lo pivot
+#define BK_ERROR_ASYNC_RINGSIZE_DEFAULT		65536 ///< Default bytes of messages pending per thread
+#define BK_ERROR_ASYNC_RINGSIZE_MIN		4096 ///< Smallest ring
+#define BK_ERROR_ASYNC_MSECS_DEFAULT		100 ///< Default longest wait of a low priority message
+extern void bk_error_isync(bk_s B, struct bk_error *beinfo);
+extern u_int64_t bk_error_idropped(bk_s B, struct bk_error *beinfo);
+#endif /* BK_USING_PTHREADS */
+extern void bk_error_ibinlog(bk_s B, struct bk_error *beinfo, struct bk_binlog *bbl, int level);
+
+
+
+/* b_binlog.c */
+/**
+ * One message read back from a binary log
+ */
+struct bk_binlog_entry
+{
+  struct timespec	bble_time;		///< When the message was raised
+  u_int32_t		bble_tid;		///< Thread number of the raiser
+  int			bble_level;		///< BK_ERR level, or BK_ERR_NONE for debugging output
+  const char	       *bble_funname;		///< Function raising the message (NULL if unknown)
+  const char	       *bble_msg;		///< Formatted message
+};
+extern struct bk_binlog *bk_binlog_create(bk_s B, const char *filename, u_int32_t bufsize, bk_flags flags);
+#define BK_BINLOG_BUFSIZE_DEFAULT		262144 ///< Default bytes of records buffered per thread
+extern void bk_binlog_destroy(bk_s B, struct bk_binlog *bbl);
+extern int bk_binlog_flush(bk_s B, struct bk_binlog *bbl);
+extern void bk_binlog_iprintf(bk_s B, struct bk_binlog *bbl, int level, const char *funname, const char *format, ...) __attribute__ ((format (printf, 5, 6)));
+extern void bk_binlog_ivprintf(bk_s B, struct bk_binlog *bbl, int level, const char *funname, const char *format, va_list ap) __attribute__ ((format (printf, 5, 0)));
+extern struct bk_binlog_reader *bk_binlog_open(bk_s B, const char *filename, bk_flags flags);
+extern void bk_binlog_close(bk_s B, struct bk_binlog_reader *bblr);
+extern const char *bk_binlog_program(bk_s B, struct bk_binlog_reader *bblr, pid_t *pidp);
+extern int bk_binlog_read(bk_s B, struct bk_binlog_reader *bblr, struct bk_binlog_entry *bble, bk_flags flags);
 
 
 
 /* b_fun.c */
-extern dict_h bk_fun_init(void);
-extern void bk_fun_destroy(dict_h funstack);
+extern struct bk_funstack *bk_fun_stack(void);
 extern struct bk_funinfo *bk_fun_entry(bk_s B, const char *func, const char *package, const char *group);
+extern struct bk_funinfo *bk_fun_entry_i(bk_s B, const char *func, const char *package, const char *group, struct bk_funsite **sitep);
 extern void bk_fun_exit(bk_s B, struct bk_funinfo *fh);
 extern void bk_fun_reentry_i(bk_s B, struct bk_funinfo *fh);
 extern void bk_fun_trace(bk_s B, FILE *out, int sysloglevel, bk_flags flags);
@@ -1772,6 +1838,8 @@ extern void bk_fun_set(bk_s B, int state, bk_flags flags);
 #define BK_FUN_ON	1			///< Turn on function tracing in @a bk_fun_set
 extern const char *bk_fun_funname(bk_s B, int ancestordepth, bk_flags flags);
 extern int bk_fun_reset_debug(bk_s B, bk_flags flags);
+extern int bk_fun_stats_dump(bk_s B, FILE *out, bk_flags flags);
+#define BK_FUN_STATS_DUMP_HTML	0x01		///< HTML table rather than CSV for @a bk_fun_stats_dump
 
 
 /* b_funlist.c */
@@ -1785,17 +1853,41 @@ extern int bk_funlist_delete(bk_s B, struct bk_funlist *funlist, void (*bf_fun)(
 /* b_memx.c */
 extern const size_t bk_memx_size;
 extern struct bk_memx *bk_memx_create(bk_s B, size_t objsize, u_int start_hint, u_int incr_hint, bk_flags flags);
+#define BK_MEMX_GEOMETRIC	  1		///< Grow by half the current allocation at a time in @a bk_memx_create
 extern void bk_memx_destroy(bk_s B, struct bk_memx *bm, bk_flags flags);
 #define BK_MEMX_PRESERVE_ARRAY    1		///< Don't destroy created array in @a bk_memx_destroy
 extern void *bk_memx_get(bk_s B, struct bk_memx *bm, u_int count, u_int *curused, bk_flags flags);
 #define BK_MEMX_GETNEW		  1		///< Get new allocation in @a bk_memx_get
 #define bk_memx_new(B, bm, count, curused, flags) bk_memx_get((B), (bm), (count), (curused), (flags)|BK_MEMX_GETNEW) ///< For alex
 extern int bk_memx_addstr(bk_s B, struct bk_memx *bm, char *str, bk_flags flags);
+extern int bk_memx_reserve(bk_s B, struct bk_memx *bm, u_int count, bk_flags flags);
 extern int bk_memx_trunc(bk_s B, struct bk_memx *bm, u_int count, bk_flags flags);
 extern int bk_memx_lop(bk_s B, struct bk_memx *bm, u_int count, bk_flags flags);
 extern int bk_memx_append(bk_s B, struct bk_memx *bm, const void *data, u_int count, bk_flags flags);
 extern int bk_memx_info(bk_s B, struct bk_memx *bm, void **arrayp, size_t *unitesizep, size_t *curallocp, size_t *curusedp, u_int *incrp, bk_flags *flagsp, bk_flags flags);
 
+/* b_arena.c */
+/**
+ * A point in an arena's allocation history, to release back to
+ */
+struct bk_arena_mark
+{
+  void		       *bam_chunk;		///< Newest chunk at the time
+  char		       *bam_cur;		///< Allocation point
+  char		       *bam_end;		///< End of current chunk
+  void		       *bam_cleanup;		///< Newest cleanup at the time
+};
+extern struct bk_arena *bk_arena_create(bk_s B, size_t chunksize, bk_flags flags);
+extern void bk_arena_destroy(bk_s B, struct bk_arena *arena, bk_flags flags);
+extern void *bk_arena_alloc(bk_s B, struct bk_arena *arena, size_t size, bk_flags flags);
+#define BK_ARENA_ZERO		0x01		///< Clear allocated memory
+extern char *bk_arena_strdup(bk_s B, struct bk_arena *arena, const char *str);
+extern char *bk_arena_strndup(bk_s B, struct bk_arena *arena, const char *str, size_t len);
+extern int bk_arena_cleanup(bk_s B, struct bk_arena *arena, void (*fun)(bk_s B, void *obj), void *obj, bk_flags flags);
+extern int bk_arena_mark(bk_s B, struct bk_arena *arena, struct bk_arena_mark *mark);
+extern void bk_arena_release(bk_s B, struct bk_arena *arena, const struct bk_arena_mark *mark, bk_flags flags);
+extern void bk_arena_reset(bk_s B, struct bk_arena *arena, bk_flags flags);
+
 /* b_run.c */
 extern struct bk_run *bk_run_init(bk_s B, bk_flags flags);
 #define BK_RUN_WANT_SIGNALTHREAD		0x01 ///< Tell bk_run that we only want signal processing on this thread--the one which is initializing bk_run_init
@@ -1982,6 +2074,7 @@ extern void bk_ssl_destroy(bk_s B, void *ssl, bk_flags flags);
 
 /* b_sysutils.c */
 extern char *bk_gethostname(bk_s B);
+extern size_t bk_hugepagesize(bk_s B);
 
 
 /* b_strcode.c */
@@ -2061,6 +2154,7 @@ extern u_int bk_bufhash(const bk_vptr *b, bk_flags flags);
 #define BK_HASH_STRING		0x01		///< String hash if len=1/2/4/8 (UNUSED AND DEPRECATED!!!!)
 
 extern char **bk_string_tokenize_split(bk_s B, const char *src, u_int limit, const char *spliton, const char *braces, const dict_h kvht_vardb, const char **variabledb, bk_flags flags);
+extern char **bk_string_tokenize_split_arena(bk_s B, struct bk_arena *arena, const char *src, u_int limit, const char *spliton, const char *braces, const dict_h kvht_vardb, const char **variabledb, bk_flags flags);
 #define BK_WHITESPACE					" \t\r\n" ///< General definition of horizonal and vertical whitespace
 #define BK_VWHITESPACE					"\r\n" ///< General definition of vertical whitespace
 #define BK_HWHITESPACE					" \t" ///< General definition of horizontal whitespace
@@ -2127,6 +2221,46 @@ extern int bk_bloomfilter_add(bk_s B, struct bk_bloomfilter *bf, const void *key
 extern int bk_bloomfilter_is_present(bk_s B, struct bk_bloomfilter *bf, const void *key, const int len);
 extern void bk_bloomfilter_printkey(bk_s B, struct bk_bloomfilter *bf, const void *key, const int len, FILE *fh);
 
+/* b_sketch.c */
+/**
+ * One heavy hitter reported by bk_topk_list()
+ */
+struct bk_topk_item
+{
+  u_int64_t		bti_count;		///< Estimated count (never below the true count)
+  size_t		bti_keylen;		///< Key length
+  const void *		bti_key;		///< Key (part of the list allocation)
+};
+extern struct bk_hll *bk_hll_create(bk_s B, u_int precision, bk_flags flags);
+#define BK_HLL_PRECISION_DEFAULT	14	///< 16K registers, about 0.8% standard error
+extern void bk_hll_destroy(bk_s B, struct bk_hll *hll);
+extern int bk_hll_add(bk_s B, struct bk_hll *hll, const void *key, size_t len);
+extern u_int64_t bk_hll_count(bk_s B, struct bk_hll *hll);
+extern int bk_hll_merge(bk_s B, struct bk_hll *dst, struct bk_hll *src, bk_flags flags);
+extern void bk_hll_clear(bk_s B, struct bk_hll *hll);
+extern struct bk_topk *bk_topk_create(bk_s B, u_int k, u_int width, u_int depth, size_t maxkey, bk_flags flags);
+#define BK_TOPK_K_DEFAULT		10	///< Heavy hitters tracked
+#define BK_TOPK_WIDTH_DEFAULT		2048	///< Counters per row: overestimates under 0.14% of the total
+#define BK_TOPK_DEPTH_DEFAULT		4	///< Rows: that bound holds with 98% probability
+#define BK_TOPK_MAXKEY_DEFAULT		64	///< Longest key
+extern void bk_topk_destroy(bk_s B, struct bk_topk *topk);
+extern int bk_topk_add(bk_s B, struct bk_topk *topk, const void *key, size_t len, u_int64_t weight);
+extern u_int64_t bk_topk_estimate(bk_s B, struct bk_topk *topk, const void *key, size_t len);
+extern u_int64_t bk_topk_total(bk_s B, struct bk_topk *topk);
+extern struct bk_topk_item *bk_topk_list(bk_s B, struct bk_topk *topk, u_int *countp, bk_flags flags);
+extern void bk_topk_list_destroy(bk_s B, struct bk_topk_item *items);
+extern int bk_topk_merge(bk_s B, struct bk_topk *dst, struct bk_topk *src, bk_flags flags);
+extern void bk_topk_clear(bk_s B, struct bk_topk *topk);
+extern struct bk_quantile *bk_quantile_create(bk_s B, double accuracy, u_int bins, bk_flags flags);
+#define BK_QUANTILE_ACCURACY_DEFAULT	0.01	///< Quantiles within 1%
+#define BK_QUANTILE_BINS_DEFAULT	4096	///< Covers about 1e-17 to 1e17 at 1%
+extern void bk_quantile_destroy(bk_s B, struct bk_quantile *q);
+extern int bk_quantile_add(bk_s B, struct bk_quantile *q, double value);
+extern int bk_quantile_get(bk_s B, struct bk_quantile *q, double pct, double *valuep, bk_flags flags);
+extern u_int64_t bk_quantile_count(bk_s B, struct bk_quantile *q);
+extern int bk_quantile_merge(bk_s B, struct bk_quantile *dst, struct bk_quantile *src, bk_flags flags);
+extern void bk_quantile_clear(bk_s B, struct bk_quantile *q);
+
 /* b_sprintf.c */
 extern char *bk_string_alloc_sprintf(bk_s B, u_int chunk, bk_flags flags, const char *fmt, ...) __attribute__ ((format (printf, 4, 5)));
 
@@ -2157,6 +2291,7 @@ extern int bk_netinfo_delete_addr(bk_s B, struct bk_netinfo *bni, struct bk_neta
 extern int bk_netinfo_set_primary_address(bk_s B, struct bk_netinfo *bni, struct bk_netaddr *bna);
 extern int bk_netinfo_reset_primary_address(bk_s B, struct bk_netinfo *bni);
 extern struct bk_netinfo *bk_netinfo_clone(bk_s B, struct bk_netinfo *obni);
+extern struct bk_netinfo *bk_netinfo_clone_arena(bk_s B, struct bk_arena *arena, struct bk_netinfo *obni);
 extern int bk_netinfo_update_servent(bk_s B, struct bk_netinfo *bni, struct servent *s);
 extern int bk_netinfo_update_protoent(bk_s B, struct bk_netinfo *bni, struct protoent *p);
 extern int bk_netinfo_update_hostent(bk_s B, struct bk_netinfo *bni, struct hostent *h);
@@ -2305,6 +2440,7 @@ extern int bk_time_ntp_parse(bk_s B, const char *src, struct timespec *dst, bk_f
 /* b_url.c */
 extern struct bk_url *bk_url_parse(bk_s B, const char *url_in, bk_url_parse_mode_e mode, bk_flags flags);
 #define BK_URL_FLAG_STRICT_PARSE	0x1	///< Don't do BAKA fuzzy logic.
+extern struct bk_url *bk_url_parse_arena(bk_s B, struct bk_arena *arena, const char *url_in, bk_url_parse_mode_e mode, bk_flags flags);
 extern struct bk_url *bk_url_create(bk_s B);
 extern void bk_url_destroy(bk_s B, struct bk_url *bu);
 extern char *bk_url_unescape(bk_s B, const char *urlcomponent);
@@ -2480,7 +2616,11 @@ extern int bk_dllvault_destroyhelp(bk_vault_t V);
 
 /* b_stats.c */
 extern struct bk_stat_list *bk_stat_create(bk_s B, bk_flags flags);
+#define BK_STATS_HISTOGRAM			0x200 ///< Keep latency histograms (for percentiles)
+#define BK_STATS_SHARDED			0x400 ///< Record into per-thread shards, without node locks
 extern void bk_stat_destroy(bk_s B, struct bk_stat_list *blist);
+extern int bk_stat_percentiles_set(bk_s B, struct bk_stat_list *blist, const double *pcts, u_int npcts, bk_flags flags);
+#define BK_STAT_MAXPCTS		8		///< Most percentiles a dump reports
 extern struct bk_stat_node *bk_stat_nodelist_create(bk_s B, struct bk_stat_list *blist, const char *name1, const char *name2, bk_flags flags);
 extern struct bk_stat_node *bk_stat_node_create(bk_s B, const char *name1, const char *name2, bk_flags flags);
 #define BK_STATS_NO_LOCKS_NEEDED		0x100
@@ -2502,6 +2642,12 @@ extern void bk_stat_add(bk_s B, struct bk_stat_list *blist, const char *name1, c
 //#define BK_STATS_NO_LOCKS_NEEDED		0x100
 extern void bk_stat_node_add(bk_s B, struct bk_stat_node *bnode, u_quad_t usec, bk_flags flags);
 //#define BK_STATS_NO_LOCKS_NEEDED		0x100
+extern int bk_stat_percentile(bk_s B, struct bk_stat_list *blist, const char *name1, const char *name2, double pct, u_quad_t *usec, bk_flags flags);
+//#define BK_STATS_NO_LOCKS_NEEDED		0x100
+extern int bk_stat_node_percentile(bk_s B, struct bk_stat_node *bnode, double pct, u_quad_t *usec, bk_flags flags);
+//#define BK_STATS_NO_LOCKS_NEEDED		0x100
+extern void bk_stat_node_merge(bk_s B, struct bk_stat_node *dst, struct bk_stat_node *src, bk_flags flags);
+//#define BK_STATS_NO_LOCKS_NEEDED		0x100
 
 /* b_thread.c */
 extern struct bk_threadlist *bk_threadlist_create(bk_s B, bk_flags flags);
@@ -2529,6 +2675,15 @@ extern int bk_thread_cancel(bk_s B, pthread_t tid, bk_flags flags);
 
 
 /* b_ringbuf.c */
+extern struct bk_queue *bk_queue_create(bk_s B, u_int size, bk_flags flags);
+extern void bk_queue_destroy(bk_s B, struct bk_queue *queue, bk_flags flags);
+#define BK_QUEUE_WAIT			0x1000	///< Block until there is room/an object (threaded only)
+extern void bk_queue_close(bk_s B, struct bk_queue *queue, bk_flags flags);
+extern int bk_queue_enqueue(bk_s B, struct bk_queue *queue, void *obj, bk_flags flags);
+extern int bk_queue_dequeue(bk_s B, struct bk_queue *queue, void **objp, bk_flags flags);
+extern int bk_queue_enqueue_batch(bk_s B, struct bk_queue *queue, void **objs, u_int cnt, bk_flags flags);
+extern int bk_queue_dequeue_batch(bk_s B, struct bk_queue *queue, void **objs, u_int cnt, bk_flags flags);
+extern int bk_queue_length(bk_s B, struct bk_queue *queue, bk_flags flags);
 extern struct bk_ring *bk_ring_create(bk_s B, u_int size, bk_flags flags);
 extern void bk_ring_destroy(bk_s B, struct bk_ring *ring, bk_flags flags);
 //#define BK_RING_WAIT			0x1000	///< Wait for ring to drain of data
@@ -2858,6 +3013,7 @@ struct bk_shmmap_client
 #define BK_SHMMAP_USER_STATEINIT	0x1da8		///< Bucket initialized by client
 #define BK_SHMMAP_USER_STATEREADY	0xea7b		///< Bucket ready by client
 #define BK_SHMMAP_USER_STATECLOSE	0xfcc7		///< Bucket detached/closed by client
+#define BK_SHMMAP_USER_STATERECLAIM	0x3e1d		///< Bucket's allocator cache being reclaimed by creator
 };
 
 
@@ -2874,12 +3030,13 @@ struct bk_shmmap_header
   void	       *sh_user;				///< Start of user space
   off_t		sh_size;				///< Actual segment size
   off_t		sh_usersize;				///< User segment size
-  time_t	sh_creatortime;				///< Freshness of creator
+  u_int64_t	sh_heartbeat;				///< Creator liveness counter (bumped every sh_fresh/2 seconds)
+  u_int64_t	sh_beatms;				///< bk_shmmap_nowms() at last heartbeat
   u_int		sh_fresh;				///< How fresh creator's time must be for liveness
   u_short	sh_numclients;				///< Number of clients in array
   u_short	sh_numattach;				///< Number of clients known attached
   u_short	sh_state;				///< State of SHMMAP (non-listed values == un-initialized)
-#define BK_SHMMAP_READY		0xfeed			///< Creator signal ready for operations (sh_creatortime must be sh_fresh)
+#define BK_SHMMAP_READY		0xfeed			///< Creator signal ready for operations (sh_beatms must be sh_fresh)
 #define BK_SHMMAP_CLOSE		0xdead			///< Creator signal destroy
   struct bk_shmmap_client sh_client[];			///< Array of clients
 };
@@ -2913,13 +3070,43 @@ struct bk_shmmap_cmds
 
 
 
+/**
+ * @brief Milliseconds on the system-wide monotonic clock, for shmmap
+ * heartbeats (the coarse clock is read from the vDSO without a syscall)
+ */
+static inline u_int64_t bk_shmmap_nowms(void)
+{
+  struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC_COARSE
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else /* CLOCK_MONOTONIC_COARSE */
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif /* CLOCK_MONOTONIC_COARSE */
+  return((u_int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/**
+ * @brief Is the creator's last heartbeat within the fresh interval?  The
+ * heartbeat is loaded before the clock is read: the other order would let
+ * a beat stored in between look like one from the far future.
+ */
+static inline int bk_shmmap_beatfresh(struct bk_shmmap_header *sh)
+{
+  u_int64_t beat = __atomic_load_n(&sh->sh_beatms, __ATOMIC_ACQUIRE);
+
+  return(beat + sh->sh_fresh * 1000ULL > bk_shmmap_nowms());
+}
+
 // Test if shmmap is active and fresh
-#define BK_SHMMAP_ISFRESH(sm) (((sm)->sm_addr->sh_state == BK_SHMMAP_READY) && (((sm)->sm_addr->sh_creatortime + (sm)->sm_addr->sh_fresh > time(NULL))))
+#define BK_SHMMAP_ISFRESH(sm) (((sm)->sm_addr->sh_state == BK_SHMMAP_READY) && bk_shmmap_beatfresh((sm)->sm_addr))
 #define BK_SHMMAP_VALIDATE(sm) (BK_SHMMAP_ISFRESH(sm)?1:bk_shmmap_validate(NULL, (sm)))
 
 
 
 extern struct bk_shmmap *bk_shmmap_create(bk_s B, const char *name, u_short max_clients, off_t size, mode_t mode, void *addr, u_int fresh, bk_flags flags);
+#define BK_SHMMAP_MEMFD		0x01		///< Segment is a memfd located through the shm name (Linux only)
+#define BK_SHMMAP_HUGEPAGE	0x02		///< Back segment with huge pages (hugetlb with BK_SHMMAP_MEMFD, else transparent)
 extern struct bk_shmmap *bk_shmmap_attach(bk_s B, const char *shmname, const char *myname, bk_flags flags);
 #define BK_SHMMAP_ATTACH_RETRYABLE ((void *)-1)
 extern void bk_shmmap_destroy(bk_s B, struct bk_shmmap *shmmap, bk_flags flags);
@@ -2927,6 +3114,34 @@ extern pthread_t *bk_shmmap_manage_thread(bk_s B, struct bk_shmmap *shmmap);
 extern void bk_shmmap_manage(bk_s B, struct bk_shmmap *shmmap, bk_flags flags);
 #define BK_SHMMAP_MANAGE_POLL 1			///< Poll, do not sleep, for one group of management changes
 extern int bk_shmmap_validate(bk_s B, struct bk_shmmap *shmmap);
+extern size_t bk_shmsnap_size(size_t len);
+extern struct bk_shmsnap *bk_shmsnap_init(bk_s B, void *mem, size_t len, bk_flags flags);
+extern int bk_shmsnap_publish(bk_s B, struct bk_shmsnap *snap, const void *data, size_t len, bk_flags flags);
+extern void *bk_shmsnap_begin(bk_s B, struct bk_shmsnap *snap, bk_flags flags);
+#define BK_SHMSNAP_COPY		0x01		///< Start the new snapshot as a copy of the current one
+extern void bk_shmsnap_commit(bk_s B, struct bk_shmsnap *snap, bk_flags flags);
+extern ssize_t bk_shmsnap_read(bk_s B, struct bk_shmsnap *snap, void *buf, size_t len, u_int64_t *versionp, bk_flags flags);
+#define BK_SHMSNAP_NOWAIT	0x01		///< Give up (EAGAIN) rather than retry a torn copy
+extern u_int64_t bk_shmsnap_version(struct bk_shmsnap *snap);
+
+
+/* b_shmalloc.c */
+typedef u_int64_t bk_shmoff_t;			///< Offset from start of a shmmap segment (same in every process)
+#define BK_SHMOFF_NULL		((bk_shmoff_t)0)	///< Offset equivalent of NULL
+#define BK_SHMOFF_PTR(sm, off)	((off) ? (void *)((char *)(sm)->sm_addr + (off)) : NULL) ///< Offset to local pointer
+#define BK_SHMOFF_OFF(sm, ptr)	((ptr) ? (bk_shmoff_t)((char *)(ptr) - (char *)(sm)->sm_addr) : BK_SHMOFF_NULL) ///< Local pointer to offset
+#define BK_SHMOFF_LOAD(p)	__atomic_load_n((p), __ATOMIC_ACQUIRE)	///< Read a shared offset link
+#define BK_SHMOFF_STORE(p, off)	__atomic_store_n((p), (off), __ATOMIC_RELEASE) ///< Publish a shared offset link
+#define BK_SHMOFF_CAS(p, expp, off) __atomic_compare_exchange_n((p), (expp), (off), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ///< Swing a shared offset link (*expp updated on failure)
+#define BK_SHMALLOC_NROOTS	16		///< Application rendezvous offsets in allocator header
+extern struct bk_shmalloc *bk_shmalloc_init(bk_s B, struct bk_shmmap *shmmap, bk_flags flags);
+#define BK_SHMALLOC_RESET	0x01		///< Creator discards any existing allocator state
+extern void bk_shmalloc_destroy(bk_s B, struct bk_shmalloc *sa, bk_flags flags);
+extern bk_shmoff_t bk_shmalloc_alloc(bk_s B, struct bk_shmalloc *sa, size_t size, bk_flags flags);
+#define BK_SHMALLOC_ZERO	0x01		///< Clear allocated memory
+extern void bk_shmalloc_free(bk_s B, struct bk_shmalloc *sa, bk_shmoff_t off, bk_flags flags);
+extern bk_shmoff_t *bk_shmalloc_root(bk_s B, struct bk_shmalloc *sa, u_int which);
+extern u_int bk_shmalloc_reclaim(bk_s B, struct bk_shmmap *shmmap, bk_flags flags);
 
 
 /* b_shmipc.c */
@@ -2937,9 +3152,26 @@ typedef enum
   BkShmIpcCreateStale=2,			///< Could have failed due to stale shared memory
   BkShmIpcCreateTimeout=3,			///< Failed due to timeout
 } bk_shmipc_failure_e;
+/**
+ * Information about one reader of a broadcast shmipc ring
+ */
+struct bk_shmipc_readerinfo
+{
+  u_int			bsri_slot;		///< Reader slot number
+  pid_t			bsri_pid;		///< Reader process
+  u_int64_t		bsri_lag;		///< Bytes written but not yet read
+  u_int64_t		bsri_overruns;		///< Times the writer lapped this reader
+  u_int64_t		bsri_lostbytes;		///< Bytes skipped because of overruns
+};
 extern struct bk_shmipc *bk_shmipc_create(bk_s B, const char *name, u_int timeoutus, u_int initus, u_int spinus, u_int size, u_int mode, bk_shmipc_failure_e *failure_reason, bk_flags flags);
 #define BK_SHMIPC_RDONLY	0x01		///< Read only activity
 #define BK_SHMIPC_WRONLY	0x02		///< Write only activity
+#define BK_SHMIPC_FUTEX		0x04		///< Sleep in kernel (futex) instead of polling when blocked (writer chooses)
+#define BK_SHMIPC_OVERWRITE	0x08		///< Broadcast: overwrite data slow readers have not read instead of blocking
+#define BK_SHMIPC_NOTIFY	0x10		///< Writer offers reader an eventfd signaled when ring becomes non-empty (Linux only)
+#define BK_SHMIPC_MEMFD		0x20		///< Ring lives in a memfd handed to the reader instead of SysV shm (Linux only, writer chooses)
+#define BK_SHMIPC_HUGEPAGE	0x40		///< Back ring with huge pages (hugetlb, else transparent) (writer chooses)
+extern struct bk_shmipc *bk_shmipc_broadcast_create(bk_s B, const char *name, u_int timeoutus, u_int initus, u_int spinus, u_int size, u_int maxreaders, u_int mode, bk_shmipc_failure_e *failure_reason, bk_flags flags);
 extern void bk_shmipc_destroy(bk_s B, struct bk_shmipc *bsi, bk_flags flags);
 extern ssize_t bk_shmipc_write(bk_s B, struct bk_shmipc *bsi, void *data, size_t len, u_int timeoutus, bk_flags flags);
 #define BK_SHMIPC_NOBLOCK	0x01		///< Do not block
@@ -2950,8 +3182,18 @@ extern ssize_t bk_shmipc_read(bk_s B, struct bk_shmipc *bsi, void *data, size_t
 #define BK_SHMIPC_READALL	0x02		///< Do not succeed without reading everything
 extern bk_vptr *bk_shmipc_readall(bk_s B, struct bk_shmipc *bsi, size_t maxbytes, u_int timeoutus, bk_flags flags);
 //#define BK_SHMIPC_NOBLOCK	0x01		///< Do not block
+extern int bk_shmipc_write_reserve(bk_s B, struct bk_shmipc *bsi, size_t len, struct iovec *iov, u_int timeoutus, bk_flags flags);
+//#define BK_SHMIPC_NOBLOCK	0x01		///< Do not block
+extern int bk_shmipc_write_commit(bk_s B, struct bk_shmipc *bsi, size_t len, bk_flags flags);
+extern int bk_shmipc_read_peek(bk_s B, struct bk_shmipc *bsi, size_t len, struct iovec *iov, u_int timeoutus, bk_flags flags);
+//#define BK_SHMIPC_NOBLOCK	0x01		///< Do not block
+extern int bk_shmipc_read_consume(bk_s B, struct bk_shmipc *bsi, size_t len, bk_flags flags);
+extern int bk_shmipc_notify_fd(bk_s B, struct bk_shmipc *bsi, bk_flags flags);
+extern int bk_shmipc_notify_drain(bk_s B, struct bk_shmipc *bsi, bk_flags flags);
 extern int bk_shmipc_peek(bk_s B, struct bk_shmipc *bsi, size_t *bytesreadable, size_t *byteswritable, u_int *buffersize, int *numothers, bk_flags flags);
 extern int bk_shmipc_errno(bk_s B, struct bk_shmipc *bsi, bk_flags flags);
+extern int bk_shmipc_readers(bk_s B, struct bk_shmipc *bsi, struct bk_shmipc_readerinfo *info, u_int maxinfo, bk_flags flags);
+extern int bk_shmipc_readersbyname(bk_s B, const char *name, struct bk_shmipc_readerinfo *info, u_int maxinfo, bk_flags flags);
 extern int bk_shmipc_cancel(bk_s B, struct bk_shmipc *bsi, bk_flags flags);
 extern int bk_shmipc_remove(bk_s B, const char *name, bk_flags flags);
 extern int bk_shmipc_peekbyname(bk_s B, const char *name, u_int32_t *magic, u_int32_t *generation, u_int32_t *ringsize, u_int32_t *offset, u_int32_t *writehand, u_int32_t *readhand, size_t *bytesreadable, size_t *byteswritable, int *numothers, size_t *segsize, bk_flags flags);
@@ -3069,7 +3311,17 @@ extern double bk_erfinv(double x);
 
 
 /**
- * Type of dynamic stat values
+ * Type of dynamic stat values.  Rate and Window are derived types kept in
+ * constant space with O(1) updates: a Rate counts events (its Int64 value
+ * is the running total; adds are events, sets are a new total) and a
+ * Window samples a gauge (its Int64 value is the latest sample).  Both
+ * report windowed figures through bk_dynamic_stat_window_get().
+ *
+ * Cardinality, TopK and Quantile are fixed-size sketches (see b_sketch.c)
+ * fed through bk_dynamic_stat_handle_observe(); plain sets and adds
+ * observe the Int64 value itself (as a key, or as a Quantile sample).
+ * Their Int64 value is the distinct count, total weight or sample count;
+ * bk_dynamic_stat_sketch() returns the sketch for queries and merges.
  */
 typedef enum
 {
@@ -3080,6 +3332,11 @@ typedef enum
   DynamicStatsValueTypeFloat,
   DynamicStatsValueTypeDouble,
   DynamicStatsValueTypeString,
+  DynamicStatsValueTypeRate,
+  DynamicStatsValueTypeWindow,
+  DynamicStatsValueTypeCardinality,
+  DynamicStatsValueTypeTopK,
+  DynamicStatsValueTypeQuantile,
 } bk_dynamic_stats_value_type_e;
 
 
@@ -3113,6 +3370,87 @@ typedef int (*bk_dynamic_stat_update_h)(bk_s B, bk_dynamic_stats_h stats_list, b
 #define DynamicStatsAccessTypeNative	DynamicStatsAccessTypeDirect
 #define DynamicStatsAccessTypePointer	DynamicStatsAccessTypeIndirect
 
+
+
+/**
+ * Windowed figures of a Rate or Window dynamic stat, over the last 1, 10
+ * and 60 complete seconds.  For a Rate they are events per second; for a
+ * Window, the mean sample.  The EWMA is of the same per-second figure,
+ * with a time constant of BK_DYNAMIC_STAT_EWMA_SECS.
+ */
+struct bk_dynamic_stat_window_values
+{
+  int64_t		bdswv_value;		///< Total (Rate) or latest sample (Window)
+  double		bdswv_1s;		///< Last second
+  double		bdswv_10s;		///< Last ten seconds
+  double		bdswv_60s;		///< Last minute
+  double		bdswv_ewma;		///< Exponentially weighted moving average
+  int64_t		bdswv_min;		///< Smallest second (Rate) or sample (Window) in the last minute
+  int64_t		bdswv_max;		///< Largest second (Rate) or sample (Window) in the last minute
+};
+#define BK_DYNAMIC_STAT_EWMA_SECS	60	///< Time constant of windowed stat EWMAs
+
+
+
+/**
+ * Shared memory export of a dynamic statistics list.  The segment starts
+ * with this header, padded to a cache line, and is followed by a
+ * bk_shmsnap area at bdseh_snapoff.  Each published snapshot is a
+ * bk_dynamic_stats_export_snapshot followed by bdses_count records, so a
+ * reader needs nothing but the segment to interpret it.
+ */
+struct bk_dynamic_stats_export_header
+{
+  u_int32_t		bdseh_magic;		///< BK_DYNAMIC_STATS_EXPORT_MAGIC once initialized
+#define BK_DYNAMIC_STATS_EXPORT_MAGIC	0x64797374	///< "dyst"
+  u_int32_t		bdseh_version;		///< Layout version
+#define BK_DYNAMIC_STATS_EXPORT_VERSION	1		///< Current layout version
+  u_int64_t		bdseh_size;		///< Size of the whole segment
+  u_int64_t		bdseh_snapoff;		///< Offset of the bk_shmsnap area
+  u_int64_t		bdseh_beatms;		///< bk_shmmap_nowms() at last publication
+  int64_t		bdseh_pid;		///< Exporting process
+};
+
+
+/**
+ * Header of one exported snapshot
+ */
+struct bk_dynamic_stats_export_snapshot
+{
+  u_int32_t		bdses_count;		///< Number of records which follow
+  u_int32_t		bdses_truncated;	///< Number of stats which did not fit
+  int64_t		bdses_generated;	///< Wall clock time (seconds) snapshot was taken
+};
+
+
+/**
+ * One exported statistic.  The name (and for strings, the value) follow
+ * the fixed part; records are padded to eight bytes.  All integer types
+ * are widened to 64 bits and float types to double.
+ */
+struct bk_dynamic_stats_export_record
+{
+  u_int32_t		bdser_len;		///< Length of this record, including padding
+  u_int16_t		bdser_type;		///< bk_dynamic_stats_value_type_e of the stat
+  u_int16_t		bdser_namelen;		///< Length of name (without NUL)
+  u_int32_t		bdser_priority;		///< Priority of the stat
+  u_int32_t		bdser_pad;		///< Alignment
+  int64_t		bdser_discriminator;	///< Discriminator of the stat
+  union
+  {
+    int64_t		bdserv_int;		///< Signed integer types
+    u_int64_t		bdserv_uint;		///< Unsigned integer types
+    double		bdserv_double;		///< Floating point types
+  }			bdser_value;		///< Value (strings follow the name instead)
+  char			bdser_name[];		///< NUL terminated name, then string value if any
+};
+#define BK_DYNAMIC_STATS_EXPORT_FIRST(snap)	((struct bk_dynamic_stats_export_record *)((struct bk_dynamic_stats_export_snapshot *)(snap) + 1)) ///< First record of a snapshot
+#define BK_DYNAMIC_STATS_EXPORT_NEXT(rec)	((struct bk_dynamic_stats_export_record *)((char *)(rec) + (rec)->bdser_len)) ///< Record following @a rec
+#define BK_DYNAMIC_STATS_EXPORT_STRING(rec)	((rec)->bdser_name + (rec)->bdser_namelen + 1) ///< String value of a string record
+
+struct bk_dynamic_stats_export;
+struct bk_dynamic_stats_collector;
+
 // b_dyn_stats.c
 extern bk_dynamic_stats_h bk_dynamic_stats_create(bk_s B, bk_flags flags);
 extern void bk_dynamic_stats_destroy(bk_s B, bk_dynamic_stats_h stats_list);
@@ -3134,6 +3472,12 @@ extern int bk_dynamic_stat_attr_update(bk_s B, bk_dynamic_stats_h stats_list, co
 #define BK_DYNAMIC_STAT_UPDATE_FLAG_DESTROY_CALLBACK	0x11
 #define BK_DYNAMIC_STAT_UPDATE_FLAG_DESTROY_OPAQUE	0x12
 extern int bk_dynamic_stat_increment(bk_s B, bk_dynamic_stats_h *stats_list, const char *name, long discriminator, bk_flags flags, ...);
+extern int bk_dynamic_stat_handle_add(bk_s B, bk_dynamic_stat_h dyn_stat, int64_t incr, bk_flags flags);
+#define bk_dynamic_stat_handle_increment(B, dyn_stat) bk_dynamic_stat_handle_add((B), (dyn_stat), 1, 0) ///< Bump a counter by one through its handle
+extern int bk_dynamic_stat_handle_set(bk_s B, bk_dynamic_stat_h dyn_stat, int64_t value, bk_flags flags);
+extern int bk_dynamic_stat_window_get(bk_s B, bk_dynamic_stat_h dyn_stat, struct bk_dynamic_stat_window_values *values, bk_flags flags);
+extern int bk_dynamic_stat_handle_observe(bk_s B, bk_dynamic_stat_h dyn_stat, const void *key, size_t keylen, int64_t value, bk_flags flags);
+extern void *bk_dynamic_stat_sketch(bk_s B, bk_dynamic_stat_h dyn_stat, bk_flags flags);
 extern int bk_dynamic_stats_getnext(bk_s B, bk_dynamic_stats_h stats_list, bk_dynamic_stat_h *statp, u_int priority, bk_dynamic_stats_value_type_e *typep, bk_dynamic_stat_value_u *valuep, bk_flags flags);
 extern char *bk_dynamic_stats_XML_create(bk_s B, bk_dynamic_stats_h stats_list, u_int priority, const char *prefix, bk_flags flags);
 extern void bk_dynamic_stats_XML_destroy(bk_s B, const char *xml_str, bk_flags flags);
@@ -3152,6 +3496,38 @@ extern int bk_dynamic_stat_set_threadid(bk_s B, bk_dynamic_stat_h dstat, pthread
 #else /* BK_USING_PTHREADS */
 extern int bk_dynamic_stat_set_threadid(bk_s B, bk_dynamic_stat_h dstat, u_long tid, bk_flags flags);
 #endif /* BK_USING_PTHREADS */
+extern struct bk_dynamic_stats_export *bk_dynamic_stats_export_create(bk_s B, bk_dynamic_stats_h stats_list, const char *name, size_t maxbytes, u_int priority, mode_t mode, struct bk_run *run, time_t msecs, bk_flags flags);
+extern int bk_dynamic_stats_export_update(bk_s B, struct bk_dynamic_stats_export *bdse, bk_flags flags);
+extern void bk_dynamic_stats_export_destroy(bk_s B, struct bk_dynamic_stats_export *bdse, bk_flags flags);
+#define BK_DYNAMIC_STATS_EXPORT_KEEP	0x01		///< Leave the segment in place on destroy
+extern struct bk_dynamic_stats_export *bk_dynamic_stats_export_attach(bk_s B, const char *name, bk_flags flags);
+extern struct bk_dynamic_stats_export_snapshot *bk_dynamic_stats_export_read(bk_s B, struct bk_dynamic_stats_export *bdse, u_int64_t *versionp, u_int64_t *agemsp, bk_flags flags);
+extern int64_t bk_dynamic_stats_export_pid(bk_s B, struct bk_dynamic_stats_export *bdse);
+extern struct bk_dynamic_stats_collector *bk_dynamic_stats_collector_create(bk_s B, bk_dynamic_stats_h stats_list, struct bk_run *run, time_t msecs, bk_flags flags);
+#define BK_DYNAMIC_STATS_COLLECTOR_MSECS_DEFAULT	1000	///< Default system stats sampling interval
+extern int bk_dynamic_stats_collector_sample(bk_s B, struct bk_dynamic_stats_collector *bdsc, bk_flags flags);
+extern u_int64_t bk_dynamic_stats_collector_samples(bk_s B, struct bk_dynamic_stats_collector *bdsc);
+extern void bk_dynamic_stats_collector_destroy(bk_s B, struct bk_dynamic_stats_collector *bdsc, bk_flags flags);
+
+/* b_pool.c */
+extern struct bk_pool *bk_pool_create(bk_s B, const char *name, size_t objsize, u_int batch, bk_flags flags);
+extern void bk_pool_destroy(bk_s B, struct bk_pool *pool, bk_flags flags);
+extern struct bk_pool *bk_pool_static(bk_s B, struct bk_pool **poolp, const char *name, size_t objsize);
+/** Process-lifetime pool held in @a pool (a static pointer), created on first use */
+#define BK_POOL_STATIC(B, pool, name, size) (__atomic_load_n(&(pool), __ATOMIC_ACQUIRE) ?: bk_pool_static((B), &(pool), (name), (size)))
+extern void *bk_pool_alloc(bk_s B, struct bk_pool *pool, bk_flags flags);
+#define BK_POOL_ZERO		0x01		///< Clear allocated object
+extern void bk_pool_free(bk_s B, struct bk_pool *pool, void *obj);
+extern int bk_pool_stats_register(bk_s B, bk_dynamic_stats_h stats_list, bk_flags flags);
+extern void bk_pool_stats_deregister(bk_s B, bk_dynamic_stats_h stats_list);
+
+/* b_profile.c */
+extern int bk_profile_start(bk_s B, u_int hz, u_int maxsamples, const char *path, bk_flags flags);
+#define BK_PROFILE_ATEXIT	0x01		///< Dump to the profile path at exit
+extern void bk_profile_stop(bk_s B, bk_flags flags);
+extern int bk_profile_dump(bk_s B, FILE *out, bk_flags flags);
+#define BK_PROFILE_DUMP_RESET	0x01		///< Start a new profile after dumping
+extern int bk_profile_dump_on_signal(bk_s B, struct bk_run *run, int signum, bk_flags flags);
 
 
 // b_patricia/radix (triesh) which handles bit patters, strings, and ipv4/v6 addresses
@@ -107,6 +107,7 @@ struct bk_ioh
 #ifdef BK_USING_PTHREADS
 extern pthread_mutex_t BkGlobalSignalLock;
 #endif /* BK_USING_PTHREADS */
+extern u_int32_t bk_debug_generation;
 
 
 /* FRIENDLY FUNCTIONS */
@@ -123,6 +124,10 @@ extern int bk_netutils_start_service_verbose_std(bk_s B, struct bk_run *run, con
 /* b_addrgroup (why?) */
 extern int bk_netutils_commandeer_service_std(bk_s B, struct bk_run *run, int s, const char *securenets, bk_bag_callback_f callback, void *args, bk_flags flags);
 
+/* b_binlog.c */
+extern int bk_binlog_hold(void);
+extern void bk_binlog_unhold(int phase);
+
 /* b_ioh.c */
 extern struct bk_ioh *bk_ioh_init_std(bk_s B, int fdin, int fdout, bk_iohhandler_f handler, void *opaque, u_int32_t inbufhint, u_int32_t inbufmax, u_int32_t outbufmax, struct bk_run *run, bk_flags flags);
 
@@ -0,0 +1,507 @@
+#if !defined(lint)
+static const char libbk__copyright[] = "Copyright © 2011";
+static const char libbk__contact[] = "<projectbaka@baka.org>";
+#endif /* not lint */
+/*
+ * ++Copyright BAKA++
+ *
+ * Copyright © 2011 The Authors. All rights reserved.
+ *
+ * This source code is licensed to you under the terms of the file
+ * LICENSE.TXT in this release for further details.
+ *
+ * Send e-mail to <projectbaka@baka.org> for further information.
+ *
+ * - -Copyright BAKA- -
+ */
+
+/**
+ * @file
+ *
+ * Region (arena) allocation for request-scoped memory.
+ *
+ * Allocation bumps a pointer through a chunk; when the chunk runs out a
+ * new one is chained on.  Nothing is freed individually: the caller takes
+ * a mark and later releases everything allocated since, or resets the
+ * whole arena, typically once per request.  Objects which own memory the
+ * arena did not provide (dicts, sockets, ...) can register a cleanup,
+ * which is run when the allocation point passes back over it.
+ *
+ * Allocations bigger than a quarter of a chunk get a chunk of their own,
+ * and the current chunk stays current, so one big string does not waste
+ * the rest of it.  Reset keeps a few standard chunks around so a steady
+ * request load does not go back to malloc at all.
+ */
+
+#include <libbk.h>
+#include "libbk_internal.h"
+
+
+
+#define ARENA_ALIGN		16		///< Alignment of every allocation
+#define ARENA_DEFCHUNK		8192		///< Default chunk size (bytes of data)
+#define ARENA_MAXSPARE		4		///< Standard chunks kept after a reset
+#define ARENA_ROUND(x)		(((x) + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1)) ///< Round up to alignment
+
+
+
+/**
+ * One chunk of arena memory.  Data follows the (aligned) header.
+ */
+struct arena_chunk
+{
+  struct arena_chunk   *ac_next;		///< Next older chunk
+  size_t		ac_size;		///< Bytes of data
+};
+#define ARENA_CHUNKHDR		ARENA_ROUND(sizeof(struct arena_chunk)) ///< Header size, aligned
+#define ARENA_CHUNKDATA(ac)	((char *)(ac) + ARENA_CHUNKHDR) ///< Start of chunk data
+
+
+
+/**
+ * A cleanup to run when the arena is released past it
+ */
+struct arena_cleanup
+{
+  struct arena_cleanup *acl_next;		///< Next older cleanup
+  void		      (*acl_fun)(bk_s B, void *obj); ///< Function to call
+  void		       *acl_obj;		///< Its argument
+};
+
+
+
+/**
+ * Arena state
+ */
+struct bk_arena
+{
+  struct arena_chunk   *ba_chunks;		///< All chunks, newest first
+  char		       *ba_cur;			///< Next free byte in current chunk
+  char		       *ba_end;			///< End of current chunk
+  struct arena_cleanup *ba_cleanups;		///< Cleanups, newest first
+  struct arena_chunk   *ba_spare;		///< Standard chunks saved by reset
+  u_int			ba_nspare;		///< Number of spare chunks
+  size_t		ba_chunksize;		///< Standard chunk data size
+  struct bk_arena_mark	ba_base;		///< Mark of the empty arena
+  bk_flags		ba_flags;		///< Fun for the future
+};
+
+
+
+static struct arena_chunk *arena_chunk_get(bk_s B, struct bk_arena *arena, size_t size);
+static void arena_chunk_put(bk_s B, struct bk_arena *arena, struct arena_chunk *ac);
+
+
+
+/**
+ * Create an arena, with its first chunk.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state.
+ *	@param chunksize Data bytes per chunk (0 for a default)
+ *	@param flags Fun for the future
+ *	@return <i>NULL</i> on failure.<br>
+ *	@return <br><i>arena</i> on success.
+ */
+struct bk_arena *bk_arena_create(bk_s B, size_t chunksize, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_arena *arena;
+
+  if (!BK_CALLOC(arena))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate arena: %s\n", strerror(errno));
+    BK_RETURN(B, NULL);
+  }
+  arena->ba_chunksize = ARENA_ROUND(chunksize ? chunksize : ARENA_DEFCHUNK);
+  arena->ba_flags = flags;
+
+  if (!(arena->ba_chunks = arena_chunk_get(B, arena, arena->ba_chunksize)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate first arena chunk\n");
+    free(arena);
+    BK_RETURN(B, NULL);
+  }
+  arena->ba_chunks->ac_next = NULL;
+  arena->ba_cur = ARENA_CHUNKDATA(arena->ba_chunks);
+  arena->ba_end = arena->ba_cur + arena->ba_chunks->ac_size;
+
+  bk_arena_mark(B, arena, &arena->ba_base);
+
+  BK_RETURN(B, arena);
+}
+
+
+
+/**
+ * Destroy an arena, running any outstanding cleanups and freeing
+ * everything allocated from it.
+ *
+ * THREADS: MT-SAFE (as long as arena is thread-private)
+ *
+ *	@param B BAKA thread/global state.
+ *	@param arena Arena
+ *	@param flags Fun for the future
+ */
+void bk_arena_destroy(bk_s B, struct bk_arena *arena, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct arena_chunk *ac;
+
+  if (!arena)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_VRETURN(B);
+  }
+
+  bk_arena_reset(B, arena, 0);
+
+  while ((ac = arena->ba_chunks))
+  {
+    arena->ba_chunks = ac->ac_next;
+    free(ac);
+  }
+  while ((ac = arena->ba_spare))
+  {
+    arena->ba_spare = ac->ac_next;
+    free(ac);
+  }
+  free(arena);
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Allocate memory from an arena.  It is never freed individually; see
+ * bk_arena_release() and bk_arena_reset().
+ *
+ * THREADS: MT-SAFE (as long as arena is thread-private)
+ *
+ *	@param B BAKA thread/global state.
+ *	@param arena Arena
+ *	@param size Bytes wanted
+ *	@param flags BK_ARENA_ZERO to clear the memory
+ *	@return <i>NULL</i> on failure.<br>
+ *	@return <br><i>memory</i> (ARENA_ALIGN aligned) on success.
+ */
+void *bk_arena_alloc(bk_s B, struct bk_arena *arena, size_t size, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct arena_chunk *ac;
+  void *ret;
+
+  if (!arena)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_RETURN(B, NULL);
+  }
+
+  // Rounding up would wrap to 0
+  if (size > ((size_t)-1) - ARENA_ALIGN)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Cannot allocate %lu bytes from an arena\n", (u_long)size);
+    BK_RETURN(B, NULL);
+  }
+
+  size = ARENA_ROUND(BK_MAX(size, 1));
+
+  if (size <= (size_t)(arena->ba_end - arena->ba_cur))
+  {
+    ret = arena->ba_cur;
+    arena->ba_cur += size;
+  }
+  else if (size > arena->ba_chunksize / 4)
+  {
+    // Big: a chunk of its own, leaving the current chunk current
+    if (!(ac = arena_chunk_get(B, arena, size)))
+      BK_RETURN(B, NULL);
+    ac->ac_next = arena->ba_chunks;
+    arena->ba_chunks = ac;
+    ret = ARENA_CHUNKDATA(ac);
+  }
+  else
+  {
+    if (!(ac = arena_chunk_get(B, arena, arena->ba_chunksize)))
+      BK_RETURN(B, NULL);
+    ac->ac_next = arena->ba_chunks;
+    arena->ba_chunks = ac;
+    ret = ARENA_CHUNKDATA(ac);
+    arena->ba_cur = (char *)ret + size;
+    arena->ba_end = (char *)ret + ac->ac_size;
+  }
+
+  if (BK_FLAG_ISSET(flags, BK_ARENA_ZERO))
+    memset(ret, 0, size);
+
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Copy a string into an arena.
+ *
+ * THREADS: MT-SAFE (as long as arena is thread-private)
+ *
+ *	@param B BAKA thread/global state.
+ *	@param arena Arena
+ *	@param str String to copy
+ *	@return <i>NULL</i> on failure.<br>
+ *	@return <br><i>copy</i> on success.
+ */
+char *bk_arena_strdup(bk_s B, struct bk_arena *arena, const char *str)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!str)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_RETURN(B, NULL);
+  }
+
+  BK_RETURN(B, bk_arena_strndup(B, arena, str, strlen(str)));
+}
+
+
+
+/**
+ * Copy at most len bytes of a string into an arena, NUL terminated.
+ *
+ * THREADS: MT-SAFE (as long as arena is thread-private)
+ *
+ *	@param B BAKA thread/global state.
+ *	@param arena Arena
+ *	@param str String to copy
+ *	@param len Most bytes to copy
+ *	@return <i>NULL</i> on failure.<br>
+ *	@return <br><i>copy</i> on success.
+ */
+char *bk_arena_strndup(bk_s B, struct bk_arena *arena, const char *str, size_t len)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  const char *nul;
+  char *ret;
+
+  if (!arena || !str)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_RETURN(B, NULL);
+  }
+
+  if ((nul = memchr(str, '\0', len)))
+    len = nul - str;
+
+  if (!(ret = bk_arena_alloc(B, arena, len + 1, 0)))
+    BK_RETURN(B, NULL);
+
+  memcpy(ret, str, len);
+  ret[len] = '\0';
+
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Register a function to be called on an object when the arena is
+ * released or reset back past this point (or destroyed).  Cleanups run
+ * newest first.
+ *
+ * THREADS: MT-SAFE (as long as arena is thread-private)
+ *
+ *	@param B BAKA thread/global state.
+ *	@param arena Arena
+ *	@param fun Function to call
+ *	@param obj Its argument
+ *	@param flags Fun for the future
+ *	@return <i>-1</i> on failure (fun has not been called).<br>
+ *	@return <br><i>0</i> on success.
+ */
+int bk_arena_cleanup(bk_s B, struct bk_arena *arena, void (*fun)(bk_s B, void *obj), void *obj, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct arena_cleanup *acl;
+
+  if (!arena || !fun)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (!(acl = bk_arena_alloc(B, arena, sizeof(*acl), 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate arena cleanup\n");
+    BK_RETURN(B, -1);
+  }
+  acl->acl_fun = fun;
+  acl->acl_obj = obj;
+  acl->acl_next = arena->ba_cleanups;
+  arena->ba_cleanups = acl;
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Remember the current allocation point, to release back to later.
+ *
+ * THREADS: MT-SAFE (as long as arena is thread-private)
+ *
+ *	@param B BAKA thread/global state.
+ *	@param arena Arena
+ *	@param mark Copy-out mark
+ *	@return <i>-1</i> on call failure.<br>
+ *	@return <br><i>0</i> on success.
+ */
+int bk_arena_mark(bk_s B, struct bk_arena *arena, struct bk_arena_mark *mark)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!arena || !mark)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  mark->bam_chunk = arena->ba_chunks;
+  mark->bam_cur = arena->ba_cur;
+  mark->bam_end = arena->ba_end;
+  mark->bam_cleanup = arena->ba_cleanups;
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Free everything allocated since a mark was taken, running cleanups
+ * registered since then.  Marks taken after this one become invalid.
+ *
+ * THREADS: MT-SAFE (as long as arena is thread-private)
+ *
+ *	@param B BAKA thread/global state.
+ *	@param arena Arena
+ *	@param mark Mark from bk_arena_mark()
+ *	@param flags Fun for the future
+ */
+void bk_arena_release(bk_s B, struct bk_arena *arena, const struct bk_arena_mark *mark, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct arena_cleanup *acl;
+  struct arena_chunk *ac;
+
+  if (!arena || !mark)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_VRETURN(B);
+  }
+
+  // Cleanups first: their records live in the chunks we are about to drop
+  while ((acl = arena->ba_cleanups) && acl != mark->bam_cleanup)
+  {
+    arena->ba_cleanups = acl->acl_next;
+    (*acl->acl_fun)(B, acl->acl_obj);
+  }
+
+  while ((ac = arena->ba_chunks) && ac != mark->bam_chunk)
+  {
+    arena->ba_chunks = ac->ac_next;
+    arena_chunk_put(B, arena, ac);
+  }
+
+  arena->ba_cur = mark->bam_cur;
+  arena->ba_end = mark->bam_end;
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Free everything allocated from an arena, keeping the arena (and a few
+ * chunks) for reuse.
+ *
+ * THREADS: MT-SAFE (as long as arena is thread-private)
+ *
+ *	@param B BAKA thread/global state.
+ *	@param arena Arena
+ *	@param flags Fun for the future
+ */
+void bk_arena_reset(bk_s B, struct bk_arena *arena, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!arena)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_VRETURN(B);
+  }
+
+  bk_arena_release(B, arena, &arena->ba_base, flags);
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Get a chunk with at least size bytes of data, from the spares if it is
+ * a standard chunk.
+ *
+ *	@param B BAKA thread/global state.
+ *	@param arena Arena
+ *	@param size Data bytes needed
+ *	@return <i>NULL</i> on failure.<br>
+ *	@return <br><i>chunk</i> on success.
+ */
+static struct arena_chunk *arena_chunk_get(bk_s B, struct bk_arena *arena, size_t size)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct arena_chunk *ac;
+
+  if (size == arena->ba_chunksize && (ac = arena->ba_spare))
+  {
+    arena->ba_spare = ac->ac_next;
+    arena->ba_nspare--;
+    BK_RETURN(B, ac);
+  }
+
+  if (size > ((size_t)-1) - ARENA_CHUNKHDR || !(ac = malloc(ARENA_CHUNKHDR + size)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate %lu byte arena chunk: %s\n", (u_long)size, strerror(errno));
+    BK_RETURN(B, NULL);
+  }
+  ac->ac_size = size;
+
+  BK_RETURN(B, ac);
+}
+
+
+
+/**
+ * Give back a chunk: keep it as a spare if it is standard and we have
+ * room, otherwise free it.
+ *
+ *	@param B BAKA thread/global state.
+ *	@param arena Arena
+ *	@param ac Chunk
+ */
+static void arena_chunk_put(bk_s B, struct bk_arena *arena, struct arena_chunk *ac)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (ac->ac_size == arena->ba_chunksize && arena->ba_nspare < ARENA_MAXSPARE)
+  {
+    ac->ac_next = arena->ba_spare;
+    arena->ba_spare = ac;
+    arena->ba_nspare++;
+  }
+  else
+    free(ac);
+
+  BK_VRETURN(B);
+}
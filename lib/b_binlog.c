@@ -0,0 +1,1479 @@
+#if !defined(lint)
+static const char libbk__copyright[] = "Copyright © 2011";
+static const char libbk__contact[] = "<projectbaka@baka.org>";
+#endif /* not lint */
+/*
+ * ++Copyright BAKA++
+ *
+ * Copyright © 2011 The Authors. All rights reserved.
+ *
+ * This source code is licensed to you under the terms of the file
+ * LICENSE.TXT in this release for further details.
+ *
+ * Send e-mail to <projectbaka@baka.org> for further information.
+ *
+ * - -Copyright BAKA- -
+ */
+
+/**
+ * @file
+ * Binary logs: printf-style messages captured without being formatted.
+ *
+ * The raising thread records the format string (by interned id), a
+ * timestamp, its thread number and the raw arguments into a buffer of its
+ * own, which is appended to the log file when it fills or the log is
+ * flushed.  Formatting happens only if somebody reads the log, with
+ * bk_binlog_open()/bk_binlog_read() (see binlogcat).
+ *
+ * Formats and function names are interned by address, so they must be
+ * string constants (as they are for bk_debug_printf and bk_error_printf);
+ * a format the capture cannot handle (%n, %m, wide characters,
+ * positional arguments) is formatted at the call instead.
+ */
+
+#include <libbk.h>
+#include "libbk_internal.h"
+#include <stdint.h>
+
+
+
+#define BBL_MAGIC		"BKBINLOG"	///< File magic
+#define BBL_VERSION		1		///< File format version
+#define BBL_BYTEORDER		0x01020304	///< Byte order check
+#define BBL_STRINGS		4096		///< Interned strings per log (a power of two)
+#define BBL_MAXARGS		32		///< Most arguments captured for one message
+#define BBL_MAXRECORD		8192		///< Largest record (strings are truncated to fit)
+#define BBL_BUFSIZE_MIN		(4 * BBL_MAXRECORD) ///< Smallest per-thread buffer
+
+
+
+/**
+ * File header
+ */
+struct bbl_header
+{
+  char		bblh_magic[8];			///< BBL_MAGIC
+  u_int32_t	bblh_version;			///< BBL_VERSION
+  u_int32_t	bblh_byteorder;			///< BBL_BYTEORDER as written
+  u_int32_t	bblh_hdrsize;			///< Size of this header
+  int32_t	bblh_pid;			///< Process which wrote the log
+  char		bblh_program[64];		///< Program which wrote the log
+};
+
+
+
+/**
+ * Record header.  Integer arguments follow as 64 bits, long doubles as
+ * their own size, strings as a 16 bit length and the bytes.
+ */
+struct bbl_record
+{
+  u_int16_t	bblr_len;			///< Length of the record
+  u_int8_t	bblr_type;			///< Type of record
+#define BBLR_STRING		1		///< Interned string (id in bblr_fmt) follows
+#define BBLR_LOG		2		///< Arguments of bblr_fmt follow
+#define BBLR_TEXT		3		///< Function name and message formatted at the call follow
+  int8_t	bblr_level;			///< BK_ERR level, or BK_ERR_NONE for debugging output
+  u_int32_t	bblr_tid;			///< Thread number
+  u_int64_t	bblr_nsecs;			///< Wall clock time
+  u_int32_t	bblr_fmt;			///< Format string id
+  u_int32_t	bblr_fun;			///< Function name id (0 if unknown)
+};
+
+
+
+/**
+ * One conversion of a format string
+ */
+struct bbl_spec
+{
+  u_int8_t	bbls_class;			///< Class of the argument, or BBLA_NONE for %%
+#define BBLA_NONE		0		///< No argument
+#define BBLA_INT		1		///< int (or smaller)
+#define BBLA_LONG		2		///< long
+#define BBLA_LLONG		3		///< long long
+#define BBLA_SIZE		4		///< size_t
+#define BBLA_PTRDIFF		5		///< ptrdiff_t
+#define BBLA_INTMAX		6		///< intmax_t
+#define BBLA_DOUBLE		7		///< double
+#define BBLA_LDOUBLE		8		///< long double
+#define BBLA_PTR		9		///< void *
+#define BBLA_STRING		10		///< char *
+#define BBLA_BAD		11		///< Not capturable
+  u_int8_t	bbls_widthstar;			///< Width is an int argument
+  u_int8_t	bbls_precstar;			///< Precision is an int argument
+  int		bbls_prec;			///< Literal precision, or -1
+};
+
+
+
+/**
+ * A format string parsed for capture
+ */
+struct bbl_format
+{
+  u_int32_t	bblf_id;			///< Id of the string in the log
+  int		bblf_nargs;			///< Arguments (star widths included), or -1 if not capturable
+  u_int8_t	bblf_class[BBL_MAXARGS];	///< BBLA_* class of each argument
+  int		bblf_prec[BBL_MAXARGS];		///< Precision of string arguments: -1 none, -2 the previous argument
+};
+
+
+
+/**
+ * Interned string slot.  The key is published last, so a reader seeing
+ * it sees the format.
+ */
+struct bbl_slot
+{
+  const char	*bbls_key;			///< Address of the string
+  struct bbl_format *bbls_format;		///< What the string is as a format
+};
+
+
+
+/**
+ * A thread's buffer of records for one log.  The thread is the only
+ * producer; whoever holds the log lock (the thread itself when the buffer
+ * is full, or a flush) is the only consumer.
+ */
+struct bbl_buf
+{
+  struct bk_binlog *bbb_owner;			///< Log fed by this buffer
+  char		*bbb_buf;			///< Records
+  u_int32_t	bbb_size;			///< Size of bbb_buf (a power of two)
+  u_int32_t	bbb_tid;			///< Thread number
+  u_int64_t	bbb_tail __attribute__((aligned(64))); ///< Bytes produced (producer writes)
+  u_int64_t	bbb_head __attribute__((aligned(64))); ///< Bytes written to the file (consumer writes)
+  struct bbl_buf *bbb_next;			///< Next buffer of the same log
+  struct bbl_buf *bbb_tnext;			///< Next buffer of the same thread
+  u_int		bbb_state;			///< Who is done with the buffer
+#define BBB_THREAD_GONE		0x1		///< Thread has exited
+#define BBB_OWNER_GONE		0x2		///< Log has been destroyed
+};
+
+
+
+/**
+ * A binary log being written
+ */
+struct bk_binlog
+{
+  int		bbl_fd;				///< Log file
+  u_int32_t	bbl_bufsize;			///< Size of per-thread buffers
+  u_int32_t	bbl_nextid;			///< Next interned string id
+  struct bbl_slot *bbl_strings;			///< Interned strings, open addressed by address
+  struct bbl_buf *bbl_bufs;			///< Per-thread buffers
+  int		bbl_failed;			///< Writes have failed since the last flush
+  bk_flags	bbl_flags;			///< Everyone needs flags
+#ifdef BK_USING_PTHREADS
+  pthread_mutex_t bbl_lock;			///< File writes, interning and consuming buffers
+#endif /* BK_USING_PTHREADS */
+};
+
+
+
+/**
+ * A binary log being read
+ */
+struct bk_binlog_reader
+{
+  FILE		*bblr_fh;			///< Log file
+  struct bbl_header bblr_header;		///< Its header
+  char		**bblr_strings;			///< Interned strings by id
+  u_int32_t	bblr_nstrings;			///< Size of bblr_strings
+  char		bblr_record[BBL_MAXRECORD];	///< Record being decoded
+  char		bblr_msg[BBL_MAXRECORD];	///< Decoded message
+};
+
+
+
+static __thread struct bbl_buf *bbl_mybufs __attribute__ ((tls_model ("initial-exec"))); ///< This thread's buffers
+static u_int32_t bbl_nexttid;			///< Thread numbers handed out
+#ifdef BK_USING_PTHREADS
+static pthread_key_t bbl_buf_key;		///< Releases bbl_mybufs at thread exit
+static pthread_once_t bbl_buf_once = PTHREAD_ONCE_INIT; ///< Creates bbl_buf_key
+#endif /* BK_USING_PTHREADS */
+
+/*
+ * Messages being diverted through a log found in bk_error or bk_debug.  A
+ * per-log count would be read through the very pointer it protects, so
+ * the count is library-wide, split by phase: bk_binlog_destroy flips the
+ * phase and waits only for the loggers which started before it.
+ */
+static u_int bbl_phase;				///< Phase new loggers count themselves in
+static u_int bbl_inflight[2];			///< Loggers in each phase
+#ifdef BK_USING_PTHREADS
+static pthread_mutex_t bbl_quiesce_lock = PTHREAD_MUTEX_INITIALIZER; ///< One phase flip at a time
+#endif /* BK_USING_PTHREADS */
+
+
+
+static struct bbl_format *bbl_intern(bk_s B, struct bk_binlog *bbl, const char *str);
+static struct bbl_format *bbl_intern_slow(bk_s B, struct bk_binlog *bbl, const char *str, u_int32_t hash);
+static const char *bbl_spec_parse(const char *fmt, struct bbl_spec *spec);
+static struct bbl_buf *bbl_buf_mine(bk_s B, struct bk_binlog *bbl);
+static void bbl_buf_put(bk_s B, struct bk_binlog *bbl, struct bbl_buf *buf, const char *rec, u_int32_t len);
+static void bbl_buf_drain(bk_s B, struct bk_binlog *bbl, struct bbl_buf *buf);
+static void bbl_buf_release(struct bbl_buf *buf, u_int gone);
+#ifdef BK_USING_PTHREADS
+static void bbl_buf_key_create(void);
+static void bbl_buf_exit(void *opaque);
+#endif /* BK_USING_PTHREADS */
+static int bbl_write(struct bk_binlog *bbl, const struct iovec *iov, int iovcnt);
+static void bbl_quiesce(void);
+
+
+
+/**
+ * Lock and unlock the log (only needed once there are threads)
+ */
+#ifdef BK_USING_PTHREADS
+#define BBL_LOCK(B,bbl)		do { if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_lock(&(bbl)->bbl_lock) != 0) abort(); } while (0)
+#define BBL_UNLOCK(B,bbl)	do { if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_unlock(&(bbl)->bbl_lock) != 0) abort(); } while (0)
+#else /* BK_USING_PTHREADS */
+#define BBL_LOCK(B,bbl)		do { } while (0)
+#define BBL_UNLOCK(B,bbl)	do { } while (0)
+#endif /* BK_USING_PTHREADS */
+
+
+
+/**
+ * Create a binary log file.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state
+ *	@param filename File to (over)write
+ *	@param bufsize Bytes of records each thread may buffer (0 for BK_BINLOG_BUFSIZE_DEFAULT)
+ *	@param flags Fun for the future
+ *	@return <i>NULL</i> on call failure, allocation failure, or if the file could not be created
+ *	@return <br><i>binary log</i> on success
+ */
+struct bk_binlog *bk_binlog_create(bk_s B, const char *filename, u_int32_t bufsize, bk_flags flags)
+{
+  struct bk_binlog *bbl = NULL;
+  struct bbl_header hdr;
+  struct iovec iov;
+  u_int32_t size;
+
+  if (!filename)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "%s: Invalid arguments\n", BK_FUNCNAME);
+    return(NULL);
+  }
+
+  bufsize = bufsize ? bufsize : BK_BINLOG_BUFSIZE_DEFAULT;
+  for (size = BBL_BUFSIZE_MIN; size < bufsize && size < (1U << 30); size <<= 1)
+    ; // Void
+
+  if (!BK_CALLOC(bbl))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "%s: Could not allocate binary log: %s\n", BK_FUNCNAME, strerror(errno));
+    return(NULL);
+  }
+  bbl->bbl_fd = -1;
+  bbl->bbl_bufsize = size;
+  bbl->bbl_nextid = 1;
+  bbl->bbl_flags = flags;
+#ifdef BK_USING_PTHREADS
+  pthread_mutex_init(&bbl->bbl_lock, NULL);
+#endif /* BK_USING_PTHREADS */
+
+  if (!BK_CALLOC_LEN(bbl->bbl_strings, BBL_STRINGS * sizeof(*bbl->bbl_strings)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "%s: Could not allocate string table: %s\n", BK_FUNCNAME, strerror(errno));
+    goto error;
+  }
+
+  if ((bbl->bbl_fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "%s: Could not create %s: %s\n", BK_FUNCNAME, filename, strerror(errno));
+    goto error;
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.bblh_magic, BBL_MAGIC, sizeof(hdr.bblh_magic));
+  hdr.bblh_version = BBL_VERSION;
+  hdr.bblh_byteorder = BBL_BYTEORDER;
+  hdr.bblh_hdrsize = sizeof(hdr);
+  hdr.bblh_pid = getpid();
+  if (BK_GENERAL_PROGRAM(B))
+    strncpy(hdr.bblh_program, BK_GENERAL_PROGRAM(B), sizeof(hdr.bblh_program) - 1);
+
+  iov.iov_base = &hdr;
+  iov.iov_len = sizeof(hdr);
+  if (bbl_write(bbl, &iov, 1) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "%s: Could not write header to %s: %s\n", BK_FUNCNAME, filename, strerror(errno));
+    goto error;
+  }
+
+  return(bbl);
+
+ error:
+  if (bbl->bbl_fd >= 0)
+    close(bbl->bbl_fd);
+  if (bbl->bbl_strings)
+    free(bbl->bbl_strings);
+#ifdef BK_USING_PTHREADS
+  pthread_mutex_destroy(&bbl->bbl_lock);
+#endif /* BK_USING_PTHREADS */
+  free(bbl);
+  return(NULL);
+}
+
+
+
+/**
+ * Flush and close a binary log.  Detach it from bk_debug and bk_error
+ * first: messages they are already diverting to it are waited for.
+ * Nobody may still be calling bk_binlog_iprintf on it directly.
+ *
+ * THREADS: REENTRANT
+ *
+ *	@param B BAKA thread/global state
+ *	@param bbl The binary log
+ */
+void bk_binlog_destroy(bk_s B, struct bk_binlog *bbl)
+{
+  struct bbl_buf *buf, *next;
+  u_int cnt;
+
+  if (!bbl)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "%s: Invalid arguments\n", BK_FUNCNAME);
+    return;
+  }
+
+  bbl_quiesce();
+
+  if (bk_binlog_flush(B, bbl) < 0)
+    bk_error_printf(B, BK_ERR_ERR, "%s: Could not write all of the binary log\n", BK_FUNCNAME);
+
+  for (buf = bbl->bbl_bufs; buf; buf = next)
+  {
+    next = buf->bbb_next;
+    bbl_buf_release(buf, BBB_OWNER_GONE);
+  }
+
+  for (cnt = 0; cnt < BBL_STRINGS; cnt++)
+    if (bbl->bbl_strings[cnt].bbls_format)
+      free(bbl->bbl_strings[cnt].bbls_format);
+  free(bbl->bbl_strings);
+
+  close(bbl->bbl_fd);
+#ifdef BK_USING_PTHREADS
+  pthread_mutex_destroy(&bbl->bbl_lock);
+#endif /* BK_USING_PTHREADS */
+  free(bbl);
+}
+
+
+
+/**
+ * Count a logger which is about to look for a binary log to divert a
+ * message to.  Call bk_binlog_unhold with the result when done with it.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@return <i>phase</i> to pass to bk_binlog_unhold
+ */
+int bk_binlog_hold(void)
+{
+  int phase = __atomic_load_n(&bbl_phase, __ATOMIC_SEQ_CST) & 1;
+
+  __atomic_add_fetch(&bbl_inflight[phase], 1, __ATOMIC_SEQ_CST);
+  return(phase);
+}
+
+
+
+/**
+ * A logger counted by bk_binlog_hold is done with the binary log it found
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param phase Return value of bk_binlog_hold
+ */
+void bk_binlog_unhold(int phase)
+{
+  __atomic_sub_fetch(&bbl_inflight[phase], 1, __ATOMIC_RELEASE);
+}
+
+
+
+/**
+ * Write out everything the threads have buffered.  Call this from time to
+ * time (a bk_run cron, say) if records should reach the file before the
+ * threads fill their buffers.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state
+ *	@param bbl The binary log
+ *	@return <i>-1</i> on call failure, or if writes have failed since the last flush
+ *	@return <br><i>0</i> on success
+ */
+int bk_binlog_flush(bk_s B, struct bk_binlog *bbl)
+{
+  struct bbl_buf *buf, *expect, **prev;
+  u_int state;
+  int ret;
+
+  if (!bbl)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "%s: Invalid arguments\n", BK_FUNCNAME);
+    return(-1);
+  }
+
+  BBL_LOCK(B, bbl);
+
+  prev = &bbl->bbl_bufs;
+  while ((buf = __atomic_load_n(prev, __ATOMIC_ACQUIRE)))
+  {
+    // <TRICKY>State first: a thread which is gone has already published its last record</TRICKY>
+    state = __atomic_load_n(&buf->bbb_state, __ATOMIC_ACQUIRE);
+    bbl_buf_drain(B, bbl, buf);
+
+    if (!(state & BBB_THREAD_GONE))
+    {
+      prev = &buf->bbb_next;
+      continue;
+    }
+
+    // Threads only push onto the head of the list (see be_async_drain)
+    expect = buf;
+    if (prev != &bbl->bbl_bufs ||
+	!__atomic_compare_exchange_n(prev, &expect, buf->bbb_next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+      while ((expect = __atomic_load_n(prev, __ATOMIC_ACQUIRE)) != buf)
+	prev = &expect->bbb_next;
+      *prev = buf->bbb_next;
+    }
+    bbl_buf_release(buf, BBB_OWNER_GONE);
+  }
+
+  ret = bbl->bbl_failed ? -1 : 0;
+  bbl->bbl_failed = 0;
+
+  BBL_UNLOCK(B, bbl);
+
+  return(ret);
+}
+
+
+
+/**
+ * Capture a printf-style message, in the style of bk_binlog_ivprintf
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state
+ *	@param bbl The binary log
+ *	@param level BK_ERR level of the message, or BK_ERR_NONE for debugging output
+ *	@param funname Function raising the message (a string constant), or NULL
+ *	@param format printf-style format (a string constant)
+ *	@param ... printf-style arguments
+ */
+void bk_binlog_iprintf(bk_s B, struct bk_binlog *bbl, int level, const char *funname, const char *format, ...)
+{
+  va_list args;
+
+  va_start(args, format);
+  bk_binlog_ivprintf(B, bbl, level, funname, format, args);
+  va_end(args);
+}
+
+
+
+/**
+ * Capture a printf-style message without formatting it.  Nothing is
+ * reported on failure (this is called from the error and debugging
+ * paths): a message which cannot be buffered is lost.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state
+ *	@param bbl The binary log
+ *	@param level BK_ERR level of the message, or BK_ERR_NONE for debugging output
+ *	@param funname Function raising the message (a string constant), or NULL
+ *	@param format printf-style format (a string constant)
+ *	@param ap printf-style arguments
+ */
+void bk_binlog_ivprintf(bk_s B, struct bk_binlog *bbl, int level, const char *funname, const char *format, va_list ap)
+{
+  u_int64_t rec64[BBL_MAXRECORD / sizeof(u_int64_t)];
+  char *rec = (char *)rec64;
+  struct bbl_record *hdr = (struct bbl_record *)rec;
+  struct bbl_format *fmt, *fun = NULL;
+  struct bbl_buf *buf;
+  struct timespec ts;
+  u_int32_t off = sizeof(*hdr);
+  int64_t ival, lastint = -1;
+  const char *str;
+  size_t len;
+  int cnt;
+
+  if (!bbl || !format || !(buf = bbl_buf_mine(B, bbl)))
+    return;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  hdr->bblr_level = level;
+  hdr->bblr_tid = buf->bbb_tid;
+  hdr->bblr_nsecs = (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+  fmt = bbl_intern(B, bbl, format);
+  if (funname)
+    fun = bbl_intern(B, bbl, funname);
+
+  if (!fmt || fmt->bblf_nargs < 0 || (funname && !fun))
+  {
+    u_int16_t funlen = funname ? MIN(strlen(funname), 255) : 0;
+
+    // Not capturable: format it now
+    hdr->bblr_type = BBLR_TEXT;
+    hdr->bblr_fmt = 0;
+    hdr->bblr_fun = 0;
+    memcpy(rec + off, &funlen, sizeof(funlen));
+    off += sizeof(funlen);
+    memcpy(rec + off, funname, funlen);
+    off += funlen;
+    if ((cnt = vsnprintf(rec + off, BBL_MAXRECORD - off, format, ap)) < 0)
+      cnt = 0;
+    off += MIN((u_int32_t)cnt, BBL_MAXRECORD - off - 1);
+    goto put;
+  }
+
+  hdr->bblr_type = BBLR_LOG;
+  hdr->bblr_fmt = fmt->bblf_id;
+  hdr->bblr_fun = fun ? fun->bblf_id : 0;
+
+  for (cnt = 0; cnt < fmt->bblf_nargs; cnt++)
+  {
+    switch (fmt->bblf_class[cnt])
+    {
+    case BBLA_INT:
+      lastint = ival = va_arg(ap, int);
+      break;
+    case BBLA_LONG:
+      ival = va_arg(ap, long);
+      break;
+    case BBLA_LLONG:
+      ival = va_arg(ap, long long);
+      break;
+    case BBLA_SIZE:
+      ival = va_arg(ap, size_t);
+      break;
+    case BBLA_PTRDIFF:
+      ival = va_arg(ap, ptrdiff_t);
+      break;
+    case BBLA_INTMAX:
+      ival = va_arg(ap, intmax_t);
+      break;
+    case BBLA_PTR:
+      ival = (intptr_t)va_arg(ap, void *);
+      break;
+    case BBLA_DOUBLE:
+    {
+      double dval = va_arg(ap, double);
+      memcpy(&ival, &dval, sizeof(ival));
+      break;
+    }
+    case BBLA_LDOUBLE:
+    {
+      long double ldval = va_arg(ap, long double);
+
+      if (off + sizeof(ldval) > BBL_MAXRECORD)
+	return;
+      memcpy(rec + off, &ldval, sizeof(ldval));
+      off += sizeof(ldval);
+      continue;
+    }
+    case BBLA_STRING:
+    {
+      u_int16_t slen;
+      int prec = fmt->bblf_prec[cnt] == -2 ? (int)lastint : fmt->bblf_prec[cnt];
+
+      if (!(str = va_arg(ap, const char *)))
+	str = "(null)";
+      len = prec >= 0 ? strnlen(str, prec) : strlen(str);
+      // Truncate to fit, leaving room for the arguments which follow
+      len = MIN(len, BBL_MAXRECORD - off - sizeof(slen) - (fmt->bblf_nargs - cnt - 1) * sizeof(long double));
+      slen = len;
+      memcpy(rec + off, &slen, sizeof(slen));
+      memcpy(rec + off + sizeof(slen), str, len);
+      off += sizeof(slen) + len;
+      continue;
+    }
+    default:
+      return;
+    }
+    memcpy(rec + off, &ival, sizeof(ival));
+    off += sizeof(ival);
+  }
+
+ put:
+  hdr->bblr_len = off;
+  bbl_buf_put(B, bbl, buf, rec, off);
+}
+
+
+
+/**
+ * Open a binary log file for reading.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state
+ *	@param filename File to read
+ *	@param flags Fun for the future
+ *	@return <i>NULL</i> on call failure, allocation failure, or if the file is not a binary log
+ *	@return <br><i>reader</i> on success
+ */
+struct bk_binlog_reader *bk_binlog_open(bk_s B, const char *filename, bk_flags flags)
+{
+  struct bk_binlog_reader *bblr = NULL;
+
+  if (!filename)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "%s: Invalid arguments\n", BK_FUNCNAME);
+    return(NULL);
+  }
+
+  if (!BK_CALLOC(bblr))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "%s: Could not allocate binary log reader: %s\n", BK_FUNCNAME, strerror(errno));
+    return(NULL);
+  }
+
+  if (!(bblr->bblr_fh = fopen(filename, "r")))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "%s: Could not open %s: %s\n", BK_FUNCNAME, filename, strerror(errno));
+    goto error;
+  }
+
+  if (fread(&bblr->bblr_header, sizeof(bblr->bblr_header), 1, bblr->bblr_fh) != 1 ||
+      memcmp(bblr->bblr_header.bblh_magic, BBL_MAGIC, sizeof(bblr->bblr_header.bblh_magic)) ||
+      bblr->bblr_header.bblh_hdrsize != sizeof(bblr->bblr_header))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "%s: %s is not a binary log\n", BK_FUNCNAME, filename);
+    goto error;
+  }
+
+  if (bblr->bblr_header.bblh_version != BBL_VERSION || bblr->bblr_header.bblh_byteorder != BBL_BYTEORDER)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "%s: %s is version %u with byte order %08x, not version %u with byte order %08x\n", BK_FUNCNAME, filename,
+		    bblr->bblr_header.bblh_version, bblr->bblr_header.bblh_byteorder, BBL_VERSION, BBL_BYTEORDER);
+    goto error;
+  }
+  bblr->bblr_header.bblh_program[sizeof(bblr->bblr_header.bblh_program) - 1] = 0;
+
+  return(bblr);
+
+ error:
+  bk_binlog_close(B, bblr);
+  return(NULL);
+}
+
+
+
+/**
+ * Close a binary log opened for reading.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state
+ *	@param bblr The reader
+ */
+void bk_binlog_close(bk_s B, struct bk_binlog_reader *bblr)
+{
+  u_int32_t cnt;
+
+  if (!bblr)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "%s: Invalid arguments\n", BK_FUNCNAME);
+    return;
+  }
+
+  for (cnt = 0; cnt < bblr->bblr_nstrings; cnt++)
+    if (bblr->bblr_strings[cnt])
+      free(bblr->bblr_strings[cnt]);
+  if (bblr->bblr_strings)
+    free(bblr->bblr_strings);
+  if (bblr->bblr_fh)
+    fclose(bblr->bblr_fh);
+  free(bblr);
+}
+
+
+
+/**
+ * Program and process which wrote a binary log
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state
+ *	@param bblr The reader
+ *	@param pidp Copy-out process id (may be NULL)
+ *	@return <i>NULL</i> on call failure
+ *	@return <br><i>program name</i> (empty if unknown) on success
+ */
+const char *bk_binlog_program(bk_s B, struct bk_binlog_reader *bblr, pid_t *pidp)
+{
+  if (!bblr)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "%s: Invalid arguments\n", BK_FUNCNAME);
+    return(NULL);
+  }
+
+  if (pidp)
+    *pidp = bblr->bblr_header.bblh_pid;
+  return(bblr->bblr_header.bblh_program);
+}
+
+
+
+/**
+ * Read and format the next message of a binary log.  Messages are in the
+ * order they reached the file: by thread, as each thread's buffer was
+ * written, rather than strictly by time.
+ *
+ * THREADS: REENTRANT
+ *
+ *	@param B BAKA thread/global state
+ *	@param bblr The reader
+ *	@param bble Copy-out message; its strings are valid until the next read
+ *	@param flags Fun for the future
+ *	@return <i>-1</i> on call failure, or if the file is corrupt
+ *	@return <br><i>0</i> at the end of the file
+ *	@return <br><i>1</i> if a message was read
+ */
+int bk_binlog_read(bk_s B, struct bk_binlog_reader *bblr, struct bk_binlog_entry *bble, bk_flags flags)
+{
+  struct bbl_record *hdr;
+  const char *fmt, *next;
+  struct bbl_spec spec;
+  size_t used, msgsize;
+  char conv[64];
+  char *rec, *msg;
+  u_int32_t off;
+  int64_t args[3];
+  int nargs;
+
+  if (!bblr || !bble)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "%s: Invalid arguments\n", BK_FUNCNAME);
+    return(-1);
+  }
+  rec = bblr->bblr_record;
+  hdr = (struct bbl_record *)rec;
+  msg = bblr->bblr_msg;
+  msgsize = sizeof(bblr->bblr_msg);
+
+  for (;;)
+  {
+    if (fread(hdr, sizeof(*hdr), 1, bblr->bblr_fh) != 1)
+    {
+      if (ferror(bblr->bblr_fh))
+      {
+	bk_error_printf(B, BK_ERR_ERR, "%s: Could not read binary log: %s\n", BK_FUNCNAME, strerror(errno));
+	return(-1);
+      }
+      return(0);
+    }
+
+    if (hdr->bblr_len < sizeof(*hdr) || hdr->bblr_len > BBL_MAXRECORD ||
+	(hdr->bblr_len > sizeof(*hdr) && fread(rec + sizeof(*hdr), hdr->bblr_len - sizeof(*hdr), 1, bblr->bblr_fh) != 1))
+    {
+      bk_error_printf(B, BK_ERR_ERR, "%s: Truncated record\n", BK_FUNCNAME);
+      return(-1);
+    }
+
+    if (hdr->bblr_type != BBLR_STRING)
+      break;
+
+    if (hdr->bblr_fmt >= bblr->bblr_nstrings)
+    {
+      u_int32_t size = MAX(hdr->bblr_fmt + 1, bblr->bblr_nstrings * 2);
+      char **strings;
+
+      if (!(strings = realloc(bblr->bblr_strings, size * sizeof(*strings))))
+      {
+	bk_error_printf(B, BK_ERR_ERR, "%s: Could not grow string table: %s\n", BK_FUNCNAME, strerror(errno));
+	return(-1);
+      }
+      memset(strings + bblr->bblr_nstrings, 0, (size - bblr->bblr_nstrings) * sizeof(*strings));
+      bblr->bblr_strings = strings;
+      bblr->bblr_nstrings = size;
+    }
+    if (bblr->bblr_strings[hdr->bblr_fmt])
+      free(bblr->bblr_strings[hdr->bblr_fmt]);
+    if (!(bblr->bblr_strings[hdr->bblr_fmt] = strndup(rec + sizeof(*hdr), hdr->bblr_len - sizeof(*hdr))))
+    {
+      bk_error_printf(B, BK_ERR_ERR, "%s: Could not copy string: %s\n", BK_FUNCNAME, strerror(errno));
+      return(-1);
+    }
+  }
+
+  bble->bble_time.tv_sec = hdr->bblr_nsecs / 1000000000;
+  bble->bble_time.tv_nsec = hdr->bblr_nsecs % 1000000000;
+  bble->bble_tid = hdr->bblr_tid;
+  bble->bble_level = hdr->bblr_level;
+  bble->bble_funname = NULL;
+  bble->bble_msg = msg;
+  off = sizeof(*hdr);
+
+  if (hdr->bblr_type == BBLR_TEXT)
+  {
+    u_int16_t funlen;
+
+    if (off + sizeof(funlen) > hdr->bblr_len)
+      goto corrupt;
+    memcpy(&funlen, rec + off, sizeof(funlen));
+    off += sizeof(funlen);
+    if (off + funlen > hdr->bblr_len)
+      goto corrupt;
+    // The function name lives in the message buffer, after the message
+    used = MIN(hdr->bblr_len - off - funlen, msgsize - funlen - 2);
+    memcpy(msg, rec + off + funlen, used);
+    msg[used] = 0;
+    if (funlen)
+    {
+      memcpy(msg + used + 1, rec + off, funlen);
+      msg[used + 1 + funlen] = 0;
+      bble->bble_funname = msg + used + 1;
+    }
+    return(1);
+  }
+
+  if (hdr->bblr_type != BBLR_LOG || hdr->bblr_fmt >= bblr->bblr_nstrings || !(fmt = bblr->bblr_strings[hdr->bblr_fmt]) ||
+      (hdr->bblr_fun && (hdr->bblr_fun >= bblr->bblr_nstrings || !bblr->bblr_strings[hdr->bblr_fun])))
+    goto corrupt;
+  if (hdr->bblr_fun)
+    bble->bble_funname = bblr->bblr_strings[hdr->bblr_fun];
+
+  /*
+   * Walk the format as the capture did, handing each conversion its
+   * stored arguments (star widths and precisions substituted in)
+   */
+  used = 0;
+  msg[0] = 0;
+  while (*fmt && used < msgsize - 1)
+  {
+    const char *pct = strchr(fmt, '%');
+    size_t len = pct ? (size_t)(pct - fmt) : strlen(fmt);
+    char *out;
+    int cnt;
+
+    len = MIN(len, msgsize - 1 - used);
+    memcpy(msg + used, fmt, len);
+    used += len;
+    msg[used] = 0;
+    if (!pct)
+      break;
+
+    next = bbl_spec_parse(pct, &spec);
+    if (spec.bbls_class == BBLA_BAD || (size_t)(next - pct) >= sizeof(conv) - 2 * 12)
+      goto corrupt;
+
+    // Star arguments first
+    for (nargs = 0; nargs < spec.bbls_widthstar + spec.bbls_precstar; nargs++)
+    {
+      if (off + sizeof(int64_t) > hdr->bblr_len)
+	goto corrupt;
+      memcpy(&args[nargs], rec + off, sizeof(int64_t));
+      off += sizeof(int64_t);
+    }
+
+    // Copy the conversion, with the star arguments written in
+    for (out = conv, nargs = 0; pct < next; pct++)
+    {
+      if (*pct == '*')
+	out += sprintf(out, "%d", (int)args[nargs++]);
+      else
+	*out++ = *pct;
+    }
+    *out = 0;
+    fmt = next;
+
+    out = msg + used;
+    len = msgsize - used;
+    switch (spec.bbls_class)
+    {
+    case BBLA_NONE:
+      cnt = snprintf(out, len, "%%");
+      break;
+
+    case BBLA_LDOUBLE:
+    {
+      long double ldval;
+
+      if (off + sizeof(ldval) > hdr->bblr_len)
+	goto corrupt;
+      memcpy(&ldval, rec + off, sizeof(ldval));
+      off += sizeof(ldval);
+      cnt = snprintf(out, len, conv, ldval);
+      break;
+    }
+
+    case BBLA_STRING:
+    {
+      char str[BBL_MAXRECORD];
+      u_int16_t slen;
+
+      if (off + sizeof(slen) > hdr->bblr_len)
+	goto corrupt;
+      memcpy(&slen, rec + off, sizeof(slen));
+      off += sizeof(slen);
+      if (off + slen > hdr->bblr_len)
+	goto corrupt;
+      memcpy(str, rec + off, slen);
+      str[slen] = 0;
+      off += slen;
+      cnt = snprintf(out, len, conv, str);
+      break;
+    }
+
+    default:
+    {
+      int64_t ival;
+      double dval;
+
+      if (off + sizeof(ival) > hdr->bblr_len)
+	goto corrupt;
+      memcpy(&ival, rec + off, sizeof(ival));
+      off += sizeof(ival);
+
+      switch (spec.bbls_class)
+      {
+      case BBLA_INT: cnt = snprintf(out, len, conv, (int)ival); break;
+      case BBLA_LONG: cnt = snprintf(out, len, conv, (long)ival); break;
+      case BBLA_LLONG: cnt = snprintf(out, len, conv, (long long)ival); break;
+      case BBLA_SIZE: cnt = snprintf(out, len, conv, (size_t)ival); break;
+      case BBLA_PTRDIFF: cnt = snprintf(out, len, conv, (ptrdiff_t)ival); break;
+      case BBLA_INTMAX: cnt = snprintf(out, len, conv, (intmax_t)ival); break;
+      case BBLA_PTR: cnt = snprintf(out, len, conv, (void *)(intptr_t)ival); break;
+      case BBLA_DOUBLE:
+	memcpy(&dval, &ival, sizeof(dval));
+	cnt = snprintf(out, len, conv, dval);
+	break;
+      default:
+	goto corrupt;
+      }
+      break;
+    }
+    }
+
+    if (cnt > 0)
+      used += MIN((size_t)cnt, len - 1);
+  }
+
+  return(1);
+
+ corrupt:
+  bk_error_printf(B, BK_ERR_ERR, "%s: Corrupt record (type %u, format %u)\n", BK_FUNCNAME, hdr->bblr_type, hdr->bblr_fmt);
+  return(-1);
+}
+
+
+
+/**
+ * The format (or function name) behind a string's address, interning it
+ * on first use
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state
+ *	@param bbl The binary log
+ *	@param str The string
+ *	@return <i>NULL</i> if the string could not be interned
+ *	@return <br><i>format</i> on success
+ */
+static struct bbl_format *bbl_intern(bk_s B, struct bk_binlog *bbl, const char *str)
+{
+  u_int32_t hash = (u_int32_t)(((uintptr_t)str * 0x9e3779b97f4a7c15ULL) >> 32);
+  struct bbl_slot *slot;
+  const char *key;
+  u_int32_t cnt;
+
+  for (cnt = 0; cnt < BBL_STRINGS; cnt++)
+  {
+    slot = &bbl->bbl_strings[(hash + cnt) & (BBL_STRINGS - 1)];
+    if ((key = __atomic_load_n(&slot->bbls_key, __ATOMIC_ACQUIRE)) == str)
+      return(slot->bbls_format);
+    if (!key)
+      return(bbl_intern_slow(B, bbl, str, hash));
+  }
+
+  return(NULL);
+}
+
+
+
+/**
+ * Intern a string: parse it as a format, write it to the log (before any
+ * record which uses it can be written), then publish it.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state
+ *	@param bbl The binary log
+ *	@param str The string
+ *	@param hash Its slot hash
+ *	@return <i>NULL</i> if the string could not be interned
+ *	@return <br><i>format</i> on success
+ */
+static struct bbl_format *bbl_intern_slow(bk_s B, struct bk_binlog *bbl, const char *str, u_int32_t hash)
+{
+  struct bbl_format *fmt = NULL;
+  struct bbl_record hdr;
+  struct bbl_slot *slot;
+  struct bbl_spec spec;
+  struct iovec iov[2];
+  const char *p;
+  size_t len;
+  u_int32_t cnt;
+
+  BBL_LOCK(B, bbl);
+
+  // Somebody else may have got here first
+  for (cnt = 0; cnt < BBL_STRINGS; cnt++)
+  {
+    slot = &bbl->bbl_strings[(hash + cnt) & (BBL_STRINGS - 1)];
+    if (slot->bbls_key == str)
+    {
+      fmt = slot->bbls_format;
+      goto done;
+    }
+    if (!slot->bbls_key)
+      break;
+  }
+
+  // Keep a slot free so that lookups of strings not yet interned end
+  if (cnt >= BBL_STRINGS - 1 || bbl->bbl_nextid >= BBL_STRINGS || (len = strlen(str)) > BBL_MAXRECORD - sizeof(hdr))
+    goto done;
+
+  if (!BK_MALLOC(fmt))
+    goto done;
+  fmt->bblf_id = bbl->bbl_nextid;
+  fmt->bblf_nargs = 0;
+
+  for (p = str; (p = strchr(p, '%')); )
+  {
+    p = bbl_spec_parse(p, &spec);
+    if (spec.bbls_class == BBLA_NONE)
+      continue;
+    if (spec.bbls_class == BBLA_BAD || fmt->bblf_nargs + 3 > BBL_MAXARGS)
+    {
+      fmt->bblf_nargs = -1;
+      break;
+    }
+    if (spec.bbls_widthstar)
+      fmt->bblf_class[fmt->bblf_nargs++] = BBLA_INT;
+    if (spec.bbls_precstar)
+      fmt->bblf_class[fmt->bblf_nargs++] = BBLA_INT;
+    fmt->bblf_prec[fmt->bblf_nargs] = spec.bbls_precstar ? -2 : spec.bbls_prec;
+    fmt->bblf_class[fmt->bblf_nargs++] = spec.bbls_class;
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.bblr_len = sizeof(hdr) + len;
+  hdr.bblr_type = BBLR_STRING;
+  hdr.bblr_fmt = fmt->bblf_id;
+  iov[0].iov_base = &hdr;
+  iov[0].iov_len = sizeof(hdr);
+  iov[1].iov_base = (char *)str;
+  iov[1].iov_len = len;
+  if (bbl_write(bbl, iov, 2) < 0)
+  {
+    free(fmt);
+    fmt = NULL;
+    goto done;
+  }
+
+  bbl->bbl_nextid++;
+  slot->bbls_format = fmt;
+  __atomic_store_n(&slot->bbls_key, str, __ATOMIC_RELEASE);
+
+ done:
+  BBL_UNLOCK(B, bbl);
+  return(fmt);
+}
+
+
+
+/**
+ * Parse one printf conversion
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param fmt The % starting the conversion
+ *	@param spec Copy-out conversion
+ *	@return <i>the character after the conversion</i>
+ */
+static const char *bbl_spec_parse(const char *fmt, struct bbl_spec *spec)
+{
+  int longs = 0, shorts = 0;
+  char size = 0;
+
+  memset(spec, 0, sizeof(*spec));
+  spec->bbls_prec = -1;
+
+  if (*++fmt == '%')
+  {
+    spec->bbls_class = BBLA_NONE;
+    return(fmt + 1);
+  }
+
+  while (*fmt && strchr("-+ #0'I", *fmt))
+    fmt++;
+
+  if (*fmt == '*')
+  {
+    spec->bbls_widthstar = 1;
+    fmt++;
+  }
+  else
+  {
+    while (isdigit(*fmt))
+      fmt++;
+  }
+  if (*fmt == '$')
+    goto bad;					// Positional arguments
+
+  if (*fmt == '.')
+  {
+    fmt++;
+    if (*fmt == '*')
+    {
+      spec->bbls_precstar = 1;
+      fmt++;
+    }
+    else
+    {
+      spec->bbls_prec = 0;
+      for (; isdigit(*fmt); fmt++)
+	spec->bbls_prec = spec->bbls_prec * 10 + (*fmt - '0');
+    }
+  }
+
+  for (;; fmt++)
+  {
+    if (*fmt == 'l')
+      longs++;
+    else if (*fmt == 'h')
+      shorts++;
+    else if (*fmt == 'q' || *fmt == 'L')
+      longs = 2;
+    else if (*fmt == 'j' || *fmt == 'z' || *fmt == 'Z' || *fmt == 't')
+      size = *fmt;
+    else
+      break;
+  }
+
+  switch (*fmt)
+  {
+  case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+    if (size == 'j')
+      spec->bbls_class = BBLA_INTMAX;
+    else if (size == 'z' || size == 'Z')
+      spec->bbls_class = BBLA_SIZE;
+    else if (size == 't')
+      spec->bbls_class = BBLA_PTRDIFF;
+    else if (longs >= 2)
+      spec->bbls_class = BBLA_LLONG;
+    else if (longs == 1)
+      spec->bbls_class = BBLA_LONG;
+    else
+      spec->bbls_class = BBLA_INT;
+    break;
+  case 'c':
+    if (longs)
+      goto bad;					// wint_t
+    spec->bbls_class = BBLA_INT;
+    break;
+  case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+    spec->bbls_class = longs >= 2 ? BBLA_LDOUBLE : BBLA_DOUBLE;
+    break;
+  case 's':
+    if (longs)
+      goto bad;					// wchar_t *
+    spec->bbls_class = BBLA_STRING;
+    break;
+  case 'p':
+    spec->bbls_class = BBLA_PTR;
+    break;
+  default:
+    goto bad;					// %n, %m, wide characters, junk
+  }
+
+  return(fmt + 1);
+
+ bad:
+  spec->bbls_class = BBLA_BAD;
+  return(*fmt ? fmt + 1 : fmt);
+}
+
+
+
+/**
+ * This thread's buffer for a log, created on first use
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state
+ *	@param bbl The binary log
+ *	@return <i>NULL</i> on allocation failure
+ *	@return <br><i>buffer</i> on success
+ */
+static struct bbl_buf *bbl_buf_mine(bk_s B, struct bk_binlog *bbl)
+{
+  struct bbl_buf *buf, **prev;
+
+  prev = &bbl_mybufs;
+  while ((buf = *prev))
+  {
+    if (__atomic_load_n(&buf->bbb_state, __ATOMIC_ACQUIRE) & BBB_OWNER_GONE)
+    {
+      // Its log is gone (and another may have its address)
+      *prev = buf->bbb_tnext;
+      bbl_buf_release(buf, BBB_THREAD_GONE);
+      continue;
+    }
+    if (buf->bbb_owner == bbl)
+      return(buf);
+    prev = &buf->bbb_tnext;
+  }
+
+  if (!BK_CALLOC(buf))
+    return(NULL);
+
+  if (!BK_MALLOC_LEN(buf->bbb_buf, bbl->bbl_bufsize))
+  {
+    free(buf);
+    return(NULL);
+  }
+  buf->bbb_owner = bbl;
+  buf->bbb_size = bbl->bbl_bufsize;
+  buf->bbb_tid = __atomic_add_fetch(&bbl_nexttid, 1, __ATOMIC_RELAXED);
+
+#ifdef BK_USING_PTHREADS
+  // The key's value is the thread's own list head
+  if (pthread_once(&bbl_buf_once, bbl_buf_key_create) != 0 ||
+      pthread_setspecific(bbl_buf_key, &bbl_mybufs) != 0)
+  {
+    free(buf->bbb_buf);
+    free(buf);
+    return(NULL);
+  }
+#endif /* BK_USING_PTHREADS */
+
+  buf->bbb_next = __atomic_load_n(&bbl->bbl_bufs, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&bbl->bbl_bufs, &buf->bbb_next, buf, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ; // Void
+
+  buf->bbb_tnext = bbl_mybufs;
+  bbl_mybufs = buf;
+  return(buf);
+}
+
+
+
+/**
+ * Append a record to this thread's buffer, writing the buffer out first
+ * if the record does not fit
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state
+ *	@param bbl The binary log
+ *	@param buf This thread's buffer
+ *	@param rec The record
+ *	@param len Its length
+ */
+static void bbl_buf_put(bk_s B, struct bk_binlog *bbl, struct bbl_buf *buf, const char *rec, u_int32_t len)
+{
+  u_int64_t tail = buf->bbb_tail;
+  u_int32_t off, first;
+
+  if (tail + len - __atomic_load_n(&buf->bbb_head, __ATOMIC_ACQUIRE) > buf->bbb_size)
+  {
+    BBL_LOCK(B, bbl);
+    bbl_buf_drain(B, bbl, buf);
+    BBL_UNLOCK(B, bbl);
+  }
+
+  off = tail & (buf->bbb_size - 1);
+  first = MIN(len, buf->bbb_size - off);
+  memcpy(buf->bbb_buf + off, rec, first);
+  memcpy(buf->bbb_buf, rec + first, len - first);
+
+  __atomic_store_n(&buf->bbb_tail, tail + len, __ATOMIC_RELEASE);
+}
+
+
+
+/**
+ * Write out what a buffer holds, with the log lock held.  Records are
+ * discarded if they cannot be written (and the next flush fails).
+ *
+ * THREADS: REENTRANT
+ *
+ *	@param B BAKA thread/global state
+ *	@param bbl The binary log
+ *	@param buf The buffer
+ */
+static void bbl_buf_drain(bk_s B, struct bk_binlog *bbl, struct bbl_buf *buf)
+{
+  u_int64_t head = buf->bbb_head;
+  u_int64_t tail = __atomic_load_n(&buf->bbb_tail, __ATOMIC_ACQUIRE);
+  u_int32_t off = head & (buf->bbb_size - 1);
+  struct iovec iov[2];
+  int iovcnt = 1;
+
+  if (head == tail)
+    return;
+
+  iov[0].iov_base = buf->bbb_buf + off;
+  iov[0].iov_len = MIN(tail - head, buf->bbb_size - off);
+  if (iov[0].iov_len < tail - head)
+  {
+    iov[1].iov_base = buf->bbb_buf;
+    iov[1].iov_len = tail - head - iov[0].iov_len;
+    iovcnt++;
+  }
+
+  if (bbl_write(bbl, iov, iovcnt) < 0)
+    bbl->bbl_failed = 1;
+
+  __atomic_store_n(&buf->bbb_head, tail, __ATOMIC_RELEASE);
+}
+
+
+
+/**
+ * One of the buffer's thread and log is done with it; the second frees it.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param buf The buffer
+ *	@param gone BBB_THREAD_GONE or BBB_OWNER_GONE
+ */
+static void bbl_buf_release(struct bbl_buf *buf, u_int gone)
+{
+  if ((__atomic_fetch_or(&buf->bbb_state, gone, __ATOMIC_ACQ_REL) | gone) == (BBB_THREAD_GONE|BBB_OWNER_GONE))
+  {
+    free(buf->bbb_buf);
+    free(buf);
+  }
+}
+
+
+
+#ifdef BK_USING_PTHREADS
+/**
+ * Create the key which releases buffers at thread exit
+ */
+static void bbl_buf_key_create(void)
+{
+  if (pthread_key_create(&bbl_buf_key, bbl_buf_exit) != 0)
+    abort();
+}
+
+
+
+/**
+ * A thread is exiting: leave its buffers to the next flush
+ *
+ *	@param opaque The thread's list of buffers
+ */
+static void bbl_buf_exit(void *opaque)
+{
+  struct bbl_buf **bufs = opaque, *buf;
+
+  while ((buf = *bufs))
+  {
+    *bufs = buf->bbb_tnext;
+    bbl_buf_release(buf, BBB_THREAD_GONE);
+  }
+}
+#endif /* BK_USING_PTHREADS */
+
+
+
+/**
+ * Write all of an iovec to the log file, with the log lock held (or
+ * before anybody else can see the log)
+ *
+ * THREADS: REENTRANT
+ *
+ *	@param bbl The binary log
+ *	@param iov What to write
+ *	@param iovcnt Number of iov elements
+ *	@return <i>-1</i> on write failure
+ *	@return <br><i>0</i> on success
+ */
+static int bbl_write(struct bk_binlog *bbl, const struct iovec *iov, int iovcnt)
+{
+  struct iovec left[2];
+  ssize_t ret;
+  int cnt;
+
+  memcpy(left, iov, iovcnt * sizeof(*iov));
+  while (iovcnt)
+  {
+    if ((ret = writev(bbl->bbl_fd, left, iovcnt)) < 0)
+    {
+      if (errno == EINTR)
+	continue;
+      return(-1);
+    }
+
+    for (cnt = 0; cnt < iovcnt && (size_t)ret >= left[cnt].iov_len; cnt++)
+      ret -= left[cnt].iov_len;
+    if (cnt < iovcnt)
+    {
+      left[cnt].iov_base = (char *)left[cnt].iov_base + ret;
+      left[cnt].iov_len -= ret;
+    }
+    memmove(left, left + cnt, (iovcnt - cnt) * sizeof(*left));
+    iovcnt -= cnt;
+  }
+
+  return(0);
+}
+
+
+
+/**
+ * Wait until no logger can still be using a binary log detached before
+ * the call.  Loggers which held before the detach are counted in one of
+ * the phases; one which held after it will find the new pointer.  The
+ * phase left behind by the last flip is drained first, since a logger
+ * may have read it just before that flip.
+ *
+ * THREADS: MT-SAFE
+ */
+static void bbl_quiesce(void)
+{
+  u_int phase;
+
+#ifdef BK_USING_PTHREADS
+  if (pthread_mutex_lock(&bbl_quiesce_lock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+
+  phase = __atomic_load_n(&bbl_phase, __ATOMIC_SEQ_CST) & 1;
+  while (__atomic_load_n(&bbl_inflight[phase ^ 1], __ATOMIC_SEQ_CST))
+    sched_yield();
+
+  __atomic_store_n(&bbl_phase, phase ^ 1, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&bbl_inflight[phase], __ATOMIC_SEQ_CST))
+    sched_yield();
+
+#ifdef BK_USING_PTHREADS
+  if (pthread_mutex_unlock(&bbl_quiesce_lock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+}
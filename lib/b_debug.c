@@ -39,6 +39,7 @@ struct bk_debug
   FILE		*bd_fh;				///< Debugging info file handle
   int		bd_sysloglevel;			///< Debugging syslog level
   bk_flags	bd_flags;			///< Fun for the future
+  struct bk_binlog *bd_binlog;			///< Binary log capturing messages instead
 #ifdef BK_USING_PTHREADS
   pthread_rwlock_t bd_rwlock;			///< Fun locking activity
 #endif /* BK_USING_PTHREADS */
@@ -92,6 +93,15 @@ static int bk_debug_setconfig_i(bk_s B, struct bk_debug *bdinfo, struct bk_confi
 
 
 
+/**
+ * Bumped whenever any debug level may have changed, invalidating the
+ * levels BK_ENTRY call sites have cached (see b_fun.c).  Starts at one
+ * since a fresh call site's cache is tagged zero.
+ */
+u_int32_t bk_debug_generation = 1;
+
+
+
 
 /**
  * Initialize the debugging structures (don't actually attempt to start debugging)
@@ -149,6 +159,7 @@ void bk_debug_destroy(bk_s B, struct bk_debug *bd)
     DICT_NUKE_CONTENTS(bd->bd_leveldb, debug, cur, bk_error_printf(B, BK_ERR_ERR,"Could not delete item from front of CLC: %s\n",debug_error_reason(bd->bd_leveldb,NULL)), if (cur->bd_name) free(cur->bd_name); free(cur));
     debug_destroy(bd->bd_leveldb);
   }
+  __atomic_add_fetch(&bk_debug_generation, 1, __ATOMIC_RELEASE);
 
 #ifdef BK_USING_PTHREADS
   pthread_rwlock_destroy(&bd->bd_rwlock);
@@ -185,6 +196,7 @@ void bk_debug_reinit(bk_s B, struct bk_debug *bd)
 
   DICT_NUKE_CONTENTS(bd->bd_leveldb, debug, cur, bk_error_printf(B, BK_ERR_ERR,"Could not delete item from front of CLC: %s\n",debug_error_reason(bd->bd_leveldb,NULL)), if (cur->bd_name) free(cur->bd_name); free(cur));
   bk_debug_setconfig_i(B, bd, BK_GENERAL_CONFIG(B), BK_GENERAL_PROGRAM(B));
+  __atomic_add_fetch(&bk_debug_generation, 1, __ATOMIC_RELEASE);
 
 #ifdef BK_USING_PTHREADS
   if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_rwlock_unlock(&bd->bd_rwlock) != 0)
@@ -329,6 +341,7 @@ int bk_debug_set(bk_s B, struct bk_debug *bdinfo, const char *name, u_int32_t le
     bdinfo->bd_defaultlevel = level;
 
  done:
+  __atomic_add_fetch(&bk_debug_generation, 1, __ATOMIC_RELEASE);
 #ifdef BK_USING_PTHREADS
   if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_rwlock_unlock(&bdinfo->bd_rwlock) != 0)
     abort();
@@ -507,6 +520,7 @@ void bk_debug_config(bk_s B, struct bk_debug *bdinfo, FILE *fh, int sysloglevel,
   bdinfo->bd_fh = fh;
   bdinfo->bd_sysloglevel = sysloglevel;
   bdinfo->bd_flags = flags;
+  __atomic_add_fetch(&bk_debug_generation, 1, __ATOMIC_RELEASE);
 
 #ifdef BK_USING_PTHREADS
   if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_rwlock_unlock(&bdinfo->bd_rwlock) != 0)
@@ -601,6 +615,8 @@ void bk_debug_iprintf(bk_s B, struct bk_debug *bdinfo, const char *format, ...)
 {
   va_list args;
   char buf[MAXDEBUGLINE];
+  struct bk_binlog *bbl;
+  int phase;
 
   if (!bdinfo || !format)
   {
@@ -609,6 +625,20 @@ void bk_debug_iprintf(bk_s B, struct bk_debug *bdinfo, const char *format, ...)
   }
 
   va_start(args, format);
+  if (__atomic_load_n(&bdinfo->bd_binlog, __ATOMIC_RELAXED))
+  {
+    // Held, so that bk_binlog_destroy waits for us if it is being detached
+    phase = bk_binlog_hold();
+    if ((bbl = __atomic_load_n(&bdinfo->bd_binlog, __ATOMIC_SEQ_CST)))
+    {
+      bk_binlog_ivprintf(B, bbl, BK_ERR_NONE, bk_fun_funname(B, 0, 0), format, args);
+      bk_binlog_unhold(phase);
+      va_end(args);
+      return;
+    }
+    bk_binlog_unhold(phase);
+  }
+
   vsnprintf(buf,sizeof(buf),format,args);
   va_end(args);
 
@@ -663,6 +693,8 @@ void bk_debug_iprintbuf(bk_s B, struct bk_debug *bdinfo, const char *intro, cons
 void bk_debug_ivprintf(bk_s B, struct bk_debug *bdinfo, const char *format, va_list ap)
 {
   char buf[MAXDEBUGLINE];
+  struct bk_binlog *bbl;
+  int phase;
 
   if (!bdinfo || !format)
   {
@@ -670,6 +702,18 @@ void bk_debug_ivprintf(bk_s B, struct bk_debug *bdinfo, const char *format, va_l
     return;
   }
 
+  if (__atomic_load_n(&bdinfo->bd_binlog, __ATOMIC_RELAXED))
+  {
+    phase = bk_binlog_hold();
+    if ((bbl = __atomic_load_n(&bdinfo->bd_binlog, __ATOMIC_SEQ_CST)))
+    {
+      bk_binlog_ivprintf(B, bbl, BK_ERR_NONE, bk_fun_funname(B, 0, 0), format, ap);
+      bk_binlog_unhold(phase);
+      return;
+    }
+    bk_binlog_unhold(phase);
+  }
+
   vsnprintf(buf,sizeof(buf),format,ap);
   bk_debug_iprint(B, bdinfo, buf);
 
@@ -678,6 +722,30 @@ void bk_debug_ivprintf(bk_s B, struct bk_debug *bdinfo, const char *format, va_l
 
 
 
+/**
+ * Capture printf-style debugging output in a binary log, unformatted,
+ * instead of printing it (bk_debug_iprint output is unaffected).  The
+ * formats must be string constants.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bdinfo Debug handle
+ *	@param bbl Binary log, or NULL to go back to printing
+ */
+void bk_debug_binlog(bk_s B, struct bk_debug *bdinfo, struct bk_binlog *bbl)
+{
+  if (!bdinfo)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "%s: Invalid arguments\n", BK_FUNCNAME);
+    return;
+  }
+
+  __atomic_store_n(&bdinfo->bd_binlog, bbl, __ATOMIC_SEQ_CST);
+}
+
+
+
 /**
  * Return the debug file stream
  *
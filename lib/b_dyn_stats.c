@@ -45,6 +45,7 @@ struct bk_dynamic_stat
   pthread_t				bds_tid; 		///< Used to note thread-specific stats.
 #endif /* BK_USING_PTHREADS */
   bk_flags				bds_flags;		///< Everyone needs flags
+  struct bk_dynamic_stat *		bds_retired_next;	///< Next deregistered stat awaiting list destruction
 };
 
 #define bds_name		bds_key.bdsk_name
@@ -64,9 +65,139 @@ struct bk_dynamic_stats_list
   bk_recursive_lock_h		bdsl_rlock;	///< Lock out other threads (recursive lock)
   bk_flags			bdsl_flags;	///< Everyone needs flags
 #define BDSL_FLAG_RLOCK_INITIALIZED	0x1	// Indicates whether the mutex has been initialized.
+  struct bk_dynamic_stat *	bdsl_retired;	///< Deregistered stats (handles may still be in use)
+  struct bk_dynamic_stats_collector *bdsl_collector; ///< Background sampler of the system stats (if any)
 };
 
 
+
+/**
+ * A shared memory export of a stats list (or, for readers, an attachment
+ * to one).
+ */
+struct bk_dynamic_stats_export
+{
+  struct bk_dynamic_stats_list *bdse_list;	///< Stats being exported (NULL for readers)
+  char *			bdse_name;	///< Name of the shared memory segment
+  struct bk_dynamic_stats_export_header *bdse_header; ///< Mapped segment
+  size_t			bdse_maplen;	///< Length of the mapping
+  struct bk_shmsnap *		bdse_snap;	///< Snapshot area within the segment
+  char *			bdse_buf;	///< Staging (exporter) or copy-out (reader) buffer
+  size_t			bdse_buflen;	///< Size of bdse_buf
+  u_int				bdse_priority;	///< Highest priority exported
+  struct bk_run *		bdse_run;	///< Run environment republishing us
+  void *			bdse_cron;	///< Republication cron handle
+  bk_flags			bdse_flags;	///< Everyone needs flags
+#define BDSE_FLAG_READER		0x1	// Attached by a reader
+};
+#define BDSE_HEADER_SIZE	((sizeof(struct bk_dynamic_stats_export_header) + 63) & ~(size_t)63) ///< Header padded to a cache line
+
+
+
+/**
+ * A periodic sampler of the process-wide system stats (memory size, CPU
+ * time, per-thread CPU time).  While one is attached to a stats list, the
+ * on-demand update callbacks of those stats are skipped, so queries just
+ * read whatever was last published.
+ */
+struct bk_dynamic_stats_collector
+{
+  struct bk_dynamic_stats_list *bdsc_list;	///< Stats being sampled
+  time_t			bdsc_msecs;	///< Sampling interval
+  int				bdsc_statm_fd;	///< /proc/self/statm, held open across samples
+  u_int64_t			bdsc_samples;	///< Samples taken
+  struct bk_run *		bdsc_run;	///< Run environment sampling us (if not a thread)
+  void *			bdsc_cron;	///< Sampling cron handle
+#ifdef BK_USING_PTHREADS
+  pthread_t			bdsc_tid;	///< Sampler thread
+  pthread_mutex_t		bdsc_lock;	///< Protects bdsc_stop
+  pthread_cond_t		bdsc_cond;	///< Wakes the sampler thread to stop
+  int				bdsc_stop;	///< Sampler thread should exit
+#endif /* BK_USING_PTHREADS */
+  bk_flags			bdsc_flags;	///< Everyone needs flags
+#define BDSC_FLAG_SYNC_INIT		0x1	// Lock and condition initialized
+#define BDSC_FLAG_THREAD		0x2	// Sampler thread running
+};
+
+
+
+/*
+ * Numeric values may be updated through handles without the list lock, so
+ * every update and read of one is atomic (relaxed: they are just counters).
+ * The floating point types have no atomic add, hence the compare-exchange.
+ */
+#define BDS_ATOMIC_ADD(field, incr)							\
+do											\
+{											\
+  __atomic_add_fetch(&(field), (incr), __ATOMIC_RELAXED);				\
+} while(0)
+
+#define BDS_ATOMIC_ADD_FP(field, incr)							\
+do											\
+{											\
+  typeof(field) __incr = (incr);							\
+  typeof(field) __old, __new;								\
+											\
+  __atomic_load(&(field), &__old, __ATOMIC_RELAXED);					\
+  do											\
+  {											\
+    __new = __old + __incr;								\
+  } while (!__atomic_compare_exchange(&(field), &__old, &__new, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)); \
+} while(0)
+
+#define BDS_ATOMIC_SET(field, value)							\
+do											\
+{											\
+  typeof(field) __value = (value);							\
+											\
+  __atomic_store(&(field), &__value, __ATOMIC_RELAXED);				\
+} while(0)
+
+
+
+/*
+ * Rate and Window stats keep one bucket per second for the last
+ * BDSW_SECS seconds (indexed by second modulo BDSW_SECS), so an update is
+ * a few atomic operations on the current bucket.  Only the first update
+ * in a new second takes the window's spin flag, to recycle the bucket and
+ * fold the seconds which have just completed into the EWMA.
+ */
+#define BDSW_SECS		64		// Seconds of history (power of two, over 60)
+#define BDS_WINDOWED(type)	((type) == DynamicStatsValueTypeRate || (type) == DynamicStatsValueTypeWindow)
+
+struct bdsw_bucket
+{
+  int64_t				bdswb_sec;		///< Second held (-1 if never used)
+  int64_t				bdswb_sum;		///< Events (Rate) or sum of samples (Window)
+  int64_t				bdswb_count;		///< Number of updates
+  int64_t				bdswb_min;		///< Smallest sample (Window)
+  int64_t				bdswb_max;		///< Largest sample (Window)
+};
+
+struct bk_dynamic_stat_window
+{
+  int64_t				bdsw_value;		///< Total (Rate) or latest sample (Window)
+  int64_t				bdsw_folded;		///< Last second folded into the EWMA
+  double				bdsw_ewma;		///< Moving average of the per-second figure
+  double				bdsw_decay;		///< Weight of the old EWMA after one second
+  char					bdsw_spin;		///< Held while recycling buckets
+  char					bdsw_primed;		///< EWMA has seen a figure
+  char					bdsw_based;		///< Rate has a total to take differences from
+  struct bdsw_bucket			bdsw_buckets[BDSW_SECS]; ///< Per-second history
+};
+#define bds_window		bds_value.bdsv_ptr
+
+
+
+/*
+ * Cardinality, TopK and Quantile stats each hold one fixed-size sketch
+ * from b_sketch.c, which does its own (atomic) locking.
+ */
+#define BDS_SKETCHED(type)	((type) == DynamicStatsValueTypeCardinality || (type) == DynamicStatsValueTypeTopK || (type) == DynamicStatsValueTypeQuantile)
+#define BDSK_HEXKEY_MAX		(2 * BK_TOPK_MAXKEY_DEFAULT + 1) // Hex TopK key and NUL
+#define bds_sketch		bds_value.bdsv_ptr
+
+
 /**
  * @name Defines: List of checkpoint descriptors.
  *
@@ -104,6 +235,7 @@ static int elapsed_time_update(bk_s B, bk_dynamic_stats_h stats_list, bk_dynamic
 static int virtual_memory_update(bk_s B, bk_dynamic_stats_h stats_list, bk_dynamic_stat_h dyn_stat, bk_flags flags);
 static int resident_memory_update(bk_s B, bk_dynamic_stats_h stats_list, bk_dynamic_stat_h dyn_stat, bk_flags flags);
 static int total_cpu_update(bk_s B, bk_dynamic_stats_h stats_list, bk_dynamic_stat_h dyn_stat, bk_flags flags);
+static int statm_read(bk_s B, int fd, u_long *vsizep, long *rssp);
 #ifndef NO_THREAD_CPU_STAT
 #ifdef BK_USING_PTHREADS
 static int stats_thread_cpu_time_register(bk_s B, bk_dynamic_stats_h stats_list, void *bt, bk_dynamic_stat_h *statp, bk_flags flags);
@@ -113,6 +245,30 @@ static int manage_thread_stats(bk_s B, struct bk_dynamic_stats_list *bdsl, bk_fl
 #endif /* NO_THREAD_CPU_STAT */
 #endif /* BK_USING_PTHREADS */
 static struct bk_dynamic_stat *stat_search(bk_s B, struct bk_dynamic_stats_list *bdsl, const char *name, long discriminator);
+static struct bk_dynamic_stat_window *bdsw_create(bk_s B, bk_flags flags);
+static inline int64_t bdsw_now(void);
+static void bdsw_advance(struct bk_dynamic_stat_window *bdsw, int64_t now, int rate);
+static void bdsw_record(struct bk_dynamic_stat_window *bdsw, int64_t amount, int rate);
+static void bdsw_set(struct bk_dynamic_stat_window *bdsw, int64_t value, int rate);
+static void bdsw_add(struct bk_dynamic_stat_window *bdsw, int64_t incr, int rate);
+static int bdsw_xml(bk_s B, struct bk_dynamic_stat *bds, bk_vstr *xml_vstr, const char *prefix, bk_flags flags);
+static void *bdsk_create(bk_s B, bk_dynamic_stats_value_type_e type, bk_flags flags);
+static void bdsk_destroy(bk_s B, struct bk_dynamic_stat *bds);
+static int bdsk_observe(bk_s B, struct bk_dynamic_stat *bds, const void *key, size_t keylen, int64_t value);
+static int bdsk_set(bk_s B, struct bk_dynamic_stat *bds, int64_t value);
+static int64_t bdsk_figure(bk_s B, struct bk_dynamic_stat *bds);
+static void bdsk_hexkey(const void *key, size_t keylen, char *buf);
+static int bdsk_xml(bk_s B, struct bk_dynamic_stat *bds, bk_vstr *xml_vstr, const char *prefix, bk_flags flags);
+static int bdsk_export(bk_s B, struct bk_dynamic_stats_export *bdse, struct bk_dynamic_stat *bds, size_t *offp, bk_flags flags);
+static int export_append(bk_s B, struct bk_dynamic_stats_export *bdse, struct bk_dynamic_stat *bds, const char *suffix, bk_dynamic_stats_value_type_e type, const void *value, const char *string, size_t *offp, bk_flags flags);
+static int export_record(bk_s B, struct bk_dynamic_stats_export *bdse, struct bk_dynamic_stat *bds, size_t *offp, bk_flags flags);
+static void export_cron(bk_s B, struct bk_run *run, void *opaque, const struct timeval starttime, bk_flags flags);
+static int export_reclaim(bk_s B, const char *name);
+static int stat_collected(struct bk_dynamic_stat *bds);
+static void collector_cron(bk_s B, struct bk_run *run, void *opaque, const struct timeval starttime, bk_flags flags);
+#ifdef BK_USING_PTHREADS
+static void *collector_thread(bk_s B, void *opaque);
+#endif /* BK_USING_PTHREADS */
 
 
 /**
@@ -175,6 +331,12 @@ bds_destroy(bk_s B, struct bk_dynamic_stat *bds)
     free(bds->bds_string);
   }
 
+  if (BDS_WINDOWED(bds->bds_value_type) && bds->bds_window)
+    free(bds->bds_window);
+
+  if (BDS_SKETCHED(bds->bds_value_type) && bds->bds_sketch)
+    bdsk_destroy(B, bds);
+
   free(bds);
   BK_VRETURN(B);
 }
@@ -261,6 +423,12 @@ bdsl_destroy(bk_s B, struct bk_dynamic_stats_list *bdsl)
     stats_list_destroy(bdsl->bdsl_list);
   }
 
+  while ((bds = bdsl->bdsl_retired))
+  {
+    bdsl->bdsl_retired = bds->bds_retired_next;
+    bds_destroy(B, bds);
+  }
+
   /*
    * Nothing (of consequence) should occur between this step and free(bdsl);
    */
@@ -329,6 +497,7 @@ bk_dynamic_stats_destroy(bk_s B, bk_dynamic_stats_h stats_list)
     BK_VRETURN(B);
   }
 
+  bk_pool_stats_deregister(B, stats_list);
   bdsl_destroy(B, bdsl);
 
   BK_VRETURN(B);
@@ -470,6 +639,18 @@ bk_dynamic_stat_register_simple(bk_s B, bk_dynamic_stats_h stats_list, const cha
     goto error;
   }
 
+  if (BDS_WINDOWED(value_type) && (access_type == DynamicStatsAccessTypeIndirect))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Rate and Window stats can only be accessed directly\n");
+    goto error;
+  }
+
+  if (BDS_SKETCHED(value_type) && (access_type == DynamicStatsAccessTypeIndirect))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Sketch stats can only be accessed directly\n");
+    goto error;
+  }
+
   if (!(bds = bds_create(B, 0)))
   {
     bk_error_printf(B, BK_ERR_ERR, "Could not create bds structure\n");
@@ -490,6 +671,18 @@ bk_dynamic_stat_register_simple(bk_s B, bk_dynamic_stats_h stats_list, const cha
   bds->bds_update_callback = update_callback;
   bds->bds_destroy_callback = destroy_callback;
 
+  if (BDS_WINDOWED(value_type) && !(bds->bds_window = bdsw_create(B, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not create window for %s\n", name);
+    goto error;
+  }
+
+  if (BDS_SKETCHED(value_type) && !(bds->bds_sketch = bdsk_create(B, value_type, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not create sketch for %s\n", name);
+    goto error;
+  }
+
   STATS_LIST_LOCK(bdsl, locked);
 
   /*
@@ -703,6 +896,13 @@ bk_dynamic_stat_register_with_value_simple(bk_s B, bk_dynamic_stats_h stats_list
     case DynamicStatsValueTypeString:
       bdsv.bdsv_string = va_arg(ap, char *);
       break;
+    case DynamicStatsValueTypeRate:
+    case DynamicStatsValueTypeWindow:
+    case DynamicStatsValueTypeCardinality:
+    case DynamicStatsValueTypeTopK:
+    case DynamicStatsValueTypeQuantile:
+      bdsv.bdsv_int64 = va_arg(ap, int64_t);
+      break;
     default:
       bk_error_printf(B, BK_ERR_ERR,"Unknown value type: %d\n", value_type);
       va_end(ap);
@@ -844,6 +1044,13 @@ bk_dynamic_stat_register_with_value(bk_s B, bk_dynamic_stats_h stats_list, const
     case DynamicStatsValueTypeString:
       bdsv.bdsv_string = va_arg(ap, char *);
       break;
+    case DynamicStatsValueTypeRate:
+    case DynamicStatsValueTypeWindow:
+    case DynamicStatsValueTypeCardinality:
+    case DynamicStatsValueTypeTopK:
+    case DynamicStatsValueTypeQuantile:
+      bdsv.bdsv_int64 = va_arg(ap, int64_t);
+      break;
     default:
       bk_error_printf(B, BK_ERR_ERR,"Unknown value type: %d\n", value_type);
       va_end(ap);
@@ -880,7 +1087,9 @@ bk_dynamic_stat_register_with_value(bk_s B, bk_dynamic_stats_h stats_list, const
 
 
 /**
- * Deregister a stat
+ * Deregister a stat.  The stat is not freed until the list is destroyed,
+ * so that threads still holding its handle may keep updating it (to no
+ * effect) without locking; re-registering the name creates a new stat.
  *
  *	@param B BAKA thread/global state.
  *	@param stats_list The stats list from which to deregister.
@@ -926,6 +1135,9 @@ bk_dynamic_stat_deregister(bk_s B, bk_dynamic_stats_h stats_list, const char *na
     goto error;
   }
 
+  bds->bds_retired_next = bdsl->bdsl_retired;
+  bdsl->bdsl_retired = bds;
+
   STATS_LIST_UNLOCK(bdsl, locked);
 
   BK_RETURN(B, 0);
@@ -949,7 +1161,7 @@ do											\
 											\
   if ((bds)->bds_access_type == DynamicStatsAccessTypeDirect)				\
   {											\
-    *((typeof(value) *)(buf)) = (value);						\
+    __atomic_load(&(value), (typeof(value) *)(buf), __ATOMIC_RELAXED);		\
   }											\
   else											\
   {											\
@@ -1001,6 +1213,19 @@ extract_value(bk_s B, struct bk_dynamic_stat *bds, void *buf, u_int len, bk_flag
   case DynamicStatsValueTypeDouble:
     EXTRACT_BDS_VALUE(bds, buf, len, bds->bds_double);
     break;
+  case DynamicStatsValueTypeRate:
+  case DynamicStatsValueTypeWindow:
+    EXTRACT_BDS_VALUE(bds, buf, len, ((struct bk_dynamic_stat_window *)bds->bds_window)->bdsw_value);
+    break;
+  case DynamicStatsValueTypeCardinality:
+  case DynamicStatsValueTypeTopK:
+  case DynamicStatsValueTypeQuantile:
+    {
+      int64_t figure = bdsk_figure(B, bds);
+
+      EXTRACT_BDS_VALUE(bds, buf, len, figure);
+    }
+    break;
   case DynamicStatsValueTypeString:
     if (((!*(char **)buf) && (len > 0)) ||
 	((*(char **)buf) && (len == 0)))
@@ -1163,22 +1388,32 @@ stat_set(bk_s B, struct bk_dynamic_stat *bds, void *data, bk_flags flags)
     switch(bds->bds_value_type)
     {
     case DynamicStatsValueTypeInt32:
-      bds->bds_int32 = *(int32_t*)data;
+      BDS_ATOMIC_SET(bds->bds_int32, *(int32_t*)data);
       break;
     case DynamicStatsValueTypeUInt32:
-      bds->bds_uint32 = *(u_int32_t*)data;
+      BDS_ATOMIC_SET(bds->bds_uint32, *(u_int32_t*)data);
       break;
     case DynamicStatsValueTypeInt64:
-      bds->bds_int64 = *(int64_t*)data;
+      BDS_ATOMIC_SET(bds->bds_int64, *(int64_t*)data);
       break;
     case DynamicStatsValueTypeUInt64:
-      bds->bds_uint64 = *(u_int64_t*)data;
+      BDS_ATOMIC_SET(bds->bds_uint64, *(u_int64_t*)data);
       break;
     case DynamicStatsValueTypeFloat:
-      bds->bds_float = *(float*)data;
+      BDS_ATOMIC_SET(bds->bds_float, *(float*)data);
       break;
     case DynamicStatsValueTypeDouble:
-      bds->bds_double = *(double*)data;
+      BDS_ATOMIC_SET(bds->bds_double, *(double*)data);
+      break;
+    case DynamicStatsValueTypeRate:
+    case DynamicStatsValueTypeWindow:
+      bdsw_set(bds->bds_window, *(int64_t *)data, bds->bds_value_type == DynamicStatsValueTypeRate);
+      break;
+    case DynamicStatsValueTypeCardinality:
+    case DynamicStatsValueTypeTopK:
+    case DynamicStatsValueTypeQuantile:
+      if (bdsk_set(B, bds, *(int64_t *)data) < 0)
+	goto error;
       break;
     case DynamicStatsValueTypeString:
       {
@@ -1262,23 +1497,36 @@ bk_dynamic_stat_set(bk_s B, bk_dynamic_stats_h stats_list, const char *name, lon
     switch(bds->bds_value_type)
     {
     case DynamicStatsValueTypeInt32:
-      bds->bds_int32 = va_arg(ap, int32_t);
+      BDS_ATOMIC_SET(bds->bds_int32, va_arg(ap, int32_t));
       break;
     case DynamicStatsValueTypeUInt32:
-      bds->bds_uint32 = va_arg(ap, u_int32_t);
+      BDS_ATOMIC_SET(bds->bds_uint32, va_arg(ap, u_int32_t));
       break;
     case DynamicStatsValueTypeInt64:
-      bds->bds_int64 = va_arg(ap, int64_t);
+      BDS_ATOMIC_SET(bds->bds_int64, va_arg(ap, int64_t));
       break;
     case DynamicStatsValueTypeUInt64:
-      bds->bds_uint64 = va_arg(ap, u_int64_t);
+      BDS_ATOMIC_SET(bds->bds_uint64, va_arg(ap, u_int64_t));
       break;
     case DynamicStatsValueTypeFloat:
       // Floats are (apparently) promoted to doubles when passed through stdargs
-      bds->bds_float = va_arg(ap, double);
+      BDS_ATOMIC_SET(bds->bds_float, va_arg(ap, double));
       break;
     case DynamicStatsValueTypeDouble:
-      bds->bds_double = va_arg(ap, double);
+      BDS_ATOMIC_SET(bds->bds_double, va_arg(ap, double));
+      break;
+    case DynamicStatsValueTypeRate:
+    case DynamicStatsValueTypeWindow:
+      bdsw_set(bds->bds_window, va_arg(ap, int64_t), bds->bds_value_type == DynamicStatsValueTypeRate);
+      break;
+    case DynamicStatsValueTypeCardinality:
+    case DynamicStatsValueTypeTopK:
+    case DynamicStatsValueTypeQuantile:
+      if (bdsk_set(B, bds, va_arg(ap, int64_t)) < 0)
+      {
+	va_end(ap);
+	goto error;
+      }
       break;
     case DynamicStatsValueTypeString:
       {
@@ -1364,6 +1612,17 @@ bk_dynamic_stat_attr_update(bk_s B, bk_dynamic_stats_h stats_list, const char *n
     goto error;
   }
 
+  // The per-second history of a windowed stat, or a sketch, cannot be converted
+  if ((BK_FLAG_ISSET(bds->bds_flags, BK_DYNAMIC_STAT_UPDATE_FLAG_VALUE_TYPE) &&
+       (value_type != bds->bds_value_type) &&
+       (BDS_WINDOWED(value_type) || BDS_WINDOWED(bds->bds_value_type) || BDS_SKETCHED(value_type) || BDS_SKETCHED(bds->bds_value_type))) ||
+      (BK_FLAG_ISSET(bds->bds_flags, BK_DYNAMIC_STAT_UPDATE_FLAG_ACCESS_TYPE) &&
+       (access_type != bds->bds_access_type) && (BDS_WINDOWED(bds->bds_value_type) || BDS_SKETCHED(bds->bds_value_type))))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Cannot change the type of %s:%ld to or from a windowed or sketch type\n", name, discriminator);
+    goto error;
+  }
+
   if (BK_FLAG_ISSET(bds->bds_flags, BK_DYNAMIC_STAT_UPDATE_FLAG_VALUE_TYPE))
     bds->bds_value_type = value_type;
 
@@ -1440,23 +1699,36 @@ bk_dynamic_stat_increment(bk_s B, bk_dynamic_stats_h *stats_list, const char *na
   switch(bds->bds_value_type)
   {
   case DynamicStatsValueTypeInt32:
-    bds->bds_int32 += va_arg(ap, int32_t);
+    BDS_ATOMIC_ADD(bds->bds_int32, va_arg(ap, int32_t));
     break;
   case DynamicStatsValueTypeUInt32:
-    bds->bds_uint32 += va_arg(ap, u_int32_t);
+    BDS_ATOMIC_ADD(bds->bds_uint32, va_arg(ap, u_int32_t));
     break;
   case DynamicStatsValueTypeInt64:
-    bds->bds_int64 += va_arg(ap, int64_t);
+    BDS_ATOMIC_ADD(bds->bds_int64, va_arg(ap, int64_t));
     break;
   case DynamicStatsValueTypeUInt64:
-    bds->bds_uint64 += va_arg(ap, u_int64_t);
+    BDS_ATOMIC_ADD(bds->bds_uint64, va_arg(ap, u_int64_t));
     break;
   case DynamicStatsValueTypeFloat:
 	// Float is promoted to double when passed through stdargs
-    bds->bds_float += va_arg(ap, double);
+    BDS_ATOMIC_ADD_FP(bds->bds_float, va_arg(ap, double));
     break;
   case DynamicStatsValueTypeDouble:
-    bds->bds_double += va_arg(ap, double);
+    BDS_ATOMIC_ADD_FP(bds->bds_double, va_arg(ap, double));
+    break;
+  case DynamicStatsValueTypeRate:
+  case DynamicStatsValueTypeWindow:
+    bdsw_add(bds->bds_window, va_arg(ap, int64_t), bds->bds_value_type == DynamicStatsValueTypeRate);
+    break;
+  case DynamicStatsValueTypeCardinality:
+  case DynamicStatsValueTypeTopK:
+  case DynamicStatsValueTypeQuantile:
+    if (bdsk_set(B, bds, va_arg(ap, int64_t)) < 0)
+    {
+      va_end(ap);
+      goto error;
+    }
     break;
   case DynamicStatsValueTypeString:
     bk_error_printf(B, BK_ERR_ERR, "Incrementing a string value is not permitted\n");
@@ -1483,118 +1755,827 @@ bk_dynamic_stat_increment(bk_s B, bk_dynamic_stats_h *stats_list, const char *na
 
 
 /**
- * Get the next value from the statistics list. If *bdsp == NULL, then get the firist value.
+ * Add to a stat through its handle (from registration or
+ * bk_dynamic_stat_get), without taking the list lock or searching by
+ * name: the per-packet counter path.  @a incr is converted to the stat's
+ * type.  The handle stays valid until the list is destroyed, even across
+ * deregistration (see @a bk_dynamic_stat_deregister).
+ *
+ * THREADS: MT-SAFE
  *
  *	@param B BAKA thread/global state.
- *	@param bds The stat struct containing the value.
- *	@param bdsp The C/O (only) bds for use with the successor function()
- *	@param typep The C/O value indicating the value's type.
- *	@param valuep The C/O result.
+ *	@param dyn_stat The stat handle.
+ *	@param incr Amount to add (may be negative).
  *	@param flags Flags for future use.
  *	@return <i>-1</i> on failure.<br>
- *	@return <i>0</i> if there is value.
- *	@return <i>1</i> on success.
+ *	@return <i>0</i> on success.
  */
-static int
-bdsl_getnext(bk_s B, struct bk_dynamic_stats_list *bdsl, struct bk_dynamic_stat **bdsp, u_int priority, bk_dynamic_stats_value_type_e *typep, bk_dynamic_stat_value_u *valuep, bk_flags flags)
+int
+bk_dynamic_stat_handle_add(bk_s B, bk_dynamic_stat_h dyn_stat, int64_t incr, bk_flags flags)
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
-  struct bk_dynamic_stat *bds;
+  struct bk_dynamic_stat *bds = (struct bk_dynamic_stat *)dyn_stat;
 
-  if (!bdsl || !bdsp)
+  if (!bds)
   {
     bk_error_printf(B, BK_ERR_ERR,"Illegal arguments\n");
     BK_RETURN(B, -1);
   }
 
-  if (!*bdsp)
-  {
-    bds = stats_list_minimum(bdsl->bdsl_list);
-  }
-  else
+  if (bds->bds_access_type == DynamicStatsAccessTypeIndirect)
   {
-    bds = stats_list_successor(bdsl->bdsl_list, *bdsp);
+    bk_error_printf(B, BK_ERR_ERR, "Indirect stats should not use %s\n", __FUNCTION__);
+    BK_RETURN(B, -1);
   }
 
-  while(bds)
+  switch(bds->bds_value_type)
   {
-    struct bk_dynamic_stat *tbds = stats_list_successor(bdsl->bdsl_list, bds);
-    if (priority >= bds->bds_priority)
-      break;
-    bds = tbds;
+  case DynamicStatsValueTypeInt32:
+    BDS_ATOMIC_ADD(bds->bds_int32, (int32_t)incr);
+    break;
+  case DynamicStatsValueTypeUInt32:
+    BDS_ATOMIC_ADD(bds->bds_uint32, (u_int32_t)incr);
+    break;
+  case DynamicStatsValueTypeInt64:
+    BDS_ATOMIC_ADD(bds->bds_int64, incr);
+    break;
+  case DynamicStatsValueTypeUInt64:
+    BDS_ATOMIC_ADD(bds->bds_uint64, (u_int64_t)incr);
+    break;
+  case DynamicStatsValueTypeFloat:
+    BDS_ATOMIC_ADD_FP(bds->bds_float, incr);
+    break;
+  case DynamicStatsValueTypeDouble:
+    BDS_ATOMIC_ADD_FP(bds->bds_double, incr);
+    break;
+  case DynamicStatsValueTypeRate:
+  case DynamicStatsValueTypeWindow:
+    bdsw_add(bds->bds_window, incr, bds->bds_value_type == DynamicStatsValueTypeRate);
+    break;
+  case DynamicStatsValueTypeCardinality:
+  case DynamicStatsValueTypeTopK:
+  case DynamicStatsValueTypeQuantile:
+    BK_RETURN(B, bdsk_set(B, bds, incr));
+  case DynamicStatsValueTypeString:
+    bk_error_printf(B, BK_ERR_ERR, "Incrementing a string value is not permitted\n");
+    BK_RETURN(B, -1);
+  default:
+    bk_error_printf(B, BK_ERR_ERR,"Unknown statistics value type: %d\n", bds->bds_value_type);
+    BK_RETURN(B, -1);
   }
 
-  if (!bds)
-    BK_RETURN(B, 0);
+  BK_RETURN(B, 0);
+}
 
-  *bdsp = bds;
 
 
-  /*
-   *  Internal callers of this function are permitted to extract just the
-   *  bds structure since they can read it directly. The type and value
-   *  copy outs are only required for external clients for whome the bds is
-   *  an opaque value.
-   */
-  if (typep)
-    *typep = bds->bds_value_type;
+/**
+ * Set a numeric stat through its handle, without taking the list lock or
+ * searching by name.  @a value is converted to the stat's type.  String
+ * stats must still be set by name (bk_dynamic_stat_set), which copies
+ * them under the lock.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state.
+ *	@param dyn_stat The stat handle.
+ *	@param value The new value.
+ *	@param flags Flags for future use.
+ *	@return <i>-1</i> on failure.<br>
+ *	@return <i>0</i> on success.
+ */
+int
+bk_dynamic_stat_handle_set(bk_s B, bk_dynamic_stat_h dyn_stat, int64_t value, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stat *bds = (struct bk_dynamic_stat *)dyn_stat;
 
-  if (bdsp && valuep)
-    BK_RETURN(B, extract_value(B, bds, valuep, sizeof(*valuep), 0));
+  if (!bds)
+  {
+    bk_error_printf(B, BK_ERR_ERR,"Illegal arguments\n");
+    BK_RETURN(B, -1);
+  }
 
-  BK_RETURN(B, 1);
+  if (bds->bds_access_type == DynamicStatsAccessTypeIndirect)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Indirect stats should not use %s\n", __FUNCTION__);
+    BK_RETURN(B, -1);
+  }
+
+  switch(bds->bds_value_type)
+  {
+  case DynamicStatsValueTypeInt32:
+    BDS_ATOMIC_SET(bds->bds_int32, value);
+    break;
+  case DynamicStatsValueTypeUInt32:
+    BDS_ATOMIC_SET(bds->bds_uint32, value);
+    break;
+  case DynamicStatsValueTypeInt64:
+    BDS_ATOMIC_SET(bds->bds_int64, value);
+    break;
+  case DynamicStatsValueTypeUInt64:
+    BDS_ATOMIC_SET(bds->bds_uint64, value);
+    break;
+  case DynamicStatsValueTypeFloat:
+    BDS_ATOMIC_SET(bds->bds_float, value);
+    break;
+  case DynamicStatsValueTypeDouble:
+    BDS_ATOMIC_SET(bds->bds_double, value);
+    break;
+  case DynamicStatsValueTypeRate:
+  case DynamicStatsValueTypeWindow:
+    bdsw_set(bds->bds_window, value, bds->bds_value_type == DynamicStatsValueTypeRate);
+    break;
+  case DynamicStatsValueTypeCardinality:
+  case DynamicStatsValueTypeTopK:
+  case DynamicStatsValueTypeQuantile:
+    BK_RETURN(B, bdsk_set(B, bds, value));
+  case DynamicStatsValueTypeString:
+    bk_error_printf(B, BK_ERR_ERR, "String stats cannot be set through %s\n", __FUNCTION__);
+    BK_RETURN(B, -1);
+  default:
+    bk_error_printf(B, BK_ERR_ERR,"Unknown statistics value type: %d\n", bds->bds_value_type);
+    BK_RETURN(B, -1);
+  }
+
+  BK_RETURN(B, 0);
 }
 
 
 
+
 /**
- * Extract, from a list of statistics values, the next value at or above a
- * particular priority order. If *statp == NULL, this function returns the
- * first value in the list (subject to the priority of course).
+ * Get the windowed figures of a Rate or Window stat through its handle.
+ * Seconds which have completed since the last update are folded in
+ * first, so an idle stat decays as it should.
+ *
+ * THREADS: MT-SAFE
  *
  *	@param B BAKA thread/global state.
- *	@param stats_list The stat struct containing the value.
- *	@param iterator The C/O iterator (opaque)
- *	@param buf The C/O results buf.
- *	@param len The length of the results buf.
+ *	@param dyn_stat The stat handle.
+ *	@param values Copy-out windowed figures.
  *	@param flags Flags for future use.
  *	@return <i>-1</i> on failure.<br>
  *	@return <i>0</i> on success.
  */
 int
-bk_dynamic_stats_getnext(bk_s B, bk_dynamic_stats_h stats_list, bk_dynamic_stat_h *statp, u_int priority, bk_dynamic_stats_value_type_e *typep, bk_dynamic_stat_value_u *valuep, bk_flags flags)
+bk_dynamic_stat_window_get(bk_s B, bk_dynamic_stat_h dyn_stat, struct bk_dynamic_stat_window_values *values, bk_flags flags)
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
-  struct bk_dynamic_stats_list *bdsl = (struct bk_dynamic_stats_list *)stats_list;
-  struct bk_dynamic_stat **bdsp = (struct bk_dynamic_stat **)statp;
-  int locked = 0;
-  int ret;
+  struct bk_dynamic_stat *bds = (struct bk_dynamic_stat *)dyn_stat;
+  struct bk_dynamic_stat_window *bdsw;
+  int64_t sum1 = 0, sum10 = 0, sum60 = 0, cnt1 = 0, cnt10 = 0, cnt60 = 0;
+  int64_t min = INT64_MAX, max = INT64_MIN;
+  int64_t now, sec, latest;
+  int rate;
 
-  if (!bdsl)
+  if (!bds || !values || !BDS_WINDOWED(bds->bds_value_type) || !(bdsw = bds->bds_window))
   {
     bk_error_printf(B, BK_ERR_ERR,"Illegal arguments\n");
     BK_RETURN(B, -1);
   }
 
-  STATS_LIST_LOCK(bdsl, locked);
+  rate = (bds->bds_value_type == DynamicStatsValueTypeRate);
+  now = bdsw_now();
+  bdsw_advance(bdsw, now, rate);
 
-  ret = bdsl_getnext(B, bdsl, bdsp, priority, typep, valuep, flags);
+  latest = __atomic_load_n(&bdsw->bdsw_value, __ATOMIC_RELAXED);
 
-  STATS_LIST_UNLOCK(bdsl, locked);
+  // The last sixty complete seconds, then (for samples) the current one
+  for (sec = now - 60; sec <= now; sec++)
+  {
+    struct bdsw_bucket *bucket = &bdsw->bdsw_buckets[sec & (BDSW_SECS - 1)];
+    int64_t sum = 0, count = 0;
 
-  BK_RETURN(B, ret);
+    if (__atomic_load_n(&bucket->bdswb_sec, __ATOMIC_ACQUIRE) != sec)
+    {
+      if (rate && sec < now)
+      {
+	// A second nobody counted in had a rate of zero
+	min = MIN(min, 0);
+	max = MAX(max, 0);
+      }
+      continue;
+    }
 
- error:
-  STATS_LIST_UNLOCK(bdsl, locked);
-  BK_RETURN(B, -1);
-}
+    sum = __atomic_load_n(&bucket->bdswb_sum, __ATOMIC_RELAXED);
+    count = __atomic_load_n(&bucket->bdswb_count, __ATOMIC_RELAXED);
 
+    if (rate)
+    {
+      if (sec < now)
+      {
+	min = MIN(min, sum);
+	max = MAX(max, sum);
+      }
+    }
+    else if (count)
+    {
+      min = MIN(min, __atomic_load_n(&bucket->bdswb_min, __ATOMIC_RELAXED));
+      max = MAX(max, __atomic_load_n(&bucket->bdswb_max, __ATOMIC_RELAXED));
+    }
 
+    if (sec == now)
+      continue;
 
-#define STAT_XML_OUTPUT(bds, fmt, value)							\
-do												\
-{												\
-  typeof(value) __value;									\
+    sum60 += sum;
+    cnt60 += count;
+    if (sec >= now - 10)
+    {
+      sum10 += sum;
+      cnt10 += count;
+    }
+    if (sec == now - 1)
+    {
+      sum1 = sum;
+      cnt1 = count;
+    }
+  }
+
+  values->bdswv_value = latest;
+  if (rate)
+  {
+    values->bdswv_1s = sum1;
+    values->bdswv_10s = sum10 / 10.0;
+    values->bdswv_60s = sum60 / 60.0;
+  }
+  else
+  {
+    // A gauge nobody set in a window still has its latest value
+    values->bdswv_1s = cnt1 ? (double)sum1 / cnt1 : latest;
+    values->bdswv_10s = cnt10 ? (double)sum10 / cnt10 : latest;
+    values->bdswv_60s = cnt60 ? (double)sum60 / cnt60 : latest;
+    if (min > max)
+      min = max = latest;
+  }
+  __atomic_load(&bdsw->bdsw_ewma, &values->bdswv_ewma, __ATOMIC_RELAXED);
+  if (!rate && !__atomic_load_n(&bdsw->bdsw_primed, __ATOMIC_RELAXED))
+    values->bdswv_ewma = latest;
+  values->bdswv_min = min;
+  values->bdswv_max = max;
+
+  BK_RETURN(B, 0);
+}
+
+
+/**
+ * Feed a Cardinality, TopK or Quantile stat through its handle.  A
+ * Cardinality stat counts distinct keys (@a value is ignored); a TopK stat
+ * counts @a value occurrences of the key; a Quantile stat records @a value
+ * as a sample (the key is ignored and may be NULL).
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state.
+ *	@param dyn_stat The stat handle.
+ *	@param key The key observed.
+ *	@param keylen Length of the key (at most BK_TOPK_MAXKEY_DEFAULT for TopK).
+ *	@param value Weight (TopK) or sample (Quantile).
+ *	@param flags Flags for future use.
+ *	@return <i>-1</i> on failure.<br>
+ *	@return <i>0</i> on success.
+ */
+int
+bk_dynamic_stat_handle_observe(bk_s B, bk_dynamic_stat_h dyn_stat, const void *key, size_t keylen, int64_t value, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stat *bds = (struct bk_dynamic_stat *)dyn_stat;
+
+  if (!bds || !BDS_SKETCHED(bds->bds_value_type) || (!key && bds->bds_value_type != DynamicStatsValueTypeQuantile))
+  {
+    bk_error_printf(B, BK_ERR_ERR,"Illegal arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  BK_RETURN(B, bdsk_observe(B, bds, key, keylen, value));
+}
+
+
+
+/**
+ * Get the sketch behind a Cardinality (struct bk_hll), TopK (struct
+ * bk_topk) or Quantile (struct bk_quantile) stat, for queries the stat
+ * value does not answer, or to merge per-thread sketches into it.  The
+ * sketch belongs to the stat.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state.
+ *	@param dyn_stat The stat handle.
+ *	@param flags Flags for future use.
+ *	@return <i>NULL</i> on failure.<br>
+ *	@return <i>sketch</i> on success.
+ */
+void *
+bk_dynamic_stat_sketch(bk_s B, bk_dynamic_stat_h dyn_stat, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stat *bds = (struct bk_dynamic_stat *)dyn_stat;
+
+  if (!bds || !BDS_SKETCHED(bds->bds_value_type))
+  {
+    bk_error_printf(B, BK_ERR_ERR,"Illegal arguments\n");
+    BK_RETURN(B, NULL);
+  }
+
+  BK_RETURN(B, bds->bds_sketch);
+}
+
+
+
+
+/**
+ * Create the per-second history of a Rate or Window stat
+ *
+ *	@param B BAKA thread/global state.
+ *	@param flags Flags for future use.
+ *	@return <i>NULL</i> on failure.<br>
+ *	@return a new <i>window</i> on success.
+ */
+static struct bk_dynamic_stat_window *
+bdsw_create(bk_s B, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stat_window *bdsw;
+  u_int cnt;
+
+  if (!(BK_CALLOC(bdsw)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not calloc: %s\n", strerror(errno));
+    BK_RETURN(B, NULL);
+  }
+
+  for (cnt = 0; cnt < BDSW_SECS; cnt++)
+    bdsw->bdsw_buckets[cnt].bdswb_sec = -1;
+  bdsw->bdsw_folded = bdsw_now() - 1;
+  // Discrete form of exp(-1/T), which keeps libm out of the update path
+  bdsw->bdsw_decay = 1.0 - 1.0 / BK_DYNAMIC_STAT_EWMA_SECS;
+
+  BK_RETURN(B, bdsw);
+}
+
+
+
+/**
+ * Seconds on the (coarse) monotonic clock
+ *
+ *	@return <i>seconds</i> since some arbitrary point
+ */
+static inline int64_t
+bdsw_now(void)
+{
+  return(bk_shmmap_nowms() / 1000);
+}
+
+
+
+/**
+ * Make the bucket for @a now current, folding every second completed
+ * since the last call into the EWMA.  Cheap when there is nothing to do;
+ * otherwise serialized by the window's spin flag.
+ *
+ *	@param bdsw The window.
+ *	@param now The current second.
+ *	@param rate Window belongs to a Rate (otherwise a Window) stat.
+ */
+static void
+bdsw_advance(struct bk_dynamic_stat_window *bdsw, int64_t now, int rate)
+{
+  struct bdsw_bucket *bucket = &bdsw->bdsw_buckets[now & (BDSW_SECS - 1)];
+  int64_t sec, latest, skip;
+  double ewma, x, decay;
+
+  if (__atomic_load_n(&bucket->bdswb_sec, __ATOMIC_ACQUIRE) == now &&
+      __atomic_load_n(&bdsw->bdsw_folded, __ATOMIC_RELAXED) >= now - 1)
+    return;
+
+  while (__atomic_test_and_set(&bdsw->bdsw_spin, __ATOMIC_ACQUIRE))
+    sched_yield();
+
+  if ((sec = bdsw->bdsw_folded + 1) < now)
+  {
+    latest = __atomic_load_n(&bdsw->bdsw_value, __ATOMIC_RELAXED);
+    ewma = bdsw->bdsw_ewma;
+
+    // Seconds too old to have a bucket were all empty; fold them at once
+    if ((skip = now - BDSW_SECS - sec) > 0)
+    {
+      x = rate ? 0 : latest;
+      for (decay = bdsw->bdsw_decay; skip && (bdsw->bdsw_primed || rate); skip >>= 1, decay *= decay)
+      {
+	if (skip & 1)
+	  ewma = x + (ewma - x) * decay;
+      }
+      sec = now - BDSW_SECS;
+    }
+
+    for (; sec < now; sec++)
+    {
+      struct bdsw_bucket *old = &bdsw->bdsw_buckets[sec & (BDSW_SECS - 1)];
+      int64_t count = 0;
+
+      if (__atomic_load_n(&old->bdswb_sec, __ATOMIC_RELAXED) == sec)
+	count = __atomic_load_n(&old->bdswb_count, __ATOMIC_RELAXED);
+
+      if (rate)
+	x = count ? __atomic_load_n(&old->bdswb_sum, __ATOMIC_RELAXED) : 0;
+      else if (count)
+	x = (double)__atomic_load_n(&old->bdswb_sum, __ATOMIC_RELAXED) / count;
+      else if (bdsw->bdsw_primed)
+	x = latest;
+      else
+	continue;				// Nothing sampled yet
+
+      // A gauge starts from its first figure; a rate from zero
+      ewma = (bdsw->bdsw_primed || rate) ? x + (ewma - x) * bdsw->bdsw_decay : x;
+      bdsw->bdsw_primed = 1;
+    }
+
+    __atomic_store(&bdsw->bdsw_ewma, &ewma, __ATOMIC_RELAXED);
+    __atomic_store_n(&bdsw->bdsw_folded, now - 1, __ATOMIC_RELAXED);
+  }
+
+  if (bucket->bdswb_sec != now)
+  {
+    __atomic_store_n(&bucket->bdswb_sum, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&bucket->bdswb_count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&bucket->bdswb_min, INT64_MAX, __ATOMIC_RELAXED);
+    __atomic_store_n(&bucket->bdswb_max, INT64_MIN, __ATOMIC_RELAXED);
+    // Updaters only use the bucket once they see it is theirs
+    __atomic_store_n(&bucket->bdswb_sec, now, __ATOMIC_RELEASE);
+  }
+
+  __atomic_clear(&bdsw->bdsw_spin, __ATOMIC_RELEASE);
+}
+
+
+
+/**
+ * Account an update in the current second's bucket
+ *
+ *	@param bdsw The window.
+ *	@param amount Events (Rate) or sample (Window).
+ *	@param rate Window belongs to a Rate (otherwise a Window) stat.
+ */
+static void
+bdsw_record(struct bk_dynamic_stat_window *bdsw, int64_t amount, int rate)
+{
+  int64_t now = bdsw_now();
+  struct bdsw_bucket *bucket = &bdsw->bdsw_buckets[now & (BDSW_SECS - 1)];
+  int64_t old;
+
+  if (__atomic_load_n(&bucket->bdswb_sec, __ATOMIC_ACQUIRE) != now)
+    bdsw_advance(bdsw, now, rate);
+
+  __atomic_add_fetch(&bucket->bdswb_sum, amount, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&bucket->bdswb_count, 1, __ATOMIC_RELAXED);
+
+  if (rate)
+    return;
+
+  old = __atomic_load_n(&bucket->bdswb_min, __ATOMIC_RELAXED);
+  while (amount < old && !__atomic_compare_exchange_n(&bucket->bdswb_min, &old, amount, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ; // Void
+  old = __atomic_load_n(&bucket->bdswb_max, __ATOMIC_RELAXED);
+  while (amount > old && !__atomic_compare_exchange_n(&bucket->bdswb_max, &old, amount, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ; // Void
+}
+
+
+
+/**
+ * Set a windowed stat: a new total for a Rate (the difference since the
+ * previous total counts as events; the first total just sets the base),
+ * a new sample for a Window.
+ *
+ *	@param bdsw The window.
+ *	@param value The new total or sample.
+ *	@param rate Window belongs to a Rate (otherwise a Window) stat.
+ */
+static void
+bdsw_set(struct bk_dynamic_stat_window *bdsw, int64_t value, int rate)
+{
+  int64_t old = __atomic_exchange_n(&bdsw->bdsw_value, value, __ATOMIC_RELAXED);
+
+  if (!rate)
+    bdsw_record(bdsw, value, rate);
+  else if (__atomic_exchange_n(&bdsw->bdsw_based, 1, __ATOMIC_RELAXED))
+    bdsw_record(bdsw, value - old, rate);
+}
+
+
+
+/**
+ * Add to a windowed stat: events for a Rate, a relative change of the
+ * gauge for a Window (the result is the new sample).
+ *
+ *	@param bdsw The window.
+ *	@param incr The amount to add.
+ *	@param rate Window belongs to a Rate (otherwise a Window) stat.
+ */
+static void
+bdsw_add(struct bk_dynamic_stat_window *bdsw, int64_t incr, int rate)
+{
+  int64_t value = __atomic_add_fetch(&bdsw->bdsw_value, incr, __ATOMIC_RELAXED);
+
+  if (rate)
+  {
+    __atomic_store_n(&bdsw->bdsw_based, 1, __ATOMIC_RELAXED);
+    bdsw_record(bdsw, incr, rate);
+  }
+  else
+  {
+    bdsw_record(bdsw, value, rate);
+  }
+}
+
+
+/**
+ * Create the sketch behind a Cardinality, TopK or Quantile stat, with
+ * the default shape so that sketches of the same type always merge.
+ *
+ *	@param B BAKA thread/global state.
+ *	@param type The stat value type.
+ *	@param flags Flags for future use.
+ *	@return <i>NULL</i> on failure.<br>
+ *	@return a new <i>sketch</i> on success.
+ */
+static void *
+bdsk_create(bk_s B, bk_dynamic_stats_value_type_e type, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  void *sketch = NULL;
+
+  switch(type)
+  {
+  case DynamicStatsValueTypeCardinality:
+    sketch = bk_hll_create(B, 0, 0);
+    break;
+  case DynamicStatsValueTypeTopK:
+    sketch = bk_topk_create(B, 0, 0, 0, 0, 0);
+    break;
+  case DynamicStatsValueTypeQuantile:
+    sketch = bk_quantile_create(B, 0, 0, 0);
+    break;
+  default:
+    bk_error_printf(B, BK_ERR_ERR,"Not a sketch type: %d\n", type);
+    break;
+  }
+
+  BK_RETURN(B, sketch);
+}
+
+
+
+/**
+ * Destroy the sketch behind a stat
+ *
+ *	@param B BAKA thread/global state.
+ *	@param bds The stat.
+ */
+static void
+bdsk_destroy(bk_s B, struct bk_dynamic_stat *bds)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  switch(bds->bds_value_type)
+  {
+  case DynamicStatsValueTypeCardinality:
+    bk_hll_destroy(B, bds->bds_sketch);
+    break;
+  case DynamicStatsValueTypeTopK:
+    bk_topk_destroy(B, bds->bds_sketch);
+    break;
+  case DynamicStatsValueTypeQuantile:
+    bk_quantile_destroy(B, bds->bds_sketch);
+    break;
+  default:
+    break;
+  }
+  bds->bds_sketch = NULL;
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Feed a sketch stat (see bk_dynamic_stat_handle_observe)
+ *
+ *	@param B BAKA thread/global state.
+ *	@param bds The stat.
+ *	@param key The key observed.
+ *	@param keylen Length of the key.
+ *	@param value Weight (TopK) or sample (Quantile).
+ *	@return <i>-1</i> on failure.<br>
+ *	@return <i>0</i> on success.
+ */
+static int
+bdsk_observe(bk_s B, struct bk_dynamic_stat *bds, const void *key, size_t keylen, int64_t value)
+{
+  switch(bds->bds_value_type)
+  {
+  case DynamicStatsValueTypeCardinality:
+    return(bk_hll_add(B, bds->bds_sketch, key, keylen));
+  case DynamicStatsValueTypeTopK:
+    if (value <= 0)
+      return(0);
+    return(bk_topk_add(B, bds->bds_sketch, key, keylen, value));
+  case DynamicStatsValueTypeQuantile:
+    return(bk_quantile_add(B, bds->bds_sketch, value));
+  default:
+    bk_error_printf(B, BK_ERR_ERR,"Not a sketch type: %d\n", bds->bds_value_type);
+    return(-1);
+  }
+}
+
+
+
+/**
+ * Set or add to a sketch stat by value: a Quantile records it as a
+ * sample, while Cardinality and TopK observe the value itself as a key
+ * (so a stat of, say, IPv4 addresses needs no key buffer).
+ *
+ *	@param B BAKA thread/global state.
+ *	@param bds The stat.
+ *	@param value The value.
+ *	@return <i>-1</i> on failure.<br>
+ *	@return <i>0</i> on success.
+ */
+static int
+bdsk_set(bk_s B, struct bk_dynamic_stat *bds, int64_t value)
+{
+  if (bds->bds_value_type == DynamicStatsValueTypeQuantile)
+    return(bdsk_observe(B, bds, NULL, 0, value));
+
+  return(bdsk_observe(B, bds, &value, sizeof(value), 1));
+}
+
+
+
+/**
+ * The Int64 value of a sketch stat: the distinct count (Cardinality),
+ * total weight (TopK) or sample count (Quantile).
+ *
+ *	@param B BAKA thread/global state.
+ *	@param bds The stat.
+ *	@return <i>value</i>
+ */
+static int64_t
+bdsk_figure(bk_s B, struct bk_dynamic_stat *bds)
+{
+  switch(bds->bds_value_type)
+  {
+  case DynamicStatsValueTypeCardinality:
+    return(bk_hll_count(B, bds->bds_sketch));
+  case DynamicStatsValueTypeTopK:
+    return(bk_topk_total(B, bds->bds_sketch));
+  case DynamicStatsValueTypeQuantile:
+    return(bk_quantile_count(B, bds->bds_sketch));
+  default:
+    return(0);
+  }
+}
+
+
+
+/**
+ * Spell a (binary) TopK key in hex for XML and export names
+ *
+ *	@param key The key.
+ *	@param keylen Length of the key (at most BK_TOPK_MAXKEY_DEFAULT).
+ *	@param buf Copy-out buffer of BDSK_HEXKEY_MAX bytes.
+ */
+static void
+bdsk_hexkey(const void *key, size_t keylen, char *buf)
+{
+  static const char hex[] = "0123456789abcdef";
+  const u_char *k = key;
+  size_t cnt;
+
+  for (cnt = 0; cnt < keylen && cnt < BK_TOPK_MAXKEY_DEFAULT; cnt++)
+  {
+    *buf++ = hex[k[cnt] >> 4];
+    *buf++ = hex[k[cnt] & 0xf];
+  }
+  *buf = '\0';
+}
+
+
+
+/**
+ * Get the next value from the statistics list. If *bdsp == NULL, then get the firist value.
+ *
+ *	@param B BAKA thread/global state.
+ *	@param bds The stat struct containing the value.
+ *	@param bdsp The C/O (only) bds for use with the successor function()
+ *	@param typep The C/O value indicating the value's type.
+ *	@param valuep The C/O result.
+ *	@param flags Flags for future use.
+ *	@return <i>-1</i> on failure.<br>
+ *	@return <i>0</i> if there is value.
+ *	@return <i>1</i> on success.
+ */
+static int
+bdsl_getnext(bk_s B, struct bk_dynamic_stats_list *bdsl, struct bk_dynamic_stat **bdsp, u_int priority, bk_dynamic_stats_value_type_e *typep, bk_dynamic_stat_value_u *valuep, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stat *bds;
+
+  if (!bdsl || !bdsp)
+  {
+    bk_error_printf(B, BK_ERR_ERR,"Illegal arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (!*bdsp)
+  {
+    bds = stats_list_minimum(bdsl->bdsl_list);
+  }
+  else
+  {
+    bds = stats_list_successor(bdsl->bdsl_list, *bdsp);
+  }
+
+  while(bds)
+  {
+    struct bk_dynamic_stat *tbds = stats_list_successor(bdsl->bdsl_list, bds);
+    if (priority >= bds->bds_priority)
+      break;
+    bds = tbds;
+  }
+
+  if (!bds)
+    BK_RETURN(B, 0);
+
+  *bdsp = bds;
+
+
+  /*
+   *  Internal callers of this function are permitted to extract just the
+   *  bds structure since they can read it directly. The type and value
+   *  copy outs are only required for external clients for whome the bds is
+   *  an opaque value.
+   */
+  if (typep)
+    *typep = bds->bds_value_type;
+
+  if (bdsp && valuep)
+    BK_RETURN(B, extract_value(B, bds, valuep, sizeof(*valuep), 0));
+
+  BK_RETURN(B, 1);
+}
+
+
+
+/**
+ * Extract, from a list of statistics values, the next value at or above a
+ * particular priority order. If *statp == NULL, this function returns the
+ * first value in the list (subject to the priority of course).
+ *
+ *	@param B BAKA thread/global state.
+ *	@param stats_list The stat struct containing the value.
+ *	@param iterator The C/O iterator (opaque)
+ *	@param buf The C/O results buf.
+ *	@param len The length of the results buf.
+ *	@param flags Flags for future use.
+ *	@return <i>-1</i> on failure.<br>
+ *	@return <i>0</i> on success.
+ */
+int
+bk_dynamic_stats_getnext(bk_s B, bk_dynamic_stats_h stats_list, bk_dynamic_stat_h *statp, u_int priority, bk_dynamic_stats_value_type_e *typep, bk_dynamic_stat_value_u *valuep, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stats_list *bdsl = (struct bk_dynamic_stats_list *)stats_list;
+  struct bk_dynamic_stat **bdsp = (struct bk_dynamic_stat **)statp;
+  int locked = 0;
+  int ret;
+
+  if (!bdsl)
+  {
+    bk_error_printf(B, BK_ERR_ERR,"Illegal arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  STATS_LIST_LOCK(bdsl, locked);
+
+  ret = bdsl_getnext(B, bdsl, bdsp, priority, typep, valuep, flags);
+
+  STATS_LIST_UNLOCK(bdsl, locked);
+
+  BK_RETURN(B, ret);
+
+ error:
+  STATS_LIST_UNLOCK(bdsl, locked);
+  BK_RETURN(B, -1);
+}
+
+
+
+#define STAT_XML_OUTPUT(bds, fmt, value)							\
+do												\
+{												\
+  typeof(value) __value;									\
   int __vptr_ret = 0;										\
 												\
   if (((bds)->bds_access_type == DynamicStatsAccessTypeIndirect) && !bds->bds_ptr)		\
@@ -1633,7 +2614,7 @@ do												\
   {												\
     if ((bds)->bds_access_type == DynamicStatsAccessTypeDirect)					\
     {												\
-      __value = (value);									\
+      __atomic_load(&(value), &__value, __ATOMIC_RELAXED);					\
     }												\
     else											\
     {												\
@@ -1662,176 +2643,1125 @@ do												\
 }while(0);
 
 /**
- * Obtain an (allocated) XML string which lists all the statistics at or
- * above a particular priority level. Caller must destroy.
+ * Obtain an (allocated) XML string which lists all the statistics at or
+ * above a particular priority level. Caller must destroy.
+ *
+ *	@param B BAKA thread/global state.
+ *	@param stats_list The stats list from which to extract the values
+ *	@param priority The priority filter.
+ *	@param prefix A fixed string to prepend to all output lines (presumably tab)
+ *	@param flags Flags for future use.
+ *	@return <i>NULL</i> on failure.<br>
+ *	@return a new <i>XML string</i> on success.
+ */
+char *
+bk_dynamic_stats_XML_create(bk_s B, bk_dynamic_stats_h stats_list, u_int priority, const char *prefix, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stats_list *bdsl = (struct bk_dynamic_stats_list *)stats_list;
+  struct bk_dynamic_stat *bds = NULL;
+  bk_vstr xml_vstr;
+  int ret;
+  char *xml_str = NULL;				// Used for str2xml conversion
+  time_t timenow = time(NULL);
+  char time_buf[50];
+  char stat_buf[1024];
+  int locked = 0;
+
+  if (!bdsl || !prefix)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, NULL);
+  }
+
+#ifdef BK_USING_PTHREADS
+#ifndef NO_THREAD_CPU_STAT
+  if (!__atomic_load_n(&bdsl->bdsl_collector, __ATOMIC_ACQUIRE) && manage_thread_stats(B, bdsl, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not manage thread stats\n");
+    goto error;
+  }
+#endif /* NO_THREAD_CPU_STAT */
+#endif /* BK_USING_PTHREADS */
+
+  if (!(xml_vstr.ptr = malloc(1)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate initial NUL for XML output string: %s\n", strerror(errno));
+    goto error;
+  }
+
+  *xml_vstr.ptr = '\0'; // Initialize empty string for the purpose of using bk_vstr.ptr
+  xml_vstr.max = 1;
+  xml_vstr.cur = 0;
+
+  if (!strftime(time_buf, sizeof(time_buf), BK_STRFTIME_DEFAULT_FMT, gmtime(&timenow)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not convert current time to a string: %s\n", strerror(errno));
+    goto error;
+  }
+
+  snprintf(stat_buf, sizeof(stat_buf), "%s<statistics generated=\"%s\">\n", prefix, (char *)time_buf);
+
+  if (bk_vstr_cat(B, 0, &xml_vstr, "%s", stat_buf))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not begin XML statitics string\n");
+    goto error;
+  }
+
+  STATS_LIST_LOCK(bdsl, locked);
+
+  if (bk_dynamic_stats_demand_update(B, bdsl, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not run the statistics demand update\n");
+    goto error;
+  }
+
+  while((ret = bdsl_getnext(B, bdsl, &bds, priority, NULL, NULL, 0)) == 1)
+  {
+    switch(bds->bds_value_type)
+    {
+    case DynamicStatsValueTypeInt32:
+      STAT_XML_OUTPUT(bds, "%d", bds->bds_int32);
+      break;
+    case DynamicStatsValueTypeUInt32:
+      STAT_XML_OUTPUT(bds, "%u", bds->bds_uint32);
+      break;
+    case DynamicStatsValueTypeInt64:
+      STAT_XML_OUTPUT(bds, "%ld", bds->bds_int64);
+      break;
+    case DynamicStatsValueTypeUInt64:
+      STAT_XML_OUTPUT(bds, "%lu", bds->bds_uint64);
+      break;
+    case DynamicStatsValueTypeFloat:
+      STAT_XML_OUTPUT(bds, "%.4f", bds->bds_float);
+      break;
+    case DynamicStatsValueTypeDouble:
+      STAT_XML_OUTPUT(bds, "%.4lf", bds->bds_double);
+      break;
+    case DynamicStatsValueTypeString:
+      if (!bds->bds_string && !(bds->bds_string = strdup("")))
+      {
+	bk_error_printf(B, BK_ERR_ERR, "Could not strdup emptry string: %s\n", strerror(errno));
+	goto error;
+      }
+      if (!(xml_str = bk_string_str2xml(B, bds->bds_string, 0)))
+      {
+	bk_error_printf(B, BK_ERR_ERR, "Could not convert string to XML\n");
+	goto error;
+      }
+      STAT_XML_OUTPUT(bds, "%s", xml_str);
+      free(xml_str);
+      xml_str = NULL;
+      break;
+    case DynamicStatsValueTypeRate:
+    case DynamicStatsValueTypeWindow:
+      if (bdsw_xml(B, bds, &xml_vstr, prefix, 0) < 0)
+      {
+	bk_error_printf(B, BK_ERR_ERR, "Could not output windowed statistic %s\n", bds->bds_name);
+	goto error;
+      }
+      break;
+    case DynamicStatsValueTypeCardinality:
+    case DynamicStatsValueTypeTopK:
+    case DynamicStatsValueTypeQuantile:
+      if (bdsk_xml(B, bds, &xml_vstr, prefix, 0) < 0)
+      {
+	bk_error_printf(B, BK_ERR_ERR, "Could not output sketch statistic %s\n", bds->bds_name);
+	goto error;
+      }
+      break;
+    default:
+      bk_error_printf(B, BK_ERR_ERR,"Unknown type: %d\n", bds->bds_value_type);
+      goto error;
+      break;
+    }
+  }
+
+  if (ret < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not extract the fisrt or next stats value\n");
+    goto error;
+  }
+
+  if (bk_vstr_cat(B, 0, &xml_vstr, "%s", "</statistics>\n"))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not complete XML statitics string\n");
+    goto error;
+  }
+
+  STATS_LIST_UNLOCK(bdsl, locked);
+
+  BK_RETURN(B, xml_vstr.ptr);
+
+ error:
+  STATS_LIST_UNLOCK(bdsl, locked);
+
+  if (xml_vstr.ptr)
+    free(xml_vstr.ptr);
+
+  if (xml_str)
+    free(xml_str);
+
+  BK_RETURN(B, NULL);
+}
+
+
+
+/**
+ * Output a Rate or Window stat as XML: the total or latest sample as the
+ * value, with the windowed figures as attributes.
+ *
+ *	@param B BAKA thread/global state.
+ *	@param bds The stat.
+ *	@param xml_vstr The XML being built.
+ *	@param prefix Prefix for each line.
+ *	@param flags Flags for future use.
+ *	@return <i>-1</i> on failure.<br>
+ *	@return <i>0</i> on success.
+ */
+static int
+bdsw_xml(bk_s B, struct bk_dynamic_stat *bds, bk_vstr *xml_vstr, const char *prefix, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stat_window_values values;
+  const char *figure;
+  char discriminator[40];
+
+  if (!bds || !xml_vstr || !prefix)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (bk_dynamic_stat_window_get(B, bds, &values, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not get windowed values\n");
+    BK_RETURN(B, -1);
+  }
+
+  figure = (bds->bds_value_type == DynamicStatsValueTypeRate) ? "rate" : "mean";
+  discriminator[0] = '\0';
+  if (bds->bds_discriminator != 0)
+    snprintf(discriminator, sizeof(discriminator), " discriminator=\"%ld\"", bds->bds_discriminator);
+
+  if (bk_vstr_cat(B, 0, xml_vstr,
+		  "%s\t<statistic description=\"%s\"%s %s1s=\"%.4f\" %s10s=\"%.4f\" %s60s=\"%.4f\" ewma=\"%.4f\" min60s=\"%lld\" max60s=\"%lld\">%lld</statistic>\n",
+		  prefix, bds->bds_name, discriminator, figure, values.bdswv_1s, figure, values.bdswv_10s, figure, values.bdswv_60s,
+		  values.bdswv_ewma, (long long)values.bdswv_min, (long long)values.bdswv_max, (long long)values.bdswv_value) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not concatonate string into vptr\n");
+    BK_RETURN(B, -1);
+  }
+
+  BK_RETURN(B, 0);
+}
+
+
+/**
+ * Output a sketch stat as XML: the stat value, with the quantiles
+ * (Quantile) or heavy hitters as hexkey:count pairs (TopK) as attributes.
+ *
+ *	@param B BAKA thread/global state.
+ *	@param bds The stat.
+ *	@param xml_vstr The XML being built.
+ *	@param prefix Prefix for each line.
+ *	@param flags Flags for future use.
+ *	@return <i>-1</i> on failure.<br>
+ *	@return <i>0</i> on success.
+ */
+static int
+bdsk_xml(bk_s B, struct bk_dynamic_stat *bds, bk_vstr *xml_vstr, const char *prefix, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_topk_item *items = NULL;
+  char discriminator[40];
+  char hexkey[BDSK_HEXKEY_MAX];
+  u_int count, cnt;
+
+  if (!bds || !xml_vstr || !prefix)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  discriminator[0] = '\0';
+  if (bds->bds_discriminator != 0)
+    snprintf(discriminator, sizeof(discriminator), " discriminator=\"%ld\"", bds->bds_discriminator);
+
+  if (bk_vstr_cat(B, 0, xml_vstr, "%s\t<statistic description=\"%s\"%s", prefix, bds->bds_name, discriminator) < 0)
+    goto error;
+
+  if (bds->bds_value_type == DynamicStatsValueTypeQuantile)
+  {
+    double p50, p90, p99, p999, min, max;
+
+    if (bk_quantile_get(B, bds->bds_sketch, 50, &p50, 0) == 0 &&
+	bk_quantile_get(B, bds->bds_sketch, 90, &p90, 0) == 0 &&
+	bk_quantile_get(B, bds->bds_sketch, 99, &p99, 0) == 0 &&
+	bk_quantile_get(B, bds->bds_sketch, 99.9, &p999, 0) == 0 &&
+	bk_quantile_get(B, bds->bds_sketch, 0, &min, 0) == 0 &&
+	bk_quantile_get(B, bds->bds_sketch, 100, &max, 0) == 0 &&
+	bk_vstr_cat(B, 0, xml_vstr, " p50=\"%.4f\" p90=\"%.4f\" p99=\"%.4f\" p999=\"%.4f\" min=\"%.4f\" max=\"%.4f\"",
+		    p50, p90, p99, p999, min, max) < 0)
+      goto error;
+  }
+  else if (bds->bds_value_type == DynamicStatsValueTypeTopK)
+  {
+    if (!(items = bk_topk_list(B, bds->bds_sketch, &count, 0)))
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not list heavy hitters\n");
+      goto error;
+    }
+
+    if (bk_vstr_cat(B, 0, xml_vstr, " top=\"") < 0)
+      goto error;
+    for (cnt = 0; cnt < count; cnt++)
+    {
+      bdsk_hexkey(items[cnt].bti_key, items[cnt].bti_keylen, hexkey);
+      if (bk_vstr_cat(B, 0, xml_vstr, "%s%s:%llu", cnt ? " " : "", hexkey, (unsigned long long)items[cnt].bti_count) < 0)
+	goto error;
+    }
+    if (bk_vstr_cat(B, 0, xml_vstr, "\"") < 0)
+      goto error;
+  }
+
+  if (bk_vstr_cat(B, 0, xml_vstr, ">%lld</statistic>\n", (long long)bdsk_figure(B, bds)) < 0)
+    goto error;
+
+  bk_topk_list_destroy(B, items);
+  BK_RETURN(B, 0);
+
+ error:
+  bk_error_printf(B, BK_ERR_ERR, "Could not concatonate string into vptr\n");
+  bk_topk_list_destroy(B, items);
+  BK_RETURN(B, -1);
+}
+
+
+
+
+/**
+ * Destroy the string created by bk_dynamic_stats_XML_create.
+ *
+ *	@param B BAKA thread/global state.
+ *	@param xml_str The XML string to destroy.
+ *	@param flags Flags for future use.
+ *	@return <i>-1</i> on failure.<br>
+ *	@return <i>0</i> on success.
+ */
+void
+bk_dynamic_stats_XML_destroy(bk_s B, const char *xml_str, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!xml_str)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_VRETURN(B);
+  }
+
+  free((char *)xml_str);
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Export a stats list through a named shared memory segment so that other
+ * processes may read it (see bk_dynamic_stats_export_attach()) without
+ * calling into, or taking locks in, this process.  The stats are mirrored
+ * into a double buffered snapshot each time bk_dynamic_stats_export_update()
+ * is called, or every @a msecs if a run environment is supplied.  A
+ * segment left by an exporter which has exited is replaced; one which a
+ * live process is still publishing to is not (errno is EEXIST).
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state.
+ *	@param stats_list The statistics list to export.
+ *	@param name Name of the shared memory segment (see shm_open(3)).
+ *	@param maxbytes Largest snapshot to publish (stats which do not fit are counted, not exported).
+ *	@param priority Highest priority stat to export (as for bk_dynamic_stats_XML_create).
+ *	@param mode Permissions of the segment.
+ *	@param run Optional run environment for periodic republication.
+ *	@param msecs Republication interval if @a run is supplied.
+ *	@param flags Flags for future use.
+ *	@return <i>NULL</i> on failure.<br>
+ *	@return <i>export handle</i> on success.
+ */
+struct bk_dynamic_stats_export *
+bk_dynamic_stats_export_create(bk_s B, bk_dynamic_stats_h stats_list, const char *name, size_t maxbytes, u_int priority, mode_t mode, struct bk_run *run, time_t msecs, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stats_list *bdsl = (struct bk_dynamic_stats_list *)stats_list;
+  struct bk_dynamic_stats_export *bdse = NULL;
+  struct bk_dynamic_stats_export_header *header;
+  int fd = -1;
+
+  if (!bdsl || !name || maxbytes < sizeof(struct bk_dynamic_stats_export_snapshot) || (run && msecs <= 0))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, NULL);
+  }
+
+  if (!(BK_CALLOC(bdse)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate stats export: %s\n", strerror(errno));
+    goto error;
+  }
+  bdse->bdse_list = bdsl;
+  bdse->bdse_priority = priority;
+  bdse->bdse_header = MAP_FAILED;
+  bdse->bdse_maplen = BDSE_HEADER_SIZE + bk_shmsnap_size(maxbytes);
+  bdse->bdse_buflen = maxbytes;
+
+  if (!(bdse->bdse_buf = malloc(bdse->bdse_buflen)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate stats export buffers: %s\n", strerror(errno));
+    goto error;
+  }
+
+  // A stale segment from a previous incarnation is replaced, a live one is not
+  if (export_reclaim(B, name) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not take over shared memory segment %s: %s\n", name, strerror(errno));
+    goto error;
+  }
+
+  if ((fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, mode)) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not create shared memory segment %s: %s\n", name, strerror(errno));
+    goto error;
+  }
+
+  // Only now is the segment ours to remove when the export goes away
+  if (!(bdse->bdse_name = strdup(name)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate stats export name: %s\n", strerror(errno));
+    shm_unlink(name);
+    goto error;
+  }
+
+  if (ftruncate(fd, bdse->bdse_maplen) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not size shared memory segment %s: %s\n", name, strerror(errno));
+    goto error;
+  }
+
+  if ((bdse->bdse_header = mmap(NULL, bdse->bdse_maplen, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not map shared memory segment %s: %s\n", name, strerror(errno));
+    goto error;
+  }
+  close(fd);
+  fd = -1;
+
+  header = bdse->bdse_header;
+  header->bdseh_version = BK_DYNAMIC_STATS_EXPORT_VERSION;
+  header->bdseh_size = bdse->bdse_maplen;
+  header->bdseh_snapoff = BDSE_HEADER_SIZE;
+  header->bdseh_pid = getpid();
+
+  if (!(bdse->bdse_snap = bk_shmsnap_init(B, (char *)header + BDSE_HEADER_SIZE, maxbytes, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not initialize snapshot area\n");
+    goto error;
+  }
+
+  // Readers must never see a header without a snapshot behind it
+  if (bk_dynamic_stats_export_update(B, bdse, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not publish initial statistics\n");
+    goto error;
+  }
+  __atomic_store_n(&header->bdseh_magic, BK_DYNAMIC_STATS_EXPORT_MAGIC, __ATOMIC_RELEASE);
+
+  if (run)
+  {
+    if (bk_run_enqueue_cron(B, run, msecs, export_cron, bdse, &bdse->bdse_cron, 0) < 0)
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not schedule statistics republication\n");
+      goto error;
+    }
+    bdse->bdse_run = run;
+  }
+
+  BK_RETURN(B, bdse);
+
+ error:
+  if (fd >= 0)
+    close(fd);
+  if (bdse)
+    bk_dynamic_stats_export_destroy(B, bdse, 0);
+  BK_RETURN(B, NULL);
+}
+
+
+
+/**
+ * Publish the current values of an exported stats list.  Update
+ * callbacks are run first, exactly as for bk_dynamic_stats_XML_create.
+ *
+ * THREADS: THREAD-REENTRANT (one publisher per export)
+ *
+ *	@param B BAKA thread/global state.
+ *	@param bdse The export to publish.
+ *	@param flags Flags for future use.
+ *	@return <i>-1</i> on failure.<br>
+ *	@return <i>0</i> on success.
+ */
+int
+bk_dynamic_stats_export_update(bk_s B, struct bk_dynamic_stats_export *bdse, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stats_list *bdsl;
+  struct bk_dynamic_stats_export_snapshot *snapshot;
+  struct bk_dynamic_stat *bds = NULL;
+  size_t off = sizeof(*snapshot);
+  int locked = 0;
+  int records;
+  int ret;
+
+  if (!bdse || !(bdsl = bdse->bdse_list) || !bdse->bdse_snap)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+#ifdef BK_USING_PTHREADS
+#ifndef NO_THREAD_CPU_STAT
+  if (!__atomic_load_n(&bdsl->bdsl_collector, __ATOMIC_ACQUIRE) && manage_thread_stats(B, bdsl, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not manage thread stats\n");
+    goto error;
+  }
+#endif /* NO_THREAD_CPU_STAT */
+#endif /* BK_USING_PTHREADS */
+
+  snapshot = (struct bk_dynamic_stats_export_snapshot *)bdse->bdse_buf;
+  memset(snapshot, 0, sizeof(*snapshot));
+  snapshot->bdses_generated = time(NULL);
+
+  STATS_LIST_LOCK(bdsl, locked);
+
+  if (bk_dynamic_stats_demand_update(B, bdsl, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not run the statistics demand update\n");
+    goto error;
+  }
+
+  while((ret = bdsl_getnext(B, bdsl, &bds, bdse->bdse_priority, NULL, NULL, 0)) == 1)
+  {
+    if ((records = export_record(B, bdse, bds, &off, 0)) < 0)
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not export %s\n", bds->bds_name);
+      goto error;
+    }
+
+    if (records)
+      snapshot->bdses_count += records;
+    else
+      snapshot->bdses_truncated++;
+  }
+
+  if (ret < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not extract the first or next stats value\n");
+    goto error;
+  }
+
+  STATS_LIST_UNLOCK(bdsl, locked);
+
+  // Values were taken under the lock; the copy into shared memory need not be
+  if (bk_shmsnap_publish(B, bdse->bdse_snap, bdse->bdse_buf, off, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not publish statistics snapshot\n");
+    goto error;
+  }
+  __atomic_store_n(&bdse->bdse_header->bdseh_beatms, bk_shmmap_nowms(), __ATOMIC_RELAXED);
+
+  BK_RETURN(B, 0);
+
+ error:
+  STATS_LIST_UNLOCK(bdsl, locked);
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * Append one stat to the snapshot being staged: one record, or for Rate
+ * and Window stats, the record followed by one Double record per
+ * windowed figure (named after the stat, with a suffix).  A stat is
+ * staged whole or not at all.
+ *
+ *	@param B BAKA thread/global state.
+ *	@param bdse The export being staged.
+ *	@param bds The stat to append (list must be locked).
+ *	@param offp Copy-in/out staging offset.
+ *	@param flags Flags for future use.
+ *	@return <i>-1</i> on failure.<br>
+ *	@return <i>number of records</i> appended on success (0 if the stat did not fit).
+ */
+static int
+export_record(bk_s B, struct bk_dynamic_stats_export *bdse, struct bk_dynamic_stat *bds, size_t *offp, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stat_window_values window;
+  bk_dynamic_stat_value_u value;
+  int64_t ival = 0;
+  u_int64_t uval = 0;
+  double dval = 0;
+  const void *valp = &ival;
+  const char *string = NULL;
+  size_t start;
+  int ret;
+
+  if (!bdse || !bds || !offp)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, -1);
+  }
+  start = *offp;
+
+  if (bds->bds_value_type == DynamicStatsValueTypeString)
+  {
+    string = bds->bds_string ? bds->bds_string : "";
+  }
+  else if (bds->bds_access_type != DynamicStatsAccessTypeIndirect || bds->bds_ptr)
+  {
+    // An unset indirect stat exports as zero, as in the XML
+    if (extract_value(B, bds, &value, sizeof(value), 0) < 0)
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not extract value\n");
+      BK_RETURN(B, -1);
+    }
+
+    switch(bds->bds_value_type)
+    {
+    case DynamicStatsValueTypeInt32:
+      ival = value.bdsv_int32;
+      break;
+    case DynamicStatsValueTypeUInt32:
+      uval = value.bdsv_uint32;
+      valp = &uval;
+      break;
+    case DynamicStatsValueTypeInt64:
+    case DynamicStatsValueTypeRate:
+    case DynamicStatsValueTypeWindow:
+    case DynamicStatsValueTypeCardinality:
+    case DynamicStatsValueTypeTopK:
+    case DynamicStatsValueTypeQuantile:
+      ival = value.bdsv_int64;
+      break;
+    case DynamicStatsValueTypeUInt64:
+      uval = value.bdsv_uint64;
+      valp = &uval;
+      break;
+    case DynamicStatsValueTypeFloat:
+      dval = value.bdsv_float;
+      valp = &dval;
+      break;
+    case DynamicStatsValueTypeDouble:
+      dval = value.bdsv_double;
+      valp = &dval;
+      break;
+    default:
+      bk_error_printf(B, BK_ERR_ERR,"Unknown type: %d\n", bds->bds_value_type);
+      BK_RETURN(B, -1);
+    }
+  }
+
+  if ((ret = export_append(B, bdse, bds, NULL, bds->bds_value_type, valp, string, offp, 0)) != 0)
+    BK_RETURN(B, ret < 0 ? -1 : 0);
+
+  if (BDS_SKETCHED(bds->bds_value_type))
+  {
+    if ((ret = bdsk_export(B, bdse, bds, offp, 0)) <= 0)
+      *offp = start;
+    BK_RETURN(B, ret);
+  }
+
+  if (!BDS_WINDOWED(bds->bds_value_type))
+    BK_RETURN(B, 1);
+
+  if (bk_dynamic_stat_window_get(B, bds, &window, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not get windowed values\n");
+    BK_RETURN(B, -1);
+  }
+
+  {
+    const char *suffixes[] = { ".1s", ".10s", ".60s", ".ewma", ".min60s", ".max60s" };
+    double figures[] = { window.bdswv_1s, window.bdswv_10s, window.bdswv_60s, window.bdswv_ewma, window.bdswv_min, window.bdswv_max };
+    u_int cnt;
+
+    for (cnt = 0; cnt < sizeof(figures) / sizeof(*figures); cnt++)
+    {
+      if ((ret = export_append(B, bdse, bds, suffixes[cnt], DynamicStatsValueTypeDouble, &figures[cnt], NULL, offp, 0)) != 0)
+      {
+	*offp = start;
+	BK_RETURN(B, ret < 0 ? -1 : 0);
+      }
+    }
+    BK_RETURN(B, cnt + 1);
+  }
+}
+
+
+
+/**
+ * Append one record to the snapshot being staged
+ *
+ *	@param B BAKA thread/global state.
+ *	@param bdse The export being staged.
+ *	@param bds The stat the record describes.
+ *	@param suffix Optional suffix to the stat's name.
+ *	@param type Type of the record.
+ *	@param value Eight byte (widened) value, unless a string.
+ *	@param string String value, for string records.
+ *	@param offp Copy-in/out staging offset.
+ *	@param flags Flags for future use.
+ *	@return <i>-1</i> on failure.<br>
+ *	@return <i>0</i> on success.<br>
+ *	@return <i>1</i> if the record did not fit.
+ */
+static int
+export_append(bk_s B, struct bk_dynamic_stats_export *bdse, struct bk_dynamic_stat *bds, const char *suffix, bk_dynamic_stats_value_type_e type, const void *value, const char *string, size_t *offp, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stats_export_record *rec;
+  size_t namelen, suffixlen, len;
+
+  if (!bdse || !bds || !offp || (!value && !string))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  namelen = strlen(bds->bds_name);
+  suffixlen = suffix ? strlen(suffix) : 0;
+  len = sizeof(*rec) + namelen + suffixlen + 1;
+  if (string)
+    len += strlen(string) + 1;
+  len = (len + 7) & ~(size_t)7;
+
+  if (namelen + suffixlen > 0xffff || *offp + len > bdse->bdse_buflen)
+    BK_RETURN(B, 1);
+
+  rec = (struct bk_dynamic_stats_export_record *)(bdse->bdse_buf + *offp);
+  memset(rec, 0, len);
+  rec->bdser_len = len;
+  rec->bdser_type = type;
+  rec->bdser_namelen = namelen + suffixlen;
+  rec->bdser_priority = bds->bds_priority;
+  rec->bdser_discriminator = bds->bds_discriminator;
+  memcpy(rec->bdser_name, bds->bds_name, namelen);
+  if (suffix)
+    memcpy(rec->bdser_name + namelen, suffix, suffixlen);
+
+  if (string)
+    strcpy(BK_DYNAMIC_STATS_EXPORT_STRING(rec), string);
+  else
+    memcpy(&rec->bdser_value, value, sizeof(rec->bdser_value));
+
+  *offp += len;
+  BK_RETURN(B, 0);
+}
+
+
+/**
+ * Append the derived records of a sketch stat after its value: Double
+ * .p50 .p90 .p99 .p999 .min and .max for a Quantile with samples, and a
+ * UInt64 count named .<hexkey> for each TopK heavy hitter.
+ *
+ *	@param B BAKA thread/global state.
+ *	@param bdse The export being staged.
+ *	@param bds The stat.
+ *	@param offp Copy-in/out staging offset.
+ *	@param flags Flags for future use.
+ *	@return <i>-1</i> on failure.<br>
+ *	@return <i>number of records</i> for the stat, including its value (0 if they did not fit).
+ */
+static int
+bdsk_export(bk_s B, struct bk_dynamic_stats_export *bdse, struct bk_dynamic_stat *bds, size_t *offp, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_topk_item *items;
+  char suffix[BDSK_HEXKEY_MAX + 1];
+  u_int count, cnt;
+  int ret = 0;
+
+  if (bds->bds_value_type == DynamicStatsValueTypeQuantile)
+  {
+    const char *suffixes[] = { ".p50", ".p90", ".p99", ".p999", ".min", ".max" };
+    const double pcts[] = { 50, 90, 99, 99.9, 0, 100 };
+    double figure;
+
+    for (cnt = 0; cnt < sizeof(pcts) / sizeof(*pcts); cnt++)
+    {
+      if (bk_quantile_get(B, bds->bds_sketch, pcts[cnt], &figure, 0) < 0)
+	break;					// No samples yet
+      if ((ret = export_append(B, bdse, bds, suffixes[cnt], DynamicStatsValueTypeDouble, &figure, NULL, offp, 0)) != 0)
+	BK_RETURN(B, ret < 0 ? -1 : 0);
+    }
+    BK_RETURN(B, cnt + 1);
+  }
+
+  if (bds->bds_value_type != DynamicStatsValueTypeTopK)
+    BK_RETURN(B, 1);
+
+  if (!(items = bk_topk_list(B, bds->bds_sketch, &count, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not list heavy hitters\n");
+    BK_RETURN(B, -1);
+  }
+
+  for (cnt = 0; cnt < count; cnt++)
+  {
+    u_int64_t figure = items[cnt].bti_count;
+
+    suffix[0] = '.';
+    bdsk_hexkey(items[cnt].bti_key, items[cnt].bti_keylen, suffix + 1);
+    if ((ret = export_append(B, bdse, bds, suffix, DynamicStatsValueTypeUInt64, &figure, NULL, offp, 0)) != 0)
+      break;
+  }
+  bk_topk_list_destroy(B, items);
+
+  if (ret != 0)
+    BK_RETURN(B, ret < 0 ? -1 : 0);
+
+  BK_RETURN(B, cnt + 1);
+}
+
+
+
+
+/**
+ * Periodic republication of an export
+ *
+ *	@param B BAKA thread/global state.
+ *	@param run The run environment.
+ *	@param opaque The export.
+ *	@param starttime When this run iteration started.
+ *	@param flags BK_RUN_DESTROY if the run environment is going away.
+ */
+static void
+export_cron(bk_s B, struct bk_run *run, void *opaque, const struct timeval starttime, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stats_export *bdse = (struct bk_dynamic_stats_export *)opaque;
+
+  if (!bdse)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_VRETURN(B);
+  }
+
+  if (BK_FLAG_ISSET(flags, BK_RUN_DESTROY))
+  {
+    bdse->bdse_run = NULL;
+    bdse->bdse_cron = NULL;
+    BK_VRETURN(B);
+  }
+
+  if (bk_dynamic_stats_export_update(B, bdse, 0) < 0)
+    bk_error_printf(B, BK_ERR_WARN, "Could not republish statistics to %s\n", bdse->bdse_name);
+
+  BK_VRETURN(B);
+}
+
+
+
+
+/**
+ * Remove a segment left behind by an exporter which has gone away.  A
+ * segment is stale if it is too small or has no valid magic, or if the
+ * process which published it no longer exists.
  *
  *	@param B BAKA thread/global state.
- *	@param stats_list The stats list from which to extract the values
- *	@param priority The priority filter.
- *	@param prefix A fixed string to prepend to all output lines (presumably tab)
+ *	@param name Name of the shared memory segment.
+ *	@return <i>-1</i> if a live exporter owns the segment (errno EEXIST) or it cannot be examined.<br>
+ *	@return <i>0</i> if there is no segment by that name (any more).
+ */
+static int
+export_reclaim(bk_s B, const char *name)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stats_export_header *header;
+  struct stat st;
+  int live = 0;
+  int fd;
+
+  if ((fd = shm_open(name, O_RDONLY, 0)) < 0)
+    BK_RETURN(B, errno == ENOENT ? 0 : -1);
+
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(*header) &&
+      (header = mmap(NULL, sizeof(*header), PROT_READ, MAP_SHARED, fd, 0)) != MAP_FAILED)
+  {
+    live = (__atomic_load_n(&header->bdseh_magic, __ATOMIC_ACQUIRE) == BK_DYNAMIC_STATS_EXPORT_MAGIC &&
+	    (kill(header->bdseh_pid, 0) == 0 || errno != ESRCH));
+    munmap(header, sizeof(*header));
+  }
+  close(fd);
+
+  if (live)
+  {
+    errno = EEXIST;
+    BK_RETURN(B, -1);
+  }
+
+  shm_unlink(name);
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Stop exporting (or for readers, detach from) a stats segment
+ *
+ * THREADS: THREAD-REENTRANT
+ *
+ *	@param B BAKA thread/global state.
+ *	@param bdse The export or attachment.
+ *	@param flags BK_DYNAMIC_STATS_EXPORT_KEEP to leave an exported segment in place.
+ */
+void
+bk_dynamic_stats_export_destroy(bk_s B, struct bk_dynamic_stats_export *bdse, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!bdse)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_VRETURN(B);
+  }
+
+  if (bdse->bdse_run && bdse->bdse_cron)
+    bk_run_dequeue(B, bdse->bdse_run, bdse->bdse_cron, BK_RUN_DEQUEUE_CRON);
+
+  if (bdse->bdse_header != MAP_FAILED)
+    munmap(bdse->bdse_header, bdse->bdse_maplen);
+
+  if (bdse->bdse_name)
+  {
+    if (!BK_FLAG_ISSET(bdse->bdse_flags, BDSE_FLAG_READER) && !BK_FLAG_ISSET(flags, BK_DYNAMIC_STATS_EXPORT_KEEP))
+      shm_unlink(bdse->bdse_name);
+    free(bdse->bdse_name);
+  }
+
+  if (bdse->bdse_buf)
+    free(bdse->bdse_buf);
+
+  free(bdse);
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Attach (read only) to a stats segment exported by some process.  The
+ * exporter is never involved in reading it.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state.
+ *	@param name Name of the shared memory segment.
  *	@param flags Flags for future use.
- *	@return <i>NULL</i> on failure.<br>
- *	@return a new <i>XML string</i> on success.
+ *	@return <i>NULL</i> on failure (ENOENT or EAGAIN if there is nothing to read yet).<br>
+ *	@return <i>attachment</i> (destroy with bk_dynamic_stats_export_destroy) on success.
  */
-char *
-bk_dynamic_stats_XML_create(bk_s B, bk_dynamic_stats_h stats_list, u_int priority, const char *prefix, bk_flags flags)
+struct bk_dynamic_stats_export *
+bk_dynamic_stats_export_attach(bk_s B, const char *name, bk_flags flags)
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
-  struct bk_dynamic_stats_list *bdsl = (struct bk_dynamic_stats_list *)stats_list;
-  struct bk_dynamic_stat *bds = NULL;
-  bk_vstr xml_vstr;
-  int ret;
-  char *xml_str = NULL;				// Used for str2xml conversion
-  time_t timenow = time(NULL);
-  char time_buf[50];
-  char stat_buf[1024];
-  int locked = 0;
+  struct bk_dynamic_stats_export *bdse = NULL;
+  struct bk_dynamic_stats_export_header *header;
+  struct stat st;
+  int fd = -1;
+  int err;
 
-  if (!bdsl || !prefix)
+  if (!name)
   {
     bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
     BK_RETURN(B, NULL);
   }
 
-#ifdef BK_USING_PTHREADS
-#ifndef NO_THREAD_CPU_STAT
-  if (manage_thread_stats(B, bdsl, 0) < 0)
+  if (!(BK_CALLOC(bdse)))
   {
-    bk_error_printf(B, BK_ERR_ERR, "Could not manage thread stats\n");
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate stats attachment: %s\n", strerror(errno));
     goto error;
   }
-#endif /* NO_THREAD_CPU_STAT */
-#endif /* BK_USING_PTHREADS */
+  bdse->bdse_flags = BDSE_FLAG_READER;
+  bdse->bdse_header = MAP_FAILED;
 
-  if (!(xml_vstr.ptr = malloc(1)))
+  if (!(bdse->bdse_name = strdup(name)))
   {
-    bk_error_printf(B, BK_ERR_ERR, "Could not allocate initial NUL for XML output string: %s\n", strerror(errno));
+    bk_error_printf(B, BK_ERR_ERR, "Could not copy segment name: %s\n", strerror(errno));
     goto error;
   }
 
-  *xml_vstr.ptr = '\0'; // Initialize empty string for the purpose of using bk_vstr.ptr
-  xml_vstr.max = 1;
-  xml_vstr.cur = 0;
-
-  if (!strftime(time_buf, sizeof(time_buf), BK_STRFTIME_DEFAULT_FMT, gmtime(&timenow)))
+  if ((fd = shm_open(name, O_RDONLY, 0)) < 0)
   {
-    bk_error_printf(B, BK_ERR_ERR, "Could not convert current time to a string: %s\n", strerror(errno));
+    bk_error_printf(B, BK_ERR_ERR, "Could not open shared memory segment %s: %s\n", name, strerror(errno));
     goto error;
   }
 
-  snprintf(stat_buf, sizeof(stat_buf), "%s<statistics generated=\"%s\">\n", prefix, (char *)time_buf);
-
-  if (bk_vstr_cat(B, 0, &xml_vstr, "%s", stat_buf))
+  if (fstat(fd, &st) < 0)
   {
-    bk_error_printf(B, BK_ERR_ERR, "Could not begin XML statitics string\n");
+    bk_error_printf(B, BK_ERR_ERR, "Could not stat shared memory segment %s: %s\n", name, strerror(errno));
     goto error;
   }
 
-  STATS_LIST_LOCK(bdsl, locked);
-
-  if (bk_dynamic_stats_demand_update(B, bdsl, 0) < 0)
+  // An exporter which has not yet sized the segment looks just like no exporter
+  if ((size_t)st.st_size < BDSE_HEADER_SIZE)
   {
-    bk_error_printf(B, BK_ERR_ERR, "Could not run the statistics demand update\n");
+    bk_error_printf(B, BK_ERR_ERR, "Shared memory segment %s is not ready\n", name);
+    errno = EAGAIN;
     goto error;
   }
 
-  while((ret = bdsl_getnext(B, bdsl, &bds, priority, NULL, NULL, 0)) == 1)
+  bdse->bdse_maplen = st.st_size;
+  if ((bdse->bdse_header = mmap(NULL, bdse->bdse_maplen, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
   {
-    switch(bds->bds_value_type)
-    {
-    case DynamicStatsValueTypeInt32:
-      STAT_XML_OUTPUT(bds, "%d", bds->bds_int32);
-      break;
-    case DynamicStatsValueTypeUInt32:
-      STAT_XML_OUTPUT(bds, "%u", bds->bds_uint32);
-      break;
-    case DynamicStatsValueTypeInt64:
-      STAT_XML_OUTPUT(bds, "%ld", bds->bds_int64);
-      break;
-    case DynamicStatsValueTypeUInt64:
-      STAT_XML_OUTPUT(bds, "%lu", bds->bds_uint64);
-      break;
-    case DynamicStatsValueTypeFloat:
-      STAT_XML_OUTPUT(bds, "%.4f", bds->bds_float);
-      break;
-    case DynamicStatsValueTypeDouble:
-      STAT_XML_OUTPUT(bds, "%.4lf", bds->bds_double);
-      break;
-    case DynamicStatsValueTypeString:
-      if (!bds->bds_string && !(bds->bds_string = strdup("")))
-      {
-	bk_error_printf(B, BK_ERR_ERR, "Could not strdup emptry string: %s\n", strerror(errno));
-	goto error;
-      }
-      if (!(xml_str = bk_string_str2xml(B, bds->bds_string, 0)))
-      {
-	bk_error_printf(B, BK_ERR_ERR, "Could not convert string to XML\n");
-	goto error;
-      }
-      STAT_XML_OUTPUT(bds, "%s", xml_str);
-      free(xml_str);
-      xml_str = NULL;
-      break;
-    default:
-      bk_error_printf(B, BK_ERR_ERR,"Unknown type: %d\n", bds->bds_value_type);
-      goto error;
-      break;
-    }
+    bk_error_printf(B, BK_ERR_ERR, "Could not map shared memory segment %s: %s\n", name, strerror(errno));
+    goto error;
   }
+  close(fd);
+  fd = -1;
 
-  if (ret < 0)
+  header = bdse->bdse_header;
+  if (__atomic_load_n(&header->bdseh_magic, __ATOMIC_ACQUIRE) != BK_DYNAMIC_STATS_EXPORT_MAGIC)
   {
-    bk_error_printf(B, BK_ERR_ERR, "Could not extract the fisrt or next stats value\n");
+    bk_error_printf(B, BK_ERR_ERR, "Shared memory segment %s holds no exported statistics (yet)\n", name);
+    errno = EAGAIN;
     goto error;
   }
 
-  if (bk_vstr_cat(B, 0, &xml_vstr, "%s", "</statistics>\n"))
+  if (header->bdseh_version != BK_DYNAMIC_STATS_EXPORT_VERSION || header->bdseh_size > bdse->bdse_maplen ||
+      header->bdseh_snapoff < sizeof(*header) || header->bdseh_snapoff >= header->bdseh_size || (header->bdseh_snapoff & 7))
   {
-    bk_error_printf(B, BK_ERR_ERR, "Could not complete XML statitics string\n");
+    bk_error_printf(B, BK_ERR_ERR, "Shared memory segment %s has an unsupported layout (version %u)\n", name, header->bdseh_version);
+    errno = EINVAL;
     goto error;
   }
 
-  STATS_LIST_UNLOCK(bdsl, locked);
+  bdse->bdse_snap = (struct bk_shmsnap *)((char *)header + header->bdseh_snapoff);
+  // No snapshot can be larger than the area holding it
+  bdse->bdse_buflen = header->bdseh_size - header->bdseh_snapoff;
+  if (!(bdse->bdse_buf = malloc(bdse->bdse_buflen)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate copy-out buffer: %s\n", strerror(errno));
+    goto error;
+  }
 
-  BK_RETURN(B, xml_vstr.ptr);
+  BK_RETURN(B, bdse);
 
  error:
-  STATS_LIST_UNLOCK(bdsl, locked);
+  err = errno;
+  if (fd >= 0)
+    close(fd);
+  if (bdse)
+    bk_dynamic_stats_export_destroy(B, bdse, 0);
+  errno = err;
+  BK_RETURN(B, NULL);
+}
 
-  if (xml_vstr.ptr)
-    free(xml_vstr.ptr);
 
-  if (xml_str)
-    free(xml_str);
 
-  BK_RETURN(B, NULL);
+/**
+ * Take a consistent copy of the stats last published to an attached
+ * segment.  The copy is checked for sanity before being returned, so the
+ * records may be walked with BK_DYNAMIC_STATS_EXPORT_FIRST and
+ * BK_DYNAMIC_STATS_EXPORT_NEXT for bdses_count iterations.
+ *
+ * THREADS: THREAD-REENTRANT (the copy belongs to the attachment)
+ *
+ *	@param B BAKA thread/global state.
+ *	@param bdse The attachment.
+ *	@param versionp Optional copy-out snapshot version (increases on every publication).
+ *	@param agemsp Optional copy-out milliseconds since the exporter last published.
+ *	@param flags BK_SHMSNAP_NOWAIT to fail (EAGAIN) rather than retry a torn copy.
+ *	@return <i>NULL</i> on failure.<br>
+ *	@return <i>snapshot</i>, valid until the next read or destroy, on success.
+ */
+struct bk_dynamic_stats_export_snapshot *
+bk_dynamic_stats_export_read(bk_s B, struct bk_dynamic_stats_export *bdse, u_int64_t *versionp, u_int64_t *agemsp, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stats_export_snapshot *snapshot;
+  struct bk_dynamic_stats_export_record *rec;
+  u_int64_t beatms;
+  ssize_t len;
+  size_t off;
+  u_int cnt;
+
+  if (!bdse || !bdse->bdse_snap)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, NULL);
+  }
+
+  beatms = __atomic_load_n(&bdse->bdse_header->bdseh_beatms, __ATOMIC_RELAXED);
+  if ((len = bk_shmsnap_read(B, bdse->bdse_snap, bdse->bdse_buf, bdse->bdse_buflen, versionp, flags & BK_SHMSNAP_NOWAIT)) < 0)
+    BK_RETURN(B, NULL);
+
+  snapshot = (struct bk_dynamic_stats_export_snapshot *)bdse->bdse_buf;
+  if ((size_t)len < sizeof(*snapshot))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Short statistics snapshot (%zd bytes)\n", len);
+    errno = EINVAL;
+    BK_RETURN(B, NULL);
+  }
+
+  // The exporter is trusted to be sane, but not to be memory safe
+  for (cnt = 0, off = sizeof(*snapshot), rec = BK_DYNAMIC_STATS_EXPORT_FIRST(snapshot); cnt < snapshot->bdses_count; cnt++, off += rec->bdser_len, rec = BK_DYNAMIC_STATS_EXPORT_NEXT(rec))
+  {
+    if (off + sizeof(*rec) > (size_t)len || rec->bdser_len < sizeof(*rec) + rec->bdser_namelen + 1 ||
+	(rec->bdser_len & 7) || off + rec->bdser_len > (size_t)len || rec->bdser_name[rec->bdser_namelen] ||
+	(rec->bdser_type == DynamicStatsValueTypeString &&
+	 !memchr(BK_DYNAMIC_STATS_EXPORT_STRING(rec), 0, rec->bdser_len - sizeof(*rec) - rec->bdser_namelen - 1)))
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Statistics snapshot record %u is corrupt\n", cnt);
+      errno = EINVAL;
+      BK_RETURN(B, NULL);
+    }
+  }
+
+  if (agemsp)
+  {
+    u_int64_t nowms = bk_shmmap_nowms();
+    *agemsp = nowms > beatms ? nowms - beatms : 0;
+  }
+
+  BK_RETURN(B, snapshot);
 }
 
 
 
 /**
- * Destroy the string created by bk_dynamic_stats_XML_create.
+ * Find the process exporting an attached segment
+ *
+ * THREADS: MT-SAFE
  *
  *	@param B BAKA thread/global state.
- *	@param xml_str The XML string to destroy.
- *	@param flags Flags for future use.
+ *	@param bdse The attachment (or export).
  *	@return <i>-1</i> on failure.<br>
- *	@return <i>0</i> on success.
+ *	@return <i>pid</i> on success.
  */
-void
-bk_dynamic_stats_XML_destroy(bk_s B, const char *xml_str, bk_flags flags)
+int64_t
+bk_dynamic_stats_export_pid(bk_s B, struct bk_dynamic_stats_export *bdse)
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
 
-  if (!xml_str)
+  if (!bdse || bdse->bdse_header == MAP_FAILED)
   {
     bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
-    BK_VRETURN(B);
+    BK_RETURN(B, -1);
   }
 
-  free((char *)xml_str);
-
-  BK_VRETURN(B);
+  BK_RETURN(B, bdse->bdse_header->bdseh_pid);
 }
 
 
@@ -1899,6 +3829,12 @@ bk_global_dynamic_stats_register(bk_s B, bk_dynamic_stats_h stats_list, bk_flags
     goto error;
   }
 
+  if (bk_pool_stats_register(B, stats_list, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not register the object pool statistics\n");
+    goto error;
+  }
+
   STATS_LIST_UNLOCK(bdsl, locked);
 
   BK_RETURN(B, 0);
@@ -1940,6 +3876,10 @@ bk_dynamic_stats_demand_update(bk_s B, bk_dynamic_stats_h stats_list, bk_flags f
       bds;
       bds = stats_list_successor(bdsl->bdsl_list, bds))
   {
+    // The collector keeps these current, so there is nothing to do here
+    if (bdsl->bdsl_collector && stat_collected(bds))
+      continue;
+
     if (bds->bds_update_callback && ((*bds->bds_update_callback)(B, bdsl, bds, 0) < 0))
     {
       bk_error_printf(B, BK_ERR_ERR, "Could not update statsitic described by: %s\n", bds->bds_name);
@@ -2225,9 +4165,8 @@ virtual_memory_update(bk_s B, bk_dynamic_stats_h stats_list, bk_dynamic_stat_h d
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
   struct bk_dynamic_stats_list *bdsl = (struct bk_dynamic_stats_list *)stats_list;
   struct bk_dynamic_stat *bds = (struct bk_dynamic_stat *)dyn_stat;
-  dict_h procinfo_list;
-  struct bk_procinfo *bpi = NULL;
-  pid_t pid = getpid();
+  u_long vsize;
+  long rss;
 
   if (!bdsl || !bds)
   {
@@ -2235,40 +4174,21 @@ virtual_memory_update(bk_s B, bk_dynamic_stats_h stats_list, bk_dynamic_stat_h d
     BK_RETURN(B, -1);
   }
 
-  if (!(procinfo_list = bk_procinfo_create(B, 0)))
-  {
-    bk_error_printf(B, BK_ERR_ERR, "Could not create procinfo struct for virt mem\n");
-    goto error;
-  }
-
-  for(bpi = procinfo_list_minimum(procinfo_list);
-      bpi;
-      bpi = procinfo_list_successor(procinfo_list, bpi))
-  {
-    if (bpi->bpi_pid == pid)
-      break;
-  }
-
-  if (!bpi)
+  if (statm_read(B, -1, &vsize, &rss) < 0)
   {
-    bk_error_printf(B, BK_ERR_ERR, "Could not locate the current process in the proclist\n");
+    bk_error_printf(B, BK_ERR_ERR, "Could not read the virtual memory size\n");
     goto error;
   }
 
-  if (stat_set(B, dyn_stat, &bpi->bpi_vsize, 0) < 0)
+  if (stat_set(B, dyn_stat, &vsize, 0) < 0)
   {
     bk_error_printf(B, BK_ERR_ERR, "Could not set the virtual memory size stat\n");
     goto error;
   }
 
-  bk_procinfo_destroy(B, procinfo_list);
-  procinfo_list = NULL;
-
   BK_RETURN(B, 0);
 
  error:
-  if (procinfo_list)
-    bk_procinfo_destroy(B, procinfo_list);
   BK_RETURN(B, -1);
 }
 
@@ -2341,9 +4261,8 @@ resident_memory_update(bk_s B, bk_dynamic_stats_h stats_list, bk_dynamic_stat_h
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
   struct bk_dynamic_stats_list *bdsl = (struct bk_dynamic_stats_list *)stats_list;
   struct bk_dynamic_stat *bds = (struct bk_dynamic_stat *)dyn_stat;
-  dict_h procinfo_list;
-  struct bk_procinfo *bpi = NULL;
-  pid_t pid = getpid();
+  u_long vsize;
+  long rss;
 
   if (!bdsl || !bds)
   {
@@ -2351,40 +4270,21 @@ resident_memory_update(bk_s B, bk_dynamic_stats_h stats_list, bk_dynamic_stat_h
     BK_RETURN(B, -1);
   }
 
-  if (!(procinfo_list = bk_procinfo_create(B, 0)))
-  {
-    bk_error_printf(B, BK_ERR_ERR, "Could not create procinfo struct for rss size\n");
-    goto error;
-  }
-
-  for(bpi = procinfo_list_minimum(procinfo_list);
-      bpi;
-      bpi = procinfo_list_successor(procinfo_list, bpi))
-  {
-    if (bpi->bpi_pid == pid)
-      break;
-  }
-
-  if (!bpi)
+  if (statm_read(B, -1, &vsize, &rss) < 0)
   {
-    bk_error_printf(B, BK_ERR_ERR, "Could not locate the current process in the proclist\n");
+    bk_error_printf(B, BK_ERR_ERR, "Could not read the resident memory size\n");
     goto error;
   }
 
-  if (stat_set(B, dyn_stat, &bpi->bpi_rss, 0) < 0)
+  if (stat_set(B, dyn_stat, &rss, 0) < 0)
   {
     bk_error_printf(B, BK_ERR_ERR, "Could not set the resident memory size stat\n");
     goto error;
   }
 
-  bk_procinfo_destroy(B, procinfo_list);
-  procinfo_list = NULL;
-
   BK_RETURN(B, 0);
 
  error:
-  if (procinfo_list)
-    bk_procinfo_destroy(B, procinfo_list);
   BK_RETURN(B, -1);
 }
 
@@ -2449,29 +4349,92 @@ total_cpu_update(bk_s B, bk_dynamic_stats_h stats_list, bk_dynamic_stat_h dyn_st
   struct timespec ts;
   float cpu_time;
 
-  if (!bdsl || !bds)
+  if (!bdsl || !bds)
+  {
+    bk_error_printf(B, BK_ERR_ERR,"Illegal arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not obtain the total CPU time: %s\n", strerror(errno));
+    goto error;
+  }
+
+  cpu_time = BK_TS2F(&ts);
+
+  if (stat_set(B, bds, &cpu_time, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not set the total CPU time\n");
+    goto error;
+  }
+
+  BK_RETURN(B, 0);
+
+ error:
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * Read the process memory sizes from /proc/self/statm: one short read,
+ * rather than the walk of every process bk_procinfo_create() makes.
+ * Units follow /proc/self/stat (and so bk_procinfo): bytes of virtual
+ * memory and pages of resident memory.
+ *
+ *	@param B BAKA thread/global state.
+ *	@param fd Open descriptor on /proc/self/statm, or -1 to open one.
+ *	@param vsizep C/O virtual memory size.
+ *	@param rssp C/O resident set size.
+ *	@return <i>-1</i> on failure.<br>
+ *	@return <i>0</i> on success.
+ */
+static int
+statm_read(bk_s B, int fd, u_long *vsizep, long *rssp)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  char buf[256];
+  ssize_t len;
+  int myfd = -1;
+  u_long size;
+  long resident;
+
+  if (!vsizep || !rssp)
   {
     bk_error_printf(B, BK_ERR_ERR,"Illegal arguments\n");
     BK_RETURN(B, -1);
   }
 
-  if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0)
+  if (fd < 0 && (fd = myfd = open("/proc/self/statm", O_RDONLY)) < 0)
   {
-    bk_error_printf(B, BK_ERR_ERR, "Could not obtain the total CPU time: %s\n", strerror(errno));
+    bk_error_printf(B, BK_ERR_ERR, "Could not open /proc/self/statm: %s\n", strerror(errno));
     goto error;
   }
 
-  cpu_time = BK_TS2F(&ts);
+  if ((len = pread(fd, buf, sizeof(buf) - 1, 0)) <= 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not read /proc/self/statm: %s\n", len < 0 ? strerror(errno) : "empty");
+    goto error;
+  }
+  buf[len] = '\0';
 
-  if (stat_set(B, bds, &cpu_time, 0) < 0)
+  if (sscanf(buf, "%lu %ld", &size, &resident) != 2)
   {
-    bk_error_printf(B, BK_ERR_ERR, "Could not set the total CPU time\n");
+    bk_error_printf(B, BK_ERR_ERR, "Could not parse /proc/self/statm: %s\n", buf);
     goto error;
   }
 
+  *vsizep = size * sysconf(_SC_PAGESIZE);
+  *rssp = resident;
+
+  if (myfd >= 0)
+    close(myfd);
   BK_RETURN(B, 0);
 
  error:
+  if (myfd >= 0)
+    close(myfd);
   BK_RETURN(B, -1);
 }
 
@@ -2740,6 +4703,416 @@ manage_thread_stats(bk_s B, struct bk_dynamic_stats_list *bdsl, bk_flags flags)
 
 
 
+/**
+ * Is this one of the system stats a collector keeps current?
+ *
+ *	@param bds The stat.
+ *	@return <i>1</i> if the collector publishes it.<br>
+ *	@return <i>0</i> if not.
+ */
+static int
+stat_collected(struct bk_dynamic_stat *bds)
+{
+  return(bds->bds_update_callback == virtual_memory_update ||
+	 bds->bds_update_callback == resident_memory_update ||
+#ifdef BK_USING_PTHREADS
+#ifndef NO_THREAD_CPU_STAT
+	 bds->bds_update_callback == thread_cpu_time_update ||
+#endif /* NO_THREAD_CPU_STAT */
+#endif /* BK_USING_PTHREADS */
+	 bds->bds_update_callback == total_cpu_update);
+}
+
+
+
+/**
+ * Start sampling the system stats of a list (virtual and resident memory,
+ * total CPU time and per-thread CPU time) every @a msecs, so that
+ * bk_dynamic_stats_demand_update(), bk_dynamic_stats_XML_create() and
+ * exports no longer read procfs or walk the thread list: they see the
+ * values of the latest sample.  Each sample is a single read of
+ * /proc/self/statm, a getrusage(2), and a clock_gettime(2) on each
+ * thread's (cached) CPU clock.  The sampler is a thread of its own, or a
+ * cron in @a run if one is supplied (for programs without threads).  A
+ * list may have only one collector.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state.
+ *	@param stats_list The statistics list to sample.
+ *	@param run Optional run environment to sample from instead of a thread.
+ *	@param msecs Sampling interval (0 for BK_DYNAMIC_STATS_COLLECTOR_MSECS_DEFAULT).
+ *	@param flags Flags for future use.
+ *	@return <i>NULL</i> on failure.<br>
+ *	@return <i>collector handle</i> on success.
+ */
+struct bk_dynamic_stats_collector *
+bk_dynamic_stats_collector_create(bk_s B, bk_dynamic_stats_h stats_list, struct bk_run *run, time_t msecs, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stats_list *bdsl = (struct bk_dynamic_stats_list *)stats_list;
+  struct bk_dynamic_stats_collector *bdsc = NULL;
+  int locked = 0;
+#ifdef BK_USING_PTHREADS
+  pthread_t *tidp;
+#endif /* BK_USING_PTHREADS */
+
+  if (!bdsl || msecs < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, NULL);
+  }
+
+#ifndef BK_USING_PTHREADS
+  if (!run)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "A run environment is required to sample statistics without threads\n");
+    BK_RETURN(B, NULL);
+  }
+#endif /* !BK_USING_PTHREADS */
+
+  if (!(BK_CALLOC(bdsc)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate stats collector: %s\n", strerror(errno));
+    goto error;
+  }
+  bdsc->bdsc_list = bdsl;
+  bdsc->bdsc_msecs = msecs ? msecs : BK_DYNAMIC_STATS_COLLECTOR_MSECS_DEFAULT;
+
+  if ((bdsc->bdsc_statm_fd = open("/proc/self/statm", O_RDONLY)) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not open /proc/self/statm: %s\n", strerror(errno));
+    goto error;
+  }
+
+  // Publish a first sample before anyone can skip the on-demand updates
+  if (bk_dynamic_stats_collector_sample(B, bdsc, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not take initial sample\n");
+    goto error;
+  }
+
+  STATS_LIST_LOCK(bdsl, locked);
+  if (bdsl->bdsl_collector)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Stats list already has a collector\n");
+    goto error;
+  }
+  __atomic_store_n(&bdsl->bdsl_collector, bdsc, __ATOMIC_RELEASE);
+  STATS_LIST_UNLOCK(bdsl, locked);
+
+  if (run)
+  {
+    if (bk_run_enqueue_cron(B, run, bdsc->bdsc_msecs, collector_cron, bdsc, &bdsc->bdsc_cron, 0) < 0)
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not schedule statistics sampling\n");
+      goto error;
+    }
+    bdsc->bdsc_run = run;
+  }
+#ifdef BK_USING_PTHREADS
+  else
+  {
+    pthread_mutex_init(&bdsc->bdsc_lock, NULL);
+    pthread_cond_init(&bdsc->bdsc_cond, NULL);
+    BK_FLAG_SET(bdsc->bdsc_flags, BDSC_FLAG_SYNC_INIT);
+
+    if (!(tidp = bk_general_thread_create(B, "bk_dynamic_stats_collector", collector_thread, bdsc, BK_THREAD_CREATE_FLAG_JOIN)))
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not start statistics sampling thread\n");
+      goto error;
+    }
+    // The threadnode goes away when the thread exits, so keep our own copy
+    bdsc->bdsc_tid = *tidp;
+    BK_FLAG_SET(bdsc->bdsc_flags, BDSC_FLAG_THREAD);
+  }
+#endif /* BK_USING_PTHREADS */
+
+  BK_RETURN(B, bdsc);
+
+ error:
+  STATS_LIST_UNLOCK(bdsl, locked);
+  if (bdsc)
+    bk_dynamic_stats_collector_destroy(B, bdsc, 0);
+  BK_RETURN(B, NULL);
+}
+
+
+
+/**
+ * Sample the system stats of a collector's list now, rather than waiting
+ * for the next interval.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state.
+ *	@param bdsc The collector.
+ *	@param flags Flags for future use.
+ *	@return <i>-1</i> on failure.<br>
+ *	@return <i>0</i> on success.
+ */
+int
+bk_dynamic_stats_collector_sample(bk_s B, struct bk_dynamic_stats_collector *bdsc, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stats_list *bdsl;
+  struct bk_dynamic_stat *bds;
+  struct rusage ru;
+  u_long vsize;
+  long rss;
+  float cpu_time;
+  int locked = 0;
+
+  if (!bdsc || !(bdsl = bdsc->bdsc_list))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (statm_read(B, bdsc->bdsc_statm_fd, &vsize, &rss) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not sample memory sizes\n");
+    goto error;
+  }
+
+  if (getrusage(RUSAGE_SELF, &ru) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not sample CPU time: %s\n", strerror(errno));
+    goto error;
+  }
+  cpu_time = BK_TV2F(&ru.ru_utime) + BK_TV2F(&ru.ru_stime);
+
+  /*
+   * Thread stats are (de)registered with the thread list locked, which must
+   * therefore be taken before the stats list lock, never inside it.
+   */
+#ifdef BK_USING_PTHREADS
+#ifndef NO_THREAD_CPU_STAT
+  if (manage_thread_stats(B, bdsl, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not manage thread stats\n");
+    goto error;
+  }
+#endif /* NO_THREAD_CPU_STAT */
+#endif /* BK_USING_PTHREADS */
+
+  STATS_LIST_LOCK(bdsl, locked);
+  for(bds = stats_list_minimum(bdsl->bdsl_list);
+      bds;
+      bds = stats_list_successor(bdsl->bdsl_list, bds))
+  {
+    int ret = 0;
+
+    if (bds->bds_update_callback == virtual_memory_update)
+      ret = stat_set(B, bds, &vsize, 0);
+    else if (bds->bds_update_callback == resident_memory_update)
+      ret = stat_set(B, bds, &rss, 0);
+    else if (bds->bds_update_callback == total_cpu_update)
+      ret = stat_set(B, bds, &cpu_time, 0);
+#ifdef BK_USING_PTHREADS
+#ifndef NO_THREAD_CPU_STAT
+    else if (bds->bds_update_callback == thread_cpu_time_update)
+      ret = thread_cpu_time_update(B, bdsl, bds, 0);
+#endif /* NO_THREAD_CPU_STAT */
+#endif /* BK_USING_PTHREADS */
+
+    if (ret < 0)
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not publish sample of statistic described by: %s\n", bds->bds_name);
+      goto error;
+    }
+  }
+  STATS_LIST_UNLOCK(bdsl, locked);
+
+  __atomic_add_fetch(&bdsc->bdsc_samples, 1, __ATOMIC_RELAXED);
+  BK_RETURN(B, 0);
+
+ error:
+  STATS_LIST_UNLOCK(bdsl, locked);
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * How many samples a collector has taken.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state.
+ *	@param bdsc The collector.
+ *	@return <i>samples</i> taken so far (including the initial one).
+ */
+u_int64_t
+bk_dynamic_stats_collector_samples(bk_s B, struct bk_dynamic_stats_collector *bdsc)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!bdsc)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, 0);
+  }
+
+  BK_RETURN(B, __atomic_load_n(&bdsc->bdsc_samples, __ATOMIC_RELAXED));
+}
+
+
+
+/**
+ * Stop a collector and detach it from its list; queries of the system
+ * stats go back to updating them on demand.
+ *
+ * THREADS: MT-SAFE (one destroyer per collector)
+ *
+ *	@param B BAKA thread/global state.
+ *	@param bdsc The collector.
+ *	@param flags Flags for future use.
+ */
+void
+bk_dynamic_stats_collector_destroy(bk_s B, struct bk_dynamic_stats_collector *bdsc, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stats_list *bdsl;
+  int locked = 0;
+
+  if (!bdsc)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_VRETURN(B);
+  }
+  bdsl = bdsc->bdsc_list;
+
+  if (bdsc->bdsc_run && bdsc->bdsc_cron)
+    bk_run_dequeue(B, bdsc->bdsc_run, bdsc->bdsc_cron, BK_RUN_DEQUEUE_CRON);
+
+#ifdef BK_USING_PTHREADS
+  if (BK_FLAG_ISSET(bdsc->bdsc_flags, BDSC_FLAG_THREAD))
+  {
+    if (pthread_mutex_lock(&bdsc->bdsc_lock) != 0)
+      abort();
+    bdsc->bdsc_stop = 1;
+    pthread_cond_signal(&bdsc->bdsc_cond);
+    if (pthread_mutex_unlock(&bdsc->bdsc_lock) != 0)
+      abort();
+
+    pthread_join(bdsc->bdsc_tid, NULL);
+  }
+
+  if (BK_FLAG_ISSET(bdsc->bdsc_flags, BDSC_FLAG_SYNC_INIT))
+  {
+    pthread_cond_destroy(&bdsc->bdsc_cond);
+    pthread_mutex_destroy(&bdsc->bdsc_lock);
+  }
+#endif /* BK_USING_PTHREADS */
+
+  if (bdsl && bdsl->bdsl_collector == bdsc)
+  {
+    STATS_LIST_LOCK(bdsl, locked);
+    __atomic_store_n(&bdsl->bdsl_collector, NULL, __ATOMIC_RELEASE);
+    STATS_LIST_UNLOCK(bdsl, locked);
+  }
+
+ error:
+  if (bdsc->bdsc_statm_fd >= 0)
+    close(bdsc->bdsc_statm_fd);
+  free(bdsc);
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Run environment cron to sample a collector's stats.
+ *
+ *	@param B BAKA thread/global state.
+ *	@param run The run environment.
+ *	@param opaque The collector.
+ *	@param starttime When this event queue run started.
+ *	@param flags BK_RUN_DESTROY when the run environment is going away.
+ */
+static void
+collector_cron(bk_s B, struct bk_run *run, void *opaque, const struct timeval starttime, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stats_collector *bdsc = opaque;
+
+  if (!bdsc)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_VRETURN(B);
+  }
+
+  if (BK_FLAG_ISSET(flags, BK_RUN_DESTROY))
+  {
+    bdsc->bdsc_run = NULL;
+    bdsc->bdsc_cron = NULL;
+    BK_VRETURN(B);
+  }
+
+  if (bk_dynamic_stats_collector_sample(B, bdsc, 0) < 0)
+    bk_error_printf(B, BK_ERR_WARN, "Could not sample statistics\n");
+
+  BK_VRETURN(B);
+}
+
+
+
+#ifdef BK_USING_PTHREADS
+/**
+ * Sampler thread: sample every bdsc_msecs until told to stop.
+ *
+ *	@param B BAKA thread/global state.
+ *	@param opaque The collector.
+ *	@return <i>NULL</i> always.
+ */
+static void *
+collector_thread(bk_s B, void *opaque)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_dynamic_stats_collector *bdsc = opaque;
+  struct timespec deadline;
+
+  if (pthread_mutex_lock(&bdsc->bdsc_lock) != 0)
+    abort();
+
+  while (!bdsc->bdsc_stop)
+  {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += bdsc->bdsc_msecs / 1000;
+    deadline.tv_nsec += (bdsc->bdsc_msecs % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+
+    while (!bdsc->bdsc_stop &&
+	   pthread_cond_timedwait(&bdsc->bdsc_cond, &bdsc->bdsc_lock, &deadline) != ETIMEDOUT)
+      ; // Spurious wakeup
+
+    if (bdsc->bdsc_stop)
+      break;
+
+    if (pthread_mutex_unlock(&bdsc->bdsc_lock) != 0)
+      abort();
+
+    if (bk_dynamic_stats_collector_sample(B, bdsc, 0) < 0)
+      bk_error_printf(B, BK_ERR_WARN, "Could not sample statistics\n");
+
+    if (pthread_mutex_lock(&bdsc->bdsc_lock) != 0)
+      abort();
+  }
+
+  if (pthread_mutex_unlock(&bdsc->bdsc_lock) != 0)
+    abort();
+
+  BK_RETURN(B, NULL);
+}
+#endif /* BK_USING_PTHREADS */
+
+
+
 /**
  * Some processes which use the indirect-update method, also want to
  * destroy that memory while still maintaining valid statistic memory. In
@@ -47,6 +47,11 @@ struct bk_error_node
 
 
 
+static struct bk_pool *errnode_pool = NULL;	///< Error node pool
+#define ERRNODE_POOL(B) BK_POOL_STATIC((B), errnode_pool, "error_node", sizeof(struct bk_error_node))
+
+
+
 /**
  * Information about the general state of errors in the system
  */
@@ -66,13 +71,78 @@ struct bk_error
   struct bk_error_node be_last;			///< Last error
   u_int32_t	be_repeat;			///< Number of times last error was repeated
   bk_flags	be_flags;			///< Flags
+  struct bk_binlog *be_binlog;			///< Binary log capturing less severe messages instead
+  int		be_binloglevel;			///< Most severe level captured in be_binlog
 #ifdef BK_USING_PTHREADS
   pthread_mutex_t be_wrlock;			///< Fun locking activity
+  struct be_ring *be_rings;			///< Per-thread rings of messages awaiting the flusher
+  u_int32_t	be_ringsize;			///< Size of new rings (0 when synchronous)
+  bk_flags	be_asyncflags;			///< BK_ERROR_ASYNC_* policy for full rings
+  time_t	be_flushms;			///< Longest a message waits for the flusher
+  u_int64_t	be_dropped;			///< Messages dropped from full rings (and reported)
+  pthread_t	be_flusher;			///< Thread draining the rings
+  pthread_cond_t be_flushcond;			///< Wakes the flusher (with be_wrlock)
+  int		be_kicked;			///< Flusher has been woken and not yet drained
+  int		be_flushstop;			///< Flusher should drain and exit
+  bk_s		be_flushB;			///< Flusher's BAKA thread state
 #endif /* BK_USING_PTHREADS */
 };
 
 
 
+#ifdef BK_USING_PTHREADS
+/**
+ * One message in a per-thread ring: this header, then the message as
+ * bk_error_iprint() would have formatted it, NUL terminated and padded out
+ * to BER_ALIGN.  A record which would not fit before the end of the ring
+ * is preceded by a BER_PAD record covering the remainder.
+ */
+struct be_record
+{
+  u_int32_t	ber_len;			///< Length of the record, padding included
+  int32_t	ber_level;			///< BK_ERR level of the message, or BER_PAD
+  time_t	ber_time;			///< Timestamp
+  u_int32_t	ber_origoffset;			///< Offset of the message without fun name
+  char		ber_msg[];			///< Formatted message
+};
+#define BER_ALIGN		32		///< Record alignment (no smaller than the header, so a pad always fits)
+#define BER_ROUND(len)		(((len) + BER_ALIGN - 1) & ~(BER_ALIGN - 1))
+#define BER_PAD			-2		///< Level of a record filling the end of the ring
+
+
+
+/**
+ * Messages raised by one thread which the flusher has yet to queue and
+ * output.  The owning thread is the only producer; whoever holds be_wrlock
+ * (normally the flusher) is the only consumer.  A ring outlives whichever
+ * of its thread and its error state goes first.
+ */
+struct be_ring
+{
+  struct bk_error *berg_owner;			///< Error state fed by this ring
+  char		*berg_buf;			///< Records
+  u_int32_t	berg_size;			///< Size of berg_buf (a power of two)
+  u_int64_t	berg_tail __attribute__((aligned(64))); ///< Bytes produced (producer writes)
+  u_int64_t	berg_dropped;			///< Messages the producer had no room for
+  u_int64_t	berg_head __attribute__((aligned(64))); ///< Bytes consumed (consumer writes)
+  u_int64_t	berg_reported;			///< Drops already reported by the consumer
+  struct be_ring *berg_next;			///< Next ring of the same error state
+  u_int		berg_state;			///< Who is done with the ring
+#define BERG_THREAD_GONE	0x1		///< Thread has exited (or moved to another error state)
+#define BERG_OWNER_GONE		0x2		///< Error state has been destroyed
+};
+
+/*
+ * Only a pointer lives in TLS, as for the function stack; the key frees
+ * (or orphans) the ring at thread exit.
+ */
+static __thread struct be_ring *be_myring __attribute__ ((tls_model ("initial-exec"))); ///< This thread's ring
+static pthread_key_t be_ring_key;		///< Releases be_myring at thread exit
+static pthread_once_t be_ring_once = PTHREAD_ONCE_INIT; ///< Creates be_ring_key
+#endif /* BK_USING_PTHREADS */
+
+
+
 /**
  * @name Defines: errq_clc
  * Lists of error messages CLC definitions
@@ -104,6 +174,23 @@ static int bk_error_enqueue(bk_s B, int sysloglevel, struct bk_error *beinfo, st
 static void be_error_output(bk_s B, FILE *fh, int sysloglevel, struct bk_error_node *node, bk_flags flags);
 static void be_error_append(bk_s B, bk_alloc_ptr *str, struct bk_error_node *node, bk_flags flags);
 static void bk_error_iclear_i(bk_s B, struct bk_error *beinfo, const char *mark, bk_flags flags);
+static int be_error_repeat(struct bk_error *beinfo, const char *msg);
+static void be_error_add(bk_s B, struct bk_error *beinfo, int sysloglevel, time_t when, char *msg, int origoffset, bk_flags flags);
+static void be_repeater_flush(bk_s B, struct bk_error *beinfo, bk_flags flags);
+#define BE_FLAG_FLUSHER		0x1		///< On the flusher, not the thread which raised the error
+/** Output flags: the flusher's own stack is no use as a trace of the message */
+#define BE_OUTFLAGS(beinfo, flags) (BK_FLAG_ISSET((flags), BE_FLAG_FLUSHER) ? (beinfo)->be_flags & ~BK_ERROR_FLAG_MORE_FUN : (beinfo)->be_flags)
+#ifdef BK_USING_PTHREADS
+static int be_async_print(bk_s B, int sysloglevel, struct bk_error *beinfo, const char *buf);
+static struct be_ring *be_ring_mine(struct bk_error *beinfo);
+static void be_kick(struct bk_error *beinfo);
+static void be_ring_release(struct be_ring *ring, u_int gone);
+static void be_ring_key_create(void);
+static void be_ring_exit(void *opaque);
+static void be_async_drain(bk_s B, struct bk_error *beinfo);
+static void be_error_dropped(bk_s B, struct bk_error *beinfo, u_int64_t dropped);
+static void *be_flusher(void *opaque);
+#endif /* BK_USING_PTHREADS */
 
 
 
@@ -146,8 +233,18 @@ struct bk_error *bk_error_init(bk_s B, u_int16_t queuelen, FILE *fh, int syslogt
   beinfo->be_maxsize = queuelen;
   BK_ZERO(&(beinfo->be_last));
   beinfo->be_flags = flags;
+  beinfo->be_binlog = NULL;
+  beinfo->be_binloglevel = BK_ERR_DEBUG;
 #ifdef BK_USING_PTHREADS
   pthread_mutex_init(&beinfo->be_wrlock, NULL);
+  beinfo->be_rings = NULL;
+  beinfo->be_ringsize = 0;
+  beinfo->be_asyncflags = 0;
+  beinfo->be_flushms = 0;
+  beinfo->be_dropped = 0;
+  beinfo->be_kicked = 0;
+  beinfo->be_flushstop = 0;
+  beinfo->be_flushB = NULL;
 #endif /* BK_USING_PTHREADS */
 
   if (!(beinfo->be_markqueue = errq_create(NULL, NULL, DICT_UNORDERED|DICT_THREAD_NOCOALESCE, NULL)))
@@ -174,6 +271,9 @@ struct bk_error *bk_error_init(bk_s B, u_int16_t queuelen, FILE *fh, int syslogt
     goto error;
   }
 
+  // Make the node pool now, not first with be_wrlock held (see bk_pool_static)
+  (void)ERRNODE_POOL(B);
+
   return(beinfo);
 
  error:
@@ -194,6 +294,9 @@ struct bk_error *bk_error_init(bk_s B, u_int16_t queuelen, FILE *fh, int syslogt
 void bk_error_destroy(bk_s B, struct bk_error *beinfo)
 {
   struct bk_error_node *node;
+#ifdef BK_USING_PTHREADS
+  struct be_ring *ring;
+#endif /* BK_USING_PTHREADS */
 
   if (!beinfo)
   {
@@ -201,16 +304,27 @@ void bk_error_destroy(bk_s B, struct bk_error *beinfo)
     return;
   }
 
+#ifdef BK_USING_PTHREADS
+  // Back to synchronous, then queue whatever is left in the rings and leave them to their threads
+  bk_error_isync(B, beinfo);
+  be_async_drain(B, beinfo);
+  while ((ring = beinfo->be_rings))
+  {
+    beinfo->be_rings = ring->berg_next;
+    be_ring_release(ring, BERG_OWNER_GONE);
+  }
+#endif /* BK_USING_PTHREADS */
+
   // flush the last repeated error, if there is one
   bk_error_irepeater_flush(B, beinfo, 0);
 
-  DICT_NUKE_CONTENTS(beinfo->be_markqueue, errq, node, break, if (node->ben_msg) free(node->ben_msg); free(node));
+  DICT_NUKE_CONTENTS(beinfo->be_markqueue, errq, node, break, if (node->ben_msg) free(node->ben_msg); bk_pool_free(B, errnode_pool, node));
   errq_destroy(beinfo->be_markqueue);
 
-  DICT_NUKE_CONTENTS(beinfo->be_hiqueue, errq, node, break, if (node->ben_msg) free(node->ben_msg); free(node));
+  DICT_NUKE_CONTENTS(beinfo->be_hiqueue, errq, node, break, if (node->ben_msg) free(node->ben_msg); bk_pool_free(B, errnode_pool, node));
   errq_destroy(beinfo->be_hiqueue);
 
-  DICT_NUKE_CONTENTS(beinfo->be_lowqueue, errq, node, break, if (node->ben_msg) free(node->ben_msg); free(node));
+  DICT_NUKE_CONTENTS(beinfo->be_lowqueue, errq, node, break, if (node->ben_msg) free(node->ben_msg); bk_pool_free(B, errnode_pool, node));
   errq_destroy(beinfo->be_lowqueue);
 
   free(beinfo);
@@ -274,7 +388,7 @@ void bk_error_config(bk_s B, struct bk_error *beinfo, u_int16_t queuelen, FILE *
 /**
  * Flush the "Last message repeated n times" message
  *
- * THREADS: REENTRANT
+ * THREADS: THREAD-REENTRANT
  *
  *	@param B BAKA thread/global state
  *	@param beinfo The error state structure.
@@ -282,18 +396,213 @@ void bk_error_config(bk_s B, struct bk_error *beinfo, u_int16_t queuelen, FILE *
  */
 void bk_error_irepeater_flush(bk_s B, struct bk_error *beinfo, bk_flags flags)
 {
-  struct bk_error_node *node = NULL;
-  static const char repeated_fmt[] = "Last message repeated %ld times\n";
-  int sysloglevel;
+  if (!beinfo)
+    return;
+
+#ifdef BK_USING_PTHREADS
+  if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_lock(&beinfo->be_wrlock) != 0)
+    abort();
+
+  // Repeats of messages still in the rings count too
+  be_async_drain(B, beinfo);
+#endif /* BK_USING_PTHREADS */
+
+  be_repeater_flush(B, beinfo, 0);
+
+#ifdef BK_USING_PTHREADS
+  if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_unlock(&beinfo->be_wrlock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+}
+
+
+
+#ifdef BK_USING_PTHREADS
+/**
+ * Have messages raised from now on go through a ring belonging to the
+ * raising thread, from which a background flusher queues, deduplicates
+ * and outputs them (to the file handle and syslog), so that threads never
+ * wait on each other or on output to raise errors.  Rings are bounded:
+ * when a thread's ring is full, its message is dropped (and the drop
+ * later reported) unless the flags ask it to wait for room.  Messages
+ * raised with BK_ERROR_FLAG_MORE_FUN configured are still handled
+ * synchronously, since their stack trace is of the raising thread.
+ * Marks, flushes and dumps first drain the rings, so they see every
+ * message raised before them, exactly as before.  Calling this again
+ * changes the policy for rings created after.
+ *
+ * THREADS: THREAD-REENTRANT
+ *
+ *	@param B BAKA thread/global state
+ *	@param beinfo The error state structure.
+ *	@param ringsize Bytes of messages each thread may have pending (0 for BK_ERROR_ASYNC_RINGSIZE_DEFAULT)
+ *	@param msecs Longest a low priority message waits to be queued (0 for BK_ERROR_ASYNC_MSECS_DEFAULT); high priority messages wake the flusher at once
+ *	@param flags BK_ERROR_ASYNC_BLOCK to wait for room in a full ring
+ *	rather than drop, BK_ERROR_ASYNC_BLOCK_HI to wait only for messages
+ *	at or above the hi-lo pivot.
+ *	@return <i>-1</i> on call failure, or if threads are not enabled
+ *	@return <br><i>0</i> on success
+ */
+int bk_error_iasync(bk_s B, struct bk_error *beinfo, u_int32_t ringsize, time_t msecs, bk_flags flags)
+{
+  u_int32_t size;
+  int ret = -1;
+
+  if (!beinfo || msecs < 0 || !BK_GENERAL_FLAG_ISTHREADREADY(B))
+    return(-1);
+
+  ringsize = ringsize ? ringsize : BK_ERROR_ASYNC_RINGSIZE_DEFAULT;
+  for (size = BK_ERROR_ASYNC_RINGSIZE_MIN; size < ringsize && size < (1U << 31); size <<= 1)
+    ;
+
+  if (pthread_mutex_lock(&beinfo->be_wrlock) != 0)
+    abort();
+
+  beinfo->be_asyncflags = flags & (BK_ERROR_ASYNC_BLOCK|BK_ERROR_ASYNC_BLOCK_HI);
+  beinfo->be_flushms = msecs ? msecs : BK_ERROR_ASYNC_MSECS_DEFAULT;
+
+  if (!beinfo->be_flushB)
+  {
+    /*
+     * The flusher is kept off the thread list: it must outlive the other
+     * threads (bk_general_destroy cancels them before destroying us).
+     */
+    if (!(beinfo->be_flushB = bk_general_thread_init(B, "bk_error_flusher")))
+      goto done;
+
+    pthread_cond_init(&beinfo->be_flushcond, NULL);
+    beinfo->be_flushstop = 0;
+    __atomic_store_n(&beinfo->be_kicked, 0, __ATOMIC_RELEASE);
+    if (pthread_create(&beinfo->be_flusher, NULL, be_flusher, beinfo) != 0)
+    {
+      pthread_cond_destroy(&beinfo->be_flushcond);
+      bk_general_thread_destroy(beinfo->be_flushB);
+      beinfo->be_flushB = NULL;
+      goto done;
+    }
+  }
+
+  __atomic_store_n(&beinfo->be_ringsize, size, __ATOMIC_RELEASE);
+  ret = 0;
+
+ done:
+  if (pthread_mutex_unlock(&beinfo->be_wrlock) != 0)
+    abort();
+  return(ret);
+}
+
+
+
+/**
+ * Go back to handling messages synchronously, in the raising thread.
+ * Messages already in the rings are queued (and output) first.
+ *
+ * THREADS: THREAD-REENTRANT
+ *
+ *	@param B BAKA thread/global state
+ *	@param beinfo The error state structure.
+ */
+void bk_error_isync(bk_s B, struct bk_error *beinfo)
+{
+  if (!beinfo || !beinfo->be_flushB)
+    return;
+
+  __atomic_store_n(&beinfo->be_ringsize, 0, __ATOMIC_RELEASE);
+
+  if (pthread_mutex_lock(&beinfo->be_wrlock) != 0)
+    abort();
+  beinfo->be_flushstop = 1;
+  pthread_cond_signal(&beinfo->be_flushcond);
+  if (pthread_mutex_unlock(&beinfo->be_wrlock) != 0)
+    abort();
+
+  // The flusher drains the rings on its way out
+  pthread_join(beinfo->be_flusher, NULL);
+  pthread_cond_destroy(&beinfo->be_flushcond);
+  bk_general_thread_destroy(beinfo->be_flushB);
+  beinfo->be_flushB = NULL;
+}
+
+
+
+/**
+ * Number of messages dropped because the raising thread's ring was full.
+ *
+ * THREADS: THREAD-REENTRANT
+ *
+ *	@param B BAKA thread/global state
+ *	@param beinfo The error state structure.
+ *	@return <i>messages dropped</i> so far
+ */
+u_int64_t bk_error_idropped(bk_s B, struct bk_error *beinfo)
+{
+  u_int64_t dropped;
+
+  if (!beinfo)
+    return(0);
+
+  if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_lock(&beinfo->be_wrlock) != 0)
+    abort();
+
+  be_async_drain(B, beinfo);
+  dropped = beinfo->be_dropped;
+
+  if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_unlock(&beinfo->be_wrlock) != 0)
+    abort();
+
+  return(dropped);
+}
+#endif /* BK_USING_PTHREADS */
+
 
+
+/**
+ * Capture printf-style messages of a level or less severe in a binary
+ * log, unformatted, instead of queueing and outputting them.  Meant for
+ * the (mostly unread) notice and debug levels; marks and dumps do not see
+ * captured messages.  The formats must be string constants.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state
+ *	@param beinfo The error state structure.
+ *	@param bbl Binary log, or NULL to stop capturing
+ *	@param level Most severe BK_ERR level to capture
+ */
+void bk_error_ibinlog(bk_s B, struct bk_error *beinfo, struct bk_binlog *bbl, int level)
+{
   if (!beinfo)
+  {
+    /* <KLUDGE>Invalid argument</KLUDGE> */
     return;
+  }
+
+  __atomic_store_n(&beinfo->be_binloglevel, level, __ATOMIC_RELAXED);
+  __atomic_store_n(&beinfo->be_binlog, bbl, __ATOMIC_SEQ_CST);
+}
+
+
+
+/**
+ * Flush the "Last message repeated n times" message, with be_wrlock held
+ *
+ * THREADS: REENTRANT
+ *
+ *	@param B BAKA thread/global state
+ *	@param beinfo The error state structure.
+ *	@param flags BE_FLAG_FLUSHER when called by the flusher
+ */
+static void be_repeater_flush(bk_s B, struct bk_error *beinfo, bk_flags flags)
+{
+  struct bk_error_node *node = NULL;
+  static const char repeated_fmt[] = "Last message repeated %ld times\n";
+  int sysloglevel;
 
   sysloglevel = beinfo->be_last.ben_level;
 
   if (beinfo->be_last.ben_repeat > 0)
   {
-    if (!(node = malloc(sizeof(*node))))
+    if (!(node = bk_pool_alloc(B, ERRNODE_POOL(B), 0)))
     {
       /* <KLUDGE>cannot allocate storage for error node</KLUDGE> */
       goto error;
@@ -326,7 +635,7 @@ void bk_error_irepeater_flush(bk_s B, struct bk_error *beinfo, bk_flags flags)
     // <TRICKY>Presumes smaller syslog levels are higher priority</TRICKY>
     if (beinfo->be_last.ben_level <= beinfo->be_hilo_pivot && (beinfo->be_last.ben_level != BK_ERR_NONE || beinfo->be_fh))
     {
-      be_error_output(B, beinfo->be_fh, beinfo->be_last.ben_level, node, beinfo->be_flags);
+      be_error_output(B, beinfo->be_fh, beinfo->be_last.ben_level, node, BE_OUTFLAGS(beinfo, flags));
     }
 
     if (bk_error_enqueue(B, sysloglevel, beinfo, node, 0) < 0)
@@ -349,7 +658,7 @@ void bk_error_irepeater_flush(bk_s B, struct bk_error *beinfo, bk_flags flags)
   if (node)
   {
     if (node->ben_msg) free(node->ben_msg);
-    free(node);
+    bk_pool_free(B, errnode_pool, node);
   }
 
   return;
@@ -373,13 +682,17 @@ void bk_error_iprint(bk_s B, int sysloglevel, struct bk_error *beinfo, const cha
 {
   const char *funname;
   time_t curtime = time(NULL);
-  struct bk_error_node *node = NULL;
   const char *level = bk_general_errorstr(B, sysloglevel);
   int len = -8;					// -(total %. chars in fmt)
   char *msg = NULL;
   int origoffset;
 
 #ifdef BK_USING_PTHREADS
+  // <TRICKY>Stack traces are of the raising thread, so those messages cannot wait for the flusher</TRICKY>
+  if (__atomic_load_n(&beinfo->be_ringsize, __ATOMIC_ACQUIRE) && BK_FLAG_ISCLEAR(beinfo->be_flags, BK_ERROR_FLAG_MORE_FUN) &&
+      be_async_print(B, sysloglevel, beinfo, buf) == 0)
+    return;
+
   if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_lock(&beinfo->be_wrlock) != 0)
     abort();
 #endif /* BK_USING_PTHREADS */
@@ -398,46 +711,21 @@ void bk_error_iprint(bk_s B, int sysloglevel, struct bk_error *beinfo, const cha
   }
   snprintf(msg, len, FMT, funname, &origoffset, level, buf);
 
-  if (beinfo->be_last.ben_msg && BK_STREQ(msg, beinfo->be_last.ben_msg))
-  {
-    beinfo->be_last.ben_repeat++;
-    free(msg);
-    msg = NULL;
-  }
-  else
-  {
-    bk_error_irepeater_flush(B, beinfo, 0);
+  be_error_add(B, beinfo, sysloglevel, curtime, msg, origoffset, 0);
+  msg = NULL;
 
-    if (!(node = malloc(sizeof(*node))))
-    {
-      /* <KLUDGE>cannot allocate storage for error node</KLUDGE> */
-      goto error;
-    }
-    node->ben_time = curtime;
-    node->ben_seq = beinfo->be_seqnum++;
-    node->ben_level = sysloglevel;
-    node->ben_msg = msg;
-    msg = NULL;
-    node->ben_origmsg = &node->ben_msg[origoffset];
-    node->ben_repeat = 0;
-
-    memcpy(&(beinfo->be_last), node, sizeof(struct bk_error_node));
-    beinfo->be_last.ben_msg = NULL;
-    beinfo->be_last.ben_origmsg = NULL;
-    if (beinfo->be_last.ben_msg = strdup(node->ben_msg))
-    {
-      beinfo->be_last.ben_origmsg = &beinfo->be_last.ben_msg[origoffset];
-    }
+#ifdef BK_USING_PTHREADS
+  if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_unlock(&beinfo->be_wrlock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
 
-    if (!bk_error_enqueue(B, sysloglevel, beinfo, node, 0) < 0)
-    {
-      goto error;
-    }
+  return;
 
-    // <TRICKY>Presumes smaller syslog levels are higher priority</TRICKY>
-    if (sysloglevel <= beinfo->be_hilo_pivot && (sysloglevel != BK_ERR_NONE || beinfo->be_fh))
-      be_error_output(B, beinfo->be_fh, beinfo->be_sysloglevel, node, beinfo->be_flags);
+ error:
 
+  if (msg)
+  {
+    free(msg);
   }
 
 #ifdef BK_USING_PTHREADS
@@ -446,26 +734,100 @@ void bk_error_iprint(bk_s B, int sysloglevel, struct bk_error *beinfo, const cha
 #endif /* BK_USING_PTHREADS */
 
   return;
+}
 
- error:
 
-  if (msg)
+
+/**
+ * Is this message a repeat of the last?  If so, count it.
+ *
+ * THREADS: REENTRANT
+ *
+ *	@param beinfo The error state structure.
+ *	@param msg The formatted message.
+ *	@return <i>1</i> if a repeat (which has been counted)
+ *	@return <br><i>0</i> if not
+ */
+static int be_error_repeat(struct bk_error *beinfo, const char *msg)
+{
+  if (beinfo->be_last.ben_msg && BK_STREQ(msg, beinfo->be_last.ben_msg))
+  {
+    beinfo->be_last.ben_repeat++;
+    return(1);
+  }
+
+  return(0);
+}
+
+
+
+/**
+ * Queue (and if necessary, output) a formatted message, or count it as a
+ * repeat of the last, with be_wrlock held.
+ *
+ * THREADS: REENTRANT
+ *
+ *	@param B BAKA thread/global state
+ *	@param beinfo The error state structure.
+ *	@param sysloglevel The BK_ERR level of important of this message
+ *	@param when When the message was raised
+ *	@param msg The formatted message (malloc'd; ownership passes to us)
+ *	@param origoffset Offset of the message without fun name
+ *	@param flags BE_FLAG_FLUSHER when called by the flusher
+ */
+static void be_error_add(bk_s B, struct bk_error *beinfo, int sysloglevel, time_t when, char *msg, int origoffset, bk_flags flags)
+{
+  struct bk_error_node *node = NULL;
+
+  if (be_error_repeat(beinfo, msg))
   {
     free(msg);
+    return;
   }
 
-  if (node)
+  be_repeater_flush(B, beinfo, flags);
+
+  if (!(node = bk_pool_alloc(B, ERRNODE_POOL(B), 0)))
   {
-    if (node->ben_msg) free(node->ben_msg);
-    free(node);
+    /* <KLUDGE>cannot allocate storage for error node</KLUDGE> */
+    goto error;
+  }
+  node->ben_time = when;
+  node->ben_seq = beinfo->be_seqnum++;
+  node->ben_level = sysloglevel;
+  node->ben_msg = msg;
+  msg = NULL;
+  node->ben_origmsg = &node->ben_msg[origoffset];
+  node->ben_repeat = 0;
+
+  memcpy(&(beinfo->be_last), node, sizeof(struct bk_error_node));
+  beinfo->be_last.ben_msg = NULL;
+  beinfo->be_last.ben_origmsg = NULL;
+  if (beinfo->be_last.ben_msg = strdup(node->ben_msg))
+  {
+    beinfo->be_last.ben_origmsg = &beinfo->be_last.ben_msg[origoffset];
   }
 
-#ifdef BK_USING_PTHREADS
-  if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_unlock(&beinfo->be_wrlock) != 0)
-    abort();
-#endif /* BK_USING_PTHREADS */
+  if (bk_error_enqueue(B, sysloglevel, beinfo, node, 0) < 0)
+  {
+    goto error;
+  }
+
+  // <TRICKY>Presumes smaller syslog levels are higher priority</TRICKY>
+  if (sysloglevel <= beinfo->be_hilo_pivot && (sysloglevel != BK_ERR_NONE || beinfo->be_fh))
+    be_error_output(B, beinfo->be_fh, beinfo->be_sysloglevel, node, BE_OUTFLAGS(beinfo, flags));
 
   return;
+
+ error:
+  if (msg)
+    free(msg);
+
+  if (node)
+  {
+    if (node->ben_msg) free(node->ben_msg);
+    bk_pool_free(B, errnode_pool, node);
+  }
 }
 
 
@@ -512,7 +874,7 @@ int bk_error_enqueue(bk_s B, int sysloglevel, struct bk_error *beinfo, struct bk
     struct bk_error_node *last = errq_maximum(be_queue);
     errq_delete(be_queue, last);
     if (last->ben_msg) free(last->ben_msg);
-    free(last);
+    bk_pool_free(B, errnode_pool, last);
     (*be_cursize)--;
   }
 
@@ -546,6 +908,8 @@ void bk_error_iprintf(bk_s B, int sysloglevel, struct bk_error *beinfo, const ch
 {
   va_list args;
   char buf[MAXERRORLINE];
+  struct bk_binlog *bbl;
+  int phase;
 
   if (!beinfo || !format)
   {
@@ -554,6 +918,20 @@ void bk_error_iprintf(bk_s B, int sysloglevel, struct bk_error *beinfo, const ch
   }
 
   va_start(args, format);
+  if (__atomic_load_n(&beinfo->be_binlog, __ATOMIC_RELAXED) &&
+      sysloglevel >= __atomic_load_n(&beinfo->be_binloglevel, __ATOMIC_RELAXED))
+  {
+    // Held, so that bk_binlog_destroy waits for us if it is being detached
+    phase = bk_binlog_hold();
+    if ((bbl = __atomic_load_n(&beinfo->be_binlog, __ATOMIC_SEQ_CST)))
+    {
+      bk_binlog_ivprintf(B, bbl, sysloglevel, bk_fun_funname(B, 0, 0), format, args);
+      bk_binlog_unhold(phase);
+      va_end(args);
+      return;
+    }
+    bk_binlog_unhold(phase);
+  }
   vsnprintf(buf, sizeof(buf), format, args);
   va_end(args);
 
@@ -605,6 +983,8 @@ void bk_error_iprintbuf(bk_s B, int sysloglevel, struct bk_error *beinfo, const
 void bk_error_ivprintf(bk_s B, int sysloglevel, struct bk_error *beinfo, const char *format, va_list ap)
 {
   char buf[MAXERRORLINE];
+  struct bk_binlog *bbl;
+  int phase;
 
   if (!beinfo || !format)
   {
@@ -612,6 +992,19 @@ void bk_error_ivprintf(bk_s B, int sysloglevel, struct bk_error *beinfo, const c
     return;
   }
 
+  if (__atomic_load_n(&beinfo->be_binlog, __ATOMIC_RELAXED) &&
+      sysloglevel >= __atomic_load_n(&beinfo->be_binloglevel, __ATOMIC_RELAXED))
+  {
+    phase = bk_binlog_hold();
+    if ((bbl = __atomic_load_n(&beinfo->be_binlog, __ATOMIC_SEQ_CST)))
+    {
+      bk_binlog_ivprintf(B, bbl, sysloglevel, bk_fun_funname(B, 0, 0), format, ap);
+      bk_binlog_unhold(phase);
+      return;
+    }
+    bk_binlog_unhold(phase);
+  }
+
   vsnprintf(buf, sizeof(buf), format, ap);
   bk_error_iprint(B, sysloglevel, beinfo, buf);
 }
@@ -642,6 +1035,9 @@ void bk_error_iflush(bk_s B, struct bk_error *beinfo, const char *mark, bk_flags
 #ifdef BK_USING_PTHREADS
   if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_lock(&beinfo->be_wrlock) != 0)
     abort();
+
+  // Messages still in the rings were raised before this call
+  be_async_drain(B, beinfo);
 #endif /* BK_USING_PTHREADS */
 
   if (mark)
@@ -688,7 +1084,7 @@ void bk_error_iflush(bk_s B, struct bk_error *beinfo, const char *mark, bk_flags
 	if (node->ben_msg)
 	  free(node->ben_msg);
 	errq_delete(*curq, node);
-	free(node);
+	bk_pool_free(B, errnode_pool, node);
 
 	// decrement counter
 	if (*curq == beinfo->be_hiqueue)
@@ -739,11 +1135,14 @@ void bk_error_imark(bk_s B, struct bk_error *beinfo, const char *mark, bk_flags
 #ifdef BK_USING_PTHREADS
   if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_lock(&beinfo->be_wrlock) != 0)
     abort();
+
+  // Messages still in the rings were raised before this call
+  be_async_drain(B, beinfo);
 #endif /* BK_USING_PTHREADS */
 
   bk_error_iclear_i(B, beinfo, mark, flags);
 
-  if (!(node = malloc(sizeof(*node))))
+  if (!(node = bk_pool_alloc(B, ERRNODE_POOL(B), 0)))
   {
     // <KLUDGE>perror("malloc")</KLUDGE>
     goto done;
@@ -757,7 +1156,7 @@ void bk_error_imark(bk_s B, struct bk_error *beinfo, const char *mark, bk_flags
   if (errq_insert(beinfo->be_markqueue, node) != DICT_OK)
   {
     // <KLUDGE>perror("insert")</KLUDGE>
-    free(node);
+    bk_pool_free(B, errnode_pool, node);
     goto done;
   }
  done:
@@ -843,7 +1242,7 @@ static void bk_error_iclear_i(bk_s B, struct bk_error *beinfo, const char *mark,
   if ((node = bk_error_marksearch(B, beinfo, mark, flags)))
   {
     errq_delete(beinfo->be_markqueue, node);
-    free(node);
+    bk_pool_free(B, errnode_pool, node);
   }
 }
 
@@ -884,6 +1283,9 @@ void bk_error_idump(bk_s B, struct bk_error *beinfo, FILE *fh, const char *mark,
 #ifdef BK_USING_PTHREADS
   if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_lock(&beinfo->be_wrlock) != 0)
     abort();
+
+  // Messages still in the rings were raised before this call
+  be_async_drain(B, beinfo);
 #endif /* BK_USING_PTHREADS */
 
   if (mark)
@@ -979,6 +1381,9 @@ char *bk_error_istrdump(bk_s B, struct bk_error *beinfo, const char *mark, int m
 #ifdef BK_USING_PTHREADS
   if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_lock(&beinfo->be_wrlock) != 0)
     abort();
+
+  // Messages still in the rings were raised before this call
+  be_async_drain(B, beinfo);
 #endif /* BK_USING_PTHREADS */
 
   if (mark)
@@ -1285,3 +1690,365 @@ static void be_error_append(bk_s B, bk_alloc_ptr *str, struct bk_error_node *nod
 
   str->cur += addedlength;
 }
+
+
+
+#ifdef BK_USING_PTHREADS
+/**
+ * Put a message in this thread's ring for the flusher, formatted just as
+ * bk_error_iprint() would.  A message which does not fit is dropped (and
+ * counted), or waited on, according to the drop policy.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state
+ *	@param sysloglevel The BK_ERR level of important of this message
+ *	@param beinfo The error state structure.
+ *	@param buf The error string to print.
+ *	@return <i>-1</i> if the message must be handled synchronously
+ *	@return <br><i>0</i> if it is now the flusher's (or was dropped)
+ */
+static int be_async_print(bk_s B, int sysloglevel, struct bk_error *beinfo, const char *buf)
+{
+  struct be_ring *ring;
+  struct be_record *rec;
+  const char *funname;
+  const char *level = bk_general_errorstr(B, sysloglevel);
+  size_t len = -8;				// -(total %. chars in fmt)
+  u_int64_t tail, head;
+  u_int32_t need, off, room, total;
+  int origoffset = 0;
+  int block;
+
+  if (!(ring = be_ring_mine(beinfo)))
+    return(-1);
+
+  if (!(funname = bk_fun_funname(B, 0, 0)))
+    funname = "?";
+
+  // Overlong messages are truncated, so that one can never fill a ring
+  len += strlen(funname) + strlen(buf) + strlen(level) + sizeof(FMT);
+  len = BK_MIN(len, ring->berg_size / 4 - sizeof(*rec));
+  need = BER_ROUND(sizeof(*rec) + len);
+
+  // <TRICKY>Presumes smaller syslog levels are higher priority</TRICKY>
+  block = BK_FLAG_ISSET(beinfo->be_asyncflags, BK_ERROR_ASYNC_BLOCK) ||
+    (BK_FLAG_ISSET(beinfo->be_asyncflags, BK_ERROR_ASYNC_BLOCK_HI) && sysloglevel <= beinfo->be_hilo_pivot);
+
+  tail = ring->berg_tail;			// Only we write it
+  for (;;)
+  {
+    off = tail & (ring->berg_size - 1);
+    room = ring->berg_size - off;
+    total = need <= room ? need : room + need;
+    head = __atomic_load_n(&ring->berg_head, __ATOMIC_ACQUIRE);
+
+    if (tail + total - head <= ring->berg_size)
+      break;
+
+    // Nobody will drain the ring once we are synchronous again
+    if (!block || !__atomic_load_n(&beinfo->be_ringsize, __ATOMIC_ACQUIRE))
+    {
+      __atomic_add_fetch(&ring->berg_dropped, 1, __ATOMIC_RELAXED);
+      return(0);
+    }
+
+    be_kick(beinfo);
+    usleep(100);
+  }
+
+  if (need > room)
+  {
+    rec = (struct be_record *)(ring->berg_buf + off);
+    rec->ber_len = room;
+    rec->ber_level = BER_PAD;
+    tail += room;
+    off = 0;
+  }
+
+  rec = (struct be_record *)(ring->berg_buf + off);
+  rec->ber_len = need;
+  rec->ber_level = sysloglevel;
+  rec->ber_time = time(NULL);
+  snprintf(rec->ber_msg, len, FMT, funname, &origoffset, level, buf);
+  rec->ber_origoffset = origoffset;
+
+  __atomic_store_n(&ring->berg_tail, tail + need, __ATOMIC_RELEASE);
+
+  // Low priority messages can wait for the next interval (unless they are piling up)
+  if (sysloglevel <= beinfo->be_hilo_pivot || tail + need - head > ring->berg_size / 2)
+    be_kick(beinfo);
+
+  return(0);
+}
+
+
+
+/**
+ * Wake the flusher, unless it was already woken or is being stopped.
+ *
+ * <TRICKY>The signal is sent under be_wrlock: a raising thread can get
+ * here after bk_error_isync has stopped the flusher, and the condition
+ * variable is destroyed as soon as the flusher has been joined.</TRICKY>
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param beinfo The error state structure.
+ */
+static void be_kick(struct bk_error *beinfo)
+{
+  if (__atomic_exchange_n(&beinfo->be_kicked, 1, __ATOMIC_ACQ_REL))
+    return;
+
+  if (pthread_mutex_lock(&beinfo->be_wrlock) != 0)
+    abort();
+  if (!beinfo->be_flushstop)
+    pthread_cond_signal(&beinfo->be_flushcond);
+  if (pthread_mutex_unlock(&beinfo->be_wrlock) != 0)
+    abort();
+}
+
+
+
+/**
+ * This thread's ring for an error state, created on first use
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param beinfo The error state structure.
+ *	@return <i>NULL</i> on allocation failure
+ *	@return <br><i>ring</i> on success
+ */
+static struct be_ring *be_ring_mine(struct bk_error *beinfo)
+{
+  struct be_ring *ring = be_myring;
+  u_int32_t size;
+
+  if (ring && ring->berg_owner == beinfo && !(__atomic_load_n(&ring->berg_state, __ATOMIC_ACQUIRE) & BERG_OWNER_GONE))
+    return(ring);
+
+  // A thread feeds one error state at a time; the old one drains what it has
+  if (ring)
+  {
+    be_myring = NULL;
+    pthread_setspecific(be_ring_key, NULL);
+    be_ring_release(ring, BERG_THREAD_GONE);
+  }
+
+  if (!(size = __atomic_load_n(&beinfo->be_ringsize, __ATOMIC_ACQUIRE)))
+    return(NULL);
+
+  if (!BK_CALLOC(ring))
+    return(NULL);
+
+  if (!BK_MALLOC_LEN(ring->berg_buf, size))
+  {
+    free(ring);
+    return(NULL);
+  }
+  ring->berg_owner = beinfo;
+  ring->berg_size = size;
+
+  if (pthread_once(&be_ring_once, be_ring_key_create) != 0 ||
+      pthread_setspecific(be_ring_key, ring) != 0)
+  {
+    free(ring->berg_buf);
+    free(ring);
+    return(NULL);
+  }
+
+  ring->berg_next = __atomic_load_n(&beinfo->be_rings, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&beinfo->be_rings, &ring->berg_next, ring, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+
+  be_myring = ring;
+  return(ring);
+}
+
+
+
+/**
+ * One of the ring's thread and error state is done with it; the second
+ * frees it.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param ring The ring.
+ *	@param gone BERG_THREAD_GONE or BERG_OWNER_GONE
+ */
+static void be_ring_release(struct be_ring *ring, u_int gone)
+{
+  if ((__atomic_fetch_or(&ring->berg_state, gone, __ATOMIC_ACQ_REL) | gone) == (BERG_THREAD_GONE|BERG_OWNER_GONE))
+  {
+    free(ring->berg_buf);
+    free(ring);
+  }
+}
+
+
+
+/**
+ * Create the key which releases rings at thread exit
+ */
+static void be_ring_key_create(void)
+{
+  if (pthread_key_create(&be_ring_key, be_ring_exit) != 0)
+    abort();
+}
+
+
+
+/**
+ * A thread is exiting: leave what is in its ring to the flusher
+ *
+ *	@param opaque The thread's ring
+ */
+static void be_ring_exit(void *opaque)
+{
+  be_myring = NULL;
+  be_ring_release(opaque, BERG_THREAD_GONE);
+}
+
+
+
+/**
+ * Queue and output everything in the rings, and report drops, with
+ * be_wrlock held.  Rings whose threads are gone are freed once empty.
+ *
+ * THREADS: REENTRANT
+ *
+ *	@param B BAKA thread/global state
+ *	@param beinfo The error state structure.
+ */
+static void be_async_drain(bk_s B, struct bk_error *beinfo)
+{
+  struct be_ring *ring, *expect, **prev;
+  struct be_record *rec;
+  u_int64_t head, tail, dropped;
+  u_int state;
+  char *msg;
+
+  prev = &beinfo->be_rings;
+  while ((ring = __atomic_load_n(prev, __ATOMIC_ACQUIRE)))
+  {
+    // <TRICKY>State first: a thread which is gone has already published its last record</TRICKY>
+    state = __atomic_load_n(&ring->berg_state, __ATOMIC_ACQUIRE);
+    tail = __atomic_load_n(&ring->berg_tail, __ATOMIC_ACQUIRE);
+
+    for (head = ring->berg_head; head != tail; head += rec->ber_len)
+    {
+      rec = (struct be_record *)(ring->berg_buf + (head & (ring->berg_size - 1)));
+      if (rec->ber_level == BER_PAD)
+	continue;
+
+      if (!be_error_repeat(beinfo, rec->ber_msg) && (msg = strdup(rec->ber_msg)))
+	be_error_add(B, beinfo, rec->ber_level, rec->ber_time, msg, rec->ber_origoffset, BE_FLAG_FLUSHER);
+    }
+    __atomic_store_n(&ring->berg_head, head, __ATOMIC_RELEASE);
+
+    if ((dropped = __atomic_load_n(&ring->berg_dropped, __ATOMIC_RELAXED)) != ring->berg_reported)
+    {
+      be_error_dropped(B, beinfo, dropped - ring->berg_reported);
+      ring->berg_reported = dropped;
+    }
+
+    if (!(state & BERG_THREAD_GONE))
+    {
+      prev = &ring->berg_next;
+      continue;
+    }
+
+    /*
+     * Threads only ever push onto the head of the list, so a ring which is
+     * not at the head can be unlinked without atomics.  Either way, prev
+     * is left on the link which now holds the ring after it.
+     */
+    expect = ring;
+    if (prev != &beinfo->be_rings ||
+	!__atomic_compare_exchange_n(prev, &expect, ring->berg_next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+      // New rings may have been pushed in front of it
+      while ((expect = __atomic_load_n(prev, __ATOMIC_ACQUIRE)) != ring)
+	prev = &expect->berg_next;
+      *prev = ring->berg_next;
+    }
+    be_ring_release(ring, BERG_OWNER_GONE);
+  }
+}
+
+
+
+/**
+ * Report messages dropped from a full ring, with be_wrlock held
+ *
+ * THREADS: REENTRANT
+ *
+ *	@param B BAKA thread/global state
+ *	@param beinfo The error state structure.
+ *	@param dropped Messages dropped since the last report
+ */
+static void be_error_dropped(bk_s B, struct bk_error *beinfo, u_int64_t dropped)
+{
+  static const char dropped_fmt[] = "%llu error messages dropped: ring full\n";
+  const char *level = bk_general_errorstr(B, BK_ERR_WARN);
+  char buf[sizeof(dropped_fmt) + 20];
+  int len = -8;					// -(total %. chars in fmt)
+  int origoffset = 0;
+  char *msg;
+
+  beinfo->be_dropped += dropped;
+
+  snprintf(buf, sizeof(buf), dropped_fmt, (unsigned long long)dropped);
+  len += strlen(__FUNCTION__) + strlen(buf) + strlen(level) + sizeof(FMT);
+  if (!(msg = malloc(len)))
+  {
+    /* <KLUDGE>cannot allocate storage for error message</KLUDGE> */
+    return;
+  }
+  snprintf(msg, len, FMT, __FUNCTION__, &origoffset, level, buf);
+
+  be_error_add(B, beinfo, BK_ERR_WARN, time(NULL), msg, origoffset, BE_FLAG_FLUSHER);
+}
+
+
+
+/**
+ * Flusher thread: drain the rings when woken, or every be_flushms
+ *
+ *	@param opaque The error state structure.
+ *	@return <i>NULL</i> always
+ */
+static void *be_flusher(void *opaque)
+{
+  struct bk_error *beinfo = opaque;
+  bk_s B = beinfo->be_flushB;
+  struct timespec deadline;
+
+  if (pthread_mutex_lock(&beinfo->be_wrlock) != 0)
+    abort();
+
+  while (!beinfo->be_flushstop)
+  {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += beinfo->be_flushms / 1000;
+    deadline.tv_nsec += (beinfo->be_flushms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+
+    while (!beinfo->be_flushstop && !__atomic_load_n(&beinfo->be_kicked, __ATOMIC_ACQUIRE) &&
+	   pthread_cond_timedwait(&beinfo->be_flushcond, &beinfo->be_wrlock, &deadline) != ETIMEDOUT)
+      ; // Spurious wakeup
+
+    __atomic_store_n(&beinfo->be_kicked, 0, __ATOMIC_RELEASE);
+    be_async_drain(B, beinfo);
+  }
+
+  if (pthread_mutex_unlock(&beinfo->be_wrlock) != 0)
+    abort();
+
+  return(NULL);
+}
+#endif /* BK_USING_PTHREADS */
@@ -27,67 +27,160 @@ static const char libbk__contact[] = "<projectbaka@baka.org>";
 
 
 
+#define FUN_SITES_INIT		256		///< Initial call site capacity
+
+
+
+/**
+ * A BK_ENTRY call site, interned by function and package name so that
+ * every call site of a function shares one statistics slot.  Each
+ * BK_ENTRY caches its site in a function-local static on first use.
+ * The site also caches the function's debug level, tagged with the
+ * bk_debug_generation it was looked up in, packed in one word so a
+ * single load tells whether it is still good.
+ */
+struct bk_funsite
+{
+  const char	       *bfsi_funname;		///< Function name
+  const char	       *bfsi_pkgname;		///< Package name
+  const char	       *bfsi_grpname;		///< Group name the debug level was looked up for
+  u_int			bfsi_id;		///< Index into statistics arrays
+  u_int64_t		bfsi_debug;		///< Generation << 32 | debug level
+};
+
+
+
 /**
- * @name Defines: funstack_clc
- * Stack of functions currently called CLC definitions
+ * One thread's statistics for one call site.  Only the owning thread
+ * writes them, with atomic stores so dumps can read them at any time.
+ */
+struct bk_funstat
+{
+  u_int64_t		bfst_count;		///< Calls
+  u_int64_t		bfst_sumns;		///< Total nanoseconds
+  u_int64_t		bfst_minns;		///< Fastest call
+  u_int64_t		bfst_maxns;		///< Slowest call
+};
+
+
+
+/**
+ * @name Defines: funsite_clc
+ * Call site interning CLC definitions
  * to hide CLC choice.
  */
 // @{
-#define funstack_create(o,k,f)		dll_create((o),(k),(f))
-#define funstack_destroy(h)		dll_destroy(h)
-#define funstack_insert(h,o)		dll_insert((h),(o))
-#define funstack_insert_uniq(h,n,o)	dll_insert_uniq((h),(n),(o))
-#define funstack_append(h,o)		dll_append((h),(o))
-#define funstack_append_uniq(h,n,o)	dll_append_uniq((h),(n),(o))
-#define funstack_search(h,k)		dll_search((h),(k))
-#define funstack_delete(h,o)		dll_delete((h),(o))
-#define funstack_minimum(h)		dll_minimum(h)
-#define funstack_maximum(h)		dll_maximum(h)
-#define funstack_successor(h,o)		dll_successor((h),(o))
-#define funstack_predecessor(h,o)	dll_predecessor((h),(o))
-#define funstack_iterate(h,d)		dll_iterate((h),(d))
-#define funstack_nextobj(h,i)		dll_nextobj(h,i)
-#define funstack_iterate_done(h,i)	dll_iterate_done(h,i)
-#define funstack_error_reason(h,i)	dll_error_reason((h),(i))
+#define funsite_create(o,k,f,a)		ht_create(o,k,f,a)
+#define funsite_destroy(h)		ht_destroy(h)
+#define funsite_insert(h,o)		ht_insert(h,o)
+#define funsite_insert_uniq(h,n,o)	ht_insert_uniq(h,n,o)
+#define funsite_append(h,o)		ht_append(h,o)
+#define funsite_append_uniq(h,n,o)	ht_append_uniq(h,n,o)
+#define funsite_search(h,k)		ht_search(h,k)
+#define funsite_delete(h,o)		ht_delete(h,o)
+#define funsite_minimum(h)		ht_minimum(h)
+#define funsite_maximum(h)		ht_maximum(h)
+#define funsite_successor(h,o)		ht_successor(h,o)
+#define funsite_predecessor(h,o)	ht_predecessor(h,o)
+#define funsite_iterate(h,d)		ht_iterate(h,d)
+#define funsite_nextobj(h,i)		ht_nextobj(h,i)
+#define funsite_iterate_done(h,i)	ht_iterate_done(h,i)
+#define funsite_error_reason(h,i)	ht_error_reason(h,i)
+
+static int funsite_oo_cmp(struct bk_funsite *a, struct bk_funsite *b);
+static int funsite_ko_cmp(struct bk_funsite *a, struct bk_funsite *b);
+static unsigned int funsite_obj_hash(struct bk_funsite *a);
+static unsigned int funsite_key_hash(struct bk_funsite *a);
+static struct ht_args funsite_args = { 1021, 2, (ht_func)funsite_obj_hash, (ht_func)funsite_key_hash };
 // @}
 
 
 
+/*
+ * Only a pointer lives in TLS, so the initial-exec model (a fixed offset
+ * from the thread pointer, no __tls_get_addr) is safe even if libbk is
+ * dlopen'd.  The stack itself is allocated on the thread's first entry.
+ */
+static __thread struct bk_funstack *fun_stack __attribute__ ((tls_model ("initial-exec"))); ///< This thread's function trace
+static struct bk_funinfo fun_overflow = { "(too deep)", "", "", 0, NULL, 0 }; ///< Stands for frames past capacity
+static struct bk_funstack fun_stack_gone;	///< fun_stack of a thread whose stack has been freed
+#ifdef BK_USING_PTHREADS
+static pthread_key_t fun_stack_key;		///< Frees fun_stack at thread exit
+static pthread_once_t fun_stack_once = PTHREAD_ONCE_INIT; ///< Creates fun_stack_key
+#endif /* BK_USING_PTHREADS */
+
+/*
+ * Function statistics.  Call sites and the threads accumulating for them
+ * are registered under fun_stats_lock; the per-call accounting is not.
+ */
+static dict_h fun_sites = NULL;			///< Interned call sites
+static struct bk_funsite **fun_site_list = NULL; ///< Call sites by id
+static u_int fun_nsites = 0;			///< Call sites interned
+static u_int fun_maxsites = 0;			///< Capacity of fun_site_list
+static struct bk_funstack *fun_stats_threads = NULL; ///< Threads with statistics
+static struct bk_funstat *fun_retired = NULL;	///< Statistics of exited threads
+static u_int fun_nretired = 0;			///< Call sites in fun_retired
+#ifdef BK_USING_PTHREADS
+static pthread_mutex_t fun_stats_lock = PTHREAD_MUTEX_INITIALIZER; ///< Lock on the above
+#endif /* BK_USING_PTHREADS */
+
+
+
+static struct bk_funstack *fun_stack_create(void);
+static struct bk_funsite *fun_site_intern(const char *func, const char *package, const char *grp);
+static u_int32_t fun_debug_level(bk_s B, struct bk_funinfo *fh);
+static void fun_stat_add(struct bk_funstack *fs, struct bk_funsite *site, u_int64_t ns);
+static int fun_stat_grow(struct bk_funstat **statsp, u_int *nstatsp, u_int want);
+static void fun_stat_merge(struct bk_funstat *sum, struct bk_funstat *stats, u_int nstats, u_int id);
+static inline u_int64_t fun_nsnow(void);
+#ifdef BK_USING_PTHREADS
+static void fun_stack_key_create(void);
+static void fun_stack_destroy(void *opaque);
+#endif /* BK_USING_PTHREADS */
+
+
 
 /**
- * Initialize the function stack
+ * Return the calling thread's function stack.  Frames are written before
+ * the depth is raised past them, so a signal handler interrupting this
+ * thread always sees complete frames below the depth.
  *
  * THREADS: MT-SAFE
  *
- *	@return <i>NULL</i> on allocation (or other CLC) failure
- *	@return <br><i>Function stack</i> on success
+ *	@return <i>NULL</i> if this thread has never traced a function
+ *	@return <br><i>function stack</i> of the calling thread
  */
-dict_h bk_fun_init(void)
+struct bk_funstack *bk_fun_stack(void)
 {
-  return(funstack_create(NULL, NULL, DICT_UNORDERED|DICT_THREAD_NOCOALESCE));
+  return(fun_stack == &fun_stack_gone?NULL:fun_stack);
 }
 
 
 
 /**
- * Destroy the function stack
+ * Entering a function--record infomation.  Function statistics are kept
+ * per function name rather than per call site (see BK_ENTRY).
  *
- * THREADS: MT-SAFE
+ * THREADS: MT-SAFE (assumes B is thread private)
  *
- *	@param funstack The stack of functions currently called
+ *	@param B BAKA Thread/global state
+ *	@param func The name of the function we are in
+ *	@param package The name of the package we are in (typically filename)
+ *	@param grp The name of the group we are in (typically library)
+ *	@return <i>NULL</i> if function tracing is not enabled
+ *	@return <br><i>encoded function info</i> on success
  */
-void bk_fun_destroy(dict_h funstack)
+struct bk_funinfo *bk_fun_entry(bk_s B, const char *func, const char *package, const char *grp)
 {
-  struct bk_funinfo *fh = NULL;
-
-  DICT_NUKE_CONTENTS(funstack, funstack, fh, break, free(fh));
-  funstack_destroy(funstack);
+  return(bk_fun_entry_i(B, func, package, grp, NULL));
 }
 
 
 
 /**
- * Entering a function--record infomation
+ * Entering a function from a BK_ENTRY call site--record information.
+ * The call site is looked up once and cached in *sitep, so neither
+ * function statistics nor debug levels cost any hashing per call.
  *
  * THREADS: MT-SAFE (assumes B is thread private)
  *
@@ -95,12 +188,14 @@ void bk_fun_destroy(dict_h funstack)
  *	@param func The name of the function we are in
  *	@param package The name of the package we are in (typically filename)
  *	@param grp The name of the group we are in (typically library)
- *	@return <i>NULL</i> if function tracing is not enabled, or on allocation failure
+ *	@param sitep Call site cache (a function-local static), or NULL
+ *	@return <i>NULL</i> if function tracing is not enabled
  *	@return <br><i>encoded function info</i> on success
  */
-struct bk_funinfo *bk_fun_entry(bk_s B, const char *func, const char *package, const char *grp)
+struct bk_funinfo *bk_fun_entry_i(bk_s B, const char *func, const char *package, const char *grp, struct bk_funsite **sitep)
 {
-  struct bk_funinfo *fh = NULL;
+  struct bk_funstack *fs = fun_stack;
+  struct bk_funinfo *fh;
 
   if (B && !BK_GENERAL_FLAG_ISFUNON(B))
   {
@@ -108,26 +203,41 @@ struct bk_funinfo *bk_fun_entry(bk_s B, const char *func, const char *package, c
     return(NULL);
   }
 
-  if (!BK_MALLOC(fh))
+  // Destructors running after ours must not allocate a stack nobody frees
+  if (fs == &fun_stack_gone)
+    return(&fun_overflow);
+
+  if (!fs && !(fs = fun_stack_create()))
   {
     if (B)
-      bk_error_printf(B, BK_ERR_ERR, "Could not allocate storage for function header: %s\n",strerror(errno));
+      bk_error_printf(B, BK_ERR_ERR, "Could not allocate function stack: %s\n",strerror(errno));
     return(NULL);
   }
 
+  if (fs->bfs_depth >= BK_FUN_MAXDEPTH)
+  {
+    fs->bfs_overflow++;
+    return(&fun_overflow);
+  }
+
+  fh = &fs->bfs_frames[fs->bfs_depth];
   fh->bf_funname = func;
   fh->bf_pkgname = package;
   fh->bf_grpname = grp;
   fh->bf_debuglevel = 0;
 
-  if (BK_BT_ISFUNSTATSON(B))
-  {
-    gettimeofday(&fh->bf_starttime, NULL);
-  }
+  fh->bf_site = sitep?__atomic_load_n(sitep, __ATOMIC_ACQUIRE):NULL;
+  if (!fh->bf_site && (BK_BT_ISFUNSTATSON(B) || (sitep && B && BK_GENERAL_FLAG_ISDEBUGON(B))) &&
+      (fh->bf_site = fun_site_intern(func, package, grp)) && sitep)
+    __atomic_store_n(sitep, fh->bf_site, __ATOMIC_RELEASE);
+
+  if (fh->bf_site && BK_BT_ISFUNSTATSON(B))
+    fh->bf_startns = fun_nsnow();
   else
-  {
-    fh->bf_starttime.tv_sec = 0;		// Stupid, yes, but funstats could be turned on at any moment...
-  }
+    fh->bf_startns = 0;				// Stupid, yes, but funstats could be turned on at any moment...
+
+  __atomic_signal_fence(__ATOMIC_RELEASE);
+  fs->bfs_depth++;
 
   bk_fun_reentry_i(B, fh);			/* OK, not re-entry, but code concentration... */
 
@@ -146,8 +256,20 @@ struct bk_funinfo *bk_fun_entry(bk_s B, const char *func, const char *package, c
  */
 void bk_fun_exit(bk_s B, struct bk_funinfo *fh)
 {
-  struct bk_funinfo *cur = NULL;
-  int save_errno = errno;
+  struct bk_funstack *fs = fun_stack;
+  struct bk_funinfo *top;
+  int save_errno;
+
+  // Common case: the innermost frame, no function stats
+  if (fh && fs && fs->bfs_depth && fh == &fs->bfs_frames[fs->bfs_depth - 1] && !fh->bf_startns && !fs->bfs_overflow)
+  {
+    fs->bfs_depth--;
+    if (B)
+      BK_BT_CURFUN(B) = fs->bfs_depth?fh - 1:NULL;
+    return;
+  }
+
+  save_errno = errno;
 
   if (!fh)
   {
@@ -155,42 +277,35 @@ void bk_fun_exit(bk_s B, struct bk_funinfo *fh)
     goto done;
   }
 
-  if (!B)
+  if (fh == &fun_overflow)
   {
-    free(fh);
+    if (fs->bfs_overflow)
+      fs->bfs_overflow--;
     goto done;
   }
 
-  if (fh->bf_starttime.tv_sec && BK_BT_ISFUNSTATSON(B))
+  if (!fs || fh < fs->bfs_frames || fh >= fs->bfs_frames + fs->bfs_depth)
   {
-    struct timeval end, sum;
-    u_quad_t thisus = 0;
-    gettimeofday(&end, NULL);
-    BK_TV_SUB(&sum, &end, &fh->bf_starttime);
-    thisus = BK_SECSTOUSEC((u_quad_t)sum.tv_sec) + sum.tv_usec;
-    bk_stat_add(B, BK_BT_FUNSTATS(B), "Function Tracing", fh->bf_funname, thisus, BK_STATS_NO_LOCKS_NEEDED);
+    // Already popped by an ancestor's exit, or from some other thread
+    bk_error_printf(B, BK_ERR_ERR,"Could not find function to exit: %s\n",fh->bf_funname);
+    goto done;
   }
 
+  if (fh->bf_startns)
+    fun_stat_add(fs, fh->bf_site, fun_nsnow() - fh->bf_startns);
 
-  for(cur = (struct bk_funinfo *)funstack_minimum(BK_BT_FUNSTACK(B)); cur && cur != fh; cur = (struct bk_funinfo *)funstack_successor(BK_BT_FUNSTACK(B), cur))
-    ; // Intentionally void
-
-  if (cur)
-  {
-    for(;cur;cur=fh)
-    {
-      if (fh = (struct bk_funinfo *)funstack_predecessor(BK_BT_FUNSTACK(B), cur))
-	bk_error_printf(B, BK_ERR_NOTICE,"Implicit exit of %s during %s exit\n",fh->bf_funname,cur->bf_funname);
-      funstack_delete(BK_BT_FUNSTACK(B), cur);
-      free(cur);
-    }
-    BK_BT_CURFUN(B) = (struct bk_funinfo *)funstack_minimum(BK_BT_FUNSTACK(B));
-  }
-  else
+  // Children which returned without telling us
+  fs->bfs_overflow = 0;
+  while ((top = &fs->bfs_frames[fs->bfs_depth - 1]) != fh)
   {
-    bk_error_printf(B, BK_ERR_ERR,"Could not find function to exit: %s\n",fh->bf_funname);
-    /* free(fh);  ---  Whether to leak memory or to double free... */
+    if (B)
+      bk_error_printf(B, BK_ERR_NOTICE,"Implicit exit of %s during %s exit\n",top->bf_funname,fh->bf_funname);
+    fs->bfs_depth--;
   }
+  fs->bfs_depth--;
+
+  if (B)
+    BK_BT_CURFUN(B) = fs->bfs_depth?&fs->bfs_frames[fs->bfs_depth - 1]:NULL;
 
  done:
   errno = save_errno;
@@ -200,8 +315,8 @@ void bk_fun_exit(bk_s B, struct bk_funinfo *fh)
 
 /**
  * This is an function for main to virtually re-enter BK_ENTRY after B
- * is initialized.  This is required since @a bk_fun_init() cannot be
- * called before @a bk_fun_entry is called.
+ * is initialized.  This is required since @a bk_fun_entry in main is
+ * called before B exists to look up debug levels.
  *
  * THREADS: MT-SAFE (assumes B is thread private)
  *
@@ -210,16 +325,13 @@ void bk_fun_exit(bk_s B, struct bk_funinfo *fh)
  */
 void bk_fun_reentry_i(bk_s B, struct bk_funinfo *fh)
 {
-  if (B && fh)
+  if (B && fh && fh != &fun_overflow)
   {
     if (BK_GENERAL_FLAG_ISDEBUGON(B))
-      fh->bf_debuglevel = bk_debug_query(B, BK_GENERAL_DEBUG(B), fh->bf_funname, fh->bf_pkgname, fh->bf_grpname, 0);
+      fh->bf_debuglevel = fun_debug_level(B, fh);
     else
       fh->bf_debuglevel = 0;
 
-    if (funstack_insert(BK_BT_FUNSTACK(B), fh) != DICT_OK)
-      bk_error_printf(B, BK_ERR_WARN, "Could not insert function stack frame: %s\n",funstack_error_reason(BK_BT_FUNSTACK(B), NULL));
-
     BK_BT_CURFUN(B) = fh;
   }
 }
@@ -238,13 +350,24 @@ void bk_fun_reentry_i(bk_s B, struct bk_funinfo *fh)
  */
 void bk_fun_trace(bk_s B, FILE *out, int sysloglevel, bk_flags flags)
 {
+  struct bk_funstack *fs = fun_stack;
   struct bk_funinfo *cur = NULL;
+  u_int depth;
 
-  if (!B || !BK_BT_FUNSTACK(B))
+  if (!B || !fs)
     return;
 
-  for(cur = (struct bk_funinfo *)funstack_maximum(BK_BT_FUNSTACK(B)); cur; cur = (struct bk_funinfo *)funstack_predecessor(BK_BT_FUNSTACK(B), cur))
+  if (fs->bfs_overflow)
   {
+    if (out)
+      fprintf(out,"Stack trace: (%u more frames)\n",fs->bfs_overflow);
+    if (sysloglevel > BK_ERR_NONE)
+      bk_general_syslog(B, sysloglevel, BK_SYSLOG_FLAG_NOFUN|BK_SYSLOG_FLAG_NOLEVEL, "Stack trace: (%u more frames)\n",fs->bfs_overflow);
+  }
+
+  for (depth = fs->bfs_depth; depth--; )
+  {
+    cur = &fs->bfs_frames[depth];
     if (out)
       fprintf(out,"Stack trace: %s %s %s\n",cur->bf_funname, cur->bf_pkgname, cur->bf_grpname);
     if (sysloglevel > BK_ERR_NONE)
@@ -303,18 +426,19 @@ void bk_fun_set(bk_s B, int state, bk_flags flags)
  */
 int bk_fun_reset_debug(bk_s B, bk_flags flags)
 {
+  struct bk_funstack *fs = fun_stack;
   struct bk_funinfo *cur = NULL;
 
   if (!B)
     return(-1);
 
-  if (!BK_GENERAL_FLAG_ISFUNON(B))
+  if (!BK_GENERAL_FLAG_ISFUNON(B) || !fs)
     return(0);					/* No function tracing */
 
-  for(cur = (struct bk_funinfo *)funstack_minimum(BK_BT_FUNSTACK(B)); cur; cur = (struct bk_funinfo *)funstack_successor(BK_BT_FUNSTACK(B), cur))
+  for (cur = fs->bfs_frames; cur < fs->bfs_frames + fs->bfs_depth; cur++)
   {
     if (BK_GENERAL_FLAG_ISDEBUGON(B))
-      cur->bf_debuglevel = bk_debug_query(B, BK_GENERAL_DEBUG(B), cur->bf_funname, cur->bf_pkgname, cur->bf_grpname, 0);
+      cur->bf_debuglevel = fun_debug_level(B, cur);
     else
       cur->bf_debuglevel = 0;
   }
@@ -337,16 +461,435 @@ int bk_fun_reset_debug(bk_s B, bk_flags flags)
  */
 const char *bk_fun_funname(bk_s B, int ancestordepth, bk_flags flags)
 {
-  struct bk_funinfo *cur = NULL;
+  struct bk_funstack *fs = fun_stack;
 
-  if (!BK_GENERAL_FLAG_ISFUNON(B))
+  if (!BK_GENERAL_FLAG_ISFUNON(B) || !fs)
     return(NULL);				/* No function tracing, no function name */
 
-  for(cur = (struct bk_funinfo *)funstack_minimum(BK_BT_FUNSTACK(B)); cur && ancestordepth--; cur = (struct bk_funinfo *)funstack_successor(BK_BT_FUNSTACK(B), cur))
-    ; // Intentionally Void
+  if (ancestordepth < 0)
+    return(NULL);
+
+  if ((u_int)ancestordepth < fs->bfs_overflow)
+    return(fun_overflow.bf_funname);		/* Too deep to have been recorded */
+  ancestordepth -= fs->bfs_overflow;
 
-  if (!cur)
+  if ((u_int)ancestordepth >= fs->bfs_depth)
     return(NULL);				/* Don't have that many ancestors! */
 
-  return(cur->bf_funname);
+  return(fs->bfs_frames[fs->bfs_depth - 1 - ancestordepth].bf_funname);
+}
+
+
+
+/**
+ * Write function statistics, merged across all threads (live and
+ * exited), one row per function.  Calls are timed in nanoseconds, but
+ * written in microseconds, in the layout of the per-thread bk_stat tables
+ * these statistics used to be kept in, so that b_stats.pl and friends can
+ * still read them.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA Thread/global state
+ *	@param out File handle to write to
+ *	@param flags BK_FUN_STATS_DUMP_HTML for an HTML table (default CSV)
+ *	@return <i>-1</i> on call failure or write failure
+ *	@return <br><i>0</i> on success
+ */
+int bk_fun_stats_dump(bk_s B, FILE *out, bk_flags flags)
+{
+  struct bk_funstack *fs;
+  struct bk_funsite *site;
+  struct bk_funstat sum;
+  u_int id;
+  int ret = 0;
+
+  if (!out)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    return(-1);
+  }
+
+  if (BK_FLAG_ISSET(flags, BK_FUN_STATS_DUMP_HTML))
+    fprintf(out, "<table summary=\"Performance Information\"><caption><em>Program Performance Statistics</em></caption><tr><th>Primary Name</th><th>Secondary Name</th><th>Minimum time (usec)</th><th>Average time (usec)</th><th>Maximum time (usec)</th><th>Count</th><th>Total time (sec)</th></tr>\n");
+
+#ifdef BK_USING_PTHREADS
+  if (pthread_mutex_lock(&fun_stats_lock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+
+  for (id = 0; id < fun_nsites; id++)
+  {
+    site = fun_site_list[id];
+    memset(&sum, 0, sizeof(sum));
+    fun_stat_merge(&sum, fun_retired, fun_nretired, id);
+    for (fs = fun_stats_threads; fs; fs = fs->bfs_next)
+      fun_stat_merge(&sum, fs->bfs_stats, fs->bfs_nstats, id);
+
+    if (!sum.bfst_count)
+      continue;
+
+    if (BK_FLAG_ISSET(flags, BK_FUN_STATS_DUMP_HTML))
+      ret = fprintf(out, "<tr><td>%s</td><td>%s</td><td align=\"right\">%llu</td><td align=\"right\">%.3f</td><td align=\"right\">%llu</td><td align=\"right\">%llu</td><td align=\"right\">%.6f</td></tr>\n", site->bfsi_funname, site->bfsi_pkgname, BUG_LLU_CAST(sum.bfst_minns / 1000), (double)sum.bfst_sumns/1000.0/sum.bfst_count, BUG_LLU_CAST(sum.bfst_maxns / 1000), BUG_LLU_CAST(sum.bfst_count), (double)sum.bfst_sumns/1000000000.0);
+    else
+      ret = fprintf(out, "\"%s\",\"%s\",\"%llu\",\"%.3f\",\"%llu\",\"%llu\",\"%.6f\"\n", site->bfsi_funname, site->bfsi_pkgname, BUG_LLU_CAST(sum.bfst_minns / 1000), (double)sum.bfst_sumns/1000.0/sum.bfst_count, BUG_LLU_CAST(sum.bfst_maxns / 1000), BUG_LLU_CAST(sum.bfst_count), (double)sum.bfst_sumns/1000000000.0);
+    if (ret < 0)
+      break;
+  }
+
+#ifdef BK_USING_PTHREADS
+  if (pthread_mutex_unlock(&fun_stats_lock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+
+  if (ret >= 0 && BK_FLAG_ISSET(flags, BK_FUN_STATS_DUMP_HTML))
+    ret = fprintf(out, "</table>\n");
+
+  if (ret < 0 || fflush(out) != 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not write function statistics: %s\n", strerror(errno));
+    return(-1);
+  }
+
+  return(0);
+}
+
+
+
+/**
+ * Find or create the call site for a function
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param func Function name
+ *	@param package Package name
+ *	@param grp Group name (not part of the key)
+ *	@return <i>NULL</i> on allocation failure
+ *	@return <br><i>call site</i> on success
+ */
+static struct bk_funsite *fun_site_intern(const char *func, const char *package, const char *grp)
+{
+  struct bk_funsite key, *site = NULL, **list;
+  u_int max;
+
+  key.bfsi_funname = func?func:"";
+  key.bfsi_pkgname = package?package:"";
+
+  // Nothing in here may use BK_ENTRY: it would come back here for the lock
+#ifdef BK_USING_PTHREADS
+  if (pthread_mutex_lock(&fun_stats_lock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+
+  if (!fun_sites && !(fun_sites = funsite_create((dict_function)funsite_oo_cmp, (dict_function)funsite_ko_cmp, DICT_HT_STRICT_HINTS|DICT_THREAD_NOCOALESCE, &funsite_args)))
+    goto done;
+
+  if ((site = funsite_search(fun_sites, (dict_key)&key)))
+    goto done;
+
+  if (fun_nsites == fun_maxsites)
+  {
+    max = fun_maxsites?fun_maxsites*2:FUN_SITES_INIT;
+    if (!(list = realloc(fun_site_list, max * sizeof(*list))))
+      goto done;
+    fun_site_list = list;
+    fun_maxsites = max;
+  }
+
+  if (!BK_MALLOC(site))
+    goto done;
+  *site = key;
+  site->bfsi_grpname = grp;
+  site->bfsi_id = fun_nsites;
+  site->bfsi_debug = 0;				// Generation 0 is never current
+
+  if (funsite_insert(fun_sites, site) != DICT_OK)
+  {
+    free(site);
+    site = NULL;
+    goto done;
+  }
+  fun_site_list[fun_nsites++] = site;
+
+ done:
+#ifdef BK_USING_PTHREADS
+  if (pthread_mutex_unlock(&fun_stats_lock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+
+  return(site);
+}
+
+
+
+/**
+ * Debug level of a function frame, from its call site's cache when that
+ * is still current.  bk_debug_generation is read before the lookup, so a
+ * level set during the lookup is at worst looked up again next time.
+ * Frames without a site, or entered with a different group than the one
+ * the site was interned with, are looked up every time.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA Thread/global state
+ *	@param fh The function frame
+ *	@return <i>debug level</i> for the frame's function/package/group
+ */
+static u_int32_t fun_debug_level(bk_s B, struct bk_funinfo *fh)
+{
+  struct bk_funsite *site = fh->bf_site;
+  u_int64_t cached;
+  u_int32_t gen, level;
+
+  if (!site || site->bfsi_grpname != fh->bf_grpname)
+    return(bk_debug_query(B, BK_GENERAL_DEBUG(B), fh->bf_funname, fh->bf_pkgname, fh->bf_grpname, 0));
+
+  gen = __atomic_load_n(&bk_debug_generation, __ATOMIC_ACQUIRE);
+  cached = __atomic_load_n(&site->bfsi_debug, __ATOMIC_RELAXED);
+  if ((u_int32_t)(cached >> 32) == gen)
+    return((u_int32_t)cached);
+
+  level = bk_debug_query(B, BK_GENERAL_DEBUG(B), fh->bf_funname, fh->bf_pkgname, fh->bf_grpname, 0);
+  __atomic_store_n(&site->bfsi_debug, (u_int64_t)gen << 32 | level, __ATOMIC_RELAXED);
+  return(level);
+}
+
+
+
+/**
+ * Account for one call in the calling thread's statistics
+ *
+ * THREADS: MT-SAFE (fs must be the calling thread's)
+ *
+ *	@param fs The calling thread's function stack
+ *	@param site The call site
+ *	@param ns Nanoseconds the call took
+ */
+static void fun_stat_add(struct bk_funstack *fs, struct bk_funsite *site, u_int64_t ns)
+{
+  struct bk_funstat *bfst;
+  int first;
+
+  if (site->bfsi_id >= fs->bfs_nstats)
+  {
+#ifdef BK_USING_PTHREADS
+    if (pthread_mutex_lock(&fun_stats_lock) != 0)
+      abort();
+#endif /* BK_USING_PTHREADS */
+
+    first = !fs->bfs_stats;
+    if (fun_stat_grow(&fs->bfs_stats, &fs->bfs_nstats, BK_MAX(fun_maxsites, site->bfsi_id + 1)) == 0 && first)
+    {
+      fs->bfs_next = fun_stats_threads;
+      fun_stats_threads = fs;
+    }
+
+#ifdef BK_USING_PTHREADS
+    if (pthread_mutex_unlock(&fun_stats_lock) != 0)
+      abort();
+#endif /* BK_USING_PTHREADS */
+
+    if (site->bfsi_id >= fs->bfs_nstats)
+      return;
+  }
+
+  bfst = &fs->bfs_stats[site->bfsi_id];
+  if (!bfst->bfst_count || ns < bfst->bfst_minns)
+    __atomic_store_n(&bfst->bfst_minns, ns, __ATOMIC_RELAXED);
+  if (ns > bfst->bfst_maxns)
+    __atomic_store_n(&bfst->bfst_maxns, ns, __ATOMIC_RELAXED);
+  __atomic_store_n(&bfst->bfst_sumns, bfst->bfst_sumns + ns, __ATOMIC_RELAXED);
+  __atomic_store_n(&bfst->bfst_count, bfst->bfst_count + 1, __ATOMIC_RELAXED);
+}
+
+
+
+/**
+ * Grow a statistics array, zeroing the new slots
+ *
+ * THREADS: REENTRANT (fun_stats_lock must be held)
+ *
+ *	@param statsp Statistics array
+ *	@param nstatsp Call sites in the array
+ *	@param want Call sites wanted
+ *	@return <i>-1</i> on allocation failure
+ *	@return <br><i>0</i> on success
+ */
+static int fun_stat_grow(struct bk_funstat **statsp, u_int *nstatsp, u_int want)
+{
+  struct bk_funstat *stats;
+
+  if (want <= *nstatsp)
+    return(0);
+
+  if (!(stats = realloc(*statsp, want * sizeof(*stats))))
+    return(-1);
+  memset(stats + *nstatsp, 0, (want - *nstatsp) * sizeof(*stats));
+  *statsp = stats;
+  *nstatsp = want;
+  return(0);
+}
+
+
+
+/**
+ * Merge one call site's statistics from an array into a sum
+ *
+ * THREADS: REENTRANT (fun_stats_lock must be held)
+ *
+ *	@param sum Merged statistics
+ *	@param stats Statistics array
+ *	@param nstats Call sites in the array
+ *	@param id Call site
+ */
+static void fun_stat_merge(struct bk_funstat *sum, struct bk_funstat *stats, u_int nstats, u_int id)
+{
+  struct bk_funstat cur;
+
+  if (id >= nstats)
+    return;
+
+  if (!(cur.bfst_count = __atomic_load_n(&stats[id].bfst_count, __ATOMIC_RELAXED)))
+    return;
+  cur.bfst_sumns = __atomic_load_n(&stats[id].bfst_sumns, __ATOMIC_RELAXED);
+  cur.bfst_minns = __atomic_load_n(&stats[id].bfst_minns, __ATOMIC_RELAXED);
+  cur.bfst_maxns = __atomic_load_n(&stats[id].bfst_maxns, __ATOMIC_RELAXED);
+
+  if (!sum->bfst_count || cur.bfst_minns < sum->bfst_minns)
+    sum->bfst_minns = cur.bfst_minns;
+  if (cur.bfst_maxns > sum->bfst_maxns)
+    sum->bfst_maxns = cur.bfst_maxns;
+  sum->bfst_sumns += cur.bfst_sumns;
+  sum->bfst_count += cur.bfst_count;
+}
+
+
+
+/**
+ * Monotonic time in nanoseconds, for function statistics
+ *
+ *	@return <i>nanoseconds</i> since some arbitrary point
+ */
+static inline u_int64_t fun_nsnow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+
+
+/**
+ * Allocate the calling thread's function stack
+ *
+ *	@return <i>NULL</i> on allocation failure
+ *	@return <br><i>function stack</i> on success
+ */
+static struct bk_funstack *fun_stack_create(void)
+{
+  struct bk_funstack *fs;
+
+  if (!BK_CALLOC(fs))
+    return(NULL);
+
+#ifdef BK_USING_PTHREADS
+  if (pthread_once(&fun_stack_once, fun_stack_key_create) != 0 ||
+      pthread_setspecific(fun_stack_key, fs) != 0)
+  {
+    free(fs);
+    return(NULL);
+  }
+#endif /* BK_USING_PTHREADS */
+
+  fun_stack = fs;
+  return(fs);
+}
+
+
+
+#ifdef BK_USING_PTHREADS
+/**
+ * Create the key whose destructor frees function stacks
+ */
+static void fun_stack_key_create(void)
+{
+  if (pthread_key_create(&fun_stack_key, fun_stack_destroy) != 0)
+    abort();
+}
+
+
+
+/**
+ * A thread is exiting: keep its function statistics and free its
+ * function stack.  Destructors which run after this one find the empty
+ * fun_stack_gone, and their functions are not traced.
+ *
+ *	@param opaque The thread's function stack
+ */
+static void fun_stack_destroy(void *opaque)
+{
+  struct bk_funstack *fs = opaque, **prev;
+  u_int id;
+
+  fun_stack = &fun_stack_gone;
+
+  if (fs->bfs_stats)
+  {
+    if (pthread_mutex_lock(&fun_stats_lock) != 0)
+      abort();
+
+    for (prev = &fun_stats_threads; *prev; prev = &(*prev)->bfs_next)
+    {
+      if (*prev == fs)
+      {
+	*prev = fs->bfs_next;
+	break;
+      }
+    }
+
+    if (fun_stat_grow(&fun_retired, &fun_nretired, fs->bfs_nstats) == 0)
+    {
+      for (id = 0; id < fs->bfs_nstats; id++)
+	fun_stat_merge(&fun_retired[id], fs->bfs_stats, fs->bfs_nstats, id);
+    }
+
+    if (pthread_mutex_unlock(&fun_stats_lock) != 0)
+      abort();
+
+    free(fs->bfs_stats);
+  }
+
+  free(fs);
+}
+#endif /* BK_USING_PTHREADS */
+
+
+
+/** CLC helper functions and structures for funsite_clc */
+static int funsite_oo_cmp(struct bk_funsite *a, struct bk_funsite *b)
+{
+  return(funsite_ko_cmp(a, b));
+}
+
+/** CLC helper functions and structures for funsite_clc */
+static int funsite_ko_cmp(struct bk_funsite *a, struct bk_funsite *b)
+{
+  int ret;
+
+  if ((ret = strcmp(a->bfsi_funname, b->bfsi_funname)))
+    return(ret);
+  return(strcmp(a->bfsi_pkgname, b->bfsi_pkgname));
+}
+
+/** CLC helper functions and structures for funsite_clc */
+static unsigned int funsite_obj_hash(struct bk_funsite *a)
+{
+  return(bk_strhash(a->bfsi_funname, 0) ^ bk_strhash(a->bfsi_pkgname, 0));
+}
+
+/** CLC helper functions and structures for funsite_clc */
+static unsigned int funsite_key_hash(struct bk_funsite *a)
+{
+  return(funsite_obj_hash(a));
 }
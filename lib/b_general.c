@@ -203,6 +203,20 @@ void bk_general_destroy(bk_s B)
 	bk_debug_destroy(B, BK_GENERAL_DEBUG(B));
     }
 
+    if (bg && BK_BT_ISFUNSTATSON(B))
+    {
+      char buf[PATH_MAX+1];
+      FILE *FH;
+
+      // Statistics of every thread, merged
+      snprintf(buf, PATH_MAX, BK_GENERAL_FUNSTATFILE(B), getpid(), 0);
+      if ((FH = fopen(buf,"w")))
+      {
+	bk_fun_stats_dump(B, FH, BK_FUN_STATS_DUMP_HTML);
+	fclose(FH);
+      }
+    }
+
     bk_general_thread_destroy(B);
 
     if (bg)
@@ -343,9 +357,6 @@ bk_s bk_general_thread_init(bk_s B, const char *name)
   }
   BK_ZERO(B1);
 
-  if (!(BK_BT_FUNSTACK(B1) = bk_fun_init()))
-    goto error;
-
 #ifdef BK_USING_PTHREADS
   if (B && pthread_mutex_lock(&BK_GENERAL_WRMUTEX(B)) != 0)
     abort();
@@ -355,15 +366,6 @@ bk_s bk_general_thread_init(bk_s B, const char *name)
   if (B)
     BK_FLAG_SET(BK_GENERAL_FLAGS(B), BK_BGFLAGS_THREADON);
 
-  if (BK_GENERAL_FUNSTATFILE(B))
-  {
-    if (!(BK_BT_FUNSTATS(B1) = bk_stat_create(B1, BK_STATS_NO_LOCKS_NEEDED)))
-    {
-      bk_error_printf(B, BK_ERR_ERR, "Could not create stats structure\n");
-      goto error;
-    }
-  }
-
 #ifdef BK_USING_PTHREADS
   if (B && pthread_mutex_unlock(&BK_GENERAL_WRMUTEX(B)) != 0)
     abort();
@@ -395,55 +397,6 @@ void bk_general_thread_destroy(bk_s B)
 {
   if (B)
   {
-    if (BK_BT_ISFUNSTATSON(B))
-    {
-      char buf[PATH_MAX+1];
-      FILE *FH;
-
-      /*
-       * <TODO>When we port this to another system where pthread_t is a
-       * structure that cannot be cast to (pid_t) - I know of no such system,
-       * not even Windows, which we will probably never support - this code
-       * will fail to compile, and we will need to come up with a better
-       * solution.  Nonetheless, getpid() alone is not sufficient on *BSD,
-       * which we already support, nor on MacOS X, which we will support
-       * someday soon, and even if pthread_t is actually a pointer, it can
-       * still be cast to a number that will be unique within the process,
-       * which is all we need.  So even though this may not be theologically
-       * pure, it is still the best solution right now.</TODO>
-       */
-#ifdef BK_USING_PTHREADS
-      // <TODO>should perform some validation of printf format string</TODO>
-      snprintf(buf, PATH_MAX, BK_GENERAL_FUNSTATFILE(B),
-	       getpid(), (pid_t) pthread_self());
-#else /* BK_USING_PTHREADS */
-      snprintf(buf, PATH_MAX, BK_GENERAL_FUNSTATFILE(B), getpid(), 0);
-#endif /* BK_USING_PTHREADS */
-
-      if (FH = fopen(buf,"w"))
-      {
-	char *data = bk_stat_dump(B, BK_BT_FUNSTATS(B), BK_STAT_DUMP_HTML);
-	if (data)
-	{
-	  if (fwrite(data, strlen(data), 1, FH) < 1)
-	  {
-	    // We probably don't care, and might not even be able to safely write an error using B.
-	  }
-	  free(data);
-	}
-	fclose(FH);
-      }
-    }
-
-    if (BK_BT_FUNSTATS(B))
-    {
-      bk_stat_destroy(B, BK_BT_FUNSTATS(B));
-      BK_BT_FUNSTATS(B) = NULL;
-    }
-
-
-    if (BK_BT_FUNSTACK(B))
-      bk_fun_destroy(BK_BT_FUNSTACK(B));
     if (BK_BT_THREADNAME(B))
       free((char *)BK_BT_THREADNAME(B));
 
@@ -670,15 +623,10 @@ int bk_general_funstat_init(bk_s B, char *filename, bk_flags flags)
     free(BK_GENERAL_FUNSTATFILE(B));
   BK_GENERAL_FUNSTATFILE(B) = NULL;
 
-  if (filename)
+  if (filename && !(BK_GENERAL_FUNSTATFILE(B) = strdup(filename)))
   {
-    if (!(BK_BT_FUNSTATS(B) = bk_stat_create(B, BK_STATS_NO_LOCKS_NEEDED)))
-    {
-      bk_error_printf(B, BK_ERR_ERR, "Could not create stats structure\n");
-      goto error;
-    }
-
-    BK_GENERAL_FUNSTATFILE(B) = strdup(filename);
+    bk_error_printf(B, BK_ERR_ERR, "Could not copy function statistics filename: %s\n", strerror(errno));
+    goto error;
   }
 
 #ifdef BK_USING_PTHREADS
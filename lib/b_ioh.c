@@ -186,6 +186,13 @@ struct bk_ioh_data
 // @}
 
 
+
+static struct bk_pool *bid_pool = NULL;		///< Data management structure pool
+#define BID_POOL(B) BK_POOL_STATIC((B), bid_pool, "ioh_data", sizeof(struct bk_ioh_data))
+static struct bk_pool *idc_pool = NULL;		///< Command information pool
+#define IDC_POOL(B) BK_POOL_STATIC((B), idc_pool, "ioh_data_cmd", sizeof(struct ioh_data_cmd))
+
+
 static int ioh_dequeue_byte(bk_s B, struct bk_ioh *ioh, struct bk_ioh_queue *iohq, u_int32_t bytes, bk_flags flags);
 static int ioh_dequeue(bk_s B, struct bk_ioh *ioh, struct bk_ioh_queue *iohq, struct bk_ioh_data *bid, bk_flags flags);
 #define IOH_DEQUEUE_ABORT		0x01	///< Tell user data is aborted
@@ -1990,7 +1997,7 @@ static int ioh_dequeue(bk_s B, struct bk_ioh *ioh, struct bk_ioh_queue *iohq, st
     if (bid->bid_data)
       free(bid->bid_data);
   }
-  free(bid);
+  bk_pool_free(B, bid_pool, bid);
 
   BK_RETURN(B, 0);
 }
@@ -2044,7 +2051,7 @@ static int ioh_queue(bk_s B, struct bk_ioh_queue *iohq, char *data, u_int32_t al
     }
   }
 
-  if (!BK_CALLOC(bid))
+  if (!(bid = bk_pool_alloc(B, BID_POOL(B), BK_POOL_ZERO)))
   {
     bk_error_printf(B, BK_ERR_ERR, "Could not allocate data management structure: %s\n", strerror(errno));
     BK_RETURN(B,-1);
@@ -2076,7 +2083,7 @@ static int ioh_queue(bk_s B, struct bk_ioh_queue *iohq, char *data, u_int32_t al
   if (bid)
   {
     biq_delete(iohq->biq_queue, bid);
-    free(bid);
+    bk_pool_free(B, bid_pool, bid);
   }
   BK_RETURN(B, -1);
 }
@@ -4226,7 +4233,7 @@ idc_create(bk_s B)
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
   struct ioh_data_cmd *idc;
 
-  if (!(BK_CALLOC(idc)))
+  if (!(idc = bk_pool_alloc(B, IDC_POOL(B), BK_POOL_ZERO)))
   {
     bk_error_printf(B, BK_ERR_ERR, "could not allocate idc: %s\n", strerror(errno));
     BK_RETURN(B,NULL);
@@ -4258,7 +4265,7 @@ idc_destroy(bk_s B, struct ioh_data_cmd *idc)
     BK_VRETURN(B);
   }
 
-  free(idc);
+  bk_pool_free(B, idc_pool, idc);
   BK_VRETURN(B);
 }
 
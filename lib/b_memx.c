@@ -19,6 +19,13 @@ static const char libbk__contact[] = "<projectbaka@baka.org>";
  * @file
  * Extendible buffer management routines (dynamicly sized arrays).
  *
+ * Growth is by the increment hint, or with BK_MEMX_GEOMETRIC by at least
+ * half again the current allocation, which keeps long runs of appends
+ * amortized O(1).  Large arrays are grown with realloc, which on systems
+ * whose malloc maps big blocks separately (glibc) remaps rather than
+ * copies them.  Lopping from the front just advances a head offset; the
+ * space is reclaimed when the array next needs to grow.
+ *
  * Alex sez: we need an accessor function for bm_curused(definitely) and bm_unitsize(maybe).
  *
  * Seth sez: we already have one (for curused at least).  See bk_memx_get.
@@ -36,8 +43,9 @@ struct bk_memx
 {
   void		*bm_array;			///< Extensible memory
   size_t	bm_unitsize;			///< Size of units
-  size_t	bm_curalloc;			///< Allocated memory
+  size_t	bm_curalloc;			///< Allocated memory (units, including lopped head)
   size_t	bm_curused;			///< Current used
+  size_t	bm_head;			///< Units lopped off the front but not yet reclaimed
   u_int		bm_incr;			///< Increment amount
   bk_flags	bm_flags;			///< Fun for the future
 };
@@ -45,6 +53,12 @@ struct bk_memx
 
 const size_t bk_memx_size = sizeof(struct bk_memx);
 
+
+
+static int memx_grow(bk_s B, struct bk_memx *bm, size_t count);
+
+
+
 /**
  * Create the extensible buffer management state along with an initial allocation
  *
@@ -53,8 +67,8 @@ const size_t bk_memx_size = sizeof(struct bk_memx);
  *	@param B BAKA Thread/global state
  *	@param objsize Object size in bytes/octets
  *	@param start_hint Number of objects to start out with
- *	@param incr_hint Number of objects to grow when more are needed
- *	@param flags Fun for the future
+ *	@param incr_hint Number of objects to grow when more are needed (minimum, with BK_MEMX_GEOMETRIC)
+ *	@param flags BK_MEMX_GEOMETRIC to grow by half the current size at a time
  *	@return <i>NULL</i> on call failure, allocation failure
  *	@return <br><i>Buffer handle</i> on success
  */
@@ -79,6 +93,7 @@ struct bk_memx *bk_memx_create(bk_s B, size_t unitsize, u_int start_hint, u_int
   }
   ret->bm_unitsize = unitsize;
   ret->bm_curused = 0;
+  ret->bm_head = 0;
   ret->bm_incr = incr_hint;
   ret->bm_flags = flags;
 
@@ -108,7 +123,9 @@ struct bk_memx *bk_memx_create(bk_s B, size_t unitsize, u_int start_hint, u_int
  *	@param bm Buffer management handle
  *	@param flags BK_MEMX_PRESERVE_ARRAY if the allocated memory
  *		must live on (will be free'd later) but the dynamic buffer
- *		management side should still go away
+ *		management side should still go away.  Anything lopped
+ *		off is slid back first, so the array to free is the start
+ *		of the allocation (where element 0 was before any lop).
  */
 void bk_memx_destroy(bk_s B, struct bk_memx *bm, bk_flags flags)
 {
@@ -122,6 +139,8 @@ void bk_memx_destroy(bk_s B, struct bk_memx *bm, bk_flags flags)
 
   if (bm->bm_array && BK_FLAG_ISCLEAR(flags, BK_MEMX_PRESERVE_ARRAY))
     free(bm->bm_array);
+  else if (bm->bm_array && bm->bm_head)
+    memmove(bm->bm_array, (char *)bm->bm_array + bm->bm_head * bm->bm_unitsize, bm->bm_curused * bm->bm_unitsize);
   free(bm);
 
   BK_VRETURN(B);
@@ -149,7 +168,6 @@ void *bk_memx_get(bk_s B, struct bk_memx *bm, u_int count, u_int *curused, bk_fl
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
   void *ret = NULL;
-  void *tmp;
 
   if (curused && bm) *curused = bm->bm_curused;
 
@@ -162,29 +180,20 @@ void *bk_memx_get(bk_s B, struct bk_memx *bm, u_int count, u_int *curused, bk_fl
 
   if (BK_FLAG_ISSET(flags, BK_MEMX_GETNEW))
   {						/* Want "new" allocation */
-    if (bm->bm_curused + count > bm->bm_curalloc)
-    {						/* Need to extend array */
-      // XXX - add code to allocate in integral bm_incr size chunks?
-      u_int incr = MAX(bm->bm_incr, count - (bm->bm_curalloc - bm->bm_curused));
-
-      if (!(tmp = realloc(bm->bm_array, (bm->bm_curalloc + incr) * bm->bm_unitsize)))
-      {
-	bk_error_printf(B, BK_ERR_ERR, "Could not extend array: %s\n",strerror(errno));
-	// don't destroy our bm -- data still valid
-	BK_RETURN(B, NULL);
-      }
-      bm->bm_curalloc += incr;
-      bm->bm_array = tmp;
+    if (memx_grow(B, bm, count) < 0)
+    {
+      // don't destroy our bm -- data still valid
+      BK_RETURN(B, NULL);
     }
 
-    ret = ((char *)bm->bm_array) + bm->bm_curused * bm->bm_unitsize;
+    ret = ((char *)bm->bm_array) + (bm->bm_head + bm->bm_curused) * bm->bm_unitsize;
     bm->bm_curused += count;
 
     if (curused) *curused = bm->bm_curused;
   }
   else
   {						/* Want existing record */
-    ret = ((char *)bm->bm_array) + count * bm->bm_unitsize;
+    ret = ((char *)bm->bm_array) + (bm->bm_head + count) * bm->bm_unitsize;
   }
 
   BK_RETURN(B,ret);
@@ -192,6 +201,38 @@ void *bk_memx_get(bk_s B, struct bk_memx *bm, u_int count, u_int *curused, bk_fl
 
 
 
+/**
+ * Make sure count more elements can be obtained without reallocating, so
+ * that a caller who knows (or can guess) how much is coming pays for one
+ * allocation instead of many.
+ *
+ * THREADS: MT-SAFE (as long as bm is thread-private)
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bm Buffer management handle
+ *	@param count Number of elements beyond those currently used
+ *	@param flags Fun for the future
+ *	@return <i>-1</i> on call failure, allocation failure
+ *	@return <br><i>0</i> on success
+ */
+int bk_memx_reserve(bk_s B, struct bk_memx *bm, u_int count, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!bm)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (memx_grow(B, bm, count) < 0)
+    BK_RETURN(B, -1);
+
+  BK_RETURN(B, 0);
+}
+
+
+
 /**
  * Reset memory extender used count (truncate).
  *
@@ -224,7 +265,9 @@ int bk_memx_trunc(bk_s B, struct bk_memx *bm, u_int count, bk_flags flags)
 
 
 /**
- * Lop off the front of a memx and slide the contents down. This is expensive.
+ * Lop off the front of a memx.  Nothing is moved: the front simply
+ * advances, and the space is reclaimed the next time the array must grow.
+ * Pointers to remaining elements stay valid until then.
  *
  * THREADS: MT-SAFE (as long as bm is thread-private)
  *
@@ -240,15 +283,17 @@ bk_memx_lop(bk_s B, struct bk_memx *bm, u_int count, bk_flags flags)
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
 
-  if (!bm)
+  if (!bm || count > bm->bm_curused)
   {
     bk_error_printf(B, BK_ERR_ERR,"Illegal arguments\n");
     BK_RETURN(B, -1);
   }
 
-  // if lopping off less than half the current used bytes, overlap will occur
-  memmove(bm->bm_array, (char *)bm->bm_array + count * bm->bm_unitsize, (bm->bm_curused - count) * bm->bm_unitsize);
   bm->bm_curused -= count;
+  if (bm->bm_curused)
+    bm->bm_head += count;
+  else
+    bm->bm_head = 0;				// Empty: start over for free
 
   BK_RETURN(B,0);
 }
@@ -375,12 +420,66 @@ bk_memx_info(bk_s B, struct bk_memx *bm, void **arrayp, size_t *unitesizep, size
     BK_RETURN(B, -1);
   }
 
-  if (arrayp) *arrayp = bm->bm_array;
+  if (arrayp) *arrayp = (char *)bm->bm_array + bm->bm_head * bm->bm_unitsize;
   if (unitesizep) *unitesizep = bm->bm_unitsize;
-  if (curallocp) *curallocp = bm->bm_curalloc;
+  if (curallocp) *curallocp = bm->bm_curalloc - bm->bm_head;
   if (curusedp) *curusedp = bm->bm_curused;
   if (incrp) *incrp = bm->bm_incr;
   if (flagsp) *flagsp = bm->bm_flags;
 
   BK_RETURN(B, 0);
 }
+
+
+
+/**
+ * Make room for count more elements past those in use.  Space lopped off
+ * the front is reclaimed first; otherwise grow by the increment hint (or
+ * by half again, for BK_MEMX_GEOMETRIC), but never by less than needed.
+ *
+ *	@param B BAKA thread/global state.
+ *	@param bm Buffer management handle
+ *	@param count Number of additional elements needed
+ *	@return <i>-1</i> on allocation failure (array unchanged).<br>
+ *	@return <i>0</i> on success.
+ */
+static int memx_grow(bk_s B, struct bk_memx *bm, size_t count)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  size_t incr, newalloc;
+  void *tmp;
+
+  if (bm->bm_head + bm->bm_curused + count <= bm->bm_curalloc)
+    BK_RETURN(B, 0);
+
+  if (bm->bm_head)
+  {
+    // Slide down what is left; realloc would copy it all anyway
+    memmove(bm->bm_array, (char *)bm->bm_array + bm->bm_head * bm->bm_unitsize, bm->bm_curused * bm->bm_unitsize);
+    bm->bm_head = 0;
+
+    if (bm->bm_curused + count <= bm->bm_curalloc)
+      BK_RETURN(B, 0);
+  }
+
+  incr = MAX(bm->bm_incr, bm->bm_curused + count - bm->bm_curalloc);
+  if (BK_FLAG_ISSET(bm->bm_flags, BK_MEMX_GEOMETRIC))
+    incr = MAX(incr, bm->bm_curalloc / 2);
+
+  newalloc = bm->bm_curalloc + incr;
+  if (newalloc < bm->bm_curalloc || newalloc > ((size_t)-1) / bm->bm_unitsize)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not extend array: %zu elements is too many\n", newalloc);
+    BK_RETURN(B, -1);
+  }
+
+  if (!(tmp = realloc(bm->bm_array, newalloc * bm->bm_unitsize)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not extend array: %s\n",strerror(errno));
+    BK_RETURN(B, -1);
+  }
+  bm->bm_curalloc = newalloc;
+  bm->bm_array = tmp;
+
+  BK_RETURN(B, 0);
+}
@@ -32,6 +32,7 @@ static int bni2sin(bk_s B, struct bk_netinfo *bni, struct bk_netaddr *bna, struc
 static int bni2sin6(bk_s B, struct bk_netinfo *bni, struct bk_netaddr *bna, struct sockaddr_in6 *sin6, bk_flags flags);
 #endif
 
+static void netinfo_arena_cleanup(bk_s B, void *opaque);
 static int bna_oo_cmp(void *bck1, void *bck2);
 static int bna_ko_cmp(void *a, void *bck2);
 
@@ -487,6 +488,67 @@ bk_netinfo_clone(bk_s B, struct bk_netinfo *obni)
 
 
 
+/**
+ * Clone a @a netinfo structure whose lifetime is bound to an arena: it is
+ * destroyed when the arena is released or reset past this point.  A
+ * netinfo owns lists and sub-objects of its own, so the clone itself is
+ * still malloc'ed; the arena just remembers to clean it up.  Do not call
+ * @a bk_netinfo_destroy on the result.
+ *
+ * THREADS: MT-SAFE (assuming different obni and thread-private arena)
+ * THREADS: REENTRANT (otherwise)
+ *
+ *	@param B BAKA thread/global state.
+ *	@param arena The arena which owns the clone.
+ *	@param obni The source @a netinfo.
+ *	@return <i>NULL</i> on failure.<br>
+ *	@return a @a new bk_netinfo on success.
+ */
+struct bk_netinfo *
+bk_netinfo_clone_arena(bk_s B, struct bk_arena *arena, struct bk_netinfo *obni)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_netinfo *nbni;
+
+  if (!arena || !obni)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, NULL);
+  }
+
+  if (!(nbni = bk_netinfo_clone(B, obni)))
+    BK_RETURN(B, NULL);
+
+  if (bk_arena_cleanup(B, arena, netinfo_arena_cleanup, nbni, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not bind netinfo to arena\n");
+    bk_netinfo_destroy(B, nbni);
+    BK_RETURN(B, NULL);
+  }
+
+  BK_RETURN(B, nbni);
+}
+
+
+
+/**
+ * Arena cleanup for @a bk_netinfo_clone_arena
+ *
+ *	@param B BAKA thread/global state.
+ *	@param opaque The @a netinfo to destroy.
+ */
+static void
+netinfo_arena_cleanup(bk_s B, void *opaque)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  bk_netinfo_destroy(B, opaque);
+
+  BK_VRETURN(B);
+}
+
+
+
 /**
  * Update the servinfo part of netinfo based on a servent.
  *
@@ -109,6 +109,11 @@ struct bk_polling_io
 
 
 
+static struct bk_pool *pid_pool = NULL;		///< Polling io data pool
+#define PID_POOL(B) BK_POOL_STATIC((B), pid_pool, "polling_io_data", sizeof(struct polling_io_data))
+
+
+
 static struct polling_io_data *pid_create(bk_s B);
 static void pid_destroy(bk_s B, struct polling_io_data *pid);
 static void polling_io_ioh_handler(bk_s B, bk_vptr *data, void *args, struct bk_ioh *ioh, bk_ioh_status_e status);
@@ -1127,7 +1132,7 @@ pid_create(bk_s B)
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
   struct polling_io_data *pid;
 
-  if (!(BK_CALLOC(pid)))
+  if (!(pid = bk_pool_alloc(B, PID_POOL(B), BK_POOL_ZERO)))
   {
     bk_error_printf(B, BK_ERR_ERR, "Could not allocate pid: %s\n", strerror(errno));
     BK_RETURN(B,NULL);
@@ -1156,7 +1161,7 @@ pid_destroy(bk_s B, struct polling_io_data *pid)
   }
 
   if (pid->pid_data) bk_polling_io_data_destroy(B, pid->pid_data);
-  free(pid);
+  bk_pool_free(B, pid_pool, pid);
   BK_VRETURN(B);
 }
 
@@ -0,0 +1,693 @@
+#if !defined(lint)
+static const char libbk__copyright[] = "Copyright © 2011";
+static const char libbk__contact[] = "<projectbaka@baka.org>";
+#endif /* not lint */
+/*
+ * ++Copyright BAKA++
+ *
+ * Copyright © 2011 The Authors. All rights reserved.
+ *
+ * This source code is licensed to you under the terms of the file
+ * LICENSE.TXT in this release for further details.
+ *
+ * Send e-mail to <projectbaka@baka.org> for further information.
+ *
+ * - -Copyright BAKA- -
+ */
+
+/**
+ * @file
+ *
+ * Fixed-size object pools for structures which are allocated and freed
+ * at high rates.
+ *
+ * Each thread keeps a private free list per pool, so the common alloc
+ * and free are a few pointer operations with no locking.  When a
+ * thread's list runs dry it takes a batch from the pool's shared depot;
+ * when it grows past two batches it gives one back.  Only when the depot
+ * is empty (or full) does the pool go to malloc (or free).  A thread's
+ * list is returned to the depot when the thread exits.
+ *
+ * Since the function tracing and error reporting code allocate from
+ * pools, everything here except the statistics registration runs without
+ * BK_ENTRY and without reporting errors: callers get NULL and errno.
+ */
+
+#include <libbk.h>
+#include "libbk_internal.h"
+
+
+
+#define POOL_DEFBATCH		32		///< Default objects moved to/from the depot at once
+#define POOL_DEPOTBATCHES	16		///< Batches the depot holds before freeing
+#define POOL_STATFLUSH		256		///< Local hits counted before adding to the pool total
+#define POOL_STATNAMELEN	128		///< Room for a statistic name
+
+
+
+/**
+ * A free object.  The link overlays the start of the user's object.
+ */
+struct pool_obj
+{
+  struct pool_obj      *po_next;		///< Next free object
+};
+
+
+
+/**
+ * One thread's free list for one pool
+ */
+struct pool_cache
+{
+  struct pool_cache    *pc_next;		///< Next cache of this pool
+  struct bk_pool       *pc_pool;		///< Pool we belong to
+  struct pool_obj      *pc_free;		///< Free objects
+  u_int			pc_count;		///< Number of free objects
+  u_int			pc_hits;		///< Hits not yet added to the pool
+};
+
+
+
+/**
+ * An object pool
+ */
+struct bk_pool
+{
+  char		       *bp_name;		///< Name, for statistics
+  size_t		bp_objsize;		///< Size of each object
+  u_int			bp_batch;		///< Objects moved to/from the depot at once
+  u_int			bp_depotmax;		///< Most objects kept in the depot
+  bk_flags		bp_flags;		///< Everyone needs flags
+  struct pool_obj      *bp_depot;		///< Shared free objects
+  u_int64_t		bp_depotcnt;		///< Number of shared free objects
+  u_int64_t		bp_hits;		///< Allocations satisfied without malloc
+  u_int64_t		bp_misses;		///< Allocations which went to malloc
+  u_int64_t		bp_released;		///< Objects handed back to free
+  struct pool_cache    *bp_caches;		///< Every thread's cache
+  struct bk_pool       *bp_next;		///< Next pool in the registry
+#ifdef BK_USING_PTHREADS
+  pthread_key_t		bp_key;			///< Per-thread cache
+  pthread_mutex_t	bp_lock;		///< Lock on depot and cache list
+#else /* BK_USING_PTHREADS */
+  struct pool_cache	bp_cache;		///< The only cache there is
+#endif /* BK_USING_PTHREADS */
+};
+
+
+
+static struct bk_pool *pool_registry = NULL;	///< Every pool, for statistics
+static bk_dynamic_stats_h pool_stats_list = NULL; ///< Where static pools created from now on register
+#ifdef BK_USING_PTHREADS
+static pthread_mutex_t pool_registry_lock = PTHREAD_MUTEX_INITIALIZER; ///< Lock on the registry
+#define POOL_LOCK(l)		do { if (pthread_mutex_lock(l) != 0) abort(); } while (0)
+#define POOL_UNLOCK(l)		do { if (pthread_mutex_unlock(l) != 0) abort(); } while (0)
+#else /* BK_USING_PTHREADS */
+#define POOL_LOCK(l)		do { } while (0)
+#define POOL_UNLOCK(l)		do { } while (0)
+#endif /* BK_USING_PTHREADS */
+
+
+
+static struct bk_pool *pool_create(const char *name, size_t objsize, u_int batch, bk_flags flags);
+static int pool_stats_register(bk_s B, bk_dynamic_stats_h stats_list, struct bk_pool *pool);
+static struct pool_cache *pool_cache_get(struct bk_pool *pool);
+static void pool_cache_exit(void *opaque);
+static void pool_refill(struct bk_pool *pool, struct pool_cache *cache);
+static void pool_spill(struct bk_pool *pool, struct pool_cache *cache, u_int count);
+static void pool_freelist(struct pool_obj *list);
+
+
+
+/**
+ * Create an object pool.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state (may be NULL)
+ *	@param name Name of the pool, for statistics
+ *	@param objsize Size of each object
+ *	@param batch Objects moved between a thread and the depot at once (0 for default)
+ *	@param flags Fun for the future
+ *	@return <i>NULL</i> on failure, with errno set
+ *	@return <br><i>pool</i> on success
+ */
+struct bk_pool *
+bk_pool_create(bk_s B, const char *name, size_t objsize, u_int batch, bk_flags flags)
+{
+  struct bk_pool *pool;
+
+  if (!(pool = pool_create(name, objsize, batch, flags)))
+    return(NULL);
+
+  POOL_LOCK(&pool_registry_lock);
+  pool->bp_next = pool_registry;
+  pool_registry = pool;
+  POOL_UNLOCK(&pool_registry_lock);
+
+  return(pool);
+}
+
+
+
+/**
+ * Build an object pool, not yet in the registry.
+ *
+ *	@param name Name of the pool, for statistics
+ *	@param objsize Size of each object
+ *	@param batch Objects moved between a thread and the depot at once (0 for default)
+ *	@param flags Fun for the future
+ *	@return <i>NULL</i> on failure, with errno set
+ *	@return <br><i>pool</i> on success
+ */
+static struct bk_pool *
+pool_create(const char *name, size_t objsize, u_int batch, bk_flags flags)
+{
+  struct bk_pool *pool = NULL;
+
+  if (!name || !objsize)
+  {
+    errno = EINVAL;
+    return(NULL);
+  }
+
+  if (!BK_CALLOC(pool))
+    return(NULL);
+
+  if (!(pool->bp_name = strdup(name)))
+    goto error;
+
+  pool->bp_objsize = BK_MAX(objsize, sizeof(struct pool_obj));
+  pool->bp_batch = batch?batch:POOL_DEFBATCH;
+  pool->bp_depotmax = pool->bp_batch * POOL_DEPOTBATCHES;
+  pool->bp_flags = flags;
+
+#ifdef BK_USING_PTHREADS
+  if ((errno = pthread_key_create(&pool->bp_key, pool_cache_exit)) != 0)
+    goto error;
+
+  if ((errno = pthread_mutex_init(&pool->bp_lock, NULL)) != 0)
+  {
+    pthread_key_delete(pool->bp_key);
+    goto error;
+  }
+#else /* BK_USING_PTHREADS */
+  pool->bp_cache.pc_pool = pool;
+  pool->bp_caches = &pool->bp_cache;
+#endif /* BK_USING_PTHREADS */
+
+  return(pool);
+
+ error:
+  if (pool->bp_name)
+    free(pool->bp_name);
+  free(pool);
+  return(NULL);
+}
+
+
+
+/**
+ * Destroy an object pool, freeing every object it holds.  Objects still
+ * allocated from the pool must not be freed to it afterwards, and no
+ * other thread may be using the pool.
+ *
+ * THREADS: REENTRANT
+ *
+ *	@param B BAKA thread/global state (may be NULL)
+ *	@param pool Pool to destroy
+ *	@param flags Fun for the future
+ */
+void
+bk_pool_destroy(bk_s B, struct bk_pool *pool, bk_flags flags)
+{
+  struct bk_pool **prev;
+  struct pool_cache *cache;
+
+  if (!pool)
+    return;
+
+  POOL_LOCK(&pool_registry_lock);
+  for (prev = &pool_registry; *prev && *prev != pool; prev = &(*prev)->bp_next)
+    ; // Intentionally void
+  if (*prev)
+    *prev = pool->bp_next;
+  POOL_UNLOCK(&pool_registry_lock);
+
+  while ((cache = pool->bp_caches))
+  {
+    pool->bp_caches = cache->pc_next;
+    pool_freelist(cache->pc_free);
+#ifdef BK_USING_PTHREADS
+    free(cache);
+#endif /* BK_USING_PTHREADS */
+  }
+  pool_freelist(pool->bp_depot);
+
+#ifdef BK_USING_PTHREADS
+  pthread_key_delete(pool->bp_key);
+  pthread_mutex_destroy(&pool->bp_lock);
+#endif /* BK_USING_PTHREADS */
+
+  free(pool->bp_name);
+  free(pool);
+}
+
+
+
+/**
+ * Return a process-lifetime pool, creating it on first use.  Normally
+ * reached through BK_POOL_STATIC, which skips the call once the pool
+ * exists.  A pool created after bk_pool_stats_register registers its own
+ * statistics in the same list, so its first use must not be made with a
+ * lock held that reporting an error would take.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state (may be NULL)
+ *	@param poolp Where the pool pointer lives (initially NULL)
+ *	@param name Name of the pool, for statistics
+ *	@param objsize Size of each object
+ *	@return <i>NULL</i> on failure, with errno set
+ *	@return <br><i>pool</i> on success
+ */
+struct bk_pool *
+bk_pool_static(bk_s B, struct bk_pool **poolp, const char *name, size_t objsize)
+{
+  struct bk_pool *pool, *expected = NULL;
+  bk_dynamic_stats_h stats_list = NULL;
+
+  if (!poolp)
+  {
+    errno = EINVAL;
+    return(NULL);
+  }
+
+  if ((pool = __atomic_load_n(poolp, __ATOMIC_ACQUIRE)))
+    return(pool);
+
+  if (!(pool = pool_create(name, objsize, 0, 0)))
+    return(NULL);
+
+  /*
+   * Only the winner joins the registry, so bk_pool_stats_register never
+   * sees a pool about to be destroyed.  It joins under the lock the stats
+   * list is set under, so it is registered either there or here.
+   */
+  POOL_LOCK(&pool_registry_lock);
+  if (__atomic_compare_exchange_n(poolp, &expected, pool, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+  {
+    pool->bp_next = pool_registry;
+    pool_registry = pool;
+    stats_list = pool_stats_list;
+  }
+  POOL_UNLOCK(&pool_registry_lock);
+
+  if (expected)
+  {
+    // Some other thread got there first
+    bk_pool_destroy(B, pool, 0);
+    return(expected);
+  }
+
+  if (stats_list && B)
+    pool_stats_register(B, stats_list, pool);
+
+  return(pool);
+}
+
+
+
+/**
+ * Allocate an object from a pool.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state (may be NULL)
+ *	@param pool Pool to allocate from
+ *	@param flags BK_POOL_ZERO to clear the object
+ *	@return <i>NULL</i> on failure, with errno set
+ *	@return <br><i>object</i> on success
+ */
+void *
+bk_pool_alloc(bk_s B, struct bk_pool *pool, bk_flags flags)
+{
+  struct pool_cache *cache;
+  struct pool_obj *obj = NULL;
+
+  if (!pool)
+  {
+    errno = EINVAL;
+    return(NULL);
+  }
+
+  if ((cache = pool_cache_get(pool)))
+  {
+    if (!cache->pc_free)
+      pool_refill(pool, cache);
+
+    if ((obj = cache->pc_free))
+    {
+      cache->pc_free = obj->po_next;
+      cache->pc_count--;
+      if (++cache->pc_hits >= POOL_STATFLUSH)
+      {
+	__atomic_add_fetch(&pool->bp_hits, cache->pc_hits, __ATOMIC_RELAXED);
+	cache->pc_hits = 0;
+      }
+    }
+  }
+
+  if (!obj)
+  {
+    if (!(obj = malloc(pool->bp_objsize)))
+      return(NULL);
+    __atomic_add_fetch(&pool->bp_misses, 1, __ATOMIC_RELAXED);
+  }
+
+  if (BK_FLAG_ISSET(flags, BK_POOL_ZERO))
+    memset(obj, 0, pool->bp_objsize);
+
+  return(obj);
+}
+
+
+
+/**
+ * Return an object to the pool it was allocated from.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state (may be NULL)
+ *	@param pool Pool the object came from
+ *	@param obj Object to free (NULL is ignored)
+ */
+void
+bk_pool_free(bk_s B, struct bk_pool *pool, void *obj)
+{
+  struct pool_cache *cache;
+  struct pool_obj *po = obj;
+
+  if (!po)
+    return;
+
+  if (!pool || !(cache = pool_cache_get(pool)))
+  {
+    free(po);
+    if (pool)
+      __atomic_add_fetch(&pool->bp_released, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  po->po_next = cache->pc_free;
+  cache->pc_free = po;
+  if (++cache->pc_count >= 2 * pool->bp_batch)
+    pool_spill(pool, cache, pool->bp_batch);
+}
+
+
+
+/**
+ * Register hit, miss, release and depot statistics for every pool which
+ * exists.  Static pools (BK_POOL_STATIC) created later register in the
+ * same list by themselves; other pools are picked up by calling this
+ * again.  Pools already registered are left alone.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state.
+ *	@param stats_list The stats list.
+ *	@param flags Fun for the future
+ *	@return <i>-1</i> on failure.<br>
+ *	@return <i>0</i> on success.
+ */
+int
+bk_pool_stats_register(bk_s B, bk_dynamic_stats_h stats_list, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_pool *pool, **pools = NULL;
+  u_int npools = 0;
+  int ret = 0;
+
+  if (!stats_list)
+  {
+    bk_error_printf(B, BK_ERR_ERR,"Illegal arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  /*
+   * Registering can allocate from (and so create) pools, so take a copy
+   * of the registry rather than walking it locked.
+   */
+  POOL_LOCK(&pool_registry_lock);
+  pool_stats_list = stats_list;
+  for (pool = pool_registry; pool; pool = pool->bp_next)
+    npools++;
+  if (npools && (pools = malloc(npools * sizeof(*pools))))
+  {
+    npools = 0;
+    for (pool = pool_registry; pool; pool = pool->bp_next)
+      pools[npools++] = pool;
+  }
+  POOL_UNLOCK(&pool_registry_lock);
+
+  if (npools && !pools)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate pool list: %s\n", strerror(errno));
+    BK_RETURN(B, -1);
+  }
+
+  while (npools--)
+  {
+    if (pool_stats_register(B, stats_list, pools[npools]) < 0)
+      ret = -1;
+  }
+
+  if (pools)
+    free(pools);
+
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Stop static pools created from now on registering in a stats list,
+ * which is about to be destroyed.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state.
+ *	@param stats_list The stats list.
+ */
+void
+bk_pool_stats_deregister(bk_s B, bk_dynamic_stats_h stats_list)
+{
+  POOL_LOCK(&pool_registry_lock);
+  if (pool_stats_list == stats_list)
+    pool_stats_list = NULL;
+  POOL_UNLOCK(&pool_registry_lock);
+}
+
+
+
+/**
+ * Register one pool's statistics.
+ *
+ *	@param B BAKA thread/global state.
+ *	@param stats_list The stats list.
+ *	@param pool The pool
+ *	@return <i>-1</i> on failure.<br>
+ *	@return <i>0</i> on success.
+ */
+static int
+pool_stats_register(bk_s B, bk_dynamic_stats_h stats_list, struct bk_pool *pool)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  char name[POOL_STATNAMELEN];
+  u_int cnt;
+  int ret = 0;
+  static const struct
+  {
+    const char	       *suffix;
+    size_t		offset;
+  } poolstats[] =
+  {
+    { "hits", offsetof(struct bk_pool, bp_hits) },
+    { "misses", offsetof(struct bk_pool, bp_misses) },
+    { "released", offsetof(struct bk_pool, bp_released) },
+    { "depot", offsetof(struct bk_pool, bp_depotcnt) },
+  };
+
+  for (cnt = 0; cnt < sizeof(poolstats) / sizeof(poolstats[0]); cnt++)
+  {
+    snprintf(name, sizeof(name), "pool.%s.%s", pool->bp_name, poolstats[cnt].suffix);
+    if (bk_dynamic_stat_register_with_value_simple(B, stats_list, name, 0, 0, DynamicStatsValueTypeUInt64, DynamicStatsAccessTypeIndirect, NULL, NULL, NULL, NULL, BK_DYNAMIC_STAT_REGISTER_FLAG_IDEMPOTENT, (char *)pool + poolstats[cnt].offset) < 0)
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not register %s statistic\n", name);
+      ret = -1;
+    }
+  }
+
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Find (or make) the calling thread's cache for a pool.
+ *
+ *	@param pool The pool
+ *	@return <i>NULL</i> if no cache could be made
+ *	@return <br><i>cache</i> otherwise
+ */
+static struct pool_cache *
+pool_cache_get(struct bk_pool *pool)
+{
+#ifdef BK_USING_PTHREADS
+  struct pool_cache *cache;
+
+  if ((cache = pthread_getspecific(pool->bp_key)))
+    return(cache);
+
+  if (!BK_CALLOC(cache))
+    return(NULL);
+  cache->pc_pool = pool;
+
+  if (pthread_setspecific(pool->bp_key, cache) != 0)
+  {
+    free(cache);
+    return(NULL);
+  }
+
+  POOL_LOCK(&pool->bp_lock);
+  cache->pc_next = pool->bp_caches;
+  pool->bp_caches = cache;
+  POOL_UNLOCK(&pool->bp_lock);
+
+  return(cache);
+#else /* BK_USING_PTHREADS */
+  return(&pool->bp_cache);
+#endif /* BK_USING_PTHREADS */
+}
+
+
+
+/**
+ * A thread with a cache is exiting: give its objects and counts back to
+ * the pool.
+ *
+ *	@param opaque The exiting thread's cache
+ */
+static void
+pool_cache_exit(void *opaque)
+{
+#ifdef BK_USING_PTHREADS
+  struct pool_cache *cache = opaque;
+  struct bk_pool *pool = cache->pc_pool;
+  struct pool_cache **prev;
+
+  pool_spill(pool, cache, cache->pc_count);
+  __atomic_add_fetch(&pool->bp_hits, cache->pc_hits, __ATOMIC_RELAXED);
+
+  POOL_LOCK(&pool->bp_lock);
+  for (prev = &pool->bp_caches; *prev && *prev != cache; prev = &(*prev)->pc_next)
+    ; // Intentionally void
+  if (*prev)
+    *prev = cache->pc_next;
+  POOL_UNLOCK(&pool->bp_lock);
+
+  free(cache);
+#endif /* BK_USING_PTHREADS */
+}
+
+
+
+/**
+ * Move up to a batch of objects from the depot to a thread's cache.
+ *
+ *	@param pool The pool
+ *	@param cache The (empty) cache to refill
+ */
+static void
+pool_refill(struct bk_pool *pool, struct pool_cache *cache)
+{
+  struct pool_obj *obj;
+
+  POOL_LOCK(&pool->bp_lock);
+  while (cache->pc_count < pool->bp_batch && (obj = pool->bp_depot))
+  {
+    pool->bp_depot = obj->po_next;
+    obj->po_next = cache->pc_free;
+    cache->pc_free = obj;
+    cache->pc_count++;
+  }
+  pool->bp_depotcnt -= cache->pc_count;
+  POOL_UNLOCK(&pool->bp_lock);
+}
+
+
+
+/**
+ * Move objects from a thread's cache to the depot, freeing whatever the
+ * depot has no room for.
+ *
+ *	@param pool The pool
+ *	@param cache The cache to drain
+ *	@param count Number of objects to move
+ */
+static void
+pool_spill(struct bk_pool *pool, struct pool_cache *cache, u_int count)
+{
+  struct pool_obj *head, *tail;
+  u_int moved, kept;
+
+  if (!count || !(head = cache->pc_free))
+    return;
+
+  // Detach the first count objects without the lock
+  for (tail = head, moved = 1; moved < count && tail->po_next; moved++)
+    tail = tail->po_next;
+  cache->pc_free = tail->po_next;
+  cache->pc_count -= moved;
+  tail->po_next = NULL;
+
+  POOL_LOCK(&pool->bp_lock);
+  kept = 0;
+  while (head && pool->bp_depotcnt + kept < pool->bp_depotmax)
+  {
+    struct pool_obj *next = head->po_next;
+
+    head->po_next = pool->bp_depot;
+    pool->bp_depot = head;
+    head = next;
+    kept++;
+  }
+  pool->bp_depotcnt += kept;
+  POOL_UNLOCK(&pool->bp_lock);
+
+  if (head)
+  {
+    __atomic_add_fetch(&pool->bp_released, moved - kept, __ATOMIC_RELAXED);
+    pool_freelist(head);
+  }
+}
+
+
+
+/**
+ * Free a list of objects.
+ *
+ *	@param list The objects
+ */
+static void
+pool_freelist(struct pool_obj *list)
+{
+  struct pool_obj *next;
+
+  for (; list; list = next)
+  {
+    next = list->po_next;
+    free(list);
+  }
+}
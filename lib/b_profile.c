@@ -0,0 +1,687 @@
+#if !defined(lint)
+static const char libbk__copyright[] = "Copyright © 2011";
+static const char libbk__contact[] = "<projectbaka@baka.org>";
+#endif /* not lint */
+/*
+ * ++Copyright BAKA++
+ *
+ * Copyright © 2011 The Authors. All rights reserved.
+ *
+ * This source code is licensed to you under the terms of the file
+ * LICENSE.TXT in this release for further details.
+ *
+ * Send e-mail to <projectbaka@baka.org> for further information.
+ *
+ * - -Copyright BAKA- -
+ */
+
+/**
+ * @file
+ *
+ * Sampling profiler over the BK_ENTRY function stack.
+ *
+ * A CPU-time interval timer (ITIMER_PROF) sends SIGPROF at the requested
+ * rate to whichever thread is running.  The handler copies that thread's
+ * function names into a fixed ring of samples: slots are reserved with a
+ * compare-and-swap and published with a sequence number, so the handler
+ * takes no locks and calls nothing unsafe.  When the ring is full samples
+ * are counted as dropped.
+ *
+ * Dumping drains the ring into a table of folded stacks (outermost
+ * function first, separated by semicolons, then a count), the input
+ * format of flamegraph.pl.  The table is cumulative, so each dump shows
+ * the whole profile so far.  Dumps can be asked for directly, on a signal
+ * through bk_run, or at exit.
+ */
+
+#include <libbk.h>
+#include "libbk_internal.h"
+
+
+
+#define PROFILE_MAXFRAMES	64		///< Frames recorded per sample
+#define PROFILE_DEFSAMPLES	4096		///< Default ring size
+#define PROFILE_UNTRACED	"(untraced)"	///< Stack of a thread without tracing
+#define PROFILE_TRUNCATED	"(truncated)"	///< Frame standing for unrecorded frames
+#define PROFILE_DROPPED		"(dropped)"	///< Stack of samples lost to a full ring
+#define PROFILE_FOLDEDLEN	1024		///< Initial folded stack buffer
+
+
+
+/**
+ * One sample: the function names on a thread's stack
+ */
+struct profile_sample
+{
+  u_int64_t		ps_seq;			///< Ring position + 1 once written
+  u_short		ps_nframes;		///< Frames recorded
+  u_short		ps_truncated;		///< Stack was deeper than recorded
+  const char	       *ps_frames[PROFILE_MAXFRAMES]; ///< Function names, outermost first
+};
+
+
+
+/**
+ * One folded stack and how often it was seen
+ */
+struct profile_stack
+{
+  char		       *pst_folded;		///< Names joined by ';'
+  u_int64_t		pst_count;		///< Samples
+};
+
+
+
+/**
+ * Profiler state.  There is only one, since the timer is per-process.
+ */
+struct bk_profile
+{
+  bk_flags		bp_flags;		///< Everyone needs flags
+#define BP_FLAG_RUNNING		0x1		///< Timer is set
+#define BP_FLAG_ATEXIT		0x2		///< Exit dump registered
+  u_int			bp_hz;			///< Samples per CPU second
+  u_int64_t		bp_max;			///< Ring size
+  struct profile_sample *bp_samples;		///< The ring
+  u_int64_t		bp_head;		///< Next position to write
+  u_int64_t		bp_tail;		///< Next position to drain
+  u_int64_t		bp_dropped;		///< Samples lost to a full ring
+  u_int64_t		bp_total;		///< Samples drained so far
+  dict_h		bp_stacks;		///< Folded stacks
+  char		       *bp_path;		///< Where signal and exit dumps go
+  struct sigaction	bp_oldact;		///< SIGPROF action to restore
+#ifdef BK_USING_PTHREADS
+  pthread_mutex_t	bp_lock;		///< Lock on draining and dumping
+#endif /* BK_USING_PTHREADS */
+};
+
+
+
+/**
+ * @name Defines: profile_clc
+ * Folded stack table CLC definitions
+ * to hide CLC choice.
+ */
+// @{
+#define profile_create(o,k,f,a)		ht_create(o,k,f,a)
+#define profile_destroy(h)		ht_destroy(h)
+#define profile_insert(h,o)		ht_insert(h,o)
+#define profile_insert_uniq(h,n,o)	ht_insert_uniq(h,n,o)
+#define profile_append(h,o)		ht_append(h,o)
+#define profile_append_uniq(h,n,o)	ht_append_uniq(h,n,o)
+#define profile_search(h,k)		ht_search(h,k)
+#define profile_delete(h,o)		ht_delete(h,o)
+#define profile_minimum(h)		ht_minimum(h)
+#define profile_maximum(h)		ht_maximum(h)
+#define profile_successor(h,o)		ht_successor(h,o)
+#define profile_predecessor(h,o)	ht_predecessor(h,o)
+#define profile_iterate(h,d)		ht_iterate(h,d)
+#define profile_nextobj(h,i)		ht_nextobj(h,i)
+#define profile_iterate_done(h,i)	ht_iterate_done(h,i)
+#define profile_error_reason(h,i)	ht_error_reason(h,i)
+
+static int profile_oo_cmp(struct profile_stack *a, struct profile_stack *b);
+static int profile_ko_cmp(char *a, struct profile_stack *b);
+static unsigned int profile_obj_hash(struct profile_stack *a);
+static unsigned int profile_key_hash(char *a);
+static struct ht_args profile_args = { 1021, 2, (ht_func)profile_obj_hash, (ht_func)profile_key_hash };
+// @}
+
+
+
+static struct bk_profile *Profile = NULL;	///< The profiler, once started
+
+
+
+static void profile_sigprof(int signum);
+static int profile_drain(bk_s B, struct bk_profile *bp);
+static int profile_count(bk_s B, struct bk_profile *bp, const char *folded, u_int64_t count);
+static int profile_write(bk_s B, struct bk_profile *bp, FILE *out, bk_flags flags);
+static int profile_dump_path(bk_s B, struct bk_profile *bp);
+static void profile_dump_signal(bk_s B, struct bk_run *run, int signum, void *opaque);
+static void profile_atexit(void);
+
+
+
+/**
+ * Start (or resume) sampling the function stacks of all threads.  Only
+ * functions using BK_ENTRY appear, and only while function tracing is on.
+ * The ring size and dump path given the first time are kept when
+ * sampling is stopped and started again.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state
+ *	@param hz Samples per second of CPU time
+ *	@param maxsamples Samples held between dumps (0 for default)
+ *	@param path File for signal and exit dumps (NULL if not wanted)
+ *	@param flags BK_PROFILE_ATEXIT to dump to @a path at exit
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>0</i> on success
+ */
+int
+bk_profile_start(bk_s B, u_int hz, u_int maxsamples, const char *path, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_profile *bp = Profile;
+  struct sigaction act;
+  struct itimerval itv;
+
+  if (!hz || hz > 1000000 || (BK_FLAG_ISSET(flags, BK_PROFILE_ATEXIT) && !path && !(bp && bp->bp_path)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (!bp)
+  {
+    if (!BK_CALLOC(bp))
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not allocate profiler: %s\n", strerror(errno));
+      BK_RETURN(B, -1);
+    }
+
+    bp->bp_max = maxsamples?maxsamples:PROFILE_DEFSAMPLES;
+    if (!(bp->bp_samples = calloc(bp->bp_max, sizeof(*bp->bp_samples))))
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not allocate %llu samples: %s\n", (unsigned long long)bp->bp_max, strerror(errno));
+      goto error;
+    }
+
+    if (!(bp->bp_stacks = profile_create((dict_function)profile_oo_cmp, (dict_function)profile_ko_cmp, DICT_HT_STRICT_HINTS|DICT_THREAD_NOCOALESCE, &profile_args)))
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not create folded stack table: %s\n", profile_error_reason(NULL, NULL));
+      goto error;
+    }
+
+    if (path && !(bp->bp_path = strdup(path)))
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not copy dump path: %s\n", strerror(errno));
+      goto error;
+    }
+
+#ifdef BK_USING_PTHREADS
+    if (pthread_mutex_init(&bp->bp_lock, NULL) != 0)
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not initialize profiler lock\n");
+      goto error;
+    }
+#endif /* BK_USING_PTHREADS */
+
+    // The handler may run as soon as the timer is set below
+    __atomic_store_n(&Profile, bp, __ATOMIC_RELEASE);
+  }
+
+  if (BK_FLAG_ISSET(bp->bp_flags, BP_FLAG_RUNNING))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Profiler is already running\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (BK_FLAG_ISSET(flags, BK_PROFILE_ATEXIT) && BK_FLAG_ISCLEAR(bp->bp_flags, BP_FLAG_ATEXIT))
+  {
+    if (atexit(profile_atexit) != 0)
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not register exit dump\n");
+      BK_RETURN(B, -1);
+    }
+    BK_FLAG_SET(bp->bp_flags, BP_FLAG_ATEXIT);
+  }
+
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = profile_sigprof;
+  act.sa_flags = SA_RESTART;
+  sigemptyset(&act.sa_mask);
+  if (sigaction(SIGPROF, &act, &bp->bp_oldact) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not install SIGPROF handler: %s\n", strerror(errno));
+    BK_RETURN(B, -1);
+  }
+
+  bp->bp_hz = hz;
+  itv.it_interval.tv_sec = 1 / hz;
+  itv.it_interval.tv_usec = (1000000 / hz) % 1000000;
+  itv.it_value = itv.it_interval;
+  if (setitimer(ITIMER_PROF, &itv, NULL) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not set profiling timer: %s\n", strerror(errno));
+    sigaction(SIGPROF, &bp->bp_oldact, NULL);
+    BK_RETURN(B, -1);
+  }
+  BK_FLAG_SET(bp->bp_flags, BP_FLAG_RUNNING);
+
+  BK_RETURN(B, 0);
+
+ error:
+  if (bp->bp_stacks)
+    profile_destroy(bp->bp_stacks);
+  if (bp->bp_samples)
+    free(bp->bp_samples);
+  if (bp->bp_path)
+    free(bp->bp_path);
+  free(bp);
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * Stop sampling.  Samples taken so far can still be dumped.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state
+ *	@param flags Fun for the future
+ */
+void
+bk_profile_stop(bk_s B, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_profile *bp = Profile;
+  struct itimerval itv;
+
+  if (!bp || BK_FLAG_ISCLEAR(bp->bp_flags, BP_FLAG_RUNNING))
+    BK_VRETURN(B);
+
+  memset(&itv, 0, sizeof(itv));
+  setitimer(ITIMER_PROF, &itv, NULL);
+  sigaction(SIGPROF, &bp->bp_oldact, NULL);
+  BK_FLAG_CLEAR(bp->bp_flags, BP_FLAG_RUNNING);
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Write the profile so far as folded stacks, one "f1;f2;f3 count" line
+ * per distinct stack.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state
+ *	@param out Where to write
+ *	@param flags BK_PROFILE_DUMP_RESET to start a new profile afterwards
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>0</i> on success
+ */
+int
+bk_profile_dump(bk_s B, FILE *out, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_profile *bp = Profile;
+
+  if (!out)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (!bp)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Profiler has not been started\n");
+    BK_RETURN(B, -1);
+  }
+
+  BK_RETURN(B, profile_write(B, bp, out, flags));
+}
+
+
+
+/**
+ * Dump the profile to the path given to @a bk_profile_start whenever a
+ * signal arrives.  The dump happens from the bk_run loop, not from the
+ * signal handler.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state
+ *	@param run The bk_run environment which handles the signal
+ *	@param signum The signal (SIGUSR2, say)
+ *	@param flags Fun for the future
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>0</i> on success
+ */
+int
+bk_profile_dump_on_signal(bk_s B, struct bk_run *run, int signum, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_profile *bp = Profile;
+
+  if (!run || !signum)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (!bp || !bp->bp_path)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Profiler has not been started with a dump path\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (bk_run_signal(B, run, signum, profile_dump_signal, bp, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not register profile dump signal handler\n");
+    BK_RETURN(B, -1);
+  }
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * SIGPROF handler: record the interrupted thread's function stack.
+ * Async-signal-safe: atomics and plain loads only.
+ *
+ *	@param signum SIGPROF
+ */
+static void
+profile_sigprof(int signum)
+{
+  struct bk_profile *bp = __atomic_load_n(&Profile, __ATOMIC_ACQUIRE);
+  struct bk_funstack *fs;
+  struct profile_sample *ps;
+  u_int64_t head;
+  u_int depth, cnt;
+
+  if (!bp)
+    return;
+
+  head = __atomic_load_n(&bp->bp_head, __ATOMIC_RELAXED);
+  do
+  {
+    if (head - __atomic_load_n(&bp->bp_tail, __ATOMIC_ACQUIRE) >= bp->bp_max)
+    {
+      __atomic_add_fetch(&bp->bp_dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  } while (!__atomic_compare_exchange_n(&bp->bp_head, &head, head + 1, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+  ps = &bp->bp_samples[head % bp->bp_max];
+  fs = bk_fun_stack();
+  depth = fs?fs->bfs_depth:0;
+  __atomic_signal_fence(__ATOMIC_ACQUIRE);
+
+  ps->ps_nframes = BK_MIN(depth, PROFILE_MAXFRAMES);
+  ps->ps_truncated = (depth > PROFILE_MAXFRAMES || (fs && fs->bfs_overflow));
+  for (cnt = 0; cnt < ps->ps_nframes; cnt++)
+    ps->ps_frames[cnt] = fs->bfs_frames[cnt].bf_funname;
+
+  __atomic_store_n(&ps->ps_seq, head + 1, __ATOMIC_RELEASE);
+}
+
+
+
+/**
+ * Move samples from the ring into the folded stack table.
+ *
+ * THREADS: REENTRANT (profiler must be locked)
+ *
+ *	@param B BAKA thread/global state
+ *	@param bp The profiler
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>0</i> on success
+ */
+static int
+profile_drain(bk_s B, struct bk_profile *bp)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct profile_sample *ps;
+  u_int64_t pos, head;
+  bk_vstr folded;
+  u_int cnt;
+  int ret = 0;
+
+  if (!(folded.ptr = malloc(PROFILE_FOLDEDLEN)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate folded stack buffer: %s\n", strerror(errno));
+    BK_RETURN(B, -1);
+  }
+  folded.max = PROFILE_FOLDEDLEN;
+
+  head = __atomic_load_n(&bp->bp_head, __ATOMIC_ACQUIRE);
+  for (pos = bp->bp_tail; pos != head; pos++)
+  {
+    ps = &bp->bp_samples[pos % bp->bp_max];
+
+    // Reserved but still being written (by a handler on another CPU)
+    while (__atomic_load_n(&ps->ps_seq, __ATOMIC_ACQUIRE) != pos + 1)
+      sched_yield();
+
+    folded.cur = 0;
+    *folded.ptr = '\0';
+    if (!ps->ps_nframes && bk_vstr_cat(B, 0, &folded, "%s", PROFILE_UNTRACED) < 0)
+      goto error;
+    for (cnt = 0; cnt < ps->ps_nframes; cnt++)
+    {
+      if (bk_vstr_cat(B, 0, &folded, "%s%s", cnt?";":"", ps->ps_frames[cnt]?ps->ps_frames[cnt]:"?") < 0)
+	goto error;
+    }
+    if (ps->ps_truncated && bk_vstr_cat(B, 0, &folded, ";%s", PROFILE_TRUNCATED) < 0)
+      goto error;
+
+    if (profile_count(B, bp, folded.ptr, 1) < 0)
+      ret = -1;
+  }
+  bp->bp_total += head - bp->bp_tail;
+  __atomic_store_n(&bp->bp_tail, head, __ATOMIC_RELEASE);
+
+  free(folded.ptr);
+  BK_RETURN(B, ret);
+
+ error:
+  // Leave the rest of the ring for next time
+  bk_error_printf(B, BK_ERR_ERR, "Could not build folded stack\n");
+  bp->bp_total += pos - bp->bp_tail;
+  __atomic_store_n(&bp->bp_tail, pos, __ATOMIC_RELEASE);
+  free(folded.ptr);
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * Add to the count of a folded stack, creating it if need be.
+ *
+ * THREADS: REENTRANT (profiler must be locked)
+ *
+ *	@param B BAKA thread/global state
+ *	@param bp The profiler
+ *	@param folded The folded stack
+ *	@param count How many more times it was seen
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>0</i> on success
+ */
+static int
+profile_count(bk_s B, struct bk_profile *bp, const char *folded, u_int64_t count)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct profile_stack *pst;
+
+  if ((pst = profile_search(bp->bp_stacks, (char *)folded)))
+  {
+    pst->pst_count += count;
+    BK_RETURN(B, 0);
+  }
+
+  if (!BK_CALLOC(pst) || !(pst->pst_folded = strdup(folded)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate folded stack: %s\n", strerror(errno));
+    goto error;
+  }
+  pst->pst_count = count;
+
+  if (profile_insert(bp->bp_stacks, pst) != DICT_OK)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not insert folded stack: %s\n", profile_error_reason(bp->bp_stacks, NULL));
+    goto error;
+  }
+
+  BK_RETURN(B, 0);
+
+ error:
+  if (pst)
+  {
+    if (pst->pst_folded)
+      free(pst->pst_folded);
+    free(pst);
+  }
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * Drain and write the folded stack table.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state
+ *	@param bp The profiler
+ *	@param out Where to write
+ *	@param flags BK_PROFILE_DUMP_RESET to empty the table afterwards
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>0</i> on success
+ */
+static int
+profile_write(bk_s B, struct bk_profile *bp, FILE *out, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct profile_stack *pst;
+  u_int64_t dropped;
+  int ret = 0;
+
+#ifdef BK_USING_PTHREADS
+  if (pthread_mutex_lock(&bp->bp_lock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+
+  if (profile_drain(B, bp) < 0)
+    ret = -1;
+
+  if ((dropped = __atomic_exchange_n(&bp->bp_dropped, 0, __ATOMIC_RELAXED)) && profile_count(B, bp, PROFILE_DROPPED, dropped) < 0)
+    ret = -1;
+
+  for (pst = profile_minimum(bp->bp_stacks); pst; pst = profile_successor(bp->bp_stacks, pst))
+  {
+    if (fprintf(out, "%s %llu\n", pst->pst_folded, (unsigned long long)pst->pst_count) < 0)
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not write profile: %s\n", strerror(errno));
+      ret = -1;
+      break;
+    }
+  }
+  fflush(out);
+
+  if (BK_FLAG_ISSET(flags, BK_PROFILE_DUMP_RESET))
+  {
+    DICT_NUKE_CONTENTS(bp->bp_stacks, profile, pst, break, free(pst->pst_folded); free(pst));
+    bp->bp_total = 0;
+  }
+
+#ifdef BK_USING_PTHREADS
+  if (pthread_mutex_unlock(&bp->bp_lock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Write the profile to the dump path, replacing what was there.
+ *
+ *	@param B BAKA thread/global state
+ *	@param bp The profiler
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>0</i> on success
+ */
+static int
+profile_dump_path(bk_s B, struct bk_profile *bp)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  FILE *out;
+  int ret;
+
+  if (!(out = fopen(bp->bp_path, "w")))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not open profile dump %s: %s\n", bp->bp_path, strerror(errno));
+    BK_RETURN(B, -1);
+  }
+
+  ret = profile_write(B, bp, out, 0);
+
+  if (fclose(out) != 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not write profile dump %s: %s\n", bp->bp_path, strerror(errno));
+    ret = -1;
+  }
+
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * bk_run signal callback: dump the profile.
+ *
+ *	@param B BAKA thread/global state
+ *	@param run The bk_run environment
+ *	@param signum The signal
+ *	@param opaque The profiler
+ */
+static void
+profile_dump_signal(bk_s B, struct bk_run *run, int signum, void *opaque)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  profile_dump_path(B, opaque);
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Exit handler: stop sampling and dump the profile.
+ */
+static void
+profile_atexit(void)
+{
+  struct bk_profile *bp = Profile;
+
+  if (!bp || !bp->bp_path)
+    return;
+
+  bk_profile_stop(NULL, 0);
+  profile_dump_path(NULL, bp);
+}
+
+
+
+/** CLC helper functions and structures for profile_clc */
+static int profile_oo_cmp(struct profile_stack *a, struct profile_stack *b)
+{
+  return(strcmp(a->pst_folded, b->pst_folded));
+}
+
+/** CLC helper functions and structures for profile_clc */
+static int profile_ko_cmp(char *a, struct profile_stack *b)
+{
+  return(strcmp(a, b->pst_folded));
+}
+
+/** CLC helper functions and structures for profile_clc */
+static unsigned int profile_obj_hash(struct profile_stack *a)
+{
+  return(bk_strhash(a->pst_folded, 0));
+}
+
+/** CLC helper functions and structures for profile_clc */
+static unsigned int profile_key_hash(char *a)
+{
+  return(bk_strhash(a, 0));
+}
@@ -18,334 +18,783 @@ static const char libbk__contact[] = "<projectbaka@baka.org>";
 /**
  * @file
  *
- * Implementation of a ring buffer, primarily for a threaded environment,
- * which does not use locking as long as system has has stuff to read and room to write.
+ * Implementation of a bounded multi-producer, multi-consumer queue of
+ * pointers, primarily for a threaded environment, which does not lock.
+ *
+ * This is Dmitry Vyukov's array queue: the size is a power of two, each
+ * cell carries a sequence number saying whose turn it is (the producer of
+ * position p may fill it when seq == p, the consumer may empty it when
+ * seq == p+1), and producers and consumers each claim positions with one
+ * compare-and-swap on their own cache line.  Batch operations claim a run
+ * of positions with a single compare-and-swap.
+ *
+ * Only a thread which finds the queue empty (or full) and was asked to
+ * wait goes to the kernel.  It counts itself as a waiter and sleeps on an
+ * event word (a futex on Linux); the other side checks the waiter count
+ * after publishing and only then pays for a wakeup.
+ *
+ * The older bk_ring interface is a thin wrapper.
  */
 
 #include <libbk.h>
 #include "libbk_internal.h"
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif /* __linux__ */
 
-static int deadbeef = 0;  // RO value with valid address, so Insure doesn't complain about WILD
+#if defined(SYS_futex) && defined(FUTEX_WAIT_PRIVATE)
+#define QUEUE_HAVE_FUTEX			///< Kernel wait/wake is available
+#endif /* SYS_futex && FUTEX_WAIT_PRIVATE */
+
+/*
+ * Tell the CPU we are spin-waiting: frees pipeline resources for a sibling
+ * hyperthread and avoids the memory-order mis-speculation flush on exit.
+ */
+#if defined(__i386__) || defined(__x86_64__)
+#define QUEUE_RELAX()		__builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define QUEUE_RELAX()		__asm__ __volatile__ ("yield" ::: "memory")
+#else
+#define QUEUE_RELAX()		__asm__ __volatile__ ("" ::: "memory")
+#endif /* __i386__ || __x86_64__ */
 
 
 
-#define HAND_PLUS_ONE(B, ring, number) (((number) + 1)%(ring)->br_size)
-#define WRITEALLOWED(B, ring) ((ring)->br_rhand != HAND_PLUS_ONE(B, ring, (ring)->br_whand))
-#define READALLOWED(B, ring) ((ring)->br_rhand != (ring)->br_whand)
+#define QUEUE_CACHELINE		64		///< Keep producer and consumer state apart
+#define QUEUE_POLLUS		100		///< Sleep between checks without futexes
+#define QUEUE_SPINS		64		///< Retries before a waiter goes to sleep
+
 
 
 /**
- * Information about a ring buffer.
- *
- * First, remember that a ring buffer implies modulus arithmetic
- *
- * Write hand points to the node it LAST WROTE
- * Read hand points to the node it LAST READ
+ * One slot in the queue
+ */
+struct queue_cell
+{
+  u_int64_t		qc_seq;				///< Whose turn: position (producer) or position+1 (consumer)
+  void		       *qc_data;			///< Object
+};
+
+
+
+/**
+ * Information about a queue.
  *
- * Thus, if WR=X and RD=X, further reads are blocked
- * If WR=X and RD=X+1, futher writes are blocked
+ * Positions only ever increase; the cell for position p is p & bq_mask.
+ */
+struct bk_queue
+{
+  struct queue_cell    *bq_cells;			///< Cell array
+  u_int64_t		bq_mask;			///< Number of cells - 1
+  bk_flags		bq_flags;			///< Fun for the future
+#define BK_QUEUE_CLOSING	0x1			///< Queue is being terminated
+  char			bq_pad0[QUEUE_CACHELINE];
+  u_int64_t		bq_enqpos;			///< Next position to produce
+  char			bq_pad1[QUEUE_CACHELINE - sizeof(u_int64_t)];
+  u_int64_t		bq_deqpos;			///< Next position to consume
+  char			bq_pad2[QUEUE_CACHELINE - sizeof(u_int64_t)];
+  u_int32_t		bq_enqevent;			///< Bumped when producers may have made queue non-empty (futex word)
+  u_int32_t		bq_deqwaiters;			///< Consumers asleep waiting for objects
+  char			bq_pad3[QUEUE_CACHELINE - 2 * sizeof(u_int32_t)];
+  u_int32_t		bq_deqevent;			///< Bumped when consumers may have made queue non-full (futex word)
+  u_int32_t		bq_enqwaiters;			///< Producers asleep waiting for room
+  char			bq_pad4[QUEUE_CACHELINE - 2 * sizeof(u_int32_t)];
+};
+
+
+
+/**
+ * Information about a ring buffer (compatibility wrapper around bk_queue)
  */
 struct bk_ring
 {
-  volatile u_int	br_rhand;			///< Location of read hand
-  int			br_readasleep;			///< Atomic bit--read is sleeping
-  volatile u_int	br_whand;			///< Location of write hand
-  int			br_writeasleep;			///< Atomic bit--write is sleeping
-  u_int			br_size;			///< Size of ring buffer
-  bk_flags		br_flags;			///< Fun for the future
-#define BK_RING_CLOSING		0x1			///< Ring is being terminated
-#ifdef BK_USING_PTHREADS
-  pthread_mutex_t	br_wlock;			///< Producer locking
-  pthread_mutex_t	br_rlock;			///< Consumer locking
-  pthread_mutex_t	br_lock;			///< Locking to prevent everyong from being asleep
-  pthread_cond_t	br_cond;			///< Where threads go to sleep
-#endif /* BK_USING_PTHREADS */
-  void	     * volatile br_ring[0];			///< Ring buffer (MUST BE LAST)
-  // DO NOT ADD ANY ELEMENTS AFTER BR_RING
+  struct bk_queue	br_queue;			///< Underlying queue
 };
 
 
 
+static int bk_queue_init(bk_s B, struct bk_queue *queue, u_int size, bk_flags flags);
+static void bk_queue_fini(bk_s B, struct bk_queue *queue, bk_flags flags);
+static u_int queue_claim_enq(struct bk_queue *queue, u_int max, u_int64_t *posp);
+static u_int queue_claim_deq(struct bk_queue *queue, u_int max, u_int64_t *posp);
+static inline u_int32_t queue_wait_prepare(u_int32_t *event, u_int32_t *waiters);
+static void queue_wait(struct bk_queue *queue, u_int32_t *event, u_int32_t seen, u_int32_t *waiters);
+static inline void queue_wake(u_int32_t *event, u_int32_t *waiters, u_int cnt);
+
+
+
 /**
- * Create a ring buffer.
+ * Create a queue.
  *
  * THREADS: MT-SAFE
  *
  *	@param B BAKA thread/global state.
- *	@param size Maximum size of ring buffer
+ *	@param size Minimum number of objects queue must hold (rounded up to a power of two)
  *	@param flags Flags Fun for the future
  *	@return <i>NULL</i> on failure.<br>
- *	@return <br><i>Ring structure</i> on success.
+ *	@return <br><i>Queue structure</i> on success.
  */
-struct bk_ring *bk_ring_create(bk_s B, u_int size, bk_flags flags)
+struct bk_queue *bk_queue_create(bk_s B, u_int size, bk_flags flags)
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
-  struct bk_ring *ring;
+  struct bk_queue *queue;
 
-  if (size < 1)
+  if (!BK_CALLOC(queue))
   {
-    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    bk_error_printf(B, BK_ERR_ERR, "Could not create queue structure: %s\n", strerror(errno));
     BK_RETURN(B, NULL);
   }
 
-  if (!BK_CALLOC_LEN(ring, sizeof(*ring)+(sizeof(void *)*size)))
+  if (bk_queue_init(B, queue, size, flags) < 0)
   {
-    bk_error_printf(B, BK_ERR_ERR, "Could not create ring structure: %s\n", strerror(errno));
+    free(queue);
     BK_RETURN(B, NULL);
   }
 
-  ring->br_size = size;
-  ring->br_flags = flags;
-  ring->br_rhand = size-1;
-  ring->br_whand = size-1;
+  BK_RETURN(B, queue);
+}
 
-#ifdef BK_USING_PTHREADS
-  pthread_mutex_init(&ring->br_lock, NULL);
-  pthread_mutex_init(&ring->br_rlock, NULL);
-  pthread_mutex_init(&ring->br_wlock, NULL);
-  pthread_cond_init(&ring->br_cond, NULL);
-#endif /* BK_USING_PTHREADS */
 
-  BK_RETURN(B, ring);
+
+/**
+ * Destroy a queue
+ *
+ * Any objects still queued are forgotten.  Threads blocked on the queue
+ * are woken (and fail) first; the caller must make sure nobody touches the
+ * queue after this returns.
+ *
+ * THREADS: REENTRANT
+ *
+ * @param B BAKA thread/global environment
+ * @param queue Queue
+ * @param flags BK_QUEUE_WAIT to wait for consumers to drain the queue first
+ */
+void bk_queue_destroy(bk_s B, struct bk_queue *queue, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!queue)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_VRETURN(B);
+  }
+
+  bk_queue_fini(B, queue, flags);
+  free(queue);
+
+  BK_VRETURN(B);
 }
 
 
 
 /**
- * Destroy a ring buffer
+ * Mark a queue as closing: producers fail from now on, consumers drain
+ * what is left and then fail instead of blocking.  Everyone asleep is woken.
  *
- * THREADS: REENTRANT
+ * THREADS: MT-SAFE
  *
  * @param B BAKA thread/global environment
- * @param ring Ring buffer
- * @param flags BK_RING_WAIT
+ * @param queue Queue
+ * @param flags Fun for the future
  */
-void bk_ring_destroy(bk_s B, struct bk_ring *ring, bk_flags flags)
+void bk_queue_close(bk_s B, struct bk_queue *queue, bk_flags flags)
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
 
-  if (!ring)
+  if (!queue)
   {
     bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
     BK_VRETURN(B);
   }
 
-  BK_FLAG_SET(ring->br_flags, BK_RING_CLOSING);
+  __atomic_or_fetch(&queue->bq_flags, BK_QUEUE_CLOSING, __ATOMIC_SEQ_CST);
+
+  // Unconditional: the waiter counts may be in flux
+  __atomic_add_fetch(&queue->bq_enqevent, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&queue->bq_deqevent, 1, __ATOMIC_SEQ_CST);
+#ifdef QUEUE_HAVE_FUTEX
+  syscall(SYS_futex, &queue->bq_enqevent, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+  syscall(SYS_futex, &queue->bq_deqevent, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#endif /* QUEUE_HAVE_FUTEX */
+
+  BK_VRETURN(B);
+}
+
+
 
-#ifdef BK_USING_PTHREADS
-  BK_SIMPLE_LOCK(B, &ring->br_lock);
+/**
+ * Add up to cnt objects to a queue, in order
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B Baka global thread environment
+ * @param queue Queue
+ * @param objs Objects to add (NULL is a legal object)
+ * @param cnt Number of objects
+ * @param flags BK_QUEUE_WAIT to block (threaded only) until at least one fits
+ * @return <i>-1</i> on error or closing
+ * @return <br><i>number of objects added</i> (0 on queue-full waiting impossible)
+ */
+int bk_queue_enqueue_batch(bk_s B, struct bk_queue *queue, void **objs, u_int cnt, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  u_int64_t pos;
+  u_int got, x, spins = 0;
 
-  while (BK_FLAG_ISSET(flags, BK_RING_WAIT) && READALLOWED(B, ring))
+  if (!queue || (!objs && cnt))
   {
-    pthread_cond_broadcast(&ring->br_cond);	// Double-check
-    pthread_cond_wait(&ring->br_cond, &ring->br_lock);
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_RETURN(B, -1);
   }
 
-  BK_SIMPLE_UNLOCK(B, &ring->br_lock);
+  while (1)
+  {
+    u_int32_t seen;
 
-  if (pthread_mutex_destroy(&ring->br_lock) != 0)
-    abort();
+    if (__atomic_load_n(&queue->bq_flags, __ATOMIC_RELAXED) & BK_QUEUE_CLOSING)
+      BK_RETURN(B, -1);
 
-  if (pthread_mutex_destroy(&ring->br_rlock) != 0)
-    abort();
+    if (!cnt || (got = queue_claim_enq(queue, cnt, &pos)))
+      break;
 
-  if (pthread_mutex_destroy(&ring->br_wlock) != 0)
-    abort();
+    // Full.  Have we been asked to wait/will it be useful
+    if (BK_FLAG_ISCLEAR(flags, BK_QUEUE_WAIT) || !BK_GENERAL_FLAG_ISTHREADON(B))
+      BK_RETURN(B, 0);
 
-  if (pthread_cond_destroy(&ring->br_cond) != 0)
-    abort();
-#endif /* BK_USING_PTHREADS */
+    if (++spins < QUEUE_SPINS)
+    {
+      QUEUE_RELAX();
+      continue;
+    }
 
-  free(ring);
+    // Announce ourselves, then look once more before sleeping
+    seen = queue_wait_prepare(&queue->bq_deqevent, &queue->bq_enqwaiters);
+    if ((got = queue_claim_enq(queue, cnt, &pos)))
+    {
+      __atomic_sub_fetch(&queue->bq_enqwaiters, 1, __ATOMIC_RELAXED);
+      break;
+    }
+    queue_wait(queue, &queue->bq_deqevent, seen, &queue->bq_enqwaiters);
+  }
 
-  BK_VRETURN(B);
+  for (x = 0; x < got; x++, pos++)
+  {
+    struct queue_cell *cell = &queue->bq_cells[pos & queue->bq_mask];
+
+    cell->qc_data = objs[x];
+    __atomic_store_n(&cell->qc_seq, pos + 1, __ATOMIC_RELEASE);
+  }
+
+  if (got)
+    queue_wake(&queue->bq_enqevent, &queue->bq_deqwaiters, got);
+
+  BK_RETURN(B, got);
 }
 
 
 
 /**
- * Write to ring buffer
+ * Remove up to cnt objects from a queue, in order
  *
- * THREADS: MT-SAFE (unless ring is full)
- * THREADS: MT-REENTRANT (otherwise)
+ * THREADS: MT-SAFE
  *
  * @param B Baka global thread environment
- * @param ring Ring buffer
- * @param opaque Object to add
- * @param flags BK_RING_WAIT (threaded only)
- * @return <i>-1</i> on error
+ * @param queue Queue
+ * @param objs Copy-out objects
+ * @param cnt Room in objs
+ * @param flags BK_QUEUE_WAIT to block (threaded only) until at least one is available
+ * @return <i>-1</i> on error, or closing with nothing left
+ * @return <br><i>number of objects removed</i> (0 on queue-empty waiting impossible)
+ */
+int bk_queue_dequeue_batch(bk_s B, struct bk_queue *queue, void **objs, u_int cnt, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  u_int64_t pos;
+  u_int got, x, spins = 0;
+
+  if (!queue || (!objs && cnt))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  while (1)
+  {
+    u_int32_t seen;
+
+    if (!cnt || (got = queue_claim_deq(queue, cnt, &pos)))
+      break;
+
+    // Empty.  Nothing more is coming if we are closing
+    if (__atomic_load_n(&queue->bq_flags, __ATOMIC_ACQUIRE) & BK_QUEUE_CLOSING)
+      BK_RETURN(B, -1);
+
+    if (BK_FLAG_ISCLEAR(flags, BK_QUEUE_WAIT) || !BK_GENERAL_FLAG_ISTHREADON(B))
+      BK_RETURN(B, 0);
+
+    if (++spins < QUEUE_SPINS)
+    {
+      QUEUE_RELAX();
+      continue;
+    }
+
+    seen = queue_wait_prepare(&queue->bq_enqevent, &queue->bq_deqwaiters);
+    if ((got = queue_claim_deq(queue, cnt, &pos)))
+    {
+      __atomic_sub_fetch(&queue->bq_deqwaiters, 1, __ATOMIC_RELAXED);
+      break;
+    }
+    queue_wait(queue, &queue->bq_enqevent, seen, &queue->bq_deqwaiters);
+  }
+
+  for (x = 0; x < got; x++, pos++)
+  {
+    struct queue_cell *cell = &queue->bq_cells[pos & queue->bq_mask];
+
+    objs[x] = cell->qc_data;
+    __atomic_store_n(&cell->qc_seq, pos + queue->bq_mask + 1, __ATOMIC_RELEASE);
+  }
+
+  if (got)
+    queue_wake(&queue->bq_deqevent, &queue->bq_enqwaiters, got);
+
+  BK_RETURN(B, got);
+}
+
+
+
+/**
+ * Add an object to a queue
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B Baka global thread environment
+ * @param queue Queue
+ * @param obj Object to add (NULL is a legal object)
+ * @param flags BK_QUEUE_WAIT (threaded only)
+ * @return <i>-1</i> on error or closing
  * @return <br><i>0</i> on queue-full waiting impossible
  * @return <br><i>1</i> on success
  */
-int bk_ring_write(bk_s B, struct bk_ring *ring, void *opaque, bk_flags flags)
+int bk_queue_enqueue(bk_s B, struct bk_queue *queue, void *obj, bk_flags flags)
+{
+  return(bk_queue_enqueue_batch(B, queue, &obj, 1, flags));
+}
+
+
+
+/**
+ * Remove an object from a queue
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B Baka global thread environment
+ * @param queue Queue
+ * @param objp Copy-out object
+ * @param flags BK_QUEUE_WAIT (threaded only)
+ * @return <i>-1</i> on error, or closing with nothing left
+ * @return <br><i>0</i> on queue-empty waiting impossible
+ * @return <br><i>1</i> on success
+ */
+int bk_queue_dequeue(bk_s B, struct bk_queue *queue, void **objp, bk_flags flags)
+{
+  return(bk_queue_dequeue_batch(B, queue, objp, 1, flags));
+}
+
+
+
+/**
+ * Return approximate number of objects in a queue (other threads may
+ * make answer slightly wrong)
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B Baka global thread environment
+ * @param queue Queue
+ * @param flags 0
+ * @return <i>-1</i> on error
+ * @return <br><i>number of objects in queue</i> on success
+ */
+int bk_queue_length(bk_s B, struct bk_queue *queue, bk_flags flags)
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
-  volatile u_int new;
-  volatile int ret = 1;
+  u_int64_t enqpos, deqpos;
 
-  if (!ring)
+  if (!queue)
   {
     bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
     BK_RETURN(B, -1);
   }
 
-  if (BK_FLAG_ISSET(ring->br_flags, BK_RING_CLOSING))
+  deqpos = __atomic_load_n(&queue->bq_deqpos, __ATOMIC_ACQUIRE);
+  enqpos = __atomic_load_n(&queue->bq_enqpos, __ATOMIC_ACQUIRE);
+
+  // Positions are claimed before cells are filled/emptied; clamp the transients
+  if (enqpos < deqpos)
+    BK_RETURN(B, 0);
+  BK_RETURN(B, MIN(enqpos - deqpos, queue->bq_mask + 1));
+}
+
+
+
+/**
+ * Set up a queue in caller's memory
+ *
+ * @param B Baka global thread environment
+ * @param queue Zeroed queue structure
+ * @param size Minimum capacity
+ * @param flags Fun for the future
+ * @return <i>-1</i> on failure
+ * @return <br><i>0</i> on success
+ */
+static int bk_queue_init(bk_s B, struct bk_queue *queue, u_int size, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  u_int64_t cells = 2;
+  u_int64_t x;
+
+  if (size < 1 || size > (1U << 31))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
     BK_RETURN(B, -1);
+  }
+
+  while (cells < size)
+    cells <<= 1;
+
+  if (!BK_CALLOC_LEN(queue->bq_cells, cells * sizeof(struct queue_cell)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate %llu queue cells: %s\n", (unsigned long long)cells, strerror(errno));
+    BK_RETURN(B, -1);
+  }
+
+  for (x = 0; x < cells; x++)
+    queue->bq_cells[x].qc_seq = x;
+
+  queue->bq_mask = cells - 1;
+  queue->bq_flags = flags & ~BK_QUEUE_CLOSING;
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Tear down a queue set up with bk_queue_init() (but do not free it)
+ *
+ * @param B Baka global thread environment
+ * @param queue Queue
+ * @param flags BK_QUEUE_WAIT
+ */
+static void bk_queue_fini(bk_s B, struct bk_queue *queue, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
 
-#ifdef BK_USING_PTHREADS
-  // <TRICKY>Danger Will Robertson--we can go to sleep while holding this lock!!!</TRICKY>
-  if (BK_FLAG_ISCLEAR(flags, BK_RING_NOLOCK))
-    BK_SIMPLE_LOCK(B, &ring->br_wlock);
-#endif /* BK_USING_PTHREADS */
+  // Let consumers finish, then get everyone off the queue
+  while (BK_FLAG_ISSET(flags, BK_QUEUE_WAIT) && BK_GENERAL_FLAG_ISTHREADON(B) && bk_queue_length(B, queue, 0) > 0)
+  {
+    u_int32_t seen = queue_wait_prepare(&queue->bq_deqevent, &queue->bq_enqwaiters);
+
+    if (bk_queue_length(B, queue, 0) > 0)
+      queue_wait(queue, &queue->bq_deqevent, seen, &queue->bq_enqwaiters);
+    else
+      __atomic_sub_fetch(&queue->bq_enqwaiters, 1, __ATOMIC_RELAXED);
+  }
 
-  // While we can make no forward progress
-  while (!WRITEALLOWED(B, ring))
+  bk_queue_close(B, queue, 0);
+
+  free(queue->bq_cells);
+  queue->bq_cells = NULL;
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Claim a run of up to max producer positions whose cells are free
+ *
+ * @param queue Queue
+ * @param max Most positions wanted
+ * @param posp Copy-out first position claimed
+ * @return <i>0</i> if the queue is full
+ * @return <br><i>positions claimed</i> otherwise
+ */
+static u_int queue_claim_enq(struct bk_queue *queue, u_int max, u_int64_t *posp)
+{
+  u_int64_t pos = __atomic_load_n(&queue->bq_enqpos, __ATOMIC_RELAXED);
+
+  while (1)
   {
-    if (BK_FLAG_ISSET(ring->br_flags, BK_RING_CLOSING))
+    struct queue_cell *cell = &queue->bq_cells[pos & queue->bq_mask];
+    int64_t dif = (int64_t)(__atomic_load_n(&cell->qc_seq, __ATOMIC_ACQUIRE) - pos);
+
+    if (dif == 0)
     {
-      ret = -1;
-      goto unlockexit;
+      u_int run = 1;
+
+      // Extend the claim over following free cells
+      while (run < max && run <= queue->bq_mask &&
+	     __atomic_load_n(&queue->bq_cells[(pos + run) & queue->bq_mask].qc_seq, __ATOMIC_ACQUIRE) == pos + run)
+	run++;
+
+      if (__atomic_compare_exchange_n(&queue->bq_enqpos, &pos, pos + run, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      {
+	*posp = pos;
+	return(run);
+      }
     }
-
-    // Have we been asked to wait/will it be useful
-    if (BK_FLAG_ISCLEAR(flags, BK_RING_WAIT) || !BK_GENERAL_FLAG_ISTHREADON(B))
+    else if (dif < 0)
+    {
+      // Consumer of the previous lap has not emptied it
+      return(0);
+    }
+    else
     {
-      ret = 0;
-      goto unlockexit;
+      // Another producer beat us here
+      pos = __atomic_load_n(&queue->bq_enqpos, __ATOMIC_RELAXED);
     }
+  }
+}
 
-#ifdef BK_USING_PTHREADS
-    BK_SIMPLE_LOCK(B, &ring->br_lock);
 
-    ring->br_writeasleep = 1;
-    pthread_cond_broadcast(&ring->br_cond);	// Ensure noone is accidentially asleep
 
-    /*
-     * <WARNING>Note, there IS a race condition whereby the reader may
-     * consume data from the ring before noticing that we have gone to
-     * sleep, since we intentionally do not lock.  However, it is
-     * assumed that the reader will eventually try to read again and
-     * we will wake up.  Please note that we will NOT ever have both
-     * people sleeping at the same time due to the locks around the
-     * conditions</WARNING>
-     */
+/**
+ * Claim a run of up to max consumer positions whose cells are filled
+ *
+ * @param queue Queue
+ * @param max Most positions wanted
+ * @param posp Copy-out first position claimed
+ * @return <i>0</i> if the queue is empty
+ * @return <br><i>positions claimed</i> otherwise
+ */
+static u_int queue_claim_deq(struct bk_queue *queue, u_int max, u_int64_t *posp)
+{
+  u_int64_t pos = __atomic_load_n(&queue->bq_deqpos, __ATOMIC_RELAXED);
 
-    if (!WRITEALLOWED(B, ring) && BK_FLAG_ISCLEAR(ring->br_flags, BK_RING_CLOSING))
-      pthread_cond_wait(&ring->br_cond, &ring->br_lock);
+  while (1)
+  {
+    struct queue_cell *cell = &queue->bq_cells[pos & queue->bq_mask];
+    int64_t dif = (int64_t)(__atomic_load_n(&cell->qc_seq, __ATOMIC_ACQUIRE) - (pos + 1));
 
-    ring->br_writeasleep = 0;
+    if (dif == 0)
+    {
+      u_int run = 1;
 
-    BK_SIMPLE_UNLOCK(B, &ring->br_lock);
-#endif /* BK_USING_PTHREADS */
+      while (run < max && run <= queue->bq_mask &&
+	     __atomic_load_n(&queue->bq_cells[(pos + run) & queue->bq_mask].qc_seq, __ATOMIC_ACQUIRE) == pos + run + 1)
+	run++;
+
+      if (__atomic_compare_exchange_n(&queue->bq_deqpos, &pos, pos + run, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      {
+	*posp = pos;
+	return(run);
+      }
+    }
+    else if (dif < 0)
+    {
+      // Producer has not filled it yet
+      return(0);
+    }
+    else
+    {
+      pos = __atomic_load_n(&queue->bq_deqpos, __ATOMIC_RELAXED);
+    }
   }
+}
+
+
+
+/**
+ * Count ourselves as a waiter before the last look at the queue.
+ *
+ * The waiter count is raised with a full fence and the other side checks
+ * it after publishing (another full fence), so either our last look sees
+ * its progress or it sees us and bumps the event, which makes the futex
+ * refuse to sleep.  A wakeup cannot be lost.
+ *
+ * @param event Event word we will sleep on
+ * @param waiters Waiter count we join
+ * @return <i>event value to sleep on</i>
+ */
+static inline u_int32_t queue_wait_prepare(u_int32_t *event, u_int32_t *waiters)
+{
+  __atomic_add_fetch(waiters, 1, __ATOMIC_SEQ_CST);
+  return(__atomic_load_n(event, __ATOMIC_SEQ_CST));
+}
 
-  new = HAND_PLUS_ONE(B, ring, ring->br_whand);
 
-  // Please do not reorder these statements Mr. Compiler
-  ring->br_ring[new] = opaque;
-  ring->br_whand = new;
 
-#ifdef BK_USING_PTHREADS
-  if (ring->br_readasleep || !opaque)
-    pthread_cond_broadcast(&ring->br_cond);	// Wake up sleeping reader
-#endif /* BK_USING_PTHREADS */
+/**
+ * Sleep until the other side bumps the event word, then leave the waiter
+ * count.  The sleep is bounded all the same.
+ *
+ * @param queue Queue
+ * @param event Event word to sleep on
+ * @param seen Value from queue_wait_prepare()
+ * @param waiters Waiter count we joined
+ */
+static void queue_wait(struct bk_queue *queue, u_int32_t *event, u_int32_t seen, u_int32_t *waiters)
+{
+  if (!(__atomic_load_n(&queue->bq_flags, __ATOMIC_RELAXED) & BK_QUEUE_CLOSING))
+  {
+#ifdef QUEUE_HAVE_FUTEX
+    struct timespec ts = { 1, 0 };
 
- unlockexit:
-#ifdef BK_USING_PTHREADS
-  if (BK_FLAG_ISCLEAR(flags, BK_RING_NOLOCK))
-    BK_SIMPLE_UNLOCK(B, &ring->br_wlock);
-#endif /* BK_USING_PTHREADS */
+    syscall(SYS_futex, event, FUTEX_WAIT_PRIVATE, seen, &ts, NULL, 0);
+#else /* QUEUE_HAVE_FUTEX */
+    usleep(QUEUE_POLLUS);
+#endif /* QUEUE_HAVE_FUTEX */
+  }
 
-  BK_RETURN(B, ret);
+  __atomic_sub_fetch(waiters, 1, __ATOMIC_RELAXED);
 }
 
 
 
 /**
- * Read from ring buffer
+ * Tell sleepers on the other side that we have made progress.  Costs a
+ * fence and a load unless someone is actually asleep.
  *
- * THREADS: MT-SAFE (unless ring is empty)
- * THREADS: MT-REENTRANT (otherwise)
+ * @param event Event word they sleep on
+ * @param waiters Their waiter count
+ * @param cnt Objects (or cells) we made available
+ */
+static inline void queue_wake(u_int32_t *event, u_int32_t *waiters, u_int cnt)
+{
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (!__atomic_load_n(waiters, __ATOMIC_RELAXED))
+    return;
+
+  __atomic_add_fetch(event, 1, __ATOMIC_SEQ_CST);
+#ifdef QUEUE_HAVE_FUTEX
+  syscall(SYS_futex, event, FUTEX_WAKE_PRIVATE, BK_MIN(cnt, INT_MAX), NULL, NULL, 0);
+#endif /* QUEUE_HAVE_FUTEX */
+}
+
+
+
+/**
+ * Create a ring buffer.
  *
- * @param B Baka global thread environment
- * @param ring Ring buffer
- * @param flags BK_RING_WAIT (threaded only)
- * @return <i>NULL</i> on error or queue-empty waiting impossible
- * @return <br><i>object</i> on success
+ * Compatibility interface to bk_queue; the ring holds at least size-1
+ * objects (the old guarantee), rounded up to a power of two.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state.
+ *	@param size Maximum size of ring buffer
+ *	@param flags Flags Fun for the future
+ *	@return <i>NULL</i> on failure.<br>
+ *	@return <br><i>Ring structure</i> on success.
  */
-volatile void *bk_ring_read(bk_s B, struct bk_ring *ring, bk_flags flags)
+struct bk_ring *bk_ring_create(bk_s B, u_int size, bk_flags flags)
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
-  volatile u_int new;
-  volatile void *ret = NULL;
+  struct bk_ring *ring;
 
-  if (!ring)
+  if (size < 1)
   {
     bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
     BK_RETURN(B, NULL);
   }
 
-#ifdef BK_USING_PTHREADS
-  // <TRICKY>Danger Will Robertson--we can go to sleep while holding this lock!!!</TRICKY>
-  if (BK_FLAG_ISCLEAR(flags, BK_RING_NOLOCK))
-    BK_SIMPLE_LOCK(B, &ring->br_rlock);
-#endif /* BK_USING_PTHREADS */
+  if (!BK_CALLOC(ring))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not create ring structure: %s\n", strerror(errno));
+    BK_RETURN(B, NULL);
+  }
 
-  // While we can make no forward progress
-  while (!READALLOWED(B, ring))
+  if (bk_queue_init(B, &ring->br_queue, size, flags) < 0)
   {
-    // If we can be in this situation, we have major race problems...user must communicate shutdown
-    if (BK_FLAG_ISSET(ring->br_flags, BK_RING_CLOSING))
-      goto unlockexit;
+    free(ring);
+    BK_RETURN(B, NULL);
+  }
+
+  BK_RETURN(B, ring);
+}
 
-    // Have we been asked to wait/will it be useful
-    if (BK_FLAG_ISCLEAR(flags, BK_RING_WAIT) || !BK_GENERAL_FLAG_ISTHREADON(B))
-      goto unlockexit;
 
-#ifdef BK_USING_PTHREADS
-    BK_SIMPLE_LOCK(B, &ring->br_lock);
 
-    ring->br_readasleep = 1;
-    pthread_cond_broadcast(&ring->br_cond);	// Ensure noone is accidentially asleep
+/**
+ * Destroy a ring buffer
+ *
+ * THREADS: REENTRANT
+ *
+ * @param B BAKA thread/global environment
+ * @param ring Ring buffer
+ * @param flags BK_RING_WAIT
+ */
+void bk_ring_destroy(bk_s B, struct bk_ring *ring, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!ring)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_VRETURN(B);
+  }
 
-    /*
-     * <WARNING>Note, there IS a race condition whereby the reader may
-     * write data to the ring before noticing that we have gone to
-     * sleep, since we intentionally do not lock.  However, it is
-     * assumed that the write will eventually try to write again and
-     * we will wake up.  Please note that we will NOT ever have both
-     * people sleeping at the same time due to the locks around the
-     * conditions.  This might be a problem with EOF processing...</WARNING>
-     */
+  bk_queue_fini(B, &ring->br_queue, BK_FLAG_ISSET(flags, BK_RING_WAIT)?BK_QUEUE_WAIT:0);
+  free(ring);
+
+  BK_VRETURN(B);
+}
 
-    if (!READALLOWED(B, ring) && BK_FLAG_ISCLEAR(ring->br_flags, BK_RING_CLOSING))
-      pthread_cond_wait(&ring->br_cond, &ring->br_lock);
 
-    ring->br_readasleep = 0;
 
-    BK_SIMPLE_UNLOCK(B, &ring->br_lock);
-#endif /* BK_USING_PTHREADS */
+/**
+ * Write to ring buffer
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B Baka global thread environment
+ * @param ring Ring buffer
+ * @param opaque Object to add
+ * @param flags BK_RING_WAIT (threaded only), BK_RING_NOLOCK (ignored; never locks)
+ * @return <i>-1</i> on error
+ * @return <br><i>0</i> on queue-full waiting impossible
+ * @return <br><i>1</i> on success
+ */
+int bk_ring_write(bk_s B, struct bk_ring *ring, void *opaque, bk_flags flags)
+{
+  if (!ring)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    return(-1);
   }
 
-  new = HAND_PLUS_ONE(B, ring, ring->br_rhand);
+  return(bk_queue_enqueue_batch(B, &ring->br_queue, &opaque, 1, BK_FLAG_ISSET(flags, BK_RING_WAIT)?BK_QUEUE_WAIT:0));
+}
+
+
 
-  // Please do not reorder these statements Mr. Compiler
-  ret = ring->br_ring[new];
-  ring->br_ring[new] = (void *)&deadbeef;	// Invalid value
-  ring->br_rhand = new;
+/**
+ * Read from ring buffer
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B Baka global thread environment
+ * @param ring Ring buffer
+ * @param flags BK_RING_WAIT (threaded only), BK_RING_NOLOCK (ignored; never locks)
+ * @return <i>NULL</i> on error or queue-empty waiting impossible
+ * @return <br><i>object</i> on success
+ */
+volatile void *bk_ring_read(bk_s B, struct bk_ring *ring, bk_flags flags)
+{
+  void *ret = NULL;
 
-#ifdef BK_USING_PTHREADS
-  if (ring->br_writeasleep || BK_FLAG_ISSET(ring->br_flags, BK_RING_CLOSING) || !ret)
-    pthread_cond_broadcast(&ring->br_cond);	// Wake up sleeping write, or if we are closing
-#endif /* BK_USING_PTHREADS */
+  if (!ring)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    return(NULL);
+  }
 
- unlockexit:
-#ifdef BK_USING_PTHREADS
-  if (BK_FLAG_ISCLEAR(flags, BK_RING_NOLOCK))
-    BK_SIMPLE_UNLOCK(B, &ring->br_rlock);
-#endif /* BK_USING_PTHREADS */
+  if (bk_queue_dequeue_batch(B, &ring->br_queue, &ret, 1, BK_FLAG_ISSET(flags, BK_RING_WAIT)?BK_QUEUE_WAIT:0) != 1)
+    return(NULL);
 
-  BK_RETURN(B, ret);
+  return(ret);
 }
 
 
@@ -364,20 +813,11 @@ volatile void *bk_ring_read(bk_s B, struct bk_ring *ring, bk_flags flags)
  */
 int bk_ring_length(bk_s B, struct bk_ring *ring, bk_flags flags)
 {
-  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
-  u_int rhand, whand;
-
   if (!ring)
   {
     bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
-    BK_RETURN(B, -1);
+    return(-1);
   }
 
-  rhand = ring->br_rhand;
-  whand = ring->br_whand;
-
-  if (whand < rhand)
-    whand += ring->br_size;
-
-  BK_RETURN(B, whand - rhand);
+  return(bk_queue_length(B, &ring->br_queue, flags));
 }
@@ -214,6 +214,11 @@ struct bk_run_ondemand_func
 
 
 
+static struct bk_pool *equeue_pool = NULL;	///< Event queue structure pool
+#define EQUEUE_POOL(B) BK_POOL_STATIC((B), equeue_pool, "run_event", sizeof(struct br_equeue))
+
+
+
 static int bk_run_event_comparator(struct br_equeue *a, struct br_equeue *b);
 static void bk_run_event_cron(bk_s B, struct bk_run *run, void *opaque, const struct timeval starttime, bk_flags flags);
 static int bk_run_checkeventq(bk_s B, struct bk_run *run, struct timeval *starttime, struct timeval *delta, u_int *event_cntp);
@@ -505,7 +510,7 @@ void bk_run_destroy(bk_s B, struct bk_run *run)
     while (cur = pq_extract_head(run->br_equeue))
     {
       bk_run_runevent(B, run, cur->bre_event, cur->bre_opaque, &curtime, BK_RUN_DESTROY, cur->bre_flags);
-      free(cur);
+      bk_pool_free(B, equeue_pool, cur);
     }
   }
 
@@ -720,7 +725,7 @@ int bk_run_enqueue(bk_s B, struct bk_run *run, struct timeval when, void (*event
     BK_RETURN(B, -1);
   }
 
-  if (!(new = malloc(sizeof(*new))))
+  if (!(new = bk_pool_alloc(B, EQUEUE_POOL(B), 0)))
   {
     bk_error_printf(B, BK_ERR_ERR, "Could not allocate event queue structure: %s\n",strerror(errno));
     BK_RETURN(B, -1);
@@ -765,7 +770,7 @@ int bk_run_enqueue(bk_s B, struct bk_run *run, struct timeval when, void (*event
     abort();
 #endif /* BK_USING_PTHREADS */
 
-  if (new) free(new);
+  if (new) bk_pool_free(B, equeue_pool, new);
   BK_RETURN(B, -1);
 }
 
@@ -939,7 +944,7 @@ int bk_run_dequeue(bk_s B, struct bk_run *run, void *handle, bk_flags flags)
 #endif /* BK_USING_PTHREADS */
 
 
-  free(bre);
+  bk_pool_free(B, equeue_pool, bre);
 
   BK_RETURN(B, 0);
 }
@@ -2272,7 +2277,7 @@ static void bk_run_event_cron(bk_s B, struct bk_run *run, void *opaque, const st
       // Someone (partially) deleted us...finish up
       pthread_cond_broadcast(&brec->brec_cond);
       pq_delete(run->br_equeue, brec->brec_equeue);
-      free(brec->brec_equeue);
+      bk_pool_free(B, equeue_pool, brec->brec_equeue);
       pthread_cond_destroy(&brec->brec_cond);
       free(brec);
     }
@@ -2524,7 +2529,7 @@ static int bk_run_checkeventq(bk_s B, struct bk_run *run, struct timeval *startt
 #endif /* BK_USING_PTHREADS */
 
     bk_run_runevent(B, run, top->bre_event, top->bre_opaque, starttime, 0, top->bre_flags);
-    free(top);
+    bk_pool_free(B, equeue_pool, top);
     event_cnt++;
 
 #ifdef BK_USING_PTHREADS
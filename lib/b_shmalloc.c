@@ -0,0 +1,713 @@
+#if !defined(lint)
+static const char libbk__copyright[] = "Copyright © 2011";
+static const char libbk__contact[] = "<projectbaka@baka.org>";
+#endif /* not lint */
+/*
+ * ++Copyright BAKA++
+ *
+ * Copyright © 2011 The Authors. All rights reserved.
+ *
+ * This source code is licensed to you under the terms of the file
+ * LICENSE.TXT in this release for further details.
+ *
+ * Send e-mail to <projectbaka@baka.org> for further information.
+ *
+ * - -Copyright BAKA- -
+ */
+
+/**
+ * @file
+ *
+ * Lock-free allocator inside the user region of a bk_shmmap segment.
+ *
+ * Everything is addressed by offset from the start of the segment so the
+ * same bk_shmoff_t means the same thing in every process, whatever address
+ * the segment is mapped at.  Blocks come in fixed size classes.  Each class
+ * has a global free list (a Treiber stack whose head carries a generation
+ * tag against ABA) and every sh_client[] slot, plus one for the creator,
+ * has a private cache per class so most alloc/free pairs touch no shared
+ * cache lines.  Fresh memory is carved off a shared bump pointer in
+ * batches.
+ *
+ * A client which dies holding blocks in its cache does not leak them:
+ * bk_shmalloc_reclaim() (run by bk_shmmap_manage()) returns the caches of
+ * empty/closed slots and of slots whose process no longer exists to the
+ * global lists.  Blocks a dead client had allocated are still referenced
+ * from wherever it put them, and are the application's to free.
+ */
+
+#include <libbk.h>
+
+
+
+#define SHMALLOC_MAGIC		0x626b7361		///< "bksa"--allocator initialized
+#define SHMALLOC_UNIT		16			///< Allocation granularity (and offset unit)
+#define SHMALLOC_CACHEBYTES	16384			///< Approximate bytes a cache holds per class before spilling
+#define SHMALLOC_MAXBATCH	32			///< Most blocks moved between cache and global list at once
+#define SHMALLOC_BLOCK_ALLOC	0xa110c8ed		///< Block header magic while allocated
+#define SHMALLOC_BLOCK_FREE	0xf7eeb10c		///< Block header magic while free
+#define SHMALLOC_CACHELINE	64			///< Keep hot shared words apart
+
+
+
+/**
+ * Block sizes, including the block header.  All multiples of SHMALLOC_UNIT.
+ */
+static const u_int32_t shmalloc_classes[] =
+{
+  32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512, 640, 768, 1024,
+  1280, 1536, 2048, 2560, 3072, 4096, 5120, 6144, 8192, 10240, 12288, 16384,
+  24576, 32768, 49152, 65536, 98304, 131072, 196608, 262144, 393216, 524288,
+  786432, 1048576,
+};
+#define SHMALLOC_NCLASSES	(sizeof(shmalloc_classes)/sizeof(shmalloc_classes[0]))
+
+
+
+/**
+ * Header in front of every block
+ */
+struct shmalloc_block
+{
+  u_int32_t		bb_magic;		///< SHMALLOC_BLOCK_ALLOC or SHMALLOC_BLOCK_FREE
+  u_int16_t		bb_class;		///< Size class
+  u_int16_t		bb_slot;		///< Slot which last allocated it (debugging)
+  u_int32_t		bb_next;		///< Next free block (units) while on a list
+  u_int32_t		bb_pad;			///< Keep user data SHMALLOC_UNIT aligned
+};
+
+
+
+/**
+ * Per slot, per class cache--only touched by the slot's owner (or by
+ * reclaim once the owner is gone)
+ */
+struct shmalloc_cache
+{
+  u_int32_t		sc_head;		///< First cached block (units)
+  u_int32_t		sc_count;		///< Number of cached blocks
+};
+
+
+
+/**
+ * Global free list head, alone on its cache line
+ */
+struct shmalloc_freelist
+{
+  u_int64_t		sf_head;		///< Generation<<32 | first free block (units)
+  char			sf_pad[SHMALLOC_CACHELINE - sizeof(u_int64_t)];
+};
+
+
+
+/**
+ * Allocator state at the start of the shmmap user region
+ */
+struct shmalloc_header
+{
+  u_int32_t		ah_magic;		///< SHMALLOC_MAGIC once usable
+  u_int32_t		ah_nslots;		///< Client slots plus one for the creator
+  u_int64_t		ah_end;			///< End of carvable memory (units)
+  bk_shmoff_t		ah_root[BK_SHMALLOC_NROOTS];	///< Application rendezvous offsets
+  char			ah_pad[SHMALLOC_CACHELINE];	///< Keep bump pointer off the read-mostly line
+  u_int64_t		ah_bump;		///< Next uncarved memory (units)
+  char			ah_pad2[SHMALLOC_CACHELINE - sizeof(u_int64_t)];
+  struct shmalloc_freelist ah_free[SHMALLOC_NCLASSES];	///< Global free lists
+  struct shmalloc_cache	ah_cache[];		///< ah_nslots * SHMALLOC_NCLASSES caches
+};
+
+
+
+/**
+ * One process's handle on the allocator
+ */
+struct bk_shmalloc
+{
+  struct bk_shmmap     *sa_shmmap;		///< Segment we allocate in
+  struct shmalloc_header *sa_hdr;		///< Allocator state in segment
+  struct shmalloc_cache *sa_cache;		///< Our slot's caches
+  u_int			sa_slot;		///< Our slot
+#ifdef BK_USING_PTHREADS
+  pthread_mutex_t	sa_lock;		///< Threads in this process share the slot's caches
+#endif /* BK_USING_PTHREADS */
+};
+
+
+
+#define UNIT2BLOCK(sm, u) ((struct shmalloc_block *)((char *)(sm)->sm_addr + (u_int64_t)(u) * SHMALLOC_UNIT))
+#define BLOCK2UNIT(sm, b) ((u_int32_t)(((char *)(b) - (char *)(sm)->sm_addr) / SHMALLOC_UNIT))
+
+
+
+static int shmalloc_class(size_t size);
+static u_int32_t shmalloc_pop(struct bk_shmmap *shmmap, struct shmalloc_freelist *fl);
+static void shmalloc_push(struct bk_shmmap *shmmap, struct shmalloc_freelist *fl, u_int32_t first, u_int32_t last);
+static u_int32_t shmalloc_carve(struct bk_shmmap *shmmap, struct shmalloc_header *ah, int class, u_int want, struct shmalloc_cache *cache);
+static void shmalloc_spill(struct bk_shmmap *shmmap, struct shmalloc_header *ah, int class, struct shmalloc_cache *cache, u_int keep);
+static u_int shmalloc_batch(int class);
+
+
+
+/**
+ * Set up (creator) or join (client) the allocator in a shmmap segment's
+ * user region.  The creator must do this before clients try to join.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state.
+ *	@param shmmap Shared memory map from bk_shmmap_create() or bk_shmmap_attach()
+ *	@param flags BK_SHMALLOC_RESET (creator) to discard an existing allocator
+ *	@return <i>NULL</i> on failure (including clients arriving before the creator initialized it).<br>
+ *	@return <br><i>allocator handle</i> on success.
+ */
+struct bk_shmalloc *bk_shmalloc_init(bk_s B, struct bk_shmmap *shmmap, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_shmalloc *sa = NULL;
+  struct shmalloc_header *ah;
+  u_int nslots;
+  u_int64_t start;
+
+  if (!shmmap || !shmmap->sm_addr)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, NULL);
+  }
+
+  ah = shmmap->sm_addr->sh_user;
+  nslots = shmmap->sm_addr->sh_numclients + 1;
+
+  if (!shmmap->sm_userbucket)
+  {
+    // Creator
+    if (ah->ah_magic == SHMALLOC_MAGIC && BK_FLAG_ISCLEAR(flags, BK_SHMALLOC_RESET))
+      goto join;
+
+    start = (char *)&ah->ah_cache[nslots * SHMALLOC_NCLASSES] - (char *)shmmap->sm_addr;
+    start = (start + SHMALLOC_CACHELINE - 1) & ~(u_int64_t)(SHMALLOC_CACHELINE - 1);
+
+    if (start >= (u_int64_t)shmmap->sm_addr->sh_size || (u_int64_t)shmmap->sm_addr->sh_size / SHMALLOC_UNIT > UINT32_MAX)
+    {
+      bk_error_printf(B, BK_ERR_ERR, "shmmap user region cannot hold an allocator (%lld bytes)\n", (long long)shmmap->sm_addr->sh_usersize);
+      BK_RETURN(B, NULL);
+    }
+
+    __atomic_store_n(&ah->ah_magic, 0, __ATOMIC_RELAXED);
+    memset((char *)ah + sizeof(ah->ah_magic), 0, start - ((char *)ah - (char *)shmmap->sm_addr) - sizeof(ah->ah_magic));
+    ah->ah_nslots = nslots;
+    ah->ah_bump = start / SHMALLOC_UNIT;
+    ah->ah_end = (u_int64_t)shmmap->sm_addr->sh_size / SHMALLOC_UNIT;
+    __atomic_store_n(&ah->ah_magic, SHMALLOC_MAGIC, __ATOMIC_RELEASE);
+  }
+  else if (__atomic_load_n(&ah->ah_magic, __ATOMIC_ACQUIRE) != SHMALLOC_MAGIC)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "shmmap creator has not set up an allocator\n");
+    BK_RETURN(B, NULL);
+  }
+
+ join:
+  if (ah->ah_nslots != nslots)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "shmmap allocator slot count %u does not match segment (%u)\n", ah->ah_nslots, nslots);
+    BK_RETURN(B, NULL);
+  }
+
+  if (!BK_CALLOC(sa))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate shmalloc handle: %s\n", strerror(errno));
+    BK_RETURN(B, NULL);
+  }
+
+  sa->sa_shmmap = shmmap;
+  sa->sa_hdr = ah;
+  sa->sa_slot = shmmap->sm_userbucket ? (u_int)(shmmap->sm_userbucket - shmmap->sm_addr->sh_client) : nslots - 1;
+  sa->sa_cache = &ah->ah_cache[sa->sa_slot * SHMALLOC_NCLASSES];
+#ifdef BK_USING_PTHREADS
+  pthread_mutex_init(&sa->sa_lock, NULL);
+#endif /* BK_USING_PTHREADS */
+
+  BK_RETURN(B, sa);
+}
+
+
+
+/**
+ * Give up an allocator handle, returning our cached blocks to the global
+ * lists.  Call before bk_shmmap_destroy().  Blocks still allocated stay
+ * allocated.
+ *
+ * THREADS: REENTRANT
+ *
+ *	@param B BAKA thread/global state.
+ *	@param sa Allocator handle
+ *	@param flags Fun for the future
+ */
+void bk_shmalloc_destroy(bk_s B, struct bk_shmalloc *sa, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  u_int class;
+
+  if (!sa)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_VRETURN(B);
+  }
+
+  for (class = 0; class < SHMALLOC_NCLASSES; class++)
+    shmalloc_spill(sa->sa_shmmap, sa->sa_hdr, class, &sa->sa_cache[class], 0);
+
+#ifdef BK_USING_PTHREADS
+  pthread_mutex_destroy(&sa->sa_lock);
+#endif /* BK_USING_PTHREADS */
+  free(sa);
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Allocate a block in the shared segment
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state.
+ *	@param sa Allocator handle
+ *	@param size Bytes wanted
+ *	@param flags BK_SHMALLOC_ZERO to clear the block
+ *	@return <i>BK_SHMOFF_NULL</i> on failure (including segment exhausted).<br>
+ *	@return <br><i>offset of block from segment start</i> on success.
+ */
+bk_shmoff_t bk_shmalloc_alloc(bk_s B, struct bk_shmalloc *sa, size_t size, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct shmalloc_cache *cache;
+  struct shmalloc_block *block;
+  u_int32_t unit;
+  int class;
+
+  if (!sa || !size)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, BK_SHMOFF_NULL);
+  }
+
+  if ((class = shmalloc_class(size)) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "%zu bytes is larger than the largest shmalloc block\n", size);
+    BK_RETURN(B, BK_SHMOFF_NULL);
+  }
+
+  cache = &sa->sa_cache[class];
+
+  BK_SIMPLE_LOCK(B, &sa->sa_lock);
+
+  if (!cache->sc_count)
+  {
+    u_int batch = shmalloc_batch(class);
+    u_int got;
+
+    // Refill from the global list, then from virgin memory
+    for (got = 0; got < batch && (unit = shmalloc_pop(sa->sa_shmmap, &sa->sa_hdr->ah_free[class])); got++)
+    {
+      UNIT2BLOCK(sa->sa_shmmap, unit)->bb_next = cache->sc_head;
+      cache->sc_head = unit;
+      cache->sc_count++;
+    }
+
+    if (!got)
+      shmalloc_carve(sa->sa_shmmap, sa->sa_hdr, class, batch, cache);
+  }
+
+  if (!cache->sc_count)
+  {
+    BK_SIMPLE_UNLOCK(B, &sa->sa_lock);
+    bk_error_printf(B, BK_ERR_WARN, "shmmap segment exhausted allocating %zu bytes\n", size);
+    BK_RETURN(B, BK_SHMOFF_NULL);
+  }
+
+  unit = cache->sc_head;
+  block = UNIT2BLOCK(sa->sa_shmmap, unit);
+  cache->sc_head = block->bb_next;
+  cache->sc_count--;
+
+  BK_SIMPLE_UNLOCK(B, &sa->sa_lock);
+
+  if (block->bb_magic != SHMALLOC_BLOCK_FREE || block->bb_class != class)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "shmalloc free list corrupted at offset %llu\n", (unsigned long long)unit * SHMALLOC_UNIT);
+    BK_RETURN(B, BK_SHMOFF_NULL);
+  }
+
+  block->bb_magic = SHMALLOC_BLOCK_ALLOC;
+  block->bb_slot = sa->sa_slot;
+  block->bb_next = 0;
+
+  if (BK_FLAG_ISSET(flags, BK_SHMALLOC_ZERO))
+    memset(block + 1, 0, shmalloc_classes[class] - sizeof(*block));
+
+  BK_RETURN(B, (bk_shmoff_t)unit * SHMALLOC_UNIT + sizeof(*block));
+}
+
+
+
+/**
+ * Free a block allocated (by any process) with bk_shmalloc_alloc()
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state.
+ *	@param sa Allocator handle
+ *	@param off Block offset (BK_SHMOFF_NULL is ignored)
+ *	@param flags Fun for the future
+ */
+void bk_shmalloc_free(bk_s B, struct bk_shmalloc *sa, bk_shmoff_t off, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct shmalloc_cache *cache;
+  struct shmalloc_block *block;
+  u_int class;
+
+  if (!sa)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_VRETURN(B);
+  }
+
+  if (off == BK_SHMOFF_NULL)
+    BK_VRETURN(B);
+
+  if (off % SHMALLOC_UNIT || off < sizeof(struct shmalloc_block) || off / SHMALLOC_UNIT >= sa->sa_hdr->ah_end ||
+      (block = (struct shmalloc_block *)((char *)sa->sa_shmmap->sm_addr + off) - 1)->bb_magic != SHMALLOC_BLOCK_ALLOC ||
+      block->bb_class >= SHMALLOC_NCLASSES)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Freeing offset %llu which is not an allocated shmalloc block\n", (unsigned long long)off);
+    BK_VRETURN(B);
+  }
+
+  class = block->bb_class;
+  cache = &sa->sa_cache[class];
+  block->bb_magic = SHMALLOC_BLOCK_FREE;
+
+  BK_SIMPLE_LOCK(B, &sa->sa_lock);
+
+  block->bb_next = cache->sc_head;
+  cache->sc_head = BLOCK2UNIT(sa->sa_shmmap, block);
+  cache->sc_count++;
+
+  // Hand a batch back once we are holding two
+  if (cache->sc_count >= 2 * shmalloc_batch(class))
+    shmalloc_spill(sa->sa_shmmap, sa->sa_hdr, class, cache, shmalloc_batch(class));
+
+  BK_SIMPLE_UNLOCK(B, &sa->sa_lock);
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Find one of the application rendezvous offsets kept in the allocator
+ * header, where the creator leaves the roots of its shared structures for
+ * clients to find.  Update it with the BK_SHMOFF_* atomics.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state.
+ *	@param sa Allocator handle
+ *	@param which Root number, less than BK_SHMALLOC_NROOTS
+ *	@return <i>NULL</i> on failure.<br>
+ *	@return <br><i>pointer to root offset</i> on success.
+ */
+bk_shmoff_t *bk_shmalloc_root(bk_s B, struct bk_shmalloc *sa, u_int which)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!sa || which >= BK_SHMALLOC_NROOTS)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, NULL);
+  }
+
+  BK_RETURN(B, &sa->sa_hdr->ah_root[which]);
+}
+
+
+
+/**
+ * Return cached blocks of departed clients to the global free lists.  A
+ * slot is departed if it is empty or closed, or if its process is gone
+ * (crashed without detaching).  Each such slot is held in the RECLAIM
+ * state while its cache drains, so no client can attach into it
+ * meanwhile.  Run by the creator; bk_shmmap_manage() calls this on every
+ * pass.
+ *
+ * THREADS: THREAD-REENTRANT (one reclaimer per segment)
+ *
+ *	@param B BAKA thread/global state.
+ *	@param shmmap Shared memory map (creator)
+ *	@param flags Fun for the future
+ *	@return <i>number of blocks reclaimed</i>
+ */
+u_int bk_shmalloc_reclaim(bk_s B, struct bk_shmmap *shmmap, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct shmalloc_header *ah;
+  u_int reclaimed = 0;
+  u_int slot, class;
+
+  if (!shmmap || !shmmap->sm_addr)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, 0);
+  }
+
+  // Most segments have no allocator; be sure this is not just user data
+  ah = shmmap->sm_addr->sh_user;
+  if (__atomic_load_n(&ah->ah_magic, __ATOMIC_ACQUIRE) != SHMALLOC_MAGIC || ah->ah_nslots != shmmap->sm_addr->sh_numclients + 1u ||
+      ah->ah_end != (u_int64_t)shmmap->sm_addr->sh_size / SHMALLOC_UNIT)
+    BK_RETURN(B, 0);
+
+  // Creator's own slot (the last) is never departed
+  for (slot = 0; slot < ah->ah_nslots - 1; slot++)
+  {
+    struct bk_shmmap_client *client = &shmmap->sm_addr->sh_client[slot];
+    struct shmalloc_cache *cache = &ah->ah_cache[slot * SHMALLOC_NCLASSES];
+    u_short state = __atomic_load_n(&client->su_state, __ATOMIC_ACQUIRE);
+
+    switch (state)
+    {
+    case BK_SHMMAP_USER_STATEEMPTY:
+    case BK_SHMMAP_USER_STATECLOSE:
+      break;
+    case BK_SHMMAP_USER_STATERECLAIM:
+      continue;
+    default:
+      if (!client->su_pid || kill(client->su_pid, 0) == 0 || errno != ESRCH)
+	continue;
+      break;
+    }
+
+    // Claim the slot so nobody can attach into it and allocate while it drains
+    if (!__atomic_compare_exchange_n(&client->su_state, &state, BK_SHMMAP_USER_STATERECLAIM, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      continue;
+
+    for (class = 0; class < SHMALLOC_NCLASSES; class++)
+    {
+      u_int32_t unit = cache[class].sc_head;
+      u_int32_t count = 0;
+
+      if (!cache[class].sc_count)
+	continue;
+
+      /*
+       * The client may have died part way through changing its cache, so
+       * trust only the links that check out and leak the rest.
+       */
+      while (unit && unit < ah->ah_end && count < cache[class].sc_count)
+      {
+	struct shmalloc_block *block = UNIT2BLOCK(shmmap, unit);
+	u_int32_t next = block->bb_next;
+
+	if (block->bb_magic != SHMALLOC_BLOCK_FREE || block->bb_class != class)
+	  break;
+	shmalloc_push(shmmap, &ah->ah_free[class], unit, unit);
+	count++;
+	unit = next;
+      }
+
+      if (count != cache[class].sc_count)
+	bk_error_printf(B, BK_ERR_WARN, "Leaked %u shmalloc blocks from slot %u cache\n", cache[class].sc_count - count, slot);
+
+      cache[class].sc_head = 0;
+      cache[class].sc_count = 0;
+      reclaimed += count;
+    }
+
+    // Hand the slot back as it was
+    __atomic_store_n(&client->su_state, state, __ATOMIC_RELEASE);
+  }
+
+  if (reclaimed)
+    bk_error_printf(B, BK_ERR_NOTICE, "Reclaimed %u shmalloc blocks from departed clients\n", reclaimed);
+
+  BK_RETURN(B, reclaimed);
+}
+
+
+
+/**
+ * Smallest class holding size user bytes
+ *
+ *	@param size User bytes
+ *	@return <i>-1</i> if too big
+ *	@return <br><i>class</i> otherwise
+ */
+static int shmalloc_class(size_t size)
+{
+  u_int lo = 0, hi = SHMALLOC_NCLASSES;
+
+  if (size > shmalloc_classes[SHMALLOC_NCLASSES - 1] - sizeof(struct shmalloc_block))
+    return(-1);
+
+  size += sizeof(struct shmalloc_block);
+  while (lo < hi)
+  {
+    u_int mid = (lo + hi) / 2;
+
+    if (shmalloc_classes[mid] < size)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return(lo);
+}
+
+
+
+/**
+ * How many blocks of a class move between cache and global list at once
+ *
+ *	@param class Size class
+ *	@return <i>batch size</i>
+ */
+static u_int shmalloc_batch(int class)
+{
+  u_int batch = SHMALLOC_CACHEBYTES / shmalloc_classes[class];
+
+  return(MAX(1, MIN(batch, SHMALLOC_MAXBATCH)));
+}
+
+
+
+/**
+ * Pop one block from a global free list
+ *
+ *	@param shmmap Segment
+ *	@param fl Free list
+ *	@return <i>0</i> if empty
+ *	@return <br><i>block unit offset</i> otherwise
+ */
+static u_int32_t shmalloc_pop(struct bk_shmmap *shmmap, struct shmalloc_freelist *fl)
+{
+  u_int64_t head = __atomic_load_n(&fl->sf_head, __ATOMIC_ACQUIRE);
+  u_int64_t newhead;
+
+  do
+  {
+    u_int32_t unit = (u_int32_t)head;
+
+    if (!unit)
+      return(0);
+
+    // The block may be popped and reused under us; the tag makes the CAS fail if so
+    newhead = ((head >> 32) + 1) << 32 | __atomic_load_n(&UNIT2BLOCK(shmmap, unit)->bb_next, __ATOMIC_RELAXED);
+  } while (!__atomic_compare_exchange_n(&fl->sf_head, &head, newhead, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+  return((u_int32_t)head);
+}
+
+
+
+/**
+ * Push an already linked chain of blocks onto a global free list
+ *
+ *	@param shmmap Segment
+ *	@param fl Free list
+ *	@param first First block of chain (units)
+ *	@param last Last block of chain (units)--its link is overwritten
+ */
+static void shmalloc_push(struct bk_shmmap *shmmap, struct shmalloc_freelist *fl, u_int32_t first, u_int32_t last)
+{
+  u_int64_t head = __atomic_load_n(&fl->sf_head, __ATOMIC_RELAXED);
+  u_int64_t newhead;
+
+  do
+  {
+    __atomic_store_n(&UNIT2BLOCK(shmmap, last)->bb_next, (u_int32_t)head, __ATOMIC_RELAXED);
+    newhead = ((head >> 32) + 1) << 32 | first;
+  } while (!__atomic_compare_exchange_n(&fl->sf_head, &head, newhead, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+
+
+/**
+ * Carve up to want fresh blocks off the bump pointer into a cache
+ *
+ *	@param shmmap Segment
+ *	@param ah Allocator header
+ *	@param class Size class
+ *	@param want Blocks wanted
+ *	@param cache Cache to fill
+ *	@return <i>blocks carved</i>
+ */
+static u_int32_t shmalloc_carve(struct bk_shmmap *shmmap, struct shmalloc_header *ah, int class, u_int want, struct shmalloc_cache *cache)
+{
+  u_int32_t units = shmalloc_classes[class] / SHMALLOC_UNIT;
+  u_int64_t bump = __atomic_load_n(&ah->ah_bump, __ATOMIC_RELAXED);
+  u_int got;
+
+  do
+  {
+    got = MIN(want, (ah->ah_end - bump) / units);
+    if (!got)
+      return(0);
+  } while (!__atomic_compare_exchange_n(&ah->ah_bump, &bump, bump + (u_int64_t)got * units, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  for (want = 0; want < got; want++)
+  {
+    struct shmalloc_block *block = UNIT2BLOCK(shmmap, bump);
+
+    block->bb_magic = SHMALLOC_BLOCK_FREE;
+    block->bb_class = class;
+    block->bb_next = cache->sc_head;
+    cache->sc_head = bump;
+    cache->sc_count++;
+    bump += units;
+  }
+
+  return(got);
+}
+
+
+
+/**
+ * Move all but keep blocks of a cache to the global free list
+ *
+ *	@param shmmap Segment
+ *	@param ah Allocator header
+ *	@param class Size class
+ *	@param cache Cache to drain
+ *	@param keep Blocks to leave cached
+ */
+static void shmalloc_spill(struct bk_shmmap *shmmap, struct shmalloc_header *ah, int class, struct shmalloc_cache *cache, u_int keep)
+{
+  u_int32_t first, last;
+  u_int n;
+
+  if (cache->sc_count <= keep)
+    return;
+
+  // Keep the most recently freed (cache warm) blocks at the head
+  last = cache->sc_head;
+  for (n = 1; n < keep; n++)
+    last = UNIT2BLOCK(shmmap, last)->bb_next;
+
+  if (keep)
+  {
+    first = UNIT2BLOCK(shmmap, last)->bb_next;
+    UNIT2BLOCK(shmmap, last)->bb_next = 0;
+  }
+  else
+  {
+    first = cache->sc_head;
+    cache->sc_head = 0;
+  }
+
+  for (last = first, n = 1; n < cache->sc_count - keep; n++)
+    last = UNIT2BLOCK(shmmap, last)->bb_next;
+
+  shmalloc_push(shmmap, &ah->ah_free[class], first, last);
+  cache->sc_count = keep;
+}
@@ -20,49 +20,95 @@ static const char libbk__contact[] = "<projectbaka@baka.org>";
  *
  * Implementation of shared memory IPC
  *
- * TODO: Instead of spinning on read empty/write full, use a semaphore
- * or perhaps a message queue
+ * By default a reader on an empty ring or a writer on a full ring polls
+ * the other party's hand every si_spinus microseconds (or spins if zero).
+ * With BK_SHMIPC_FUTEX (Linux only) the blocked party instead sleeps in
+ * the kernel on the other party's hand, which is woken when the hand
+ * moves.  A per-party waiter-present word lets the fast path skip the
+ * wake system call when nobody is asleep.
+ *
+ * A ring created with bk_shmipc_broadcast_create() has one writer and up
+ * to a fixed number of readers, each with its own read position in a slot
+ * between the header and the ring.  Readers come and go (any
+ * bk_shmipc_create() reader attaches to a free slot) and start at the
+ * current write position.  With BK_SHMIPC_OVERWRITE the writer never
+ * waits: a reader that is lapped detects it, skips to the newest data and
+ * counts the loss.  Otherwise the writer blocks on the slowest reader.
+ * Overwrite mode does not know about message boundaries, so it is best
+ * used with fixed-size records.
+ *
+ * A point-to-point writer created with BK_SHMIPC_NOTIFY (Linux only) also
+ * makes an eventfd, and hands it to the reader over a unix socket
+ * (SCM_RIGHTS) during the create handshake.  The writer signals it when
+ * the ring goes from empty to non-empty, so a reader can put
+ * bk_shmipc_notify_fd() into bk_run_handle() next to its sockets.  When the
+ * eventfd is readable, call bk_shmipc_notify_drain() and then read with
+ * BK_SHMIPC_NOBLOCK until EAGAIN; only then is the next signal guaranteed.
+ *
+ * A point-to-point writer created with BK_SHMIPC_MEMFD (Linux only) puts
+ * the ring in a memfd instead of a SysV segment, so nothing is left behind
+ * by a crash and keys cannot collide.  The reader finds the writer through
+ * an abstract unix socket and receives the memfd (SCM_RIGHTS) before the
+ * usual handshake; readers need no flag.  BK_SHMIPC_HUGEPAGE asks for
+ * hugetlb pages on either backend, falling back to transparent huge pages
+ * when none are reserved, to cut TLB misses on large rings.
  */
 
 #include <libbk.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif /* __linux__ */
+
+#if defined(SYS_futex) && defined(FUTEX_WAIT)
+#define SHMIPC_HAVE_FUTEX			///< Kernel wait/wake is available
+#endif /* SYS_futex && FUTEX_WAIT */
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#define SHMIPC_HAVE_EVENTFD			///< Eventfd and abstract unix sockets are available
+#ifdef MFD_CLOEXEC
+#define SHMIPC_HAVE_MEMFD			///< Memfd backing is available
+#endif /* MFD_CLOEXEC */
+#endif /* __linux__ */
 
 
 // Duplicated in shmadm.c for humans
-#define SHMIPC_MAGIC_WINIT	0xfeedface	///< Magic cookie for SYN
-#define SHMIPC_MAGIC_RINIT	0xfacefedd	///< Magic cookie for SYN-ACK
-#define SHMIPC_MAGIC		0xabadcafe	///< Magic cookie for connected
-#define SHMIPC_MAGIC_EOF	0xdeadbeef	///< Magic cookie for death
+#define SHMIPC_MAGIC_WINIT	0xfeedfac2	///< Magic cookie for SYN
+#define SHMIPC_MAGIC_RINIT	0xfacefed2	///< Magic cookie for SYN-ACK
+#define SHMIPC_MAGIC		0xabadcaf2	///< Magic cookie for connected
+#define SHMIPC_MAGIC_EOF	0xdeadbee2	///< Magic cookie for death
+// Magic cookies of the original (version 1) header layout
+#define SHMIPC_V1_MAGIC_WINIT	0xfeedface	///< Version 1 SYN
+#define SHMIPC_V1_MAGIC_RINIT	0xfacefedd	///< Version 1 SYN-ACK
+#define SHMIPC_V1_MAGIC		0xabadcafe	///< Version 1 connected
+#define SHMIPC_V1_MAGIC_EOF	0xdeadbeef	///< Version 1 death
+#define SHMIPC_IS_V1_MAGIC(m)	((m) == SHMIPC_V1_MAGIC_WINIT || (m) == SHMIPC_V1_MAGIC_RINIT || (m) == SHMIPC_V1_MAGIC || (m) == SHMIPC_V1_MAGIC_EOF)
 #define DEFAULT_SPINUS		0		///< Default, spin
+#define SHMIPC_FUTEX_MAXWAITUS	100000		///< Longest futex sleep before rechecking for a dead peer
+#define SHMIPC_NOTIFY_SOCKFMT	"bkshmipc-%08x-%08x" ///< Abstract socket name (key, generation) for handing over the eventfd
+#define SHMIPC_MEMFD_SOCKFMT	"bkshmipc-mem-%08x" ///< Abstract socket name (key) for handing over the memfd
 
 /*
- * Make explicit the concurrency operations required to provide proper two
- * party (single reader, single writer) IPC functionality without the
- * use of locks.  In addition to providing an atomic set operation,
- * the system must not reorder historical writes (specifically memcpy)
- * past an atomic set.
- *
- * This code should work on any system which allows for atomic int32
- * load/read and store/set operations, and which additionally forbid
- * stores from passing loads and stores from passing stores
- *
- * Specifically, it should work on AMD64, PARISC, sparcs (in default
- * TSO mode), x86
+ * Concurrency operations required to provide proper two party (single
+ * reader, single writer) IPC functionality without the use of locks.
+ *
+ * A party publishes its hand with a release store, so all of its earlier
+ * ring accesses (the memcpy into or out of the ring) are visible before
+ * the new hand is; the other party picks the hand up with an acquire load
+ * before touching the ring.  These are the GCC builtins for the C11 memory
+ * model, which work on the plain (non-_Atomic) words of the shared header
+ * and on any architecture the compiler supports.
  */
-#if defined(__s390x__) || defined(__powerpc64__) || defined(__tilegx__)
-#error "Do not have an atomic read/set operation for this architecture"
-#elif defined(__alpha__) || defined(__ia64__) || defined(__arm__) || defined(__powerpc64__)
-#error "Do not have an implicit memory barrier"
-// __sync_synchronize() is a possibility, but is rather drastic and not always implemented
-#elif defined(__i386__) || defined(__x86_64__) || defined(__sparc__) || defined(__hppa__)
-#define shmipc_atomic32_read(x) (*(volatile u_int32_t *)&x)	// Atomic int load
-#define shmipc_atomic32_set(v,i) ((v) = (i))			// Atomic int store
-#define shmipc_sstore_fence() do { ; } while (0)		// Forbid Stores Reordered After Stores
-#define shmipc_lstore_fence() do { ; } while (0)		// Forbid Loads Reordered After Stores
-#else
-#error "Don't know about atomic read/set or memory fencing requirements for this architecture"
-#endif
+#define shmipc_load_acquire(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)		// Load, later accesses stay after
+#define shmipc_load_relaxed(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)		// Load, no ordering
+#define shmipc_store_release(v,i) __atomic_store_n(&(v), (i), __ATOMIC_RELEASE) // Store, earlier accesses stay before
+#define shmipc_store_relaxed(v,i) __atomic_store_n(&(v), (i), __ATOMIC_RELAXED) // Store, no ordering
+#define shmipc_full_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)		// Forbid Loads Passing Stores (futex handshake)
+#define SHMIPC_CACHELINE	64		///< Assumed cache line size for hand separation
 
 
 /**
@@ -78,25 +124,106 @@ struct bk_shmipc
   struct bk_shmipc_header *si_base;		///< Start of shared memory segment
   volatile char        *si_ring;		///< Start of data ring (character for pointer arithmetic)
   u_int			si_ringbytes;		///< Number of bytes of ring space
+  u_int32_t		si_theirhand;		///< Cached copy of the other party's hand
+  u_int64_t		si_pos;			///< Broadcast: our stream position (writer or reader)
+  u_int64_t		si_minpos;		///< Broadcast writer: cached position of slowest reader
+  struct bk_shmipc_slot *si_slot;		///< Broadcast reader: our slot
   u_int			si_errno;		///< Errno of last operation
+  size_t		si_reserved;		///< Bytes handed out by bk_shmipc_write_reserve
+  size_t		si_peeked;		///< Bytes handed out by bk_shmipc_read_peek
+  int			si_notifyfd;		///< Eventfd signaled when ring becomes non-empty (-1 if none)
+  int			si_notifysock;		///< Eventfd handover socket, only during create (-1 if none)
+  int			si_memfd;		///< Memfd backing the ring (-1 for SysV)
+  int			si_memsock;		///< Memfd handover socket, writer only during create (-1 if none)
+  size_t		si_segsize;		///< Size of memfd mapping
   bk_flags		si_flags;		///< Fun for the future
 #define SI_SAWEND	0x01			///< Saw EOF on way or another
 #define SI_READONLY	0x02			///< Readonly, otherwise writeonly
+#define SI_FUTEX	0x04			///< Block with futex wait/wake instead of polling
+#define SI_BROADCAST	0x08			///< Broadcast ring (one writer, many readers)
+#define SI_OVERWRITE	0x10			///< Broadcast writer overwrites slow readers
+#define SI_NOTIFY	0x20			///< Eventfd notification is in use
+#define SI_MEMFD	0x40			///< Ring lives in a memfd rather than SysV shared memory
 };
 
 
 
 /**
- * Information about ring structure
+ * Information about ring structure (version 2).
+ *
+ * Each hand lives on its own cache line, so that moving one hand does not
+ * invalidate the line the other party is working from.  A waiter-present
+ * word lives on the line of the party which checks it (the waker), so the
+ * check is normally a local hit.  Magic and generation stay at the front
+ * in the same place as version 1, so old segments can be recognized.
  */
 struct bk_shmipc_header
 {
-  volatile u_int32_t	bsh_magic;		///< Set once everything is initialized
+  u_int32_t		bsh_magic;		///< Set once everything is initialized
+  u_int32_t		bsh_generation;		///< Generation number, possibly resembling writer init time
+  u_int32_t		bsh_ringsize;		///< Size of ring
+  u_int32_t		bsh_ringoffset;		///< Offset of start of ring from base of shared memory
+  u_int32_t		bsh_flags;		///< Ring options chosen by the writer
+#define BSH_FLAG_FUTEX		0x01		///< Parties sleep on the hands with futexes
+#define BSH_FLAG_BROADCAST	0x02		///< Broadcast ring with reader slots
+#define BSH_FLAG_OVERWRITE	0x04		///< Broadcast writer overwrites slow readers
+#define BSH_FLAG_NOTIFY		0x08		///< Writer offers an eventfd for empty to non-empty notification
+#define BSH_FLAG_HUGEPAGE	0x10		///< Writer asked for huge pages (readers advise too)
+  u_int32_t		bsh_maxreaders;		///< Broadcast: number of reader slots after header
+  u_int32_t		bsh_writerpid;		///< Broadcast: writer process (readers detect death)
+  // Written by writer, read by reader
+  u_int32_t		bsh_writehand __attribute__((aligned(SHMIPC_CACHELINE))); ///< Byte offset of write hand
+  u_int32_t		bsh_readwait;		///< Number of readers (about to be) asleep on bsh_writehand
+  u_int64_t		bsh_writepos;		///< Broadcast: total bytes ever published
+  u_int64_t		bsh_writelimit;		///< Broadcast overwrite: end of region being overwritten
+  // Written by reader, read by writer
+  u_int32_t		bsh_readhand __attribute__((aligned(SHMIPC_CACHELINE))); ///< Byte offset of read hand
+  u_int32_t		bsh_writewait;		///< Writer is (about to be) asleep on bsh_readhand
+  u_int32_t		bsh_readerpid;		///< Reader process (memfd rings detect death)
+} __attribute__((aligned(SHMIPC_CACHELINE)));
+
+
+
+/**
+ * Broadcast reader slot, one cache line each, between header and ring
+ */
+struct bk_shmipc_slot
+{
+  u_int32_t		bss_state;		///< Slot state
+#define BSS_FREE		0		///< Available
+#define BSS_CLAIMED		1		///< Reader is initializing
+#define BSS_ACTIVE		2		///< Reader is consuming
+  u_int32_t		bss_pid;		///< Reader process
+  u_int32_t		bss_writewait;		///< Writer is (about to be) asleep on bss_readpos
+  u_int64_t		bss_readpos;		///< Stream position of reader
+  u_int64_t		bss_overruns;		///< Number of times reader was lapped
+  u_int64_t		bss_lostbytes;		///< Bytes reader skipped after being lapped
+} __attribute__((aligned(SHMIPC_CACHELINE)));
+
+#define SHMIPC_SLOTS(base) ((struct bk_shmipc_slot *)((char *)(base) + sizeof(struct bk_shmipc_header)))
+
+/*
+ * Low 32 bits of a 64 bit position, which is what the futex sleeps on
+ */
+#if BYTE_ORDER == BIG_ENDIAN
+#define SHMIPC_POS_LOWORD(p) (((u_int32_t *)&(p)) + 1)
+#else
+#define SHMIPC_POS_LOWORD(p) ((u_int32_t *)&(p))
+#endif
+
+
+
+/**
+ * Original (version 1) ring structure, kept to describe old segments
+ */
+struct bk_shmipc_header_v1
+{
+  u_int32_t		bsh_magic;		///< Set once everything is initialized
   u_int32_t		bsh_generation;		///< Generation number, possibly resembling writer init time
-  volatile u_int32_t	bsh_writehand;		///< Byte offset of write hand
+  u_int32_t		bsh_writehand;		///< Byte offset of write hand
   u_int32_t		bsh_ringsize;		///< Size of ring
   u_int32_t		bsh_ringoffset;		///< Offset of start of ring from base of shared memory
-  volatile u_int32_t	bsh_readhand;		///< Byte offset of read hand
+  u_int32_t		bsh_readhand;		///< Byte offset of read hand
 };
 
 
@@ -105,9 +232,39 @@ struct bk_shmipc_header
 
 
 
-static inline int bytes_available_write(u_int32_t writehand, u_int32_t readhand, u_int32_t ringbytes);
-static inline int bytes_available_read(u_int32_t writehand, u_int32_t readhand, u_int32_t ringbytes);
+static inline u_int32_t bytes_available_write(u_int32_t writehand, u_int32_t readhand, u_int32_t ringbytes);
+static inline u_int32_t bytes_available_read(u_int32_t writehand, u_int32_t readhand, u_int32_t ringbytes);
 static int genkeyfromname(bk_s B, const char *name, key_t *key, bk_flags flags);
+static void shmipc_wait(struct bk_shmipc *bsi, u_int32_t *hand, u_int32_t seen, u_int32_t *waitflag, struct timeval *endtime);
+static inline void shmipc_wake(struct bk_shmipc *bsi, u_int32_t *hand, u_int32_t *waitflag);
+static ssize_t shmipc_await(bk_s B, struct bk_shmipc *bsi, size_t need, u_int timeoutus, bk_flags flags);
+static inline void shmipc_spans(struct bk_shmipc *bsi, u_int32_t hand, size_t len, struct iovec *iov);
+static inline u_int32_t shmipc_theirhand(struct bk_shmipc *bsi);
+static struct bk_shmipc *shmipc_create(bk_s B, const char *name, u_int timeoutus, u_int initus, u_int spinus, u_int size, u_int maxreaders, u_int mode, bk_shmipc_failure_e *failure_reason, bk_flags flags);
+static int shmipc_bcast_join(bk_s B, struct bk_shmipc *bsi);
+static int shmipc_bcast_reap(struct bk_shmipc_slot *slot);
+static u_int64_t shmipc_bcast_minpos(struct bk_shmipc *bsi, struct bk_shmipc_slot **slowest);
+static ssize_t shmipc_bcast_write(bk_s B, struct bk_shmipc *bsi, char *cdata, size_t len, u_int timeoutus, bk_flags flags);
+static ssize_t shmipc_bcast_read(bk_s B, struct bk_shmipc *bsi, char *cdata, size_t len, u_int timeoutus, bk_flags flags);
+static int shmipc_bcast_writergone(struct bk_shmipc *bsi);
+static int shmipc_readers_fill(struct bk_shmipc_header *base, struct bk_shmipc_readerinfo *info, u_int maxinfo);
+static inline void shmipc_notify(struct bk_shmipc *bsi, u_int32_t prevhand);
+#ifdef SHMIPC_HAVE_EVENTFD
+static int shmipc_sendfd(int sock, int fd);
+static int shmipc_recvfd(int sock);
+static void shmipc_notify_sockname(struct bk_shmipc *bsi, struct sockaddr_un *sun, socklen_t *sunlen);
+static int shmipc_notify_listen(bk_s B, struct bk_shmipc *bsi);
+static int shmipc_notify_connect(bk_s B, struct bk_shmipc *bsi);
+static int shmipc_notify_send(bk_s B, struct bk_shmipc *bsi);
+static int shmipc_notify_recv(bk_s B, struct bk_shmipc *bsi);
+#endif /* SHMIPC_HAVE_EVENTFD */
+#ifdef SHMIPC_HAVE_MEMFD
+static void shmipc_memfd_sockname(struct bk_shmipc *bsi, struct sockaddr_un *sun, socklen_t *sunlen);
+static int shmipc_memfd_create(bk_s B, struct bk_shmipc *bsi, size_t segsize, bk_flags flags);
+static void shmipc_memfd_serve(bk_s B, struct bk_shmipc *bsi);
+static int shmipc_memfd_attach(bk_s B, struct bk_shmipc *bsi, struct timeval *endtime);
+#endif /* SHMIPC_HAVE_MEMFD */
+static void shmipc_hugepage_advise(struct bk_shmipc *bsi, size_t segsize);
 
 
 
@@ -124,11 +281,73 @@ static int genkeyfromname(bk_s B, const char *name, key_t *key, bk_flags flags);
  *	@param spinus How often to check for available data/space for operations (microseconds)
  *	@param size Desired size of buffers (writer only, ignored for reader)
  *	@param mode SHM permissions mode (writer only, ignored for reader)
- *	@param flags BK_SHMIPC_RDONLY, BK_SHMIPC_WRONLY
+ *	@param flags BK_SHMIPC_RDONLY, BK_SHMIPC_WRONLY, BK_SHMIPC_FUTEX, BK_SHMIPC_NOTIFY, BK_SHMIPC_MEMFD, BK_SHMIPC_HUGEPAGE (writer only, reader follows writer)
  *	@return <i>NULL</i> on call failure, allocation failure, writer not present (reader only)
  *	@return <br><i>IPC handle</i> on success
  */
 struct bk_shmipc *bk_shmipc_create(bk_s B, const char *name, u_int timeoutus, u_int initus, u_int spinus, u_int size, u_int mode, bk_shmipc_failure_e *failure_reason, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  BK_RETURN(B, shmipc_create(B, name, timeoutus, initus, spinus, size, 0, mode, failure_reason, flags));
+}
+
+
+
+/**
+ * Create the writer side of a broadcast (one writer, many readers) ring.
+ * Readers attach with bk_shmipc_create(..., BK_SHMIPC_RDONLY) at any time
+ * and see data written after they attach.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA Thread/global state
+ *	@param name name to rendezvous on
+ *	@param timeoutus Default timeout for I/O functions in microseconds
+ *	@param initus Timeout to wait for old instance to disappear
+ *	@param spinus How often to check for available space when blocked (microseconds)
+ *	@param size Desired size of ring
+ *	@param maxreaders Maximum number of simultaneously attached readers
+ *	@param mode SHM permissions mode
+ *	@param flags BK_SHMIPC_FUTEX, BK_SHMIPC_OVERWRITE, BK_SHMIPC_HUGEPAGE
+ *	@return <i>NULL</i> on call failure, allocation failure
+ *	@return <br><i>IPC handle</i> on success
+ */
+struct bk_shmipc *bk_shmipc_broadcast_create(bk_s B, const char *name, u_int timeoutus, u_int initus, u_int spinus, u_int size, u_int maxreaders, u_int mode, bk_shmipc_failure_e *failure_reason, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  // Readers join broadcast rings at any time, so there is nobody to hand a memfd to
+  if (!maxreaders || BK_FLAG_ISSET(flags, BK_SHMIPC_RDONLY|BK_SHMIPC_MEMFD))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    if (failure_reason) *failure_reason = BkShmIpcCreateFatal;
+    BK_RETURN(B, NULL);
+  }
+
+  BK_RETURN(B, shmipc_create(B, name, timeoutus, initus, spinus, size, maxreaders, mode, failure_reason, flags|BK_SHMIPC_WRONLY));
+}
+
+
+
+/**
+ * Common creation of point-to-point and broadcast rings
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA Thread/global state
+ *	@param name name to rendezvous on
+ *	@param timeoutus Default timeout for I/O functions in microseconds
+ *	@param initus Timeout to wait for writer to become present or old instance to disappear
+ *	@param spinus How often to check for available data/space for operations (microseconds)
+ *	@param size Desired size of buffers (writer only, ignored for reader)
+ *	@param maxreaders Number of broadcast reader slots (writer only, 0 for point-to-point)
+ *	@param mode SHM permissions mode (writer only, ignored for reader)
+ *	@param flags BK_SHMIPC_RDONLY, BK_SHMIPC_WRONLY, BK_SHMIPC_FUTEX, BK_SHMIPC_OVERWRITE, BK_SHMIPC_NOTIFY, BK_SHMIPC_MEMFD, BK_SHMIPC_HUGEPAGE
+ *	@return <i>NULL</i> on call failure, allocation failure, writer not present (reader only)
+ *	@return <br><i>IPC handle</i> on success
+ */
+static struct bk_shmipc *shmipc_create(bk_s B, const char *name, u_int timeoutus, u_int initus, u_int spinus, u_int size, u_int maxreaders, u_int mode, bk_shmipc_failure_e *failure_reason, bk_flags flags)
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
   struct bk_shmipc *bsi = NULL;
@@ -137,6 +356,8 @@ struct bk_shmipc *bk_shmipc_create(bk_s B, const char *name, u_int timeoutus, u_
   int shmflg = 0;
   struct shmid_ds buf;
   int numothers = 0;
+  int broadcast = (maxreaders > 0);
+  size_t hdrsize = sizeof(struct bk_shmipc_header) + maxreaders * sizeof(struct bk_shmipc_slot);
 
   if (failure_reason) *failure_reason = BkShmIpcCreateSuccess;
 
@@ -159,6 +380,10 @@ struct bk_shmipc *bk_shmipc_create(bk_s B, const char *name, u_int timeoutus, u_
     if (failure_reason) *failure_reason = BkShmIpcCreateFatal;
     BK_RETURN(B, NULL);
   }
+  bsi->si_notifyfd = -1;
+  bsi->si_notifysock = -1;
+  bsi->si_memfd = -1;
+  bsi->si_memsock = -1;
 
   if (!(bsi->si_filename = strdup(name)))
   {
@@ -178,6 +403,10 @@ struct bk_shmipc *bk_shmipc_create(bk_s B, const char *name, u_int timeoutus, u_
   else
   {
     shmflg = IPC_CREAT|IPC_EXCL|mode;
+#ifdef SHM_HUGETLB
+    if (BK_FLAG_ISSET(flags, BK_SHMIPC_HUGEPAGE))
+      shmflg |= SHM_HUGETLB;
+#endif /* SHM_HUGETLB */
   }
   gettimeofday(&endtime, NULL);
   delta.tv_sec = initus / 1000000;
@@ -185,10 +414,28 @@ struct bk_shmipc *bk_shmipc_create(bk_s B, const char *name, u_int timeoutus, u_
   BK_TV_ADD(&endtime,&endtime,&delta);
   bsi->si_shmid = -1;
 
+  if (BK_FLAG_ISSET(flags, BK_SHMIPC_MEMFD) && BK_FLAG_ISCLEAR(flags, BK_SHMIPC_RDONLY))
+  {
+#ifdef SHMIPC_HAVE_MEMFD
+    if (shmipc_memfd_create(B, bsi, size+hdrsize, flags) < 0)
+#endif /* SHMIPC_HAVE_MEMFD */
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not create memfd shared memory (%s)\n", bsi->si_filename);
+      if (failure_reason) *failure_reason = BkShmIpcCreateFatal;
+      goto error;
+    }
+  }
+
   // Readers and writers attempt to get shared memory segment
-  while (bsi->si_shmid < 0 && (!initus || BK_TV_CMP(&endtime,&delta) > 0))
+  while (bsi->si_shmid < 0 && !bsi->si_base && (!initus || BK_TV_CMP(&endtime,&delta) > 0))
   {
-    if ((bsi->si_shmid = shmget(bsi->si_shmkey, size?size+sizeof(struct bk_shmipc_header):0, shmflg)) < 0)
+#ifdef SHMIPC_HAVE_MEMFD
+    // A memfd writer hands its segment straight to us
+    if (BK_FLAG_ISSET(bsi->si_flags, SI_READONLY) && shmipc_memfd_attach(B, bsi, initus?&endtime:NULL) == 0)
+      break;
+#endif /* SHMIPC_HAVE_MEMFD */
+
+    if ((bsi->si_shmid = shmget(bsi->si_shmkey, size?size+hdrsize:0, shmflg)) < 0)
     {
       if ((bsi->si_errno = errno) == EEXIST)
       {
@@ -211,6 +458,15 @@ struct bk_shmipc *bk_shmipc_create(bk_s B, const char *name, u_int timeoutus, u_
       {
 	bk_error_printf(B, BK_ERR_WARN, "Could not get shared memory (%s): %s\n", bsi->si_filename, strerror(errno));
       }
+#ifdef SHM_HUGETLB
+      else if (shmflg & SHM_HUGETLB)
+      {
+	// Probably no huge pages reserved; transparent huge pages are the next best thing
+	bk_error_printf(B, BK_ERR_WARN, "Could not get huge page shared memory, using normal pages (%s): %s\n", bsi->si_filename, strerror(errno));
+	shmflg &= ~SHM_HUGETLB;
+	continue;
+      }
+#endif /* SHM_HUGETLB */
       else
       {
 	bk_error_printf(B, BK_ERR_ERR, "Could not get shared memory (%s): %s\n", bsi->si_filename, strerror(errno));
@@ -224,18 +480,28 @@ struct bk_shmipc *bk_shmipc_create(bk_s B, const char *name, u_int timeoutus, u_
     }
   }
 
-  if (bsi->si_shmid < 0)
+  if (bsi->si_shmid < 0 && !bsi->si_base)
   {
     bk_error_printf(B, BK_ERR_ERR, "Could not get shared memory within timeout of %u microseconds (%s): %s\n", initus, bsi->si_filename, strerror(errno));
     if (failure_reason) *failure_reason = BkShmIpcCreateTimeout;
     goto error;
   }
 
-  if ((bsi->si_base = shmat(bsi->si_shmid, NULL, 0)) == (void *)-1)
+  if (bsi->si_shmid >= 0)
   {
-    bk_error_printf(B, BK_ERR_ERR, "Could not attach shared memory (%s): %s\n", bsi->si_filename, strerror(errno));
-    if (failure_reason) *failure_reason = BkShmIpcCreateFatal;
-    goto error;
+    if ((bsi->si_base = shmat(bsi->si_shmid, NULL, 0)) == (void *)-1)
+    {
+      bsi->si_base = NULL;
+      bk_error_printf(B, BK_ERR_ERR, "Could not attach shared memory (%s): %s\n", bsi->si_filename, strerror(errno));
+      if (failure_reason) *failure_reason = BkShmIpcCreateFatal;
+      goto error;
+    }
+#ifdef SHM_HUGETLB
+    if (BK_FLAG_ISSET(flags, BK_SHMIPC_HUGEPAGE) && !(shmflg & SHM_HUGETLB))
+#else  /* SHM_HUGETLB */
+    if (BK_FLAG_ISSET(flags, BK_SHMIPC_HUGEPAGE))
+#endif /* SHM_HUGETLB */
+      shmipc_hugepage_advise(bsi, size+hdrsize);
   }
 
   if (BK_FLAG_ISCLEAR(bsi->si_flags, SI_READONLY))
@@ -244,16 +510,62 @@ struct bk_shmipc *bk_shmipc_create(bk_s B, const char *name, u_int timeoutus, u_
 
     bsi->si_base->bsh_generation = curtime;
     bsi->si_base->bsh_ringsize = size;
-    bsi->si_base->bsh_ringoffset = sizeof(struct bk_shmipc_header);
-    shmipc_atomic32_set(bsi->si_base->bsh_writehand, 0);
-    shmipc_atomic32_set(bsi->si_base->bsh_readhand, 0);
-    shmipc_atomic32_set(bsi->si_base->bsh_magic, SHMIPC_MAGIC_WINIT); // Send SYN
+    bsi->si_base->bsh_ringoffset = hdrsize;
+    bsi->si_base->bsh_flags = 0;
+    if (BK_FLAG_ISSET(flags, BK_SHMIPC_HUGEPAGE))
+      BK_FLAG_SET(bsi->si_base->bsh_flags, BSH_FLAG_HUGEPAGE);
+#ifdef SHMIPC_HAVE_FUTEX
+    if (BK_FLAG_ISSET(flags, BK_SHMIPC_FUTEX))
+      BK_FLAG_SET(bsi->si_base->bsh_flags, BSH_FLAG_FUTEX);
+#endif /* SHMIPC_HAVE_FUTEX */
+    bsi->si_base->bsh_maxreaders = maxreaders;
+    bsi->si_base->bsh_writerpid = getpid();
+    bsi->si_base->bsh_readerpid = 0;
+    memset(SHMIPC_SLOTS(bsi->si_base), 0, maxreaders * sizeof(struct bk_shmipc_slot));
+    shmipc_store_relaxed(bsi->si_base->bsh_readwait, 0);
+    shmipc_store_relaxed(bsi->si_base->bsh_writewait, 0);
+    shmipc_store_relaxed(bsi->si_base->bsh_writehand, 0);
+    shmipc_store_relaxed(bsi->si_base->bsh_readhand, 0);
+    shmipc_store_relaxed(bsi->si_base->bsh_writepos, 0);
+    shmipc_store_relaxed(bsi->si_base->bsh_writelimit, 0);
+    if (broadcast)
+    {
+      // No handshake: readers attach to slots whenever they like
+      BK_FLAG_SET(bsi->si_flags, SI_BROADCAST);
+      BK_FLAG_SET(bsi->si_base->bsh_flags, BSH_FLAG_BROADCAST);
+      if (BK_FLAG_ISSET(flags, BK_SHMIPC_OVERWRITE))
+	BK_FLAG_SET(bsi->si_base->bsh_flags, BSH_FLAG_OVERWRITE);
+      shmipc_store_release(bsi->si_base->bsh_magic, SHMIPC_MAGIC);
+    }
+    else
+    {
+#ifdef SHMIPC_HAVE_EVENTFD
+      // Failure just means the reader does not get notification
+      if (BK_FLAG_ISSET(flags, BK_SHMIPC_NOTIFY) && shmipc_notify_listen(B, bsi) == 0)
+	BK_FLAG_SET(bsi->si_base->bsh_flags, BSH_FLAG_NOTIFY);
+#endif /* SHMIPC_HAVE_EVENTFD */
+      shmipc_store_release(bsi->si_base->bsh_magic, SHMIPC_MAGIC_WINIT); // Send SYN
+    }
   }
   else
   {						// Reader waits for initialization
-    while (shmipc_atomic32_read(bsi->si_base->bsh_magic) != SHMIPC_MAGIC_WINIT && (!initus || BK_TV_CMP(&endtime,&delta) > 0))
+    while (shmipc_load_acquire(bsi->si_base->bsh_magic) != SHMIPC_MAGIC_WINIT && (!initus || BK_TV_CMP(&endtime,&delta) > 0))
     {
-      if (shmipc_atomic32_read(bsi->si_base->bsh_magic) == SHMIPC_MAGIC_EOF || shmipc_atomic32_read(bsi->si_base->bsh_magic) == SHMIPC_MAGIC_RINIT || shmipc_atomic32_read(bsi->si_base->bsh_magic) == SHMIPC_MAGIC)
+      if (shmipc_load_acquire(bsi->si_base->bsh_magic) == SHMIPC_MAGIC && BK_FLAG_ISSET(bsi->si_base->bsh_flags, BSH_FLAG_BROADCAST))
+      {
+	broadcast = 1;
+	BK_FLAG_SET(bsi->si_flags, SI_BROADCAST);
+	break;
+      }
+
+      if (SHMIPC_IS_V1_MAGIC(shmipc_load_acquire(bsi->si_base->bsh_magic)))
+      {
+	bk_error_printf(B, BK_ERR_ERR, "Writer uses the old (version 1) shmipc header layout (%s)\n", bsi->si_filename);
+	if (failure_reason) *failure_reason = BkShmIpcCreateFatal;
+	goto error;
+      }
+
+      if (shmipc_load_acquire(bsi->si_base->bsh_magic) == SHMIPC_MAGIC_EOF || shmipc_load_acquire(bsi->si_base->bsh_magic) == SHMIPC_MAGIC_RINIT || shmipc_load_acquire(bsi->si_base->bsh_magic) == SHMIPC_MAGIC)
       {
 	bk_error_printf(B, BK_ERR_ERR, "Writer closed before we saw magic (%s)\n", bsi->si_filename);
 	if (failure_reason) *failure_reason = BkShmIpcCreateStale;
@@ -273,22 +585,44 @@ struct bk_shmipc *bk_shmipc_create(bk_s B, const char *name, u_int timeoutus, u_
 	gettimeofday(&delta, NULL);
     }
 
-    if (shmipc_atomic32_read(bsi->si_base->bsh_magic) != SHMIPC_MAGIC_WINIT)
+    if (!broadcast && shmipc_load_acquire(bsi->si_base->bsh_magic) != SHMIPC_MAGIC_WINIT)
     {
       bk_error_printf(B, BK_ERR_ERR, "Writer has not initialized shm within timeout of %u microseconds (%s)\n", initus, bsi->si_filename);
       if (failure_reason) *failure_reason = BkShmIpcCreateTimeout;
       goto error;
     }
 
+#ifdef SHMIPC_HAVE_EVENTFD
+    // Queue up for the eventfd before the syn-ack, so the writer need not wait for us
+    if (!broadcast && BK_FLAG_ISSET(bsi->si_base->bsh_flags, BSH_FLAG_NOTIFY))
+      shmipc_notify_connect(B, bsi);
+#endif /* SHMIPC_HAVE_EVENTFD */
+
     // Continue the dance -- send syn-ack
-    shmipc_atomic32_set(bsi->si_base->bsh_magic, SHMIPC_MAGIC_RINIT);
+    if (!broadcast)
+    {
+      bsi->si_base->bsh_readerpid = getpid();
+      shmipc_store_release(bsi->si_base->bsh_magic, SHMIPC_MAGIC_RINIT);
+    }
   }
 
-  if (BK_FLAG_ISCLEAR(bsi->si_flags, SI_READONLY))
+  if (broadcast)
+  {
+    // Broadcast rings are connected as soon as the writer has initialized
+  }
+  else if (BK_FLAG_ISCLEAR(bsi->si_flags, SI_READONLY))
   {						// Writer waits for reader syn-ack
-    while (shmipc_atomic32_read(bsi->si_base->bsh_magic) != SHMIPC_MAGIC_RINIT && (!initus || BK_TV_CMP(&endtime,&delta) > 0))
+    while (shmipc_load_acquire(bsi->si_base->bsh_magic) != SHMIPC_MAGIC_RINIT && (!initus || BK_TV_CMP(&endtime,&delta) > 0))
     {
-      u_int32_t oldmagic = shmipc_atomic32_read(bsi->si_base->bsh_magic);
+      u_int32_t oldmagic;
+
+#ifdef SHMIPC_HAVE_MEMFD
+      // Reader cannot even see our syn until it has the memfd
+      if (bsi->si_memsock >= 0)
+	shmipc_memfd_serve(B, bsi);
+#endif /* SHMIPC_HAVE_MEMFD */
+
+      oldmagic = shmipc_load_acquire(bsi->si_base->bsh_magic);
 
       if (oldmagic == SHMIPC_MAGIC_EOF || oldmagic == SHMIPC_MAGIC || (oldmagic != SHMIPC_MAGIC_RINIT && oldmagic != SHMIPC_MAGIC_WINIT))
       {
@@ -303,21 +637,33 @@ struct bk_shmipc *bk_shmipc_create(bk_s B, const char *name, u_int timeoutus, u_
 	gettimeofday(&delta, NULL);
     }
 
-    if (shmipc_atomic32_read(bsi->si_base->bsh_magic) != SHMIPC_MAGIC_RINIT)
+    if (shmipc_load_acquire(bsi->si_base->bsh_magic) != SHMIPC_MAGIC_RINIT)
     {
       bk_error_printf(B, BK_ERR_ERR, "Reader has not acknowledged shm within timeout of %u microseconds (%s)\n", initus, bsi->si_filename);
       if (failure_reason) *failure_reason = BkShmIpcCreateTimeout;
       goto error;
     }
 
+#ifdef SHMIPC_HAVE_EVENTFD
+    if (bsi->si_notifysock >= 0)
+      shmipc_notify_send(B, bsi);
+#endif /* SHMIPC_HAVE_EVENTFD */
+
+    // Point-to-point: nobody else may have the memfd
+    if (bsi->si_memsock >= 0)
+    {
+      close(bsi->si_memsock);
+      bsi->si_memsock = -1;
+    }
+
     // Say we are connected
-    shmipc_atomic32_set(bsi->si_base->bsh_magic, SHMIPC_MAGIC);
+    shmipc_store_release(bsi->si_base->bsh_magic, SHMIPC_MAGIC);
   }
   else
   {						// Reader waits for connected
-    while (shmipc_atomic32_read(bsi->si_base->bsh_magic) != SHMIPC_MAGIC && (!initus || BK_TV_CMP(&endtime,&delta) > 0))
+    while (shmipc_load_acquire(bsi->si_base->bsh_magic) != SHMIPC_MAGIC && (!initus || BK_TV_CMP(&endtime,&delta) > 0))
     {
-      u_int32_t oldmagic = shmipc_atomic32_read(bsi->si_base->bsh_magic);
+      u_int32_t oldmagic = shmipc_load_acquire(bsi->si_base->bsh_magic);
 
       if (oldmagic == SHMIPC_MAGIC_EOF || oldmagic == SHMIPC_MAGIC_WINIT || (oldmagic != SHMIPC_MAGIC && oldmagic != SHMIPC_MAGIC_RINIT))
       {
@@ -339,12 +685,17 @@ struct bk_shmipc *bk_shmipc_create(bk_s B, const char *name, u_int timeoutus, u_
 	gettimeofday(&delta, NULL);
     }
 
-    if (shmipc_atomic32_read(bsi->si_base->bsh_magic) != SHMIPC_MAGIC)
+    if (shmipc_load_acquire(bsi->si_base->bsh_magic) != SHMIPC_MAGIC)
     {
       bk_error_printf(B, BK_ERR_ERR, "Writer has not acknowledged reader shm within timeout of %u microseconds (%s)\n", initus, bsi->si_filename);
       if (failure_reason) *failure_reason = BkShmIpcCreateTimeout;
       goto error;
     }
+
+#ifdef SHMIPC_HAVE_EVENTFD
+    if (bsi->si_notifysock >= 0)
+      shmipc_notify_recv(B, bsi);
+#endif /* SHMIPC_HAVE_EVENTFD */
   }
 
   /*
@@ -356,7 +707,18 @@ struct bk_shmipc *bk_shmipc_create(bk_s B, const char *name, u_int timeoutus, u_
   bsi->si_ringbytes = bsi->si_base->bsh_ringsize;
   bsi->si_ring = ((char *)bsi->si_base) + bsi->si_base->bsh_ringoffset;
 
-  if (shmctl(bsi->si_shmid, IPC_STAT, &buf) < 0)
+#ifdef SHMIPC_HAVE_FUTEX
+  if (BK_FLAG_ISSET(bsi->si_base->bsh_flags, BSH_FLAG_FUTEX))
+    BK_FLAG_SET(bsi->si_flags, SI_FUTEX);
+#endif /* SHMIPC_HAVE_FUTEX */
+  if (broadcast && BK_FLAG_ISSET(bsi->si_base->bsh_flags, BSH_FLAG_OVERWRITE))
+    BK_FLAG_SET(bsi->si_flags, SI_OVERWRITE);
+
+  if (BK_FLAG_ISSET(bsi->si_flags, SI_MEMFD))
+  {
+    buf.shm_segsz = bsi->si_segsize;
+  }
+  else if (shmctl(bsi->si_shmid, IPC_STAT, &buf) < 0)
   {
     bsi->si_errno = errno;
     bk_error_printf(B, BK_ERR_ERR, "Could not stat shmipc: %s\n", strerror(errno));
@@ -364,14 +726,33 @@ struct bk_shmipc *bk_shmipc_create(bk_s B, const char *name, u_int timeoutus, u_
     goto error;
   }
 
-  if ((u_int)((bsi->si_ring - (char *)bsi->si_base) + bsi->si_ringbytes) > buf.shm_segsz)
+  if ((size_t)(bsi->si_ring - (char *)bsi->si_base) + bsi->si_ringbytes > (size_t)buf.shm_segsz)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Memory corruption or attack to induce memory corruption ((%p-%p)%u + %u > %zu)\n", bsi->si_ring, bsi->si_base, (u_int)(bsi->si_ring - (char *)bsi->si_base), bsi->si_ringbytes, (size_t)buf.shm_segsz);
+    bsi->si_errno = EBADSLT;
+    if (failure_reason) *failure_reason = BkShmIpcCreateFatal;
+    goto error;
+  }
+
+  // Harmless if the segment is already hugetlb backed
+  if (BK_FLAG_ISSET(bsi->si_flags, SI_READONLY) && BK_FLAG_ISSET(bsi->si_base->bsh_flags, BSH_FLAG_HUGEPAGE))
+    shmipc_hugepage_advise(bsi, buf.shm_segsz);
+
+  if (broadcast && (bsi->si_base->bsh_ringoffset < sizeof(struct bk_shmipc_header) + bsi->si_base->bsh_maxreaders * sizeof(struct bk_shmipc_slot)))
   {
-    bk_error_printf(B, BK_ERR_ERR, "Memory corruption or attack to induce memory corruption ((%p-%p)%u + %d > %u)\n", bsi->si_ring, bsi->si_base, (u_int)(bsi->si_ring - (char *)bsi->si_base), bsi->si_ringbytes, (u_int)buf.shm_segsz);
+    bk_error_printf(B, BK_ERR_ERR, "Memory corruption or attack to induce memory corruption (%u reader slots in %u byte header)\n", bsi->si_base->bsh_maxreaders, bsi->si_base->bsh_ringoffset);
     bsi->si_errno = EBADSLT;
     if (failure_reason) *failure_reason = BkShmIpcCreateFatal;
     goto error;
   }
 
+  if (broadcast && BK_FLAG_ISSET(bsi->si_flags, SI_READONLY) && shmipc_bcast_join(B, bsi) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "No free broadcast reader slot (%s)\n", bsi->si_filename);
+    if (failure_reason) *failure_reason = BkShmIpcCreateFatal;
+    goto error;
+  }
+
   BK_RETURN(B, bsi);
 
  error:
@@ -400,13 +781,42 @@ void bk_shmipc_destroy(bk_s B, struct bk_shmipc *bsi, bk_flags flags)
   if (!bsi)
     BK_VRETURN(B);
 
-  if (bsi->si_base)
+  if (bsi->si_base && BK_FLAG_ALLSET(bsi->si_flags, SI_BROADCAST|SI_READONLY))
   {
-    shmipc_atomic32_set(bsi->si_base->bsh_magic, SHMIPC_MAGIC_EOF);
+    // Broadcast reader leaves quietly; writer and other readers carry on
+    if (bsi->si_slot)
+    {
+      shmipc_store_release(bsi->si_slot->bss_state, BSS_FREE);
+      shmipc_wake(bsi, SHMIPC_POS_LOWORD(bsi->si_slot->bss_readpos), &bsi->si_slot->bss_writewait);
+    }
     if (shmdt(bsi->si_base) < 0)
     {
       bk_error_printf(B, BK_ERR_ERR, "Could not detach shared memory: %s\n", strerror(errno));
     }
+    bsi->si_shmid = -1;
+  }
+  else if (bsi->si_base)
+  {
+    shmipc_store_release(bsi->si_base->bsh_magic, SHMIPC_MAGIC_EOF);
+    shmipc_wake(bsi, &bsi->si_base->bsh_writehand, &bsi->si_base->bsh_readwait);
+    shmipc_wake(bsi, &bsi->si_base->bsh_readhand, &bsi->si_base->bsh_writewait);
+    if (BK_FLAG_ISSET(bsi->si_flags, SI_NOTIFY) && BK_FLAG_ISCLEAR(bsi->si_flags, SI_READONLY))
+    {
+      u_int64_t one = 1;
+
+      // Reader's event loop must wake up to see the EOF
+      if (write(bsi->si_notifyfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+	bk_error_printf(B, BK_ERR_WARN, "Could not signal notification eventfd: %s\n", strerror(errno));
+    }
+    if (BK_FLAG_ISSET(bsi->si_flags, SI_MEMFD))
+    {
+      if (munmap(bsi->si_base, bsi->si_segsize) < 0)
+	bk_error_printf(B, BK_ERR_ERR, "Could not unmap shared memory: %s\n", strerror(errno));
+    }
+    else if (shmdt(bsi->si_base) < 0)
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not detach shared memory: %s\n", strerror(errno));
+    }
   }
 
   if (bsi->si_shmid >= 0 && (shmctl(bsi->si_shmid, IPC_RMID, NULL) < 0))
@@ -414,6 +824,15 @@ void bk_shmipc_destroy(bk_s B, struct bk_shmipc *bsi, bk_flags flags)
     bk_error_printf(B, BK_ERR_WARN, "Could not removed shared memory (other side may have done so): %s\n", strerror(errno));
   }
 
+  if (bsi->si_notifysock >= 0)
+    close(bsi->si_notifysock);
+  if (bsi->si_notifyfd >= 0)
+    close(bsi->si_notifyfd);
+  if (bsi->si_memsock >= 0)
+    close(bsi->si_memsock);
+  if (bsi->si_memfd >= 0)
+    close(bsi->si_memfd);
+
   if (bsi->si_filename)
     free((char *)bsi->si_filename);
   free(bsi);
@@ -426,12 +845,14 @@ void bk_shmipc_destroy(bk_s B, struct bk_shmipc *bsi, bk_flags flags)
 /**
  * Find the number of bytes available to write in the closed space of the ring buffer
  */
-static inline int bytes_available_write(u_int32_t writehand, u_int32_t readhand, u_int32_t ringbytes)
+static inline u_int32_t bytes_available_write(u_int32_t writehand, u_int32_t readhand, u_int32_t ringbytes)
 {
-   if (readhand <= writehand)
-     readhand += ringbytes;
+   u_int64_t farhand = readhand;		// Rings may be larger than 2GB
 
-   return(readhand - writehand - 1);
+   if (farhand <= writehand)
+     farhand += ringbytes;
+
+   return(farhand - writehand - 1);
  }
 
 
@@ -439,16 +860,98 @@ static inline int bytes_available_write(u_int32_t writehand, u_int32_t readhand,
 /**
  * Find the number of bytes available to read in the closed space of the ring buffer
  */
-static inline int bytes_available_read(u_int32_t writehand, u_int32_t readhand, u_int32_t ringbytes)
+static inline u_int32_t bytes_available_read(u_int32_t writehand, u_int32_t readhand, u_int32_t ringbytes)
  {
-   if (readhand > writehand)
-     writehand += ringbytes;
+   u_int64_t farhand = writehand;		// Rings may be larger than 2GB
+
+   if (readhand > farhand)
+     farhand += ringbytes;
 
-   return(writehand - readhand);
+   return(farhand - readhand);
  }
 
 
 
+/**
+ * Wait for the other party to move its hand away from the value we last saw.
+ *
+ * In futex mode we count ourselves in the waiter-present word, then
+ * recheck the hand (the other party checks the word after moving the hand,
+ * so one of us must notice the other) before sleeping in the kernel.  The
+ * sleep is bounded so that a peer which died without waking us is noticed
+ * by the caller's attach-count check.  Otherwise we poll every si_spinus.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param bsi Shared memory structure
+ *	@param hand The other party's hand (futex word)
+ *	@param seen Value of hand which made us block
+ *	@param waitflag Waiter-present count we join
+ *	@param endtime Absolute time at which the caller gives up (NULL for never)
+ */
+static void shmipc_wait(struct bk_shmipc *bsi, u_int32_t *hand, u_int32_t seen, u_int32_t *waitflag, struct timeval *endtime)
+{
+#ifdef SHMIPC_HAVE_FUTEX
+  if (BK_FLAG_ISSET(bsi->si_flags, SI_FUTEX))
+  {
+    struct timespec ts;
+    u_int waitus = SHMIPC_FUTEX_MAXWAITUS;
+
+    if (endtime)
+    {
+      struct timeval now;
+
+      gettimeofday(&now, NULL);
+      BK_TV_SUB(&now, endtime, &now);
+      if (now.tv_sec < 0)
+	return;
+      if (now.tv_sec == 0)
+	waitus = MIN(waitus, (u_int)now.tv_usec);
+    }
+    ts.tv_sec = waitus / 1000000;
+    ts.tv_nsec = (waitus % 1000000) * 1000;
+
+    __atomic_add_fetch(waitflag, 1, __ATOMIC_SEQ_CST);	// Full fence as well
+    if (shmipc_load_acquire(*hand) == seen && shmipc_load_acquire(bsi->si_base->bsh_magic) == SHMIPC_MAGIC)
+      syscall(SYS_futex, hand, FUTEX_WAIT, seen, &ts, NULL, 0);
+    __atomic_sub_fetch(waitflag, 1, __ATOMIC_RELAXED);
+    return;
+  }
+#endif /* SHMIPC_HAVE_FUTEX */
+
+  if (bsi->si_spinus)
+    usleep(bsi->si_spinus);
+}
+
+
+
+/**
+ * Wake the other party if it is asleep waiting for our hand to move.
+ *
+ * Called after our hand (or the magic) has been published.  The full fence
+ * orders that store before the load of the waiter-present word; without
+ * a sleeper this costs no system call.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param bsi Shared memory structure
+ *	@param hand Our hand (futex word the other party sleeps on)
+ *	@param waitflag The other party's waiter-present word
+ */
+static inline void shmipc_wake(struct bk_shmipc *bsi, u_int32_t *hand, u_int32_t *waitflag)
+{
+#ifdef SHMIPC_HAVE_FUTEX
+  if (BK_FLAG_ISCLEAR(bsi->si_flags, SI_FUTEX))
+    return;
+
+  shmipc_full_fence();
+  if (shmipc_load_relaxed(*waitflag))
+    syscall(SYS_futex, hand, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif /* SHMIPC_HAVE_FUTEX */
+}
+
+
+
 /**
 
  * Write data via shmipc
@@ -470,6 +973,8 @@ ssize_t bk_shmipc_write(bk_s B, struct bk_shmipc *bsi, void *data, size_t len, u
   char *cdata = data;
   ssize_t ret = 0;
   u_int32_t writehand;
+  u_int32_t readhand;
+  u_int32_t prevhand;
   struct timeval endtime;
   struct timeval delta;
 
@@ -498,8 +1003,11 @@ ssize_t bk_shmipc_write(bk_s B, struct bk_shmipc *bsi, void *data, size_t len, u
     BK_RETURN(B, -1);
   }
 
+  if (BK_FLAG_ISSET(bsi->si_flags, SI_BROADCAST))
+    BK_RETURN(B, shmipc_bcast_write(B, bsi, cdata, len, timeoutus, flags));
+
   // Security check
-  if ((writehand = shmipc_atomic32_read(bsi->si_base->bsh_writehand)) >= bsi->si_ringbytes)
+  if ((writehand = shmipc_load_relaxed(bsi->si_base->bsh_writehand)) >= bsi->si_ringbytes)
   {
     bk_error_printf(B, BK_ERR_ERR, "Memory corruption or attack to induce memory corruption\n");
     bsi->si_errno = EBADSLT;
@@ -516,7 +1024,7 @@ ssize_t bk_shmipc_write(bk_s B, struct bk_shmipc *bsi, void *data, size_t len, u
     BK_TV_ADD(&endtime,&endtime,&delta);
   }
 
-  if (BK_FLAG_ISSET(flags,BK_SHMIPC_DROP2BLOCK) && (len > (size_t)bytes_available_write(writehand, shmipc_atomic32_read(bsi->si_base->bsh_readhand), bsi->si_ringbytes)))
+  if (BK_FLAG_ISSET(flags,BK_SHMIPC_DROP2BLOCK) && (len > (size_t)bytes_available_write(writehand, bsi->si_theirhand, bsi->si_ringbytes)) && (len > (size_t)bytes_available_write(writehand, shmipc_theirhand(bsi), bsi->si_ringbytes)))
   {
     int numreader = 0;
 
@@ -538,7 +1046,10 @@ ssize_t bk_shmipc_write(bk_s B, struct bk_shmipc *bsi, void *data, size_t len, u
   {
     u_int writelen;
 
-    if (!(writelen = bytes_available_write(writehand, shmipc_atomic32_read(bsi->si_base->bsh_readhand), bsi->si_ringbytes)))
+    // Only go to the reader's cache line when our copy of its hand shows no room
+    if (!(writelen = bytes_available_write(writehand, bsi->si_theirhand, bsi->si_ringbytes)))
+      writelen = bytes_available_write(writehand, (readhand = shmipc_theirhand(bsi)), bsi->si_ringbytes);
+    if (!writelen)
     {
       int numreader = 0;
 
@@ -572,8 +1083,7 @@ ssize_t bk_shmipc_write(bk_s B, struct bk_shmipc *bsi, void *data, size_t len, u
 	if (BK_TV_CMP(&endtime,&delta) < 0)
 	  goto wouldblock;
       }
-      if (bsi->si_spinus)
-	usleep(bsi->si_spinus);
+      shmipc_wait(bsi, &bsi->si_base->bsh_readhand, readhand, &bsi->si_base->bsh_writewait, timeoutus?&endtime:NULL);
       continue;
     }
 
@@ -583,13 +1093,16 @@ ssize_t bk_shmipc_write(bk_s B, struct bk_shmipc *bsi, void *data, size_t len, u
     memcpy((char *)bsi->si_ring + writehand, cdata, writelen);
     cdata += writelen;
     len -= writelen;
+    prevhand = writehand;
     writehand += writelen;
     ret += writelen;
 
     if (writehand == bsi->si_ringbytes)
       writehand = 0;
-    shmipc_sstore_fence();
-    shmipc_atomic32_set(bsi->si_base->bsh_writehand, writehand);
+    shmipc_store_release(bsi->si_base->bsh_writehand, writehand);
+    shmipc_wake(bsi, &bsi->si_base->bsh_writehand, &bsi->si_base->bsh_readwait);
+    if (BK_FLAG_ISSET(bsi->si_flags, SI_NOTIFY))
+      shmipc_notify(bsi, prevhand);
   }
 
   BK_RETURN(B, ret);
@@ -617,6 +1130,7 @@ ssize_t bk_shmipc_read(bk_s B, struct bk_shmipc *bsi, void *data, size_t len, u_
   ssize_t ret = 0;
   char *cdata = data;
   u_int32_t readhand;
+  u_int32_t writehand;
   struct timeval endtime;
   struct timeval delta;
   u_int readlen;
@@ -644,8 +1158,11 @@ ssize_t bk_shmipc_read(bk_s B, struct bk_shmipc *bsi, void *data, size_t len, u_
     BK_RETURN(B, -1);
   }
 
+  if (BK_FLAG_ISSET(bsi->si_flags, SI_BROADCAST))
+    BK_RETURN(B, shmipc_bcast_read(B, bsi, cdata, len, timeoutus, flags));
+
   // Security check
-  if ((readhand = shmipc_atomic32_read(bsi->si_base->bsh_readhand)) >= bsi->si_ringbytes)
+  if ((readhand = shmipc_load_relaxed(bsi->si_base->bsh_readhand)) >= bsi->si_ringbytes)
   {
     bk_error_printf(B, BK_ERR_ERR, "Memory corruption or attack to induce memory corruption\n");
     bsi->si_errno = EBADSLT;
@@ -664,7 +1181,10 @@ ssize_t bk_shmipc_read(bk_s B, struct bk_shmipc *bsi, void *data, size_t len, u_
 
   while (len)
   {
-    if (!(readlen = bytes_available_read(shmipc_atomic32_read(bsi->si_base->bsh_writehand), readhand, bsi->si_ringbytes)))
+    // Only go to the writer's cache line when our copy of its hand shows no data
+    if (!(readlen = bytes_available_read(bsi->si_theirhand, readhand, bsi->si_ringbytes)))
+      readlen = bytes_available_read((writehand = shmipc_theirhand(bsi)), readhand, bsi->si_ringbytes);
+    if (!readlen)
     {
       int numwriter = 0;
 
@@ -674,9 +1194,17 @@ ssize_t bk_shmipc_read(bk_s B, struct bk_shmipc *bsi, void *data, size_t len, u_
 	BK_RETURN(B, ret);
       }
 
+      if (BK_FLAG_ISSET(bsi->si_flags, SI_NOTIFY))
+      {
+	// Pairs with shmipc_notify(): either we see the new data or the writer sees us caught up
+	shmipc_full_fence();
+	if (bytes_available_read((writehand = shmipc_theirhand(bsi)), readhand, bsi->si_ringbytes))
+	  continue;
+      }
+
       bk_shmipc_peek(B, bsi, NULL, NULL, NULL, &numwriter, 0);
 
-      if (numwriter < 1 || shmipc_atomic32_read(bsi->si_base->bsh_magic) == SHMIPC_MAGIC_EOF)
+      if (numwriter < 1 || shmipc_load_acquire(bsi->si_base->bsh_magic) == SHMIPC_MAGIC_EOF)
       {
 	// EOF
 	BK_FLAG_SET(bsi->si_flags, SI_SAWEND);
@@ -698,8 +1226,7 @@ ssize_t bk_shmipc_read(bk_s B, struct bk_shmipc *bsi, void *data, size_t len, u_
 	if (BK_TV_CMP(&endtime,&delta) < 0)
 	  goto wouldblock;
       }
-      if (bsi->si_spinus)
-	usleep(bsi->si_spinus);
+      shmipc_wait(bsi, &bsi->si_base->bsh_writehand, writehand, &bsi->si_base->bsh_readwait, timeoutus?&endtime:NULL);
       continue;
     }
 
@@ -713,8 +1240,8 @@ ssize_t bk_shmipc_read(bk_s B, struct bk_shmipc *bsi, void *data, size_t len, u_
 
     if (readhand == bsi->si_ringbytes)
       readhand = 0;
-    shmipc_lstore_fence();
-    shmipc_atomic32_set(bsi->si_base->bsh_readhand, readhand);
+    shmipc_store_release(bsi->si_base->bsh_readhand, readhand);
+    shmipc_wake(bsi, &bsi->si_base->bsh_readhand, &bsi->si_base->bsh_writewait);
   }
 
   BK_RETURN(B, ret);
@@ -743,6 +1270,7 @@ bk_vptr *bk_shmipc_readall(bk_s B, struct bk_shmipc *bsi, size_t maxbytes, u_int
   struct timeval endtime;
   struct timeval delta;
   u_int readbytes;
+  u_int32_t writehand;
 
   if (!bsi || !bsi->si_base)
   {
@@ -769,7 +1297,14 @@ bk_vptr *bk_shmipc_readall(bk_s B, struct bk_shmipc *bsi, size_t maxbytes, u_int
     BK_TV_ADD(&endtime,&endtime,&delta);
   }
 
-  while (!(readbytes = bytes_available_read(shmipc_atomic32_read(bsi->si_base->bsh_writehand), shmipc_atomic32_read(bsi->si_base->bsh_readhand), bsi->si_ringbytes)))
+  if (BK_FLAG_ISSET(bsi->si_flags, SI_BROADCAST))
+  {
+    // The broadcast read does its own waiting; just size the buffer generously
+    readbytes = maxbytes?MIN(maxbytes, bsi->si_ringbytes):bsi->si_ringbytes;
+    goto allocate;
+  }
+
+  while (!(readbytes = bytes_available_read((writehand = shmipc_theirhand(bsi)), shmipc_load_relaxed(bsi->si_base->bsh_readhand), bsi->si_ringbytes)))
   {
     int numwriter;
 
@@ -779,7 +1314,7 @@ bk_vptr *bk_shmipc_readall(bk_s B, struct bk_shmipc *bsi, size_t maxbytes, u_int
       goto error;
     }
 
-    if (numwriter < 1 || shmipc_atomic32_read(bsi->si_base->bsh_magic) == SHMIPC_MAGIC_EOF)
+    if (numwriter < 1 || shmipc_load_acquire(bsi->si_base->bsh_magic) == SHMIPC_MAGIC_EOF)
     {
       // EOF
       BK_FLAG_SET(bsi->si_flags, SI_SAWEND);
@@ -801,13 +1336,13 @@ bk_vptr *bk_shmipc_readall(bk_s B, struct bk_shmipc *bsi, size_t maxbytes, u_int
       if (BK_TV_CMP(&endtime,&delta) < 0)
 	goto wouldblock;
     }
-    if (bsi->si_spinus)
-      usleep(bsi->si_spinus);
+    shmipc_wait(bsi, &bsi->si_base->bsh_writehand, writehand, &bsi->si_base->bsh_readwait, timeoutus?&endtime:NULL);
   }
 
   if (maxbytes)
     readbytes = MIN(MIN(readbytes,maxbytes), bsi->si_ringbytes);
 
+ allocate:
   if (!BK_MALLOC(ret))
   {
     bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
@@ -823,10 +1358,10 @@ bk_vptr *bk_shmipc_readall(bk_s B, struct bk_shmipc *bsi, size_t maxbytes, u_int
     goto error;
   }
 
-  if ((ret->len = bk_shmipc_read(B, bsi, ret->ptr, ret->len, 0, BK_SHMIPC_NOBLOCK)) < 1)
+  if ((ret->len = bk_shmipc_read(B, bsi, ret->ptr, ret->len, timeoutus, BK_FLAG_ISSET(bsi->si_flags, SI_BROADCAST)?flags:BK_SHMIPC_NOBLOCK)) < 1)
     goto error;
 
-  if (ret->len != readbytes)
+  if (ret->len != readbytes && BK_FLAG_ISCLEAR(bsi->si_flags, SI_BROADCAST))
   {
     bk_error_printf(B, BK_ERR_WARN, "Unexpected mismatch between requested/available and actual bytes: %d != %d", ret->len, readbytes);
   }
@@ -846,24 +1381,28 @@ bk_vptr *bk_shmipc_readall(bk_s B, struct bk_shmipc *bsi, size_t maxbytes, u_int
 
 
 /**
- * Peek at available data in ipc ring
+ * Reserve space in the ring so the caller can build a message in place
+ * (zero-copy write).  The reserved region is returned as one span, or as
+ * two spans if it wraps around the end of the ring.  Nothing is visible to
+ * the reader until bk_shmipc_write_commit().
  *
  * THREADS: MT-SAFE
  *
  *	@param B BAKA Thread/global state
  *	@param bsi Shared memory structure
- *	@param bytesreadable Copy-out number of bytes someone can read
- *	@param byteswritable Copy-out number of bytes someone can write
- *	@param numothers Copy-out number of other people attached
- *	@param flags Fun for the future
- *	@return <i>-1</i> on failure
- *	@return <br><i>0</i> on success
+ *	@param len Number of bytes to reserve (must fit in an empty ring)
+ *	@param iov Copy-out array of two spans (second has zero length if no wrap)
+ *	@param timeoutus Timeout override (0 for default)
+ *	@param flags BK_SHMIPC_NOBLOCK
+ *	@return <i>-1</i> on failure (including timeout, EAGAIN)
+ *	@return <br><i>number of non-empty spans</i> on success
  */
-int bk_shmipc_peek(bk_s B, struct bk_shmipc *bsi, size_t *bytesreadable, size_t *byteswritable, u_int *buffersize, int *numothers, bk_flags flags)
+int bk_shmipc_write_reserve(bk_s B, struct bk_shmipc *bsi, size_t len, struct iovec *iov, u_int timeoutus, bk_flags flags)
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  u_int32_t writehand;
 
-  if (!bsi)
+  if (!bsi || !iov || !len)
   {
     bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
     if (bsi)
@@ -871,51 +1410,52 @@ int bk_shmipc_peek(bk_s B, struct bk_shmipc *bsi, size_t *bytesreadable, size_t
     BK_RETURN(B, -1);
   }
 
-  if (bytesreadable)
-    *bytesreadable = bytes_available_read(shmipc_atomic32_read(bsi->si_base->bsh_writehand), shmipc_atomic32_read(bsi->si_base->bsh_readhand), bsi->si_ringbytes);
-  if (byteswritable)
-    *byteswritable = bytes_available_write(shmipc_atomic32_read(bsi->si_base->bsh_writehand), shmipc_atomic32_read(bsi->si_base->bsh_readhand), bsi->si_ringbytes);
-  if (buffersize)
-    *buffersize = bsi->si_ringbytes;
-
-  if (numothers)
+  // Security check
+  if (BK_FLAG_ISSET(bsi->si_flags, SI_READONLY))
   {
-    struct shmid_ds buf;
+    bk_error_printf(B, BK_ERR_ERR, "Attempting to write to the read side of shmipc\n");
+    bsi->si_errno = EACCES;
+    BK_RETURN(B, -1);
+  }
 
-    memset(&buf, 0, sizeof(buf));
+  if (len >= bsi->si_ringbytes)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Reservation of %zu bytes can never fit in %u byte ring (%s)\n", len, bsi->si_ringbytes, bsi->si_filename);
+    bsi->si_errno = EMSGSIZE;
+    BK_RETURN(B, -1);
+  }
 
-    if (shmctl(bsi->si_shmid, IPC_STAT, &buf) < 0)
-    {
-      bsi->si_errno = errno;
-      bk_error_printf(B, BK_ERR_ERR, "Could not stat shmipc: %s\n", strerror(errno));
-      BK_RETURN(B, -1);
-    }
+  if (shmipc_await(B, bsi, len, timeoutus, flags) < 0)
+    BK_RETURN(B, -1);
 
-    *numothers = buf.shm_nattch - 1;
-  }
+  writehand = shmipc_load_relaxed(bsi->si_base->bsh_writehand);
+  shmipc_spans(bsi, writehand, len, iov);
+  bsi->si_reserved = len;
 
-  BK_RETURN(B, 0);
+  BK_RETURN(B, iov[1].iov_len?2:1);
 }
 
 
 
 /**
- * Retrieve errno for last operation
+ * Publish bytes previously reserved with bk_shmipc_write_reserve()
  *
  * THREADS: MT-SAFE
  *
  *	@param B BAKA Thread/global state
  *	@param bsi Shared memory structure
+ *	@param len Number of bytes (from the start of the reservation) to publish
  *	@param flags Fun for the future
- *	@return <i>-1</i> on failure to retrieve
- *	@return <br><i>0</i> if last operation succeeded
- *	@return <br><i>E*</i> errno numbers for last operation
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>0</i> on success
  */
-int bk_shmipc_errno(bk_s B, struct bk_shmipc *bsi, bk_flags flags)
+int bk_shmipc_write_commit(bk_s B, struct bk_shmipc *bsi, size_t len, bk_flags flags)
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  u_int32_t writehand;
+  u_int32_t prevhand;
 
-  if (!bsi)
+  if (!bsi || len > bsi->si_reserved || BK_FLAG_ISSET(bsi->si_flags, SI_READONLY))
   {
     bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
     if (bsi)
@@ -923,27 +1463,44 @@ int bk_shmipc_errno(bk_s B, struct bk_shmipc *bsi, bk_flags flags)
     BK_RETURN(B, -1);
   }
 
-  BK_RETURN(B, bsi->si_errno);
+  bsi->si_reserved = 0;
+  prevhand = shmipc_load_relaxed(bsi->si_base->bsh_writehand);
+  writehand = (prevhand + len) % bsi->si_ringbytes;
+
+  shmipc_store_release(bsi->si_base->bsh_writehand, writehand);
+  shmipc_wake(bsi, &bsi->si_base->bsh_writehand, &bsi->si_base->bsh_readwait);
+  if (BK_FLAG_ISSET(bsi->si_flags, SI_NOTIFY))
+    shmipc_notify(bsi, prevhand);
+
+  BK_RETURN(B, 0);
 }
 
 
 
 /**
- * Cancel (artifical EOF) a shmipc
+ * Look at queued data in place (zero-copy read).  All currently readable
+ * data is returned as one span, or as two spans if it wraps around the end
+ * of the ring.  The data stays in the ring until bk_shmipc_read_consume().
  *
  * THREADS: MT-SAFE
  *
  *	@param B BAKA Thread/global state
  *	@param bsi Shared memory structure
- *	@param flags Fun for the future
- *	@return <i>-1</i> on failure
- *	@return <br><i>0</i> on success
+ *	@param len Minimum number of bytes to wait for (0 means 1)
+ *	@param iov Copy-out array of two spans (second has zero length if no wrap)
+ *	@param timeoutus Timeout override (0 for default)
+ *	@param flags BK_SHMIPC_NOBLOCK
+ *	@return <i>-1</i> on failure (including timeout, EAGAIN)
+ *	@return <br><i>0</i> on EOF
+ *	@return <br><i>number of non-empty spans</i> on success
  */
-int bk_shmipc_cancel(bk_s B, struct bk_shmipc *bsi, bk_flags flags)
+int bk_shmipc_read_peek(bk_s B, struct bk_shmipc *bsi, size_t len, struct iovec *iov, u_int timeoutus, bk_flags flags)
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  ssize_t avail;
+  u_int32_t readhand;
 
-  if (!bsi)
+  if (!bsi || !iov)
   {
     bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
     if (bsi)
@@ -951,9 +1508,1394 @@ int bk_shmipc_cancel(bk_s B, struct bk_shmipc *bsi, bk_flags flags)
     BK_RETURN(B, -1);
   }
 
-  shmipc_atomic32_set(bsi->si_base->bsh_magic, SHMIPC_MAGIC_EOF);
+  // Stupidity check
+  if (BK_FLAG_ISCLEAR(bsi->si_flags, SI_READONLY))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Attempting to read to the write side of shmipc\n");
+    bsi->si_errno = EACCES;
+    BK_RETURN(B, -1);
+  }
 
-  BK_RETURN(B, 0);
+  if (len >= bsi->si_ringbytes)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Waiting for %zu bytes can never succeed in %u byte ring (%s)\n", len, bsi->si_ringbytes, bsi->si_filename);
+    bsi->si_errno = EMSGSIZE;
+    BK_RETURN(B, -1);
+  }
+
+  if ((avail = shmipc_await(B, bsi, BK_MAX(len, 1), timeoutus, flags)) <= 0)
+    BK_RETURN(B, avail);
+
+  readhand = shmipc_load_relaxed(bsi->si_base->bsh_readhand);
+  shmipc_spans(bsi, readhand, avail, iov);
+  bsi->si_peeked = avail;
+
+  BK_RETURN(B, iov[1].iov_len?2:1);
+}
+
+
+
+/**
+ * Release bytes previously examined with bk_shmipc_read_peek()
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bsi Shared memory structure
+ *	@param len Number of bytes (from the start of the peeked data) to release
+ *	@param flags Fun for the future
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>0</i> on success
+ */
+int bk_shmipc_read_consume(bk_s B, struct bk_shmipc *bsi, size_t len, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  u_int32_t readhand;
+
+  if (!bsi || len > bsi->si_peeked || BK_FLAG_ISCLEAR(bsi->si_flags, SI_READONLY))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    if (bsi)
+      bsi->si_errno = EINVAL;
+    BK_RETURN(B, -1);
+  }
+
+  bsi->si_peeked = 0;
+  readhand = (shmipc_load_relaxed(bsi->si_base->bsh_readhand) + len) % bsi->si_ringbytes;
+
+  shmipc_store_release(bsi->si_base->bsh_readhand, readhand);
+  shmipc_wake(bsi, &bsi->si_base->bsh_readhand, &bsi->si_base->bsh_writewait);
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Wait until the ring has at least a given number of bytes free (writer)
+ * or readable (reader), following the same EOF, timeout and blocking rules
+ * as bk_shmipc_write()/bk_shmipc_read().
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bsi Shared memory structure
+ *	@param need Number of bytes required
+ *	@param timeoutus Timeout override (0 for default)
+ *	@param flags BK_SHMIPC_NOBLOCK
+ *	@return <i>-1</i> on failure (including timeout, EAGAIN, writer EOF)
+ *	@return <br><i>0</i> on reader EOF
+ *	@return <br><i>bytes available</i> on success
+ */
+static ssize_t shmipc_await(bk_s B, struct bk_shmipc *bsi, size_t need, u_int timeoutus, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  int reader = BK_FLAG_ISSET(bsi->si_flags, SI_READONLY);
+  u_int32_t *otherhand = reader?&bsi->si_base->bsh_writehand:&bsi->si_base->bsh_readhand;
+  u_int32_t *waitflag = reader?&bsi->si_base->bsh_readwait:&bsi->si_base->bsh_writewait;
+  struct timeval endtime;
+  struct timeval delta;
+  u_int32_t myhand, theirhand;
+  size_t avail;
+
+  if (BK_FLAG_ISSET(bsi->si_flags, SI_BROADCAST))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Zero-copy operations are not supported on broadcast rings (%s)\n", bsi->si_filename);
+    bsi->si_errno = ENOTSUP;
+    BK_RETURN(B, -1);
+  }
+
+  if (BK_FLAG_ISSET(bsi->si_flags, SI_SAWEND))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Peer is no longer reachable (%s)\n", bsi->si_filename);
+    bsi->si_errno = reader?0:ENETRESET;
+    BK_RETURN(B, reader?0:-1);
+  }
+
+  // Security check
+  if ((myhand = shmipc_load_relaxed(*(reader?&bsi->si_base->bsh_readhand:&bsi->si_base->bsh_writehand))) >= bsi->si_ringbytes)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Memory corruption or attack to induce memory corruption\n");
+    bsi->si_errno = EBADSLT;
+    BK_RETURN(B, -1);
+  }
+
+  if (!timeoutus)
+    timeoutus = bsi->si_timeoutus;
+  if (timeoutus)
+  {
+    gettimeofday(&endtime, NULL);
+    delta.tv_sec = timeoutus / 1000000;
+    delta.tv_usec = timeoutus % 1000000;
+    BK_TV_ADD(&endtime,&endtime,&delta);
+  }
+
+  theirhand = bsi->si_theirhand;
+  while (1)
+  {
+    int numothers = 0;
+
+    if (reader)
+      avail = bytes_available_read(theirhand, myhand, bsi->si_ringbytes);
+    else
+      avail = bytes_available_write(myhand, theirhand, bsi->si_ringbytes);
+
+    if (avail >= need)
+      break;
+
+    if (reader && BK_FLAG_ISSET(bsi->si_flags, SI_NOTIFY))
+      shmipc_full_fence();			// Pairs with shmipc_notify()
+
+    // Our copy of their hand is stale, go get the real one before blocking
+    if (theirhand == bsi->si_theirhand && theirhand != shmipc_theirhand(bsi))
+    {
+      theirhand = bsi->si_theirhand;
+      continue;
+    }
+
+    bk_shmipc_peek(B, bsi, NULL, NULL, NULL, &numothers, 0);
+
+    if (numothers < 1 || (reader && shmipc_load_acquire(bsi->si_base->bsh_magic) == SHMIPC_MAGIC_EOF))
+    {
+      // EOF
+      BK_FLAG_SET(bsi->si_flags, SI_SAWEND);
+      bsi->si_errno = reader?0:ENETRESET;
+      BK_RETURN(B, reader?0:-1);
+    }
+
+    if (BK_FLAG_ISSET(flags, BK_SHMIPC_NOBLOCK))
+    {
+    wouldblock:
+      bsi->si_errno = EAGAIN;
+      bk_error_printf(B, BK_ERR_WARN, "Zero-copy %s failed--timeout (%u) with %zu of %zu bytes available (%s)\n", reader?"read":"write", timeoutus, avail, need, bsi->si_filename);
+      BK_RETURN(B, -1);
+    }
+
+    if (timeoutus)
+    {
+      gettimeofday(&delta, NULL);
+      if (BK_TV_CMP(&endtime,&delta) < 0)
+	goto wouldblock;
+    }
+    shmipc_wait(bsi, otherhand, theirhand, waitflag, timeoutus?&endtime:NULL);
+    theirhand = shmipc_theirhand(bsi);
+  }
+
+  BK_RETURN(B, avail);
+}
+
+
+
+/**
+ * Describe a region of the ring starting at a hand as one or two spans
+ *
+ *	@param bsi Shared memory structure
+ *	@param hand Starting byte offset in ring
+ *	@param len Length of region
+ *	@param iov Copy-out array of two spans
+ */
+static inline void shmipc_spans(struct bk_shmipc *bsi, u_int32_t hand, size_t len, struct iovec *iov)
+{
+  size_t first = MIN(len, (size_t)(bsi->si_ringbytes - hand));
+
+  iov[0].iov_base = (char *)bsi->si_ring + hand;
+  iov[0].iov_len = first;
+  iov[1].iov_base = (char *)bsi->si_ring;
+  iov[1].iov_len = len - first;
+}
+
+
+
+/**
+ * Refresh our cached copy of the other party's hand from shared memory
+ *
+ *	@param bsi Shared memory structure
+ *	@return <i>other party's hand</i>
+ */
+static inline u_int32_t shmipc_theirhand(struct bk_shmipc *bsi)
+{
+  if (BK_FLAG_ISSET(bsi->si_flags, SI_READONLY))
+    bsi->si_theirhand = shmipc_load_acquire(bsi->si_base->bsh_writehand);
+  else
+    bsi->si_theirhand = shmipc_load_acquire(bsi->si_base->bsh_readhand);
+  return(bsi->si_theirhand);
+}
+
+
+
+/**
+ * Tell an event-loop reader that the ring has become non-empty
+ *
+ * The writer has just published data written at prevhand.  The reader
+ * fences between publishing its read hand and its final check for data,
+ * and we fence between publishing our write hand and this check, so either
+ * the reader sees our data or we see it caught up (and signal it).
+ *
+ *	@param bsi Shared memory structure (writer)
+ *	@param prevhand Write hand before the data just published
+ */
+static inline void shmipc_notify(struct bk_shmipc *bsi, u_int32_t prevhand)
+{
+  u_int64_t one = 1;
+
+  shmipc_full_fence();
+  if (shmipc_theirhand(bsi) != prevhand)
+    return;					// Reader is still working through older data
+
+  // Only fails if the counter would overflow, in which case the reader is well aware
+  (void)write(bsi->si_notifyfd, &one, sizeof(one));
+}
+
+
+
+#ifdef SHMIPC_HAVE_EVENTFD
+/**
+ * Pass a file descriptor over a connected unix socket
+ *
+ *	@param sock Connected unix socket
+ *	@param fd Descriptor to pass
+ *	@return <i>-1</i> on failure (errno set)
+ *	@return <br><i>0</i> on success
+ */
+static int shmipc_sendfd(int sock, int fd)
+{
+  union
+  {
+    struct cmsghdr	cm;
+    char		buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  char token = 'F';
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+  iov.iov_base = &token;
+  iov.iov_len = sizeof(token);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+  if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(token))
+    return(-1);
+
+  return(0);
+}
+
+
+
+/**
+ * Receive a file descriptor passed over a connected unix socket
+ *
+ *	@param sock Connected unix socket
+ *	@return <i>-1</i> on failure (nothing passed, peer closed, or timeout)
+ *	@return <br><i>file descriptor</i> on success (close-on-exec)
+ */
+static int shmipc_recvfd(int sock)
+{
+  union
+  {
+    struct cmsghdr	cm;
+    char		buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct iovec iov;
+  char token;
+  int fd = -1;
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &token;
+  iov.iov_len = sizeof(token);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(token))
+    return(-1);
+
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+  {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+      memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  }
+
+  return(fd);
+}
+
+
+
+/**
+ * Name of the abstract unix socket used to hand the eventfd to the reader
+ *
+ *	@param bsi Shared memory structure
+ *	@param sun Copy-out socket address
+ *	@param sunlen Copy-out socket address length
+ */
+static void shmipc_notify_sockname(struct bk_shmipc *bsi, struct sockaddr_un *sun, socklen_t *sunlen)
+{
+  memset(sun, 0, sizeof(*sun));
+  sun->sun_family = AF_UNIX;
+  snprintf(sun->sun_path + 1, sizeof(sun->sun_path) - 1, SHMIPC_NOTIFY_SOCKFMT, (u_int)bsi->si_shmkey, bsi->si_base->bsh_generation);
+  *sunlen = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(sun->sun_path + 1);
+}
+
+
+
+/**
+ * Writer: create the notification eventfd and listen for the reader
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bsi Shared memory structure (writer)
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>0</i> on success
+ */
+static int shmipc_notify_listen(bk_s B, struct bk_shmipc *bsi)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct sockaddr_un sun;
+  socklen_t sunlen;
+
+  if ((bsi->si_notifyfd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) < 0)
+  {
+    bk_error_printf(B, BK_ERR_WARN, "Could not create notification eventfd: %s\n", strerror(errno));
+    goto error;
+  }
+
+  if ((bsi->si_notifysock = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0)) < 0)
+  {
+    bk_error_printf(B, BK_ERR_WARN, "Could not create notification socket: %s\n", strerror(errno));
+    goto error;
+  }
+
+  shmipc_notify_sockname(bsi, &sun, &sunlen);
+  if (bind(bsi->si_notifysock, (struct sockaddr *)&sun, sunlen) < 0 || listen(bsi->si_notifysock, 1) < 0)
+  {
+    bk_error_printf(B, BK_ERR_WARN, "Could not listen for notification reader (%s): %s\n", bsi->si_filename, strerror(errno));
+    goto error;
+  }
+
+  BK_RETURN(B, 0);
+
+ error:
+  if (bsi->si_notifysock >= 0)
+    close(bsi->si_notifysock);
+  bsi->si_notifysock = -1;
+  if (bsi->si_notifyfd >= 0)
+    close(bsi->si_notifyfd);
+  bsi->si_notifyfd = -1;
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * Reader: connect to the writer to collect the notification eventfd later
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bsi Shared memory structure (reader)
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>0</i> on success
+ */
+static int shmipc_notify_connect(bk_s B, struct bk_shmipc *bsi)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct sockaddr_un sun;
+  socklen_t sunlen;
+
+  if ((bsi->si_notifysock = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)) < 0)
+  {
+    bk_error_printf(B, BK_ERR_WARN, "Could not create notification socket: %s\n", strerror(errno));
+    BK_RETURN(B, -1);
+  }
+
+  shmipc_notify_sockname(bsi, &sun, &sunlen);
+  if (connect(bsi->si_notifysock, (struct sockaddr *)&sun, sunlen) < 0)
+  {
+    bk_error_printf(B, BK_ERR_WARN, "Could not connect to notification writer (%s): %s\n", bsi->si_filename, strerror(errno));
+    close(bsi->si_notifysock);
+    bsi->si_notifysock = -1;
+    BK_RETURN(B, -1);
+  }
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Writer: pass the eventfd to the (already connected) reader
+ *
+ * The listening socket is closed either way, which also tells a reader
+ * still waiting for the eventfd that it is not coming.
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bsi Shared memory structure (writer)
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>0</i> on success
+ */
+static int shmipc_notify_send(bk_s B, struct bk_shmipc *bsi)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  int conn;
+  int ret = -1;
+
+  if ((conn = accept4(bsi->si_notifysock, NULL, NULL, SOCK_CLOEXEC)) < 0)
+  {
+    bk_error_printf(B, BK_ERR_WARN, "Reader did not ask for notification eventfd (%s): %s\n", bsi->si_filename, strerror(errno));
+    goto done;
+  }
+
+  if (shmipc_sendfd(conn, bsi->si_notifyfd) < 0)
+  {
+    bk_error_printf(B, BK_ERR_WARN, "Could not pass notification eventfd to reader (%s): %s\n", bsi->si_filename, strerror(errno));
+    goto done;
+  }
+
+  BK_FLAG_SET(bsi->si_flags, SI_NOTIFY);
+  ret = 0;
+
+ done:
+  if (conn >= 0)
+    close(conn);
+  close(bsi->si_notifysock);
+  bsi->si_notifysock = -1;
+  if (ret < 0)
+  {
+    close(bsi->si_notifyfd);
+    bsi->si_notifyfd = -1;
+  }
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Reader: receive the notification eventfd from the writer
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bsi Shared memory structure (reader)
+ *	@return <i>-1</i> on failure (writer did not send one)
+ *	@return <br><i>0</i> on success
+ */
+static int shmipc_notify_recv(bk_s B, struct bk_shmipc *bsi)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  int ret = -1;
+
+  if ((bsi->si_notifyfd = shmipc_recvfd(bsi->si_notifysock)) < 0)
+  {
+    bk_error_printf(B, BK_ERR_WARN, "Writer did not pass notification eventfd (%s)\n", bsi->si_filename);
+    goto done;
+  }
+
+  BK_FLAG_SET(bsi->si_flags, SI_NOTIFY);
+  ret = 0;
+
+ done:
+  close(bsi->si_notifysock);
+  bsi->si_notifysock = -1;
+  BK_RETURN(B, ret);
+}
+#endif /* SHMIPC_HAVE_EVENTFD */
+
+
+
+#ifdef SHMIPC_HAVE_MEMFD
+/**
+ * Name of the abstract unix socket a memfd writer hands its ring out on
+ *
+ *	@param bsi Shared memory structure
+ *	@param sun Copy-out socket address
+ *	@param sunlen Copy-out socket address length
+ */
+static void shmipc_memfd_sockname(struct bk_shmipc *bsi, struct sockaddr_un *sun, socklen_t *sunlen)
+{
+  memset(sun, 0, sizeof(*sun));
+  sun->sun_family = AF_UNIX;
+  snprintf(sun->sun_path + 1, sizeof(sun->sun_path) - 1, SHMIPC_MEMFD_SOCKFMT, (u_int)bsi->si_shmkey);
+  *sunlen = offsetof(struct sockaddr_un, sun_path) + 1 + strlen(sun->sun_path + 1);
+}
+
+
+
+/**
+ * Writer: create and map a memfd backed segment, and listen for the reader
+ *
+ * With BK_SHMIPC_HUGEPAGE a hugetlb memfd (rounded up to whole huge pages)
+ * is tried first; without reserved huge pages we fall back to normal pages
+ * advised for transparent huge pages.  The size is sealed so the reader
+ * cannot truncate the segment out from under us.
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bsi Shared memory structure (writer)
+ *	@param segsize Size of header plus ring
+ *	@param flags BK_SHMIPC_HUGEPAGE
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>0</i> on success
+ */
+static int shmipc_memfd_create(bk_s B, struct bk_shmipc *bsi, size_t segsize, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  char memname[64];
+  struct sockaddr_un sun;
+  socklen_t sunlen;
+  int hugetlb = 0;
+
+  // Shows up in /proc/<pid>/fd to help humans
+  snprintf(memname, sizeof(memname), "bkshmipc:%s", bsi->si_filename);
+
+#ifdef MFD_HUGETLB
+  if (BK_FLAG_ISSET(flags, BK_SHMIPC_HUGEPAGE) && bk_hugepagesize(B))
+  {
+    size_t hugesize = ((segsize + bk_hugepagesize(B) - 1) / bk_hugepagesize(B)) * bk_hugepagesize(B);
+
+    if ((bsi->si_memfd = memfd_create(memname, MFD_CLOEXEC|MFD_ALLOW_SEALING|MFD_HUGETLB)) >= 0 && ftruncate(bsi->si_memfd, hugesize) == 0 &&
+	(bsi->si_base = mmap(NULL, hugesize, PROT_READ|PROT_WRITE, MAP_SHARED, bsi->si_memfd, 0)) != MAP_FAILED)
+    {
+      segsize = hugesize;
+      hugetlb = 1;
+    }
+    else
+    {
+      bk_error_printf(B, BK_ERR_WARN, "Could not get huge page memfd, using normal pages (%s): %s\n", bsi->si_filename, strerror(errno));
+      if (bsi->si_memfd >= 0)
+	close(bsi->si_memfd);
+      bsi->si_memfd = -1;
+      bsi->si_base = NULL;
+    }
+  }
+#endif /* MFD_HUGETLB */
+
+  if (!hugetlb)
+  {
+    if ((bsi->si_memfd = memfd_create(memname, MFD_CLOEXEC|MFD_ALLOW_SEALING)) < 0)
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not create memfd (%s): %s\n", bsi->si_filename, strerror(errno));
+      goto error;
+    }
+
+    if (ftruncate(bsi->si_memfd, segsize) < 0)
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not size memfd to %zu bytes (%s): %s\n", segsize, bsi->si_filename, strerror(errno));
+      goto error;
+    }
+
+    if ((bsi->si_base = mmap(NULL, segsize, PROT_READ|PROT_WRITE, MAP_SHARED, bsi->si_memfd, 0)) == MAP_FAILED)
+    {
+      bsi->si_base = NULL;
+      bk_error_printf(B, BK_ERR_ERR, "Could not map memfd (%s): %s\n", bsi->si_filename, strerror(errno));
+      goto error;
+    }
+
+    if (BK_FLAG_ISSET(flags, BK_SHMIPC_HUGEPAGE))
+      shmipc_hugepage_advise(bsi, segsize);
+  }
+
+#ifdef F_SEAL_SHRINK
+  if (fcntl(bsi->si_memfd, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_SEAL) < 0)
+    bk_error_printf(B, BK_ERR_NOTICE, "Could not seal memfd size (%s): %s\n", bsi->si_filename, strerror(errno));
+#endif /* F_SEAL_SHRINK */
+
+  bsi->si_segsize = segsize;
+  BK_FLAG_SET(bsi->si_flags, SI_MEMFD);
+
+  if ((bsi->si_memsock = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0)) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not create memfd handover socket: %s\n", strerror(errno));
+    goto error;
+  }
+
+  shmipc_memfd_sockname(bsi, &sun, &sunlen);
+  if (bind(bsi->si_memsock, (struct sockaddr *)&sun, sunlen) < 0 || listen(bsi->si_memsock, 4) < 0)
+  {
+    // EADDRINUSE: a live writer already owns this name
+    bk_error_printf(B, BK_ERR_ERR, "Could not listen for memfd reader (%s): %s\n", bsi->si_filename, strerror(errno));
+    goto error;
+  }
+
+  BK_RETURN(B, 0);
+
+ error:
+  // bk_shmipc_destroy() cleans up the rest
+  if (bsi->si_base && BK_FLAG_ISCLEAR(bsi->si_flags, SI_MEMFD))
+  {
+    munmap(bsi->si_base, segsize);
+    bsi->si_base = NULL;
+  }
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * Writer: hand the memfd to any reader waiting for it (never blocks)
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bsi Shared memory structure (writer)
+ */
+static void shmipc_memfd_serve(bk_s B, struct bk_shmipc *bsi)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  int conn;
+
+  while ((conn = accept4(bsi->si_memsock, NULL, NULL, SOCK_CLOEXEC)) >= 0)
+  {
+    if (shmipc_sendfd(conn, bsi->si_memfd) < 0)
+      bk_error_printf(B, BK_ERR_WARN, "Could not pass memfd to reader (%s): %s\n", bsi->si_filename, strerror(errno));
+    close(conn);
+  }
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Reader: try to collect and map the ring from a memfd writer
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bsi Shared memory structure (reader)
+ *	@param endtime When to give up waiting for the writer (NULL for never)
+ *	@return <i>-1</i> if there is no memfd writer (or it failed us)
+ *	@return <br><i>0</i> on success
+ */
+static int shmipc_memfd_attach(bk_s B, struct bk_shmipc *bsi, struct timeval *endtime)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct sockaddr_un sun;
+  socklen_t sunlen;
+  struct stat st;
+  int sock;
+  int fd = -1;
+  void *base;
+
+  if ((sock = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)) < 0)
+    BK_RETURN(B, -1);
+
+  shmipc_memfd_sockname(bsi, &sun, &sunlen);
+  if (connect(sock, (struct sockaddr *)&sun, sunlen) < 0)
+  {
+    // Normal for SysV writers
+    close(sock);
+    BK_RETURN(B, -1);
+  }
+
+  if (endtime)
+  {
+    struct timeval now, left;
+
+    gettimeofday(&now, NULL);
+    BK_TV_SUB(&left, endtime, &now);
+    if (left.tv_sec < 0 || (!left.tv_sec && left.tv_usec <= 0))
+    {
+      left.tv_sec = 0;
+      left.tv_usec = 1;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &left, sizeof(left));
+  }
+
+  fd = shmipc_recvfd(sock);
+  close(sock);
+
+  if (fd < 0)
+  {
+    bk_error_printf(B, BK_ERR_WARN, "Memfd writer did not pass its ring (%s)\n", bsi->si_filename);
+    BK_RETURN(B, -1);
+  }
+
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct bk_shmipc_header))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Memfd from writer is unusable (%s)\n", bsi->si_filename);
+    close(fd);
+    BK_RETURN(B, -1);
+  }
+
+  if ((base = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not map memfd (%s): %s\n", bsi->si_filename, strerror(errno));
+    close(fd);
+    BK_RETURN(B, -1);
+  }
+
+  bsi->si_memfd = fd;
+  bsi->si_base = base;
+  bsi->si_segsize = st.st_size;
+  BK_FLAG_SET(bsi->si_flags, SI_MEMFD);
+
+  BK_RETURN(B, 0);
+}
+#endif /* SHMIPC_HAVE_MEMFD */
+
+
+
+/**
+ * Ask for transparent huge pages on the segment (best effort: only helps
+ * where they are enabled for shared memory)
+ *
+ *	@param bsi Shared memory structure
+ *	@param segsize Size of mapping
+ */
+static void shmipc_hugepage_advise(struct bk_shmipc *bsi, size_t segsize)
+{
+#ifdef MADV_HUGEPAGE
+  madvise(bsi->si_base, segsize, MADV_HUGEPAGE);
+#endif /* MADV_HUGEPAGE */
+}
+
+
+
+/**
+ * Get the descriptor which becomes readable when the ring goes from empty
+ * to non-empty (or the writer goes away), for bk_run_handle() or poll().
+ * Only available if the writer was created with BK_SHMIPC_NOTIFY.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bsi Shared memory structure (reader)
+ *	@param flags Fun for the future
+ *	@return <i>-1</i> on failure (ENOTSUP if no notification)
+ *	@return <br><i>file descriptor</i> on success (owned by bsi)
+ */
+int bk_shmipc_notify_fd(bk_s B, struct bk_shmipc *bsi, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!bsi)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (BK_FLAG_ISCLEAR(bsi->si_flags, SI_NOTIFY) || BK_FLAG_ISCLEAR(bsi->si_flags, SI_READONLY))
+  {
+    bsi->si_errno = ENOTSUP;
+    BK_RETURN(B, -1);
+  }
+
+  BK_RETURN(B, bsi->si_notifyfd);
+}
+
+
+
+/**
+ * Acknowledge notification.  Afterwards, read with BK_SHMIPC_NOBLOCK
+ * until EAGAIN (or EOF) before going back to the event loop; otherwise
+ * data already in the ring will not generate another notification.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bsi Shared memory structure (reader)
+ *	@param flags Fun for the future
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>0</i> if there was no notification pending
+ *	@return <br><i>1</i> if notification was pending
+ */
+int bk_shmipc_notify_drain(bk_s B, struct bk_shmipc *bsi, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  u_int64_t cnt;
+
+  if (!bsi || BK_FLAG_ISCLEAR(bsi->si_flags, SI_NOTIFY))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    if (bsi)
+      bsi->si_errno = ENOTSUP;
+    BK_RETURN(B, -1);
+  }
+
+  if (read(bsi->si_notifyfd, &cnt, sizeof(cnt)) != sizeof(cnt))
+  {
+    if (errno == EAGAIN)
+      BK_RETURN(B, 0);
+    bsi->si_errno = errno;
+    bk_error_printf(B, BK_ERR_ERR, "Could not read notification eventfd: %s\n", strerror(errno));
+    BK_RETURN(B, -1);
+  }
+
+  BK_RETURN(B, 1);
+}
+
+
+
+/**
+ * Claim a broadcast reader slot and start reading at the current write
+ * position.  Slots whose reader process has died are reclaimed first.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bsi Shared memory structure (reader)
+ *	@return <i>-1</i> on failure (no free slot)
+ *	@return <br><i>0</i> on success
+ */
+static int shmipc_bcast_join(bk_s B, struct bk_shmipc *bsi)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_shmipc_slot *slot = SHMIPC_SLOTS(bsi->si_base);
+  u_int cnt;
+
+  for (cnt = 0; cnt < bsi->si_base->bsh_maxreaders; cnt++, slot++)
+  {
+    u_int32_t state = BSS_FREE;
+    u_int64_t pos;
+
+    if (!__atomic_compare_exchange_n(&slot->bss_state, &state, BSS_CLAIMED, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+    {
+      if (state != BSS_ACTIVE || !shmipc_bcast_reap(slot))
+	continue;
+      state = BSS_FREE;
+      if (!__atomic_compare_exchange_n(&slot->bss_state, &state, BSS_CLAIMED, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+	continue;
+    }
+
+    slot->bss_pid = getpid();
+    slot->bss_writewait = 0;
+    slot->bss_overruns = 0;
+    slot->bss_lostbytes = 0;
+
+    /*
+     * Until the writer sees us active it may run a full ring ahead of the
+     * position we sampled, so resample until we are safely inside the ring.
+     */
+    do
+    {
+      pos = shmipc_load_acquire(bsi->si_base->bsh_writepos);
+      shmipc_store_release(slot->bss_readpos, pos);
+      shmipc_store_release(slot->bss_state, BSS_ACTIVE);
+      shmipc_full_fence();
+    } while (shmipc_load_acquire(bsi->si_base->bsh_writepos) - pos >= bsi->si_ringbytes);
+
+    bsi->si_slot = slot;
+    bsi->si_pos = pos;
+    BK_RETURN(B, 0);
+  }
+
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * Free an active broadcast slot if its reader process no longer exists
+ *
+ *	@param slot Reader slot
+ *	@return <i>1</i> if the slot was reclaimed
+ *	@return <br><i>0</i> otherwise
+ */
+static int shmipc_bcast_reap(struct bk_shmipc_slot *slot)
+{
+  u_int32_t state = BSS_ACTIVE;
+  pid_t pid = shmipc_load_relaxed(slot->bss_pid);
+
+  if (!pid || kill(pid, 0) == 0 || errno != ESRCH)
+    return(0);
+
+  return(__atomic_compare_exchange_n(&slot->bss_state, &state, BSS_FREE, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+}
+
+
+
+/**
+ * Find the position of the slowest active broadcast reader
+ *
+ *	@param bsi Shared memory structure
+ *	@param slowest Copy-out slot of slowest reader (NULL if none active)
+ *	@return <i>position of slowest reader</i>, or write position if no readers
+ */
+static u_int64_t shmipc_bcast_minpos(struct bk_shmipc *bsi, struct bk_shmipc_slot **slowest)
+{
+  struct bk_shmipc_slot *slot = SHMIPC_SLOTS(bsi->si_base);
+  u_int64_t minpos = shmipc_load_acquire(bsi->si_base->bsh_writepos);
+  u_int cnt;
+
+  if (slowest)
+    *slowest = NULL;
+
+  for (cnt = 0; cnt < bsi->si_base->bsh_maxreaders; cnt++, slot++)
+  {
+    u_int64_t pos;
+
+    if (shmipc_load_acquire(slot->bss_state) != BSS_ACTIVE)
+      continue;
+
+    if ((pos = shmipc_load_acquire(slot->bss_readpos)) < minpos)
+    {
+      minpos = pos;
+      if (slowest)
+	*slowest = slot;
+    }
+  }
+
+  return(minpos);
+}
+
+
+
+/**
+ * Test whether the writer of a broadcast ring has gone away
+ *
+ *	@param bsi Shared memory structure (reader)
+ *	@return <i>1</i> if the writer closed or died
+ *	@return <br><i>0</i> otherwise
+ */
+static int shmipc_bcast_writergone(struct bk_shmipc *bsi)
+{
+  pid_t pid = bsi->si_base->bsh_writerpid;
+
+  if (shmipc_load_acquire(bsi->si_base->bsh_magic) == SHMIPC_MAGIC_EOF)
+    return(1);
+
+  return(pid && kill(pid, 0) < 0 && errno == ESRCH);
+}
+
+
+
+/**
+ * Write data to a broadcast ring
+ *
+ * In block mode the free space is measured from the slowest active reader
+ * (cached, and only rescanned when the cache says the ring is full).  In
+ * overwrite mode the writer first announces the region it is about to
+ * overwrite in bsh_writelimit, so a reader copying from that region can
+ * tell its copy may be torn.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bsi Shared memory structure
+ *	@param cdata Data to write
+ *	@param len Number of bytes to write
+ *	@param timeoutus Timeout (0 for default)
+ *	@param flags BK_SHMIPC_WRITEALL|BK_SHMIPC_NOBLOCK|BK_SHMIPC_DROP2BLOCK
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>bytes written</i> on success
+ */
+static ssize_t shmipc_bcast_write(bk_s B, struct bk_shmipc *bsi, char *cdata, size_t len, u_int timeoutus, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  int overwrite = BK_FLAG_ISSET(bsi->si_flags, SI_OVERWRITE);
+  ssize_t ret = 0;
+  struct timeval endtime;
+  struct timeval delta;
+
+  if (!timeoutus)
+    timeoutus = bsi->si_timeoutus;
+  if (timeoutus)
+  {
+    gettimeofday(&endtime, NULL);
+    delta.tv_sec = timeoutus / 1000000;
+    delta.tv_usec = timeoutus % 1000000;
+    BK_TV_ADD(&endtime,&endtime,&delta);
+  }
+
+  if (!overwrite && BK_FLAG_ISSET(flags,BK_SHMIPC_DROP2BLOCK) && len > bsi->si_ringbytes - (bsi->si_pos - shmipc_bcast_minpos(bsi, NULL)))
+  {
+    // EWOULDBLOCK
+    BK_RETURN(B, 0);
+  }
+
+  while (len)
+  {
+    u_int64_t writelen;
+    u_int32_t offset = bsi->si_pos % bsi->si_ringbytes;
+
+    if (overwrite)
+    {
+      writelen = bsi->si_ringbytes;
+    }
+    else if (!(writelen = bsi->si_ringbytes - (bsi->si_pos - bsi->si_minpos)))
+    {
+      struct bk_shmipc_slot *slowest;
+
+      // Our copy of the slowest reader is stale, go look at the slots
+      if ((writelen = bsi->si_ringbytes - (bsi->si_pos - (bsi->si_minpos = shmipc_bcast_minpos(bsi, &slowest)))))
+	continue;
+
+      if (ret && (BK_FLAG_ISCLEAR(flags, BK_SHMIPC_WRITEALL)))
+      {
+	// Forward progress was made
+	BK_RETURN(B, ret);
+      }
+
+      // A dead reader would block us forever
+      if (slowest && shmipc_bcast_reap(slowest))
+	continue;
+
+      if (BK_FLAG_ISSET(flags, BK_SHMIPC_NOBLOCK))
+      {
+      wouldblock:
+	bsi->si_errno = EAGAIN;
+	bk_error_printf(B, BK_ERR_WARN, "Broadcast write failed--timeout (%u) with no free space behind slowest reader (%s)\n", timeoutus, bsi->si_filename);
+	BK_RETURN(B, -1);
+      }
+
+      if (timeoutus)
+      {
+	gettimeofday(&delta, NULL);
+	if (BK_TV_CMP(&endtime,&delta) < 0)
+	  goto wouldblock;
+      }
+      if (slowest)
+	shmipc_wait(bsi, SHMIPC_POS_LOWORD(slowest->bss_readpos), (u_int32_t)bsi->si_minpos, &slowest->bss_writewait, timeoutus?&endtime:NULL);
+      continue;
+    }
+
+    writelen = MIN(writelen, len);
+    writelen = MIN(writelen, bsi->si_ringbytes - offset);
+
+    if (overwrite)
+    {
+      // Seqlock-style announcement: limit store is ordered before the data stores
+      shmipc_store_relaxed(bsi->si_base->bsh_writelimit, bsi->si_pos + writelen);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    memcpy((char *)bsi->si_ring + offset, cdata, writelen);
+    cdata += writelen;
+    len -= writelen;
+    ret += writelen;
+    bsi->si_pos += writelen;
+
+    shmipc_store_release(bsi->si_base->bsh_writepos, bsi->si_pos);
+    shmipc_store_release(bsi->si_base->bsh_writehand, bsi->si_pos % bsi->si_ringbytes);
+    shmipc_wake(bsi, &bsi->si_base->bsh_writehand, &bsi->si_base->bsh_readwait);
+  }
+
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Read data from a broadcast ring
+ *
+ * If the writer has lapped us (overwrite mode), or may have overwritten
+ * the bytes while we copied them, the data is discarded, we skip to the
+ * newest data, and the loss is recorded in our slot.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bsi Shared memory structure
+ *	@param cdata Data to read (copy-out)
+ *	@param len Number of bytes to read
+ *	@param timeoutus Timeout (0 for default)
+ *	@param flags BK_SHMIPC_READALL BK_SHMIPC_NOBLOCK
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>bytes actually read</i> on success (0 on EOF)
+ */
+static ssize_t shmipc_bcast_read(bk_s B, struct bk_shmipc *bsi, char *cdata, size_t len, u_int timeoutus, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_shmipc_slot *slot = bsi->si_slot;
+  ssize_t ret = 0;
+  struct timeval endtime;
+  struct timeval delta;
+
+  if (!timeoutus)
+    timeoutus = bsi->si_timeoutus;
+  if (timeoutus)
+  {
+    gettimeofday(&endtime, NULL);
+    delta.tv_sec = timeoutus / 1000000;
+    delta.tv_usec = timeoutus % 1000000;
+    BK_TV_ADD(&endtime,&endtime,&delta);
+  }
+
+  while (len)
+  {
+    u_int64_t writepos = shmipc_load_acquire(bsi->si_base->bsh_writepos);
+    u_int64_t readlen = writepos - bsi->si_pos;
+    u_int32_t offset = bsi->si_pos % bsi->si_ringbytes;
+
+    if (readlen > bsi->si_ringbytes)
+    {
+      // Lapped by the writer
+      goto overrun;
+    }
+
+    if (!readlen)
+    {
+      if (ret && (BK_FLAG_ISCLEAR(flags, BK_SHMIPC_READALL)))
+      {
+	// Forward progress was made
+	BK_RETURN(B, ret);
+      }
+
+      if (shmipc_bcast_writergone(bsi))
+      {
+	// EOF
+	BK_FLAG_SET(bsi->si_flags, SI_SAWEND);
+	bsi->si_errno = 0;
+	BK_RETURN(B, ret);
+      }
+
+      if (BK_FLAG_ISSET(flags, BK_SHMIPC_NOBLOCK))
+      {
+      wouldblock:
+	bsi->si_errno = EAGAIN;
+	bk_error_printf(B, BK_ERR_WARN, "Broadcast read failed--timeout (%u) with no data available (%s)\n", timeoutus, bsi->si_filename);
+	BK_RETURN(B, -1);
+      }
+
+      if (timeoutus)
+      {
+	gettimeofday(&delta, NULL);
+	if (BK_TV_CMP(&endtime,&delta) < 0)
+	  goto wouldblock;
+      }
+      shmipc_wait(bsi, &bsi->si_base->bsh_writehand, writepos % bsi->si_ringbytes, &bsi->si_base->bsh_readwait, timeoutus?&endtime:NULL);
+      continue;
+    }
+
+    readlen = MIN(readlen, len);
+    readlen = MIN(readlen, bsi->si_ringbytes - offset);
+    memcpy(cdata, (char *)bsi->si_ring + offset, readlen);
+
+    if (BK_FLAG_ISSET(bsi->si_flags, SI_OVERWRITE))
+    {
+      // Was any of what we just copied being overwritten?
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (shmipc_load_relaxed(bsi->si_base->bsh_writelimit) > bsi->si_pos + bsi->si_ringbytes)
+	goto overrun;
+    }
+
+    cdata += readlen;
+    len -= readlen;
+    ret += readlen;
+    bsi->si_pos += readlen;
+
+    shmipc_store_release(slot->bss_readpos, bsi->si_pos);
+    shmipc_wake(bsi, SHMIPC_POS_LOWORD(slot->bss_readpos), &slot->bss_writewait);
+    continue;
+
+  overrun:
+    writepos = shmipc_load_acquire(bsi->si_base->bsh_writepos);
+    slot->bss_overruns++;
+    slot->bss_lostbytes += writepos - bsi->si_pos;
+    bk_error_printf(B, BK_ERR_WARN, "Broadcast reader lapped by writer, skipping %llu bytes (%s)\n", (unsigned long long)(writepos - bsi->si_pos), bsi->si_filename);
+    bsi->si_pos = writepos;
+    shmipc_store_release(slot->bss_readpos, bsi->si_pos);
+  }
+
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Report on the readers of a broadcast ring (writer or any reader)
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bsi Shared memory structure
+ *	@param info Copy-out array of reader information
+ *	@param maxinfo Number of elements in info
+ *	@param flags Fun for the future
+ *	@return <i>-1</i> on failure (including not a broadcast ring)
+ *	@return <br><i>number of active readers</i> on success (may exceed maxinfo)
+ */
+int bk_shmipc_readers(bk_s B, struct bk_shmipc *bsi, struct bk_shmipc_readerinfo *info, u_int maxinfo, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!bsi || (maxinfo && !info))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    if (bsi)
+      bsi->si_errno = EINVAL;
+    BK_RETURN(B, -1);
+  }
+
+  if (BK_FLAG_ISCLEAR(bsi->si_flags, SI_BROADCAST))
+  {
+    bsi->si_errno = ENOTSUP;
+    BK_RETURN(B, -1);
+  }
+
+  BK_RETURN(B, shmipc_readers_fill(bsi->si_base, info, maxinfo));
+}
+
+
+
+/**
+ * Fill out reader information from the slots of a broadcast ring
+ *
+ *	@param base Ring header
+ *	@param info Copy-out array of reader information
+ *	@param maxinfo Number of elements in info
+ *	@return <i>number of active readers</i>
+ */
+static int shmipc_readers_fill(struct bk_shmipc_header *base, struct bk_shmipc_readerinfo *info, u_int maxinfo)
+{
+  struct bk_shmipc_slot *slot = SHMIPC_SLOTS(base);
+  u_int64_t writepos = shmipc_load_acquire(base->bsh_writepos);
+  u_int cnt;
+  int ret = 0;
+
+  for (cnt = 0; cnt < base->bsh_maxreaders; cnt++, slot++)
+  {
+    if (shmipc_load_acquire(slot->bss_state) != BSS_ACTIVE)
+      continue;
+
+    if ((u_int)ret < maxinfo)
+    {
+      info[ret].bsri_slot = cnt;
+      info[ret].bsri_pid = slot->bss_pid;
+      info[ret].bsri_lag = writepos - shmipc_load_acquire(slot->bss_readpos);
+      info[ret].bsri_overruns = slot->bss_overruns;
+      info[ret].bsri_lostbytes = slot->bss_lostbytes;
+    }
+    ret++;
+  }
+
+  return(ret);
+}
+
+
+
+/**
+ * Peek at available data in ipc ring
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bsi Shared memory structure
+ *	@param bytesreadable Copy-out number of bytes someone can read
+ *	@param byteswritable Copy-out number of bytes someone can write
+ *	@param numothers Copy-out number of other people attached
+ *	@param flags Fun for the future
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>0</i> on success
+ */
+int bk_shmipc_peek(bk_s B, struct bk_shmipc *bsi, size_t *bytesreadable, size_t *byteswritable, u_int *buffersize, int *numothers, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!bsi)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    if (bsi)
+      bsi->si_errno = EINVAL;
+    BK_RETURN(B, -1);
+  }
+
+  if (BK_FLAG_ISSET(bsi->si_flags, SI_BROADCAST))
+  {
+    u_int64_t writepos = shmipc_load_acquire(bsi->si_base->bsh_writepos);
+
+    if (bytesreadable)
+      *bytesreadable = BK_FLAG_ISSET(bsi->si_flags, SI_READONLY)?MIN(writepos - bsi->si_pos, bsi->si_ringbytes):0;
+    if (byteswritable)
+      *byteswritable = BK_FLAG_ISSET(bsi->si_flags, SI_OVERWRITE)?bsi->si_ringbytes:bsi->si_ringbytes - MIN(writepos - shmipc_bcast_minpos(bsi, NULL), bsi->si_ringbytes);
+  }
+  else
+  {
+    if (bytesreadable)
+      *bytesreadable = bytes_available_read(shmipc_load_acquire(bsi->si_base->bsh_writehand), shmipc_load_acquire(bsi->si_base->bsh_readhand), bsi->si_ringbytes);
+    if (byteswritable)
+      *byteswritable = bytes_available_write(shmipc_load_acquire(bsi->si_base->bsh_writehand), shmipc_load_acquire(bsi->si_base->bsh_readhand), bsi->si_ringbytes);
+  }
+  if (buffersize)
+    *buffersize = bsi->si_ringbytes;
+
+  if (numothers && BK_FLAG_ISSET(bsi->si_flags, SI_MEMFD))
+  {
+    // No attach count on a memfd, so see whether the other party still exists
+    pid_t other = BK_FLAG_ISSET(bsi->si_flags, SI_READONLY)?bsi->si_base->bsh_writerpid:bsi->si_base->bsh_readerpid;
+
+    *numothers = (other && (kill(other, 0) == 0 || errno != ESRCH));
+  }
+  else if (numothers)
+  {
+    struct shmid_ds buf;
+
+    memset(&buf, 0, sizeof(buf));
+
+    if (shmctl(bsi->si_shmid, IPC_STAT, &buf) < 0)
+    {
+      bsi->si_errno = errno;
+      bk_error_printf(B, BK_ERR_ERR, "Could not stat shmipc: %s\n", strerror(errno));
+      BK_RETURN(B, -1);
+    }
+
+    *numothers = buf.shm_nattch - 1;
+  }
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Retrieve errno for last operation
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bsi Shared memory structure
+ *	@param flags Fun for the future
+ *	@return <i>-1</i> on failure to retrieve
+ *	@return <br><i>0</i> if last operation succeeded
+ *	@return <br><i>E*</i> errno numbers for last operation
+ */
+int bk_shmipc_errno(bk_s B, struct bk_shmipc *bsi, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!bsi)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    if (bsi)
+      bsi->si_errno = EINVAL;
+    BK_RETURN(B, -1);
+  }
+
+  BK_RETURN(B, bsi->si_errno);
+}
+
+
+
+/**
+ * Cancel (artifical EOF) a shmipc
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA Thread/global state
+ *	@param bsi Shared memory structure
+ *	@param flags Fun for the future
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>0</i> on success
+ */
+int bk_shmipc_cancel(bk_s B, struct bk_shmipc *bsi, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!bsi)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    if (bsi)
+      bsi->si_errno = EINVAL;
+    BK_RETURN(B, -1);
+  }
+
+  shmipc_store_release(bsi->si_base->bsh_magic, SHMIPC_MAGIC_EOF);
+  shmipc_wake(bsi, &bsi->si_base->bsh_writehand, &bsi->si_base->bsh_readwait);
+  shmipc_wake(bsi, &bsi->si_base->bsh_readhand, &bsi->si_base->bsh_writewait);
+
+  BK_RETURN(B, 0);
 }
 
 
@@ -1066,7 +3008,7 @@ int bk_shmipc_remove(bk_s B, const char *name, bk_flags flags)
  *	@return <i>-1</i> on failure
  *	@return <br><i>0</i> on success
  *	@return <br><i>1</i> on success but data might be bad (no-one attached)
- *	@return <br><i>2</i> on success but data definately bad (incorrect magic numbers or other accounting)
+ *	@return <br><i>2</i> on success but data definately bad (incorrect magic numbers, old header layout, or other accounting)
  *	@return <br><i>3</i> on partial success (only numothers/segsize filled out--insufficient attaches to be safe, need force)
  */
 int bk_shmipc_peekbyname(bk_s B, const char *name, u_int32_t *magic, u_int32_t *generation, u_int32_t *ringsize, u_int32_t *offset, u_int32_t *writehand, u_int32_t *readhand, size_t *bytesreadable, size_t *byteswritable, int *numothers, size_t *segsize, bk_flags flags)
@@ -1076,6 +3018,7 @@ int bk_shmipc_peekbyname(bk_s B, const char *name, u_int32_t *magic, u_int32_t *
   key_t key;
   int shmid;
   struct bk_shmipc_header *base = NULL;
+  u_int32_t lmagic, lgeneration, lringsize, loffset, lwritehand, lreadhand;
   int ret = 0;
 
   if (!name)
@@ -1114,7 +3057,7 @@ int bk_shmipc_peekbyname(bk_s B, const char *name, u_int32_t *magic, u_int32_t *
     BK_RETURN(B, 3);
   }
 
-  if (!(base = shmat(shmid, NULL, 0)))
+  if ((base = shmat(shmid, NULL, 0)) == (void *)-1)
   {
     bk_error_printf(B, BK_ERR_ERR, "Could not attach shared memory (%s): %s\n", name, strerror(errno));
     BK_RETURN(B, -1);
@@ -1123,33 +3066,144 @@ int bk_shmipc_peekbyname(bk_s B, const char *name, u_int32_t *magic, u_int32_t *
   if (buf.shm_nattch == 0)
     ret = 1;
 
-  if (base->bsh_ringsize+base->bsh_ringoffset != buf.shm_segsz || (shmipc_atomic32_read(base->bsh_magic) != SHMIPC_MAGIC && shmipc_atomic32_read(base->bsh_magic) != SHMIPC_MAGIC_EOF))
+  lmagic = shmipc_load_acquire(base->bsh_magic);
+
+  if (SHMIPC_IS_V1_MAGIC(lmagic))
+  {
+    // Segment from a writer using the old layout: report it, but it is not ours to use
+    struct bk_shmipc_header_v1 *v1 = (struct bk_shmipc_header_v1 *)base;
+
+    lgeneration = v1->bsh_generation;
+    lringsize = v1->bsh_ringsize;
+    loffset = v1->bsh_ringoffset;
+    lwritehand = shmipc_load_acquire(v1->bsh_writehand);
+    lreadhand = shmipc_load_acquire(v1->bsh_readhand);
+    ret = 2;
+  }
+  else
+  {
+    lgeneration = base->bsh_generation;
+    lringsize = base->bsh_ringsize;
+    loffset = base->bsh_ringoffset;
+    lwritehand = shmipc_load_acquire(base->bsh_writehand);
+    lreadhand = shmipc_load_acquire(base->bsh_readhand);
+    if (lmagic != SHMIPC_MAGIC && lmagic != SHMIPC_MAGIC_EOF)
+      ret = 2;
+  }
+
+  if (lringsize+loffset != buf.shm_segsz)
     ret = 2;
 
   if (magic)
-    *magic = shmipc_atomic32_read(base->bsh_magic);
+    *magic = lmagic;
 
   if (generation)
-    *generation = base->bsh_generation;
+    *generation = lgeneration;
 
   if (ringsize)
-    *ringsize = base->bsh_ringsize;
+    *ringsize = lringsize;
 
   if (offset)
-    *offset = base->bsh_ringoffset;
+    *offset = loffset;
 
   if (writehand)
-    *writehand = shmipc_atomic32_read(base->bsh_writehand);
+    *writehand = lwritehand;
 
   if (readhand)
-    *readhand = shmipc_atomic32_read(base->bsh_readhand);
+    *readhand = lreadhand;
 
   if (bytesreadable)
-    *bytesreadable = bytes_available_read(shmipc_atomic32_read(base->bsh_writehand), shmipc_atomic32_read(base->bsh_readhand), base->bsh_ringsize);
+    *bytesreadable = bytes_available_read(lwritehand, lreadhand, lringsize);
 
   if (byteswritable)
-    *byteswritable = bytes_available_write(shmipc_atomic32_read(base->bsh_writehand), shmipc_atomic32_read(base->bsh_readhand), base->bsh_ringsize);
+    *byteswritable = bytes_available_write(lwritehand, lreadhand, lringsize);
+
+  if (shmdt(base) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not detach shared memory: %s\n", strerror(errno));
+  }
+
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Report on the readers of a broadcast ring by name, without joining it
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA Thread/global state
+ *	@param name Name of shared memory ring
+ *	@param info Copy-out array of reader information
+ *	@param maxinfo Number of elements in info
+ *	@param flags Fun for the future
+ *	@return <i>-1</i> on failure (including not a broadcast ring)
+ *	@return <br><i>number of active readers</i> on success (may exceed maxinfo)
+ */
+int bk_shmipc_readersbyname(bk_s B, const char *name, struct bk_shmipc_readerinfo *info, u_int maxinfo, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct shmid_ds buf;
+  key_t key;
+  int shmid;
+  struct bk_shmipc_header *base = NULL;
+  u_int32_t lmagic;
+  int ret = -1;
+
+  if (!name || (maxinfo && !info))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (genkeyfromname(B, name, &key, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not convert name %s\n", name);
+    BK_RETURN(B, -1);
+  }
 
+  if ((shmid = shmget(key, 0, 0)) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not get shm name %s: %s\n", name, strerror(errno));
+    BK_RETURN(B, -1);
+  }
+
+  if (shmctl(shmid, IPC_STAT, &buf) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not stat shmipc: %s\n", strerror(errno));
+    BK_RETURN(B, -1);
+  }
+
+  if (buf.shm_segsz < sizeof(*base))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Shared memory %s too small to be a shmipc ring\n", name);
+    BK_RETURN(B, -1);
+  }
+
+  if ((base = shmat(shmid, NULL, SHM_RDONLY)) == (void *)-1)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not attach shared memory (%s): %s\n", name, strerror(errno));
+    BK_RETURN(B, -1);
+  }
+
+  lmagic = shmipc_load_acquire(base->bsh_magic);
+
+  if ((lmagic != SHMIPC_MAGIC && lmagic != SHMIPC_MAGIC_EOF) || BK_FLAG_ISCLEAR(base->bsh_flags, BSH_FLAG_BROADCAST))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Shared memory %s is not a broadcast shmipc ring\n", name);
+    goto error;
+  }
+
+  if (sizeof(*base) + base->bsh_maxreaders * sizeof(struct bk_shmipc_slot) > buf.shm_segsz)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Shared memory %s reader table is corrupt\n", name);
+    goto error;
+  }
+
+  ret = shmipc_readers_fill(base, info, maxinfo);
+
+ error:
   if (shmdt(base) < 0)
   {
     bk_error_printf(B, BK_ERR_ERR, "Could not detach shared memory: %s\n", strerror(errno));
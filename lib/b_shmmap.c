@@ -24,11 +24,77 @@ static const char libbk__contact[] = "<projectbaka@baka.org>";
 #include <libbk.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <sys/mman.h>
+
+
+
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+#define SHMMAP_HAVE_MEMFD			///< memfd_create(2) is available
+#endif /* __linux__ && MFD_CLOEXEC */
+
+
+
+/**
+ * With BK_SHMMAP_MEMFD the POSIX shm object only holds this locator; the
+ * segment itself is an anonymous memfd which attachers reopen through the
+ * creator's /proc/<pid>/fd entry (so they need ptrace-level access to the
+ * creator, e.g. the same uid).
+ */
+struct shmmap_locator
+{
+  u_int32_t		sl_magic;		///< SHMMAP_LOCATOR_MAGIC
+  pid_t			sl_pid;			///< Creator holding the memfd
+  int			sl_fd;			///< Creator's descriptor number for the memfd
+  size_t		sl_pagesize;		///< Mapping granularity (huge page size for hugetlb)
+};
+#define SHMMAP_LOCATOR_MAGIC	0x6d656d66	///< "memf"
+
+
+
+#define SHMSNAP_ALIGN		64		///< Keep snapshot counters and data on separate cache lines
+
+
+
+/**
+ * Shared snapshot area.  Two buffers, each with its own sequence count;
+ * the writer fills the one readers are not being pointed at, so a reader
+ * only has to retry if the writer laps it twice during one copy.  All
+ * references are relative to the structure, so it may sit anywhere in a
+ * segment mapped at any address.
+ */
+struct bk_shmsnap
+{
+  u_int32_t		ss_magic;		///< SHMSNAP_MAGIC
+  u_int32_t		ss_pad;			///< Alignment
+  u_int64_t		ss_len;			///< Capacity of each buffer
+  u_int64_t		ss_version;		///< Publications so far; buffer (ss_version & 1) is current
+  char			ss_pad2[SHMSNAP_ALIGN - 3 * sizeof(u_int64_t)];
+};
+#define SHMSNAP_MAGIC		0x736e6170	///< "snap"
+
+
+
+/**
+ * One of the two snapshot buffers
+ */
+struct shmsnap_buffer
+{
+  u_int64_t		sb_seq;			///< Odd while being written
+  u_int64_t		sb_len;			///< Valid bytes in this publication
+  char			sb_pad[SHMSNAP_ALIGN - 2 * sizeof(u_int64_t)];
+  char			sb_data[];		///< Snapshot
+};
+#define SHMSNAP_STRIDE(len)	(sizeof(struct shmsnap_buffer) + (((len) + SHMSNAP_ALIGN - 1) & ~(u_int64_t)(SHMSNAP_ALIGN - 1)))
+#define SHMSNAP_BUFFER(snap, which) ((struct shmsnap_buffer *)((char *)((snap) + 1) + (which) * SHMSNAP_STRIDE((snap)->ss_len)))
 
 
 
 static struct bk_shmmap *bk_shmmap_int(bk_s B, const char *name, const char *myname, u_short max_clients, off_t size, mode_t mode, void *addr, u_int fresh, bk_flags flags);
 static void *bk_shmmap_manage_thread_th(bk_s B, void *opaque);
+#ifdef SHMMAP_HAVE_MEMFD
+static int shmmap_memfd_publish(bk_s B, struct bk_shmmap *shmmap, off_t *size, bk_flags flags);
+static int shmmap_memfd_locate(bk_s B, struct bk_shmmap *shmmap, size_t *pagesize);
+#endif /* SHMMAP_HAVE_MEMFD */
 
 
 
@@ -42,7 +108,10 @@ static void *bk_shmmap_manage_thread_th(bk_s B, void *opaque);
  * @param mode Desired local domain permissions of shm segment
  * @param addr Desired address in virtual memory (zero will pick one)
  * @param fresh How fresh does mgmt interface need to be (0 for default)
- * @param flags none
+ * @param flags BK_SHMMAP_MEMFD to back the segment with a memfd which only
+ *	the creator holds (attachers find it via the shm name; it goes away
+ *	with the creator), BK_SHMMAP_HUGEPAGE to use huge pages (hugetlb
+ *	needs BK_SHMMAP_MEMFD, a huge page aligned addr, and reserved pages)
  * @return NULL on error or existing segment
  * @return shmmap on success
  */
@@ -100,7 +169,7 @@ struct bk_shmmap *bk_shmmap_attach(bk_s B, const char *name, const char *myname,
  * @param mode Desired local domain permissions of shm segment
  * @param addr Desired address in virtual memory (zero will pick one)--ignored for attach
  * @param fresh How fresh does mgmt interface need to be (0 for default)
- * @param flags none
+ * @param flags BK_SHMMAP_MEMFD|BK_SHMMAP_HUGEPAGE (creator only)
  * @return NULL on error
  * @return (void *)-1 on retryable error
  * @return shmmap on success
@@ -113,6 +182,8 @@ static struct bk_shmmap *bk_shmmap_int(bk_s B, const char *name, const char *myn
   u_int mgmt_size = 0;
   int attach = !size;
   void *errret = (void *)-1;
+  size_t pagesize = 0;
+  int hugetlb = 0;
   struct mq_attr mqattr;
 
   if (!name)
@@ -192,8 +263,23 @@ static struct bk_shmmap *bk_shmmap_int(bk_s B, const char *name, const char *myn
 
     size += mgmt_size;
 
+    if (BK_FLAG_ISSET(flags, BK_SHMMAP_MEMFD))
+    {
+#ifdef SHMMAP_HAVE_MEMFD
+      // Swaps sm_shmfd for the (already sized) memfd
+      if ((hugetlb = shmmap_memfd_publish(B, shmmap, &size, flags)) < 0)
+      {
+	errret = NULL;
+	goto error;
+      }
+#else /* SHMMAP_HAVE_MEMFD */
+      bk_error_printf(B, BK_ERR_ERR, "memfd backed shmmap is not supported on this system\n");
+      errret = NULL;
+      goto error;
+#endif /* SHMMAP_HAVE_MEMFD */
+    }
     // Pick a size
-    if (ftruncate(shmmap->sm_shmfd, size))
+    else if (ftruncate(shmmap->sm_shmfd, size))
     {
       bk_error_printf(B, BK_ERR_ERR, "Could not set size (%lld) of shared memory segment: %s\n", (long long)size, strerror(errno));
       errret = NULL;
@@ -209,9 +295,20 @@ static struct bk_shmmap *bk_shmmap_int(bk_s B, const char *name, const char *myn
      * Perform a temporary mapping to read the header in order to find
      * the correct address and size we should be using
      */
-    size = sizeof(struct bk_shmmap_header);
-    if ((shmmap->sm_addr = mmap(NULL, sizeof(struct bk_shmmap_header), PROT_READ, MAP_SHARED, shmmap->sm_shmfd, 0)) == MAP_FAILED)
+#ifdef SHMMAP_HAVE_MEMFD
+    // Swaps sm_shmfd for the creator's memfd if that is how it was made
+    if (shmmap_memfd_locate(B, shmmap, &pagesize) < 0)
+    {
+      errret = NULL;
+      goto error;
+    }
+#endif /* SHMMAP_HAVE_MEMFD */
+
+    // hugetlb mappings must be whole huge pages
+    size = MAX(sizeof(struct bk_shmmap_header), pagesize);
+    if ((shmmap->sm_addr = mmap(NULL, size, PROT_READ, MAP_SHARED, shmmap->sm_shmfd, 0)) == MAP_FAILED)
     {
+      shmmap->sm_addr = NULL;
       bk_error_printf(B, BK_ERR_ERR, "Could not memory map shared memory segment: %s\n", strerror(errno));
       errret = NULL;
       goto error;
@@ -230,12 +327,14 @@ static struct bk_shmmap *bk_shmmap_int(bk_s B, const char *name, const char *myn
     addr = shmmap->sm_addr->sh_addr;
     size = shmmap->sm_addr->sh_size;
 
-    if (munmap(shmmap->sm_addr, sizeof(struct bk_shmmap_header)) < 0)
+    if (munmap(shmmap->sm_addr, MAX(sizeof(struct bk_shmmap_header), pagesize)) < 0)
     {
+      shmmap->sm_addr = NULL;
       bk_error_printf(B, BK_ERR_ERR, "Huh? Cannot unmap temporary memory segment\n");
       errret = NULL;
       goto error;
     }
+    shmmap->sm_addr = NULL;
 
     misc_flags |= MAP_FIXED;
   }
@@ -243,6 +342,7 @@ static struct bk_shmmap *bk_shmmap_int(bk_s B, const char *name, const char *myn
   // Memory map it
   if ((shmmap->sm_addr = mmap(addr, size, PROT_READ|PROT_WRITE, misc_flags, shmmap->sm_shmfd, 0)) == MAP_FAILED)
   {
+    shmmap->sm_addr = NULL;
     bk_error_printf(B, BK_ERR_ERR, "Could not memory map shared memory segment: %s\n", strerror(errno));
     errret = NULL;
     goto error;
@@ -254,6 +354,12 @@ static struct bk_shmmap *bk_shmmap_int(bk_s B, const char *name, const char *myn
     goto error;
   }
 
+#ifdef MADV_HUGEPAGE
+  // Creator with normal pages: transparent huge pages where shmem allows
+  if (!attach && BK_FLAG_ISSET(flags, BK_SHMMAP_HUGEPAGE) && !hugetlb)
+    madvise(shmmap->sm_addr, size, MADV_HUGEPAGE);
+#endif /* MADV_HUGEPAGE */
+
   if (!attach)
   {
     // Initialize the new segment
@@ -262,7 +368,8 @@ static struct bk_shmmap *bk_shmmap_int(bk_s B, const char *name, const char *myn
     shmmap->sm_addr->sh_user = ((u_char *)shmmap->sm_addr)+mgmt_size;
     shmmap->sm_addr->sh_size = size;
     shmmap->sm_addr->sh_usersize = size - mgmt_size;
-    shmmap->sm_addr->sh_creatortime = time(NULL);
+    shmmap->sm_addr->sh_beatms = bk_shmmap_nowms();
+    shmmap->sm_addr->sh_heartbeat = 1;
     shmmap->sm_addr->sh_fresh = fresh?fresh:(u_int)atoi(BK_GWD(B, "bk_shmmap_fresh", BK_SHMMAP_DEFAULT_FRESH));
     shmmap->sm_addr->sh_numclients = max_clients;
     shmmap->sm_addr->sh_state = BK_SHMMAP_READY;
@@ -366,6 +473,136 @@ static struct bk_shmmap *bk_shmmap_int(bk_s B, const char *name, const char *myn
 
 
 
+#ifdef SHMMAP_HAVE_MEMFD
+/**
+ * Creator: back the segment with a memfd and leave a locator for it in the
+ * (already created) POSIX shm object
+ *
+ * With BK_SHMMAP_HUGEPAGE a hugetlb memfd is tried first, rounding the
+ * segment up to whole huge pages; failing that, normal pages are used.
+ *
+ * @param B BAKA World
+ * @param shmmap Shared memory map structure (sm_shmfd is replaced by the memfd)
+ * @param size Copy-in/out segment size (may be rounded up)
+ * @param flags BK_SHMMAP_HUGEPAGE
+ * @return -1 on error
+ * @return 0 on success with normal pages
+ * @return 1 on success with hugetlb pages
+ */
+static int shmmap_memfd_publish(bk_s B, struct bk_shmmap *shmmap, off_t *size, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct shmmap_locator loc;
+  int memfd = -1;
+  int hugetlb = 0;
+
+  memset(&loc, 0, sizeof(loc));
+  loc.sl_magic = SHMMAP_LOCATOR_MAGIC;
+  loc.sl_pid = getpid();
+
+#ifdef MFD_HUGETLB
+  if (BK_FLAG_ISSET(flags, BK_SHMMAP_HUGEPAGE) && (loc.sl_pagesize = bk_hugepagesize(B)))
+  {
+    off_t hugesize = ((*size + loc.sl_pagesize - 1) / loc.sl_pagesize) * loc.sl_pagesize;
+
+    if ((memfd = memfd_create(shmmap->sm_name, MFD_CLOEXEC|MFD_HUGETLB)) >= 0 && ftruncate(memfd, hugesize) == 0)
+    {
+      *size = hugesize;
+      hugetlb = 1;
+    }
+    else
+    {
+      bk_error_printf(B, BK_ERR_WARN, "Could not get huge page memfd, using normal pages: %s\n", strerror(errno));
+      if (memfd >= 0)
+	close(memfd);
+      memfd = -1;
+      loc.sl_pagesize = 0;
+    }
+  }
+#endif /* MFD_HUGETLB */
+
+  if (memfd < 0)
+  {
+    if ((memfd = memfd_create(shmmap->sm_name, MFD_CLOEXEC)) < 0)
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not create memfd: %s\n", strerror(errno));
+      goto error;
+    }
+
+    if (ftruncate(memfd, *size))
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not set size (%lld) of memfd: %s\n", (long long)*size, strerror(errno));
+      goto error;
+    }
+  }
+
+  loc.sl_fd = memfd;
+  if (ftruncate(shmmap->sm_shmfd, sizeof(loc)) || pwrite(shmmap->sm_shmfd, &loc, sizeof(loc), 0) != sizeof(loc))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not publish memfd locator: %s\n", strerror(errno));
+    goto error;
+  }
+
+  close(shmmap->sm_shmfd);
+  shmmap->sm_shmfd = memfd;
+
+  BK_RETURN(B, hugetlb);
+
+ error:
+  if (memfd >= 0)
+    close(memfd);
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * Attacher: if the POSIX shm object is a memfd locator, reopen the
+ * creator's memfd in its place
+ *
+ * @param B BAKA World
+ * @param shmmap Shared memory map structure (sm_shmfd may be replaced)
+ * @param pagesize Copy-out mapping granularity (0 for normal pages)
+ * @return -1 on error
+ * @return 0 on success (including ordinary shm segments)
+ */
+static int shmmap_memfd_locate(bk_s B, struct bk_shmmap *shmmap, size_t *pagesize)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct shmmap_locator loc;
+  struct stat st;
+  char path[64];
+  int memfd;
+
+  *pagesize = 0;
+
+  if (fstat(shmmap->sm_shmfd, &st) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not stat shared memory segment: %s\n", strerror(errno));
+    BK_RETURN(B, -1);
+  }
+
+  // A real segment is always bigger than the header, let alone the locator
+  if (st.st_size != sizeof(loc) || pread(shmmap->sm_shmfd, &loc, sizeof(loc), 0) != sizeof(loc) || loc.sl_magic != SHMMAP_LOCATOR_MAGIC)
+    BK_RETURN(B, 0);
+
+  snprintf(path, sizeof(path), "/proc/%d/fd/%d", (int)loc.sl_pid, loc.sl_fd);
+  if ((memfd = open(path, O_RDWR|O_CLOEXEC)) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not open creator's memfd %s: %s\n", path, strerror(errno));
+    BK_RETURN(B, -1);
+  }
+
+  close(shmmap->sm_shmfd);
+  shmmap->sm_shmfd = memfd;
+  *pagesize = loc.sl_pagesize;
+
+  BK_RETURN(B, 0);
+}
+#endif /* SHMMAP_HAVE_MEMFD */
+
+
+
 /**
  * Destroy (by creator) or detach (by others) a shared memory segment
  *
@@ -502,7 +739,8 @@ void bk_shmmap_manage(bk_s B, struct bk_shmmap *shmmap, bk_flags flags)
     struct timespec tstime;
     gettimeofday(&tvtime, NULL);
 
-    shmmap->sm_addr->sh_creatortime = tvtime.tv_sec;
+    __atomic_store_n(&shmmap->sm_addr->sh_beatms, bk_shmmap_nowms(), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&shmmap->sm_addr->sh_heartbeat, 1, __ATOMIC_RELEASE);
 
     if (BK_FLAG_ISSET(flags, BK_SHMMAP_MANAGE_POLL))
     {
@@ -520,6 +758,8 @@ void bk_shmmap_manage(bk_s B, struct bk_shmmap *shmmap, bk_flags flags)
     {
       if (errno == ETIMEDOUT)
       {
+	// Catch clients which died without detaching
+	bk_shmalloc_reclaim(B, shmmap, 0);
 	if (BK_FLAG_ISSET(flags, BK_SHMMAP_MANAGE_POLL))
 	  break;
 	continue;
@@ -551,17 +791,21 @@ void bk_shmmap_manage(bk_s B, struct bk_shmmap *shmmap, bk_flags flags)
 	    shmmap->sm_addr->sh_numattach--;
 	}
       }
+      // Before the slot can be handed out again
+      bk_shmalloc_reclaim(B, shmmap, 0);
     }
     if (bop.bsc_op == bk_shmmap_op_attach)
     {
       int x;
       for(x=0;x<shmmap->sm_addr->sh_numclients;x++)
       {
-	if (shmmap->sm_addr->sh_client[x].su_state == BK_SHMMAP_USER_STATEEMPTY)
+	u_short empty = BK_SHMMAP_USER_STATEEMPTY;
+
+	// Not into a slot bk_shmalloc_reclaim has claimed
+	if (__atomic_compare_exchange_n(&shmmap->sm_addr->sh_client[x].su_state, &empty, BK_SHMMAP_USER_STATEPREP, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
 	{
 	  shmmap->sm_addr->sh_client[x].su_pid = bop.bsc_pid;
 	  strncpy(shmmap->sm_addr->sh_client[x].su_name, bop.bsc_name, BK_SHMMAP_MAXCLIENTNAME);
-	  shmmap->sm_addr->sh_client[x].su_state = BK_SHMMAP_USER_STATEPREP;
 	  shmmap->sm_addr->sh_numattach++;
 	  break;
 	}
@@ -610,3 +854,250 @@ int bk_shmmap_validate(bk_s B, struct bk_shmmap *shmmap)
   // Only thing left is not fresh
   BK_RETURN(B, -1);
 }
+
+
+
+/**
+ * Find how much shared memory a snapshot area of a given size needs
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param len Largest snapshot to be published
+ * @return bytes needed (for bk_shmsnap_init())
+ */
+size_t bk_shmsnap_size(size_t len)
+{
+  return(sizeof(struct bk_shmsnap) + 2 * SHMSNAP_STRIDE(len));
+}
+
+
+
+/**
+ * Set up a snapshot area in shared memory (typically part of a shmmap
+ * user region, or a bk_shmalloc() block whose offset is left in a root).
+ * There must only be one publishing thread; any number of readers in any
+ * process may use bk_shmsnap_read() without ever holding up the publisher.
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA World
+ * @param mem Shared memory, bk_shmsnap_size(len) bytes, 8-byte aligned
+ * @param len Largest snapshot to be published
+ * @param flags Fun for the future
+ * @return NULL on error
+ * @return snapshot area on success
+ */
+struct bk_shmsnap *bk_shmsnap_init(bk_s B, void *mem, size_t len, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_shmsnap *snap = mem;
+
+  if (!mem || ((u_long)mem & 7))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, NULL);
+  }
+
+  memset(mem, 0, bk_shmsnap_size(len));
+  snap->ss_len = len;
+  __atomic_store_n(&snap->ss_magic, SHMSNAP_MAGIC, __ATOMIC_RELEASE);
+
+  BK_RETURN(B, snap);
+}
+
+
+
+/**
+ * Start a new snapshot in place: returns the buffer to fill, which readers
+ * cannot see until bk_shmsnap_commit().
+ *
+ * THREADS: THREAD-REENTRANT (single publisher)
+ *
+ * @param B BAKA World
+ * @param snap Snapshot area
+ * @param flags BK_SHMSNAP_COPY to start from the current snapshot
+ * @return NULL on error
+ * @return snapshot buffer (bk_shmsnap_size() len bytes) on success
+ */
+void *bk_shmsnap_begin(bk_s B, struct bk_shmsnap *snap, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct shmsnap_buffer *cur, *next;
+  u_int64_t version;
+
+  if (!snap || snap->ss_magic != SHMSNAP_MAGIC)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, NULL);
+  }
+
+  version = __atomic_load_n(&snap->ss_version, __ATOMIC_RELAXED);
+  cur = SHMSNAP_BUFFER(snap, version & 1);
+  next = SHMSNAP_BUFFER(snap, (version + 1) & 1);
+
+  // Readers still copying out of this buffer will see the odd count and retry
+  __atomic_store_n(&next->sb_seq, next->sb_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  if (BK_FLAG_ISSET(flags, BK_SHMSNAP_COPY))
+  {
+    memcpy(next->sb_data, cur->sb_data, cur->sb_len);
+    next->sb_len = cur->sb_len;
+  }
+  else
+  {
+    next->sb_len = snap->ss_len;
+  }
+
+  BK_RETURN(B, (void *)next->sb_data);
+}
+
+
+
+/**
+ * Make the snapshot started with bk_shmsnap_begin() current
+ *
+ * THREADS: THREAD-REENTRANT (single publisher)
+ *
+ * @param B BAKA World
+ * @param snap Snapshot area
+ * @param flags Fun for the future
+ */
+void bk_shmsnap_commit(bk_s B, struct bk_shmsnap *snap, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct shmsnap_buffer *next;
+  u_int64_t version;
+
+  if (!snap || snap->ss_magic != SHMSNAP_MAGIC)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_VRETURN(B);
+  }
+
+  version = __atomic_load_n(&snap->ss_version, __ATOMIC_RELAXED);
+  next = SHMSNAP_BUFFER(snap, (version + 1) & 1);
+
+  if (!(next->sb_seq & 1))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Committing a snapshot which was never begun\n");
+    BK_VRETURN(B);
+  }
+
+  __atomic_store_n(&next->sb_seq, next->sb_seq + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&snap->ss_version, version + 1, __ATOMIC_RELEASE);
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Publish a copy of data as the new snapshot
+ *
+ * THREADS: THREAD-REENTRANT (single publisher)
+ *
+ * @param B BAKA World
+ * @param snap Snapshot area
+ * @param data Snapshot contents
+ * @param len Length of data (no more than the area was set up for)
+ * @param flags Fun for the future
+ * @return -1 on error
+ * @return 0 on success
+ */
+int bk_shmsnap_publish(bk_s B, struct bk_shmsnap *snap, const void *data, size_t len, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  char *buf;
+
+  if (!snap || (!data && len) || len > snap->ss_len)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (!(buf = bk_shmsnap_begin(B, snap, 0)))
+    BK_RETURN(B, -1);
+
+  memcpy(buf, data, len);
+  ((struct shmsnap_buffer *)(buf - offsetof(struct shmsnap_buffer, sb_data)))->sb_len = len;
+  bk_shmsnap_commit(B, snap, 0);
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Take a consistent copy of the current snapshot.  Never takes a lock or
+ * makes a syscall; a copy torn by the publisher is simply retried.
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA World
+ * @param snap Snapshot area
+ * @param buf Copy-out buffer
+ * @param len Size of buf (longer snapshots are truncated)
+ * @param versionp Optional copy-out version of the snapshot copied (0 before the first publication)
+ * @param flags BK_SHMSNAP_NOWAIT
+ * @return -1 on error (EAGAIN if a NOWAIT copy was torn)
+ * @return bytes copied on success
+ */
+ssize_t bk_shmsnap_read(bk_s B, struct bk_shmsnap *snap, void *buf, size_t len, u_int64_t *versionp, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  u_int tries;
+
+  if (!snap || (!buf && len) || __atomic_load_n(&snap->ss_magic, __ATOMIC_ACQUIRE) != SHMSNAP_MAGIC)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  for (tries = 0; ; tries++)
+  {
+    u_int64_t version = __atomic_load_n(&snap->ss_version, __ATOMIC_ACQUIRE);
+    struct shmsnap_buffer *cur = SHMSNAP_BUFFER(snap, version & 1);
+    u_int64_t seq = __atomic_load_n(&cur->sb_seq, __ATOMIC_ACQUIRE);
+    size_t copied;
+
+    if (!(seq & 1))
+    {
+      copied = MIN(len, __atomic_load_n(&cur->sb_len, __ATOMIC_RELAXED));
+      memcpy(buf, cur->sb_data, copied);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+      if (__atomic_load_n(&cur->sb_seq, __ATOMIC_RELAXED) == seq)
+      {
+	if (versionp)
+	  *versionp = version;
+	BK_RETURN(B, copied);
+      }
+    }
+
+    if (BK_FLAG_ISSET(flags, BK_SHMSNAP_NOWAIT))
+    {
+      errno = EAGAIN;
+      BK_RETURN(B, -1);
+    }
+
+    // A publisher spinning faster than we can copy; let it breathe
+    if (tries > 16)
+      sched_yield();
+  }
+}
+
+
+
+/**
+ * Find the version of the current snapshot, to see if a new copy is needed
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param snap Snapshot area
+ * @return snapshot version (0 before the first publication)
+ */
+u_int64_t bk_shmsnap_version(struct bk_shmsnap *snap)
+{
+  return(__atomic_load_n(&snap->ss_version, __ATOMIC_ACQUIRE));
+}
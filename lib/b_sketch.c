@@ -0,0 +1,1190 @@
+#if !defined(lint)
+static const char libbk__copyright[] = "Copyright © 2001-2011";
+static const char libbk__contact[] = "<projectbaka@baka.org>";
+#endif /* not lint */
+/*
+ * ++Copyright BAKA++
+ *
+ * Copyright © 2001-2011 The Authors. All rights reserved.
+ *
+ * This source code is licensed to you under the terms of the file
+ * LICENSE.TXT in this release for further details.
+ *
+ * Send e-mail to <projectbaka@baka.org> for further information.
+ *
+ * - -Copyright BAKA- -
+ */
+
+/**
+ * @file
+ * Fixed-memory streaming sketches: HyperLogLog distinct counting,
+ * count-min top-K (heavy hitter) tracking and DDSketch quantiles.
+ *
+ * All three are sized at creation and never grow, are updated with
+ * atomic operations so several threads may feed one sketch, and may be
+ * merged with another sketch of the same shape, so per-thread sketches
+ * can be combined at reporting time instead of sharing one hot sketch.
+ */
+
+#include <libbk.h>
+#include "libbk_internal.h"
+
+
+
+#define HLL_PRECISION_MIN	4		///< Smallest useful register count (16)
+#define HLL_PRECISION_MAX	18		///< Largest register count (256K)
+#define SKETCH_SEED		0x62616b61	///< murmurhash seed shared by all sketches, so merges agree
+
+
+
+/**
+ * HyperLogLog distinct value estimator
+ */
+struct bk_hll
+{
+  u_int		bh_precision;			///< log2 of the number of registers
+  u_int		bh_registers;			///< Number of registers
+  u_int8_t     *bh_reg;				///< Longest leading zero run seen, plus one
+};
+
+
+
+/**
+ * One heavy hitter candidate
+ */
+struct topk_entry
+{
+  u_int64_t	te_count;			///< Count estimate when last seen
+  u_int64_t	te_hash;			///< Key hash, to skip most key compares
+  size_t	te_keylen;			///< Key length
+  u_int		te_slot;			///< Key storage slot
+};
+
+
+
+/**
+ * Count-min sketch with a heavy hitter heap
+ */
+struct bk_topk
+{
+  u_int		btk_k;				///< Heavy hitters tracked
+  u_int		btk_width;			///< Counters per row
+  u_int		btk_depth;			///< Rows
+  size_t	btk_maxkey;			///< Longest key accepted
+  u_int64_t    *btk_counters;			///< btk_depth rows of btk_width counters
+  u_int64_t	btk_total;			///< Total weight added
+  u_int64_t	btk_threshold;			///< Smallest heap count once the heap is full
+  u_int		btk_used;			///< Heap entries in use
+  struct topk_entry *btk_heap;			///< Min-heap of heavy hitters by count
+  char	       *btk_keys;			///< btk_k slots of btk_maxkey bytes
+#ifdef BK_USING_PTHREADS
+  pthread_mutex_t btk_lock;			///< Protects the heap
+#endif /* BK_USING_PTHREADS */
+};
+
+
+
+/**
+ * DDSketch quantile estimator
+ */
+struct bk_quantile
+{
+  double	bq_gamma;			///< Bucket growth factor, (1+accuracy)/(1-accuracy)
+  double	bq_lngamma;			///< log(bq_gamma), cached
+  u_int		bq_bins;			///< Number of bins
+  int		bq_offset;			///< Bin holding values just above 1
+  u_int64_t    *bq_counts;			///< Values per bin
+  u_int64_t	bq_zero;			///< Values <= 0
+  u_int64_t	bq_count;			///< Total values
+  u_int64_t	bq_min;				///< Smallest value (bits of a double)
+  u_int64_t	bq_max;				///< Largest value (bits of a double)
+};
+
+
+
+static void topk_offer(bk_s B, struct bk_topk *topk, u_int64_t hash, const void *key, size_t len, u_int64_t estimate);
+static u_int64_t topk_estimate(struct bk_topk *topk, const u_int64_t *hash);
+static void topk_siftdown(struct topk_entry *heap, u_int used, u_int cur);
+static void topk_siftup(struct topk_entry *heap, u_int cur);
+static int topk_item_cmp(const void *a, const void *b);
+static void quantile_extreme(u_int64_t *bitsp, double value, int max);
+static inline double quantile_bits2double(u_int64_t bits);
+
+
+
+/**
+ * Create a HyperLogLog distinct value estimator.  The standard error of
+ * the estimate is about 1.04/sqrt(2^precision); it uses 2^precision
+ * bytes no matter how many values are added.
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA Thread/global state
+ * @param precision log2 of the number of registers (4-18, 0 for BK_HLL_PRECISION_DEFAULT)
+ * @param flags Fun for the future
+ * @return <i>new estimator</i> on success
+ * @return <i>NULL</i> on failure
+ */
+struct bk_hll *bk_hll_create(bk_s B, u_int precision, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_hll *hll = NULL;
+
+  if (!precision)
+    precision = BK_HLL_PRECISION_DEFAULT;
+
+  if (precision < HLL_PRECISION_MIN || precision > HLL_PRECISION_MAX)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid HyperLogLog precision %u\n", precision);
+    BK_RETURN(B, NULL);
+  }
+
+  if (!BK_CALLOC_LEN(hll, sizeof(*hll)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate HyperLogLog: %s\n", strerror(errno));
+    goto error;
+  }
+  hll->bh_precision = precision;
+  hll->bh_registers = 1 << precision;
+
+  if (!BK_CALLOC_LEN(hll->bh_reg, hll->bh_registers))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate HyperLogLog registers: %s\n", strerror(errno));
+    goto error;
+  }
+
+  BK_RETURN(B, hll);
+
+ error:
+  if (hll)
+    bk_hll_destroy(B, hll);
+
+  BK_RETURN(B, NULL);
+}
+
+
+
+/**
+ * Destroy a HyperLogLog estimator
+ *
+ * THREADS: MT-SAFE (as long as no one else is using it)
+ *
+ * @param B BAKA Thread/global state
+ * @param hll Estimator to destroy
+ */
+void bk_hll_destroy(bk_s B, struct bk_hll *hll)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (hll)
+  {
+    if (hll->bh_reg)
+      free(hll->bh_reg);
+    free(hll);
+  }
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Add a value to a HyperLogLog estimator.  Adding a value already seen
+ * changes nothing.
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA Thread/global state
+ * @param hll Estimator
+ * @param key Value to add
+ * @param len Length of value in bytes
+ * @return <i>0</i> on success
+ * @return <i>-1</i> on failure
+ */
+int bk_hll_add(bk_s B, struct bk_hll *hll, const void *key, size_t len)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  u_int64_t hash[2], rest;
+  u_int8_t rank, cur;
+  u_int idx;
+
+  if (!hll || !key)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  murmurhash3_x64_128(key, len, SKETCH_SEED, hash);
+
+  // Top bits pick the register, the rest supply the run of zeros (capped by a sentinel bit)
+  idx = hash[0] >> (64 - hll->bh_precision);
+  rest = (hash[0] << hll->bh_precision) | ((u_int64_t)1 << (hll->bh_precision - 1));
+  rank = __builtin_clzll(rest) + 1;
+
+  cur = __atomic_load_n(&hll->bh_reg[idx], __ATOMIC_RELAXED);
+  while (rank > cur && !__atomic_compare_exchange_n(&hll->bh_reg[idx], &cur, rank, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Estimate the number of distinct values added to a HyperLogLog
+ * estimator.  Small counts use linear counting, which is nearly exact.
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA Thread/global state
+ * @param hll Estimator
+ * @return <i>estimated distinct values</i>
+ */
+u_int64_t bk_hll_count(bk_s B, struct bk_hll *hll)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  double m, alpha, sum = 0, estimate;
+  u_int zeros = 0, x;
+  u_int8_t reg;
+
+  if (!hll)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, 0);
+  }
+
+  for (x = 0; x < hll->bh_registers; x++)
+  {
+    reg = __atomic_load_n(&hll->bh_reg[x], __ATOMIC_RELAXED);
+    sum += ldexp(1.0, -reg);
+    if (!reg)
+      zeros++;
+  }
+
+  m = hll->bh_registers;
+  alpha = 0.7213 / (1.0 + 1.079 / m);
+  estimate = alpha * m * m / sum;
+
+  if (estimate <= 2.5 * m && zeros)
+    estimate = m * log(m / zeros);
+
+  BK_RETURN(B, (u_int64_t)(estimate + 0.5));
+}
+
+
+
+/**
+ * Merge one HyperLogLog estimator into another of the same precision.
+ * Afterwards @a dst estimates the distinct values added to either.
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA Thread/global state
+ * @param dst Estimator to merge into
+ * @param src Estimator to merge from (unchanged)
+ * @param flags Fun for the future
+ * @return <i>0</i> on success
+ * @return <i>-1</i> on failure (including a precision mismatch)
+ */
+int bk_hll_merge(bk_s B, struct bk_hll *dst, struct bk_hll *src, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  u_int8_t rank, cur;
+  u_int x;
+
+  if (!dst || !src || dst->bh_precision != src->bh_precision)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal or mismatched arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  for (x = 0; x < dst->bh_registers; x++)
+  {
+    rank = __atomic_load_n(&src->bh_reg[x], __ATOMIC_RELAXED);
+    cur = __atomic_load_n(&dst->bh_reg[x], __ATOMIC_RELAXED);
+    while (rank > cur && !__atomic_compare_exchange_n(&dst->bh_reg[x], &cur, rank, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      ;
+  }
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Forget everything added to a HyperLogLog estimator, e.g. at the start
+ * of each reporting interval.
+ *
+ * THREADS: MT-SAFE (adds racing the clear may or may not survive it)
+ *
+ * @param B BAKA Thread/global state
+ * @param hll Estimator
+ */
+void bk_hll_clear(bk_s B, struct bk_hll *hll)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  u_int x;
+
+  if (!hll)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_VRETURN(B);
+  }
+
+  for (x = 0; x < hll->bh_registers; x++)
+    __atomic_store_n(&hll->bh_reg[x], 0, __ATOMIC_RELAXED);
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Create a count-min top-K tracker.  Counts are kept in @a depth rows of
+ * @a width counters, so a key's estimate is never low and is high by at
+ * most about e/width of the total weight with probability 1-e^-depth.
+ * The @a k keys with the largest estimates are kept in a heap.
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA Thread/global state
+ * @param k Number of heavy hitters to track (0 for BK_TOPK_K_DEFAULT)
+ * @param width Counters per row (0 for BK_TOPK_WIDTH_DEFAULT)
+ * @param depth Number of rows (0 for BK_TOPK_DEPTH_DEFAULT)
+ * @param maxkey Longest key which will be added (0 for BK_TOPK_MAXKEY_DEFAULT)
+ * @param flags Fun for the future
+ * @return <i>new tracker</i> on success
+ * @return <i>NULL</i> on failure
+ */
+struct bk_topk *bk_topk_create(bk_s B, u_int k, u_int width, u_int depth, size_t maxkey, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_topk *topk = NULL;
+
+  if (!k)
+    k = BK_TOPK_K_DEFAULT;
+  if (!width)
+    width = BK_TOPK_WIDTH_DEFAULT;
+  if (!depth)
+    depth = BK_TOPK_DEPTH_DEFAULT;
+  if (!maxkey)
+    maxkey = BK_TOPK_MAXKEY_DEFAULT;
+
+  if (!BK_CALLOC_LEN(topk, sizeof(*topk)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate top-K tracker: %s\n", strerror(errno));
+    BK_RETURN(B, NULL);
+  }
+  topk->btk_k = k;
+  topk->btk_width = width;
+  topk->btk_depth = depth;
+  topk->btk_maxkey = maxkey;
+
+#ifdef BK_USING_PTHREADS
+  if (pthread_mutex_init(&topk->btk_lock, NULL) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+
+  if (!BK_CALLOC_LEN(topk->btk_counters, (size_t)width * depth * sizeof(*topk->btk_counters)) ||
+      !BK_CALLOC_LEN(topk->btk_heap, k * sizeof(*topk->btk_heap)) ||
+      !BK_CALLOC_LEN(topk->btk_keys, k * maxkey))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate top-K tracker storage: %s\n", strerror(errno));
+    goto error;
+  }
+
+  BK_RETURN(B, topk);
+
+ error:
+  bk_topk_destroy(B, topk);
+  BK_RETURN(B, NULL);
+}
+
+
+
+/**
+ * Destroy a top-K tracker
+ *
+ * THREADS: MT-SAFE (as long as no one else is using it)
+ *
+ * @param B BAKA Thread/global state
+ * @param topk Tracker to destroy
+ */
+void bk_topk_destroy(bk_s B, struct bk_topk *topk)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (topk)
+  {
+    if (topk->btk_counters)
+      free(topk->btk_counters);
+    if (topk->btk_heap)
+      free(topk->btk_heap);
+    if (topk->btk_keys)
+      free(topk->btk_keys);
+#ifdef BK_USING_PTHREADS
+    pthread_mutex_destroy(&topk->btk_lock);
+#endif /* BK_USING_PTHREADS */
+    free(topk);
+  }
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Count @a weight occurrences of a key.  The counters are updated
+ * atomically; the heap lock is only taken when the key's estimate is
+ * large enough to belong in the heap.
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA Thread/global state
+ * @param topk Tracker
+ * @param key Key to count
+ * @param len Length of key in bytes (at most the tracker's maxkey)
+ * @param weight Occurrences to count
+ * @return <i>0</i> on success
+ * @return <i>-1</i> on failure
+ */
+int bk_topk_add(bk_s B, struct bk_topk *topk, const void *key, size_t len, u_int64_t weight)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  u_int64_t hash[2], estimate = ~(u_int64_t)0, cur;
+  u_int row;
+
+  if (!topk || !key || len > topk->btk_maxkey)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  murmurhash3_x64_128(key, len, SKETCH_SEED, hash);
+
+  for (row = 0; row < topk->btk_depth; row++)
+  {
+    cur = __atomic_add_fetch(&topk->btk_counters[(size_t)row * topk->btk_width + (hash[0] + row * hash[1]) % topk->btk_width], weight, __ATOMIC_RELAXED);
+    estimate = BK_MIN(estimate, cur);
+  }
+  __atomic_add_fetch(&topk->btk_total, weight, __ATOMIC_RELAXED);
+
+  if (estimate > __atomic_load_n(&topk->btk_threshold, __ATOMIC_RELAXED))
+    topk_offer(B, topk, hash[0], key, len, estimate);
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Estimate how often a key has been counted.  The estimate is never
+ * below the true count.
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA Thread/global state
+ * @param topk Tracker
+ * @param key Key to look up
+ * @param len Length of key in bytes
+ * @return <i>estimated count</i>
+ */
+u_int64_t bk_topk_estimate(bk_s B, struct bk_topk *topk, const void *key, size_t len)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  u_int64_t hash[2];
+
+  if (!topk || !key)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, 0);
+  }
+
+  murmurhash3_x64_128(key, len, SKETCH_SEED, hash);
+
+  BK_RETURN(B, topk_estimate(topk, hash));
+}
+
+
+
+/**
+ * Total weight counted by a top-K tracker
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA Thread/global state
+ * @param topk Tracker
+ * @return <i>total weight</i>
+ */
+u_int64_t bk_topk_total(bk_s B, struct bk_topk *topk)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!topk)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, 0);
+  }
+
+  BK_RETURN(B, __atomic_load_n(&topk->btk_total, __ATOMIC_RELAXED));
+}
+
+
+
+/**
+ * List the heavy hitters, largest first, with current estimates.  The
+ * items and the keys they point to are one allocation.
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA Thread/global state
+ * @param topk Tracker
+ * @param countp C/O number of items returned
+ * @param flags Fun for the future
+ * @return <i>items</i> on success, to be freed with bk_topk_list_destroy()
+ * @return <i>NULL</i> on failure
+ */
+struct bk_topk_item *bk_topk_list(bk_s B, struct bk_topk *topk, u_int *countp, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_topk_item *items = NULL;
+  u_int64_t hash[2];
+  char *keys;
+  u_int x, used;
+
+  if (!topk || !countp)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, NULL);
+  }
+
+  if (!BK_MALLOC_LEN(items, topk->btk_k * (sizeof(*items) + topk->btk_maxkey)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate top-K list: %s\n", strerror(errno));
+    BK_RETURN(B, NULL);
+  }
+  keys = (char *)(items + topk->btk_k);
+
+#ifdef BK_USING_PTHREADS
+  if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_lock(&topk->btk_lock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+
+  used = topk->btk_used;
+  for (x = 0; x < used; x++)
+  {
+    memcpy(keys, topk->btk_keys + topk->btk_heap[x].te_slot * topk->btk_maxkey, topk->btk_heap[x].te_keylen);
+    items[x].bti_key = keys;
+    items[x].bti_keylen = topk->btk_heap[x].te_keylen;
+    keys += topk->btk_maxkey;
+  }
+
+#ifdef BK_USING_PTHREADS
+  if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_unlock(&topk->btk_lock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+
+  // Heap counts are as of each key's last add; report what the counters say now
+  for (x = 0; x < used; x++)
+  {
+    murmurhash3_x64_128(items[x].bti_key, items[x].bti_keylen, SKETCH_SEED, hash);
+    items[x].bti_count = topk_estimate(topk, hash);
+  }
+  qsort(items, used, sizeof(*items), topk_item_cmp);
+
+  *countp = used;
+  BK_RETURN(B, items);
+}
+
+
+
+/**
+ * Free a list returned by bk_topk_list()
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA Thread/global state
+ * @param items List to free
+ */
+void bk_topk_list_destroy(bk_s B, struct bk_topk_item *items)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (items)
+    free(items);
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Merge one top-K tracker into another of the same shape.  Counters are
+ * summed and the source's heavy hitters are offered to the destination
+ * heap, so per-thread trackers can be combined for reporting.
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA Thread/global state
+ * @param dst Tracker to merge into
+ * @param src Tracker to merge from (unchanged)
+ * @param flags Fun for the future
+ * @return <i>0</i> on success
+ * @return <i>-1</i> on failure (including a shape mismatch)
+ */
+int bk_topk_merge(bk_s B, struct bk_topk *dst, struct bk_topk *src, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_topk_item *items;
+  u_int64_t hash[2];
+  size_t x, counters;
+  u_int count;
+
+  if (!dst || !src || dst == src || dst->btk_width != src->btk_width || dst->btk_depth != src->btk_depth || dst->btk_maxkey < src->btk_maxkey)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal or mismatched arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  counters = (size_t)dst->btk_width * dst->btk_depth;
+  for (x = 0; x < counters; x++)
+    __atomic_add_fetch(&dst->btk_counters[x], __atomic_load_n(&src->btk_counters[x], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+  __atomic_add_fetch(&dst->btk_total, __atomic_load_n(&src->btk_total, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+
+  if (!(items = bk_topk_list(B, src, &count, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not list source heavy hitters\n");
+    BK_RETURN(B, -1);
+  }
+
+  for (x = 0; x < count; x++)
+  {
+    murmurhash3_x64_128(items[x].bti_key, items[x].bti_keylen, SKETCH_SEED, hash);
+    topk_offer(B, dst, hash[0], items[x].bti_key, items[x].bti_keylen, topk_estimate(dst, hash));
+  }
+
+  bk_topk_list_destroy(B, items);
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Forget everything counted by a top-K tracker
+ *
+ * THREADS: MT-SAFE (adds racing the clear may or may not survive it)
+ *
+ * @param B BAKA Thread/global state
+ * @param topk Tracker
+ */
+void bk_topk_clear(bk_s B, struct bk_topk *topk)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  size_t x, counters;
+
+  if (!topk)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_VRETURN(B);
+  }
+
+  counters = (size_t)topk->btk_width * topk->btk_depth;
+  for (x = 0; x < counters; x++)
+    __atomic_store_n(&topk->btk_counters[x], 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&topk->btk_total, 0, __ATOMIC_RELAXED);
+
+#ifdef BK_USING_PTHREADS
+  if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_lock(&topk->btk_lock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+
+  topk->btk_used = 0;
+  __atomic_store_n(&topk->btk_threshold, 0, __ATOMIC_RELAXED);
+
+#ifdef BK_USING_PTHREADS
+  if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_unlock(&topk->btk_lock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Offer a key to the heavy hitter heap: raise its count if it is there,
+ * otherwise take a free entry or evict the smallest if this key beats it.
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA Thread/global state
+ * @param topk Tracker
+ * @param hash Key hash
+ * @param key Key
+ * @param len Key length
+ * @param estimate Key's current count estimate
+ */
+static void topk_offer(bk_s B, struct bk_topk *topk, u_int64_t hash, const void *key, size_t len, u_int64_t estimate)
+{
+  struct topk_entry *heap = topk->btk_heap;
+  u_int x;
+
+#ifdef BK_USING_PTHREADS
+  if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_lock(&topk->btk_lock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+
+  for (x = 0; x < topk->btk_used; x++)
+  {
+    if (heap[x].te_hash == hash && heap[x].te_keylen == len &&
+	!memcmp(topk->btk_keys + heap[x].te_slot * topk->btk_maxkey, key, len))
+      break;
+  }
+
+  if (x < topk->btk_used)
+  {
+    if (estimate > heap[x].te_count)
+    {
+      heap[x].te_count = estimate;
+      topk_siftdown(heap, topk->btk_used, x);
+    }
+  }
+  else if (topk->btk_used < topk->btk_k)
+  {
+    x = topk->btk_used++;
+    heap[x].te_slot = x;
+    heap[x].te_hash = hash;
+    heap[x].te_keylen = len;
+    heap[x].te_count = estimate;
+    memcpy(topk->btk_keys + x * topk->btk_maxkey, key, len);
+    topk_siftup(heap, x);
+  }
+  else if (estimate > heap[0].te_count)
+  {
+    heap[0].te_hash = hash;
+    heap[0].te_keylen = len;
+    heap[0].te_count = estimate;
+    memcpy(topk->btk_keys + heap[0].te_slot * topk->btk_maxkey, key, len);
+    topk_siftdown(heap, topk->btk_used, 0);
+  }
+
+  if (topk->btk_used == topk->btk_k)
+    __atomic_store_n(&topk->btk_threshold, heap[0].te_count, __ATOMIC_RELAXED);
+
+#ifdef BK_USING_PTHREADS
+  if (BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_unlock(&topk->btk_lock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+}
+
+
+
+/**
+ * Count-min estimate for a hashed key: the smallest of its counters
+ *
+ * @param topk Tracker
+ * @param hash Both halves of the key hash
+ * @return <i>estimate</i>
+ */
+static u_int64_t topk_estimate(struct bk_topk *topk, const u_int64_t *hash)
+{
+  u_int64_t estimate = ~(u_int64_t)0, cur;
+  u_int row;
+
+  for (row = 0; row < topk->btk_depth; row++)
+  {
+    cur = __atomic_load_n(&topk->btk_counters[(size_t)row * topk->btk_width + (hash[0] + row * hash[1]) % topk->btk_width], __ATOMIC_RELAXED);
+    estimate = BK_MIN(estimate, cur);
+  }
+
+  return(estimate);
+}
+
+
+
+/**
+ * Restore the min-heap property below an entry whose count grew
+ *
+ * @param heap Heap
+ * @param used Entries in the heap
+ * @param cur Entry which grew
+ */
+static void topk_siftdown(struct topk_entry *heap, u_int used, u_int cur)
+{
+  struct topk_entry tmp;
+  u_int child;
+
+  while ((child = 2 * cur + 1) < used)
+  {
+    if (child + 1 < used && heap[child + 1].te_count < heap[child].te_count)
+      child++;
+    if (heap[cur].te_count <= heap[child].te_count)
+      break;
+    tmp = heap[cur];
+    heap[cur] = heap[child];
+    heap[child] = tmp;
+    cur = child;
+  }
+}
+
+
+
+/**
+ * Restore the min-heap property above a newly added entry
+ *
+ * @param heap Heap
+ * @param cur Entry just added
+ */
+static void topk_siftup(struct topk_entry *heap, u_int cur)
+{
+  struct topk_entry tmp;
+  u_int parent;
+
+  while (cur > 0 && heap[(parent = (cur - 1) / 2)].te_count > heap[cur].te_count)
+  {
+    tmp = heap[cur];
+    heap[cur] = heap[parent];
+    heap[parent] = tmp;
+    cur = parent;
+  }
+}
+
+
+
+/**
+ * qsort comparison putting the largest counts first
+ */
+static int topk_item_cmp(const void *a, const void *b)
+{
+  const struct bk_topk_item *ia = a, *ib = b;
+
+  if (ia->bti_count != ib->bti_count)
+    return(ia->bti_count > ib->bti_count ? -1 : 1);
+  return(0);
+}
+
+
+
+/**
+ * Create a DDSketch quantile estimator.  Every quantile of positive
+ * values it reports is within @a accuracy (relative) of a true value at
+ * that rank, so long as the values lie within the range the bins cover:
+ * gamma^(+-bins/2), where gamma is (1+accuracy)/(1-accuracy).  Values
+ * outside that range land in the end bins; values <= 0 are counted
+ * separately and reported as 0.
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA Thread/global state
+ * @param accuracy Relative accuracy (0 for BK_QUANTILE_ACCURACY_DEFAULT)
+ * @param bins Number of bins (0 for BK_QUANTILE_BINS_DEFAULT)
+ * @param flags Fun for the future
+ * @return <i>new estimator</i> on success
+ * @return <i>NULL</i> on failure
+ */
+struct bk_quantile *bk_quantile_create(bk_s B, double accuracy, u_int bins, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_quantile *q = NULL;
+
+  if (accuracy == 0)
+    accuracy = BK_QUANTILE_ACCURACY_DEFAULT;
+  if (!bins)
+    bins = BK_QUANTILE_BINS_DEFAULT;
+
+  if (accuracy <= 0 || accuracy >= 1 || bins < 2)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid quantile sketch parameters\n");
+    BK_RETURN(B, NULL);
+  }
+
+  if (!BK_CALLOC_LEN(q, sizeof(*q)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate quantile sketch: %s\n", strerror(errno));
+    goto error;
+  }
+  q->bq_gamma = (1 + accuracy) / (1 - accuracy);
+  q->bq_lngamma = log(q->bq_gamma);
+  q->bq_bins = bins;
+  q->bq_offset = bins / 2;
+
+  if (!BK_CALLOC_LEN(q->bq_counts, bins * sizeof(*q->bq_counts)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate quantile sketch bins: %s\n", strerror(errno));
+    goto error;
+  }
+
+  bk_quantile_clear(B, q);
+  BK_RETURN(B, q);
+
+ error:
+  if (q)
+    bk_quantile_destroy(B, q);
+
+  BK_RETURN(B, NULL);
+}
+
+
+
+/**
+ * Destroy a quantile estimator
+ *
+ * THREADS: MT-SAFE (as long as no one else is using it)
+ *
+ * @param B BAKA Thread/global state
+ * @param q Estimator to destroy
+ */
+void bk_quantile_destroy(bk_s B, struct bk_quantile *q)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (q)
+  {
+    if (q->bq_counts)
+      free(q->bq_counts);
+    free(q);
+  }
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Add a value to a quantile estimator
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA Thread/global state
+ * @param q Estimator
+ * @param value Value to add
+ * @return <i>0</i> on success
+ * @return <i>-1</i> on failure
+ */
+int bk_quantile_add(bk_s B, struct bk_quantile *q, double value)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  double idx;
+  int bin;
+
+  if (!q || isnan(value))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (value <= 0)
+  {
+    __atomic_add_fetch(&q->bq_zero, 1, __ATOMIC_RELAXED);
+  }
+  else
+  {
+    idx = ceil(log(value) / q->bq_lngamma) + q->bq_offset;
+    bin = (idx < 0) ? 0 : ((idx >= q->bq_bins) ? q->bq_bins - 1 : (int)idx);
+    __atomic_add_fetch(&q->bq_counts[bin], 1, __ATOMIC_RELAXED);
+  }
+
+  quantile_extreme(&q->bq_min, value, 0);
+  quantile_extreme(&q->bq_max, value, 1);
+  __atomic_add_fetch(&q->bq_count, 1, __ATOMIC_RELAXED);
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Estimate a percentile of the values added to a quantile estimator.
+ * The 0th and 100th percentiles are the exact minimum and maximum.
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA Thread/global state
+ * @param q Estimator
+ * @param pct Percentile wanted (0-100)
+ * @param valuep C/O estimate
+ * @param flags Fun for the future
+ * @return <i>0</i> on success
+ * @return <i>-1</i> on failure (including no values added)
+ */
+int bk_quantile_get(bk_s B, struct bk_quantile *q, double pct, double *valuep, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  u_int64_t count, rank, seen;
+  double min, max, value;
+  u_int bin;
+
+  if (!q || !valuep || pct < 0 || pct > 100)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (!(count = __atomic_load_n(&q->bq_count, __ATOMIC_RELAXED)))
+    BK_RETURN(B, -1);
+
+  min = quantile_bits2double(__atomic_load_n(&q->bq_min, __ATOMIC_RELAXED));
+  max = quantile_bits2double(__atomic_load_n(&q->bq_max, __ATOMIC_RELAXED));
+  rank = (u_int64_t)(pct / 100 * (count - 1));
+
+  if (pct == 0 || pct == 100)
+  {
+    *valuep = (pct == 0) ? min : max;
+    BK_RETURN(B, 0);
+  }
+
+  value = max;
+  if ((seen = __atomic_load_n(&q->bq_zero, __ATOMIC_RELAXED)) > rank)
+  {
+    value = 0;
+  }
+  else
+  {
+    for (bin = 0; bin < q->bq_bins; bin++)
+    {
+      if ((seen += __atomic_load_n(&q->bq_counts[bin], __ATOMIC_RELAXED)) > rank)
+      {
+	// Midpoint (in relative terms) of the bin's range (gamma^(i-1), gamma^i]
+	value = 2 * pow(q->bq_gamma, (int)bin - q->bq_offset) / (q->bq_gamma + 1);
+	break;
+      }
+    }
+  }
+
+  *valuep = BK_MAX(min, BK_MIN(max, value));
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Number of values added to a quantile estimator
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA Thread/global state
+ * @param q Estimator
+ * @return <i>count</i>
+ */
+u_int64_t bk_quantile_count(bk_s B, struct bk_quantile *q)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!q)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, 0);
+  }
+
+  BK_RETURN(B, __atomic_load_n(&q->bq_count, __ATOMIC_RELAXED));
+}
+
+
+
+/**
+ * Merge one quantile estimator into another with the same accuracy and
+ * bins.  Afterwards @a dst describes the values added to either.
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA Thread/global state
+ * @param dst Estimator to merge into
+ * @param src Estimator to merge from (unchanged)
+ * @param flags Fun for the future
+ * @return <i>0</i> on success
+ * @return <i>-1</i> on failure (including a shape mismatch)
+ */
+int bk_quantile_merge(bk_s B, struct bk_quantile *dst, struct bk_quantile *src, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  u_int bin;
+
+  if (!dst || !src || dst == src || dst->bq_gamma != src->bq_gamma || dst->bq_bins != src->bq_bins)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal or mismatched arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (!__atomic_load_n(&src->bq_count, __ATOMIC_RELAXED))
+    BK_RETURN(B, 0);
+
+  for (bin = 0; bin < dst->bq_bins; bin++)
+    __atomic_add_fetch(&dst->bq_counts[bin], __atomic_load_n(&src->bq_counts[bin], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+  __atomic_add_fetch(&dst->bq_zero, __atomic_load_n(&src->bq_zero, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+  quantile_extreme(&dst->bq_min, quantile_bits2double(__atomic_load_n(&src->bq_min, __ATOMIC_RELAXED)), 0);
+  quantile_extreme(&dst->bq_max, quantile_bits2double(__atomic_load_n(&src->bq_max, __ATOMIC_RELAXED)), 1);
+  __atomic_add_fetch(&dst->bq_count, __atomic_load_n(&src->bq_count, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Forget every value added to a quantile estimator
+ *
+ * THREADS: MT-SAFE (adds racing the clear may or may not survive it)
+ *
+ * @param B BAKA Thread/global state
+ * @param q Estimator
+ */
+void bk_quantile_clear(bk_s B, struct bk_quantile *q)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  double inf = HUGE_VAL, ninf = -HUGE_VAL;
+  u_int64_t bits;
+  u_int bin;
+
+  if (!q)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_VRETURN(B);
+  }
+
+  __atomic_store_n(&q->bq_count, 0, __ATOMIC_RELAXED);
+  for (bin = 0; bin < q->bq_bins; bin++)
+    __atomic_store_n(&q->bq_counts[bin], 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&q->bq_zero, 0, __ATOMIC_RELAXED);
+  memcpy(&bits, &inf, sizeof(bits));
+  __atomic_store_n(&q->bq_min, bits, __ATOMIC_RELAXED);
+  memcpy(&bits, &ninf, sizeof(bits));
+  __atomic_store_n(&q->bq_max, bits, __ATOMIC_RELAXED);
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Atomically lower a minimum or raise a maximum held as the bits of a double
+ *
+ * @param bitsp Extreme to update
+ * @param value Candidate value
+ * @param max Nonzero to raise a maximum, zero to lower a minimum
+ */
+static void quantile_extreme(u_int64_t *bitsp, double value, int max)
+{
+  u_int64_t cur, bits;
+
+  memcpy(&bits, &value, sizeof(bits));
+  cur = __atomic_load_n(bitsp, __ATOMIC_RELAXED);
+  while ((max ? value > quantile_bits2double(cur) : value < quantile_bits2double(cur)) &&
+	 !__atomic_compare_exchange_n(bitsp, &cur, bits, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+
+
+/**
+ * Reinterpret the bits of a double
+ *
+ * @param bits Bits
+ * @return <i>double</i>
+ */
+static inline double quantile_bits2double(u_int64_t bits)
+{
+  double value;
+
+  memcpy(&value, &bits, sizeof(value));
+  return(value);
+}
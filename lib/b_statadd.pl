@@ -3,7 +3,8 @@
 #
 # Add stats tables produced by baka statistics, produce a combined
 # output file as the sum of the inputs (for combining per-thread stats
-# files)
+# files).  Percentile columns (from histogram lists) cannot be added
+# exactly; the largest of each is kept, which is an upper bound.
 #
 #
 # ++Copyright BAKA++
@@ -33,7 +34,7 @@ foreach $file (@ARGV)
   while (<X>)
   {
     my (@A) = split(/\<td[^>]*\>/);
-    if ($#A == 7)
+    if ($#A >= 7)
     {
       $state = 1;
 
@@ -58,6 +59,11 @@ foreach $file (@ARGV)
       }
       $count{$name} += int($A[6]);
       $sum{$name} += $A[7];
+      for ($col = 8; $col <= $#A; $col++)
+      {
+	$A[$col] =~ s/<.*//s;
+	$pct{$name}[$col-8] = max($pct{$name}[$col-8],int($A[$col]));
+      }
     }
     else
     {
@@ -78,8 +84,13 @@ foreach $name (keys %count)
 {
   my ($n1,$n2) = split(/</,$name);
 
-  printf(qq^<tr><td>%s</td><td>%s</td><td align="right">%u</td><td align="right">%.3f</td><td align="right">%u</td><td align="right">%u</td><td align="right">%.6f</td></tr>\n^,
+  printf(qq^<tr><td>%s</td><td>%s</td><td align="right">%u</td><td align="right">%.3f</td><td align="right">%u</td><td align="right">%u</td><td align="right">%.6f</td>^,
 	 $n1, $n2, $min{$name}, $sum{$name}*1000000/$count{$name}, $max{$name}, $count{$name},$sum{$name});
+  foreach $p (@{$pct{$name}})
+  {
+    printf(qq^<td align="right">%u</td>^, $p);
+  }
+  print "</tr>\n";
 }
 print @trailer;
 
@@ -2,7 +2,7 @@
 #
 # Compare two stats tables produced by baka statistics, produce a
 # combined output file with relative order positions and percentage
-# change.
+# change.  Any percentile columns (histogram lists) may be compared too.
 #
 # ++Copyright BAKA++
 #
@@ -43,7 +43,7 @@ sub sortem
   foreach $line (@aa)
   {
     my (@junk) = split(/\<td[^>]*\>/,$line);
-    if ($#junk == 7)
+    if ($#junk >= 7)
     {
       $state = 1;
       push(@body,$line);
@@ -68,7 +68,7 @@ $pos = 1;
 foreach $line (@new)
 {
   @comp = split(/\<td[^>]*\>/,$line);
-  if ($#comp != 7)
+  if ($#comp < 7)
   {
     next;
   }
@@ -88,7 +88,7 @@ $state = 0;
 foreach $line (@old)
 {
   @comp = split(/\<td[^>]*\>/,$line);
-  if ($#comp != 7)
+  if ($#comp < 7)
   {
     if ($state == 0)
     {
@@ -50,6 +50,28 @@ static const char libbk__contact[] = "<projectbaka@baka.org>";
 
 #define MAXPERFINFO	8192			///< Maximum size for a performance information line
 
+/*
+ * Histograms are log-linear (HDR style): values below 2^BSH_SUBBITS each
+ * have a bucket, and every power of two above that is split into
+ * 2^BSH_SUBBITS buckets, so any recorded value is known to within
+ * 1/2^BSH_SUBBITS (about 3%).  Values past 2^BSH_MAXBITS usec (about
+ * nine years) share the last bucket.
+ */
+#define BSH_SUBBITS	5			///< log2 of buckets per power of two
+#define BSH_SUBCOUNT	(1 << BSH_SUBBITS)	///< Buckets per power of two
+#define BSH_MAXBITS	48			///< Largest value distinguished
+#define BSH_BUCKETS	((BSH_MAXBITS - BSH_SUBBITS + 1) * BSH_SUBCOUNT) ///< Buckets per histogram
+#define BSL_DEFPCTS	{ 50.0, 90.0, 99.0, 99.9 } ///< Default reported percentiles
+
+/*
+ * Sharded nodes (BK_STATS_SHARDED) keep their totals in per-thread shards,
+ * each on its own cache line, so recording threads never take the node
+ * lock or bounce a shared line.  Threads are handed shards round-robin;
+ * past BSN_SHARDS threads some share, which the atomic updates tolerate.
+ */
+#define BSN_SHARDS	64			///< Shards per sharded node
+#define BSN_LINE	64			///< Cache line size, for shard alignment
+
 
 
 /**
@@ -58,11 +80,27 @@ static const char libbk__contact[] = "<projectbaka@baka.org>";
 struct bk_stat_list
 {
   dict_h	bsl_list;			///< List of performance tracks
-  bk_flags	bsl_flags;			///< Flags for the future
+  bk_flags	bsl_flags;			///< BK_STATS_HISTOGRAM
+  u_int		bsl_npcts;			///< Percentiles reported
+  double	bsl_pcts[BK_STAT_MAXPCTS];	///< Percentiles reported
 };
 
 
 
+/**
+ * One thread's share of a sharded performance tracking node
+ */
+struct bsn_shard
+{
+  u_quad_t		bss_minutime;		///< Minimum number of microseconds this shard has seen
+  u_quad_t		bss_maxutime;		///< Maximum number of microseconds this shard has seen
+  u_quad_t		bss_sumutime;		///< Sum of microseconds this shard has seen
+  u_quad_t		bss_count;		///< Number of times this shard has tracked
+  struct timeval	bss_start;		///< Start time for this thread's current tracking
+} __attribute__ ((aligned (BSN_LINE)));
+
+
+
 /**
  * Performance tracking node
  */
@@ -75,6 +113,8 @@ struct bk_stat_node
   u_quad_t		bsn_sumutime;		///< Sum of microseconds we have seen for this itme
   struct timeval	bsn_start;		///< Start time for current tracking
   u_int			bsn_count;		///< Number of times we have tracked
+  u_quad_t	       *bsn_hist;		///< Histogram of microseconds (BSH_BUCKETS), if kept
+  struct bsn_shard     *bsn_shards;		///< Per-thread totals (BSN_SHARDS), if sharded
   bk_flags		bsn_flags;		///< Flags for the future
 #ifdef BK_USING_PTHREADS
   pthread_mutex_t	bsn_lock;		///< Per-node locking
@@ -112,15 +152,29 @@ static ht_val bsl_key_hash(struct bk_stat_node *a);
 static struct ht_args bsl_args = { 1024, 3, (ht_func)bsl_obj_hash, (ht_func)bsl_key_hash };
 // @}
 
+static void bsn_record(struct bk_stat_node *bnode, u_quad_t usec);
+static u_int bsh_index(u_quad_t usec);
+static u_quad_t bsh_value(u_int idx);
+static u_quad_t bsn_percentile(struct bk_stat_node *bnode, double pct);
+static struct bsn_shard *bsn_shard(struct bk_stat_node *bnode);
+static void bss_add(struct bsn_shard *bss, u_quad_t count, u_quad_t sumutime, u_quad_t minutime, u_quad_t maxutime);
+static void bsn_totals(struct bk_stat_node *bnode, u_quad_t *minutime, u_quad_t *maxutime, u_quad_t *sumutime, u_quad_t *count);
+
+static __thread u_int bsn_myshard __attribute__ ((tls_model ("initial-exec"))); ///< This thread's shard index plus one, 0 if not yet assigned
+static u_int bsn_nextshard;			///< Next shard index to hand out
+
 
 
 /**
- * Create a performance statistic tracking list
+ * Create a performance statistic tracking list.  With BK_STATS_HISTOGRAM
+ * every node in the list keeps a latency histogram, and dumps report
+ * percentiles (see @a bk_stat_percentiles_set).  With BK_STATS_SHARDED
+ * every node is sharded (see @a bk_stat_node_create).
  *
  * THREADS: MT-SAFE
  *
  *	@param B BAKA thread/global state.
- *	@param flags BK_STATS_NO_LOCKS_NEEDED
+ *	@param flags BK_STATS_NO_LOCKS_NEEDED, BK_STATS_HISTOGRAM, BK_STATS_SHARDED
  *	@return <i>NULL</i> on failure.<br>
  *	@return <br><i>performance list</i> on success
  */
@@ -129,12 +183,16 @@ struct bk_stat_list *bk_stat_create(bk_s B, bk_flags flags)
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
   struct bk_stat_list *blist;
   bk_flags bsl_flags = DICT_UNIQUE_KEYS;
+  double defpcts[] = BSL_DEFPCTS;
 
   if (!BK_CALLOC(blist))
   {
     bk_error_printf(B, BK_ERR_ERR, "Could not allocate performance list structure: %s\n", strerror(errno));
     BK_RETURN(B, NULL);
   }
+  blist->bsl_flags = flags & (BK_STATS_HISTOGRAM|BK_STATS_SHARDED);
+  blist->bsl_npcts = sizeof(defpcts) / sizeof(*defpcts);
+  memcpy(blist->bsl_pcts, defpcts, sizeof(defpcts));
 
   if (BK_FLAG_ISCLEAR(flags, BK_STATS_NO_LOCKS_NEEDED))
   {
@@ -188,6 +246,47 @@ void bk_stat_destroy(bk_s B, struct bk_stat_list *blist)
 
 
 
+/**
+ * Choose the percentiles which dumps of a histogram list report
+ *
+ * THREADS: THREAD-REENTRANT
+ *
+ *	@param B BAKA thread/global state.
+ *	@param blist Performance list
+ *	@param pcts Percentiles (0-100), e.g. 99.9
+ *	@param npcts Number of percentiles (at most BK_STAT_MAXPCTS)
+ *	@param flags Fun for the future
+ *	@return <i>-1</i> on call failure
+ *	@return <br><i>0</i> on success
+ */
+int bk_stat_percentiles_set(bk_s B, struct bk_stat_list *blist, const double *pcts, u_int npcts, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  u_int cnt;
+
+  if (!blist || (npcts && !pcts) || npcts > BK_STAT_MAXPCTS)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  for (cnt = 0; cnt < npcts; cnt++)
+  {
+    if (pcts[cnt] < 0.0 || pcts[cnt] > 100.0)
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Percentile %g is out of range\n", pcts[cnt]);
+      BK_RETURN(B, -1);
+    }
+  }
+
+  memcpy(blist->bsl_pcts, pcts, npcts * sizeof(*pcts));
+  blist->bsl_npcts = npcts;
+
+  BK_RETURN(B, 0);
+}
+
+
+
 /**
  * Create a performance statistic tracking node, attach to blist
  *
@@ -197,7 +296,7 @@ void bk_stat_destroy(bk_s B, struct bk_stat_list *blist)
  *	@param blist Performance list
  *	@param name1 Primary name
  *	@param name2 Secondary name
- *	@param flags Fun for the future
+ *	@param flags BK_STATS_HISTOGRAM (implied by a histogram list)
  *	@return <i>NULL</i> on failure.<br>
  *	@return <br><i>performance node</i> on success
  */
@@ -212,7 +311,7 @@ struct bk_stat_node *bk_stat_nodelist_create(bk_s B, struct bk_stat_list *blist,
     BK_RETURN(B, NULL);
   }
 
-  if (!(bnode = bk_stat_node_create(B, name1, name2, flags)))
+  if (!(bnode = bk_stat_node_create(B, name1, name2, flags | blist->bsl_flags)))
   {
     bk_error_printf(B, BK_ERR_ERR, "Could not create node for list\n");
     BK_RETURN(B, NULL);
@@ -231,14 +330,18 @@ struct bk_stat_node *bk_stat_nodelist_create(bk_s B, struct bk_stat_list *blist,
 
 
 /**
- * Create a performance statistic tracking node
+ * Create a performance statistic tracking node.  A BK_STATS_SHARDED node
+ * is recorded into without taking its lock: each thread adds to its own
+ * cache-line shard and readers sum the shards, so many threads can hammer
+ * one node cheaply.  Its start/end intervals are kept per shard, so are
+ * only reliable with at most BSN_SHARDS threads timing the node at once.
  *
  * THREADS: MT-SAFE
  *
  *	@param B BAKA thread/global state.
  *	@param name1 Primary name
  *	@param name2 Secondary name
- *	@param flags Fun for the future
+ *	@param flags BK_STATS_HISTOGRAM to keep a latency histogram, BK_STATS_SHARDED
  *	@return <i>NULL</i> on failure.<br>
  *	@return <br><i>performance node</i> on success
  */
@@ -246,6 +349,8 @@ struct bk_stat_node *bk_stat_node_create(bk_s B, const char *name1, const char *
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
   struct bk_stat_node *bnode;
+  void *shards;
+  u_int shard;
 
   if (!name1)
   {
@@ -271,6 +376,25 @@ struct bk_stat_node *bk_stat_node_create(bk_s B, const char *name1, const char *
   }
   bnode->bsn_minutime = UINT_MAX;
 
+  if (BK_FLAG_ISSET(flags, BK_STATS_HISTOGRAM) && !(bnode->bsn_hist = calloc(BSH_BUCKETS, sizeof(*bnode->bsn_hist))))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate performance histogram: %s\n", strerror(errno));
+    goto error;
+  }
+
+  if (BK_FLAG_ISSET(flags, BK_STATS_SHARDED))
+  {
+    if ((errno = posix_memalign(&shards, BSN_LINE, BSN_SHARDS * sizeof(*bnode->bsn_shards))) != 0)
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not allocate performance shards: %s\n", strerror(errno));
+      goto error;
+    }
+    bnode->bsn_shards = shards;
+    memset(bnode->bsn_shards, 0, BSN_SHARDS * sizeof(*bnode->bsn_shards));
+    for (shard = 0; shard < BSN_SHARDS; shard++)
+      bnode->bsn_shards[shard].bss_minutime = UINT_MAX;
+  }
+
   BK_RETURN(B, bnode);
 
  error:
@@ -305,6 +429,12 @@ void bk_stat_node_destroy(bk_s B, struct bk_stat_node *bnode)
   if (bnode->bsn_name2)
     free((void *)bnode->bsn_name2);
 
+  if (bnode->bsn_hist)
+    free(bnode->bsn_hist);
+
+  if (bnode->bsn_shards)
+    free(bnode->bsn_shards);
+
 #ifdef BK_USING_PTHREADS
   if (pthread_mutex_unlock(&bnode->bsn_lock) != 0)
     abort();
@@ -410,6 +540,7 @@ void bk_stat_end(bk_s B, struct bk_stat_list *blist, const char *name1, const ch
 void bk_stat_node_start(bk_s B, struct bk_stat_node *bnode, bk_flags flags)
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct timeval *start;
 
   if (!bnode)
   {
@@ -417,22 +548,23 @@ void bk_stat_node_start(bk_s B, struct bk_stat_node *bnode, bk_flags flags)
     BK_VRETURN(B);
   }
 
+  start = bnode->bsn_shards?&bsn_shard(bnode)->bss_start:&bnode->bsn_start;
 
-  if (bnode->bsn_start.tv_sec != 0)
+  if (start->tv_sec != 0)
   {
     bk_error_printf(B, BK_ERR_ERR, "Performance interval %s/%s has already been started\n", bnode->bsn_name1,bnode->bsn_name2?bnode->bsn_name2:"");
     BK_VRETURN(B);
   }
 
 #ifdef BK_USING_PTHREADS
-  if (BK_FLAG_ISCLEAR(flags, BK_STATS_NO_LOCKS_NEEDED) && BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_lock(&bnode->bsn_lock) != 0)
+  if (BK_FLAG_ISCLEAR(flags, BK_STATS_NO_LOCKS_NEEDED) && !bnode->bsn_shards && BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_lock(&bnode->bsn_lock) != 0)
     abort();
 #endif /* BK_USING_PTHREADS */
 
-  gettimeofday(&bnode->bsn_start, NULL);
+  gettimeofday(start, NULL);
 
 #ifdef BK_USING_PTHREADS
-  if (BK_FLAG_ISCLEAR(flags, BK_STATS_NO_LOCKS_NEEDED) && BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_unlock(&bnode->bsn_lock) != 0)
+  if (BK_FLAG_ISCLEAR(flags, BK_STATS_NO_LOCKS_NEEDED) && !bnode->bsn_shards && BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_unlock(&bnode->bsn_lock) != 0)
     abort();
 #endif /* BK_USING_PTHREADS */
 
@@ -454,7 +586,7 @@ void bk_stat_node_start(bk_s B, struct bk_stat_node *bnode, bk_flags flags)
 void bk_stat_node_end(bk_s B, struct bk_stat_node *bnode, bk_flags flags)
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
-  struct timeval end, sum;
+  struct timeval end, sum, *start;
   u_quad_t thisus = 0;
 
   if (!bnode)
@@ -463,7 +595,9 @@ void bk_stat_node_end(bk_s B, struct bk_stat_node *bnode, bk_flags flags)
     BK_VRETURN(B);
   }
 
-  if (bnode->bsn_start.tv_sec == 0)
+  start = bnode->bsn_shards?&bsn_shard(bnode)->bss_start:&bnode->bsn_start;
+
+  if (start->tv_sec == 0)
   {
     bk_error_printf(B, BK_ERR_ERR, "Performance interval %s/%s was ended but not started (perhaps double-started?)\n", bnode->bsn_name1,bnode->bsn_name2?bnode->bsn_name2:"");
     BK_VRETURN(B);
@@ -472,11 +606,11 @@ void bk_stat_node_end(bk_s B, struct bk_stat_node *bnode, bk_flags flags)
   gettimeofday(&end, NULL);
 
 #ifdef BK_USING_PTHREADS
-  if (BK_FLAG_ISCLEAR(flags, BK_STATS_NO_LOCKS_NEEDED) && BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_lock(&bnode->bsn_lock) != 0)
+  if (BK_FLAG_ISCLEAR(flags, BK_STATS_NO_LOCKS_NEEDED) && !bnode->bsn_shards && BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_lock(&bnode->bsn_lock) != 0)
     abort();
 #endif /* BK_USING_PTHREADS */
 
-  BK_TV_SUB(&sum, &end, &bnode->bsn_start);
+  BK_TV_SUB(&sum, &end, start);
 
 #ifdef THISUS_IS_INT
   if (sum.tv_sec >= 4294)
@@ -488,19 +622,12 @@ void bk_stat_node_end(bk_s B, struct bk_stat_node *bnode, bk_flags flags)
 #endif /*THISUS_IS_INT*/
     thisus = BK_SECSTOUSEC(sum.tv_sec) + sum.tv_usec;
 
-  if (thisus < bnode->bsn_minutime)
-    bnode->bsn_minutime = thisus;
+  bsn_record(bnode, thisus);
 
-  if (thisus > bnode->bsn_maxutime)
-    bnode->bsn_maxutime = thisus;
-
-  bnode->bsn_sumutime += thisus;
-  bnode->bsn_count++;
-
-  bnode->bsn_start.tv_sec = 0;
+  start->tv_sec = 0;
 
 #ifdef BK_USING_PTHREADS
-  if (BK_FLAG_ISCLEAR(flags, BK_STATS_NO_LOCKS_NEEDED) && BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_unlock(&bnode->bsn_lock) != 0)
+  if (BK_FLAG_ISCLEAR(flags, BK_STATS_NO_LOCKS_NEEDED) && !bnode->bsn_shards && BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_unlock(&bnode->bsn_lock) != 0)
     abort();
 #endif /* BK_USING_PTHREADS */
 
@@ -516,6 +643,9 @@ void bk_stat_node_end(bk_s B, struct bk_stat_node *bnode, bk_flags flags)
  *
  * @param B BAKA thread/global environment
  * @param blist Performance list
+ * Lists created with BK_STATS_HISTOGRAM get a column per configured
+ * percentile after the usual ones.
+ *
  * @param flags BK_STAT_DUMP_HTML, BK_STATS_NO_LOCKS_NEEDED
  * @param <i>NULL</i> on call failure, allocation failure
  * @param <br><i>string you must free</i> on success
@@ -527,6 +657,10 @@ char *bk_stat_dump(bk_s B, struct bk_stat_list *blist, bk_flags flags)
   char perfbuf[MAXPERFINFO];
   bk_vstr ostring;
   char *funstatfilessave = BK_GENERAL_FUNSTATFILE(B);
+  int histogram = BK_FLAG_ISSET(blist?blist->bsl_flags:0, BK_STATS_HISTOGRAM);
+  u_quad_t minutime, maxutime, sumutime, count;
+  u_int pct;
+  int len;
 
   if (!blist)
   {
@@ -548,7 +682,15 @@ char *bk_stat_dump(bk_s B, struct bk_stat_list *blist, bk_flags flags)
 
   if (BK_FLAG_ISSET(flags, BK_STAT_DUMP_HTML))
   {
-    if (bk_vstr_cat(B, 0, &ostring, "<table summary=\"Performance Information\"><caption><em>Program Performance Statistics</em></caption><tr><th>Primary Name</th><th>Secondary Name</th><th>Minimum time (usec)</th><th>Average time (usec)</th><th>Maximum time (usec)</th><th>Count</th><th>Total time (sec)</th></tr>\n") < 0)
+    if (bk_vstr_cat(B, 0, &ostring, "<table summary=\"Performance Information\"><caption><em>Program Performance Statistics</em></caption><tr><th>Primary Name</th><th>Secondary Name</th><th>Minimum time (usec)</th><th>Average time (usec)</th><th>Maximum time (usec)</th><th>Count</th><th>Total time (sec)</th>") < 0)
+      goto error;
+    // Percentile columns come after the original seven, which scripts index
+    for (pct = 0; histogram && pct < blist->bsl_npcts; pct++)
+    {
+      if (bk_vstr_cat(B, 0, &ostring, "<th>p%g (usec)</th>", blist->bsl_pcts[pct]) < 0)
+	goto error;
+    }
+    if (bk_vstr_cat(B, 0, &ostring, "</tr>\n") < 0)
       goto error;
   }
 
@@ -559,15 +701,28 @@ char *bk_stat_dump(bk_s B, struct bk_stat_list *blist, bk_flags flags)
       abort();
 #endif /* BK_USING_PTHREADS */
 
+    bsn_totals(bnode, &minutime, &maxutime, &sumutime, &count);
+
     if (BK_FLAG_ISSET(flags, BK_STAT_DUMP_HTML))
     {
-      snprintf(perfbuf, sizeof(perfbuf), "<tr><td>%s</td><td>%s</td><td align=\"right\">%llu</td><td align=\"right\">%.3f</td><td align=\"right\">%llu</td><td align=\"right\">%u</td><td align=\"right\">%.6f</td></tr>\n",bnode->bsn_name1, bnode->bsn_name2, BUG_LLU_CAST(bnode->bsn_minutime), bnode->bsn_count?(double)bnode->bsn_sumutime/bnode->bsn_count:0.0, BUG_LLU_CAST(bnode->bsn_maxutime), bnode->bsn_count,(double)bnode->bsn_sumutime/1000000.0);
+      len = snprintf(perfbuf, sizeof(perfbuf), "<tr><td>%s</td><td>%s</td><td align=\"right\">%llu</td><td align=\"right\">%.3f</td><td align=\"right\">%llu</td><td align=\"right\">%u</td><td align=\"right\">%.6f</td>",bnode->bsn_name1, bnode->bsn_name2, BUG_LLU_CAST(minutime), count?(double)sumutime/count:0.0, BUG_LLU_CAST(maxutime), (u_int)count,(double)sumutime/1000000.0);
     }
     else
     {
-      snprintf(perfbuf, sizeof(perfbuf), "\"%s\",\"%s\",\"%llu\",\"%.3f\",\"%llu\",\"%u\",\"%.6f\"\n",bnode->bsn_name1, bnode->bsn_name2, BUG_LLU_CAST(bnode->bsn_minutime), bnode->bsn_count?(double)bnode->bsn_sumutime/bnode->bsn_count:0.0, BUG_LLU_CAST(bnode->bsn_maxutime), bnode->bsn_count,(double)bnode->bsn_sumutime/1000000.0);
+      len = snprintf(perfbuf, sizeof(perfbuf), "\"%s\",\"%s\",\"%llu\",\"%.3f\",\"%llu\",\"%u\",\"%.6f\"",bnode->bsn_name1, bnode->bsn_name2, BUG_LLU_CAST(minutime), count?(double)sumutime/count:0.0, BUG_LLU_CAST(maxutime), (u_int)count,(double)sumutime/1000000.0);
     }
 
+    for (pct = 0; histogram && pct < blist->bsl_npcts && len < (int)sizeof(perfbuf); pct++)
+    {
+      if (BK_FLAG_ISSET(flags, BK_STAT_DUMP_HTML))
+	len += snprintf(perfbuf + len, sizeof(perfbuf) - len, "<td align=\"right\">%llu</td>", BUG_LLU_CAST(bsn_percentile(bnode, blist->bsl_pcts[pct])));
+      else
+	len += snprintf(perfbuf + len, sizeof(perfbuf) - len, ",\"%llu\"", BUG_LLU_CAST(bsn_percentile(bnode, blist->bsl_pcts[pct])));
+    }
+
+    if (len < (int)sizeof(perfbuf))
+      snprintf(perfbuf + len, sizeof(perfbuf) - len, "%s", BK_FLAG_ISSET(flags, BK_STAT_DUMP_HTML)?"</tr>\n":"\n");
+
 #ifdef BK_USING_PTHREADS
     if (BK_FLAG_ISCLEAR(flags, BK_STATS_NO_LOCKS_NEEDED) && BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_unlock(&bnode->bsn_lock) != 0)
       abort();
@@ -659,6 +814,7 @@ void bk_stat_info(bk_s B, struct bk_stat_list *blist, const char *name1, const c
 void bk_stat_node_info(bk_s B, struct bk_stat_node *bnode, u_quad_t *minusec, u_quad_t *maxusec, u_quad_t *sumutime, u_int *count, bk_flags flags)
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  u_quad_t min, max, sum, cnt;
 
   if (!bnode)
   {
@@ -671,17 +827,19 @@ void bk_stat_node_info(bk_s B, struct bk_stat_node *bnode, u_quad_t *minusec, u_
     abort();
 #endif /* BK_USING_PTHREADS */
 
+  bsn_totals(bnode, &min, &max, &sum, &cnt);
+
   if (minusec)
-    *minusec = bnode->bsn_minutime;
+    *minusec = min;
 
   if (maxusec)
-    *maxusec = bnode->bsn_maxutime;
+    *maxusec = max;
 
   if (sumutime)
-    *sumutime = bnode->bsn_sumutime;
+    *sumutime = sum;
 
   if (count)
-    *count = bnode->bsn_count;
+    *count = cnt;
 
 #ifdef BK_USING_PTHREADS
   if (BK_FLAG_ISCLEAR(flags, BK_STATS_NO_LOCKS_NEEDED) && BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_unlock(&bnode->bsn_lock) != 0)
@@ -693,6 +851,166 @@ void bk_stat_node_info(bk_s B, struct bk_stat_node *bnode, u_quad_t *minusec, u_
 
 
 
+/**
+ * Return a percentile of a performance interval, by name
+ *
+ * THREADS: MT-SAFE
+ *
+ * @param B BAKA thread/global environment
+ * @param blist Performance list
+ * @param name1 Primary name
+ * @param name2 Secondary name
+ * @param pct Percentile (0-100)
+ * @param usec Copy-out for the percentile
+ * @param flags BK_STATS_NO_LOCKS_NEEDED
+ * @return <i>-1</i> on call failure, or no such node or histogram
+ * @return <br><i>0</i> on success
+ */
+int bk_stat_percentile(bk_s B, struct bk_stat_list *blist, const char *name1, const char *name2, double pct, u_quad_t *usec, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  struct bk_stat_node *bnode;
+  struct bk_stat_node searchnode;
+
+  if (!blist || !name1)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  searchnode.bsn_name1 = name1;
+  searchnode.bsn_name2 = name2;
+
+  if (!(bnode = bsl_search(blist->bsl_list, &searchnode)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Tried to get a percentile of performance interval %s/%s which did not appear in list\n", name1, name2?name2:"");
+    BK_RETURN(B, -1);
+  }
+
+  BK_RETURN(B, bk_stat_node_percentile(B, bnode, pct, usec, flags));
+}
+
+
+
+/**
+ * Return a percentile of a performance interval.  The value is the
+ * highest one its histogram bucket could hold (but no more than the
+ * maximum seen), so it is at most about 3% high.
+ *
+ * THREADS: MT-SAFE (assuming different bnode)
+ * THREADS: THREAD-REENTRANT (Otherwise)
+ *
+ * @param B BAKA thread/global environment
+ * @param bnode Node to return information for
+ * @param pct Percentile (0-100)
+ * @param usec Copy-out for the percentile (0 if nothing recorded)
+ * @param flags BK_STATS_NO_LOCKS_NEEDED
+ * @return <i>-1</i> on call failure, or no histogram
+ * @return <br><i>0</i> on success
+ */
+int bk_stat_node_percentile(bk_s B, struct bk_stat_node *bnode, double pct, u_quad_t *usec, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!bnode || !usec || pct < 0.0 || pct > 100.0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (!bnode->bsn_hist)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Performance interval %s/%s keeps no histogram\n", bnode->bsn_name1, bnode->bsn_name2?bnode->bsn_name2:"");
+    BK_RETURN(B, -1);
+  }
+
+#ifdef BK_USING_PTHREADS
+  if (BK_FLAG_ISCLEAR(flags, BK_STATS_NO_LOCKS_NEEDED) && BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_lock(&bnode->bsn_lock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+
+  *usec = bsn_percentile(bnode, pct);
+
+#ifdef BK_USING_PTHREADS
+  if (BK_FLAG_ISCLEAR(flags, BK_STATS_NO_LOCKS_NEEDED) && BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_unlock(&bnode->bsn_lock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Add everything recorded in one performance interval to another (to
+ * combine per-thread nodes, say).  Histograms are merged bucket by bucket
+ * if both nodes keep them.  A sharded @a dst is added to without its lock.
+ *
+ * THREADS: MT-SAFE (assuming different dst)
+ * THREADS: THREAD-REENTRANT (Otherwise)
+ *
+ * @param B BAKA thread/global environment
+ * @param dst Node to add to
+ * @param src Node to add from (should not be changing)
+ * @param flags BK_STATS_NO_LOCKS_NEEDED
+ */
+void bk_stat_node_merge(bk_s B, struct bk_stat_node *dst, struct bk_stat_node *src, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  u_quad_t minutime, maxutime, sumutime, count, bucket;
+  u_int idx;
+
+  if (!dst || !src || dst == src)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_VRETURN(B);
+  }
+
+  bsn_totals(src, &minutime, &maxutime, &sumutime, &count);
+
+#ifdef BK_USING_PTHREADS
+  if (BK_FLAG_ISCLEAR(flags, BK_STATS_NO_LOCKS_NEEDED) && !dst->bsn_shards && BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_lock(&dst->bsn_lock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+
+  if (count)
+  {
+    if (dst->bsn_shards)
+    {
+      bss_add(bsn_shard(dst), count, sumutime, minutime, maxutime);
+    }
+    else
+    {
+      if (minutime < dst->bsn_minutime)
+	dst->bsn_minutime = minutime;
+
+      if (maxutime > dst->bsn_maxutime)
+	dst->bsn_maxutime = maxutime;
+
+      dst->bsn_sumutime += sumutime;
+      dst->bsn_count += count;
+    }
+
+    if (dst->bsn_hist && src->bsn_hist)
+    {
+      for (idx = 0; idx < BSH_BUCKETS; idx++)
+      {
+	if ((bucket = __atomic_load_n(&src->bsn_hist[idx], __ATOMIC_RELAXED)))
+	  __atomic_add_fetch(&dst->bsn_hist[idx], bucket, __ATOMIC_RELAXED);
+      }
+    }
+  }
+
+#ifdef BK_USING_PTHREADS
+  if (BK_FLAG_ISCLEAR(flags, BK_STATS_NO_LOCKS_NEEDED) && !dst->bsn_shards && BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_unlock(&dst->bsn_lock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+
+  BK_VRETURN(B);
+}
+
+
+
 /**
  * Add units to a performance interval, by name
  *
@@ -758,10 +1076,39 @@ void bk_stat_node_add(bk_s B, struct bk_stat_node *bnode, u_quad_t usec, bk_flag
   }
 
 #ifdef BK_USING_PTHREADS
-  if (BK_FLAG_ISCLEAR(flags, BK_STATS_NO_LOCKS_NEEDED) && BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_lock(&bnode->bsn_lock) != 0)
+  if (BK_FLAG_ISCLEAR(flags, BK_STATS_NO_LOCKS_NEEDED) && !bnode->bsn_shards && BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_lock(&bnode->bsn_lock) != 0)
     abort();
 #endif /* BK_USING_PTHREADS */
 
+  bsn_record(bnode, usec);
+
+#ifdef BK_USING_PTHREADS
+  if (BK_FLAG_ISCLEAR(flags, BK_STATS_NO_LOCKS_NEEDED) && !bnode->bsn_shards && BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_unlock(&bnode->bsn_lock) != 0)
+    abort();
+#endif /* BK_USING_PTHREADS */
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Record one interval in a node (which must be locked if need be, unless
+ * it is sharded)
+ *
+ * @param bnode Node to record in
+ * @param usec Length of the interval
+ */
+static void bsn_record(struct bk_stat_node *bnode, u_quad_t usec)
+{
+  if (bnode->bsn_shards)
+  {
+    bss_add(bsn_shard(bnode), 1, usec, usec, usec);
+    if (bnode->bsn_hist)
+      __atomic_add_fetch(&bnode->bsn_hist[bsh_index(usec)], 1, __ATOMIC_RELAXED);
+    return;
+  }
+
   if (usec < bnode->bsn_minutime)
     bnode->bsn_minutime = usec;
 
@@ -771,12 +1118,175 @@ void bk_stat_node_add(bk_s B, struct bk_stat_node *bnode, u_quad_t usec, bk_flag
   bnode->bsn_sumutime += usec;
   bnode->bsn_count++;
 
-#ifdef BK_USING_PTHREADS
-  if (BK_FLAG_ISCLEAR(flags, BK_STATS_NO_LOCKS_NEEDED) && BK_GENERAL_FLAG_ISTHREADON(B) && pthread_mutex_unlock(&bnode->bsn_lock) != 0)
-    abort();
-#endif /* BK_USING_PTHREADS */
+  if (bnode->bsn_hist)
+    bnode->bsn_hist[bsh_index(usec)]++;
+}
 
-  BK_VRETURN(B);
+
+
+/**
+ * Find the histogram bucket of a value
+ *
+ * @param usec Value
+ * @return <i>bucket index</i>
+ */
+static u_int bsh_index(u_quad_t usec)
+{
+  u_int msb;
+
+  if (usec < BSH_SUBCOUNT)
+    return(usec);
+
+  if (usec >> BSH_MAXBITS)
+    return(BSH_BUCKETS - 1);
+
+  msb = 63 - __builtin_clzll(usec);
+  return(((msb - BSH_SUBBITS + 1) << BSH_SUBBITS) + ((usec >> (msb - BSH_SUBBITS)) - BSH_SUBCOUNT));
+}
+
+
+
+/**
+ * Find the largest value a histogram bucket holds
+ *
+ * @param idx Bucket index
+ * @return <i>value</i>
+ */
+static u_quad_t bsh_value(u_int idx)
+{
+  u_int shift;
+
+  if (idx < BSH_SUBCOUNT)
+    return(idx);
+
+  shift = (idx >> BSH_SUBBITS) - 1;
+  return(((u_quad_t)(BSH_SUBCOUNT + (idx & (BSH_SUBCOUNT - 1)) + 1) << shift) - 1);
+}
+
+
+
+/**
+ * Compute a percentile from a node's histogram (which must be locked if
+ * need be, unless it is sharded).  The rank comes from the histogram
+ * itself, which a sharded node may be updating as we read.
+ *
+ * @param bnode Node with histogram
+ * @param pct Percentile (0-100)
+ * @return <i>value</i> at the percentile, 0 if nothing recorded
+ */
+static u_quad_t bsn_percentile(struct bk_stat_node *bnode, double pct)
+{
+  u_quad_t minutime, maxutime, sumutime, count;
+  u_quad_t hist[BSH_BUCKETS];
+  u_quad_t rank, seen = 0;
+  u_int idx;
+
+  if (!bnode->bsn_hist)
+    return(0);
+
+  bsn_totals(bnode, &minutime, &maxutime, &sumutime, &count);
+
+  for (count = 0, idx = 0; idx < BSH_BUCKETS; idx++)
+    count += (hist[idx] = __atomic_load_n(&bnode->bsn_hist[idx], __ATOMIC_RELAXED));
+
+  if (!count)
+    return(0);
+
+  // Smallest value with at least pct% of samples at or below it
+  rank = (u_quad_t)ceil(pct / 100.0 * count);
+  if (rank < 1)
+    rank = 1;
+
+  for (idx = 0; idx < BSH_BUCKETS - 1; idx++)
+  {
+    if ((seen += hist[idx]) >= rank)
+      return(BK_MAX(BK_MIN(bsh_value(idx), maxutime), BK_MIN(minutime, maxutime)));
+  }
+  return(maxutime);				// Last bucket has no upper bound
+}
+
+
+
+/**
+ * Find (assigning if need be) the calling thread's shard of a sharded node
+ *
+ * @param bnode Sharded node
+ * @return <i>shard</i>
+ */
+static struct bsn_shard *bsn_shard(struct bk_stat_node *bnode)
+{
+  if (!bsn_myshard)
+    bsn_myshard = __atomic_fetch_add(&bsn_nextshard, 1, __ATOMIC_RELAXED) % BSN_SHARDS + 1;
+
+  return(&bnode->bsn_shards[bsn_myshard - 1]);
+}
+
+
+
+/**
+ * Add intervals to a shard.  The shard is normally this thread's alone,
+ * but may be shared when there are more threads than shards, so the
+ * updates are atomic (and uncontended, hence cheap, in the usual case).
+ *
+ * @param bss Shard to add to
+ * @param count Number of intervals
+ * @param sumutime Their total length
+ * @param minutime The shortest of them
+ * @param maxutime The longest of them
+ */
+static void bss_add(struct bsn_shard *bss, u_quad_t count, u_quad_t sumutime, u_quad_t minutime, u_quad_t maxutime)
+{
+  u_quad_t cur;
+
+  __atomic_add_fetch(&bss->bss_sumutime, sumutime, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&bss->bss_count, count, __ATOMIC_RELAXED);
+
+  cur = __atomic_load_n(&bss->bss_minutime, __ATOMIC_RELAXED);
+  while (minutime < cur && !__atomic_compare_exchange_n(&bss->bss_minutime, &cur, minutime, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+
+  cur = __atomic_load_n(&bss->bss_maxutime, __ATOMIC_RELAXED);
+  while (maxutime > cur && !__atomic_compare_exchange_n(&bss->bss_maxutime, &cur, maxutime, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+
+
+/**
+ * Find a node's totals, summing the shards of a sharded node (which may
+ * be changing as we read, so the totals may be very slightly skewed)
+ *
+ * @param bnode Node
+ * @param minutime Copy-out minimum (UINT_MAX if nothing recorded)
+ * @param maxutime Copy-out maximum
+ * @param sumutime Copy-out sum
+ * @param count Copy-out count
+ */
+static void bsn_totals(struct bk_stat_node *bnode, u_quad_t *minutime, u_quad_t *maxutime, u_quad_t *sumutime, u_quad_t *count)
+{
+  struct bsn_shard *bss;
+  u_quad_t cur;
+
+  if (!bnode->bsn_shards)
+  {
+    *minutime = bnode->bsn_minutime;
+    *maxutime = bnode->bsn_maxutime;
+    *sumutime = bnode->bsn_sumutime;
+    *count = bnode->bsn_count;
+    return;
+  }
+
+  *minutime = UINT_MAX;
+  *maxutime = *sumutime = *count = 0;
+  for (bss = bnode->bsn_shards; bss < bnode->bsn_shards + BSN_SHARDS; bss++)
+  {
+    if ((cur = __atomic_load_n(&bss->bss_minutime, __ATOMIC_RELAXED)) < *minutime)
+      *minutime = cur;
+    if ((cur = __atomic_load_n(&bss->bss_maxutime, __ATOMIC_RELAXED)) > *maxutime)
+      *maxutime = cur;
+    *sumutime += __atomic_load_n(&bss->bss_sumutime, __ATOMIC_RELAXED);
+    *count += __atomic_load_n(&bss->bss_count, __ATOMIC_RELAXED);
+  }
 }
 
 
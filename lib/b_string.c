@@ -85,6 +85,7 @@ struct bk_str_registry_element
  */
 #define LIMITNOTREACHED	(!limit || (limit > 1 && limit--))
 
+static char **string_tokenize_split(bk_s B, struct bk_arena *arena, const char *src, u_int limit, const char *spliton, const char *braces, const dict_h kvht_vardb, const char **variabledb, bk_flags flags);
 static struct bk_str_registry_element *bsre_create(bk_s B, const char *str, bk_flags flags);
 static void bsre_destroy(bk_s B, struct bk_str_registry_element *bsre);
 
@@ -526,12 +527,70 @@ char *bk_string_printbuf(bk_s B, const char *intro, const char *prefix, const bk
  *	@return <br><i>null terminated array of token strings</i> on success.
  */
 char **bk_string_tokenize_split(bk_s B, const char *src, u_int limit, const char *spliton, const char *braces, const dict_h kvht_vardb, const char **variabledb, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  BK_RETURN(B, string_tokenize_split(B, NULL, src, limit, spliton, braces, kvht_vardb, variabledb, flags));
+}
+
+
+
+/**
+ * Tokenize a string as @a bk_string_tokenize_split does, but put the
+ * array and the token strings in an arena.  They go away when the arena
+ * is released or reset; do not call @a bk_string_tokenize_destroy on them.
+ *
+ * THREADS: MT-SAFE (as long as arena is thread-private)
+ *
+ *	@param B BAKA Thread/global state
+ *	@param arena Arena to allocate the results from
+ *	@param src Source string to tokenize
+ *	@param limit As for @a bk_string_tokenize_split
+ *	@param spliton As for @a bk_string_tokenize_split
+ *	@param braces As for @a bk_string_tokenize_split
+ *	@param kvht_vardb As for @a bk_string_tokenize_split
+ *	@param variabledb As for @a bk_string_tokenize_split
+ *	@param flags As for @a bk_string_tokenize_split
+ *	@return <i>NULL</i> on call failure, allocation failure, other failure
+ *	@return <br><i>null terminated array of token strings</i> on success.
+ */
+char **bk_string_tokenize_split_arena(bk_s B, struct bk_arena *arena, const char *src, u_int limit, const char *spliton, const char *braces, const dict_h kvht_vardb, const char **variabledb, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!arena)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid arguments\n");
+    BK_RETURN(B, NULL);
+  }
+
+  BK_RETURN(B, string_tokenize_split(B, arena, src, limit, spliton, braces, kvht_vardb, variabledb, flags));
+}
+
+
+
+/**
+ * Guts of @a bk_string_tokenize_split and @a bk_string_tokenize_split_arena.
+ *
+ *	@param B BAKA Thread/global state
+ *	@param arena Arena for the results (NULL for malloc)
+ *	@param src Source string to tokenize
+ *	@param limit Maximum number of tokens to generate
+ *	@param spliton Separator characters
+ *	@param braces Brace pairs
+ *	@param kvht_vardb Variable database
+ *	@param variabledb Environment-style variable database
+ *	@param flags Tokenization flags
+ *	@return <i>NULL</i> on call failure, allocation failure, other failure
+ *	@return <br><i>null terminated array of token strings</i> on success.
+ */
+static char **string_tokenize_split(bk_s B, struct bk_arena *arena, const char *src, u_int limit, const char *spliton, const char *braces, const dict_h kvht_vardb, const char **variabledb, bk_flags flags)
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
   char **ret;
   const char *curloc = src;
   int tmp;
-  u_int toklen, state = S_BASE;
+  u_int toklen, ntokens, state = S_BASE;
   const char *startseq = NULL;
   char *token;
   u_char newchar;
@@ -611,7 +670,7 @@ char **bk_string_tokenize_split(bk_s B, const char *src, u_int limit, const char
    */
   if (BK_FLAG_ISCLEAR(flags, BK_STRING_TOKENIZE_WANT_EMPTY_TOKEN) && (*src == '\0'))
   {
-    if (!(BK_MALLOC(ret)))
+    if (!(ret = arena ? bk_arena_alloc(B, arena, sizeof(*ret), 0) : malloc(sizeof(*ret))))
     {
       bk_error_printf(B, BK_ERR_ERR, "Could not allocate space for NULL string: %s\n", strerror(errno));
       goto error;
@@ -971,7 +1030,7 @@ char **bk_string_tokenize_split(bk_s B, const char *src, u_int limit, const char
 	}
 
 	/* Duplicate the token into the token slot */
-	if (!(*ret = strdup(token)))
+	if (!(*ret = arena ? bk_arena_strdup(B, arena, token) : strdup(token)))
 	{
 	  bk_error_printf(B, BK_ERR_ERR, "Could not duplicate token: %s\n", strerror(errno));
 	  goto error;
@@ -1159,12 +1218,27 @@ char **bk_string_tokenize_split(bk_s B, const char *src, u_int limit, const char
   *ret = NULL;					/* NULL terminated array */
 
   /* Get the first token slot */
-  if (!(ret = bk_memx_get(B, splitx, 0, NULL, 0)))
+  if (!(ret = bk_memx_get(B, splitx, 0, &ntokens, 0)))
   {
     bk_error_printf(B, BK_ERR_ERR, "Could not find array for return?!?\n");
     goto error;
   }
-  bk_memx_destroy(B, splitx, BK_MEMX_PRESERVE_ARRAY);
+
+  if (arena)
+  {
+    char **array;
+
+    if (!(array = bk_arena_alloc(B, arena, ntokens * sizeof(*array), 0)))
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not allocate token array from arena\n");
+      goto error;
+    }
+    memcpy(array, ret, ntokens * sizeof(*array));
+    ret = array;
+    bk_memx_destroy(B, splitx, 0);
+  }
+  else
+    bk_memx_destroy(B, splitx, BK_MEMX_PRESERVE_ARRAY);
   bk_memx_destroy(B, tokenx, 0);
   BK_RETURN(B, ret);
 
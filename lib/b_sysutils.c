@@ -81,3 +81,45 @@ char *bk_gethostname(bk_s B)
 
   BK_RETURN(B, hostname);
 }
+
+
+
+/**
+ * Find the size of the system's default huge page, for callers which must
+ * round hugetlb mappings.  The answer is cached after the first call.
+ *
+ * THREADS: MT-SAFE
+ *
+ *	@param B BAKA thread/global state.
+ *	@return <i>0</i> if huge pages are not known to be supported.<br>
+ *	@return <br><i>huge page size in bytes</i> on success.
+ */
+size_t bk_hugepagesize(bk_s B)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+  static size_t hugepagesize = 0;
+  FILE *fp;
+  char line[128];
+  u_long kbytes;
+
+  if (hugepagesize)
+    BK_RETURN(B, hugepagesize);
+
+  if (!(fp = fopen("/proc/meminfo", "r")))
+  {
+    bk_error_printf(B, BK_ERR_NOTICE, "Could not open /proc/meminfo to find huge page size: %s\n", strerror(errno));
+    BK_RETURN(B, 0);
+  }
+
+  while (fgets(line, sizeof(line), fp))
+  {
+    if (sscanf(line, "Hugepagesize: %lu kB", &kbytes) == 1)
+    {
+      hugepagesize = kbytes * 1024;
+      break;
+    }
+  }
+  fclose(fp);
+
+  BK_RETURN(B, hugepagesize);
+}
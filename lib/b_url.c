@@ -26,7 +26,13 @@ static const char libbk__contact[] = "<projectbaka@baka.org>";
 #define PARAM_DELIM ';'
 
 
-#define STORE_URL_ELEMENT(B, mode, element, start, end)			  \
+
+static struct bk_url *url_parse(bk_s B, struct bk_arena *arena, const char *url, bk_url_parse_mode_e mode, bk_flags flags);
+static struct bk_url *url_create(bk_s B, struct bk_arena *arena);
+static char *url_strndup(bk_s B, struct bk_arena *arena, const char *str, size_t len);
+
+
+#define STORE_URL_ELEMENT(B, arena, mode, element, start, end)		  \
 do {									  \
   switch(mode)								  \
   {									  \
@@ -41,7 +47,7 @@ do {									  \
   case BkUrlParseStrEmpty:						  \
     if (!(start))							  \
     {									  \
-      if (!((element).bue_str = strdup("")))				  \
+      if (!((element).bue_str = url_strndup((B), (arena), "", 0)))	  \
       {									  \
 	bk_error_printf(B, BK_ERR_ERR,					  \
 			"Could not strdup an element of url: %s\n",	  \
@@ -53,7 +59,7 @@ do {									  \
   case BkUrlParseStrNULL:						  \
     if (start)								  \
     {									  \
-      if (!((element).bue_str = bk_strndup((B), (start), (end)-(start)))) \
+      if (!((element).bue_str = url_strndup((B), (arena), (start), (end)-(start)))) \
       {									  \
 	bk_error_printf(B, BK_ERR_ERR,					  \
 			"Could not strdup an element of url: %s\n",	  \
@@ -72,7 +78,8 @@ do {									  \
 
 #define FREE_URL_ELEMENT(bu, element)		\
 {						\
-  if (!BK_URL_IS_VPTR(bu))			\
+  if (!BK_URL_IS_VPTR(bu) &&			\
+      BK_FLAG_ISCLEAR((bu)->bu_flags, BK_URL_FLAG_ARENA)) \
   {						\
     free(BK_URL_DATA((bu),(element)));		\
   }						\
@@ -126,6 +133,58 @@ do {									  \
  */
 struct bk_url *
 bk_url_parse(bk_s B, const char *url, bk_url_parse_mode_e mode, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  BK_RETURN(B, url_parse(B, NULL, url, mode, flags));
+}
+
+
+
+/**
+ * Parse a url as @a bk_url_parse does, but take the structure and all
+ * copied strings from an arena.  The result goes away when the arena is
+ * released or reset; @a bk_url_destroy on it is harmless and does nothing.
+ *
+ * THREADS: MT-SAFE (as long as arena is thread-private)
+ *
+ *	@param B BAKA thread/global state.
+ *	@param arena Arena to allocate from.
+ *	@param url Url to parse.
+ *	@param mode The mode of parsing.
+ *	@param flags Flags as for @a bk_url_parse.
+ *	@return <i>NULL</i> on failure (partial allocations stay in the arena).<br>
+ *	@return a new @a bk_url on success.
+ */
+struct bk_url *
+bk_url_parse_arena(bk_s B, struct bk_arena *arena, const char *url, bk_url_parse_mode_e mode, bk_flags flags)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  if (!arena)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Illegal arguments\n");
+    BK_RETURN(B, NULL);
+  }
+
+  BK_RETURN(B, url_parse(B, arena, url, mode, flags));
+}
+
+
+
+/**
+ * Guts of @a bk_url_parse and @a bk_url_parse_arena.
+ *
+ *	@param B BAKA thread/global state.
+ *	@param arena Arena to allocate from (NULL for malloc).
+ *	@param url Url to parse.
+ *	@param mode The mode of parsing.
+ *	@param flags Flags for the future.
+ *	@return <i>NULL</i> on failure.<br>
+ *	@return a new @a bk_url on success.
+ */
+static struct bk_url *
+url_parse(bk_s B, struct bk_arena *arena, const char *url, bk_url_parse_mode_e mode, bk_flags flags)
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
   struct bk_url *bu = NULL;
@@ -144,7 +203,7 @@ bk_url_parse(bk_s B, const char *url, bk_url_parse_mode_e mode, bk_flags flags)
     BK_RETURN(B, NULL);
   }
 
-  if (!(bu = bk_url_create(B)))
+  if (!(bu = url_create(B, arena)))
   {
     bk_error_printf(B, BK_ERR_ERR, "could not create url struct\n");
     goto error;
@@ -271,7 +330,7 @@ bk_url_parse(bk_s B, const char *url, bk_url_parse_mode_e mode, bk_flags flags)
   }
   else
   {
-    if (!(bu->bu_url = strdup(url)))
+    if (!(bu->bu_url = url_strndup(B, arena, url, url_end - url)))
     {
       bk_error_printf(B, BK_ERR_ERR, "Could not strdup url: %s\n", strerror(errno));
       goto error;
@@ -280,11 +339,11 @@ bk_url_parse(bk_s B, const char *url, bk_url_parse_mode_e mode, bk_flags flags)
 
   // Save all the data.
   // <WARNING> odious "goto error" hidden in this macro </WARNING>
-  STORE_URL_ELEMENT(B, mode, bu->bu_scheme, scheme, scheme_end);
-  STORE_URL_ELEMENT(B, mode, bu->bu_authority, authority, authority_end);
-  STORE_URL_ELEMENT(B, mode, bu->bu_path, path, path_end);
-  STORE_URL_ELEMENT(B, mode, bu->bu_query, query, query_end);
-  STORE_URL_ELEMENT(B, mode, bu->bu_fragment, fragment, fragment_end);
+  STORE_URL_ELEMENT(B, arena, mode, bu->bu_scheme, scheme, scheme_end);
+  STORE_URL_ELEMENT(B, arena, mode, bu->bu_authority, authority, authority_end);
+  STORE_URL_ELEMENT(B, arena, mode, bu->bu_path, path, path_end);
+  STORE_URL_ELEMENT(B, arena, mode, bu->bu_query, query, query_end);
+  STORE_URL_ELEMENT(B, arena, mode, bu->bu_fragment, fragment, fragment_end);
 
 
   if (BK_FLAG_ISCLEAR(flags, BK_URL_FLAG_STRICT_PARSE))
@@ -328,14 +387,14 @@ bk_url_parse(bk_s B, const char *url, bk_url_parse_mode_e mode, bk_flags flags)
 	 * strdup'ed to "" even if unset.
 	 */
 	FREE_URL_ELEMENT(bu, bu->bu_authority);
-	STORE_URL_ELEMENT(B, mode, bu->bu_authority, authority, authority_end);
+	STORE_URL_ELEMENT(B, arena, mode, bu->bu_authority, authority, authority_end);
 	BK_FLAG_SET(bu->bu_flags, BK_URL_FLAG_AUTHORITY);
 
 	BK_FLAG_CLEAR(bu->bu_flags, BK_URL_FLAG_PATH);
 
 	if (authority_end != path_end)
 	{
-	  STORE_URL_ELEMENT(B, mode, bu->bu_path, authority_end, path_end);
+	  STORE_URL_ELEMENT(B, arena, mode, bu->bu_path, authority_end, path_end);
 	  BK_FLAG_SET(bu->bu_flags, BK_URL_FLAG_PATH);
 	  FREE_URL_ELEMENT(bu, hold);
 	}
@@ -399,14 +458,14 @@ bk_url_parse(bk_s B, const char *url, bk_url_parse_mode_e mode, bk_flags flags)
       BK_FLAG_SET(bu->bu_flags, BK_URL_FLAG_HOST);
     }
 
-    STORE_URL_ELEMENT(B, mode, bu->bu_host, host, host_end);
-    STORE_URL_ELEMENT(B, mode, bu->bu_serv, serv, serv_end);
+    STORE_URL_ELEMENT(B, arena, mode, bu->bu_host, host, host_end);
+    STORE_URL_ELEMENT(B, arena, mode, bu->bu_serv, serv, serv_end);
   }
 
   BK_RETURN(B,bu);
 
  error:
-  if (bu) bk_url_destroy(B, bu);
+  if (bu && !arena) bk_url_destroy(B, bu);
   BK_RETURN(B,NULL);
 }
 
@@ -423,11 +482,38 @@ bk_url_parse(bk_s B, const char *url, bk_url_parse_mode_e mode, bk_flags flags)
  */
 struct bk_url *
 bk_url_create(bk_s B)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
+
+  BK_RETURN(B, url_create(B, NULL));
+}
+
+
+
+/**
+ * Create a clean url structure, from an arena if one is given.
+ *
+ *	@param B BAKA thread/global state.
+ *	@param arena Arena to allocate from (NULL for malloc).
+ *	@return <i>NULL</i> on failure.<br>
+ *	@return a new @a bk_url on success.
+ */
+static struct bk_url *
+url_create(bk_s B, struct bk_arena *arena)
 {
   BK_ENTRY(B, __FUNCTION__, __FILE__, "libbk");
   struct bk_url *bu = NULL;
 
-  if (!(BK_CALLOC(bu)))
+  if (arena)
+  {
+    if (!(bu = bk_arena_alloc(B, arena, sizeof(*bu), BK_ARENA_ZERO)))
+    {
+      bk_error_printf(B, BK_ERR_ERR, "could not allocate bk_url from arena\n");
+      BK_RETURN(B,NULL);
+    }
+    BK_FLAG_SET(bu->bu_flags, BK_URL_FLAG_ARENA);
+  }
+  else if (!(BK_CALLOC(bu)))
   {
     bk_error_printf(B, BK_ERR_ERR, "could not allocate bk_url: %s\n", strerror(errno));
     BK_RETURN(B,NULL);
@@ -438,6 +524,26 @@ bk_url_create(bk_s B)
 
 
 
+/**
+ * Copy (part of) a string for a url element, from an arena if one is given.
+ *
+ *	@param B BAKA thread/global state.
+ *	@param arena Arena to allocate from (NULL for malloc).
+ *	@param str String to copy.
+ *	@param len Most bytes to copy.
+ *	@return <i>NULL</i> on failure.<br>
+ *	@return <i>copy</i> on success.
+ */
+static char *
+url_strndup(bk_s B, struct bk_arena *arena, const char *str, size_t len)
+{
+  if (arena)
+    return(bk_arena_strndup(B, arena, str, len));
+  return(bk_strndup(B, str, len));
+}
+
+
+
 /**
  * Destroy a @a bk_url completely.
  *
@@ -457,6 +563,10 @@ bk_url_destroy(bk_s B, struct bk_url *bu)
     BK_VRETURN(B);
   }
 
+  // The arena owns everything
+  if (BK_FLAG_ISSET(bu->bu_flags, BK_URL_FLAG_ARENA))
+    BK_VRETURN(B);
+
   if (bu->bu_mode != BkUrlParseVptr && bu->bu_url)
     free(bu->bu_url);
 
@@ -0,0 +1,333 @@
+#if !defined(lint)
+static const char libbk__copyright[] = "Copyright © 2011";
+static const char libbk__contact[] = "<projectbaka@baka.org>";
+#endif /* not lint */
+/*
+ * ++Copyright BAKA++
+ *
+ * Copyright © 2011 The Authors. All rights reserved.
+ *
+ * This source code is licensed to you under the terms of the file
+ * LICENSE.TXT in this release for further details.
+ *
+ * Send e-mail to <projectbaka@baka.org> for further information.
+ *
+ * - -Copyright BAKA- -
+ */
+
+/**
+ * @file
+ *
+ * Print dynamic statistics exported to shared memory by another process
+ * (see bk_dynamic_stats_export_create()), without involving that process.
+ */
+#include <libbk.h>
+#include <libbk_i18n.h>
+
+
+#define STD_LOCALEDIR_KEY     "LOCALEDIR"	///< Key in bkconfig to find the locale translation files
+#define STD_LOCALEDIR_ENV     "BAKA_HOME"	///< Key in Environment to find base of locale directory
+#define STD_LOCALEDIR_DEF     "/usr/local/baka"	///< Default base of where locale directory might be found
+#define STD_LOCALEDIR_SUB     "locale"		///< Sub-component from install base where locale might be found
+#define ERRORQUEUE_DEPTH      32		///< Default error queue depth
+
+
+
+/**
+ * Information of international importance to everyone
+ * which cannot be passed around.
+ */
+struct global_structure
+{
+} Global;
+
+
+
+/**
+ * Information about basic program runtime configuration
+ * which must be passed around.
+ */
+struct program_config
+{
+  char		       *pc_shmname;		///< Shared memory name
+  int			pc_interval;		///< Milliseconds between repeated prints
+  int			pc_count;		///< Number of prints (0 == forever when repeating)
+  bk_flags		pc_flags;		///< Flags are fun!
+#define PC_VERBOSE	0x001			///< Verbose output
+#define PC_CHANGED	0x002			///< Only print new snapshots
+};
+
+
+
+static int print_snapshot(bk_s B, struct program_config *pc, struct bk_dynamic_stats_export *bdse, u_int64_t *lastversionp);
+
+
+
+/**
+ * Program entry point
+ *
+ *	@param argc Number of argv elements
+ *	@param argv Program name and arguments
+ *	@param envp Program environment
+ *	@return <i>0</i> Success
+ *	@return <br><i>1</i> Could not read statistics
+ *	@return <br><i>254</i> Initialization failed
+ */
+int
+main(int argc, char **argv, char **envp)
+{
+  bk_s B = NULL;				/* Baka general structure */
+  BK_ENTRY_MAIN(B, __FUNCTION__, __FILE__, "SIMPLE");
+  int c;
+  int getopterr = 0;
+  int debug_level = 0;
+  char i18n_localepath[_POSIX_PATH_MAX];
+  char *i18n_locale;
+  struct program_config Pconfig, *pc = NULL;
+  struct bk_dynamic_stats_export *bdse;
+  u_int64_t lastversion = 0;
+  int printed;
+  poptContext optCon = NULL;
+  struct poptOption optionsTable[] =
+  {
+    {"debug", 'd', POPT_ARG_NONE, NULL, 'd', N_("Turn on debugging"), NULL },
+    {"verbose", 'v', POPT_ARG_NONE, NULL, 'v', N_("Turn on verbose message"), NULL },
+    {"no-seatbelts", 0, POPT_ARG_NONE, NULL, 0x1000, N_("Sealtbelts off & speed up"), NULL },
+    {"seatbelts", 0, POPT_ARG_NONE, NULL, 0x1001, N_("Enable function tracing"), NULL },
+    {"profiling", 0, POPT_ARG_STRING, NULL, 0x1002, N_("Enable and write profiling data"), N_("filename") },
+
+    {"name", 'n', POPT_ARG_STRING, &Pconfig.pc_shmname, 0, N_("Shared memory to read statistics from"), N_("shm name") },
+    {"interval", 'i', POPT_ARG_INT, &Pconfig.pc_interval, 0, N_("Reprint every interval milliseconds"), N_("msecs") },
+    {"count", 'c', POPT_ARG_INT, &Pconfig.pc_count, 0, N_("Number of times to print (with --interval)"), N_("count") },
+    {"changed", 'C', POPT_ARG_NONE, NULL, 'C', N_("Only reprint when the statistics were republished"), NULL },
+    POPT_AUTOHELP
+    POPT_TABLEEND
+  };
+
+  if (!(B=bk_general_init(argc, &argv, &envp, BK_ENV_GWD(NULL, "BK_ENV_CONF_APP", BK_APP_CONF), NULL, ERRORQUEUE_DEPTH, LOG_LOCAL0, 0)))
+  {
+    fprintf(stderr,"Could not perform basic initialization\n");
+    exit(254);
+  }
+  bk_fun_reentry(B);
+
+  // Enable error output
+  bk_error_config(B, BK_GENERAL_ERROR(B), ERRORQUEUE_DEPTH, stderr, BK_ERR_ERR,
+		  BK_ERR_ERR, BK_ERROR_CONFIG_FH |
+		  BK_ERROR_CONFIG_SYSLOGTHRESHOLD | BK_ERROR_CONFIG_HILO_PIVOT);
+
+  // i18n stuff
+  setlocale(LC_ALL, "");
+  if (!(i18n_locale = BK_GWD(B, STD_LOCALEDIR_KEY, NULL)))
+  {
+    i18n_locale = i18n_localepath;
+    snprintf(i18n_localepath, sizeof(i18n_localepath), "%s/%s", BK_ENV_GWD(B, STD_LOCALEDIR_ENV,STD_LOCALEDIR_DEF), STD_LOCALEDIR_SUB);
+  }
+  bindtextdomain(BK_GENERAL_PROGRAM(B), i18n_locale);
+  textdomain(BK_GENERAL_PROGRAM(B));
+  for (c = 0; optionsTable[c].longName || optionsTable[c].shortName; c++)
+  {
+    if (optionsTable[c].descrip) (*((char **)&(optionsTable[c].descrip)))=_(optionsTable[c].descrip);
+    if (optionsTable[c].argDescrip) (*((char **)&(optionsTable[c].argDescrip)))=_(optionsTable[c].argDescrip);
+  }
+
+  pc = &Pconfig;
+  memset(pc, 0, sizeof(*pc));
+
+  if (!(optCon = poptGetContext(NULL, argc, (const char **)argv, optionsTable, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not initialize options processing\n");
+    bk_exit(B, 254);
+  }
+
+  while ((c = poptGetNextOpt(optCon)) >= 0)
+  {
+    switch (c)
+    {
+    case 'd':					// debug
+      if (!debug_level)
+      {
+	// Set up debugging, from config file
+	bk_general_debug_config(B, stderr, BK_ERR_NONE, 0);
+	bk_debug_printf(B, "Debugging on\n");
+	debug_level++;
+      }
+      else if (debug_level == 1)
+      {
+	/*
+	 * Enable output of error and higher error logs (this can be
+	 * annoying so require -dd)
+	 */
+	bk_error_config(B, BK_GENERAL_ERROR(B), 0, stderr, BK_ERR_NONE, BK_ERR_ERR, BK_ERROR_CONFIG_FH | BK_ERROR_CONFIG_HILO_PIVOT | BK_ERROR_CONFIG_SYSLOGTHRESHOLD);
+	bk_debug_printf(B, "Extra debugging on\n");
+	debug_level++;
+      }
+      else if (debug_level == 2)
+      {
+	/*
+	 * Enable output of all levels of bk_error logs (this can be
+	 * very annoying so require -ddd)
+	 */
+	bk_error_config(B, BK_GENERAL_ERROR(B), 0, stderr, BK_ERR_NONE, BK_ERR_DEBUG, BK_ERROR_CONFIG_FH | BK_ERROR_CONFIG_HILO_PIVOT | BK_ERROR_CONFIG_SYSLOGTHRESHOLD);
+	bk_debug_printf(B, "Super-extra debugging on\n");
+	debug_level++;
+      }
+      break;
+    case 'v':					// verbose
+      BK_FLAG_SET(pc->pc_flags, PC_VERBOSE);
+      bk_error_config(B, BK_GENERAL_ERROR(B), ERRORQUEUE_DEPTH, stderr, BK_ERR_NONE, BK_ERR_ERR, 0);
+      break;
+    case 0x1000:				// no-seatbelts
+      BK_FLAG_CLEAR(BK_GENERAL_FLAGS(B), BK_BGFLAGS_FUNON);
+      break;
+    case 0x1001:				// seatbelts
+      BK_FLAG_SET(BK_GENERAL_FLAGS(B), BK_BGFLAGS_FUNON);
+      break;
+    case 0x1002:				// profiling
+      bk_general_funstat_init(B, (char *)poptGetOptArg(optCon), 0);
+      break;
+    default:
+      getopterr++;
+      break;
+
+    case 'C':					// changed
+      BK_FLAG_SET(pc->pc_flags, PC_CHANGED);
+      break;
+    }
+  }
+
+  /*
+   * Reprocess so that argc and argv contain the remaining command
+   * line arguments (note argv[0] is an argument, not the program
+   * name).  argc remains the number of elements in the argv array.
+   */
+  argv = (char **)poptGetArgs(optCon);
+  argc = 0;
+  if (argv)
+    for (; argv[argc]; argc++)
+      ; // Void
+
+  if (c < -1 || getopterr || pc->pc_interval < 0 || pc->pc_count < 0)
+  {
+    if (c < -1)
+    {
+      fprintf(stderr, "%s\n", poptStrerror(c));
+    }
+    poptPrintUsage(optCon, stderr, 0);
+    bk_exit(B, 254);
+  }
+
+  if (!pc->pc_shmname)
+  {
+    fprintf(stderr,"--name option is required\n");
+    poptPrintUsage(optCon, stderr, 0);
+    bk_exit(B, 254);
+  }
+
+  if (!(bdse = bk_dynamic_stats_export_attach(B, pc->pc_shmname, 0)))
+  {
+    fprintf(stderr,"Could not attach to exported statistics %s: %s\n", pc->pc_shmname, strerror(errno));
+    bk_exit(B, 1);
+  }
+
+  if (!pc->pc_interval)
+    pc->pc_count = 1;
+
+  for (printed = 0; !pc->pc_count || printed < pc->pc_count; )
+  {
+    switch (print_snapshot(B, pc, bdse, &lastversion))
+    {
+    case 1:
+      printed++;
+      break;
+    case 0:
+      break;
+    default:
+      bk_dynamic_stats_export_destroy(B, bdse, 0);
+      bk_exit(B, 1);
+    }
+
+    if (pc->pc_interval && (!pc->pc_count || printed < pc->pc_count))
+      usleep(pc->pc_interval * 1000);
+  }
+
+  bk_dynamic_stats_export_destroy(B, bdse, 0);
+  poptFreeContext(optCon);
+  bk_exit(B, 0);
+  return(255);					// Stupid INSIGHT stuff.
+}
+
+
+
+/**
+ * Print one snapshot of the exported statistics
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@param bdse Attached statistics
+ *	@param lastversionp Copy-in/out version last printed
+ *	@return <i>-1</i> Failure
+ *	@return <br><i>0</i> Nothing new to print
+ *	@return <br><i>1</i> Printed
+ */
+static int
+print_snapshot(bk_s B, struct program_config *pc, struct bk_dynamic_stats_export *bdse, u_int64_t *lastversionp)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "SIMPLE");
+  struct bk_dynamic_stats_export_snapshot *snapshot;
+  struct bk_dynamic_stats_export_record *rec;
+  u_int64_t version, agems;
+  u_int cnt;
+
+  if (!(snapshot = bk_dynamic_stats_export_read(B, bdse, &version, &agems, 0)))
+  {
+    fprintf(stderr,"Could not read exported statistics %s: %s\n", pc->pc_shmname, strerror(errno));
+    BK_RETURN(B, -1);
+  }
+
+  if (BK_FLAG_ISSET(pc->pc_flags, PC_CHANGED) && *lastversionp && version == *lastversionp)
+    BK_RETURN(B, 0);
+  *lastversionp = version;
+
+  if (BK_FLAG_ISSET(pc->pc_flags, PC_VERBOSE))
+    printf("# pid %lld version %llu age %llums stats %u truncated %u\n", (long long)bk_dynamic_stats_export_pid(B, bdse),
+	   (unsigned long long)version, (unsigned long long)agems, snapshot->bdses_count, snapshot->bdses_truncated);
+
+  for (cnt = 0, rec = BK_DYNAMIC_STATS_EXPORT_FIRST(snapshot); cnt < snapshot->bdses_count; cnt++, rec = BK_DYNAMIC_STATS_EXPORT_NEXT(rec))
+  {
+    if (rec->bdser_discriminator)
+      printf("%s[%lld] ", rec->bdser_name, (long long)rec->bdser_discriminator);
+    else
+      printf("%s ", rec->bdser_name);
+
+    switch (rec->bdser_type)
+    {
+    case DynamicStatsValueTypeInt32:
+    case DynamicStatsValueTypeInt64:
+    case DynamicStatsValueTypeRate:
+    case DynamicStatsValueTypeWindow:
+    case DynamicStatsValueTypeCardinality:
+    case DynamicStatsValueTypeTopK:
+    case DynamicStatsValueTypeQuantile:
+      printf("%lld\n", (long long)rec->bdser_value.bdserv_int);
+      break;
+    case DynamicStatsValueTypeUInt32:
+    case DynamicStatsValueTypeUInt64:
+      printf("%llu\n", (unsigned long long)rec->bdser_value.bdserv_uint);
+      break;
+    case DynamicStatsValueTypeFloat:
+    case DynamicStatsValueTypeDouble:
+      printf("%.4f\n", rec->bdser_value.bdserv_double);
+      break;
+    case DynamicStatsValueTypeString:
+      printf("%s\n", BK_DYNAMIC_STATS_EXPORT_STRING(rec));
+      break;
+    default:
+      printf("<unknown type %u>\n", rec->bdser_type);
+      break;
+    }
+  }
+  fflush(stdout);
+
+  BK_RETURN(B, 1);
+}
@@ -29,6 +29,7 @@ static const char libbk__contact[] = "<projectbaka@baka.org>";
 #define STD_LOCALEDIR_DEF     "/usr/local/baka"	///< Default base of where locale directory might be found
 #define STD_LOCALEDIR_SUB     "locale"		///< Sub-component from install base where locale might be found
 #define ERRORQUEUE_DEPTH      32		///< Default error queue depth
+#define MAXREADERINFO         64		///< Most broadcast readers to describe
 
 
 
@@ -254,6 +255,8 @@ static int progrun(bk_s B, struct program_config *pc)
   size_t bytesreadable, byteswritable, segsize;
   int numothers;
   int ret;
+  struct bk_shmipc_readerinfo readers[MAXREADERINFO];
+  int numreaders, cnt;
 
   if (!pc)
   {
@@ -286,10 +289,11 @@ static int progrun(bk_s B, struct program_config *pc)
     printf("%40s: %x\n", "Magic number", (int)magic);
     if (BK_FLAG_ISSET(pc->pc_flags, PC_VERBOSE))
     {
-      printf("%40s: %x\n", "Magic number (SYN)", 0xfeedface);
-      printf("%40s: %x\n", "Magic number (SYN-ACK)", 0xfacefedd);
-      printf("%40s: %x\n", "Magic number (CONNECTED)", 0xabadcafe);
-      printf("%40s: %x\n", "Magic number (RST)", 0xdeadbeef);
+      printf("%40s: %x\n", "Magic number (SYN)", 0xfeedfac2);
+      printf("%40s: %x\n", "Magic number (SYN-ACK)", 0xfacefed2);
+      printf("%40s: %x\n", "Magic number (CONNECTED)", 0xabadcaf2);
+      printf("%40s: %x\n", "Magic number (RST)", 0xdeadbee2);
+      printf("%40s: %x %x %x %x\n", "Old layout magic (SYN/SYN-ACK/CONN/RST)", 0xfeedface, 0xfacefedd, 0xabadcafe, 0xdeadbeef);
     }
     printf("%40s: %u\n", "Generation", (u_int)generation);
     printf("%40s: %d\n", "Ring size", (int)ringsize);
@@ -298,6 +302,15 @@ static int progrun(bk_s B, struct program_config *pc)
     printf("%40s: %d\n", "Read hand", (int)readhand);
     printf("%40s: %d\n", "Bytes readable", (int)bytesreadable);
     printf("%40s: %d\n", "Bytes writable", (int)byteswritable);
+
+    if ((numreaders = bk_shmipc_readersbyname(B, pc->pc_filename, readers, MAXREADERINFO, 0)) >= 0)
+    {
+      printf("%40s: %d\n", "Broadcast readers", numreaders);
+      for (cnt = 0; cnt < MIN(numreaders, MAXREADERINFO); cnt++)
+      {
+	printf("%34s %5u: pid %d, lag %llu bytes, %llu overruns, %llu bytes lost\n", "Reader slot", readers[cnt].bsri_slot, (int)readers[cnt].bsri_pid, (unsigned long long)readers[cnt].bsri_lag, (unsigned long long)readers[cnt].bsri_overruns, (unsigned long long)readers[cnt].bsri_lostbytes);
+      }
+    }
   }
 
   BK_RETURN(B, 0);
@@ -58,10 +58,12 @@ struct program_config
   u_int			pc_length;		///< Length of shared memory
   u_int			pc_size;		///< Size of I/O buffers
   u_int			pc_sourcebufs;		///< Number of source buffers to generate
+  u_int			pc_maxreaders;		///< Broadcast reader slots (writer only, 0 for point-to-point)
   bk_flags		pc_flags;		///< Flags are fun!
 #define PC_VERBOSE	0x001			///< Verbose output
 #define PC_RDONLY	0x002			///< Read activity
 #define PC_SINK		0x004			///< Discard data from write side (reader only)
+#define PC_OVERWRITE	0x008			///< Broadcast writer overwrites slow readers
 };
 
 
@@ -102,6 +104,8 @@ main(int argc, char **argv, char **envp)
 
     {"source", 0, POPT_ARG_INT, NULL, 0x100, N_("Source fake data to remote side"), N_("number of i/o buffers") },
     {"sink", 0, POPT_ARG_NONE, NULL, 0x101, N_("Sink/discard data from remote side"), NULL },
+    {"broadcast", 0, POPT_ARG_INT, NULL, 0x102, N_("Broadcast to many readers (write side)"), N_("maximum readers") },
+    {"overwrite", 0, POPT_ARG_NONE, NULL, 0x103, N_("Overwrite slow broadcast readers instead of blocking"), NULL },
     {"write", 'w', POPT_ARG_NONE, NULL, 'w', N_("Write side of cat (otherwise is read side)"), NULL },
     {"rendezvous", 'r', POPT_ARG_STRING, NULL, 'r', N_("Shared memory rendezvous name"), N_("name") },
     {"timeout", 't', POPT_ARG_INT, NULL, 't', N_("Timeout"), N_("microseconds") },
@@ -206,6 +210,12 @@ main(int argc, char **argv, char **envp)
     case 0x101:					// sink
       BK_FLAG_SET(pc->pc_flags, PC_SINK);
       break;
+    case 0x102:					// broadcast
+      pc->pc_maxreaders = bk_string_demagnify(B, poptGetOptArg(optCon), 0);
+      break;
+    case 0x103:					// overwrite
+      BK_FLAG_SET(pc->pc_flags, PC_OVERWRITE);
+      break;
     case 'w':					// write-side
       BK_FLAG_CLEAR(pc->pc_flags, PC_RDONLY);
       break;
@@ -283,7 +293,12 @@ static int proginit(bk_s B, struct program_config *pc)
     BK_RETURN(B, -1);
   }
 
-  if (!(pc->pc_bsi = bk_shmipc_create(B, pc->pc_filename, pc->pc_timeout, pc->pc_timeout, pc->pc_poll, pc->pc_length, 0700, NULL, BK_FLAG_ISSET(pc->pc_flags, PC_RDONLY)?BK_SHMIPC_RDONLY:BK_SHMIPC_WRONLY)))
+  if (pc->pc_maxreaders && BK_FLAG_ISCLEAR(pc->pc_flags, PC_RDONLY))
+    pc->pc_bsi = bk_shmipc_broadcast_create(B, pc->pc_filename, pc->pc_timeout, pc->pc_timeout, pc->pc_poll, pc->pc_length, pc->pc_maxreaders, 0700, NULL, BK_FLAG_ISSET(pc->pc_flags, PC_OVERWRITE)?BK_SHMIPC_OVERWRITE:0);
+  else
+    pc->pc_bsi = bk_shmipc_create(B, pc->pc_filename, pc->pc_timeout, pc->pc_timeout, pc->pc_poll, pc->pc_length, 0700, NULL, BK_FLAG_ISSET(pc->pc_flags, PC_RDONLY)?BK_SHMIPC_RDONLY:BK_SHMIPC_WRONLY);
+
+  if (!pc->pc_bsi)
   {
     bk_error_printf(B, BK_ERR_ERR, "Could not attach to shared memory IPC\n");
     BK_RETURN(B, -1);
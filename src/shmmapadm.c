@@ -261,12 +261,16 @@ main(int argc, char **argv, char **envp)
     exit(2);
   }
 
+  // Heartbeat first, so a beat stored after we read the clock cannot wrap
+  u_int64_t beatms = __atomic_load_n(&sm_addr->sh_beatms, __ATOMIC_ACQUIRE);
+  u_int64_t nowms = bk_shmmap_nowms();
+
   printf("%20s %p\n","Address",sm_addr->sh_addr);
   printf("%20s %p\n","User Address",sm_addr->sh_user);
   printf("%20s %lld\n","Segment size",(long long)sm_addr->sh_size);
   printf("%20s %lld\n","User size",(long long)sm_addr->sh_usersize);
-  printf("%20s %lld (%lld seconds old) %s","Creatortime",(long long)sm_addr->sh_creatortime, (long long)(time(NULL)-sm_addr->sh_creatortime),ctime(&sm_addr->sh_creatortime));
-  printf("%20s %u %s\n","Fresh interval",sm_addr->sh_fresh, sm_addr->sh_creatortime+sm_addr->sh_fresh > time(NULL)?"ISFRESH":"NOTFRESH");
+  printf("%20s %llu (%llu ms old)\n","Heartbeat",(unsigned long long)sm_addr->sh_heartbeat, (unsigned long long)(nowms > beatms?nowms-beatms:0));
+  printf("%20s %u %s\n","Fresh interval",sm_addr->sh_fresh, beatms + sm_addr->sh_fresh*1000ULL > nowms?"ISFRESH":"NOTFRESH");
   printf("%20s %u\n","Num Client Slots",sm_addr->sh_numclients);
   printf("%20s %u\n","Num Attaches",sm_addr->sh_numattach);
   printf("%20s %04x %s\n","State",sm_addr->sh_state,sm_addr->sh_state==BK_SHMMAP_READY?"READY":sm_addr->sh_state==BK_SHMMAP_CLOSE?"CLOSE":"UNINITIALIZED");
@@ -300,6 +304,7 @@ main(int argc, char **argv, char **envp)
       case BK_SHMMAP_USER_STATEINIT: state = "INIT "; break;
       case BK_SHMMAP_USER_STATEREADY: state = "READY"; break;
       case BK_SHMMAP_USER_STATECLOSE: state = "CLOSE"; break;
+      case BK_SHMMAP_USER_STATERECLAIM: state = "RECLM"; break;
       default: state="OTHER";
       }
 
@@ -19,10 +19,19 @@ static const char libbk__contact[] = "<projectbaka@baka.org>";
  * @file
  *
  * This file implements IPC performance test, using three different modes
+ *
+ * In bk_shmipc mode, --latency sends a timestamp every --interval
+ * microseconds so the reader is normally idle when data arrives, and
+ * reports one-way latency for the blocking strategy selected with
+ * --spinus (0 is spin, otherwise usleep) or --futex.  --zerocopy moves
+ * --buffersize byte messages with reserve/commit and peek/consume instead
+ * of copying through bk_shmipc_write/bk_shmipc_read.  --notify has the
+ * reader sleep in poll() on the shmipc eventfd, as an event loop would.
  */
 
 #include <libbk.h>
 #include <mqueue.h>
+#include <poll.h>
 
 
 
@@ -52,6 +61,12 @@ struct program_config
 #define PC_MQ				0x02	///< Message queue
 #define PC_MB				0x04	///< Mailbox/mutex
 #define PC_BK				0x08	///< Mailbox/mutex
+#define PC_FUTEX			0x10	///< shmipc blocks with futex
+#define PC_LATENCY			0x20	///< Measure shmipc message latency
+#define PC_ZEROCOPY			0x40	///< shmipc reserve/commit, peek/consume
+#define PC_NOTIFY			0x80	///< shmipc reader waits on eventfd
+#define PC_MEMFD			0x100	///< shmipc ring in memfd
+#define PC_HUGEPAGE			0x200	///< shmipc ring in huge pages
   int			pc_buffer;		///< Buffer sizes
   int			pc_chunks;		///< Number of chunks to send
   volatile int		pc_ready;		///< Mailbox communication
@@ -62,12 +77,19 @@ struct program_config
   mqd_t			pc_mqout;		///< Message queue
   pthread_t	       *pc_recvthread;		///< Receiver thread
   struct bk_shmipc     *pc_shmipc;		///< Shared memory ring
+  u_int			pc_spinus;		///< shmipc poll interval (0 to spin)
+  u_int			pc_ringsize;		///< shmipc ring size
+  u_int			pc_intervalus;		///< Delay between latency test messages
+  u_int64_t		pc_latmin;		///< Minimum latency (ns)
+  u_int64_t		pc_latmax;		///< Maximum latency (ns)
+  u_int64_t		pc_latsum;		///< Total latency (ns)
 };
 
 
 
 static int proginit(bk_s B, struct program_config *pconfig);
 static void *recvthread(bk_s B, void *opaque);
+static inline u_int64_t nsnow(void);
 
 
 
@@ -102,6 +124,15 @@ main(int argc, char **argv, char **envp)
     {"mailbox", 0, POPT_ARG_NONE, NULL, 10, "Use mailbox/mutex testing", NULL },
     {"messagequeue", 0, POPT_ARG_NONE, NULL, 11, "Use messagequeue testing", NULL },
     {"shmipc", 0, POPT_ARG_NONE, NULL, 12, "Use bk shmipc testing", NULL },
+    {"spinus", 0, POPT_ARG_INT, NULL, 13, "shmipc poll interval when blocked (0 to spin)", "microseconds" },
+    {"futex", 0, POPT_ARG_NONE, NULL, 14, "shmipc sleeps with futex when blocked", NULL },
+    {"latency", 0, POPT_ARG_NONE, NULL, 15, "Measure shmipc one-way message latency", NULL },
+    {"interval", 0, POPT_ARG_INT, NULL, 16, "Delay between latency messages", "microseconds" },
+    {"zerocopy", 0, POPT_ARG_NONE, NULL, 17, "shmipc uses reserve/commit and peek/consume", NULL },
+    {"notify", 0, POPT_ARG_NONE, NULL, 18, "shmipc reader polls eventfd notification", NULL },
+    {"memfd", 0, POPT_ARG_NONE, NULL, 19, "shmipc ring lives in a memfd", NULL },
+    {"hugepage", 0, POPT_ARG_NONE, NULL, 20, "shmipc ring uses huge pages", NULL },
+    {"ringsize", 0, POPT_ARG_INT, NULL, 21, "shmipc ring size (large rings with big --buffersize and --zerocopy show TLB effects)", "bytes" },
     POPT_AUTOHELP
     POPT_TABLEEND
   };
@@ -117,6 +148,8 @@ main(int argc, char **argv, char **envp)
   memset(pc,0,sizeof(*pc));
   pc->pc_buffer = 16;
   pc->pc_chunks = 1000000;
+  pc->pc_intervalus = 100;
+  pc->pc_ringsize = 16300;
 
   if (!(optCon = poptGetContext(NULL, argc, (const char **)argv, optionsTable, 0)))
   {
@@ -167,6 +200,42 @@ main(int argc, char **argv, char **envp)
       pc->pc_ready++;
       break;
 
+    case 13:					// shmipc poll interval
+      pc->pc_spinus = atoi(poptGetOptArg(optCon));
+      break;
+
+    case 14:					// shmipc futex
+      BK_FLAG_SET(pc->pc_flags, PC_FUTEX);
+      break;
+
+    case 15:					// shmipc latency
+      BK_FLAG_SET(pc->pc_flags, PC_LATENCY);
+      break;
+
+    case 16:					// Latency message interval
+      pc->pc_intervalus = atoi(poptGetOptArg(optCon));
+      break;
+
+    case 17:					// shmipc zero-copy
+      BK_FLAG_SET(pc->pc_flags, PC_ZEROCOPY);
+      break;
+
+    case 18:					// shmipc eventfd notification
+      BK_FLAG_SET(pc->pc_flags, PC_NOTIFY);
+      break;
+
+    case 19:					// shmipc memfd
+      BK_FLAG_SET(pc->pc_flags, PC_MEMFD);
+      break;
+
+    case 20:					// shmipc huge pages
+      BK_FLAG_SET(pc->pc_flags, PC_HUGEPAGE);
+      break;
+
+    case 21:					// shmipc ring size
+      pc->pc_ringsize = atoi(poptGetOptArg(optCon));
+      break;
+
     }
   }
 
@@ -219,7 +288,34 @@ main(int argc, char **argv, char **envp)
     }
     else if (BK_FLAG_ISSET(pc->pc_flags, PC_BK))
     {
-      if (bk_shmipc_write(B, pc->pc_shmipc, buf, sizeof(void *), 0, BK_SHMIPC_WRITEALL) != sizeof(void *))
+      u_int64_t stamp = 0;
+
+      if (BK_FLAG_ISSET(pc->pc_flags, PC_LATENCY))
+      {
+	if (pc->pc_intervalus)
+	  usleep(pc->pc_intervalus);
+	stamp = nsnow();
+      }
+
+      if (BK_FLAG_ISSET(pc->pc_flags, PC_ZEROCOPY))
+      {
+	struct iovec iov[2];
+	size_t len;
+
+	// Message is built straight into the ring
+	if (bk_shmipc_write_reserve(B, pc->pc_shmipc, pc->pc_buffer, iov, 0, 0) < 1)
+	{
+	  bk_error_printf(B, BK_ERR_ERR, "Could not shmreserve\n");
+	  bk_die(B, 1, stderr, "Could not reserve", BK_WARNDIE_WANTDETAILS);
+	}
+	// The stamp may straddle the end of the ring
+	len = MIN(iov[0].iov_len, sizeof(stamp));
+	memcpy(iov[0].iov_base, &stamp, len);
+	if (len < sizeof(stamp))
+	  memcpy(iov[1].iov_base, (char *)&stamp + len, MIN(iov[1].iov_len, sizeof(stamp) - len));
+	bk_shmipc_write_commit(B, pc->pc_shmipc, pc->pc_buffer, 0);
+      }
+      else if (bk_shmipc_write(B, pc->pc_shmipc, &stamp, sizeof(stamp), 0, BK_SHMIPC_WRITEALL) != sizeof(stamp))
       {
 	bk_error_printf(B, BK_ERR_ERR, "Could not shmsend\n");
 	bk_die(B, 1, stderr, "Could not receive", BK_WARNDIE_WANTDETAILS);
@@ -255,7 +351,9 @@ main(int argc, char **argv, char **envp)
   }
   else if (BK_FLAG_ISSET(pc->pc_flags, PC_BK))
   {
-    fprintf(stderr,"In bk_shmipc mode\n");
+    fprintf(stderr,"In bk_shmipc mode (%s)\n", BK_FLAG_ISSET(pc->pc_flags, PC_NOTIFY)?"eventfd":(BK_FLAG_ISSET(pc->pc_flags, PC_FUTEX)?"futex":(pc->pc_spinus?"usleep":"spin")));
+    if (BK_FLAG_ISSET(pc->pc_flags, PC_LATENCY) && pc->pc_chunks > 0)
+      fprintf(stderr,"Latency min/avg/max %llu/%llu/%llu ns at %u us interval\n", (unsigned long long)pc->pc_latmin, (unsigned long long)(pc->pc_latsum / pc->pc_chunks), (unsigned long long)pc->pc_latmax, pc->pc_intervalus);
   }
   else
   {
@@ -322,7 +420,8 @@ proginit(bk_s B, struct program_config *pc)
 
   if (BK_FLAG_ISSET(pc->pc_flags, PC_BK))
   {
-    if (!(pc->pc_shmipc = bk_shmipc_create(B, "test", 0, 0, 1, 16300, 0600, NULL, BK_SHMIPC_WRONLY)))
+    if (!(pc->pc_shmipc = bk_shmipc_create(B, "test", 0, 0, pc->pc_spinus, pc->pc_ringsize, 0600, NULL, BK_SHMIPC_WRONLY|(BK_FLAG_ISSET(pc->pc_flags, PC_FUTEX)?BK_SHMIPC_FUTEX:0)|(BK_FLAG_ISSET(pc->pc_flags, PC_NOTIFY)?BK_SHMIPC_NOTIFY:0)|
+					  (BK_FLAG_ISSET(pc->pc_flags, PC_MEMFD)?BK_SHMIPC_MEMFD:0)|(BK_FLAG_ISSET(pc->pc_flags, PC_HUGEPAGE)?BK_SHMIPC_HUGEPAGE:0))))
     {
       bk_error_printf(B, BK_ERR_ERR, "Could not create shared memory ipc\n");
       goto error;
@@ -368,7 +467,7 @@ static void *recvthread(bk_s B, void *opaque)
 
   if (BK_FLAG_ISSET(pc->pc_flags, PC_BK))
   {
-    if (!(shmipc = bk_shmipc_create(B, "test", 0, 0, 1, 0, 0600, NULL, BK_SHMIPC_RDONLY)))
+    if (!(shmipc = bk_shmipc_create(B, "test", 0, 0, pc->pc_spinus, 0, 0600, NULL, BK_SHMIPC_RDONLY)))
     {
       bk_error_printf(B, BK_ERR_ERR, "Could not create shared memory ipc reader\n");
       goto error;
@@ -399,11 +498,66 @@ static void *recvthread(bk_s B, void *opaque)
     }
     else if (BK_FLAG_ISSET(pc->pc_flags, PC_BK))
     {
-      if (bk_shmipc_read(B, shmipc, buf, sizeof(void *), 0, BK_SHMIPC_READALL) != sizeof(void *))
+      u_int64_t stamp = 0;
+
+      if (BK_FLAG_ISSET(pc->pc_flags, PC_ZEROCOPY))
+      {
+	struct iovec iov[2];
+	size_t len;
+
+	// Message is examined in place, then released
+	if (bk_shmipc_read_peek(B, shmipc, pc->pc_buffer, iov, 0, 0) < 1)
+	{
+	  bk_error_printf(B, BK_ERR_ERR, "Could not shmpeek\n");
+	  goto error;
+	}
+	// The stamp may straddle the end of the ring
+	len = MIN(iov[0].iov_len, sizeof(stamp));
+	memcpy(&stamp, iov[0].iov_base, len);
+	if (len < sizeof(stamp))
+	  memcpy((char *)&stamp + len, iov[1].iov_base, MIN(iov[1].iov_len, sizeof(stamp) - len));
+	bk_shmipc_read_consume(B, shmipc, pc->pc_buffer, 0);
+      }
+      else if (BK_FLAG_ISSET(pc->pc_flags, PC_NOTIFY))
+      {
+	size_t got = 0;
+	ssize_t len;
+	struct pollfd pfd;
+
+	// Drain without blocking, only sleep on the eventfd once the ring is empty
+	while (got < sizeof(stamp))
+	{
+	  if ((len = bk_shmipc_read(B, shmipc, (char *)&stamp + got, sizeof(stamp) - got, 0, BK_SHMIPC_NOBLOCK)) > 0)
+	  {
+	    got += len;
+	    continue;
+	  }
+	  if (len == 0 || bk_shmipc_errno(B, shmipc, 0) != EAGAIN || (pfd.fd = bk_shmipc_notify_fd(B, shmipc, 0)) < 0)
+	  {
+	    bk_error_printf(B, BK_ERR_ERR, "Could not shmreceive\n");
+	    goto error;
+	  }
+	  pfd.events = POLLIN;
+	  poll(&pfd, 1, -1);
+	  bk_shmipc_notify_drain(B, shmipc, 0);
+	}
+      }
+      else if (bk_shmipc_read(B, shmipc, &stamp, sizeof(stamp), 0, BK_SHMIPC_READALL) != sizeof(stamp))
       {
 	bk_error_printf(B, BK_ERR_ERR, "Could not shmreceive\n");
 	goto error;
       }
+
+      if (BK_FLAG_ISSET(pc->pc_flags, PC_LATENCY))
+      {
+	u_int64_t lat = nsnow() - stamp;
+
+	if (!pc->pc_latmin || lat < pc->pc_latmin)
+	  pc->pc_latmin = lat;
+	if (lat > pc->pc_latmax)
+	  pc->pc_latmax = lat;
+	pc->pc_latsum += lat;
+      }
     }
   }
 
@@ -419,3 +573,18 @@ static void *recvthread(bk_s B, void *opaque)
  error:
   BK_RETURN(B, NULL);
 }
+
+
+
+/**
+ * Monotonic time in nanoseconds, for latency measurement
+ *
+ *	@return <i>nanoseconds</i> since some arbitrary point
+ */
+static inline u_int64_t nsnow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
@@ -50,6 +50,9 @@ struct program_config
 {
   pthread_t	        pc_manageth;		///< Manage thread
   struct bk_shmmap     *pc_shmmap;		////< Shared memory
+  struct bk_shmalloc   *pc_shmalloc;		///< Allocator in shared memory
+  int			pc_allocs;		///< Allocations to churn through (0 for memset test)
+  int			pc_snaps;		///< Snapshots to publish/read (0 for memset test)
   int			pc_shmlen;		///< (user) size of shared memory
   char		       *pc_shmname;		///< Shared memory name
   bk_flags		pc_flags;		///< Flags are fun!
@@ -60,6 +63,8 @@ struct program_config
 
 static int proginit(bk_s B, struct program_config *pc, int argc, char **argv);
 static void progrun(bk_s B, struct program_config *pc);
+static void allocrun(bk_s B, struct program_config *pc);
+static void snaprun(bk_s B, struct program_config *pc);
 
 
 
@@ -94,6 +99,8 @@ main(int argc, char **argv, char **envp)
 
     {"name", 'n', POPT_ARG_STRING, &Pconfig.pc_shmname, 0, N_("Shared memory to attach to"), N_("shm name") },
     {"len", 'l', POPT_ARG_INT, &Pconfig.pc_shmlen, 0, N_("Length of shared memory"), N_("shm_length") },
+    {"alloc", 'a', POPT_ARG_INT, &Pconfig.pc_allocs, 0, N_("Churn the shared memory allocator instead"), N_("allocations") },
+    {"snap", 's', POPT_ARG_INT, &Pconfig.pc_snaps, 0, N_("Publish/check seqlock snapshots instead"), N_("snapshots") },
     POPT_AUTOHELP
     POPT_TABLEEND
   };
@@ -269,6 +276,12 @@ static int proginit(bk_s B, struct program_config *pc, int argc, char **argv)
       BK_RETURN(B, -1);
     }
     pc->pc_manageth = *pt;
+
+    if (pc->pc_allocs && !(pc->pc_shmalloc = bk_shmalloc_init(B, pc->pc_shmmap, 0)))
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not set up shared memory allocator\n");
+      BK_RETURN(B, -1);
+    }
   }
   else
   {
@@ -285,6 +298,12 @@ static int proginit(bk_s B, struct program_config *pc, int argc, char **argv)
     }
 
     fprintf(stderr,"shmmap-attached\n");
+
+    while (pc->pc_allocs && !(pc->pc_shmalloc = bk_shmalloc_init(B, pc->pc_shmmap, 0)))
+    {
+      fprintf(stderr,"shmalloc-init (waiting for creator)\n");
+      sleep(1);
+    }
   }
 
   BK_RETURN(B, 0);
@@ -310,7 +329,20 @@ static void progrun(bk_s B, struct program_config *pc)
     BK_VRETURN(B);
   }
 
-  if (pc->pc_shmlen)
+  if (pc->pc_snaps)
+  {
+    snaprun(B, pc);
+    if (pc->pc_shmlen)
+      bk_shmmap_destroy(B, pc->pc_shmmap, 0);
+  }
+  else if (pc->pc_allocs)
+  {
+    allocrun(B, pc);
+    bk_shmalloc_destroy(B, pc->pc_shmalloc, 0);
+    if (pc->pc_shmlen)
+      bk_shmmap_destroy(B, pc->pc_shmmap, 0);
+  }
+  else if (pc->pc_shmlen)
   {
     u_short x = 1;
     while (x)
@@ -341,15 +373,129 @@ static void progrun(bk_s B, struct program_config *pc)
 	histo[(int)y]++;
       }
 
-      printf("-------------------- %d %u\n", (int)pc->pc_shmmap->sm_addr->sh_usersize,(u_int)pc->pc_shmmap->sm_addr->sh_creatortime);
+      printf("-------------------- %d %llu\n", (int)pc->pc_shmmap->sm_addr->sh_usersize,(unsigned long long)pc->pc_shmmap->sm_addr->sh_heartbeat);
       for(x=0;x<256;x++)
       {
 	if (histo[x])
 	  printf("%3d %d\n", x, histo[x]);
       }
     }
-    fprintf(stderr,"shmmap name=%s, creatortime=%u(%i), state=%x fresh=%d\n",pc->pc_shmmap->sm_name,(int)pc->pc_shmmap->sm_addr->sh_creatortime,(int)(time(NULL)-pc->pc_shmmap->sm_addr->sh_creatortime),pc->pc_shmmap->sm_addr->sh_state,pc->pc_shmmap->sm_addr->sh_fresh);
+    fprintf(stderr,"shmmap name=%s, heartbeat=%llu(%llums), state=%x fresh=%d\n",pc->pc_shmmap->sm_name,(unsigned long long)pc->pc_shmmap->sm_addr->sh_heartbeat,(unsigned long long)(bk_shmmap_nowms()-pc->pc_shmmap->sm_addr->sh_beatms),pc->pc_shmmap->sm_addr->sh_state,pc->pc_shmmap->sm_addr->sh_fresh);
+  }
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Churn the shared allocator: keep a window of random sized blocks, each
+ * stamped with its own offset, and check the stamps survive other
+ * processes allocating and freeing around them.
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ */
+static void allocrun(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"SIMPLE");
+  bk_shmoff_t window[256];
+  int bad = 0, failed = 0;
+  int x;
+
+  memset(window, 0, sizeof(window));
+
+  for (x = 0; x < pc->pc_allocs; x++)
+  {
+    int which = random() % 256;
+    bk_shmoff_t *block;
+
+    if ((block = BK_SHMOFF_PTR(pc->pc_shmmap, window[which])))
+    {
+      if (*block != window[which])
+	bad++;
+      bk_shmalloc_free(B, pc->pc_shmalloc, window[which], 0);
+    }
+
+    if (!(window[which] = bk_shmalloc_alloc(B, pc->pc_shmalloc, sizeof(bk_shmoff_t) + random() % 4096, 0)))
+    {
+      failed++;
+      continue;
+    }
+    block = BK_SHMOFF_PTR(pc->pc_shmmap, window[which]);
+    *block = window[which];
   }
 
+  for (x = 0; x < 256; x++)
+    bk_shmalloc_free(B, pc->pc_shmalloc, window[x], 0);
+
+  printf("%d allocations, %d failed, %d corrupted\n", pc->pc_allocs, failed, bad);
+
+  BK_VRETURN(B);
+}
+
+
+
+#define SNAPWORDS	1024			///< Words in test snapshot
+
+
+
+/**
+ * Creator publishes snapshots whose words all hold the snapshot number;
+ * clients copy them out and complain about any copy which is not uniform.
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ */
+static void snaprun(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"SIMPLE");
+  struct bk_shmsnap *snap = pc->pc_shmmap->sm_addr->sh_user;
+  u_int32_t words[SNAPWORDS];
+  u_int64_t version, lastversion = 0;
+  int bad = 0, reads = 0;
+  int x, y;
+
+  if (pc->pc_shmlen)
+  {
+    if ((size_t)pc->pc_shmmap->sm_addr->sh_usersize < bk_shmsnap_size(sizeof(words)) || !bk_shmsnap_init(B, snap, sizeof(words), 0))
+    {
+      fprintf(stderr,"Could not set up snapshot area (need %zu bytes)\n", bk_shmsnap_size(sizeof(words)));
+      BK_VRETURN(B);
+    }
+
+    for (x = 1; x <= pc->pc_snaps; x++)
+    {
+      u_int32_t *next = bk_shmsnap_begin(B, snap, 0);
+
+      for (y = 0; y < SNAPWORDS; y++)
+	next[y] = x;
+      bk_shmsnap_commit(B, snap, 0);
+    }
+    printf("%d snapshots published\n", pc->pc_snaps);
+    BK_VRETURN(B);
+  }
+
+  for (x = 0; x < pc->pc_snaps && BK_SHMMAP_ISFRESH(pc->pc_shmmap); x++)
+  {
+    if (bk_shmsnap_read(B, snap, words, sizeof(words), &version, 0) < 0)
+      break;
+    if (version == lastversion)
+      continue;
+    lastversion = version;
+    reads++;
+
+    for (y = 0; y < SNAPWORDS; y++)
+    {
+      if (words[y] != version)
+      {
+	bad++;
+	break;
+      }
+    }
+  }
+
+  printf("%d new snapshots read, %d inconsistent\n", reads, bad);
+
   BK_VRETURN(B);
 }
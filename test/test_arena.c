@@ -0,0 +1,285 @@
+#if !defined(lint)
+static const char libbk__copyright[] = "Copyright © 2011";
+static const char libbk__contact[] = "<projectbaka@baka.org>";
+#endif /* not lint */
+/*
+ * ++Copyright BAKA++
+ *
+ * Copyright © 2011 The Authors. All rights reserved.
+ *
+ * This source code is licensed to you under the terms of the file
+ * LICENSE.TXT in this release for further details.
+ *
+ * Send e-mail to <projectbaka@baka.org> for further information.
+ *
+ * - -Copyright BAKA- -
+ */
+
+/**
+ * @file
+ *
+ * Time a parse-heavy "request": parse a few URLs and tokenize a few
+ * command lines, then throw all of it away.  Once with malloc and the
+ * usual destroy calls, once from an arena reset after every request.
+ */
+#include <libbk.h>
+
+
+
+#define ERRORQUEUE_DEPTH	32		///< Default error queue depth
+#define DEFAULT_COUNT		200000		///< Requests per run
+
+
+
+/**
+ * Information about basic program runtime configuration
+ * which must be passed around.
+ */
+struct program_config
+{
+  bk_flags		pc_flags;		///< Flags are fun!
+#define PC_VERBOSE	0x001			///< Verbose output
+  u_int			pc_count;		///< Requests per run
+};
+
+
+
+/**
+ * What a request parses
+ */
+static const char *urls[] =
+{
+  "http://www.baka.org:8080/pub/ietf/uri/index.html?q=arena&lang=en#Related",
+  "https://user@[::1]:443/a/b/c;param=1?x=y",
+  "wump:foobar.baka.org/some/path",
+  "ftp://ftp.example.com/pub/file.tar.gz",
+};
+static const char *lines[] =
+{
+  "GET /pub/ietf/uri/index.html HTTP/1.1",
+  "set \"client name\" 'quoted value' plain tokens here",
+  "Host: www.baka.org  Accept: text/html  Connection: keep-alive",
+};
+#define NURLS		(sizeof(urls)/sizeof(urls[0]))	///< Number of URLs
+#define NLINES		(sizeof(lines)/sizeof(lines[0]))	///< Number of lines
+
+
+
+static int progrun(bk_s B, struct program_config *pc);
+static int request_malloc(bk_s B);
+static int request_arena(bk_s B, struct bk_arena *arena);
+static inline u_int64_t nsnow(void);
+
+
+
+/**
+ * Program entry point
+ *
+ *	@param argc Number of argv elements
+ *	@param argv Program name and arguments
+ *	@param envp Program environment
+ *	@return <i>0</i> Success
+ *	@return <br><i>1</i> Some request failed
+ *	@return <br><i>254</i> Initialization failed
+ */
+int
+main(int argc, char **argv, char **envp)
+{
+  bk_s B = NULL;				/* Baka general structure */
+  BK_ENTRY_MAIN(B, __FUNCTION__, __FILE__, "test_arena");
+  int c;
+  int getopterr = 0;
+  struct program_config Pconfig, *pc = NULL;
+  poptContext optCon = NULL;
+  struct poptOption optionsTable[] =
+  {
+    {"debug", 'd', POPT_ARG_NONE, NULL, 'd', "Turn on debugging", NULL },
+    {"verbose", 'v', POPT_ARG_NONE, NULL, 'v', "Turn on verbose message", NULL },
+    {"count", 'c', POPT_ARG_INT, NULL, 'c', "Requests per run", "count" },
+    POPT_AUTOHELP
+    POPT_TABLEEND
+  };
+
+  if (!(B=bk_general_init(argc, &argv, &envp, BK_ENV_GWD(B, "BK_ENV_CONF_APP", BK_APP_CONF), NULL, ERRORQUEUE_DEPTH, LOG_USER, 0)))
+  {
+    fprintf(stderr,"Could not perform basic initialization\n");
+    exit(254);
+  }
+  bk_fun_reentry(B);
+
+  pc = &Pconfig;
+  memset(pc, 0, sizeof(*pc));
+  pc->pc_count = DEFAULT_COUNT;
+
+  if (!(optCon = poptGetContext(NULL, argc, (const char **)argv, optionsTable, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not initialize options processing\n");
+    bk_exit(B, 254);
+  }
+
+  while ((c = poptGetNextOpt(optCon)) >= 0)
+  {
+    switch (c)
+    {
+    case 'd':					// debug
+      bk_error_config(B, BK_GENERAL_ERROR(B), 0, stderr, 0, 0, BK_ERROR_CONFIG_FH);	// Enable output of all error logs
+      bk_general_debug_config(B, stderr, BK_ERR_NONE, 0);				// Set up debugging, from config file
+      bk_debug_printf(B, "Debugging on\n");
+      break;
+    case 'v':					// verbose
+      BK_FLAG_SET(pc->pc_flags, PC_VERBOSE);
+      bk_error_config(B, BK_GENERAL_ERROR(B), ERRORQUEUE_DEPTH, stderr, BK_ERR_NONE, BK_ERR_ERR, 0);
+      break;
+    case 'c':
+      pc->pc_count = atoi(poptGetOptArg(optCon));
+      break;
+    default:
+      getopterr++;
+      break;
+    }
+  }
+
+  if (c < -1 || getopterr || !pc->pc_count)
+  {
+    if (c < -1)
+    {
+      fprintf(stderr, "%s\n", poptStrerror(c));
+    }
+    poptPrintUsage(optCon, stderr, 0);
+    bk_exit(B, 254);
+  }
+
+  bk_exit(B, progrun(B, pc) < 0 ? 1 : 0);
+  return(255);					// Stupid INSIGHT stuff.
+}
+
+
+
+/**
+ * Run the malloc and arena versions and compare
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int progrun(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_arena");
+  struct bk_arena *arena;
+  u_int64_t start, mallocns, arenans;
+  u_int x;
+
+  if (!(arena = bk_arena_create(B, 0, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not create arena\n");
+    BK_RETURN(B, -1);
+  }
+
+  start = nsnow();
+  for (x = 0; x < pc->pc_count; x++)
+  {
+    if (request_malloc(B) < 0)
+      goto error;
+  }
+  mallocns = nsnow() - start;
+
+  start = nsnow();
+  for (x = 0; x < pc->pc_count; x++)
+  {
+    if (request_arena(B, arena) < 0)
+      goto error;
+    bk_arena_reset(B, arena, 0);
+  }
+  arenans = nsnow() - start;
+
+  printf("%-8s %14s\n", "alloc", "ns/request");
+  printf("%-8s %14.1f\n", "malloc", (double)mallocns / pc->pc_count);
+  printf("%-8s %14.1f\n", "arena", (double)arenans / pc->pc_count);
+
+  bk_arena_destroy(B, arena, 0);
+  BK_RETURN(B, 0);
+
+ error:
+  fprintf(stderr, "Request %u failed\n", x);
+  bk_arena_destroy(B, arena, 0);
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * One request, with malloc'ed results destroyed one by one
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int request_malloc(bk_s B)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_arena");
+  struct bk_url *bu;
+  char **tokens;
+  u_int x;
+
+  for (x = 0; x < NURLS; x++)
+  {
+    if (!(bu = bk_url_parse(B, urls[x], BkUrlParseStrEmpty, 0)))
+      BK_RETURN(B, -1);
+    bk_url_destroy(B, bu);
+  }
+
+  for (x = 0; x < NLINES; x++)
+  {
+    if (!(tokens = bk_string_tokenize_split(B, lines[x], 0, NULL, NULL, NULL, NULL, BK_STRING_TOKENIZE_SIMPLE)))
+      BK_RETURN(B, -1);
+    bk_string_tokenize_destroy(B, tokens);
+  }
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * One request, with everything from an arena the caller resets
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param arena Request arena
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int request_arena(bk_s B, struct bk_arena *arena)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_arena");
+  u_int x;
+
+  for (x = 0; x < NURLS; x++)
+  {
+    if (!bk_url_parse_arena(B, arena, urls[x], BkUrlParseStrEmpty, 0))
+      BK_RETURN(B, -1);
+  }
+
+  for (x = 0; x < NLINES; x++)
+  {
+    if (!bk_string_tokenize_split_arena(B, arena, lines[x], 0, NULL, NULL, NULL, NULL, BK_STRING_TOKENIZE_SIMPLE))
+      BK_RETURN(B, -1);
+  }
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Monotonic time in nanoseconds, for throughput measurement
+ *
+ *	@return <i>nanoseconds</i> since some arbitrary point
+ */
+static inline u_int64_t nsnow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
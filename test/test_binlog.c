@@ -0,0 +1,496 @@
+#if !defined(lint)
+static const char libbk__copyright[] = "Copyright © 2011";
+static const char libbk__contact[] = "<projectbaka@baka.org>";
+#endif /* not lint */
+/*
+ * ++Copyright BAKA++
+ *
+ * Copyright © 2011 The Authors. All rights reserved.
+ *
+ * This source code is licensed to you under the terms of the file
+ * LICENSE.TXT in this release for further details.
+ *
+ * Send e-mail to <projectbaka@baka.org> for further information.
+ *
+ * - -Copyright BAKA- -
+ */
+
+/**
+ * @file
+ *
+ * Check and time binary logs: messages of every conversion the capture
+ * handles (and some it formats at the call) must read back exactly as
+ * snprintf formats them; several threads logging at once must lose and
+ * reorder nothing; bk_error_binlog and bk_debug_binlog must divert only
+ * what they should.  Capture is timed against snprintf.
+ */
+#include <libbk.h>
+#include <stdint.h>
+#include <wchar.h>
+
+
+
+#define ERRORQUEUE_DEPTH	32		///< Default error queue depth
+#define DEFAULT_COUNT		100000		///< Messages per thread, and timed messages
+#define THREADS			4		///< Threads logging at once
+#define MAXCASES		32		///< Most format cases checked
+#define CASELEN			256		///< Longest formatted case
+
+
+
+/**
+ * Information about basic program runtime configuration
+ * which must be passed around.
+ */
+struct program_config
+{
+  bk_flags		pc_flags;		///< Flags are fun!
+#define PC_VERBOSE	0x001			///< Verbose output
+  u_int			pc_count;		///< Messages per thread
+  char			pc_file[64];		///< Scratch log file
+  struct bk_binlog     *pc_binlog;		///< Log the threads share
+};
+
+
+
+/**
+ * Format a case with snprintf for the expected text, and capture it
+ */
+#define CASE(fmt, args...)						\
+do {									\
+  snprintf(expect[ncases++], CASELEN, fmt, ##args);			\
+  bk_binlog_iprintf(B, bbl, BK_ERR_ERR, __FUNCTION__, fmt, ##args);	\
+} while (0)
+
+
+
+static int progrun(bk_s B, struct program_config *pc);
+static int formats(bk_s B, struct program_config *pc);
+static int threads(bk_s B, struct program_config *pc);
+static void *logger(bk_s B, void *opaque);
+static int routing(bk_s B, struct program_config *pc);
+static int timing(bk_s B, struct program_config *pc);
+static inline u_int64_t nsnow(void);
+
+
+
+/**
+ * Program entry point
+ *
+ *	@param argc Number of argv elements
+ *	@param argv Program name and arguments
+ *	@param envp Program environment
+ *	@return <i>0</i> Success
+ *	@return <br><i>1</i> Some message did not read back
+ *	@return <br><i>254</i> Initialization failed
+ */
+int
+main(int argc, char **argv, char **envp)
+{
+  bk_s B = NULL;				/* Baka general structure */
+  BK_ENTRY_MAIN(B, __FUNCTION__, __FILE__, "test_binlog");
+  int c;
+  int getopterr = 0;
+  struct program_config Pconfig, *pc = NULL;
+  poptContext optCon = NULL;
+  struct poptOption optionsTable[] =
+  {
+    {"debug", 'd', POPT_ARG_NONE, NULL, 'd', "Turn on debugging", NULL },
+    {"verbose", 'v', POPT_ARG_NONE, NULL, 'v', "Turn on verbose message", NULL },
+    {"count", 'c', POPT_ARG_INT, NULL, 'c', "Messages per thread", "count" },
+    POPT_AUTOHELP
+    POPT_TABLEEND
+  };
+
+  if (!(B=bk_general_init(argc, &argv, &envp, BK_ENV_GWD(B, "BK_ENV_CONF_APP", BK_APP_CONF), NULL, ERRORQUEUE_DEPTH, LOG_USER, BK_GENERAL_THREADREADY)))
+  {
+    fprintf(stderr,"Could not perform basic initialization\n");
+    exit(254);
+  }
+  bk_fun_reentry(B);
+
+  pc = &Pconfig;
+  memset(pc, 0, sizeof(*pc));
+  pc->pc_count = DEFAULT_COUNT;
+  snprintf(pc->pc_file, sizeof(pc->pc_file), "/tmp/test_binlog.%d", (int)getpid());
+
+  if (!(optCon = poptGetContext(NULL, argc, (const char **)argv, optionsTable, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not initialize options processing\n");
+    bk_exit(B, 254);
+  }
+
+  while ((c = poptGetNextOpt(optCon)) >= 0)
+  {
+    switch (c)
+    {
+    case 'd':					// debug
+      bk_error_config(B, BK_GENERAL_ERROR(B), 0, stderr, 0, 0, BK_ERROR_CONFIG_FH);	// Enable output of all error logs
+      bk_general_debug_config(B, stderr, BK_ERR_NONE, 0);				// Set up debugging, from config file
+      bk_debug_printf(B, "Debugging on\n");
+      break;
+    case 'v':					// verbose
+      BK_FLAG_SET(pc->pc_flags, PC_VERBOSE);
+      bk_error_config(B, BK_GENERAL_ERROR(B), ERRORQUEUE_DEPTH, stderr, BK_ERR_NONE, BK_ERR_ERR, 0);
+      break;
+    case 'c':
+      pc->pc_count = atoi(poptGetOptArg(optCon));
+      break;
+    default:
+      getopterr++;
+      break;
+    }
+  }
+
+  if (c < -1 || getopterr || pc->pc_count < 1)
+  {
+    if (c < -1)
+    {
+      fprintf(stderr, "%s\n", poptStrerror(c));
+    }
+    poptPrintUsage(optCon, stderr, 0);
+    bk_exit(B, 254);
+  }
+
+  c = progrun(B, pc);
+  unlink(pc->pc_file);
+  bk_exit(B, c < 0 ? 1 : 0);
+  return(255);					// Stupid INSIGHT stuff.
+}
+
+
+
+/**
+ * Run each check in turn
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Some check failed
+ */
+static int progrun(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_binlog");
+  int ret = 0;
+
+  if (formats(B, pc) < 0)
+    ret = -1;
+  if (threads(B, pc) < 0)
+    ret = -1;
+  if (routing(B, pc) < 0)
+    ret = -1;
+  if (timing(B, pc) < 0)
+    ret = -1;
+
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Capture one message of each kind of conversion, read them back and
+ * compare them with snprintf; then check that an over-long message is
+ * truncated rather than lost.
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int formats(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_binlog");
+  char expect[MAXCASES][CASELEN];
+  struct bk_binlog_reader *bblr = NULL;
+  struct bk_binlog_entry bble;
+  struct bk_binlog *bbl;
+  const char *nullstr = NULL;
+  char longstr[BK_BINLOG_BUFSIZE_DEFAULT / 16];
+  int ncases = 0;
+  int x;
+  int ret = -1;
+
+  if (!(bbl = bk_binlog_create(B, pc->pc_file, 0, 0)))
+  {
+    fprintf(stderr, "Could not create binary log %s\n", pc->pc_file);
+    BK_RETURN(B, -1);
+  }
+
+  CASE("plain\n");
+  CASE("%d %i %u %x %X %o %c\n", -42, 7, 42U, 0xbeef, 0xcafe, 8, 'z');
+  CASE("%ld %lu %lld %llu %qd\n", -(1L << 40), 1UL << 41, -(1LL << 50), 1ULL << 63, 5LL);
+  CASE("%zu %zd %td %jd %hd %hhu\n", (size_t)123, (ssize_t)-5, (ptrdiff_t)-7, (intmax_t)1 << 50, (short)-3, (unsigned char)250);
+  CASE("%f %.3e %g %10.2f %-8.1f| %a %Lf\n", 3.5, 12345.678, 0.0001, -2.25, 1.0, 0.5, (long double)1.25);
+  CASE("%s|%-8s|%8s|%.3s|%.*s|%*d|%-*.*s|\n", "hello", "left", "right", "truncated", 2, "abc", 6, 42, 7, 2, "xyz");
+  CASE("%s %p %%d 100%%\n", nullstr, (void *)0x1234);
+  CASE("%#x %+d % d %05d %-5d|\n", 255, 5, 5, 42, 42);
+  CASE("%s %s %s %s %d\n", "", "a", "bb", "ccc", 0);
+  // Formatted at the call
+  errno = ENOENT;
+  CASE("%m: %d\n", 1);
+  CASE("%2$s %1$s\n", "world", "hello");
+  CASE("%lc%lc\n", (wint_t)'o', (wint_t)'k');
+
+  memset(longstr, 'x', sizeof(longstr) - 1);
+  longstr[sizeof(longstr) - 1] = 0;
+  bk_binlog_iprintf(B, bbl, BK_ERR_NONE, NULL, "long %s %d\n", longstr, 99);
+
+  bk_binlog_destroy(B, bbl);
+
+  if (!(bblr = bk_binlog_open(B, pc->pc_file, 0)))
+  {
+    fprintf(stderr, "Could not open binary log %s\n", pc->pc_file);
+    BK_RETURN(B, -1);
+  }
+
+  for (x = 0; x < ncases; x++)
+  {
+    if (bk_binlog_read(B, bblr, &bble, 0) != 1)
+    {
+      fprintf(stderr, "formats: case %d missing\n", x);
+      goto error;
+    }
+    if (strcmp(bble.bble_msg, expect[x]) || !bble.bble_funname || strcmp(bble.bble_funname, __FUNCTION__) || bble.bble_level != BK_ERR_ERR)
+    {
+      fprintf(stderr, "formats: case %d read back as %s: %s (level %d), expected %s", x,
+	      bble.bble_funname ? bble.bble_funname : "?", bble.bble_msg, bble.bble_level, expect[x]);
+      goto error;
+    }
+  }
+
+  if (bk_binlog_read(B, bblr, &bble, 0) != 1 || strncmp(bble.bble_msg, "long xxxxxxxx", 13) ||
+      strlen(bble.bble_msg) < sizeof(longstr) / 4 || bble.bble_funname || bble.bble_level != BK_ERR_NONE)
+  {
+    fprintf(stderr, "formats: long message did not read back truncated\n");
+    goto error;
+  }
+
+  if (bk_binlog_read(B, bblr, &bble, 0) != 0)
+  {
+    fprintf(stderr, "formats: more messages than were logged\n");
+    goto error;
+  }
+
+  printf("formats: %d cases read back\n", ncases);
+  ret = 0;
+
+ error:
+  bk_binlog_close(B, bblr);
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * THREADS threads log pc_count numbered messages each into small
+ * buffers; every message must read back, in order for each thread.
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int threads(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_binlog");
+  pthread_t *thread[THREADS];
+  struct bk_binlog_reader *bblr = NULL;
+  struct bk_binlog_entry bble;
+  int next[THREADS];
+  u_int64_t start, elapsed, total = 0;
+  int nthr = 0, x, thr, seq;
+  int ret = -1;
+
+  if (!(pc->pc_binlog = bk_binlog_create(B, pc->pc_file, 1, 0)))
+  {
+    fprintf(stderr, "Could not create binary log %s\n", pc->pc_file);
+    BK_RETURN(B, -1);
+  }
+
+  start = nsnow();
+  for (x = 0; x < THREADS; x++)
+  {
+    if (!(thread[nthr] = bk_general_thread_create(B, "logger", logger, pc, BK_THREAD_CREATE_FLAG_JOIN)))
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not create logger thread\n");
+      break;
+    }
+    nthr++;
+  }
+  for (x = 0; x < nthr; x++)
+    pthread_join(*thread[x], NULL);
+  elapsed = BK_MAX(nsnow() - start, 1);
+
+  bk_binlog_destroy(B, pc->pc_binlog);
+  pc->pc_binlog = NULL;
+  if (nthr < THREADS)
+    BK_RETURN(B, -1);
+
+  if (!(bblr = bk_binlog_open(B, pc->pc_file, 0)))
+  {
+    fprintf(stderr, "Could not open binary log %s\n", pc->pc_file);
+    BK_RETURN(B, -1);
+  }
+
+  memset(next, 0, sizeof(next));
+  while ((x = bk_binlog_read(B, bblr, &bble, 0)) > 0)
+  {
+    if (sscanf(bble.bble_msg, "thread %d message %d", &thr, &seq) != 2 || thr < 0 || thr >= THREADS || seq != next[thr])
+    {
+      fprintf(stderr, "threads: unexpected message %s", bble.bble_msg);
+      goto error;
+    }
+    next[thr]++;
+    total++;
+  }
+
+  if (x < 0 || total != (u_int64_t)THREADS * pc->pc_count)
+  {
+    fprintf(stderr, "threads: read %llu of %llu messages\n", (unsigned long long)total, (unsigned long long)THREADS * pc->pc_count);
+    goto error;
+  }
+
+  printf("threads: %d threads, %llu messages, %.2f ns/message\n", THREADS, (unsigned long long)total, (double)elapsed * THREADS / total);
+  ret = 0;
+
+ error:
+  bk_binlog_close(B, bblr);
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Log pc_count numbered messages
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param opaque Program configuration
+ *	@return <i>NULL</i>
+ */
+static void *logger(bk_s B, void *opaque)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_binlog");
+  static int nextthread = 0;
+  struct program_config *pc = opaque;
+  int me = __atomic_fetch_add(&nextthread, 1, __ATOMIC_RELAXED) % THREADS;
+  u_int x;
+
+  for (x = 0; x < pc->pc_count; x++)
+    bk_binlog_iprintf(B, pc->pc_binlog, BK_ERR_DEBUG, __FUNCTION__, "thread %d message %u\n", me, x);
+
+  BK_RETURN(B, NULL);
+}
+
+
+
+/**
+ * bk_error_binlog must divert only messages at or below its level, and
+ * bk_debug_binlog must divert printf-style debugging output (named by the
+ * function trace, when it is on).
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int routing(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_binlog");
+  struct bk_binlog_reader *bblr = NULL;
+  struct bk_binlog_entry bble;
+  struct bk_binlog *bbl;
+  int ret = -1;
+
+  if (!(bbl = bk_binlog_create(B, pc->pc_file, 0, 0)))
+  {
+    fprintf(stderr, "Could not create binary log %s\n", pc->pc_file);
+    BK_RETURN(B, -1);
+  }
+
+  bk_error_binlog(B, bbl, BK_ERR_NOTICE);
+  bk_debug_binlog(B, BK_GENERAL_DEBUG(B), bbl);
+  bk_error_printf(B, BK_ERR_ERR, "error %d is queued\n", 1);
+  bk_error_printf(B, BK_ERR_NOTICE, "notice %d is captured\n", 2);
+  bk_debug_iprintf(B, BK_GENERAL_DEBUG(B), "debugging %d is captured\n", 3);
+  bk_error_binlog(B, NULL, BK_ERR_NOTICE);
+  bk_debug_binlog(B, BK_GENERAL_DEBUG(B), NULL);
+  bk_error_printf(B, BK_ERR_NOTICE, "notice %d is queued\n", 4);
+  bk_binlog_destroy(B, bbl);
+
+  if (!(bblr = bk_binlog_open(B, pc->pc_file, 0)))
+  {
+    fprintf(stderr, "Could not open binary log %s\n", pc->pc_file);
+    BK_RETURN(B, -1);
+  }
+
+  if (bk_binlog_read(B, bblr, &bble, 0) != 1 || strcmp(bble.bble_msg, "notice 2 is captured\n") || bble.bble_level != BK_ERR_NOTICE ||
+      bk_binlog_read(B, bblr, &bble, 0) != 1 || strcmp(bble.bble_msg, "debugging 3 is captured\n") || bble.bble_level != BK_ERR_NONE ||
+      (bble.bble_funname && strcmp(bble.bble_funname, __FUNCTION__)) ||
+      bk_binlog_read(B, bblr, &bble, 0) != 0)
+  {
+    fprintf(stderr, "routing: wrong messages captured\n");
+    goto error;
+  }
+
+  printf("routing: ok\n");
+  ret = 0;
+
+ error:
+  bk_binlog_close(B, bblr);
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Time capturing a typical message against formatting it
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int timing(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_binlog");
+  struct bk_binlog *bbl;
+  u_int64_t start, capturens, formatns;
+  char buf[256];
+  u_int x;
+
+  if (!(bbl = bk_binlog_create(B, pc->pc_file, 0, 0)))
+  {
+    fprintf(stderr, "Could not create binary log %s\n", pc->pc_file);
+    BK_RETURN(B, -1);
+  }
+
+  start = nsnow();
+  for (x = 0; x < pc->pc_count; x++)
+    bk_binlog_iprintf(B, bbl, BK_ERR_DEBUG, __FUNCTION__, "%s: request %u from %s took %.3f ms\n", "handler", x, "10.0.0.1", x / 1000.0);
+  capturens = nsnow() - start;
+
+  start = nsnow();
+  for (x = 0; x < pc->pc_count; x++)
+    snprintf(buf, sizeof(buf), "%s: request %u from %s took %.3f ms\n", "handler", x, "10.0.0.1", x / 1000.0);
+  formatns = nsnow() - start;
+
+  bk_binlog_destroy(B, bbl);
+
+  printf("timing: %.2f ns/capture, %.2f ns/snprintf\n", (double)capturens / pc->pc_count, (double)formatns / pc->pc_count);
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Monotonic time in nanoseconds, for throughput measurement
+ *
+ *	@return <i>nanoseconds</i> since some arbitrary point
+ */
+static inline u_int64_t nsnow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
@@ -0,0 +1,735 @@
+#if !defined(lint)
+static const char libbk__copyright[] = "Copyright © 2001-2011";
+static const char libbk__contact[] = "<projectbaka@baka.org>";
+#endif /* not lint */
+/*
+ * ++Copyright BAKA++
+ *
+ * Copyright © 2001-2011 The Authors. All rights reserved.
+ *
+ * This source code is licensed to you under the terms of the file
+ * LICENSE.TXT in this release for further details.
+ *
+ * Send e-mail to <projectbaka@baka.org> for further information.
+ *
+ * - -Copyright BAKA- -
+ */
+
+/**
+ * @file
+ *
+ * Check and time bumping one dynamic statistic counter from many threads
+ * at once, by name (list lock and search) and through its handle (atomic,
+ * lockless), checking that no increments are lost.  Also checks that a
+ * handle survives deregistration of its stat, checks the windowed figures
+ * of Rate and Window stats, compares reading the stats through a
+ * shared memory export with building the XML, and times on-demand updates
+ * of the system stats with and without a background collector.
+ */
+#include <libbk.h>
+
+
+
+#define ERRORQUEUE_DEPTH	32		///< Default error queue depth
+#define DEFAULT_COUNT		1000000		///< Increments per thread
+#define DEFAULT_MAXTHREADS	32		///< Largest thread count tried
+#define STAT_NAME		"packets"	///< Name of the counter under test
+#define EXPORT_READS		10000		///< Reads timed through each interface
+#define EXPORT_BYTES		4096		///< Export snapshot size
+#define WINDOW_EVENTS		1000		///< Events counted in one second
+#define COLLECT_MSECS		50		///< Collector sampling interval
+#define COLLECT_UPDATES		1000		///< Demand updates timed with and without a collector
+
+
+
+/**
+ * Information about basic program runtime configuration
+ * which must be passed around.
+ */
+struct program_config
+{
+  bk_flags		pc_flags;		///< Flags are fun!
+#define PC_VERBOSE	0x001			///< Verbose output
+#define PC_BYHANDLE	0x002			///< Current run increments by handle
+  u_int			pc_count;		///< Increments per thread
+  u_int			pc_maxthreads;		///< Largest thread count tried
+  bk_dynamic_stats_h	pc_stats;		///< Stats list under test
+  bk_dynamic_stat_h	pc_stat;		///< Counter under test
+};
+
+
+
+static int proginit(bk_s B, struct program_config *pc);
+static int progrun(bk_s B, struct program_config *pc);
+static int runone(bk_s B, struct program_config *pc, u_int nthreads, int byhandle);
+static int deregistered(bk_s B, struct program_config *pc);
+static int windowed(bk_s B, struct program_config *pc);
+static int exported(bk_s B, struct program_config *pc);
+static int collected(bk_s B, struct program_config *pc);
+static int cpu_time(bk_s B, struct program_config *pc, float *cpup);
+static void nextsecond(void);
+static void *incrementer(bk_s B, void *opaque);
+static inline u_int64_t nsnow(void);
+
+
+
+/**
+ * Program entry point
+ *
+ *	@param argc Number of argv elements
+ *	@param argv Program name and arguments
+ *	@param envp Program environment
+ *	@return <i>0</i> Success
+ *	@return <br><i>1</i> Increments lost
+ *	@return <br><i>254</i> Initialization failed
+ */
+int
+main(int argc, char **argv, char **envp)
+{
+  bk_s B = NULL;				/* Baka general structure */
+  BK_ENTRY_MAIN(B, __FUNCTION__, __FILE__, "test_dynstats");
+  int c;
+  int getopterr = 0;
+  struct program_config Pconfig, *pc = NULL;
+  poptContext optCon = NULL;
+  struct poptOption optionsTable[] =
+  {
+    {"debug", 'd', POPT_ARG_NONE, NULL, 'd', "Turn on debugging", NULL },
+    {"verbose", 'v', POPT_ARG_NONE, NULL, 'v', "Turn on verbose message", NULL },
+    {"count", 'c', POPT_ARG_INT, NULL, 'c', "Increments per thread", "count" },
+    {"threads", 't', POPT_ARG_INT, NULL, 't', "Largest number of threads to try", "threads" },
+    POPT_AUTOHELP
+    POPT_TABLEEND
+  };
+
+  if (!(B=bk_general_init(argc, &argv, &envp, BK_ENV_GWD(B, "BK_ENV_CONF_APP", BK_APP_CONF), NULL, ERRORQUEUE_DEPTH, LOG_USER, BK_GENERAL_THREADREADY)))
+  {
+    fprintf(stderr,"Could not perform basic initialization\n");
+    exit(254);
+  }
+  bk_fun_reentry(B);
+
+  pc = &Pconfig;
+  memset(pc, 0, sizeof(*pc));
+  pc->pc_count = DEFAULT_COUNT;
+  pc->pc_maxthreads = DEFAULT_MAXTHREADS;
+
+  if (!(optCon = poptGetContext(NULL, argc, (const char **)argv, optionsTable, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not initialize options processing\n");
+    bk_exit(B, 254);
+  }
+
+  while ((c = poptGetNextOpt(optCon)) >= 0)
+  {
+    switch (c)
+    {
+    case 'd':					// debug
+      bk_error_config(B, BK_GENERAL_ERROR(B), 0, stderr, 0, 0, BK_ERROR_CONFIG_FH);	// Enable output of all error logs
+      bk_general_debug_config(B, stderr, BK_ERR_NONE, 0);				// Set up debugging, from config file
+      bk_debug_printf(B, "Debugging on\n");
+      break;
+    case 'v':					// verbose
+      BK_FLAG_SET(pc->pc_flags, PC_VERBOSE);
+      bk_error_config(B, BK_GENERAL_ERROR(B), ERRORQUEUE_DEPTH, stderr, BK_ERR_NONE, BK_ERR_ERR, 0);
+      break;
+    case 'c':
+      pc->pc_count = atoi(poptGetOptArg(optCon));
+      break;
+    case 't':
+      pc->pc_maxthreads = atoi(poptGetOptArg(optCon));
+      break;
+    default:
+      getopterr++;
+      break;
+    }
+  }
+
+  if (c < -1 || getopterr || !pc->pc_count || !pc->pc_maxthreads)
+  {
+    if (c < -1)
+    {
+      fprintf(stderr, "%s\n", poptStrerror(c));
+    }
+    poptPrintUsage(optCon, stderr, 0);
+    bk_exit(B, 254);
+  }
+
+  if (proginit(B, pc) < 0)
+  {
+    bk_die(B, 254, stderr, "Could not perform program initialization\n", BK_FLAG_ISSET(pc->pc_flags, PC_VERBOSE)?BK_WARNDIE_WANTDETAILS:0);
+  }
+
+  bk_exit(B, progrun(B, pc) < 0 ? 1 : 0);
+  return(255);					// Stupid INSIGHT stuff.
+}
+
+
+
+/**
+ * General program initialization
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Total terminal failure
+ */
+static int proginit(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_dynstats");
+
+  if (!pc)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid argument\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (!BK_GENERAL_FLAG_ISTHREADREADY(B))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "libbk was not built with thread support\n");
+    BK_RETURN(B, -1);
+  }
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Run the by-name and by-handle tests for each thread count
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Some run lost increments
+ */
+static int progrun(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_dynstats");
+  u_int nthreads;
+  int ret = 0;
+
+  printf("%8s %16s %16s\n", "threads", "by name ns/op", "by handle ns/op");
+
+  for (nthreads = 1; nthreads <= pc->pc_maxthreads; nthreads *= 2)
+  {
+    int byname, byhandle;
+
+    if ((byname = runone(B, pc, nthreads, 0)) < 0)
+      ret = -1;
+    if ((byhandle = runone(B, pc, nthreads, 1)) < 0)
+      ret = -1;
+
+    printf("%8u %16.2f %16.2f\n", nthreads, byname / 100.0, byhandle / 100.0);
+    fflush(stdout);
+  }
+
+  if (deregistered(B, pc) < 0)
+    ret = -1;
+
+  if (windowed(B, pc) < 0)
+    ret = -1;
+
+  if (exported(B, pc) < 0)
+    ret = -1;
+
+  if (collected(B, pc) < 0)
+    ret = -1;
+
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * One timed run: every thread increments the same counter pc_count times,
+ * after which the counter must hold all of them.
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@param nthreads Incrementing threads
+ *	@param byhandle Increment through the handle rather than by name
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>hundredths of a nanosecond</i> of wall time per increment per thread on success
+ */
+static int runone(bk_s B, struct program_config *pc, u_int nthreads, int byhandle)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_dynstats");
+  pthread_t *threads[DEFAULT_MAXTHREADS];
+  bk_dynamic_stat_value_u value;
+  u_int nthr = 0, x;
+  u_int64_t start, elapsed;
+
+  if (nthreads > sizeof(threads) / sizeof(*threads))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Too many threads: %u\n", nthreads);
+    BK_RETURN(B, -1);
+  }
+
+  if (!(pc->pc_stats = bk_dynamic_stats_create(B, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not create stats list\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (bk_dynamic_stat_register_simple(B, pc->pc_stats, STAT_NAME, 0, 0, DynamicStatsValueTypeUInt64, DynamicStatsAccessTypeDirect, NULL, NULL, NULL, &pc->pc_stat, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not register counter\n");
+    goto error;
+  }
+
+  if (byhandle)
+    BK_FLAG_SET(pc->pc_flags, PC_BYHANDLE);
+  else
+    BK_FLAG_CLEAR(pc->pc_flags, PC_BYHANDLE);
+
+  start = nsnow();
+
+  for (x = 0; x < nthreads; x++)
+  {
+    if (!(threads[nthr] = bk_general_thread_create(B, "incrementer", incrementer, pc, BK_THREAD_CREATE_FLAG_JOIN)))
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not create incrementer thread\n");
+      goto error;
+    }
+    nthr++;
+  }
+  for (x = 0; x < nthr; x++)
+    pthread_join(*threads[x], NULL);
+  nthr = 0;
+
+  elapsed = BK_MAX(nsnow() - start, 1);
+
+  if (bk_dynamic_stat_get(B, pc->pc_stats, STAT_NAME, 0, NULL, &value, NULL, NULL, NULL, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not read counter\n");
+    goto error;
+  }
+
+  bk_dynamic_stats_destroy(B, pc->pc_stats);
+  pc->pc_stats = NULL;
+
+  if (value.bdsv_uint64 != (u_int64_t)nthreads * pc->pc_count)
+  {
+    fprintf(stderr, "%u threads%s: counted %llu of %llu increments\n", nthreads, byhandle?" (by handle)":"",
+	    (unsigned long long)value.bdsv_uint64, (unsigned long long)nthreads * pc->pc_count);
+    BK_RETURN(B, -1);
+  }
+
+  if (BK_FLAG_ISSET(pc->pc_flags, PC_VERBOSE))
+    fprintf(stderr, "%u threads%s: %llu increments in %llu ns\n", nthreads, byhandle?" (by handle)":"",
+	    (unsigned long long)value.bdsv_uint64, (unsigned long long)elapsed);
+
+  BK_RETURN(B, (int)BK_MIN(elapsed * 100 / pc->pc_count, INT_MAX));
+
+ error:
+  for (x = 0; x < nthr; x++)
+    pthread_join(*threads[x], NULL);
+  bk_dynamic_stats_destroy(B, pc->pc_stats);
+  pc->pc_stats = NULL;
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * A handle must stay usable after its stat is deregistered, and a stat
+ * registered again under the same name must start afresh.
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int deregistered(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_dynstats");
+  bk_dynamic_stat_h newstat = NULL;
+  bk_dynamic_stat_value_u value;
+
+  if (!(pc->pc_stats = bk_dynamic_stats_create(B, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not create stats list\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (bk_dynamic_stat_register_simple(B, pc->pc_stats, STAT_NAME, 0, 0, DynamicStatsValueTypeInt32, DynamicStatsAccessTypeDirect, NULL, NULL, NULL, &pc->pc_stat, 0) < 0 ||
+      bk_dynamic_stat_handle_set(B, pc->pc_stat, 5, 0) < 0 ||
+      bk_dynamic_stat_deregister(B, pc->pc_stats, STAT_NAME, 0, 0) < 0 ||
+      bk_dynamic_stat_handle_add(B, pc->pc_stat, -2, 0) < 0 ||
+      bk_dynamic_stat_register_simple(B, pc->pc_stats, STAT_NAME, 0, 0, DynamicStatsValueTypeInt32, DynamicStatsAccessTypeDirect, NULL, NULL, NULL, &newstat, 0) < 0 ||
+      bk_dynamic_stat_handle_increment(B, newstat) < 0 ||
+      bk_dynamic_stat_get(B, pc->pc_stats, STAT_NAME, 0, NULL, &value, NULL, NULL, NULL, 0) < 0)
+  {
+    fprintf(stderr, "Could not update or reregister a deregistered stat\n");
+    goto error;
+  }
+
+  if (newstat == pc->pc_stat || value.bdsv_int32 != 1)
+  {
+    fprintf(stderr, "Reregistered stat is %d, should be 1\n", value.bdsv_int32);
+    goto error;
+  }
+
+  bk_dynamic_stats_destroy(B, pc->pc_stats);
+  pc->pc_stats = NULL;
+  BK_RETURN(B, 0);
+
+ error:
+  bk_dynamic_stats_destroy(B, pc->pc_stats);
+  pc->pc_stats = NULL;
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * Count WINDOW_EVENTS events and take three samples within one second,
+ * then check the windowed figures once that second has completed.
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int windowed(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_dynstats");
+  struct bk_dynamic_stat_window_values rate, window;
+  bk_dynamic_stat_h gauge = NULL;
+  u_int x;
+
+  if (!(pc->pc_stats = bk_dynamic_stats_create(B, 0)) ||
+      bk_dynamic_stat_register_simple(B, pc->pc_stats, STAT_NAME, 0, 0, DynamicStatsValueTypeRate, DynamicStatsAccessTypeDirect, NULL, NULL, NULL, &pc->pc_stat, 0) < 0 ||
+      bk_dynamic_stat_register_simple(B, pc->pc_stats, "queue depth", 0, 0, DynamicStatsValueTypeWindow, DynamicStatsAccessTypeDirect, NULL, NULL, NULL, &gauge, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not create windowed stats\n");
+    goto error;
+  }
+
+  nextsecond();
+  for (x = 0; x < WINDOW_EVENTS; x++)
+    bk_dynamic_stat_handle_increment(B, pc->pc_stat);
+  bk_dynamic_stat_handle_set(B, gauge, 5, 0);
+  bk_dynamic_stat_handle_set(B, gauge, 10, 0);
+  bk_dynamic_stat_handle_set(B, gauge, 15, 0);
+  nextsecond();
+
+  if (bk_dynamic_stat_window_get(B, pc->pc_stat, &rate, 0) < 0 ||
+      bk_dynamic_stat_window_get(B, gauge, &window, 0) < 0)
+  {
+    fprintf(stderr, "Could not get windowed figures\n");
+    goto error;
+  }
+
+  printf("rate: total %lld, %.2f/s over 1s, %.2f/s over 10s, %.2f/s over 60s, ewma %.2f\n",
+	 (long long)rate.bdswv_value, rate.bdswv_1s, rate.bdswv_10s, rate.bdswv_60s, rate.bdswv_ewma);
+
+  if (rate.bdswv_value != WINDOW_EVENTS || rate.bdswv_1s != WINDOW_EVENTS || rate.bdswv_10s != WINDOW_EVENTS / 10.0 ||
+      rate.bdswv_max != WINDOW_EVENTS || rate.bdswv_min != 0 || rate.bdswv_ewma <= 0 || rate.bdswv_ewma >= WINDOW_EVENTS)
+  {
+    fprintf(stderr, "Rate figures are wrong\n");
+    goto error;
+  }
+
+  if (window.bdswv_value != 15 || window.bdswv_1s != 10 || window.bdswv_60s != 10 ||
+      window.bdswv_min != 5 || window.bdswv_max != 15 || window.bdswv_ewma != 10)
+  {
+    fprintf(stderr, "Window figures are wrong (mean %.2f, min %lld, max %lld, ewma %.2f)\n",
+	    window.bdswv_1s, (long long)window.bdswv_min, (long long)window.bdswv_max, window.bdswv_ewma);
+    goto error;
+  }
+
+  bk_dynamic_stats_destroy(B, pc->pc_stats);
+  pc->pc_stats = NULL;
+  BK_RETURN(B, 0);
+
+ error:
+  if (pc->pc_stats)
+    bk_dynamic_stats_destroy(B, pc->pc_stats);
+  pc->pc_stats = NULL;
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * Export the stats to shared memory, check that a reader attached by name
+ * sees the same values, and time a reader's copy against the XML which
+ * a monitor would otherwise have the process build.
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int exported(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_dynstats");
+  struct bk_dynamic_stats_export *bdse = NULL, *reader = NULL, *other = NULL;
+  struct bk_dynamic_stats_export_snapshot *snapshot = NULL;
+  struct bk_dynamic_stats_export_record *rec;
+  char name[64];
+  u_int64_t start, readns, xmlns;
+  u_int64_t version;
+  char *xml;
+  u_int x;
+
+  snprintf(name, sizeof(name), "/test_dynstats.%d", (int)getpid());
+
+  if (!(pc->pc_stats = bk_dynamic_stats_create(B, 0)) ||
+      bk_global_dynamic_stats_register(B, pc->pc_stats, 0) < 0 ||
+      bk_dynamic_stat_register_simple(B, pc->pc_stats, STAT_NAME, 0, 0, DynamicStatsValueTypeUInt64, DynamicStatsAccessTypeDirect, NULL, NULL, NULL, &pc->pc_stat, 0) < 0 ||
+      bk_dynamic_stat_handle_set(B, pc->pc_stat, 12345, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not create stats list\n");
+    goto error;
+  }
+
+  if (!(bdse = bk_dynamic_stats_export_create(B, pc->pc_stats, name, EXPORT_BYTES, 0, 0600, NULL, 0, 0)) ||
+      !(reader = bk_dynamic_stats_export_attach(B, name, 0)))
+  {
+    fprintf(stderr, "Could not export stats to %s\n", name);
+    goto error;
+  }
+
+  // A live export must not be taken over
+  if ((other = bk_dynamic_stats_export_create(B, pc->pc_stats, name, EXPORT_BYTES, 0, 0600, NULL, 0, 0)) || errno != EEXIST)
+  {
+    fprintf(stderr, "Second export to %s was not refused\n", name);
+    goto error;
+  }
+
+  if (bk_dynamic_stat_handle_add(B, pc->pc_stat, 1, 0) < 0 || bk_dynamic_stats_export_update(B, bdse, 0) < 0)
+  {
+    fprintf(stderr, "Could not republish stats\n");
+    goto error;
+  }
+
+  start = nsnow();
+  for (x = 0; x < EXPORT_READS; x++)
+  {
+    if (!(snapshot = bk_dynamic_stats_export_read(B, reader, &version, NULL, 0)))
+    {
+      fprintf(stderr, "Could not read exported stats\n");
+      goto error;
+    }
+  }
+  readns = nsnow() - start;
+
+  for (x = 0, rec = BK_DYNAMIC_STATS_EXPORT_FIRST(snapshot); x < snapshot->bdses_count; x++, rec = BK_DYNAMIC_STATS_EXPORT_NEXT(rec))
+  {
+    if (!strcmp(rec->bdser_name, STAT_NAME))
+      break;
+  }
+
+  if (x == snapshot->bdses_count || rec->bdser_type != DynamicStatsValueTypeUInt64 || rec->bdser_value.bdserv_uint != 12346 || version != 2)
+  {
+    fprintf(stderr, "Exported %s missing or wrong (%u stats, version %llu)\n", STAT_NAME, snapshot->bdses_count, (unsigned long long)version);
+    goto error;
+  }
+
+  start = nsnow();
+  for (x = 0; x < EXPORT_READS; x++)
+  {
+    if (!(xml = bk_dynamic_stats_XML_create(B, pc->pc_stats, 0, "", 0)))
+    {
+      fprintf(stderr, "Could not create XML stats\n");
+      goto error;
+    }
+    bk_dynamic_stats_XML_destroy(B, xml, 0);
+  }
+  xmlns = nsnow() - start;
+
+  printf("%u stats: export read %.2f ns, XML create %.2f ns\n", snapshot->bdses_count, (double)readns / EXPORT_READS, (double)xmlns / EXPORT_READS);
+
+  bk_dynamic_stats_export_destroy(B, reader, 0);
+  bk_dynamic_stats_export_destroy(B, bdse, 0);
+  bk_dynamic_stats_destroy(B, pc->pc_stats);
+  pc->pc_stats = NULL;
+  BK_RETURN(B, 0);
+
+ error:
+  if (other)
+    bk_dynamic_stats_export_destroy(B, other, 0);
+  if (reader)
+    bk_dynamic_stats_export_destroy(B, reader, 0);
+  if (bdse)
+    bk_dynamic_stats_export_destroy(B, bdse, 0);
+  if (pc->pc_stats)
+    bk_dynamic_stats_destroy(B, pc->pc_stats);
+  pc->pc_stats = NULL;
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * Time on-demand updates of the global stats without and then with a
+ * collector sampling them in the background, and check that the collector
+ * really does keep the CPU time current.
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int collected(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_dynstats");
+  struct bk_dynamic_stats_collector *bdsc = NULL;
+  u_int64_t start, demandns, collectns, samples;
+  float before, after;
+  volatile u_int spin = 0;
+  u_int x;
+
+  if (!(pc->pc_stats = bk_dynamic_stats_create(B, 0)) ||
+      bk_global_dynamic_stats_register(B, pc->pc_stats, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not create stats list\n");
+    goto error;
+  }
+
+  start = nsnow();
+  for (x = 0; x < COLLECT_UPDATES; x++)
+  {
+    if (bk_dynamic_stats_demand_update(B, pc->pc_stats, 0) < 0)
+    {
+      fprintf(stderr, "Could not update stats on demand\n");
+      goto error;
+    }
+  }
+  demandns = nsnow() - start;
+
+  if (!(bdsc = bk_dynamic_stats_collector_create(B, pc->pc_stats, NULL, COLLECT_MSECS, 0)))
+  {
+    fprintf(stderr, "Could not create stats collector\n");
+    goto error;
+  }
+
+  start = nsnow();
+  for (x = 0; x < COLLECT_UPDATES; x++)
+  {
+    if (bk_dynamic_stats_demand_update(B, pc->pc_stats, 0) < 0)
+    {
+      fprintf(stderr, "Could not update collected stats\n");
+      goto error;
+    }
+  }
+  collectns = nsnow() - start;
+
+  // Burn some CPU, then give the sampler a few intervals to notice
+  if (cpu_time(B, pc, &before) < 0)
+    goto error;
+  start = nsnow();
+  while (nsnow() - start < 200000000)
+    spin++;
+  usleep(COLLECT_MSECS * 4000);
+  if (cpu_time(B, pc, &after) < 0)
+    goto error;
+  samples = bk_dynamic_stats_collector_samples(B, bdsc);
+
+  printf("demand update %.2f us, with collector %.2f us (%llu samples, cpu %.3f -> %.3f)\n",
+	 (double)demandns / COLLECT_UPDATES / 1000, (double)collectns / COLLECT_UPDATES / 1000,
+	 (unsigned long long)samples, before, after);
+
+  if (samples < 3 || after < before + 0.1)
+  {
+    fprintf(stderr, "Collector is not keeping CPU time current\n");
+    goto error;
+  }
+
+  bk_dynamic_stats_collector_destroy(B, bdsc, 0);
+  bk_dynamic_stats_destroy(B, pc->pc_stats);
+  pc->pc_stats = NULL;
+  BK_RETURN(B, 0);
+
+ error:
+  if (bdsc)
+    bk_dynamic_stats_collector_destroy(B, bdsc, 0);
+  if (pc->pc_stats)
+    bk_dynamic_stats_destroy(B, pc->pc_stats);
+  pc->pc_stats = NULL;
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * Read the total CPU time stat, as a monitor would
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@param cpup C/O total CPU time
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int cpu_time(bk_s B, struct program_config *pc, float *cpup)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_dynstats");
+  bk_dynamic_stat_value_u value;
+
+  if (bk_dynamic_stats_demand_update(B, pc->pc_stats, 0) < 0 ||
+      bk_dynamic_stat_get(B, pc->pc_stats, BK_DYNAMIC_STAT_DEFAULT_NAME_CPU_TIME, 0, NULL, &value, NULL, NULL, NULL, 0) < 0)
+  {
+    fprintf(stderr, "Could not read %s\n", BK_DYNAMIC_STAT_DEFAULT_NAME_CPU_TIME);
+    BK_RETURN(B, -1);
+  }
+
+  *cpup = value.bdsv_float;
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Incrementer thread: bump the counter pc_count times
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param opaque Program configuration
+ *	@return <i>NULL</i> always
+ */
+static void *incrementer(bk_s B, void *opaque)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_dynstats");
+  struct program_config *pc = opaque;
+  u_int x;
+
+  for (x = 0; x < pc->pc_count; x++)
+  {
+    if (BK_FLAG_ISSET(pc->pc_flags, PC_BYHANDLE))
+      bk_dynamic_stat_handle_increment(B, pc->pc_stat);
+    else
+      bk_dynamic_stat_increment(B, pc->pc_stats, STAT_NAME, 0, 0, (u_int64_t)1);
+  }
+
+  BK_RETURN(B, NULL);
+}
+
+
+
+/**
+ * Monotonic time in nanoseconds, for throughput measurement
+ *
+ *	@return <i>nanoseconds</i> since some arbitrary point
+ */
+static inline u_int64_t nsnow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+
+
+/**
+ * Wait for the start of the next second of the clock windowed stats use
+ */
+static void nextsecond(void)
+{
+  u_int64_t start = bk_shmmap_nowms() / 1000;
+
+  while (bk_shmmap_nowms() / 1000 == start)
+    usleep(1000);
+}
@@ -42,6 +42,7 @@ struct program_config
 #define PC_STDERR	2
 #define PC_SYSLOG	4
 #define PC_QUEUE	8
+#define PC_ASYNC	16
 };
 
 
@@ -60,6 +61,7 @@ main(int argc, char **argv, char **envp)
   poptContext optCon = NULL;
   int c;
   int getopterr = 0;
+  bk_flags initflags = 0;
   extern char *optarg;
   extern int optind;
   struct program_config Pconfig, *pconfig;
@@ -70,13 +72,24 @@ main(int argc, char **argv, char **envp)
     {"stderr", 'e', POPT_ARG_NONE, NULL, 'e', "Errors to stderr", NULL },
     {"syslog", 's', POPT_ARG_NONE, NULL, 's', "Errors to syslog", NULL },
     {"queue", 'q', POPT_ARG_NONE, NULL, 'q', "Dump error queue before exiting", NULL },
+    {"async", 'a', POPT_ARG_NONE, NULL, 'a', "Raise errors through a background flusher", NULL },
 
     POPT_AUTOHELP
     POPT_TABLEEND
   };
 
 
-  if (!(B=bk_general_init(argc, &argv, &envp, BK_ENV_GWD(B, "BK_ENV_CONF_APP", BK_APP_CONF), NULL, ERRORQUEUE_DEPTH, LOG_USER, 0)))
+  /*
+   * Only -a needs threads, and they must be ready before popt runs.
+   * None of our options take arguments, so any short flag group may hold it.
+   */
+  for (c = 1; c < argc; c++)
+  {
+    if (!strcmp(argv[c], "--async") || (argv[c][0] == '-' && argv[c][1] != '-' && strchr(argv[c], 'a')))
+      initflags = BK_GENERAL_THREADREADY;
+  }
+
+  if (!(B=bk_general_init(argc, &argv, &envp, BK_ENV_GWD(B, "BK_ENV_CONF_APP", BK_APP_CONF), NULL, ERRORQUEUE_DEPTH, LOG_USER, initflags)))
   {
     fprintf(stderr,"Could not perform basic initialization\n");
     exit(254);
@@ -125,6 +138,10 @@ main(int argc, char **argv, char **envp)
       BK_FLAG_SET(pconfig->pc_flags, PC_QUEUE);
       break;
 
+    case 'a':
+      BK_FLAG_SET(pconfig->pc_flags, PC_ASYNC);
+      break;
+
     default:
       usage(B);
       break;
@@ -166,7 +183,7 @@ main(int argc, char **argv, char **envp)
  */
 void usage(bk_s B)
 {
-  fprintf(stderr,"Usage: %s: [-desvq]\n",BK_GENERAL_PROGRAM(B));
+  fprintf(stderr,"Usage: %s: [-desvqa]\n",BK_GENERAL_PROGRAM(B));
 }
 
 
@@ -190,6 +207,12 @@ int proginit(bk_s B, struct program_config *pconfig)
   bk_error_config(B, BK_GENERAL_ERROR(B), ERRORQUEUE_DEPTH, fh, sysloglevel, BK_ERR_WARN,
 		  BK_ERROR_CONFIG_FH | BK_ERROR_CONFIG_SYSLOGTHRESHOLD | BK_ERROR_CONFIG_HILO_PIVOT);
 
+  if (BK_FLAG_ISSET(pconfig->pc_flags, PC_ASYNC) && bk_error_async(B, 0, 0, 0) < 0)
+  {
+    fprintf(stderr, "Could not make error handling asynchronous\n");
+    BK_RETURN(B, -1);
+  }
+
   BK_RETURN(B, 0);
 }
 
@@ -267,6 +290,12 @@ void progrun(bk_s B, struct program_config *pconfig)
     bk_error_printf(B, BK_ERR_WARN, "Warning test 4 %d\n",cnt);
   }
 
+  if (BK_FLAG_ISSET(pconfig->pc_flags, PC_ASYNC))
+  {
+    bk_error_sync(B);
+    fprintf(stderr, "%llu error messages dropped\n", (unsigned long long)bk_error_dropped(B));
+  }
+
   bk_warn(B,stderr,"This is a warning\n",BK_FLAG_ISSET(pconfig->pc_flags, PC_VERBOSE)?BK_WARNDIE_WANTDETAILS:0);
   bk_die(B,254,stderr,"This is a fatal error\n",BK_FLAG_ISSET(pconfig->pc_flags, PC_VERBOSE)?BK_WARNDIE_WANTDETAILS:0);
 
@@ -48,7 +48,10 @@ static int FUN_ON = 1;
 
 
 int proginit(bk_s B);
-void progrun(bk_s B);
+int progrun(bk_s B);
+void progtime(bk_s B, int count);
+int timed(bk_s B, int x);
+u_int32_t debuglevel(bk_s B);
 void recurse(bk_s B, int levels, enum command cmd);
 void recurse2(bk_s B, int levels, enum command cmd);
 
@@ -64,11 +67,16 @@ main(int argc, char **argv, char **envp)
   poptContext optCon=NULL;
   const char *arg;
   int debugging = 0;
+  int timecount = 0;
+  int funstats = 0;
+  int ret = 0;
   struct poptOption optionsTable[] =
   {
     {"debug", 'd', POPT_ARG_NONE, NULL, 'd', "Turn on debugging", NULL },
     {"syslog-level", 's', POPT_ARG_INT, NULL, 's', "Syslog level (default 0=debug)", NULL },
     {"no-seatbelts", 'n', POPT_ARG_NONE, NULL, 'n', "Sealtbelts off & speed up", NULL },
+    {"time", 't', POPT_ARG_INT, NULL, 't', "Time this many traced calls", "count" },
+    {"funstats", 'S', POPT_ARG_NONE, NULL, 'S', "Keep and print function statistics", NULL },
     POPT_AUTOHELP
     POPT_TABLEEND
   };
@@ -100,6 +108,13 @@ main(int argc, char **argv, char **envp)
       arg = poptGetOptArg(optCon);
       Global.gs_sysloglevel = BK_ERR_DEBUG - atoi(arg ? arg : "0");
       break;
+    case 't':
+      arg = poptGetOptArg(optCon);
+      timecount = atoi(arg ? arg : "0");
+      break;
+    case 'S':
+      funstats = 1;
+      break;
     default:
       getopterr++;
       break;
@@ -121,7 +136,18 @@ main(int argc, char **argv, char **envp)
     bk_die(B,254,stderr,"Could not perform program initialization\n",0);
   }
 
-  progrun(B);
+  if (funstats && bk_general_funstat_init(B, "/dev/null", 0) < 0)
+  {
+    bk_die(B,254,stderr,"Could not enable function statistics\n",0);
+  }
+
+  if (timecount > 0)
+    progtime(B, timecount);
+  else
+    ret = progrun(B);
+
+  if (funstats)
+    bk_fun_stats_dump(B, stdout, 0);
 
   if (!debugging)
   {
@@ -129,7 +155,7 @@ main(int argc, char **argv, char **envp)
     bk_error_dump(B,stderr,NULL,BK_ERR_DEBUG,BK_ERR_NONE,0);
   }
 
-  bk_exit(B,0);
+  bk_exit(B,ret);
   abort();
   BK_RETURN(B,255);				/* Insight is stupid */
 }
@@ -149,12 +175,13 @@ int proginit(bk_s B)
 
 
 /*
- * Normal processing
+ * Normal processing: 0 on success, 1 if a check failed
  */
-void progrun(bk_s B)
+int progrun(bk_s B)
 {
   BK_ENTRY(B, __FUNCTION__,__FILE__,"SIMPLE");
   int x;
+  int ret = 0;
 
   recurse(B, 9, badreturn);
   recurse(B, 9, trace);
@@ -171,11 +198,73 @@ void progrun(bk_s B)
     recurse(B, 999, noop);
   recurse(B, 999, resetdebug);
 
+  // A call site's cached debug level must follow bk_debug_set
+  if (FUN_ON && BK_GENERAL_FLAG_ISDEBUGON(B))
+  {
+    u_int32_t level = debuglevel(B) + 1;
+
+    if (bk_debug_set(B, BK_GENERAL_DEBUG(B), "debuglevel", level) < 0)
+    {
+      fprintf(stderr, "Could not set debug level %u\n", level);
+      ret = 1;
+    }
+    else if (debuglevel(B) != level)
+    {
+      fprintf(stderr, "Stale debug level %u after setting %u\n", debuglevel(B), level);
+      ret = 1;
+    }
+  }
+
+  BK_RETURN(B, ret);
+}
+
+
+
+/*
+ * Time BK_ENTRY/BK_RETURN pairs
+ */
+void progtime(bk_s B, int count)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"SIMPLE");
+  struct timespec start, end;
+  int x, sum = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for(x=0;x<count;x++)
+    sum += timed(B, x);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  printf("%d traced calls, %.2f ns/call (%d)\n", count, ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / count, sum & 1);
+
   BK_VRETURN(B);
 }
 
 
 
+/*
+ * Smallest possible traced function
+ */
+int timed(bk_s B, int x)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "SIMPLE");
+
+  BK_RETURN(B, x);
+}
+
+
+
+/*
+ * This function's own debug level
+ */
+u_int32_t debuglevel(bk_s B)
+{
+  BK_ENTRY(B, __FUNCTION__, __FILE__, "SIMPLE");
+
+  BK_RETURN(B, BK_BT_CURFUN(B) ? BK_BT_CURFUN(B)->bf_debuglevel : 0);
+}
+
+
+
 /*
  * Push down through the stack
  */
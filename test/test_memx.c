@@ -0,0 +1,250 @@
+#if !defined(lint)
+static const char libbk__copyright[] = "Copyright © 2001-2011";
+static const char libbk__contact[] = "<projectbaka@baka.org>";
+#endif /* not lint */
+/*
+ * ++Copyright BAKA++
+ *
+ * Copyright © 2001-2011 The Authors. All rights reserved.
+ *
+ * This source code is licensed to you under the terms of the file
+ * LICENSE.TXT in this release for further details.
+ *
+ * Send e-mail to <projectbaka@baka.org> for further information.
+ *
+ * - -Copyright BAKA- -
+ */
+
+/**
+ * @file
+ *
+ * Check and time bk_memx growth: append many elements one at a time with
+ * the fixed increment, with geometric growth, and after a reserve, then
+ * drain the array from the front with lop, verifying contents throughout.
+ */
+#include <libbk.h>
+
+
+
+#define ERRORQUEUE_DEPTH	32		///< Default error queue depth
+#define DEFAULT_COUNT		10000000	///< Elements appended
+#define DEFAULT_INCR		128		///< Fixed growth increment
+#define LOP_CHUNK		1000		///< Elements lopped at a time
+
+
+
+/**
+ * Information about basic program runtime configuration
+ * which must be passed around.
+ */
+struct program_config
+{
+  bk_flags		pc_flags;		///< Flags are fun!
+#define PC_VERBOSE	0x001			///< Verbose output
+  u_int			pc_count;		///< Elements appended
+  u_int			pc_incr;		///< Growth increment hint
+};
+
+
+
+static int progrun(bk_s B, struct program_config *pc);
+static int runone(bk_s B, struct program_config *pc, const char *name, bk_flags createflags, int reserve);
+static inline u_int64_t nsnow(void);
+
+
+
+/**
+ * Program entry point
+ *
+ *	@param argc Number of argv elements
+ *	@param argv Program name and arguments
+ *	@param envp Program environment
+ *	@return <i>0</i> Success
+ *	@return <br><i>1</i> Contents were wrong
+ *	@return <br><i>254</i> Initialization failed
+ */
+int
+main(int argc, char **argv, char **envp)
+{
+  bk_s B = NULL;				/* Baka general structure */
+  BK_ENTRY_MAIN(B, __FUNCTION__, __FILE__, "test_memx");
+  int c;
+  int getopterr = 0;
+  struct program_config Pconfig, *pc = NULL;
+  poptContext optCon = NULL;
+  struct poptOption optionsTable[] =
+  {
+    {"debug", 'd', POPT_ARG_NONE, NULL, 'd', "Turn on debugging", NULL },
+    {"verbose", 'v', POPT_ARG_NONE, NULL, 'v', "Turn on verbose message", NULL },
+    {"count", 'c', POPT_ARG_INT, NULL, 'c', "Elements to append", "count" },
+    {"incr", 'i', POPT_ARG_INT, NULL, 'i', "Growth increment hint", "incr" },
+    POPT_AUTOHELP
+    POPT_TABLEEND
+  };
+
+  if (!(B=bk_general_init(argc, &argv, &envp, BK_ENV_GWD(B, "BK_ENV_CONF_APP", BK_APP_CONF), NULL, ERRORQUEUE_DEPTH, LOG_USER, 0)))
+  {
+    fprintf(stderr,"Could not perform basic initialization\n");
+    exit(254);
+  }
+  bk_fun_reentry(B);
+
+  pc = &Pconfig;
+  memset(pc, 0, sizeof(*pc));
+  pc->pc_count = DEFAULT_COUNT;
+  pc->pc_incr = DEFAULT_INCR;
+
+  if (!(optCon = poptGetContext(NULL, argc, (const char **)argv, optionsTable, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not initialize options processing\n");
+    bk_exit(B, 254);
+  }
+
+  while ((c = poptGetNextOpt(optCon)) >= 0)
+  {
+    switch (c)
+    {
+    case 'd':					// debug
+      bk_error_config(B, BK_GENERAL_ERROR(B), 0, stderr, 0, 0, BK_ERROR_CONFIG_FH);	// Enable output of all error logs
+      bk_general_debug_config(B, stderr, BK_ERR_NONE, 0);				// Set up debugging, from config file
+      bk_debug_printf(B, "Debugging on\n");
+      break;
+    case 'v':					// verbose
+      BK_FLAG_SET(pc->pc_flags, PC_VERBOSE);
+      bk_error_config(B, BK_GENERAL_ERROR(B), ERRORQUEUE_DEPTH, stderr, BK_ERR_NONE, BK_ERR_ERR, 0);
+      break;
+    case 'c':
+      pc->pc_count = atoi(poptGetOptArg(optCon));
+      break;
+    case 'i':
+      pc->pc_incr = atoi(poptGetOptArg(optCon));
+      break;
+    default:
+      getopterr++;
+      break;
+    }
+  }
+
+  if (c < -1 || getopterr || !pc->pc_count)
+  {
+    if (c < -1)
+    {
+      fprintf(stderr, "%s\n", poptStrerror(c));
+    }
+    poptPrintUsage(optCon, stderr, 0);
+    bk_exit(B, 254);
+  }
+
+  bk_exit(B, progrun(B, pc) < 0 ? 1 : 0);
+  return(255);					// Stupid INSIGHT stuff.
+}
+
+
+
+/**
+ * Run each growth policy in turn
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Some run failed
+ */
+static int progrun(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_memx");
+  int ret = 0;
+
+  printf("%-12s %14s %14s\n", "policy", "append ns/op", "lop ns/call");
+
+  if (runone(B, pc, "increment", 0, 0) < 0)
+    ret = -1;
+  if (runone(B, pc, "geometric", BK_MEMX_GEOMETRIC, 0) < 0)
+    ret = -1;
+  if (runone(B, pc, "reserve", 0, 1) < 0)
+    ret = -1;
+
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Append pc_count elements, then lop them off LOP_CHUNK at a time,
+ * checking the front element after every lop.
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@param name Policy name to print
+ *	@param createflags Flags for bk_memx_create
+ *	@param reserve Reserve room for everything up front
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int runone(bk_s B, struct program_config *pc, const char *name, bk_flags createflags, int reserve)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_memx");
+  struct bk_memx *bm;
+  u_int64_t start, appendns, lopns;
+  u_int x, *first;
+
+  if (!(bm = bk_memx_create(B, sizeof(u_int), 1, pc->pc_incr, createflags)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not create memx\n");
+    BK_RETURN(B, -1);
+  }
+
+  start = nsnow();
+  if (reserve && bk_memx_reserve(B, bm, pc->pc_count, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not reserve %u elements\n", pc->pc_count);
+    goto error;
+  }
+  for (x = 0; x < pc->pc_count; x++)
+  {
+    if (bk_memx_append(B, bm, &x, 1, 0) < 0)
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not append element %u\n", x);
+      goto error;
+    }
+  }
+  appendns = nsnow() - start;
+
+  start = nsnow();
+  for (x = 0; x < pc->pc_count; x += LOP_CHUNK)
+  {
+    if (!(first = bk_memx_get(B, bm, 0, NULL, 0)) || *first != x)
+    {
+      fprintf(stderr, "%s: element %u is wrong after lop\n", name, x);
+      goto error;
+    }
+    if (bk_memx_lop(B, bm, BK_MIN(LOP_CHUNK, pc->pc_count - x), 0) < 0)
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not lop at %u\n", x);
+      goto error;
+    }
+  }
+  lopns = nsnow() - start;
+
+  printf("%-12s %14.2f %14.2f\n", name, (double)appendns / pc->pc_count, (double)lopns * LOP_CHUNK / pc->pc_count);
+  bk_memx_destroy(B, bm, 0);
+  BK_RETURN(B, 0);
+
+ error:
+  bk_memx_destroy(B, bm, 0);
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * Monotonic time in nanoseconds, for throughput measurement
+ *
+ *	@return <i>nanoseconds</i> since some arbitrary point
+ */
+static inline u_int64_t nsnow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
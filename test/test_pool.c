@@ -0,0 +1,268 @@
+#if !defined(lint)
+static const char libbk__copyright[] = "Copyright © 2001-2011";
+static const char libbk__contact[] = "<projectbaka@baka.org>";
+#endif /* not lint */
+/*
+ * ++Copyright BAKA++
+ *
+ * Copyright © 2001-2011 The Authors. All rights reserved.
+ *
+ * This source code is licensed to you under the terms of the file
+ * LICENSE.TXT in this release for further details.
+ *
+ * Send e-mail to <projectbaka@baka.org> for further information.
+ *
+ * - -Copyright BAKA- -
+ */
+
+/**
+ * @file
+ *
+ * Time bk_pool against malloc/free for a working set of small objects
+ * allocated and freed in rounds, verifying object contents throughout,
+ * and print the pool's hit/miss counts.
+ */
+#include <libbk.h>
+
+
+
+#define ERRORQUEUE_DEPTH	32		///< Default error queue depth
+#define DEFAULT_ROUNDS		100000		///< Rounds of alloc/free
+#define DEFAULT_WORKING		64		///< Objects held per round
+#define OBJSIZE			48		///< Object size (roughly a bk_ioh_data)
+
+
+
+/**
+ * Information about basic program runtime configuration
+ * which must be passed around.
+ */
+struct program_config
+{
+  bk_flags		pc_flags;		///< Flags are fun!
+#define PC_VERBOSE	0x001			///< Verbose output
+  u_int			pc_rounds;		///< Rounds of alloc/free
+  u_int			pc_working;		///< Objects held per round
+};
+
+
+
+static int progrun(bk_s B, struct program_config *pc);
+static int runone(bk_s B, struct program_config *pc, const char *name, struct bk_pool *pool);
+static inline u_int64_t nsnow(void);
+
+
+
+/**
+ * Program entry point
+ *
+ *	@param argc Number of argv elements
+ *	@param argv Program name and arguments
+ *	@param envp Program environment
+ *	@return <i>0</i> Success
+ *	@return <br><i>1</i> Contents were wrong
+ *	@return <br><i>254</i> Initialization failed
+ */
+int
+main(int argc, char **argv, char **envp)
+{
+  bk_s B = NULL;				/* Baka general structure */
+  BK_ENTRY_MAIN(B, __FUNCTION__, __FILE__, "test_pool");
+  int c;
+  int getopterr = 0;
+  struct program_config Pconfig, *pc = NULL;
+  poptContext optCon = NULL;
+  struct poptOption optionsTable[] =
+  {
+    {"debug", 'd', POPT_ARG_NONE, NULL, 'd', "Turn on debugging", NULL },
+    {"verbose", 'v', POPT_ARG_NONE, NULL, 'v', "Turn on verbose message", NULL },
+    {"rounds", 'r', POPT_ARG_INT, NULL, 'r', "Rounds of alloc/free", "rounds" },
+    {"working", 'w', POPT_ARG_INT, NULL, 'w', "Objects held per round", "working" },
+    POPT_AUTOHELP
+    POPT_TABLEEND
+  };
+
+  if (!(B=bk_general_init(argc, &argv, &envp, BK_ENV_GWD(B, "BK_ENV_CONF_APP", BK_APP_CONF), NULL, ERRORQUEUE_DEPTH, LOG_USER, 0)))
+  {
+    fprintf(stderr,"Could not perform basic initialization\n");
+    exit(254);
+  }
+  bk_fun_reentry(B);
+
+  pc = &Pconfig;
+  memset(pc, 0, sizeof(*pc));
+  pc->pc_rounds = DEFAULT_ROUNDS;
+  pc->pc_working = DEFAULT_WORKING;
+
+  if (!(optCon = poptGetContext(NULL, argc, (const char **)argv, optionsTable, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not initialize options processing\n");
+    bk_exit(B, 254);
+  }
+
+  while ((c = poptGetNextOpt(optCon)) >= 0)
+  {
+    switch (c)
+    {
+    case 'd':					// debug
+      bk_error_config(B, BK_GENERAL_ERROR(B), 0, stderr, 0, 0, BK_ERROR_CONFIG_FH);	// Enable output of all error logs
+      bk_general_debug_config(B, stderr, BK_ERR_NONE, 0);				// Set up debugging, from config file
+      bk_debug_printf(B, "Debugging on\n");
+      break;
+    case 'v':					// verbose
+      BK_FLAG_SET(pc->pc_flags, PC_VERBOSE);
+      bk_error_config(B, BK_GENERAL_ERROR(B), ERRORQUEUE_DEPTH, stderr, BK_ERR_NONE, BK_ERR_ERR, 0);
+      break;
+    case 'r':
+      pc->pc_rounds = atoi(poptGetOptArg(optCon));
+      break;
+    case 'w':
+      pc->pc_working = atoi(poptGetOptArg(optCon));
+      break;
+    default:
+      getopterr++;
+      break;
+    }
+  }
+
+  if (c < -1 || getopterr || !pc->pc_rounds || !pc->pc_working)
+  {
+    if (c < -1)
+    {
+      fprintf(stderr, "%s\n", poptStrerror(c));
+    }
+    poptPrintUsage(optCon, stderr, 0);
+    bk_exit(B, 254);
+  }
+
+  bk_exit(B, progrun(B, pc) < 0 ? 1 : 0);
+  return(255);					// Stupid INSIGHT stuff.
+}
+
+
+
+/**
+ * Run malloc and then the pool, and show the pool statistics
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Some run failed
+ */
+static int progrun(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_pool");
+  struct bk_pool *pool = NULL;
+  bk_dynamic_stats_h stats_list = NULL;
+  bk_dynamic_stat_value_u value;
+  int ret = 0;
+
+  if (!(pool = bk_pool_create(B, "test", OBJSIZE, 0, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not create pool: %s\n", strerror(errno));
+    BK_RETURN(B, -1);
+  }
+
+  printf("%-8s %14s\n", "alloc", "ns/alloc+free");
+
+  if (runone(B, pc, "malloc", NULL) < 0)
+    ret = -1;
+  if (runone(B, pc, "pool", pool) < 0)
+    ret = -1;
+
+  if (!(stats_list = bk_dynamic_stats_create(B, 0)) || bk_pool_stats_register(B, stats_list, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not register pool statistics\n");
+    ret = -1;
+  }
+  else
+  {
+    if (bk_dynamic_stat_get(B, stats_list, "pool.test.hits", 0, NULL, &value, NULL, NULL, NULL, 0) == 0)
+      printf("pool hits   %llu\n", (unsigned long long)value.bdsv_uint64);
+    if (bk_dynamic_stat_get(B, stats_list, "pool.test.misses", 0, NULL, &value, NULL, NULL, NULL, 0) == 0)
+      printf("pool misses %llu\n", (unsigned long long)value.bdsv_uint64);
+  }
+
+  if (stats_list)
+    bk_dynamic_stats_destroy(B, stats_list);
+  bk_pool_destroy(B, pool, 0);
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Allocate pc_working objects, stamp them, check and free them again,
+ * pc_rounds times.
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@param name Allocator name to print
+ *	@param pool Pool to use, NULL for malloc
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int runone(bk_s B, struct program_config *pc, const char *name, struct bk_pool *pool)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_pool");
+  u_int **objs;
+  u_int64_t start, ns;
+  u_int round, x;
+  int ret = 0;
+
+  if (!(objs = calloc(pc->pc_working, sizeof(*objs))))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not allocate object list: %s\n", strerror(errno));
+    BK_RETURN(B, -1);
+  }
+
+  start = nsnow();
+  for (round = 0; round < pc->pc_rounds && !ret; round++)
+  {
+    for (x = 0; x < pc->pc_working; x++)
+    {
+      if (!(objs[x] = pool?bk_pool_alloc(B, pool, 0):malloc(OBJSIZE)))
+      {
+	bk_error_printf(B, BK_ERR_ERR, "Could not allocate object %u\n", x);
+	ret = -1;
+	break;
+      }
+      *objs[x] = round + x;
+    }
+    for (x = 0; x < pc->pc_working && objs[x]; x++)
+    {
+      if (*objs[x] != round + x)
+      {
+	fprintf(stderr, "%s: object %u of round %u is wrong\n", name, x, round);
+	ret = -1;
+      }
+      if (pool)
+	bk_pool_free(B, pool, objs[x]);
+      else
+	free(objs[x]);
+      objs[x] = NULL;
+    }
+  }
+  ns = nsnow() - start;
+
+  if (!ret)
+    printf("%-8s %14.2f\n", name, (double)ns / ((u_int64_t)pc->pc_rounds * pc->pc_working));
+
+  free(objs);
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Monotonic time in nanoseconds, for throughput measurement
+ *
+ *	@return <i>nanoseconds</i> since some arbitrary point
+ */
+static inline u_int64_t nsnow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
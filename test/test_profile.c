@@ -0,0 +1,255 @@
+#if !defined(lint)
+static const char libbk__copyright[] = "Copyright © 2011";
+static const char libbk__contact[] = "<projectbaka@baka.org>";
+#endif /* not lint */
+/*
+ * ++Copyright BAKA++
+ *
+ * Copyright © 2011 The Authors. All rights reserved.
+ *
+ * This source code is licensed to you under the terms of the file
+ * LICENSE.TXT in this release for further details.
+ *
+ * Send e-mail to <projectbaka@baka.org> for further information.
+ *
+ * - -Copyright BAKA- -
+ */
+
+/**
+ * @file
+ *
+ * Exercise the sampling profiler: burn CPU in traced functions of known
+ * relative cost and print the folded stacks, which should show
+ * burn_heavy with about three times the samples of burn_light.
+ */
+#include <libbk.h>
+
+
+
+#define ERRORQUEUE_DEPTH	32		///< Default error queue depth
+#define DEFAULT_HZ		997		///< Sampling rate
+#define DEFAULT_ROUNDS		2000		///< Rounds of burning
+#define BURN_LIGHT		100000		///< Loop count of light function
+
+
+
+/**
+ * Information about basic program runtime configuration
+ * which must be passed around.
+ */
+struct program_config
+{
+  bk_flags		pc_flags;		///< Flags are fun!
+#define PC_VERBOSE	0x001			///< Verbose output
+  u_int			pc_hz;			///< Sampling rate
+  u_int			pc_rounds;		///< Rounds of burning
+  const char	       *pc_path;		///< Exit dump path
+};
+
+
+
+static int progrun(bk_s B, struct program_config *pc);
+static void descend(bk_s B, u_int depth);
+static void burn_light(bk_s B);
+static void burn_heavy(bk_s B);
+static void burn(u_int count);
+
+static volatile double Sink;			///< Keep the optimizer away
+
+
+
+/**
+ * Program entry point
+ *
+ *	@param argc Number of argv elements
+ *	@param argv Program name and arguments
+ *	@param envp Program environment
+ *	@return <i>0</i> Success
+ *	@return <br><i>1</i> Profiling failed
+ *	@return <br><i>254</i> Initialization failed
+ */
+int
+main(int argc, char **argv, char **envp)
+{
+  bk_s B = NULL;				/* Baka general structure */
+  BK_ENTRY_MAIN(B, __FUNCTION__, __FILE__, "test_profile");
+  int c;
+  int getopterr = 0;
+  struct program_config Pconfig, *pc = NULL;
+  poptContext optCon = NULL;
+  struct poptOption optionsTable[] =
+  {
+    {"debug", 'd', POPT_ARG_NONE, NULL, 'd', "Turn on debugging", NULL },
+    {"verbose", 'v', POPT_ARG_NONE, NULL, 'v', "Turn on verbose message", NULL },
+    {"hz", 'h', POPT_ARG_INT, NULL, 'h', "Samples per CPU second", "hz" },
+    {"rounds", 'r', POPT_ARG_INT, NULL, 'r', "Rounds of burning", "rounds" },
+    {"output", 'o', POPT_ARG_STRING, NULL, 'o', "Also dump to this file at exit", "path" },
+    POPT_AUTOHELP
+    POPT_TABLEEND
+  };
+
+  if (!(B=bk_general_init(argc, &argv, &envp, BK_ENV_GWD(B, "BK_ENV_CONF_APP", BK_APP_CONF), NULL, ERRORQUEUE_DEPTH, LOG_USER, 0)))
+  {
+    fprintf(stderr,"Could not perform basic initialization\n");
+    exit(254);
+  }
+  bk_fun_reentry(B);
+
+  pc = &Pconfig;
+  memset(pc, 0, sizeof(*pc));
+  pc->pc_hz = DEFAULT_HZ;
+  pc->pc_rounds = DEFAULT_ROUNDS;
+
+  if (!(optCon = poptGetContext(NULL, argc, (const char **)argv, optionsTable, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not initialize options processing\n");
+    bk_exit(B, 254);
+  }
+
+  while ((c = poptGetNextOpt(optCon)) >= 0)
+  {
+    switch (c)
+    {
+    case 'd':					// debug
+      bk_error_config(B, BK_GENERAL_ERROR(B), 0, stderr, 0, 0, BK_ERROR_CONFIG_FH);	// Enable output of all error logs
+      bk_general_debug_config(B, stderr, BK_ERR_NONE, 0);				// Set up debugging, from config file
+      bk_debug_printf(B, "Debugging on\n");
+      break;
+    case 'v':					// verbose
+      BK_FLAG_SET(pc->pc_flags, PC_VERBOSE);
+      bk_error_config(B, BK_GENERAL_ERROR(B), ERRORQUEUE_DEPTH, stderr, BK_ERR_NONE, BK_ERR_ERR, 0);
+      break;
+    case 'h':
+      pc->pc_hz = atoi(poptGetOptArg(optCon));
+      break;
+    case 'r':
+      pc->pc_rounds = atoi(poptGetOptArg(optCon));
+      break;
+    case 'o':
+      pc->pc_path = poptGetOptArg(optCon);
+      break;
+    default:
+      getopterr++;
+      break;
+    }
+  }
+
+  if (c < -1 || getopterr || !pc->pc_hz)
+  {
+    if (c < -1)
+    {
+      fprintf(stderr, "%s\n", poptStrerror(c));
+    }
+    poptPrintUsage(optCon, stderr, 0);
+    bk_exit(B, 254);
+  }
+
+  bk_exit(B, progrun(B, pc) < 0 ? 1 : 0);
+  return(255);					// Stupid INSIGHT stuff.
+}
+
+
+
+/**
+ * Profile some rounds of burning and print the result
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int progrun(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_profile");
+  u_int x;
+
+  if (bk_profile_start(B, pc->pc_hz, 0, pc->pc_path, pc->pc_path?BK_PROFILE_ATEXIT:0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not start profiler\n");
+    BK_RETURN(B, -1);
+  }
+
+  for (x = 0; x < pc->pc_rounds; x++)
+    descend(B, x % 3);
+
+  bk_profile_stop(B, 0);
+
+  if (bk_profile_dump(B, stdout, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not dump profile\n");
+    BK_RETURN(B, -1);
+  }
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Recurse a little so stacks differ, then burn
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param depth Levels left
+ */
+static void descend(bk_s B, u_int depth)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_profile");
+
+  if (depth)
+  {
+    descend(B, depth - 1);
+    BK_VRETURN(B);
+  }
+
+  burn_light(B);
+  burn_heavy(B);
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Burn one unit of CPU
+ *
+ *	@param B BAKA Thread/Global configuration
+ */
+static void burn_light(bk_s B)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_profile");
+
+  burn(BURN_LIGHT);
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Burn three units of CPU
+ *
+ *	@param B BAKA Thread/Global configuration
+ */
+static void burn_heavy(bk_s B)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_profile");
+
+  burn(BURN_LIGHT * 3);
+
+  BK_VRETURN(B);
+}
+
+
+
+/**
+ * Spin
+ *
+ *	@param count Iterations
+ */
+static void burn(u_int count)
+{
+  u_int x;
+
+  for (x = 0; x < count; x++)
+    Sink += x * 0.5;
+}
@@ -0,0 +1,463 @@
+#if !defined(lint)
+static const char libbk__copyright[] = "Copyright © 2003-2011";
+static const char libbk__contact[] = "<projectbaka@baka.org>";
+#endif /* not lint */
+/*
+ * ++Copyright BAKA++
+ *
+ * Copyright © 2003-2011 The Authors. All rights reserved.
+ *
+ * This source code is licensed to you under the terms of the file
+ * LICENSE.TXT in this release for further details.
+ *
+ * Send e-mail to <projectbaka@baka.org> for further information.
+ *
+ * - -Copyright BAKA- -
+ */
+
+/**
+ * @file
+ *
+ * Correctness and scaling test for bk_queue: for 1, 2, 4, ... threads
+ * (half producers, half consumers) push a known series of values through
+ * one queue, check every value came out exactly once, and report
+ * operations per second for single and batch operations.
+ */
+#include <libbk.h>
+
+
+
+#define ERRORQUEUE_DEPTH	32		///< Default error queue depth
+#define DEFAULT_COUNT		1000000		///< Objects per producer
+#define DEFAULT_SIZE		1024		///< Queue size
+#define DEFAULT_MAXTHREADS	32		///< Largest thread count tried
+#define DEFAULT_BATCH		16		///< Objects per batch operation
+#define MAX_BATCH		256		///< Largest batch we allow
+
+
+
+/**
+ * Information about basic program runtime configuration
+ * which must be passed around.
+ */
+struct program_config
+{
+  bk_flags		pc_flags;		///< Flags are fun!
+#define PC_VERBOSE	0x001			///< Verbose output
+  u_int			pc_count;		///< Objects per producer
+  u_int			pc_size;		///< Queue size
+  u_int			pc_maxthreads;		///< Largest thread count tried
+  u_int			pc_batch;		///< Objects per batch operation
+  u_int			pc_runbatch;		///< Batch size of the current run (0 for single)
+  struct bk_queue      *pc_queue;		///< Queue under test
+  u_int			pc_nextid;		///< Next producer id
+  u_int64_t		pc_sum;			///< Sum of everything consumed
+  u_int64_t		pc_consumed;		///< Number of objects consumed
+};
+
+
+
+static int proginit(bk_s B, struct program_config *pc);
+static int progrun(bk_s B, struct program_config *pc);
+static int runone(bk_s B, struct program_config *pc, u_int nthreads, u_int batch);
+static void *producer(bk_s B, void *opaque);
+static void *consumer(bk_s B, void *opaque);
+static inline u_int64_t nsnow(void);
+
+
+
+/**
+ * Program entry point
+ *
+ *	@param argc Number of argv elements
+ *	@param argv Program name and arguments
+ *	@param envp Program environment
+ *	@return <i>0</i> Success
+ *	@return <br><i>1</i> Objects lost or duplicated
+ *	@return <br><i>254</i> Initialization failed
+ */
+int
+main(int argc, char **argv, char **envp)
+{
+  bk_s B = NULL;				/* Baka general structure */
+  BK_ENTRY_MAIN(B, __FUNCTION__, __FILE__, "test_queue");
+  int c;
+  int getopterr = 0;
+  struct program_config Pconfig, *pc = NULL;
+  poptContext optCon = NULL;
+  struct poptOption optionsTable[] =
+  {
+    {"debug", 'd', POPT_ARG_NONE, NULL, 'd', "Turn on debugging", NULL },
+    {"verbose", 'v', POPT_ARG_NONE, NULL, 'v', "Turn on verbose message", NULL },
+    {"count", 'c', POPT_ARG_INT, NULL, 'c', "Objects per producer", "count" },
+    {"size", 's', POPT_ARG_INT, NULL, 's', "Queue size", "size" },
+    {"threads", 't', POPT_ARG_INT, NULL, 't', "Largest number of threads to try", "threads" },
+    {"batch", 'b', POPT_ARG_INT, NULL, 'b', "Objects per batch operation", "batch" },
+    POPT_AUTOHELP
+    POPT_TABLEEND
+  };
+
+  if (!(B=bk_general_init(argc, &argv, &envp, BK_ENV_GWD(B, "BK_ENV_CONF_APP", BK_APP_CONF), NULL, ERRORQUEUE_DEPTH, LOG_USER, BK_GENERAL_THREADREADY)))
+  {
+    fprintf(stderr,"Could not perform basic initialization\n");
+    exit(254);
+  }
+  bk_fun_reentry(B);
+
+  pc = &Pconfig;
+  memset(pc, 0, sizeof(*pc));
+  pc->pc_count = DEFAULT_COUNT;
+  pc->pc_size = DEFAULT_SIZE;
+  pc->pc_maxthreads = DEFAULT_MAXTHREADS;
+  pc->pc_batch = DEFAULT_BATCH;
+
+  if (!(optCon = poptGetContext(NULL, argc, (const char **)argv, optionsTable, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not initialize options processing\n");
+    bk_exit(B, 254);
+  }
+
+  while ((c = poptGetNextOpt(optCon)) >= 0)
+  {
+    switch (c)
+    {
+    case 'd':					// debug
+      bk_error_config(B, BK_GENERAL_ERROR(B), 0, stderr, 0, 0, BK_ERROR_CONFIG_FH);	// Enable output of all error logs
+      bk_general_debug_config(B, stderr, BK_ERR_NONE, 0);				// Set up debugging, from config file
+      bk_debug_printf(B, "Debugging on\n");
+      break;
+    case 'v':					// verbose
+      BK_FLAG_SET(pc->pc_flags, PC_VERBOSE);
+      bk_error_config(B, BK_GENERAL_ERROR(B), ERRORQUEUE_DEPTH, stderr, BK_ERR_NONE, BK_ERR_ERR, 0);
+      break;
+    case 'c':
+      pc->pc_count = atoi(poptGetOptArg(optCon));
+      break;
+    case 's':
+      pc->pc_size = atoi(poptGetOptArg(optCon));
+      break;
+    case 't':
+      pc->pc_maxthreads = atoi(poptGetOptArg(optCon));
+      break;
+    case 'b':
+      pc->pc_batch = atoi(poptGetOptArg(optCon));
+      break;
+    default:
+      getopterr++;
+      break;
+    }
+  }
+
+  if (c < -1 || getopterr || !pc->pc_count || !pc->pc_size || !pc->pc_maxthreads || pc->pc_batch > MAX_BATCH)
+  {
+    if (c < -1)
+    {
+      fprintf(stderr, "%s\n", poptStrerror(c));
+    }
+    poptPrintUsage(optCon, stderr, 0);
+    bk_exit(B, 254);
+  }
+
+  if (proginit(B, pc) < 0)
+  {
+    bk_die(B, 254, stderr, "Could not perform program initialization\n", BK_FLAG_ISSET(pc->pc_flags, PC_VERBOSE)?BK_WARNDIE_WANTDETAILS:0);
+  }
+
+  bk_exit(B, progrun(B, pc) < 0 ? 1 : 0);
+  return(255);					// Stupid INSIGHT stuff.
+}
+
+
+
+/**
+ * General program initialization
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Total terminal failure
+ */
+static int proginit(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_queue");
+
+  if (!pc)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid argument\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (!BK_GENERAL_FLAG_ISTHREADREADY(B))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "libbk was not built with thread support\n");
+    BK_RETURN(B, -1);
+  }
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Run the single and batch tests for each thread count
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Some run lost or duplicated objects
+ */
+static int progrun(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_queue");
+  u_int nthreads;
+  int ret = 0;
+
+  printf("%8s %16s %16s\n", "threads", "single ops/s", "batch ops/s");
+
+  for (nthreads = 1; nthreads <= pc->pc_maxthreads; nthreads *= 2)
+  {
+    int single, batch = 0;
+
+    if ((single = runone(B, pc, nthreads, 0)) < 0)
+      ret = -1;
+    if (pc->pc_batch > 1 && (batch = runone(B, pc, nthreads, pc->pc_batch)) < 0)
+      ret = -1;
+
+    printf("%8u %16d %16d\n", nthreads, single, batch);
+    fflush(stdout);
+  }
+
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * One timed run.  With one thread we alternately fill and drain the queue
+ * from the main thread; otherwise half the threads produce and the rest
+ * consume.
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@param nthreads Total threads
+ *	@param batch Objects per operation (0 for single operations)
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>objects per second</i> on success
+ */
+static int runone(bk_s B, struct program_config *pc, u_int nthreads, u_int batch)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_queue");
+  pthread_t *threads[2 * DEFAULT_MAXTHREADS];
+  u_int nprod, ncons, nthr = 0, x;
+  u_int64_t start, elapsed, total, expected;
+
+  nprod = BK_MAX(nthreads / 2, 1);
+  ncons = BK_MAX(nthreads - nprod, 1);
+  if (nthreads > 1 && nprod + ncons > sizeof(threads) / sizeof(*threads))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Too many threads: %u\n", nthreads);
+    BK_RETURN(B, -1);
+  }
+
+  if (!(pc->pc_queue = bk_queue_create(B, pc->pc_size, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not create queue\n");
+    BK_RETURN(B, -1);
+  }
+  pc->pc_runbatch = batch;
+  pc->pc_nextid = 0;
+  pc->pc_sum = 0;
+  pc->pc_consumed = 0;
+  total = (u_int64_t)nprod * pc->pc_count;
+  expected = total * (total + 1) / 2;
+
+  start = nsnow();
+
+  if (nthreads == 1)
+  {
+    void *objs[MAX_BATCH];
+    u_int64_t next = 1;
+
+    while (next <= total)
+    {
+      int got;
+
+      // Fill
+      do
+      {
+	if (batch)
+	{
+	  for (x = 0; x < batch && next + x <= total; x++)
+	    objs[x] = (void *)(u_long)(next + x);
+	  got = bk_queue_enqueue_batch(B, pc->pc_queue, objs, x, 0);
+	}
+	else
+	  got = bk_queue_enqueue(B, pc->pc_queue, (void *)(u_long)next, 0);
+	next += BK_MAX(got, 0);
+      } while (got > 0 && next <= total);
+
+      // Drain
+      do
+      {
+	if (batch)
+	  got = bk_queue_dequeue_batch(B, pc->pc_queue, objs, batch, 0);
+	else
+	  got = bk_queue_dequeue(B, pc->pc_queue, objs, 0);
+	for (x = 0; got > 0 && x < (u_int)got; x++)
+	  pc->pc_sum += (u_long)objs[x];
+	pc->pc_consumed += BK_MAX(got, 0);
+      } while (got > 0);
+    }
+  }
+  else
+  {
+    for (x = 0; x < ncons; x++)
+    {
+      if (!(threads[nthr] = bk_general_thread_create(B, "consumer", consumer, pc, BK_THREAD_CREATE_FLAG_JOIN)))
+      {
+	bk_error_printf(B, BK_ERR_ERR, "Could not create consumer thread\n");
+	goto error;
+      }
+      nthr++;
+    }
+    for (x = 0; x < nprod; x++)
+    {
+      if (!(threads[nthr] = bk_general_thread_create(B, "producer", producer, pc, BK_THREAD_CREATE_FLAG_JOIN)))
+      {
+	bk_error_printf(B, BK_ERR_ERR, "Could not create producer thread\n");
+	goto error;
+      }
+      nthr++;
+    }
+
+    // Producers first, then let the consumers drain and leave
+    for (x = ncons; x < nthr; x++)
+      pthread_join(*threads[x], NULL);
+    bk_queue_close(B, pc->pc_queue, 0);
+    for (x = 0; x < ncons; x++)
+      pthread_join(*threads[x], NULL);
+    nthr = 0;
+  }
+
+  elapsed = BK_MAX(nsnow() - start, 1);
+  bk_queue_destroy(B, pc->pc_queue, 0);
+  pc->pc_queue = NULL;
+
+  if (pc->pc_consumed != total || pc->pc_sum != expected)
+  {
+    fprintf(stderr, "%u threads%s: consumed %llu of %llu objects, checksum %llu should be %llu\n", nthreads, batch?" (batch)":"",
+	    (unsigned long long)pc->pc_consumed, (unsigned long long)total, (unsigned long long)pc->pc_sum, (unsigned long long)expected);
+    BK_RETURN(B, -1);
+  }
+
+  if (BK_FLAG_ISSET(pc->pc_flags, PC_VERBOSE))
+    fprintf(stderr, "%u producers, %u consumers, batch %u: %llu objects in %llu ns\n", nprod, nthreads > 1 ? ncons : 0, batch,
+	    (unsigned long long)total, (unsigned long long)elapsed);
+
+  BK_RETURN(B, (int)BK_MIN(total * 1000000000 / elapsed, INT_MAX));
+
+ error:
+  bk_queue_close(B, pc->pc_queue, 0);
+  for (x = 0; x < nthr; x++)
+    pthread_join(*threads[x], NULL);
+  bk_queue_destroy(B, pc->pc_queue, 0);
+  pc->pc_queue = NULL;
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * Producer thread: queue values id*count+1 .. (id+1)*count, so that all
+ * producers together queue 1 .. nprod*count exactly once.
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param opaque Program configuration
+ *	@return <i>NULL</i> always
+ */
+static void *producer(bk_s B, void *opaque)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_queue");
+  struct program_config *pc = opaque;
+  void *objs[MAX_BATCH];
+  u_int64_t next, last;
+  u_int x;
+  int got;
+
+  next = (u_int64_t)__atomic_fetch_add(&pc->pc_nextid, 1, __ATOMIC_RELAXED) * pc->pc_count + 1;
+  last = next + pc->pc_count - 1;
+
+  while (next <= last)
+  {
+    if (pc->pc_runbatch)
+    {
+      for (x = 0; x < pc->pc_runbatch && next + x <= last; x++)
+	objs[x] = (void *)(u_long)(next + x);
+      got = bk_queue_enqueue_batch(B, pc->pc_queue, objs, x, BK_QUEUE_WAIT);
+    }
+    else
+      got = bk_queue_enqueue(B, pc->pc_queue, (void *)(u_long)next, BK_QUEUE_WAIT);
+
+    if (got < 0)
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Queue closed under producer\n");
+      break;
+    }
+    next += got;
+  }
+
+  BK_RETURN(B, NULL);
+}
+
+
+
+/**
+ * Consumer thread: drain until the queue is closed and empty.
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param opaque Program configuration
+ *	@return <i>NULL</i> always
+ */
+static void *consumer(bk_s B, void *opaque)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_queue");
+  struct program_config *pc = opaque;
+  void *objs[MAX_BATCH];
+  u_int64_t sum = 0, consumed = 0;
+  int got, x;
+
+  while (1)
+  {
+    if (pc->pc_runbatch)
+      got = bk_queue_dequeue_batch(B, pc->pc_queue, objs, pc->pc_runbatch, BK_QUEUE_WAIT);
+    else
+      got = bk_queue_dequeue(B, pc->pc_queue, objs, BK_QUEUE_WAIT);
+
+    if (got < 0)
+      break;
+
+    for (x = 0; x < got; x++)
+      sum += (u_long)objs[x];
+    consumed += got;
+  }
+
+  __atomic_add_fetch(&pc->pc_sum, sum, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&pc->pc_consumed, consumed, __ATOMIC_RELAXED);
+
+  BK_RETURN(B, NULL);
+}
+
+
+
+/**
+ * Monotonic time in nanoseconds, for throughput measurement
+ *
+ *	@return <i>nanoseconds</i> since some arbitrary point
+ */
+static inline u_int64_t nsnow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
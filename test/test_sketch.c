@@ -0,0 +1,518 @@
+#if !defined(lint)
+static const char libbk__copyright[] = "Copyright © 2001-2011";
+static const char libbk__contact[] = "<projectbaka@baka.org>";
+#endif /* not lint */
+/*
+ * ++Copyright BAKA++
+ *
+ * Copyright © 2001-2011 The Authors. All rights reserved.
+ *
+ * This source code is licensed to you under the terms of the file
+ * LICENSE.TXT in this release for further details.
+ *
+ * Send e-mail to <projectbaka@baka.org> for further information.
+ *
+ * - -Copyright BAKA- -
+ */
+
+/**
+ * @file
+ *
+ * Check and time the fixed-memory sketches: HyperLogLog distinct counts,
+ * count-min heavy hitters and DDSketch quantiles are fed a known stream,
+ * split across several shards which are then merged, and their answers
+ * checked against the error bounds; then the same sketches are checked
+ * through Cardinality, TopK and Quantile dynamic stats.
+ */
+#include <libbk.h>
+
+
+
+#define ERRORQUEUE_DEPTH	32		///< Default error queue depth
+#define DEFAULT_COUNT		1000000		///< Distinct keys / samples fed
+#define SHARDS			4		///< Sketches each stream is split across
+#define HEAVY			BK_TOPK_K_DEFAULT ///< Heavy hitters planted in the top-K stream
+#define HEAVY_WEIGHT		10000		///< Weight of the smallest heavy hitter
+#define HEAVY_CHUNK		100		///< Weight added to a heavy hitter at a time
+#define HLL_TOLERANCE		0.03		///< Allowed relative cardinality error (over 3 sigma)
+#define QUANTILE_TOLERANCE	0.011		///< Allowed relative quantile error (accuracy plus rank rounding)
+
+
+
+/**
+ * Information about basic program runtime configuration
+ * which must be passed around.
+ */
+struct program_config
+{
+  bk_flags		pc_flags;		///< Flags are fun!
+#define PC_VERBOSE	0x001			///< Verbose output
+  u_int			pc_count;		///< Distinct keys / samples fed
+};
+
+
+
+static int progrun(bk_s B, struct program_config *pc);
+static int cardinality(bk_s B, struct program_config *pc);
+static int topk(bk_s B, struct program_config *pc);
+static int quantile(bk_s B, struct program_config *pc);
+static int dynamic(bk_s B, struct program_config *pc);
+static inline u_int64_t nsnow(void);
+
+
+
+/**
+ * Program entry point
+ *
+ *	@param argc Number of argv elements
+ *	@param argv Program name and arguments
+ *	@param envp Program environment
+ *	@return <i>0</i> Success
+ *	@return <br><i>1</i> Some answer was out of bounds
+ *	@return <br><i>254</i> Initialization failed
+ */
+int
+main(int argc, char **argv, char **envp)
+{
+  bk_s B = NULL;				/* Baka general structure */
+  BK_ENTRY_MAIN(B, __FUNCTION__, __FILE__, "test_sketch");
+  int c;
+  int getopterr = 0;
+  struct program_config Pconfig, *pc = NULL;
+  poptContext optCon = NULL;
+  struct poptOption optionsTable[] =
+  {
+    {"debug", 'd', POPT_ARG_NONE, NULL, 'd', "Turn on debugging", NULL },
+    {"verbose", 'v', POPT_ARG_NONE, NULL, 'v', "Turn on verbose message", NULL },
+    {"count", 'c', POPT_ARG_INT, NULL, 'c', "Distinct keys / samples to feed", "count" },
+    POPT_AUTOHELP
+    POPT_TABLEEND
+  };
+
+  if (!(B=bk_general_init(argc, &argv, &envp, BK_ENV_GWD(B, "BK_ENV_CONF_APP", BK_APP_CONF), NULL, ERRORQUEUE_DEPTH, LOG_USER, 0)))
+  {
+    fprintf(stderr,"Could not perform basic initialization\n");
+    exit(254);
+  }
+  bk_fun_reentry(B);
+
+  pc = &Pconfig;
+  memset(pc, 0, sizeof(*pc));
+  pc->pc_count = DEFAULT_COUNT;
+
+  if (!(optCon = poptGetContext(NULL, argc, (const char **)argv, optionsTable, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not initialize options processing\n");
+    bk_exit(B, 254);
+  }
+
+  while ((c = poptGetNextOpt(optCon)) >= 0)
+  {
+    switch (c)
+    {
+    case 'd':					// debug
+      bk_error_config(B, BK_GENERAL_ERROR(B), 0, stderr, 0, 0, BK_ERROR_CONFIG_FH);	// Enable output of all error logs
+      bk_general_debug_config(B, stderr, BK_ERR_NONE, 0);				// Set up debugging, from config file
+      bk_debug_printf(B, "Debugging on\n");
+      break;
+    case 'v':					// verbose
+      BK_FLAG_SET(pc->pc_flags, PC_VERBOSE);
+      bk_error_config(B, BK_GENERAL_ERROR(B), ERRORQUEUE_DEPTH, stderr, BK_ERR_NONE, BK_ERR_ERR, 0);
+      break;
+    case 'c':
+      pc->pc_count = atoi(poptGetOptArg(optCon));
+      break;
+    default:
+      getopterr++;
+      break;
+    }
+  }
+
+  if (c < -1 || getopterr || pc->pc_count < 1000)
+  {
+    if (c < -1)
+    {
+      fprintf(stderr, "%s\n", poptStrerror(c));
+    }
+    poptPrintUsage(optCon, stderr, 0);
+    bk_exit(B, 254);
+  }
+
+  bk_exit(B, progrun(B, pc) < 0 ? 1 : 0);
+  return(255);					// Stupid INSIGHT stuff.
+}
+
+
+
+/**
+ * Run each check in turn
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Some check failed
+ */
+static int progrun(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_sketch");
+  int ret = 0;
+
+  if (cardinality(B, pc) < 0)
+    ret = -1;
+  if (topk(B, pc) < 0)
+    ret = -1;
+  if (quantile(B, pc) < 0)
+    ret = -1;
+  if (dynamic(B, pc) < 0)
+    ret = -1;
+
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Feed pc_count distinct keys, each twice, round robin across SHARDS
+ * estimators; merge them and check the estimate.  Also check that a
+ * small set is counted (nearly) exactly.
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int cardinality(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_sketch");
+  struct bk_hll *shard[SHARDS] = { NULL };
+  struct bk_hll *small = NULL;
+  u_int64_t start, addns, count;
+  u_int32_t key;
+  double error;
+  u_int x;
+  int ret = -1;
+
+  for (x = 0; x < SHARDS; x++)
+  {
+    if (!(shard[x] = bk_hll_create(B, 0, 0)))
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not create HyperLogLog\n");
+      goto error;
+    }
+  }
+
+  start = nsnow();
+  for (key = 0; key < 2 * pc->pc_count; key++)
+  {
+    u_int32_t addr = key % pc->pc_count;	// Each key twice
+
+    bk_hll_add(B, shard[key % SHARDS], &addr, sizeof(addr));
+  }
+  addns = nsnow() - start;
+
+  for (x = 1; x < SHARDS; x++)
+  {
+    if (bk_hll_merge(B, shard[0], shard[x], 0) < 0)
+    {
+      fprintf(stderr, "Could not merge HyperLogLog shards\n");
+      goto error;
+    }
+  }
+
+  count = bk_hll_count(B, shard[0]);
+  error = fabs((double)count - pc->pc_count) / pc->pc_count;
+  printf("cardinality: %u distinct, estimate %llu (%.2f%% off), %.2f ns/add\n",
+	 pc->pc_count, (unsigned long long)count, error * 100, (double)addns / (2 * pc->pc_count));
+  if (error > HLL_TOLERANCE)
+  {
+    fprintf(stderr, "Cardinality estimate is out of bounds\n");
+    goto error;
+  }
+
+  if (!(small = bk_hll_create(B, 0, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not create HyperLogLog\n");
+    goto error;
+  }
+  for (key = 0; key < 1000; key++)
+    bk_hll_add(B, small, &key, sizeof(key));
+  if ((count = bk_hll_count(B, small)) < 980 || count > 1020)
+  {
+    fprintf(stderr, "Small cardinality estimate %llu is not close to 1000\n", (unsigned long long)count);
+    goto error;
+  }
+
+  ret = 0;
+
+ error:
+  for (x = 0; x < SHARDS; x++)
+    bk_hll_destroy(B, shard[x]);
+  bk_hll_destroy(B, small);
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Feed pc_count background keys once each, then HEAVY keys with weights
+ * HEAVY_WEIGHT, 2*HEAVY_WEIGHT, ..., round robin across SHARDS trackers;
+ * merge them and check that exactly the heavy keys are reported, in
+ * order, with counts within the count-min bound.
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int topk(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_sketch");
+  struct bk_topk *shard[SHARDS] = { NULL };
+  struct bk_topk_item *items = NULL;
+  u_int64_t start, addns, total, slack, weight, adds = 0;
+  u_int32_t key;
+  u_int x, count;
+  int ret = -1;
+
+  for (x = 0; x < SHARDS; x++)
+  {
+    if (!(shard[x] = bk_topk_create(B, 0, 0, 0, 0, 0)))
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not create top-K tracker\n");
+      goto error;
+    }
+  }
+
+  // Heavy keys are numbered above the background keys, and arrive in HEAVY_CHUNK lots
+  start = nsnow();
+  for (key = 0; key < pc->pc_count; key++, adds++)
+    bk_topk_add(B, shard[adds % SHARDS], &key, sizeof(key), 1);
+  for (x = 0; x < HEAVY; x++)
+  {
+    key = pc->pc_count + x;
+    for (weight = 0; weight < (x + 1) * HEAVY_WEIGHT; weight += HEAVY_CHUNK, adds++)
+      bk_topk_add(B, shard[adds % SHARDS], &key, sizeof(key), HEAVY_CHUNK);
+  }
+  addns = nsnow() - start;
+
+  for (x = 1; x < SHARDS; x++)
+  {
+    if (bk_topk_merge(B, shard[0], shard[x], 0) < 0)
+    {
+      fprintf(stderr, "Could not merge top-K shards\n");
+      goto error;
+    }
+  }
+
+  if (!(items = bk_topk_list(B, shard[0], &count, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not list heavy hitters\n");
+    goto error;
+  }
+
+  total = bk_topk_total(B, shard[0]);
+  slack = total * 3 / BK_TOPK_WIDTH_DEFAULT;	// Comfortably over e/width
+  printf("top-K: %llu total weight, %u reported, %.2f ns/add\n", (unsigned long long)total, count, (double)addns / adds);
+
+  if (count != HEAVY)
+  {
+    fprintf(stderr, "Expected %u heavy hitters, got %u\n", HEAVY, count);
+    goto error;
+  }
+
+  for (x = 0; x < count; x++)
+  {
+    u_int32_t expect = pc->pc_count + HEAVY - 1 - x;
+
+    weight = (u_int64_t)(HEAVY - x) * HEAVY_WEIGHT;
+
+    if (BK_FLAG_ISSET(pc->pc_flags, PC_VERBOSE))
+      printf("\t%u: %llu (true %llu)\n", *(u_int32_t *)items[x].bti_key, (unsigned long long)items[x].bti_count, (unsigned long long)weight);
+
+    if (items[x].bti_keylen != sizeof(expect) || memcmp(items[x].bti_key, &expect, sizeof(expect)) ||
+	items[x].bti_count < weight || items[x].bti_count > weight + slack)
+    {
+      fprintf(stderr, "Heavy hitter %u is wrong\n", x);
+      goto error;
+    }
+  }
+
+  ret = 0;
+
+ error:
+  bk_topk_list_destroy(B, items);
+  for (x = 0; x < SHARDS; x++)
+    bk_topk_destroy(B, shard[x]);
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Feed the samples 1..pc_count in a scrambled order, round robin across
+ * SHARDS estimators; merge them and check some percentiles.
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int quantile(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_sketch");
+  struct bk_quantile *shard[SHARDS] = { NULL };
+  const double pcts[] = { 0, 1, 50, 90, 99, 99.9, 100 };
+  u_int64_t start, addns;
+  double value, expect;
+  u_int x;
+  int ret = -1;
+
+  for (x = 0; x < SHARDS; x++)
+  {
+    if (!(shard[x] = bk_quantile_create(B, 0, 0, 0)))
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not create quantile sketch\n");
+      goto error;
+    }
+  }
+
+  start = nsnow();
+  for (x = 0; x < pc->pc_count; x++)
+  {
+    // A stride coprime to the count visits every sample once, out of order
+    u_int64_t sample = ((u_int64_t)x * 7919) % pc->pc_count + 1;
+
+    if (pc->pc_count % 7919 == 0)
+      sample = x + 1;
+    bk_quantile_add(B, shard[x % SHARDS], sample);
+  }
+  addns = nsnow() - start;
+
+  for (x = 1; x < SHARDS; x++)
+  {
+    if (bk_quantile_merge(B, shard[0], shard[x], 0) < 0)
+    {
+      fprintf(stderr, "Could not merge quantile shards\n");
+      goto error;
+    }
+  }
+
+  printf("quantile: %llu samples, %.2f ns/add\n", (unsigned long long)bk_quantile_count(B, shard[0]), (double)addns / pc->pc_count);
+
+  for (x = 0; x < sizeof(pcts) / sizeof(*pcts); x++)
+  {
+    expect = 1 + floor(pcts[x] / 100 * (pc->pc_count - 1));
+    if (bk_quantile_get(B, shard[0], pcts[x], &value, 0) < 0)
+    {
+      fprintf(stderr, "Could not get percentile %.1f\n", pcts[x]);
+      goto error;
+    }
+    printf("\tp%-5g %14.2f (true %.0f)\n", pcts[x], value, expect);
+    if (fabs(value - expect) > expect * QUANTILE_TOLERANCE)
+    {
+      fprintf(stderr, "Percentile %g is out of bounds\n", pcts[x]);
+      goto error;
+    }
+  }
+
+  ret = 0;
+
+ error:
+  for (x = 0; x < SHARDS; x++)
+    bk_quantile_destroy(B, shard[x]);
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Check the sketches through dynamic stats: values by key and by plain
+ * set, the stat values, and the XML.
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int dynamic(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_sketch");
+  bk_dynamic_stats_h stats = NULL;
+  bk_dynamic_stat_h sources = NULL, talkers = NULL, latency = NULL;
+  bk_dynamic_stat_value_u value;
+  char *xml = NULL;
+  int64_t x;
+  int ret = -1;
+
+  if (!(stats = bk_dynamic_stats_create(B, 0)) ||
+      bk_dynamic_stat_register_simple(B, stats, "sources", 0, 0, DynamicStatsValueTypeCardinality, DynamicStatsAccessTypeDirect, NULL, NULL, NULL, &sources, 0) < 0 ||
+      bk_dynamic_stat_register_simple(B, stats, "talkers", 0, 0, DynamicStatsValueTypeTopK, DynamicStatsAccessTypeDirect, NULL, NULL, NULL, &talkers, 0) < 0 ||
+      bk_dynamic_stat_register_simple(B, stats, "latency", 0, 0, DynamicStatsValueTypeQuantile, DynamicStatsAccessTypeDirect, NULL, NULL, NULL, &latency, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not create sketch stats\n");
+    goto error;
+  }
+
+  for (x = 1; x <= 100; x++)
+  {
+    bk_dynamic_stat_handle_set(B, sources, x % 50, 0);	// Each source twice
+    bk_dynamic_stat_handle_observe(B, talkers, "quiet", 5, 1, 0);
+    bk_dynamic_stat_handle_set(B, latency, x, 0);
+  }
+  bk_dynamic_stat_handle_observe(B, talkers, "loud", 4, 1000, 0);
+
+  if (bk_dynamic_stat_get(B, stats, "sources", 0, NULL, &value, NULL, NULL, NULL, 0) < 0 || value.bdsv_int64 < 49 || value.bdsv_int64 > 51)
+  {
+    fprintf(stderr, "Cardinality stat is wrong\n");
+    goto error;
+  }
+  if (bk_dynamic_stat_get(B, stats, "talkers", 0, NULL, &value, NULL, NULL, NULL, 0) < 0 || value.bdsv_int64 != 1100)
+  {
+    fprintf(stderr, "TopK stat is wrong\n");
+    goto error;
+  }
+  if (bk_dynamic_stat_get(B, stats, "latency", 0, NULL, &value, NULL, NULL, NULL, 0) < 0 || value.bdsv_int64 != 100 ||
+      bk_quantile_count(B, bk_dynamic_stat_sketch(B, latency, 0)) != 100)
+  {
+    fprintf(stderr, "Quantile stat is wrong\n");
+    goto error;
+  }
+
+  if (!(xml = bk_dynamic_stats_XML_create(B, stats, 0, "", 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not create XML\n");
+    goto error;
+  }
+  if (BK_FLAG_ISSET(pc->pc_flags, PC_VERBOSE))
+    printf("%s", xml);
+  // "loud" is 6c6f7564 in hex
+  if (!strstr(xml, "top=\"6c6f7564:1000 7175696574:100\"") || !strstr(xml, "p50=\"") || !strstr(xml, "max=\"100.0000\""))
+  {
+    fprintf(stderr, "Sketch stat XML is wrong:\n%s", xml);
+    goto error;
+  }
+
+  ret = 0;
+
+ error:
+  if (xml)
+    bk_dynamic_stats_XML_destroy(B, xml, 0);
+  if (stats)
+    bk_dynamic_stats_destroy(B, stats);
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * Monotonic time in nanoseconds, for throughput measurement
+ *
+ *	@return <i>nanoseconds</i> since some arbitrary point
+ */
+static inline u_int64_t nsnow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
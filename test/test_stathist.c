@@ -0,0 +1,254 @@
+#if !defined(lint)
+static const char libbk__copyright[] = "Copyright © 2011";
+static const char libbk__contact[] = "<projectbaka@baka.org>";
+#endif /* not lint */
+/*
+ * ++Copyright BAKA++
+ *
+ * Copyright © 2011 The Authors. All rights reserved.
+ *
+ * This source code is licensed to you under the terms of the file
+ * LICENSE.TXT in this release for further details.
+ *
+ * Send e-mail to <projectbaka@baka.org> for further information.
+ *
+ * - -Copyright BAKA- -
+ */
+
+/**
+ * @file
+ *
+ * Check bk_stat latency histograms: record known distributions, check
+ * that percentiles are within the histogram's precision, check that
+ * merged nodes agree with a node which saw everything, and print the
+ * dump with its percentile columns.
+ */
+#include <libbk.h>
+
+
+
+#define ERRORQUEUE_DEPTH	32		///< Default error queue depth
+#define DEFAULT_COUNT		1000000		///< Samples recorded
+#define PRECISION		(1.0 / 32)	///< Relative error allowed
+
+
+
+/**
+ * Information about basic program runtime configuration
+ * which must be passed around.
+ */
+struct program_config
+{
+  bk_flags		pc_flags;		///< Flags are fun!
+#define PC_VERBOSE	0x001			///< Verbose output
+#define PC_HTML		0x002			///< Dump as HTML
+  u_int			pc_count;		///< Samples recorded
+};
+
+
+
+static int progrun(bk_s B, struct program_config *pc);
+static int check(bk_s B, struct bk_stat_list *blist, const char *name, double pct, u_quad_t expect);
+
+
+
+/**
+ * Program entry point
+ *
+ *	@param argc Number of argv elements
+ *	@param argv Program name and arguments
+ *	@param envp Program environment
+ *	@return <i>0</i> Success
+ *	@return <br><i>1</i> Percentiles were wrong
+ *	@return <br><i>254</i> Initialization failed
+ */
+int
+main(int argc, char **argv, char **envp)
+{
+  bk_s B = NULL;				/* Baka general structure */
+  BK_ENTRY_MAIN(B, __FUNCTION__, __FILE__, "test_stathist");
+  int c;
+  int getopterr = 0;
+  struct program_config Pconfig, *pc = NULL;
+  poptContext optCon = NULL;
+  struct poptOption optionsTable[] =
+  {
+    {"debug", 'd', POPT_ARG_NONE, NULL, 'd', "Turn on debugging", NULL },
+    {"verbose", 'v', POPT_ARG_NONE, NULL, 'v', "Turn on verbose message", NULL },
+    {"count", 'c', POPT_ARG_INT, NULL, 'c', "Samples to record", "count" },
+    {"html", 'H', POPT_ARG_NONE, NULL, 'H', "Dump as HTML", NULL },
+    POPT_AUTOHELP
+    POPT_TABLEEND
+  };
+
+  if (!(B=bk_general_init(argc, &argv, &envp, BK_ENV_GWD(B, "BK_ENV_CONF_APP", BK_APP_CONF), NULL, ERRORQUEUE_DEPTH, LOG_USER, 0)))
+  {
+    fprintf(stderr,"Could not perform basic initialization\n");
+    exit(254);
+  }
+  bk_fun_reentry(B);
+
+  pc = &Pconfig;
+  memset(pc, 0, sizeof(*pc));
+  pc->pc_count = DEFAULT_COUNT;
+
+  if (!(optCon = poptGetContext(NULL, argc, (const char **)argv, optionsTable, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not initialize options processing\n");
+    bk_exit(B, 254);
+  }
+
+  while ((c = poptGetNextOpt(optCon)) >= 0)
+  {
+    switch (c)
+    {
+    case 'd':					// debug
+      bk_error_config(B, BK_GENERAL_ERROR(B), 0, stderr, 0, 0, BK_ERROR_CONFIG_FH);	// Enable output of all error logs
+      bk_general_debug_config(B, stderr, BK_ERR_NONE, 0);				// Set up debugging, from config file
+      bk_debug_printf(B, "Debugging on\n");
+      break;
+    case 'v':					// verbose
+      BK_FLAG_SET(pc->pc_flags, PC_VERBOSE);
+      bk_error_config(B, BK_GENERAL_ERROR(B), ERRORQUEUE_DEPTH, stderr, BK_ERR_NONE, BK_ERR_ERR, 0);
+      break;
+    case 'c':
+      pc->pc_count = atoi(poptGetOptArg(optCon));
+      break;
+    case 'H':
+      BK_FLAG_SET(pc->pc_flags, PC_HTML);
+      break;
+    default:
+      getopterr++;
+      break;
+    }
+  }
+
+  if (c < -1 || getopterr || pc->pc_count < 1000)
+  {
+    if (c < -1)
+    {
+      fprintf(stderr, "%s\n", poptStrerror(c));
+    }
+    poptPrintUsage(optCon, stderr, 0);
+    bk_exit(B, 254);
+  }
+
+  bk_exit(B, progrun(B, pc) < 0 ? 1 : 0);
+  return(255);					// Stupid INSIGHT stuff.
+}
+
+
+
+/**
+ * Record, check, merge, and dump
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Failure
+ */
+static int progrun(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_stathist");
+  struct bk_stat_list *blist;
+  struct bk_stat_node *half[2] = { NULL, NULL };
+  double pcts[] = { 50.0, 99.0, 99.9, 99.99 };
+  u_quad_t whole, merged;
+  char *dump;
+  u_int x;
+  int ret = 0;
+
+  if (!(blist = bk_stat_create(B, BK_STATS_HISTOGRAM)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not create histogram list\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (bk_stat_percentiles_set(B, blist, pcts, sizeof(pcts) / sizeof(*pcts), 0) < 0 ||
+      !(half[0] = bk_stat_node_create(B, "half", "0", BK_STATS_HISTOGRAM)) ||
+      !(half[1] = bk_stat_node_create(B, "half", "1", BK_STATS_HISTOGRAM)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not set up histograms\n");
+    goto error;
+  }
+
+  for (x = 1; x <= pc->pc_count; x++)
+  {
+    // Uniform 1..count; and a fast path with a slow tail of 0.1%
+    bk_stat_add(B, blist, "uniform", NULL, x, 0);
+    bk_stat_add(B, blist, "tail", NULL, x % 1000 ? 100 : 100000, 0);
+    bk_stat_node_add(B, half[x & 1], x, 0);
+  }
+
+  if (check(B, blist, "uniform", 50.0, pc->pc_count / 2) < 0 ||
+      check(B, blist, "uniform", 99.0, pc->pc_count / 100 * 99) < 0 ||
+      check(B, blist, "tail", 99.0, 100) < 0 ||
+      check(B, blist, "tail", 99.95, 100000) < 0)
+    ret = -1;
+
+  bk_stat_node_merge(B, half[0], half[1], 0);
+  for (x = 0; x < sizeof(pcts) / sizeof(*pcts); x++)
+  {
+    if (bk_stat_percentile(B, blist, "uniform", NULL, pcts[x], &whole, 0) < 0 ||
+	bk_stat_node_percentile(B, half[0], pcts[x], &merged, 0) < 0 ||
+	whole != merged)
+    {
+      fprintf(stderr, "Merged p%g is %llu, not %llu\n", pcts[x], (unsigned long long)merged, (unsigned long long)whole);
+      ret = -1;
+    }
+  }
+
+  if (!(dump = bk_stat_dump(B, blist, BK_FLAG_ISSET(pc->pc_flags, PC_HTML)?BK_STAT_DUMP_HTML:0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not dump statistics\n");
+    goto error;
+  }
+  fputs(dump, stdout);
+  free(dump);
+
+  bk_stat_node_destroy(B, half[0]);
+  bk_stat_node_destroy(B, half[1]);
+  bk_stat_destroy(B, blist);
+  BK_RETURN(B, ret);
+
+ error:
+  if (half[0])
+    bk_stat_node_destroy(B, half[0]);
+  if (half[1])
+    bk_stat_node_destroy(B, half[1]);
+  bk_stat_destroy(B, blist);
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * Check one percentile against what it should be
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param blist Statistics list
+ *	@param name Node name
+ *	@param pct Percentile
+ *	@param expect Exact percentile of what was recorded
+ *	@return <i>0</i> Within precision
+ *	@return <br><i>-1</i> Wrong
+ */
+static int check(bk_s B, struct bk_stat_list *blist, const char *name, double pct, u_quad_t expect)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_stathist");
+  u_quad_t got;
+
+  if (bk_stat_percentile(B, blist, name, NULL, pct, &got, 0) < 0)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not get p%g of %s\n", pct, name);
+    BK_RETURN(B, -1);
+  }
+
+  if (got < expect || got > expect + expect * PRECISION)
+  {
+    fprintf(stderr, "%s p%g is %llu, expected %llu\n", name, pct, (unsigned long long)got, (unsigned long long)expect);
+    BK_RETURN(B, -1);
+  }
+
+  BK_RETURN(B, 0);
+}
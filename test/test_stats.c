@@ -47,6 +47,7 @@ struct bk_dynamic_stats_list
   bk_recursive_lock_h		bdsl_rlock;	///< Lock out other threads (recursive lock)
   bk_flags			bdsl_flags;	///< Everyone needs flags
 #define BDSL_FLAG_RLOCK_INITIALIZED	0x1	// Indicates whether the mutex has been initialized.
+  struct bk_dynamic_stat *	bdsl_retired;	///< Deregistered stats (handles may still be in use)
 };
 
 
@@ -0,0 +1,334 @@
+#if !defined(lint)
+static const char libbk__copyright[] = "Copyright © 2001-2011";
+static const char libbk__contact[] = "<projectbaka@baka.org>";
+#endif /* not lint */
+/*
+ * ++Copyright BAKA++
+ *
+ * Copyright © 2001-2011 The Authors. All rights reserved.
+ *
+ * This source code is licensed to you under the terms of the file
+ * LICENSE.TXT in this release for further details.
+ *
+ * Send e-mail to <projectbaka@baka.org> for further information.
+ *
+ * - -Copyright BAKA- -
+ */
+
+/**
+ * @file
+ *
+ * Check and time recording into one bk_stat node from many threads at
+ * once, with the usual per-node lock and with BK_STATS_SHARDED, checking
+ * that nothing recorded is lost.
+ */
+#include <libbk.h>
+
+
+
+#define ERRORQUEUE_DEPTH	32		///< Default error queue depth
+#define DEFAULT_COUNT		1000000		///< Intervals recorded per thread
+#define DEFAULT_MAXTHREADS	32		///< Largest thread count tried
+#define VALUE_RANGE		1000		///< Recorded values are 1 .. VALUE_RANGE
+
+
+
+/**
+ * Information about basic program runtime configuration
+ * which must be passed around.
+ */
+struct program_config
+{
+  bk_flags		pc_flags;		///< Flags are fun!
+#define PC_VERBOSE	0x001			///< Verbose output
+#define PC_HISTOGRAM	0x002			///< Keep histograms too
+  u_int			pc_count;		///< Intervals recorded per thread
+  u_int			pc_maxthreads;		///< Largest thread count tried
+  struct bk_stat_node  *pc_node;		///< Node under test
+};
+
+
+
+static int proginit(bk_s B, struct program_config *pc);
+static int progrun(bk_s B, struct program_config *pc);
+static int runone(bk_s B, struct program_config *pc, u_int nthreads, bk_flags createflags);
+static void *recorder(bk_s B, void *opaque);
+static inline u_int64_t nsnow(void);
+
+
+
+/**
+ * Program entry point
+ *
+ *	@param argc Number of argv elements
+ *	@param argv Program name and arguments
+ *	@param envp Program environment
+ *	@return <i>0</i> Success
+ *	@return <br><i>1</i> Intervals lost
+ *	@return <br><i>254</i> Initialization failed
+ */
+int
+main(int argc, char **argv, char **envp)
+{
+  bk_s B = NULL;				/* Baka general structure */
+  BK_ENTRY_MAIN(B, __FUNCTION__, __FILE__, "test_statshard");
+  int c;
+  int getopterr = 0;
+  struct program_config Pconfig, *pc = NULL;
+  poptContext optCon = NULL;
+  struct poptOption optionsTable[] =
+  {
+    {"debug", 'd', POPT_ARG_NONE, NULL, 'd', "Turn on debugging", NULL },
+    {"verbose", 'v', POPT_ARG_NONE, NULL, 'v', "Turn on verbose message", NULL },
+    {"count", 'c', POPT_ARG_INT, NULL, 'c', "Intervals recorded per thread", "count" },
+    {"threads", 't', POPT_ARG_INT, NULL, 't', "Largest number of threads to try", "threads" },
+    {"histogram", 'H', POPT_ARG_NONE, NULL, 'H', "Keep latency histograms too", NULL },
+    POPT_AUTOHELP
+    POPT_TABLEEND
+  };
+
+  if (!(B=bk_general_init(argc, &argv, &envp, BK_ENV_GWD(B, "BK_ENV_CONF_APP", BK_APP_CONF), NULL, ERRORQUEUE_DEPTH, LOG_USER, BK_GENERAL_THREADREADY)))
+  {
+    fprintf(stderr,"Could not perform basic initialization\n");
+    exit(254);
+  }
+  bk_fun_reentry(B);
+
+  pc = &Pconfig;
+  memset(pc, 0, sizeof(*pc));
+  pc->pc_count = DEFAULT_COUNT;
+  pc->pc_maxthreads = DEFAULT_MAXTHREADS;
+
+  if (!(optCon = poptGetContext(NULL, argc, (const char **)argv, optionsTable, 0)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not initialize options processing\n");
+    bk_exit(B, 254);
+  }
+
+  while ((c = poptGetNextOpt(optCon)) >= 0)
+  {
+    switch (c)
+    {
+    case 'd':					// debug
+      bk_error_config(B, BK_GENERAL_ERROR(B), 0, stderr, 0, 0, BK_ERROR_CONFIG_FH);	// Enable output of all error logs
+      bk_general_debug_config(B, stderr, BK_ERR_NONE, 0);				// Set up debugging, from config file
+      bk_debug_printf(B, "Debugging on\n");
+      break;
+    case 'v':					// verbose
+      BK_FLAG_SET(pc->pc_flags, PC_VERBOSE);
+      bk_error_config(B, BK_GENERAL_ERROR(B), ERRORQUEUE_DEPTH, stderr, BK_ERR_NONE, BK_ERR_ERR, 0);
+      break;
+    case 'c':
+      pc->pc_count = atoi(poptGetOptArg(optCon));
+      break;
+    case 't':
+      pc->pc_maxthreads = atoi(poptGetOptArg(optCon));
+      break;
+    case 'H':
+      BK_FLAG_SET(pc->pc_flags, PC_HISTOGRAM);
+      break;
+    default:
+      getopterr++;
+      break;
+    }
+  }
+
+  // Keep the total within bk_stat_node_info's u_int count
+  if (c < -1 || getopterr || !pc->pc_count || !pc->pc_maxthreads || (u_int64_t)pc->pc_count * pc->pc_maxthreads > UINT_MAX)
+  {
+    if (c < -1)
+    {
+      fprintf(stderr, "%s\n", poptStrerror(c));
+    }
+    poptPrintUsage(optCon, stderr, 0);
+    bk_exit(B, 254);
+  }
+
+  if (proginit(B, pc) < 0)
+  {
+    bk_die(B, 254, stderr, "Could not perform program initialization\n", BK_FLAG_ISSET(pc->pc_flags, PC_VERBOSE)?BK_WARNDIE_WANTDETAILS:0);
+  }
+
+  bk_exit(B, progrun(B, pc) < 0 ? 1 : 0);
+  return(255);					// Stupid INSIGHT stuff.
+}
+
+
+
+/**
+ * General program initialization
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Total terminal failure
+ */
+static int proginit(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_statshard");
+
+  if (!pc)
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Invalid argument\n");
+    BK_RETURN(B, -1);
+  }
+
+  if (!BK_GENERAL_FLAG_ISTHREADREADY(B))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "libbk was not built with thread support\n");
+    BK_RETURN(B, -1);
+  }
+
+  BK_RETURN(B, 0);
+}
+
+
+
+/**
+ * Run the locked and sharded tests for each thread count
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@return <i>0</i> Success
+ *	@return <br><i>-1</i> Some run lost intervals
+ */
+static int progrun(bk_s B, struct program_config *pc)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_statshard");
+  bk_flags createflags = BK_FLAG_ISSET(pc->pc_flags, PC_HISTOGRAM)?BK_STATS_HISTOGRAM:0;
+  u_int nthreads;
+  int ret = 0;
+
+  printf("%8s %16s %16s\n", "threads", "locked ns/op", "sharded ns/op");
+
+  for (nthreads = 1; nthreads <= pc->pc_maxthreads; nthreads *= 2)
+  {
+    int locked, sharded;
+
+    if ((locked = runone(B, pc, nthreads, createflags)) < 0)
+      ret = -1;
+    if ((sharded = runone(B, pc, nthreads, createflags | BK_STATS_SHARDED)) < 0)
+      ret = -1;
+
+    printf("%8u %16.2f %16.2f\n", nthreads, locked / 100.0, sharded / 100.0);
+    fflush(stdout);
+  }
+
+  BK_RETURN(B, ret);
+}
+
+
+
+/**
+ * One timed run: every thread records pc_count intervals into the same
+ * node, after which the node must hold all of them.
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param pc Program configuration
+ *	@param nthreads Recording threads
+ *	@param createflags Flags for bk_stat_node_create
+ *	@return <i>-1</i> on failure
+ *	@return <br><i>hundredths of a nanosecond</i> of wall time per interval per thread on success
+ */
+static int runone(bk_s B, struct program_config *pc, u_int nthreads, bk_flags createflags)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_statshard");
+  pthread_t *threads[DEFAULT_MAXTHREADS];
+  u_int nthr = 0, count, x;
+  u_quad_t minusec, maxusec, sumusec, expected;
+  u_int64_t start, elapsed;
+
+  if (nthreads > sizeof(threads) / sizeof(*threads))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Too many threads: %u\n", nthreads);
+    BK_RETURN(B, -1);
+  }
+
+  if (!(pc->pc_node = bk_stat_node_create(B, "statshard", NULL, createflags)))
+  {
+    bk_error_printf(B, BK_ERR_ERR, "Could not create performance node\n");
+    BK_RETURN(B, -1);
+  }
+
+  start = nsnow();
+
+  for (x = 0; x < nthreads; x++)
+  {
+    if (!(threads[nthr] = bk_general_thread_create(B, "recorder", recorder, pc, BK_THREAD_CREATE_FLAG_JOIN)))
+    {
+      bk_error_printf(B, BK_ERR_ERR, "Could not create recorder thread\n");
+      goto error;
+    }
+    nthr++;
+  }
+  for (x = 0; x < nthr; x++)
+    pthread_join(*threads[x], NULL);
+  nthr = 0;
+
+  elapsed = BK_MAX(nsnow() - start, 1);
+
+  bk_stat_node_info(B, pc->pc_node, &minusec, &maxusec, &sumusec, &count, 0);
+  bk_stat_node_destroy(B, pc->pc_node);
+  pc->pc_node = NULL;
+
+  // Each thread records 1 .. VALUE_RANGE over and over
+  expected = (u_quad_t)(pc->pc_count / VALUE_RANGE) * VALUE_RANGE * (VALUE_RANGE + 1) / 2;
+  expected += (u_quad_t)(pc->pc_count % VALUE_RANGE) * (pc->pc_count % VALUE_RANGE + 1) / 2;
+  expected *= nthreads;
+
+  if (count != nthreads * pc->pc_count || sumusec != expected || minusec != 1 || maxusec != BK_MIN(pc->pc_count, VALUE_RANGE))
+  {
+    fprintf(stderr, "%u threads%s: recorded %u of %u intervals, sum %llu should be %llu, range %llu-%llu\n", nthreads, BK_FLAG_ISSET(createflags, BK_STATS_SHARDED)?" (sharded)":"",
+	    count, nthreads * pc->pc_count, (unsigned long long)sumusec, (unsigned long long)expected, (unsigned long long)minusec, (unsigned long long)maxusec);
+    BK_RETURN(B, -1);
+  }
+
+  if (BK_FLAG_ISSET(pc->pc_flags, PC_VERBOSE))
+    fprintf(stderr, "%u threads%s: %u intervals in %llu ns\n", nthreads, BK_FLAG_ISSET(createflags, BK_STATS_SHARDED)?" (sharded)":"",
+	    count, (unsigned long long)elapsed);
+
+  BK_RETURN(B, (int)BK_MIN(elapsed * 100 / pc->pc_count, INT_MAX));
+
+ error:
+  for (x = 0; x < nthr; x++)
+    pthread_join(*threads[x], NULL);
+  bk_stat_node_destroy(B, pc->pc_node);
+  pc->pc_node = NULL;
+  BK_RETURN(B, -1);
+}
+
+
+
+/**
+ * Recorder thread: record pc_count intervals of 1 .. VALUE_RANGE usec
+ *
+ *	@param B BAKA Thread/Global configuration
+ *	@param opaque Program configuration
+ *	@return <i>NULL</i> always
+ */
+static void *recorder(bk_s B, void *opaque)
+{
+  BK_ENTRY(B, __FUNCTION__,__FILE__,"test_statshard");
+  struct program_config *pc = opaque;
+  u_int x;
+
+  for (x = 0; x < pc->pc_count; x++)
+    bk_stat_node_add(B, pc->pc_node, x % VALUE_RANGE + 1, 0);
+
+  BK_RETURN(B, NULL);
+}
+
+
+
+/**
+ * Monotonic time in nanoseconds, for throughput measurement
+ *
+ *	@return <i>nanoseconds</i> since some arbitrary point
+ */
+static inline u_int64_t nsnow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}